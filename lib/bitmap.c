@@ -149,7 +149,7 @@ int bitmap_set(bitmap *bm, unsigned long pos)
 
 	if (!bm)
 		return 0;
-	if (l > bm->alloc)
+	if (l >= bm->alloc)
 		return -1;
 
 	bm->vector[l] |= (1 << bit);
@@ -162,7 +162,7 @@ int bitmap_isset(const bitmap *bm, unsigned long pos)
 	const int bit = pos & MAPMASK;
 	int set;
 
-	if (!bm || l > bm->alloc)
+	if (!bm || l >= bm->alloc)
 		return 0;
 
 	set = !!(bm->vector[l] & (1 << bit));
@@ -4,36 +4,90 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 
-/**
- * The struct that represents a single buffer in the nm_bufferqueue.
- */
-struct bufferqueue_buffer {
-	char *bqb_buf; /* the data */
-	unsigned long bqb_offset; /* where we're reading in the buffer */
-	unsigned long bqb_bufsize; /* the amount of data in this buffer in total */
-	struct bufferqueue_buffer *bqb_next; /* link to the next buffer after this */
-};
+/* the smallest ring we allocate */
+#define BQ_MIN_SIZE 4096
+/* how much free space we make sure to have before every read */
+#define BQ_READ_SIZE 16384
+/* rings larger than this are released when they run empty */
+#define BQ_KEEP_SIZE (1 << 20)
+/* longest delimiter we remember a scan cursor for */
+#define BQ_DELIM_MAX 16
 
 /**
- * The struct that represents a whole bufferqueue. It contains bufferqueue_buffer
+ * The struct that represents a whole bufferqueue.
+ *
+ * The data lives in a single ring of bq_size bytes, where bq_size is
+ * always a power of two. Unread data starts at bq_head and wraps around
+ * the end of the ring, so it is always at most two contiguous segments,
+ * which is what we hand to readv() and writev().
  */
 struct nm_bufferqueue {
-	struct bufferqueue_buffer *bq_front; /**< A pointer to the head of the queue. */
-	struct bufferqueue_buffer *bq_back; /**< A pointer to the tail of the queue. */
+	char *bq_buf; /**< The ring itself */
+	size_t bq_size; /**< Size of the ring. 0 until something is pushed */
+	size_t bq_head; /**< Offset of the first unread byte in the ring */
 	size_t bq_available; /**< The number of bytes in this bq. */
+	size_t bq_scanned; /**< Bytes from the head known not to start bq_delim */
+	size_t bq_delim_len; /**< Length of bq_delim, 0 if there's no cursor */
+	char bq_delim[BQ_DELIM_MAX]; /**< The delimiter bq_scanned applies to */
 };
 
-static struct bufferqueue_buffer *bufferqueue_buffer_create(void)
+/*
+ * Fill in (at most two) iovecs describing len bytes of the ring,
+ * starting off bytes past the head. Returns the number of iovecs used.
+ */
+static int bq_iov(nm_bufferqueue *bq, size_t off, size_t len, struct iovec *iov)
+{
+	size_t start, first;
+
+	if (!len)
+		return 0;
+
+	start = (bq->bq_head + off) & (bq->bq_size - 1);
+	first = bq->bq_size - start;
+	if (first > len)
+		first = len;
+	iov[0].iov_base = bq->bq_buf + start;
+	iov[0].iov_len = first;
+	if (first == len)
+		return 1;
+	iov[1].iov_base = bq->bq_buf;
+	iov[1].iov_len = len - first;
+	return 2;
+}
+
+static inline char bq_byte(nm_bufferqueue *bq, size_t off)
 {
-	return calloc(1, sizeof(struct bufferqueue_buffer));
+	return bq->bq_buf[(bq->bq_head + off) & (bq->bq_size - 1)];
 }
 
-static void bufferqueue_buffer_destroy(struct bufferqueue_buffer *buffer)
+/*
+ * Make sure there's room for at least need more bytes, growing the ring
+ * if there isn't. Growing straightens out the data, so the head is at
+ * the start of the new ring afterwards.
+ */
+static int bq_reserve(nm_bufferqueue *bq, size_t need)
 {
-	free(buffer->bqb_buf);
-	buffer->bqb_buf = NULL;
-	free(buffer);
+	size_t size = bq->bq_size ? bq->bq_size : BQ_MIN_SIZE;
+	char *buf;
+
+	while (size - bq->bq_available < need) {
+		if (size << 1 < size)
+			return -1;
+		size <<= 1;
+	}
+	if (size == bq->bq_size)
+		return 0;
+
+	if ((buf = malloc(size)) == NULL)
+		return -1;
+	nm_bufferqueue_peek(bq, bq->bq_available, buf);
+	free(bq->bq_buf);
+	bq->bq_buf = buf;
+	bq->bq_size = size;
+	bq->bq_head = 0;
+	return 0;
 }
 
 nm_bufferqueue *nm_bufferqueue_create()
@@ -48,11 +102,7 @@ void nm_bufferqueue_destroy(nm_bufferqueue *bq)
 	if (!bq)
 		return;
 
-	while (bq->bq_front) {
-		struct bufferqueue_buffer *buffer = bq->bq_front->bqb_next;
-		bufferqueue_buffer_destroy(bq->bq_front);
-		bq->bq_front = buffer;
-	}
+	free(bq->bq_buf);
 	free(bq);
 }
 
@@ -66,68 +116,41 @@ size_t nm_bufferqueue_get_available(nm_bufferqueue *bq)
 
 int nm_bufferqueue_peek(nm_bufferqueue *bq, size_t size, void *buffer)
 {
-	size_t used = 0; /* bytes used across all buffers - counts up towards initial size as size shrinks to 0 */
-	size_t left_in_buffer = 0; /* size left per buffer - after the first, this should be bytes in buffer */
-	struct bufferqueue_buffer *current_buf;
+	struct iovec iov[2];
+	int i, n;
+
 	if (!bq || bq->bq_available < size)
 		return -1;
-	if (!size)
+	if (!size || !buffer)
 		return 0;
-	current_buf = bq->bq_front;
-
-	while ((left_in_buffer = current_buf->bqb_bufsize - current_buf->bqb_offset) <= size) {
-		if (buffer)
-			memcpy(
-			    buffer + used,
-			    current_buf->bqb_buf + current_buf->bqb_offset,
-			    left_in_buffer);
-		current_buf = current_buf->bqb_next;
-		size -= left_in_buffer;
-		used += left_in_buffer;
-		if (!current_buf) {
-			if (!size)
-				return 0;
-			else
-				return -1;
-		}
-	}
 
-	if (size) {
-		if (buffer)
-			memcpy(
-			    buffer + used,
-			    current_buf->bqb_buf + current_buf->bqb_offset,
-			    size);
+	n = bq_iov(bq, 0, size, iov);
+	for (i = 0; i < n; i++) {
+		memcpy(buffer, iov[i].iov_base, iov[i].iov_len);
+		buffer = (char *)buffer + iov[i].iov_len;
 	}
-
 	return 0;
 }
 
 int nm_bufferqueue_drop(nm_bufferqueue *bq, size_t size)
 {
-	size_t left_in_buffer = 0;
 	if (!bq || bq->bq_available < size)
 		return -1;
 	if (!size)
 		return 0;
-	while ((left_in_buffer = bq->bq_front->bqb_bufsize - bq->bq_front->bqb_offset) <= size) {
-		struct bufferqueue_buffer *new_head = bq->bq_front->bqb_next;
-		size -= left_in_buffer;
-		bufferqueue_buffer_destroy(bq->bq_front);
-		bq->bq_front = new_head;
-		bq->bq_available -= left_in_buffer;
-		if (!bq->bq_front) {
-			bq->bq_back = NULL;
-			if (!size)
-				return 0;
-			else
-				return -1;
-		}
-	}
 
-	if (size) {
-		bq->bq_front->bqb_offset += size;
-		bq->bq_available -= size;
+	bq->bq_head = (bq->bq_head + size) & (bq->bq_size - 1);
+	bq->bq_available -= size;
+	bq->bq_scanned = bq->bq_scanned > size ? bq->bq_scanned - size : 0;
+
+	if (!bq->bq_available) {
+		/* start over at the front so the next read gets one segment */
+		bq->bq_head = 0;
+		if (bq->bq_size > BQ_KEEP_SIZE) {
+			free(bq->bq_buf);
+			bq->bq_buf = NULL;
+			bq->bq_size = 0;
+		}
 	}
 	return 0;
 }
@@ -142,147 +165,166 @@ int nm_bufferqueue_unshift(nm_bufferqueue *bq, size_t size, void *buffer)
 	return was_error;
 }
 
-static int is_delim_match(struct bufferqueue_buffer *buffer, const char *position, const char *delim, size_t delim_len)
+static int is_delim_match(nm_bufferqueue *bq, size_t off, const char *delim, size_t delim_len)
 {
-	size_t matches;
-	for (matches = 0; matches < delim_len; matches++) {
-		if ((unsigned long)position + (unsigned long)matches >= (unsigned long)buffer->bqb_buf + (unsigned long)buffer->bqb_bufsize) {
-			if (buffer->bqb_next == NULL)
-				return 0;
-			buffer = buffer->bqb_next;
-			position = buffer->bqb_buf - matches;
-		}
-		if (position[matches] != delim[matches]) {
+	size_t i;
+	for (i = 1; i < delim_len; i++) {
+		if (bq_byte(bq, off + i) != delim[i])
 			return 0;
-		}
 	}
 	return 1;
 }
 
+/*
+ * Find the offset of the first delimiter at or after off, or return
+ * limit if there is none. Only candidate start bytes below limit are
+ * considered.
+ */
+static size_t find_delim(nm_bufferqueue *bq, size_t off, size_t limit, const char *delim, size_t delim_len)
+{
+	while (off < limit) {
+		struct iovec iov[2];
+		char *ptr = NULL;
+		int i, n;
+
+		n = bq_iov(bq, off, limit - off, iov);
+		for (i = 0; i < n; i++) {
+			if ((ptr = memchr(iov[i].iov_base, *delim, iov[i].iov_len)) != NULL) {
+				off += ptr - (char *)iov[i].iov_base;
+				break;
+			}
+			off += iov[i].iov_len;
+		}
+		if (!ptr)
+			return limit;
+		if (is_delim_match(bq, off, delim, delim_len))
+			return off;
+		off++;
+	}
+	return limit;
+}
+
 int nm_bufferqueue_unshift_to_delim(nm_bufferqueue *bq, const char *delim, size_t delim_len, size_t *size, void **buffer)
 {
-	struct bufferqueue_buffer *bqbuffer;
+	size_t start = 0, limit, off;
 
 	if (!buffer)
 		return -1;
 	else
 		*buffer = NULL;
 
-	if (!bq || !bq->bq_front)
+	if (!bq || !bq->bq_available || !delim_len)
 		return -1;
 
 	*size = 0;
 
-	bqbuffer = bq->bq_front;
-
-	while (bqbuffer) {
-		char *ptr = NULL;
-		size_t remains = bqbuffer->bqb_bufsize - bqbuffer->bqb_offset;
-		char *buf = bqbuffer->bqb_buf + bqbuffer->bqb_offset;
-		while (remains) {
-			unsigned long jump;
-			size_t ioc_start;
-
-			ptr = memchr(buf, *delim, remains);
-			if (!ptr) {
-				break;
-			}
-			if (!is_delim_match(bqbuffer, ptr, delim, delim_len)) {
-				jump = 1 + (unsigned long)ptr - (unsigned long)buf;
-				remains -= jump;
-				buf += jump;
-				continue;
-			}
-			/* it was a delimiter match, so return it */
+	if (bq->bq_available < delim_len)
+		return -1;
 
-			ioc_start = (size_t)bqbuffer->bqb_buf + bqbuffer->bqb_offset;
-			*size += (size_t)ptr - ioc_start;
-			*size += delim_len;
+	/*
+	 * Everything before the cursor was scanned the last time we were
+	 * asked for this delimiter, so there's no point looking there again
+	 */
+	if (bq->bq_delim_len == delim_len && !memcmp(bq->bq_delim, delim, delim_len))
+		start = bq->bq_scanned;
+
+	limit = bq->bq_available - delim_len + 1;
+	off = find_delim(bq, start, limit, delim, delim_len);
+	if (off == limit) {
+		if (delim_len <= BQ_DELIM_MAX) {
+			memcpy(bq->bq_delim, delim, delim_len);
+			bq->bq_delim_len = delim_len;
+			bq->bq_scanned = limit;
+		}
+		return -1;
+	}
 
-			if ((*buffer = calloc(*size, 1)) == NULL)
-				return -1;
+	/* it was a delimiter match, so return it */
+	*size = off + delim_len;
+	if ((*buffer = malloc(*size)) == NULL)
+		return -1;
 
-			if (nm_bufferqueue_unshift(bq, *size, *buffer)) {
-				/* we fucked up */
-				free(*buffer);
-				*buffer = NULL;
-				return -1;
-			}
-			return 0;
-		}
-		*size += bqbuffer->bqb_bufsize - bqbuffer->bqb_offset;
-		bqbuffer = bqbuffer->bqb_next;
+	if (nm_bufferqueue_unshift(bq, *size, *buffer)) {
+		free(*buffer);
+		*buffer = NULL;
+		return -1;
 	}
-	return -1;
+	return 0;
 }
 
 int nm_bufferqueue_read(nm_bufferqueue *bq, int fd)
 {
-	char *buffer;
-	int avail = 0;
+	size_t want = BQ_READ_SIZE;
+	int total = 0;
 
-	if (ioctl(fd, FIONREAD, &avail) < 0) {
+	if (!bq)
 		return -1;
-	}
-
-	if (avail == 0) {
-		/* EOF or EAGAIN? With a bit of luck, read() will fail and tell us.
-		 * Without luck, it was EAGAIN, but now it isn't,
-		 * so we have to deal with that, too...
-		 */
-		char failbuf[128];
-		avail = read(fd, failbuf, 128);
-		if (avail > 0)
-			nm_bufferqueue_push(bq, failbuf, avail);
-		return avail;
-	}
 
-	if ((buffer = malloc(avail)) == NULL) {
-		errno = -ENOMEM;
-		return -1;
-	}
+	for (;;) {
+		struct iovec iov[2];
+		size_t room;
+		ssize_t ret;
+		int pending = 0;
+
+		if (bq_reserve(bq, want)) {
+			if (total)
+				return total;
+			errno = ENOMEM;
+			return -1;
+		}
 
-	if (read(fd, buffer, avail) < 0) {
-		return -1;
-	}
+		room = bq->bq_size - bq->bq_available;
+		ret = readv(fd, iov, bq_iov(bq, bq->bq_available, room, iov));
+		if (ret <= 0) {
+			/* report what we got now, and EOF or errors next time */
+			if (total)
+				return total;
+			return ret;
+		}
+		bq->bq_available += ret;
+		total += ret;
 
-	if (nm_bufferqueue_push_block(bq, buffer, avail)) {
-		errno = -ENOMEM;
-		free(buffer);
-		return -1;
+		/*
+		 * A short read means we've drained the fd. If we filled the
+		 * ring there may be more, but we only ask for it if it's
+		 * already there, since fd may well be blocking.
+		 */
+		if ((size_t)ret < room)
+			return total;
+		if (ioctl(fd, FIONREAD, &pending) < 0 || pending <= 0)
+			return total;
+		want = pending;
 	}
-	return avail;
 }
 
 int nm_bufferqueue_push_block(nm_bufferqueue *bq, void *buf, size_t len)
 {
-	struct bufferqueue_buffer *buffer;
-	if (len == 0)
-		return 0;
-	buffer = bufferqueue_buffer_create();
-	buffer->bqb_buf = buf;
-	buffer->bqb_bufsize = len;
-	if (!bq->bq_front) {
-		bq->bq_front = bq->bq_back = buffer;
-	} else {
-		bq->bq_back->bqb_next = buffer;
-		bq->bq_back = buffer;
-	}
-	bq->bq_available += len;
-	return 0;
+	int ret = nm_bufferqueue_push(bq, buf, len);
+	if (!ret)
+		free(buf);
+	return ret;
 }
 
 int nm_bufferqueue_push(nm_bufferqueue *bq, const void *buf, size_t len)
 {
-	char *internal_buf;
+	struct iovec iov[2];
+	int i, n;
+
 	if (!bq)
 		return -1;
 	if (len == 0)
 		return 0;
 
-	internal_buf = calloc(len, 1);
-	memcpy(internal_buf, buf, len);
-	return nm_bufferqueue_push_block(bq, internal_buf, len);
+	if (bq_reserve(bq, len))
+		return -1;
+
+	n = bq_iov(bq, bq->bq_available, len, iov);
+	for (i = 0; i < n; i++) {
+		memcpy(iov[i].iov_base, buf, iov[i].iov_len);
+		buf = (const char *)buf + iov[i].iov_len;
+	}
+	bq->bq_available += len;
+	return 0;
 }
 
 int nm_bufferqueue_write(nm_bufferqueue *bq, int fd)
@@ -293,17 +335,17 @@ int nm_bufferqueue_write(nm_bufferqueue *bq, int fd)
 	if (!bq)
 		return -1;
 
-	if (!bq->bq_front)
+	if (!bq->bq_available)
 		return 0;
 
 	if (fd < 0)
 		return -1;
 
-	while (bq->bq_front) {
-		char *buf = bq->bq_front->bqb_buf + bq->bq_front->bqb_offset;
-		size_t len = bq->bq_front->bqb_bufsize - bq->bq_front->bqb_offset;
+	while (bq->bq_available) {
+		struct iovec iov[2];
+		ssize_t new_sent;
 
-		int new_sent = write(fd, buf, len);
+		new_sent = writev(fd, iov, bq_iov(bq, 0, bq->bq_available, iov));
 		if (new_sent < 0) {
 			if (errno == EINTR) {
 				continue;
@@ -316,7 +358,7 @@ int nm_bufferqueue_write(nm_bufferqueue *bq, int fd)
 		}
 		sent += new_sent;
 
-		nm_bufferqueue_unshift(bq, new_sent, NULL);
+		nm_bufferqueue_drop(bq, new_sent);
 	}
 
 	return sent;
@@ -14,12 +14,16 @@ NAGIOS_BEGIN_DECL
 
 /**
  * @file bufferqueue.h
- * @brief A simple queue of buffers of binary data
+ * @brief A simple queue of binary data
  *
  * The bufferqueue library is intended for working with sockets.
  * It accepts/reads data as it becomes available, and returns/sends
  * it on demand.
  *
+ * Data is kept in a single growable ring buffer, so reads and writes
+ * are done with readv()/writev() straight into and out of the ring,
+ * without allocating anything per call.
+ *
  * You should generally not use this directly, but instead use the iobroker
  * to push and poll data across sockets.
  *
@@ -63,8 +67,8 @@ void nm_bufferqueue_destroy(nm_bufferqueue *bq);
 int nm_bufferqueue_push(nm_bufferqueue *bq, const void *buf, size_t len);
 
 /**
- * Like nm_bufferqueue_push, except it doesn't copy all the data - instead,
- * it takes over ownership of buf.
+ * Like nm_bufferqueue_push, except it takes over ownership of buf,
+ * which is freed once its contents have been queued.
  *
  * @param[in] bq The bufferqueue to append the data to
  * @param[in] buf The buffer we should use
@@ -116,6 +120,10 @@ int nm_bufferqueue_unshift(nm_bufferqueue *bq, size_t size, void *buffer);
  *
  * The returned size and data will include the trailing delimiter.
  *
+ * The bufferqueue remembers how far it got looking for the last
+ * delimiter it was asked about, so calling this repeatedly as more
+ * data arrives doesn't rescan what has already been looked at.
+ *
  * @param[in] bq The bufferqueue to use data from
  * @param[in] delim The delimiter
  * @param[in] delim_len Length of the delimiter
@@ -129,7 +137,7 @@ int nm_bufferqueue_unshift_to_delim(nm_bufferqueue *bq, const char *delim, size_
  * Read data into the bufferqueue.
  * @param[in] bq The bufferqueue we should read into
  * @param[in] fd The filedescriptor we should read from
- * @return The number of bytes read on success. < 0 on errors
+ * @return The number of bytes read on success, 0 on EOF. < 0 on errors
  */
 int nm_bufferqueue_read(nm_bufferqueue *bq, int fd);
 
@@ -7,6 +7,8 @@
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/uio.h>
 #include "iobroker.h"
 #include "bufferqueue.h"
 
@@ -36,6 +38,10 @@
 #include <sys/select.h>
 #endif
 
+#ifndef IOV_MAX
+# define IOV_MAX 16 /* the least POSIX guarantees */
+#endif
+
 #if defined(IOBROKER_USES_EPOLL) && defined(IOBROKER_USES_POLL)
 # error "iobroker can't use both epoll() and poll()"
 #elif defined(IOBROKER_USES_EPOLL) && defined(IOBROKER_USES_SELECT)
@@ -44,17 +50,22 @@
 # error "iobroker can't use both poll() and select()"
 #endif
 
-typedef struct {
+typedef struct iobroker_fd {
 	int fd; /* the file descriptor */
 	int events; /* events the caller is interested in */
 	int (*handler)(int, int, void *); /* where we send data */
 	void *arg; /* the argument we send to the input handler */
+	int (*out_handler)(int, int, void *); /* called when output won't block */
+	void *out_arg; /* the argument we send to the output handler */
 	nm_bufferqueue *bq_out;
+	int dirty; /* set if bq_out has data we couldn't send yet */
+	struct iobroker_fd *next_dirty, *prev_dirty;
 } iobroker_fd;
 
 
 struct iobroker_set {
 	iobroker_fd **iobroker_fds;
+	iobroker_fd *dirty_fds; /* the ones with output waiting to be sent */
 	int max_fds; /* max number of sockets we can accept */
 	int num_fds; /* number of sockets we're currently brokering for */
 #ifdef IOBROKER_USES_EPOLL
@@ -185,6 +196,78 @@ error_out:
 	return NULL;
 }
 
+#ifdef IOBROKER_USES_EPOLL
+static int set_epoll_events(iobroker_set *iobs, iobroker_fd *s, int events)
+{
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.fd = s->fd;
+	return epoll_ctl(iobs->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+#endif
+
+/*
+ * Sockets with output we couldn't send right away are kept on a list,
+ * and are polled for writability until they've caught up, so pushing
+ * pending data only ever has to look at the sockets that have any.
+ */
+static void mark_dirty(iobroker_set *iobs, iobroker_fd *s)
+{
+	if (s->dirty)
+		return;
+	s->dirty = 1;
+	s->prev_dirty = NULL;
+	s->next_dirty = iobs->dirty_fds;
+	if (iobs->dirty_fds)
+		iobs->dirty_fds->prev_dirty = s;
+	iobs->dirty_fds = s;
+#ifdef IOBROKER_USES_EPOLL
+	if (!(s->events & EPOLLOUT) && !s->out_handler)
+		set_epoll_events(iobs, s, s->events | EPOLLOUT);
+#endif
+}
+
+static void unlink_dirty(iobroker_set *iobs, iobroker_fd *s)
+{
+	if (!s->dirty)
+		return;
+	s->dirty = 0;
+	if (s->prev_dirty)
+		s->prev_dirty->next_dirty = s->next_dirty;
+	else
+		iobs->dirty_fds = s->next_dirty;
+	if (s->next_dirty)
+		s->next_dirty->prev_dirty = s->prev_dirty;
+	s->next_dirty = s->prev_dirty = NULL;
+}
+
+static void mark_clean(iobroker_set *iobs, iobroker_fd *s)
+{
+	if (!s->dirty)
+		return;
+	unlink_dirty(iobs, s);
+#ifdef IOBROKER_USES_EPOLL
+	if (!(s->events & EPOLLOUT) && !s->out_handler)
+		set_epoll_events(iobs, s, s->events);
+#endif
+}
+
+/*
+ * send as much pending output as the socket will take. Returns
+ * -errno if the socket is broken, for the caller to report
+ */
+static int flush_one(iobroker_set *iobs, iobroker_fd *s)
+{
+	int ret;
+
+	ret = nm_bufferqueue_write(s->bq_out, s->fd);
+	if (nm_bufferqueue_get_available(s->bq_out))
+		mark_dirty(iobs, s);
+	else
+		mark_clean(iobs, s);
+	return ret;
+}
+
 static int reg_one(iobroker_set *iobs, int fd, int events, void *arg, int (*handler)(int, int, void *))
 {
 	iobroker_fd *s;
@@ -244,6 +327,28 @@ int iobroker_register_out(iobroker_set *iobs, int fd, void *arg, int (*handler)(
 #endif
 }
 
+int iobroker_set_output_handler(iobroker_set *iobs, int fd, void *arg, int (*handler)(int, int, void *))
+{
+	iobroker_fd *s;
+
+	if (!iobs)
+		return IOBROKER_ENOSET;
+	if (fd < 0 || fd >= iobs->max_fds || !iobs->iobroker_fds[fd])
+		return IOBROKER_EINVAL;
+
+	s = iobs->iobroker_fds[fd];
+#ifdef IOBROKER_USES_EPOLL
+	/* only bother the kernel when we start or stop caring */
+	if (!(s->events & EPOLLOUT) && !s->dirty && !s->out_handler != !handler) {
+		if (set_epoll_events(iobs, s, handler ? s->events | EPOLLOUT : s->events) < 0)
+			return IOBROKER_ELIB;
+	}
+#endif
+	s->out_handler = handler;
+	s->out_arg = arg;
+	return 0;
+}
+
 int iobroker_is_registered(iobroker_set *iobs, int fd)
 {
 	if (!iobs || fd < 0 || fd > iobs->max_fds || !iobs->iobroker_fds[fd])
@@ -263,6 +368,7 @@ int iobroker_unregister(iobroker_set *iobs, int fd)
 	if (fd < 0 || fd >= iobs->max_fds || !iobs->iobroker_fds[fd])
 		return IOBROKER_EINVAL;
 
+	unlink_dirty(iobs, iobs->iobroker_fds[fd]);
 	nm_bufferqueue_destroy(iobs->iobroker_fds[fd]->bq_out);
 	iobs->iobroker_fds[fd]->bq_out = NULL;
 
@@ -369,7 +475,24 @@ int iobroker_poll(iobroker_set *iobs, int timeout)
 		s = iobs->iobroker_fds[fd];
 
 		if (s) {
-			s->handler(fd, iobs->ep_events[i].events, s->arg);
+			int events = iobs->ep_events[i].events;
+
+			if ((events & EPOLLOUT) && s->dirty)
+				flush_one(iobs, s);
+			/* our own backlog goes first, then the owner's */
+			if ((events & EPOLLOUT) && !s->dirty && s->out_handler) {
+				s->out_handler(fd, events, s->out_arg);
+				/* the output handler may have closed it */
+				if (!(s = iobs->iobroker_fds[fd]))
+					continue;
+			}
+			/* don't bother input handlers with our own writability */
+			if (!(s->events & EPOLLOUT)) {
+				events &= ~EPOLLOUT;
+				if (!events)
+					continue;
+			}
+			s->handler(fd, events, s->arg);
 			ret++;
 		}
 	}
@@ -381,39 +504,52 @@ int iobroker_poll(iobroker_set *iobs, int timeout)
 	 * used if epoll() or poll() doesn't work properly.
 	 */
 	{
-		fd_set read_fds;
+		fd_set read_fds, write_fds;
 		int num_fds = 0;
 		struct timeval tv;
+		iobroker_fd *s, *next;
 
 		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		for (s = iobs->dirty_fds; s; s = s->next_dirty)
+			FD_SET(s->fd, &write_fds);
 		for (i = 0; i < iobs->max_fds; i++) {
 			if (!iobs->iobroker_fds[i])
 				continue;
 			num_fds++;
 			FD_SET(iobs->iobroker_fds[i]->fd, &read_fds);
+			if (iobs->iobroker_fds[i]->out_handler)
+				FD_SET(iobs->iobroker_fds[i]->fd, &write_fds);
 			if (num_fds == iobs->num_fds)
 				break;
 		}
 		if (timeout >= 0) {
 			tv.tv_sec = timeout / 1000;
 			tv.tv_usec = (timeout % 1000) * 1000;
-			nfds = select(iobs->max_fds, &read_fds, NULL, NULL, &tv);
+			nfds = select(iobs->max_fds, &read_fds, &write_fds, NULL, &tv);
 		} else { /* timeout of -1 means poll indefinitely */
-			nfds = select(iobs->max_fds, &read_fds, NULL, NULL, NULL);
+			nfds = select(iobs->max_fds, &read_fds, &write_fds, NULL, NULL);
 		}
 		if (nfds < 0) {
 			return IOBROKER_ELIB;
 		}
+		for (s = iobs->dirty_fds; s; s = next) {
+			next = s->next_dirty;
+			if (FD_ISSET(s->fd, &write_fds))
+				flush_one(iobs, s);
+		}
 		num_fds = 0;
 		for (i = 0; i < iobs->max_fds; i++) {
 			if (!iobs->iobroker_fds[i])
 				continue;
-			if (FD_ISSET(iobs->iobroker_fds[i]->fd, &read_fds)) {
-				iobroker_fd *s = iobs->iobroker_fds[i];
-				if (!s) {
-					/* this should be logged somehow */
+			s = iobs->iobroker_fds[i];
+			if (s->out_handler && !s->dirty && FD_ISSET(s->fd, &write_fds)) {
+				s->out_handler(s->fd, POLLOUT, s->out_arg);
+				if (!iobs->iobroker_fds[i])
 					continue;
-				}
+			}
+			if (FD_ISSET(iobs->iobroker_fds[i]->fd, &read_fds)) {
+				s = iobs->iobroker_fds[i];
 				s->handler(s->fd, POLLIN, s->arg);
 				ret++;
 			}
@@ -432,6 +568,8 @@ int iobroker_poll(iobroker_set *iobs, int timeout)
 				continue;
 			iobs->pfd[p].fd = iobs->iobroker_fds[i]->fd;
 			iobs->pfd[p].events = POLLIN;
+			if (iobs->iobroker_fds[i]->dirty || iobs->iobroker_fds[i]->out_handler)
+				iobs->pfd[p].events |= POLLOUT;
 			p++;
 		}
 		nfds = poll(iobs->pfd, iobs->num_fds, timeout);
@@ -440,11 +578,19 @@ int iobroker_poll(iobroker_set *iobs, int timeout)
 		}
 		for (i = 0; i < iobs->num_fds; i++) {
 			iobroker_fd *s;
+
+			s = iobs->iobroker_fds[iobs->pfd[i].fd];
+			if (s && s->dirty && (iobs->pfd[i].revents & POLLOUT))
+				flush_one(iobs, s);
+			if (s && !s->dirty && s->out_handler && (iobs->pfd[i].revents & POLLOUT)) {
+				s->out_handler(s->fd, (int)iobs->pfd[i].revents, s->out_arg);
+				s = iobs->iobroker_fds[iobs->pfd[i].fd];
+			}
+
 			if ((iobs->pfd[i].revents & POLLIN) != POLLIN) {
 				continue;
 			}
 
-			s = iobs->iobroker_fds[iobs->pfd[i].fd];
 			if (!s) {
 				/* this should be logged somehow */
 				continue;
@@ -460,35 +606,87 @@ int iobroker_poll(iobroker_set *iobs, int timeout)
 
 int iobroker_push(iobroker_set *iobs)
 {
-	int i, result = 1;
+	iobroker_fd *s, *next;
 
 	if (!iobs)
 		return 1;
 
-	for (i = 0; i < iobs->max_fds; i++) {
-		iobroker_fd *s = NULL;
-
-		if (!iobs->iobroker_fds[i])
-			continue;
-
-		s = iobs->iobroker_fds[i];
-		if (s->fd > 0 && nm_bufferqueue_get_available(s->bq_out)) {
-			int ret;
-			result = 0;
-			ret = nm_bufferqueue_write(s->bq_out, s->fd);
-			if (ret < 0) {
-				/* TODO: can't log() in lib */
-			}
-		}
+	for (s = iobs->dirty_fds; s; s = next) {
+		next = s->next_dirty;
+		flush_one(iobs, s);
 	}
-	return result;
+	return iobs->dirty_fds == NULL;
 }
 
 int iobroker_write_packet(iobroker_set *iobs, int fd, char *buf, size_t len)
 {
 	int ret = 0;
-	if ((ret = nm_bufferqueue_push(iobs->iobroker_fds[fd]->bq_out, buf, len)))
+	iobroker_fd *s = iobs->iobroker_fds[fd];
+
+	if ((ret = nm_bufferqueue_push(s->bq_out, buf, len)))
+		return ret;
+
+	/*
+	 * Anything that was queued before has to go first, and if there was
+	 * anything, we're already waiting for the socket to become writable
+	 */
+	if (!s->dirty && (ret = flush_one(iobs, s)) < 0)
 		return ret;
-	/* horrible idea? */
-	return iobroker_push(iobs);
+	return 0;
+}
+
+int iobroker_write_packetv(iobroker_set *iobs, int fd, const struct iovec *iov, int iovcnt)
+{
+	iobroker_fd *s = iobs->iobroker_fds[fd];
+	size_t offset = 0;
+	ssize_t sent;
+	int i = 0, ret, partial;
+
+	/* if there's a backlog, the new data has to wait its turn */
+	while (!s->dirty && i < iovcnt) {
+		struct iovec vec[IOV_MAX];
+		size_t total = 0;
+		int j, cnt = iovcnt - i > IOV_MAX ? IOV_MAX : iovcnt - i;
+
+		for (j = 0; j < cnt; j++) {
+			vec[j] = iov[i + j];
+			total += vec[j].iov_len;
+		}
+		vec[0].iov_base = (char *)vec[0].iov_base + offset;
+		vec[0].iov_len -= offset;
+		total -= offset;
+
+		sent = writev(fd, vec, cnt);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -errno;
+			/* the rest goes into the backlog */
+			break;
+		}
+
+		/* skip past whatever was sent */
+		partial = (size_t)sent < total;
+		while (i < iovcnt && (size_t)sent >= iov[i].iov_len - offset) {
+			sent -= iov[i].iov_len - offset;
+			offset = 0;
+			i++;
+		}
+		offset += sent;
+
+		/* the socket is full, so leave the rest for later */
+		if (partial)
+			break;
+	}
+
+	for (; i < iovcnt; i++, offset = 0) {
+		if (iov[i].iov_len <= offset)
+			continue;
+		if ((ret = nm_bufferqueue_push(s->bq_out, (char *)iov[i].iov_base + offset, iov[i].iov_len - offset)))
+			return ret;
+	}
+	if (nm_bufferqueue_get_available(s->bq_out))
+		mark_dirty(iobs, s);
+	return 0;
 }
@@ -6,6 +6,7 @@
 #endif
 
 #include "lnae-utils.h"
+#include <sys/uio.h>
 
 /**
  * @file iobroker.h
@@ -105,6 +106,23 @@ extern int iobroker_register(iobroker_set *iobs, int sd, void *arg, int (*handle
  */
 extern int iobroker_register_out(iobroker_set *iobs, int sd, void *arg, int (*handler)(int, int, void *));
 
+/**
+ * Set or clear the output handler of a socket already registered
+ * with the broker. While one is set, the socket is polled for
+ * writability as well as for input, and the handler is called when
+ * writing to it won't block and any data queued by
+ * iobroker_write_packet() has been sent. This is meant for callers
+ * that keep their own output queue, and they should clear it again
+ * once they've caught up, or the socket will keep waking the loop.
+ *
+ * @param iobs The socket set the socket is registered with
+ * @param sd The socket descriptor
+ * @param arg Argument passed to the output handler
+ * @param handler The function to call when output won't block, or NULL
+ * @return 0 on success. < 0 on errors
+ */
+extern int iobroker_set_output_handler(iobroker_set *iobs, int sd, void *arg, int (*handler)(int, int, void *));
+
 /**
  * Check if a particular filedescriptor is registered with the iobroker set
  * @param[in] iobs The iobroker set the filedescriptor should be member of
@@ -175,9 +193,10 @@ extern void iobroker_destroy(iobroker_set *iobs, int flags);
  */
 extern int iobroker_poll(iobroker_set *iobs, int timeout);
 /**
- * Push any pending outgoing data
+ * Push any pending outgoing data. Sockets that can't take all of it
+ * right away are flushed by iobroker_poll() once they become writable.
  * @param iobs The socket set to push everything in.
- * @returns 0 if any data was pushed, non-zero otherwise
+ * @returns 0 if some data is still waiting to be sent, non-zero otherwise
  */
 int iobroker_push(iobroker_set *iobs);
 
@@ -190,10 +209,27 @@ int iobroker_push(iobroker_set *iobs);
  * @param[in] fd The socket descriptor to add data to. Must be registered in the set.
  * @param[in] buf The data to send. Binary-safe.
  * @param[in] len The length of the data.
- * @returns 0 if everything worked, non-zero otherwise
+ * @returns 0 if everything worked, non-zero otherwise. A broken socket
+ *          gives -errno, which iobroker_strerror() can describe.
  */
 int iobroker_write_packet(iobroker_set *iobs, int fd, char *buf, size_t len);
 
+/**
+ * Like iobroker_write_packet(), but gathers the data from several
+ * buffers, so a whole batch of messages can be sent off with a single
+ * writev(2). Whatever the socket won't take right away is copied and
+ * sent by iobroker_poll() when it becomes writable, so the buffers
+ * may be reused as soon as this returns.
+ *
+ * @param[in] iobs The socket set to send data to
+ * @param[in] fd The socket descriptor to add data to. Must be registered in the set.
+ * @param[in] iov The buffers to send, in order
+ * @param[in] iovcnt The number of buffers in iov
+ * @returns 0 if everything worked, non-zero otherwise. A broken socket
+ *          gives -errno, which iobroker_strerror() can describe.
+ */
+int iobroker_write_packetv(iobroker_set *iobs, int fd, const struct iovec *iov, int iovcnt);
+
 NAGIOS_END_DECL
 #endif /* INCLUDE_iobroker_h__ */
 /** @} */
@@ -13,6 +13,13 @@
  * Care has been taken to make sure the functions are async-safe. The one
  * function which isn't is runcmd_init() which it doesn't make sense to
  * call twice anyway, so the api as a whole should be considered async-safe.
+ * runcmd_open() keeps a cache of parsed command lines though, so it must
+ * not be called from several threads at once.
+ *
+ * Commands are started with posix_spawn(), which on modern systems uses
+ * vfork() semantics and so doesn't have to copy the page tables of a
+ * large parent. fork() is only used when posix_spawn() fails, so that a
+ * command that can't be executed still reports why on its stderr.
  *
  */
 
@@ -27,6 +34,8 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include "runcmd.h"
 
 
@@ -68,6 +77,22 @@ static int maxfd = 0;
 # endif /* _SC_OPEN_MAX */
 #endif /* OPEN_MAX */
 
+/* set to 0 to always fork(). Only the tests have a reason to */
+static int use_spawn = 1;
+
+/*
+ * Checks run the same command lines over and over, so we keep the
+ * argument vectors of the most recently used ones around instead of
+ * tokenizing them on every run. The cache is direct-mapped on a hash
+ * of the command line, so a collision simply evicts the older entry.
+ */
+#define ARGV_CACHE_SIZE 1024
+static struct argv_cache_entry {
+	char *cmd;
+	char **argv;
+	int cmd2strv_errors;
+} argv_cache[ARGV_CACHE_SIZE];
+
 
 const char *runcmd_strerror(int code)
 {
@@ -323,30 +348,28 @@ void runcmd_init(void)
 }
 
 
-/* Start running a command */
-int runcmd_open(const char *cmd, int *pfd, int *pfderr, char **env)
+static void free_argv(char **argv, int cmd2strv_errors)
 {
-	char **argv = NULL;
-	int cmd2strv_errors, argc = 0;
-	size_t cmdlen;
-	pid_t pid;
-
-	int i = 0;
-
-	if (!pids)
-		runcmd_init();
+	if (!argv)
+		return;
+	if (!cmd2strv_errors)
+		free(argv[0]);
+	else
+		free(argv[2]);
+	free(argv);
+}
 
-	/* if no command was passed, return with no error */
-	if (!*cmd)
-		return RUNCMD_EINVAL;
+static char **cmd2argv(const char *cmd, int *cmd2strv_errors)
+{
+	char **argv, **shrunk;
+	int argc = 0;
 
-	cmdlen = strlen(cmd);
-	argv = calloc((cmdlen / 2) + 5, sizeof(char *));
+	argv = calloc((strlen(cmd) / 2) + 5, sizeof(char *));
 	if (!argv)
-		return RUNCMD_EALLOC;
+		return NULL;
 
-	cmd2strv_errors = runcmd_cmd2strv(cmd, &argc, argv);
-	if (cmd2strv_errors) {
+	*cmd2strv_errors = runcmd_cmd2strv(cmd, &argc, argv);
+	if (*cmd2strv_errors) {
 		/*
 		 * if there are complications, we fall back to running
 		 * the command via the shell
@@ -357,36 +380,135 @@ int runcmd_open(const char *cmd, int *pfd, int *pfderr, char **env)
 		argv[2] = strdup(cmd);
 		if (!argv[2]) {
 			free(argv);
-			return RUNCMD_EALLOC;
+			return NULL;
 		}
 		argv[3] = NULL;
+		argc = 3;
 	}
 
-	if (pipe(pfd) < 0) {
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
-		free(argv);
+	/* the vector was sized for the worst case, so give back the rest */
+	if ((shrunk = realloc(argv, (argc + 1) * sizeof(char *))) != NULL)
+		argv = shrunk;
+	return argv;
+}
+
+/*
+ * Returns the argument vector for cmd. It belongs to the cache and
+ * stays valid until the next call.
+ */
+static char **cached_cmd2argv(const char *cmd)
+{
+	struct argv_cache_entry *ent;
+	unsigned int hash = 5381;
+	const char *p;
+	char **argv;
+	int cmd2strv_errors = 0;
+
+	for (p = cmd; *p; p++)
+		hash = ((hash << 5) + hash) ^ (unsigned char)*p;
+	ent = &argv_cache[hash & (ARGV_CACHE_SIZE - 1)];
+
+	if (ent->cmd && !strcmp(ent->cmd, cmd))
+		return ent->argv;
+
+	if (!(argv = cmd2argv(cmd, &cmd2strv_errors)))
+		return NULL;
+
+	free(ent->cmd);
+	free_argv(ent->argv, ent->cmd2strv_errors);
+	ent->argv = argv;
+	ent->cmd2strv_errors = cmd2strv_errors;
+	if (!(ent->cmd = strdup(cmd))) {
+		/* can't cache it, but we can still run it */
+		ent->argv = NULL;
+		free_argv(argv, cmd2strv_errors);
+		return NULL;
+	}
+	return argv;
+}
+
+/*
+ * pipe() with both ends marked close-on-exec, so no child ever inherits
+ * another child's pipes. The ends that become the child's stdout and
+ * stderr lose the flag when they're dup2()'d into place.
+ */
+static int cloexec_pipe(int *fds)
+{
+	if (pipe(fds) < 0)
+		return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
+static pid_t runcmd_spawn(char **argv, int *pfd, int *pfderr)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	short flags = POSIX_SPAWN_SETPGROUP;
+	pid_t pid;
+	int ret;
+
+	/*
+	 * dup2() onto the same fd doesn't clear close-on-exec, so leave
+	 * the odd case where our stdout or stderr was closed to fork()
+	 */
+	if (pfd[1] <= STDERR_FILENO || pfderr[1] <= STDERR_FILENO)
+		return -1;
+
+	if (posix_spawn_file_actions_init(&fa))
+		return -1;
+	if (posix_spawnattr_init(&attr)) {
+		posix_spawn_file_actions_destroy(&fa);
+		return -1;
+	}
+
+#ifdef POSIX_SPAWN_USEVFORK
+	flags |= POSIX_SPAWN_USEVFORK;
+#endif
+	/* make sure all our children are killable by our parent */
+	ret = posix_spawnattr_setflags(&attr, flags);
+	ret |= posix_spawnattr_setpgroup(&attr, 0);
+	ret |= posix_spawn_file_actions_adddup2(&fa, pfd[1], STDOUT_FILENO);
+	ret |= posix_spawn_file_actions_adddup2(&fa, pfderr[1], STDERR_FILENO);
+	if (!ret)
+		ret = posix_spawnp(&pid, argv[0], &fa, &attr, argv, environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	return ret ? -1 : pid;
+}
+
+/* Start running a command */
+int runcmd_open(const char *cmd, int *pfd, int *pfderr, char **env)
+{
+	char **argv = NULL;
+	pid_t pid = -1;
+
+	if (!pids)
+		runcmd_init();
+
+	/* if no command was passed, return with no error */
+	if (!*cmd)
+		return RUNCMD_EINVAL;
+
+	if (!(argv = cached_cmd2argv(cmd)))
+		return RUNCMD_EALLOC;
+
+	if (cloexec_pipe(pfd) < 0) {
 		return RUNCMD_ECMD;
 	}
-	if (pipe(pfderr) < 0) {
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
-		free(argv);
+	if (cloexec_pipe(pfderr) < 0) {
 		close(pfd[0]);
 		close(pfd[1]);
 		return RUNCMD_EFD;
 	}
-	pid = fork();
+
+	if (use_spawn)
+		pid = runcmd_spawn(argv, pfd, pfderr);
+	if (pid < 0)
+		pid = fork();
 	if (pid < 0) {
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
-		free(argv);
 		close(pfd[0]);
 		close(pfd[1]);
 		close(pfderr[0]);
@@ -400,46 +522,30 @@ int runcmd_open(const char *cmd, int *pfd, int *pfderr, char **env)
 		/* make sure all our children are killable by our parent */
 		setpgid(getpid(), getpid());
 
-		close(pfd[0]);
-		if (pfd[1] != STDOUT_FILENO) {
+		if (pfd[1] != STDOUT_FILENO)
 			dup2(pfd[1], STDOUT_FILENO);
-			close(pfd[1]);
-		}
-		close(pfderr[0]);
-		if (pfderr[1] != STDERR_FILENO) {
+		else
+			fcntl(pfd[1], F_SETFD, 0);
+		if (pfderr[1] != STDERR_FILENO)
 			dup2(pfderr[1], STDERR_FILENO);
-			close(pfderr[1]);
-		}
-
-		/* close all descriptors in pids[]
-		 * This is executed in a separate address space (pure child),
-		 * so we don't have to worry about async safety */
-		for (i = 0; i < maxfd; i++)
-			if (pids[i] > 0)
-				close(i);
+		else
+			fcntl(pfderr[1], F_SETFD, 0);
 
-		i = execvp(argv[0], argv);
+		/*
+		 * every other pipe we've handed out is close-on-exec, so
+		 * there's nothing left to close here
+		 */
+		execvp(argv[0], argv);
 		fprintf(stderr, "execvp(%s, ...) failed. errno is %d: %s\n", argv[0], errno, strerror(errno));
-		if (!cmd2strv_errors)
-			free(argv[0]);
-		else
-			free(argv[2]);
 		_exit(errno);
 	}
 
 	/* parent picks up execution here */
 	/*
-	 * close childs file descriptors in our address space and
-	 * release the memory we used that won't get passed to the
-	 * caller.
+	 * close childs file descriptors in our address space
 	 */
 	close(pfd[1]);
 	close(pfderr[1]);
-	if (!cmd2strv_errors)
-		free(argv[0]);
-	else
-		free(argv[2]);
-	free(argv);
 
 	/* tag our file's entry in the pid-list and return it */
 	pids[pfd[0]] = pid;
@@ -87,6 +87,18 @@ int main(int argc, char **argv)
 	ok_int(bitmap_count_unset_bits(a), bitmap_cardinality(a), "bitmap_clear() must clear all");
 	ok_int(bitmap_count_set_bits(a), 0, "bitmap_clear() must clear all (part 2)");
 
+	/* the whole last word is usable, but nothing after it */
+	i = bitmap_cardinality(a) - MAPSIZE;
+	ok_int(bitmap_set(a, i), 0, "bitmap_set() on the first bit of the last word");
+	ok_int(bitmap_isset(a, i), 1, "bitmap_isset() on the first bit of the last word");
+	i = bitmap_cardinality(a) - 1;
+	ok_int(bitmap_set(a, i), 0, "bitmap_set() on the last bit");
+	ok_int(bitmap_isset(a, i), 1, "bitmap_isset() on the last bit");
+	ok_int(bitmap_set(a, i + 1), -1, "bitmap_set() must refuse the bit after the last one");
+	ok_int(bitmap_isset(a, i + 1), 0, "bitmap_isset() must not see the bit after the last one");
+	ok_int(bitmap_set(a, i + MAPSIZE), -1, "bitmap_set() must refuse the word after the last one");
+	ok_int(bitmap_count_set_bits(a), 2, "only the bits in the last word are set");
+
 	t_end();
 	return 0;
 }
@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/time.h>
 #include "bufferqueue.c"
 #include "t-utils.h"
 
@@ -94,6 +96,148 @@ static int test_delimiter(const char *delim, size_t delim_len)
 	return 0;
 }
 
+/*
+ * Push and pull a counting byte sequence in odd sizes, so the data
+ * wraps around the end of the ring in every possible position
+ */
+static void test_wraparound(void)
+{
+	nm_bufferqueue *bq;
+	unsigned char in[977], out[977];
+	unsigned int pushed = 0, pulled = 0, i, round, bad = 0;
+	size_t most = BQ_MIN_SIZE;
+
+	t_start("Testing data wrapping around the end of the ring");
+	bq = nm_bufferqueue_create();
+	t_req(bq != NULL);
+	for (round = 0; round < 2000; round++) {
+		size_t push_len = 1 + (round * 7) % sizeof(in);
+		size_t pull_len = 1 + (round * 13) % sizeof(out);
+
+		for (i = 0; i < push_len; i++)
+			in[i] = (unsigned char)(pushed++ & 0xff);
+		nm_bufferqueue_push(bq, in, push_len);
+		if (nm_bufferqueue_get_available(bq) > most)
+			most = nm_bufferqueue_get_available(bq);
+
+		if (pull_len > nm_bufferqueue_get_available(bq))
+			pull_len = nm_bufferqueue_get_available(bq);
+		if (nm_bufferqueue_unshift(bq, pull_len, out))
+			bad++;
+		for (i = 0; i < pull_len; i++) {
+			if (out[i] != (unsigned char)(pulled++ & 0xff))
+				bad++;
+		}
+	}
+	ok_uint(bad, 0, "Data must come out in the order it went in");
+	ok_uint(nm_bufferqueue_get_available(bq), pushed - pulled, "Available bytes must add up");
+	test(bq->bq_size < 2 * most, "Ring must not grow when there's room to wrap (size is %lu, most used %lu)",
+	     (unsigned long)bq->bq_size, (unsigned long)most);
+	nm_bufferqueue_destroy(bq);
+	t_end();
+}
+
+static void test_delim_cursor(void)
+{
+	nm_bufferqueue *bq;
+	char *ptr = NULL;
+	size_t len = 0;
+
+	t_start("Testing delimiters arriving in pieces");
+	bq = nm_bufferqueue_create();
+	t_req(bq != NULL);
+
+	nm_bufferqueue_push(bq, "abc\1", 4);
+	test(nm_bufferqueue_unshift_to_delim(bq, "\1\0\0", 3, &len, (void **)&ptr) != 0, "Incomplete message must not be returned");
+	test(ptr == NULL, "Buffer must be NULL on failure");
+	nm_bufferqueue_push(bq, "\0", 1);
+	test(nm_bufferqueue_unshift_to_delim(bq, "\1\0\0", 3, &len, (void **)&ptr) != 0, "Incomplete delimiter must not match");
+	nm_bufferqueue_push(bq, "\0def", 4);
+	test(!nm_bufferqueue_unshift_to_delim(bq, "\1\0\0", 3, &len, (void **)&ptr), "Delimiter completed by a later push must match");
+	t_req(ptr != NULL);
+	test(len == 6 && !memcmp(ptr, "abc\1\0\0", 6), "Message must be returned whole");
+	free(ptr);
+
+	/* a failed scan for one delimiter mustn't hide another */
+	test(nm_bufferqueue_unshift_to_delim(bq, "\n", 1, &len, (void **)&ptr) != 0, "No newline yet");
+	test(!nm_bufferqueue_unshift_to_delim(bq, "e", 1, &len, (void **)&ptr), "Switching delimiter must scan from the start");
+	t_req(ptr != NULL);
+	test(len == 2 && !memcmp(ptr, "de", 2), "Data up to the new delimiter must be returned");
+	free(ptr);
+	ok_uint(nm_bufferqueue_get_available(bq), 1, "One byte must remain");
+
+	nm_bufferqueue_destroy(bq);
+	t_end();
+}
+
+static double tv_delta_secs(const struct timeval *start, const struct timeval *stop)
+{
+	return (stop->tv_sec - start->tv_sec) + (stop->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+#define BENCH_MSG_LEN 200
+#define BENCH_MSGS 500000
+#define BENCH_BYTES ((unsigned long)BENCH_MSGS * BENCH_MSG_LEN)
+/*
+ * Shuffle delimited messages through a socketpair the same way the
+ * core and its workers do, and report how fast it went
+ */
+static void test_throughput(void)
+{
+	nm_bufferqueue *out, *in;
+	int sv[2];
+	char msg[BENCH_MSG_LEN];
+	unsigned long sent = 0, received = 0, bad = 0, msgs = 0;
+	struct timeval start, stop;
+	double secs;
+
+	t_start("Testing throughput over a socketpair");
+	t_req(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	out = nm_bufferqueue_create();
+	in = nm_bufferqueue_create();
+	t_req(out != NULL && in != NULL);
+
+	memset(msg, 'x', sizeof(msg));
+	memcpy(msg + sizeof(msg) - 3, "\1\0\0", 3);
+
+	gettimeofday(&start, NULL);
+	while (received < BENCH_BYTES) {
+		char *ptr;
+		size_t len;
+
+		while (sent < BENCH_BYTES && nm_bufferqueue_get_available(out) < 65536) {
+			nm_bufferqueue_push(out, msg, sizeof(msg));
+			sent += sizeof(msg);
+		}
+		if (nm_bufferqueue_write(out, sv[0]) < 0)
+			break;
+		if (nm_bufferqueue_read(in, sv[1]) < 0 && errno != EAGAIN)
+			break;
+		while (!nm_bufferqueue_unshift_to_delim(in, "\1\0\0", 3, &len, (void **)&ptr)) {
+			if (len != sizeof(msg) || memcmp(ptr, msg, len))
+				bad++;
+			received += len;
+			msgs++;
+			free(ptr);
+		}
+	}
+	gettimeofday(&stop, NULL);
+	secs = tv_delta_secs(&start, &stop);
+
+	test(received == BENCH_BYTES, "All data must arrive (%lu of %lu bytes)", received, BENCH_BYTES);
+	ok_uint(bad, 0, "All messages must arrive intact");
+	t_diag("%lu messages, %lu bytes in %.3fs: %.0f messages/s, %.1f MB/s",
+	       msgs, received, secs, msgs / secs, received / secs / (1 << 20));
+
+	nm_bufferqueue_destroy(out);
+	nm_bufferqueue_destroy(in);
+	close(sv[0]);
+	close(sv[1]);
+	t_end();
+}
+
 int main(int argc, char **argv)
 {
 	unsigned int i;
@@ -105,12 +249,18 @@ int main(int argc, char **argv)
 	};
 
 	t_set_colors(0);
+	t_start("bufferqueue tests");
 	t_start("iocache_use_delim() test");
 	for (i = 0; i < ARRAY_SIZE(sc); i++) {
 		t_start("Testing delimiter %s of len %ld", sc[i].str, sc[i].len);
 		test_delimiter(sc[i].str, sc[i].len);
 		t_end();
 	}
+	t_end();
+
+	test_wraparound();
+	test_delim_cursor();
+	test_throughput();
 
 	return t_end();
 }
@@ -108,6 +108,240 @@ static int listen_handler(int fd, int events, void *arg)
 	return 0;
 }
 
+static int backlog_input_calls;
+static int backlog_handler(int fd, int events, void *arg)
+{
+	backlog_input_calls++;
+	return 0;
+}
+
+/*
+ * Queue more data than the socket buffer takes, and make sure it's sent
+ * off by polling as the other end reads it, without waking the input
+ * handler for it.
+ */
+static void test_write_backlog(void)
+{
+	int sv[2], i, flags, errors = 0;
+	char chunk[4096], buf[65536];
+	size_t sent = 0, received = 0;
+	ssize_t len;
+	iobroker_set *bset;
+
+	bset = iobroker_create();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		t_fail("socketpair() failed: %s", strerror(errno));
+		return;
+	}
+	flags = fcntl(sv[0], F_GETFL);
+	fcntl(sv[0], F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(sv[1], F_GETFL);
+	fcntl(sv[1], F_SETFL, flags | O_NONBLOCK);
+
+	iobroker_register(bset, sv[0], NULL, backlog_handler);
+	ok_int(iobroker_push(bset), 1, "nothing to push on a fresh set");
+	test(bset->dirty_fds == NULL, "no sockets are dirty on a fresh set");
+
+	memset(chunk, 'x', sizeof(chunk));
+	for (i = 0; i < 1024; i++) {
+		if (iobroker_write_packet(bset, sv[0], chunk, sizeof(chunk)))
+			errors++;
+		sent += sizeof(chunk);
+	}
+	ok_int(errors, 0, "queueing data never fails");
+	test(bset->dirty_fds == bset->iobroker_fds[sv[0]], "the socket is dirty when the peer doesn't read");
+	ok_int(iobroker_push(bset), 0, "push reports the backlog");
+
+	while (received < sent) {
+		len = read(sv[1], buf, sizeof(buf));
+		if (len > 0)
+			received += len;
+		if (iobroker_poll(bset, 100) < 0)
+			break;
+	}
+	ok_int((int)received, (int)sent, "everything arrives eventually");
+	test(bset->dirty_fds == NULL, "the socket is clean once it has caught up");
+	ok_int(iobroker_push(bset), 1, "no backlog left to push");
+	ok_int(backlog_input_calls, 0, "input handler isn't called for writability");
+
+	iobroker_close(bset, sv[0]);
+	close(sv[1]);
+	iobroker_destroy(bset, 0);
+}
+
+/*
+ * Send more buffers than fit in one writev(), and more data than the
+ * socket takes, and make sure it all arrives in order.
+ */
+static void test_write_packetv(void)
+{
+	int sv[2], i, flags, mismatch = 0;
+	static char data[2048][100];
+	struct iovec iov[2048];
+	char buf[65536];
+	size_t sent = 0, received = 0;
+	ssize_t len;
+	iobroker_set *bset;
+
+	bset = iobroker_create();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		t_fail("socketpair() failed: %s", strerror(errno));
+		return;
+	}
+	flags = fcntl(sv[0], F_GETFL);
+	fcntl(sv[0], F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(sv[1], F_GETFL);
+	fcntl(sv[1], F_SETFL, flags | O_NONBLOCK);
+	iobroker_register(bset, sv[0], NULL, backlog_handler);
+
+	for (i = 0; i < (int)ARRAY_SIZE(iov); i++) {
+		/* every buffer is filled with its own index, and some are empty */
+		memset(data[i], i & 0xff, sizeof(data[i]));
+		iov[i].iov_base = data[i];
+		iov[i].iov_len = i % 7 ? sizeof(data[i]) : 0;
+		sent += iov[i].iov_len;
+	}
+	for (i = 0; i < 4; i++)
+		ok_int(iobroker_write_packetv(bset, sv[0], iov, ARRAY_SIZE(iov)), 0, "queueing a vector of buffers");
+	sent *= 4;
+
+	i = 0;
+	while (received < sent) {
+		len = read(sv[1], buf, sizeof(buf));
+		if (len > 0) {
+			ssize_t j;
+			for (j = 0; j < len; j++, received++) {
+				size_t pos = received % (sent / 4), idx = 0;
+				/* find which buffer this byte came from */
+				while (pos >= iov[idx].iov_len) {
+					pos -= iov[idx].iov_len;
+					idx++;
+				}
+				if ((unsigned char)buf[j] != (idx & 0xff))
+					mismatch++;
+			}
+		}
+		if (iobroker_poll(bset, 100) < 0)
+			break;
+	}
+	ok_int((int)received, (int)sent, "all buffers arrive");
+	ok_int(mismatch, 0, "buffers arrive in order");
+	test(bset->dirty_fds == NULL, "the socket is clean once it has caught up");
+
+	iobroker_close(bset, sv[0]);
+	close(sv[1]);
+	iobroker_destroy(bset, 0);
+}
+
+/* writes to a socket whose peer is gone fail with an error we can log */
+static void test_write_errors(void)
+{
+	int sv[2], ret;
+	char chunk[100];
+	struct iovec iov[2];
+	iobroker_set *bset;
+
+	bset = iobroker_create();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		t_fail("socketpair() failed: %s", strerror(errno));
+		return;
+	}
+	iobroker_register(bset, sv[0], NULL, backlog_handler);
+	close(sv[1]);
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(chunk, 'x', sizeof(chunk));
+	ret = iobroker_write_packet(bset, sv[0], chunk, sizeof(chunk));
+	ok_int(ret, -EPIPE, "iobroker_write_packet() reports a broken pipe");
+	test(!strcmp(iobroker_strerror(ret), strerror(EPIPE)), "and iobroker_strerror() describes it");
+
+	iobroker_close(bset, sv[0]);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		t_fail("socketpair() failed: %s", strerror(errno));
+		return;
+	}
+	iobroker_register(bset, sv[0], NULL, backlog_handler);
+	close(sv[1]);
+	iov[0].iov_base = iov[1].iov_base = chunk;
+	iov[0].iov_len = iov[1].iov_len = sizeof(chunk);
+	ret = iobroker_write_packetv(bset, sv[0], iov, 2);
+	ok_int(ret, -EPIPE, "iobroker_write_packetv() reports a broken pipe");
+
+	iobroker_close(bset, sv[0]);
+	iobroker_destroy(bset, 0);
+}
+
+struct drain_state {
+	iobroker_set *iobs;
+	char chunk[4096];
+	int left; /* chunks still to send */
+	int calls;
+};
+
+static int drain_handler(int fd, int events, void *arg)
+{
+	struct drain_state *ds = (struct drain_state *)arg;
+
+	ds->calls++;
+	while (ds->left > 0) {
+		if (write(fd, ds->chunk, sizeof(ds->chunk)) < 0)
+			return 0;
+		ds->left--;
+	}
+	iobroker_set_output_handler(ds->iobs, fd, NULL, NULL);
+	return 0;
+}
+
+/*
+ * A caller with its own output queue gets called back as the socket
+ * becomes writable, and the input handler is left alone.
+ */
+static void test_output_handler(void)
+{
+	int sv[2], flags;
+	char buf[65536];
+	size_t sent, received = 0;
+	ssize_t len;
+	struct drain_state ds;
+
+	backlog_input_calls = 0;
+	memset(&ds, 0, sizeof(ds));
+	memset(ds.chunk, 'y', sizeof(ds.chunk));
+	ds.left = 256;
+	sent = ds.left * sizeof(ds.chunk);
+	ds.iobs = iobroker_create();
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		t_fail("socketpair() failed: %s", strerror(errno));
+		return;
+	}
+	flags = fcntl(sv[0], F_GETFL);
+	fcntl(sv[0], F_SETFL, flags | O_NONBLOCK);
+	flags = fcntl(sv[1], F_GETFL);
+	fcntl(sv[1], F_SETFL, flags | O_NONBLOCK);
+
+	ok_int(iobroker_set_output_handler(ds.iobs, sv[0], &ds, drain_handler), IOBROKER_EINVAL,
+	       "output handlers need a registered socket");
+	iobroker_register(ds.iobs, sv[0], NULL, backlog_handler);
+	ok_int(iobroker_set_output_handler(ds.iobs, sv[0], &ds, drain_handler), 0, "setting an output handler");
+
+	while (received < sent) {
+		len = read(sv[1], buf, sizeof(buf));
+		if (len > 0)
+			received += len;
+		if (iobroker_poll(ds.iobs, 100) < 0)
+			break;
+	}
+	ok_int((int)received, (int)sent, "the output handler sends everything");
+	test(ds.calls > 1, "the output handler is called as the peer catches up");
+	test(ds.iobs->iobroker_fds[sv[0]]->out_handler == NULL, "the output handler can clear itself");
+	ok_int(backlog_input_calls, 0, "input handler isn't called for writability");
+
+	iobroker_close(ds.iobs, sv[0]);
+	close(sv[1]);
+	iobroker_destroy(ds.iobs, 0);
+}
+
 void sighandler(int sig)
 {
 	/* test failed */
@@ -189,6 +423,11 @@ int main(int argc, char **argv)
 	iobroker_close(iobs, listen_fd);
 	iobroker_destroy(iobs, 0);
 
+	test_write_backlog();
+	test_write_packetv();
+	test_write_errors();
+	test_output_handler();
+
 	t_end();
 	return 0;
 }
@@ -1,6 +1,7 @@
 #include "runcmd.c"
 #include "t-utils.h"
 #include <stdio.h>
+#include <sys/time.h>
 
 #define BUF_SIZE 1024
 
@@ -88,6 +89,51 @@ struct {
 	{ 0, NULL, 0, { NULL, NULL, NULL }},
 };
 
+/* run cmd to completion and return its wait status, with stdout in out */
+static int run_to_end(const char *cmd, char *out, size_t outlen)
+{
+	int pfd[2] = { -1, -1}, pfderr[2] = { -1, -1};
+	int fd, status = -1;
+	ssize_t len, total = 0;
+	pid_t pid;
+
+	fd = runcmd_open(cmd, pfd, pfderr, NULL);
+	if (fd < 0)
+		return -1;
+	pid = runcmd_pid(fd);
+	while ((len = read(pfd[0], out + total, outlen - total - 1)) > 0)
+		total += len;
+	out[total] = 0;
+	close(pfd[0]);
+	close(pfderr[0]);
+	pids[fd] = 0;
+	waitpid(pid, &status, 0);
+	return status;
+}
+
+#define BENCH_SPAWNS 500
+#define BENCH_HEAP (64 << 20)
+static double spawn_rate(int spawn)
+{
+	struct timeval start, stop;
+	char out[BUF_SIZE];
+	int i, bad = 0;
+	double secs;
+
+	use_spawn = spawn;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_SPAWNS; i++) {
+		if (run_to_end("/bin/true", out, sizeof(out)))
+			bad++;
+	}
+	gettimeofday(&stop, NULL);
+	use_spawn = 1;
+
+	ok_int(bad, 0, spawn ? "posix_spawn()'d commands must succeed" : "fork()'ed commands must succeed");
+	secs = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+	return BENCH_SPAWNS / secs;
+}
+
 int main(int argc, char **argv)
 {
 	int ret, r2;
@@ -149,6 +195,54 @@ int main(int argc, char **argv)
 		}
 	}
 
+	r2 = t_end();
+	ret = r2 ? r2 : ret;
+	t_reset();
+	t_start("spawning");
+	{
+		char out[BUF_SIZE];
+		char **cached;
+		int status;
+
+		status = run_to_end("/bin/echo -n spawned", out, sizeof(out));
+		ok_int(status, 0, "Plain commands must exit cleanly");
+		ok_str("spawned", out, "Plain commands must produce their output");
+		cached = cached_cmd2argv("/bin/echo -n spawned");
+		ok_str("/bin/echo", cached ? cached[0] : NULL, "Command lines must be cached");
+		test(cached == cached_cmd2argv("/bin/echo -n spawned"), "Cached command lines must not be parsed again");
+
+		status = run_to_end("/bin/echo shell | /bin/cat", out, sizeof(out));
+		ok_int(status, 0, "Shell commands must exit cleanly");
+		ok_str("shell\n", out, "Shell commands must run through the shell");
+
+		use_spawn = 0;
+		status = run_to_end("/bin/echo -n forked", out, sizeof(out));
+		use_spawn = 1;
+		ok_int(status, 0, "fork()'ed commands must exit cleanly");
+		ok_str("forked", out, "fork()'ed commands must produce their output");
+
+		status = run_to_end("/nonexistent/plugin", out, sizeof(out));
+		test(WIFEXITED(status) && WEXITSTATUS(status) == ENOENT, "Missing plugins must exit with ENOENT");
+	}
+	r2 = t_end();
+	ret = r2 ? r2 : ret;
+	t_reset();
+	t_start("spawn rate benchmark");
+	{
+		double spawned, forked;
+		char *heap;
+
+		/* workers aren't small, and fork() gets slower the larger we are */
+		heap = malloc(BENCH_HEAP);
+		t_req(heap != NULL);
+		memset(heap, 1, BENCH_HEAP);
+
+		spawned = spawn_rate(1);
+		forked = spawn_rate(0);
+		t_diag("%d commands with %dMiB of heap: %.0f/s with posix_spawn(), %.0f/s with fork()",
+		       BENCH_SPAWNS, BENCH_HEAP >> 20, spawned, forked);
+		free(heap);
+	}
 	r2 = t_end();
 	return r2 ? r2 : ret;
 }
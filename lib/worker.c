@@ -1,4 +1,5 @@
 #include "worker.h"
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/socket.h>
@@ -44,6 +45,24 @@ char *worker_ioc2msg(nm_bufferqueue *bq, size_t *size, int flags)
 	return res;
 }
 
+int worker_ioc2frame(nm_bufferqueue *bq, struct wproc_frame *frame, char **payload)
+{
+	if (nm_bufferqueue_peek(bq, sizeof(*frame), frame))
+		return 0;
+	if (frame->magic != WPROC_FRAME_MAGIC || frame->len > WPROC_FRAME_MAX_LEN)
+		return -1;
+	if (nm_bufferqueue_get_available(bq) < sizeof(*frame) + frame->len)
+		return 0;
+
+	*payload = malloc(frame->len + 1);
+	if (!*payload)
+		return -1;
+	nm_bufferqueue_drop(bq, sizeof(*frame));
+	nm_bufferqueue_unshift(bq, frame->len, *payload);
+	(*payload)[frame->len] = 0;
+	return 1;
+}
+
 int spawn_named_helper(char *path, char **argv)
 {
 	int ret, pid;
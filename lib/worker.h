@@ -5,6 +5,7 @@
 #error "Only <naemon/naemon.h> can be included directly."
 #endif
 
+#include <stdint.h>
 #include "lnae-utils.h"
 #include "kvvec.h"
 #include "bufferqueue.h"
@@ -25,6 +26,51 @@ NAGIOS_BEGIN_DECL
 #define PAIR_SEP 0 /**< pair separator for buf2kvvec() and kvvec2buf() */
 #define KV_SEP '=' /**< key/value separator for buf2kvvec() and kvvec2buf() */
 
+/**
+ * @name Binary worker protocol
+ * A worker that adds protocol=1 to its registration request and gets
+ * "OK protocol=1" back sends all its messages as frames instead of
+ * key/value vectors. Each frame is a struct wproc_frame followed by
+ * len bytes of payload. Integers are in host byte order, as workers
+ * always run on the same machine as the core.
+ *
+ * Result payloads are a struct wproc_result_frame followed by the
+ * command, stdout, stderr and error message, in that order, each with
+ * a terminating nul byte that isn't counted in its length. Log
+ * payloads are the message itself.
+ *
+ * Workers that don't ask for it keep using key/value vectors, and so
+ * does the core when sending jobs to workers.
+ * @{
+ */
+#define WPROC_PROTOCOL_BINARY 1 /**< protocol version to ask for */
+#define WPROC_FRAME_MAGIC 0x4e57 /**< first two bytes of every frame */
+#define WPROC_FRAME_MAX_LEN (64 << 20) /**< larger frames are garbage */
+#define WPROC_FRAME_LOG 1 /**< a log message */
+#define WPROC_FRAME_RESULT 2 /**< the result of a job */
+
+struct wproc_frame {
+	uint16_t magic; /**< WPROC_FRAME_MAGIC */
+	uint16_t type; /**< WPROC_FRAME_* */
+	uint32_t len; /**< length of the payload */
+};
+
+struct wproc_result_frame {
+	int32_t job_id;
+	int32_t wait_status;
+	int32_t exited_ok;
+	int32_t error_code;
+	uint32_t timeout;
+	uint32_t reserved;
+	int64_t start_sec, start_usec;
+	int64_t stop_sec, stop_usec;
+	int64_t ru_utime_sec, ru_utime_usec;
+	int64_t ru_stime_sec, ru_stime_usec;
+	int64_t ru_minflt, ru_majflt, ru_inblock, ru_oublock;
+	uint32_t command_len, outstd_len, outerr_len, error_msg_len;
+};
+/** @} */
+
 /**
  * Spawn a helper with a specific process name
  * The first entry in the argv parameter will be the name of the
@@ -60,6 +106,17 @@ extern struct kvvec_buf *build_kvvec_buf(struct kvvec *kvv);
  */
 extern char *worker_ioc2msg(nm_bufferqueue *ioc, size_t *size, int flags);
 
+/**
+ * Grab a binary protocol frame from a bufferqueue
+ * @param[in] bq The bufferqueue
+ * @param[out] frame The frame's header
+ * @param[out] payload The frame's payload, with a nul byte added at
+ *                     the end. Must be free()'d by the caller
+ * @return 1 if a frame was grabbed, 0 if there's no complete frame
+ *         yet, < 0 if the data isn't a valid frame
+ */
+extern int worker_ioc2frame(nm_bufferqueue *bq, struct wproc_frame *frame, char **payload);
+
 /**
  * Set some common socket options
  * @param[in] sd The socket to set options for
@@ -140,6 +140,7 @@ CFLAGS="%{mycflags}" LDFLAGS="$CFLAGS" %configure \
 %{__cp} -p %{buildroot}%{_bindir}/naemon %{buildroot}%{_bindir}/naemon-dbg
 %{__strip} %{buildroot}%{_bindir}/naemon
 %{__strip} %{buildroot}%{_bindir}/naemonstats
+%{__strip} %{buildroot}%{_bindir}/naemondebug
 %{__strip} %{buildroot}%{_libdir}/naemon/libnaemon.so.0.0.0
 %{__mv} %{buildroot}%{_sysconfdir}/logrotate.d/naemon %{buildroot}%{_sysconfdir}/logrotate.d/%{name}
 %{__mv} %{buildroot}%{_libdir}/naemon/pkgconfig %{buildroot}%{_libdir}/pkgconfig
@@ -326,6 +327,8 @@ exit 0
 %{_datadir}/naemon/examples
 %attr(0755,root,root) %{_bindir}/naemonstats
 %{_mandir}/man8/naemonstats.8*
+%attr(0755,root,root) %{_bindir}/naemondebug
+%{_mandir}/man8/naemondebug.8*
 
 %files -n libnaemon
 %attr(0755,root,root) %dir %{_libdir}/naemon
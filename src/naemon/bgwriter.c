@@ -0,0 +1,198 @@
+#include "config.h"
+#include "common.h"
+#include "bgwriter.h"
+#include "events.h"
+#include "logging.h"
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+
+static unsigned long usecs_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000UL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* how long the main loop was held up by a write */
+static void record_stall(struct bg_writer *w, unsigned long stall)
+{
+	w->stats.writes++;
+	w->stats.last_stall = stall;
+	if (stall > w->stats.max_stall)
+		w->stats.max_stall = stall;
+}
+
+/* how long it took until the new file was in place */
+static void record_duration(struct bg_writer *w, unsigned long duration, int result)
+{
+	if (result != OK)
+		w->stats.failed++;
+	w->stats.last_duration = duration;
+	if (duration > w->stats.max_duration)
+		w->stats.max_duration = duration;
+}
+
+/* the writer is done, one way or another */
+static void bg_writer_finished(struct bg_writer *w, int result)
+{
+	if (w->timeout_event) {
+		destroy_event(w->timeout_event);
+		w->timeout_event = NULL;
+	}
+	if (w->sd >= 0) {
+		iobroker_close(nagios_iobs, w->sd);
+		w->sd = -1;
+	}
+
+	w->stats.in_progress = 0;
+	record_duration(w, usecs_since(&w->started), result);
+
+	log_debug_info(w->debug_level, 1, "Background %s writer (PID = %d) finished in %lu usec\n", w->name, (int)w->pid, w->stats.last_duration);
+	w->pid = 0;
+
+	if (w->done)
+		w->done(result);
+}
+
+void bg_writer_wait(struct bg_writer *w)
+{
+	int status = 0, ret;
+
+	if (!w->pid)
+		return;
+
+	iobroker_close(nagios_iobs, w->sd);
+	w->sd = -1;
+
+	while ((ret = waitpid(w->pid, &status, 0)) < 0 && errno == EINTR)
+		;
+	if (ret < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to reap %s writer (PID = %d): %s\n", w->name, (int)w->pid, strerror(errno));
+		status = -1;
+	}
+	bg_writer_finished(w, WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? OK : ERROR);
+}
+
+static int bg_writer_input(int sd, int events, void *arg)
+{
+	char buf[64];
+
+	/* the writer never writes anything, so this is EOF */
+	if (read(sd, buf, sizeof(buf)) < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+
+	bg_writer_wait(arg);
+	return 0;
+}
+
+/* a killed writer that couldn't be reaped right away is reaped when it's gone */
+static int killed_writer_input(int sd, int events, void *arg)
+{
+	char buf[64];
+
+	if (read(sd, buf, sizeof(buf)) < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+
+	iobroker_close(nagios_iobs, sd);
+	while (waitpid(GPOINTER_TO_INT(arg), NULL, 0) < 0 && errno == EINTR)
+		;
+	return 0;
+}
+
+/*
+ * A writer that's stuck would keep every later write from starting,
+ * so it's killed once it has run for too long. If it can't be reaped
+ * right away, such as when it's stuck in the kernel, its pipe is kept
+ * around to reap it later and the next write may start meanwhile.
+ */
+static void bg_writer_timeout(struct nm_event_execution_properties *evprop)
+{
+	struct bg_writer *w = evprop->user_data;
+
+	w->timeout_event = NULL;
+	if (evprop->execution_type != EVENT_EXEC_NORMAL || !w->pid)
+		return;
+
+	nm_log(NSLOG_RUNTIME_WARNING, "Warning: Background %s writer (PID = %d) didn't finish in time, killing it\n", w->name, (int)w->pid);
+	kill(w->pid, SIGKILL);
+	if (waitpid(w->pid, NULL, WNOHANG) == 0 &&
+	    iobroker_unregister(nagios_iobs, w->sd) == 0 &&
+	    iobroker_register(nagios_iobs, w->sd, GINT_TO_POINTER(w->pid), killed_writer_input) == 0) {
+		w->sd = -1;
+	}
+	bg_writer_finished(w, ERROR);
+}
+
+int bg_writer_start(struct bg_writer *w, time_t timeout)
+{
+	struct timespec start;
+	int fds[2], ret;
+
+	if (w->pid) {
+		w->stats.skipped++;
+		log_debug_info(w->debug_level, 1, "Background %s writer (PID = %d) is still running, skipping this write\n", w->name, (int)w->pid);
+		return OK;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (pipe(fds) < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to create pipe for %s writer: %s\n", w->name, strerror(errno));
+		return ERROR;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	w->prepare();
+
+	w->pid = fork();
+	if (w->pid == 0) {
+		close(fds[0]);
+		_exit(w->write() == OK ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+
+	/* prepare() has run, so the write has to happen one way or another */
+	if (w->pid < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to fork() %s writer, writing in the foreground: %s\n", w->name, strerror(errno));
+		w->pid = 0;
+		close(fds[0]);
+		ret = w->write();
+		record_stall(w, usecs_since(&start));
+		record_duration(w, w->stats.last_stall, ret);
+		if (w->done)
+			w->done(ret);
+		return OK;
+	}
+
+	w->sd = fds[0];
+	w->started = start;
+	w->stats.in_progress = 1;
+	record_stall(w, usecs_since(&start));
+	log_debug_info(w->debug_level, 1, "Started background %s writer (PID = %d), main loop stalled for %lu usec\n", w->name, (int)w->pid, w->stats.last_stall);
+
+	if (iobroker_register(nagios_iobs, w->sd, w, bg_writer_input) < 0) {
+		/* we can't tell when it's done, so wait for it */
+		bg_writer_wait(w);
+	} else if (timeout > 0) {
+		w->timeout_event = schedule_event(timeout, bg_writer_timeout, w);
+	}
+
+	return OK;
+}
+
+unsigned long bg_writer_record(struct bg_writer *w, const struct timespec *start, int result)
+{
+	unsigned long elapsed = usecs_since(start);
+
+	record_stall(w, elapsed);
+	record_duration(w, elapsed, result);
+	return elapsed;
+}
@@ -0,0 +1,74 @@
+#ifndef _BGWRITER_H
+#define _BGWRITER_H
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include <sys/types.h>
+#include <time.h>
+#include "common.h"
+
+NAGIOS_BEGIN_DECL
+
+/*
+ * A background writer saves a file from a forked child, which writes
+ * from its copy-on-write snapshot of the parent, so the main loop only
+ * stalls for as long as fork() takes. The child holds the write end of
+ * a pipe, so we learn it's done when the read end hits EOF. A writer
+ * that runs for too long is killed, so a stuck one can't keep later
+ * writes from starting.
+ */
+
+/* times in microseconds */
+struct bg_writer_stats {
+	int in_progress; /* a background writer is running */
+	unsigned long writes; /* writes started */
+	unsigned long skipped; /* background writes skipped because the last one wasn't done */
+	unsigned long failed; /* writes that didn't make it to disk */
+	unsigned long last_stall, max_stall; /* time the main loop was blocked */
+	unsigned long last_duration, max_duration; /* time until the file was in place */
+};
+
+struct bg_writer {
+	const char *name; /* what it writes, for log messages */
+	int debug_level;
+	void (*prepare)(void); /* run before fork() */
+	int (*write)(void); /* run in the child, returns OK or ERROR */
+	void (*done)(int result); /* run once the write prepare() was run for is over, may be NULL */
+	pid_t pid;
+	int sd;
+	struct timed_event *timeout_event;
+	struct timespec started;
+	struct bg_writer_stats stats;
+};
+
+#define BG_WRITER_INIT(name, debug_level, prepare, write, done) \
+	{ name, debug_level, prepare, write, done, 0, -1, NULL, { 0, 0 }, { 0, 0, 0, 0, 0, 0, 0, 0 } }
+
+/**
+ * Starts a background write, unless one is already running
+ * @param w The writer
+ * @param timeout Seconds after which a running writer is killed, 0 for never
+ * @return ERROR if nothing was done, so the caller should write in the
+ *         foreground, otherwise OK
+ */
+int bg_writer_start(struct bg_writer *w, time_t timeout);
+
+/**
+ * Waits for a background write to finish, if one is running
+ * @param w The writer
+ */
+void bg_writer_wait(struct bg_writer *w);
+
+/**
+ * Adds a write done in the foreground to the statistics
+ * @param w The writer
+ * @param start When the write started, by CLOCK_MONOTONIC
+ * @param result OK if the write succeeded
+ * @return How long the write took, in microseconds
+ */
+unsigned long bg_writer_record(struct bg_writer *w, const struct timespec *start, int result);
+
+NAGIOS_END_DECL
+#endif
@@ -200,7 +200,6 @@ static void handle_host_check_event(struct nm_event_execution_properties *evprop
 static int run_async_host_check(host *hst, int check_options, double latency)
 {
 	nagios_macros mac;
-	char *raw_command = NULL;
 	char *processed_command = NULL;
 	struct timeval start_time, end_time;
 	check_result *cr;
@@ -291,16 +290,17 @@ static int run_async_host_check(host *hst, int check_options, double latency)
 	memset(&mac, 0, sizeof(mac));
 	grab_host_macros_r(&mac, hst);
 
-	get_raw_command_line_r(&mac, hst->check_command_ptr, hst->check_command, &raw_command, macro_options);
-	if (raw_command == NULL) {
+	if (hst->check_command_ptr == NULL) {
 		clear_volatile_macros_r(&mac);
-		log_debug_info(DEBUGL_CHECKS, 0, "Raw check command for host '%s' was NULL - aborting.\n", hst->name);
+		log_debug_info(DEBUGL_CHECKS, 0, "Check command for host '%s' was NULL - aborting.\n", hst->name);
 		return ERROR;
 	}
 
+	/* the command line itself is expanded from its compiled form below */
+	grab_argv_macros_r(&mac, hst->check_command, macro_options);
+
 	/* process any macros contained in the argument */
-	process_macros_r(&mac, raw_command, &processed_command, macro_options);
-	nm_free(raw_command);
+	process_command_macros_r(&mac, hst->check_command_ptr, &processed_command, macro_options);
 	if (processed_command == NULL) {
 		clear_volatile_macros_r(&mac);
 		log_debug_info(DEBUGL_CHECKS, 0, "Processed check command for host '%s' was NULL - aborting.\n", hst->name);
@@ -343,6 +343,8 @@ static int run_async_host_check(host *hst, int check_options, double latency)
 	if (runchk_result == ERROR) {
 		nm_log(NSLOG_RUNTIME_ERROR,
 		       "Unable to send check for host '%s' to worker (ret=%d)\n", hst->name, runchk_result);
+		free_check_result(cr);
+		nm_free(cr);
 	} else {
 		/* do the book-keeping */
 		currently_running_host_checks++;
@@ -252,7 +252,6 @@ static void handle_service_check_event(struct nm_event_execution_properties *evp
 static int run_scheduled_service_check(service *svc, int check_options, double latency)
 {
 	nagios_macros mac;
-	char *raw_command = NULL;
 	char *processed_command = NULL;
 	struct timeval start_time, end_time;
 	host *temp_host = NULL;
@@ -305,16 +304,17 @@ static int run_scheduled_service_check(service *svc, int check_options, double l
 	grab_host_macros_r(&mac, temp_host);
 	grab_service_macros_r(&mac, svc);
 
-	get_raw_command_line_r(&mac, svc->check_command_ptr, svc->check_command, &raw_command, macro_options);
-	if (raw_command == NULL) {
+	if (svc->check_command_ptr == NULL) {
 		clear_volatile_macros_r(&mac);
-		log_debug_info(DEBUGL_CHECKS, 0, "Raw check command for service '%s' on host '%s' was NULL - aborting.\n", svc->description, svc->host_name);
+		log_debug_info(DEBUGL_CHECKS, 0, "Check command for service '%s' on host '%s' was NULL - aborting.\n", svc->description, svc->host_name);
 		return ERROR;
 	}
 
+	/* the command line itself is expanded from its compiled form below */
+	grab_argv_macros_r(&mac, svc->check_command, macro_options);
+
 	/* process any macros contained in the argument */
-	process_macros_r(&mac, raw_command, &processed_command, macro_options);
-	nm_free(raw_command);
+	process_command_macros_r(&mac, svc->check_command_ptr, &processed_command, macro_options);
 	if (processed_command == NULL) {
 		clear_volatile_macros_r(&mac);
 		log_debug_info(DEBUGL_CHECKS, 0, "Processed check command for service '%s' on host '%s' was NULL - aborting.\n", svc->description, svc->host_name);
@@ -355,6 +355,8 @@ static int run_scheduled_service_check(service *svc, int check_options, double l
 	if (runchk_result == ERROR) {
 		nm_log(NSLOG_RUNTIME_ERROR,
 		       "Unable to send check for service '%s' on host '%s' to worker (ret=%d)\n", svc->description, svc->host_name, runchk_result);
+		free_check_result(cr);
+		nm_free(cr);
 	} else {
 		/* do the book-keeping */
 		currently_running_service_checks++;
@@ -27,6 +27,7 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <limits.h>
 #include <poll.h>
 #include <glib.h>
 
@@ -286,6 +287,7 @@ static int command_file_worker(int sd)
 			 * which breaks livestatus. So make this a debug log entry only.
 			 */
 			log_debug_info(DEBUGL_IPC, 1, "Command file worker: Naemon main process is dead (%m)\n");
+			nm_bufferqueue_destroy(bq);
 			return EXIT_SUCCESS;
 		}
 
@@ -309,6 +311,7 @@ static int command_file_worker(int sd)
 				continue;
 
 			nm_log(NSLOG_RUNTIME_ERROR, "Command file worker: Failed to poll (%m)");
+			nm_bufferqueue_destroy(bq);
 			return EXIT_FAILURE;
 		}
 
@@ -318,12 +321,14 @@ static int command_file_worker(int sd)
 			if (errno == EINTR)
 				continue;
 			nm_log(NSLOG_RUNTIME_ERROR, "Command file worker: Failed to read from bufferqueue (%m)");
+			nm_bufferqueue_destroy(bq);
 			return EXIT_FAILURE;
 		}
 
 		ret = nm_bufferqueue_write(bq, sd);
 		if (ret < 0 && ret != EAGAIN && ret != EWOULDBLOCK) {
 			nm_log(NSLOG_RUNTIME_ERROR, "Command file worker: Failed to write to bufferqueue (%m)");
+			nm_bufferqueue_destroy(bq);
 			return EXIT_FAILURE;
 		}
 	} /* while(1) */
@@ -436,6 +441,7 @@ struct external_command_with_result {
 static int registered_commands_sz;
 static struct external_command **registered_commands;
 static int num_registered_commands;
+static GHashTable *registered_commands_index; /* name -> command */
 
 /* forward declarations */
 static struct arg_val *arg_val_copy(struct arg_val *v);
@@ -484,12 +490,9 @@ static const char *arg_t2str(arg_t type)
 
 struct external_command *command_lookup(const char *ext_command)
 {
-	int i;
-	for (i = 0; i < registered_commands_sz; i++) {
-		if ((registered_commands[i] != NULL) && (0 == strcmp(ext_command, registered_commands[i]->name)))
-			return registered_commands[i];
-	}
-	return NULL;
+	if (!registered_commands_index || !ext_command)
+		return NULL;
+	return g_hash_table_lookup(registered_commands_index, ext_command);
 }
 
 static struct external_command_argument *command_argument_get(const struct external_command *ext_command, const char *argname)
@@ -943,15 +946,14 @@ cleanup:
 }
 
 
-static int parse_arguments(const char *s, struct external_command_argument **args, int argc, GError **error)
+/* parses the arguments in s, which is tokenized in place */
+static int parse_arguments(char *s, struct external_command_argument **args, int argc, GError **error)
 {
-	char *scopy, *next, *temp = NULL;
+	char *next, *temp = NULL;
 	int i = 0;
 	GError *parse_error = NULL;
 
-	scopy = nm_strdup(s);
-	/* stash ptr start for free()ing, since *s is const and we copy it */
-	for (temp = scopy; temp; i++, temp = next ? next + 1 : NULL) {
+	for (temp = s; temp; i++, temp = next ? next + 1 : NULL) {
 		next = strchr(temp, ';');
 		if (next && i < argc) {
 			*next = '\0';
@@ -1068,8 +1070,6 @@ static int parse_arguments(const char *s, struct external_command_argument **arg
 		}
 	}
 
-	nm_free(scopy);
-
 	/* discount trailing default values */
 	while (argc > i && args[i]->argval->val) {
 		i++;
@@ -1087,7 +1087,6 @@ static int parse_arguments(const char *s, struct external_command_argument **arg
 	return 0;
 
 cleanup:
-	nm_free(scopy);
 	return -1;
 }
 
@@ -1114,15 +1113,21 @@ static struct external_command *parse_nokv_command(const char *cmdstr, GError **
 		    "Failed to find a command string to parse");
 		return NULL;
 	}
+	/* a single copy of the command is tokenized in place */
 	cmd = nm_strdup(cmdstr);
 	/* get the command entry time */
-	if ((temp_ptr = my_strtok(cmd, "[")) == NULL || (temp_ptr = my_strtok(NULL, "]")) == NULL) {
+	if ((temp_ptr = strchr(cmd, '[')) == NULL || !*++temp_ptr) {
 		g_set_error(
 		    error,
 		    NM_COMMAND_ERROR,
 		    CMD_ERROR_MALFORMED_COMMAND,
 		    "Commands must begin with a timestamp inside square brackets");
 	} else {
+		if ((args = strchr(temp_ptr, ']'))) {
+			*args++ = 0;
+		} else {
+			args = temp_ptr + strlen(temp_ptr);
+		}
 		entry_time = (time_t)parse_ulong(temp_ptr, &parse_error);
 		if (parse_error) {
 			g_set_error(
@@ -1133,21 +1138,22 @@ static struct external_command *parse_nokv_command(const char *cmdstr, GError **
 			g_clear_error(&parse_error);
 		}
 		/* get the command name */
-		else if ((temp_ptr = my_strtok(NULL, ";")) == NULL) {
+		else if (!*args) {
 			g_set_error(
 			    error,
 			    NM_COMMAND_ERROR,
 			    CMD_ERROR_MALFORMED_COMMAND,
 			    "Couldn't find command name: missing semicolon in command string");
 		} else {
-			cmd_name = nm_strdup(temp_ptr + 1);
+			/* skip the space after the timestamp */
+			cmd_name = *args == ';' ? args : args + 1;
 
 			/* get the command arguments */
-			if ((temp_ptr = my_strtok(NULL, "")) == NULL) {
-				/*No arguments, this is (possibly) OK*/
-				args = nm_strdup("");
+			if ((args = strchr(cmd_name, ';'))) {
+				*args++ = 0;
 			} else {
-				args = nm_strdup(temp_ptr);
+				/*No arguments, this is (possibly) OK*/
+				args = cmd_name + strlen(cmd_name);
 			}
 			if (cmd_name[0] == '_') {
 				/*command*/
@@ -1185,8 +1191,6 @@ static struct external_command *parse_nokv_command(const char *cmdstr, GError **
 		}
 	}
 
-	free(cmd_name);
-	free(args);
 	free(cmd);
 	return command2;
 }
@@ -1504,6 +1508,7 @@ int command_register(struct external_command *ext_command, int id)
 	}
 	ext_command->id = id;
 	registered_commands[id] = ext_command;
+	g_hash_table_insert(registered_commands_index, ext_command->name, ext_command);
 	++num_registered_commands;
 	return id;
 }
@@ -1515,6 +1520,7 @@ void registered_commands_init(int initial_size)
 		return;
 	}
 	registered_commands = nm_calloc((size_t)initial_size, sizeof(struct external_command *));
+	registered_commands_index = g_hash_table_new(g_str_hash, g_str_equal);
 	registered_commands_sz = initial_size;
 	num_registered_commands = 0;
 }
@@ -1529,6 +1535,8 @@ void registered_commands_deinit(void)
 	registered_commands_sz = 0;
 	free(registered_commands);
 	registered_commands = NULL;
+	g_hash_table_destroy(registered_commands_index);
+	registered_commands_index = NULL;
 }
 
 void command_unregister(struct external_command *ext_command)
@@ -1538,6 +1546,8 @@ void command_unregister(struct external_command *ext_command)
 		return;
 
 	id = ext_command->id;
+	if (g_hash_table_lookup(registered_commands_index, ext_command->name) == ext_command)
+		g_hash_table_remove(registered_commands_index, ext_command->name);
 	command_destroy(ext_command);
 	registered_commands[id] = NULL;
 	--num_registered_commands;
@@ -3344,15 +3354,116 @@ int process_external_command2(int cmd, time_t entry_time, char *args)
 	return return_code;
 }
 
+/* a passive check result, picked straight out of the command string */
+struct passive_check_result {
+	const struct external_command *ext_command;
+	time_t entry_time;
+	host *hst;
+	service *svc; /* NULL for host check results */
+	int return_code;
+	char *args;
+	char *output;
+};
+
+/*
+ * Passive check results make up the bulk of what's submitted through
+ * the command pipe, so they skip copying and validating a full
+ * external command and are tokenized in place instead. Anything this
+ * isn't sure about is left to command_parse(), which also gets to
+ * report any errors, so the string is restored before we return.
+ */
+static int parse_passive_check_result(char *cmd, struct passive_check_result *pcr)
+{
+	char *ptr, *endptr, *fields[4], *delims[3];
+	unsigned long entry_time;
+	long return_code;
+	int i, num_fields, num_delims = 0, ret = ERROR;
+
+	if (cmd[0] != '[' || !isdigit((unsigned char)cmd[1]))
+		return ERROR;
+	errno = 0;
+	entry_time = strtoul(cmd + 1, &endptr, 10);
+	if (errno || endptr[0] != ']' || endptr[1] != ' ')
+		return ERROR;
+
+	memset(pcr, 0, sizeof(*pcr));
+	ptr = endptr + 2;
+	if (!(endptr = strchr(ptr, ';')))
+		return ERROR;
+	*endptr = 0;
+	pcr->ext_command = command_lookup(ptr);
+	*endptr = ';';
+	if (!pcr->ext_command)
+		return ERROR;
+	if (pcr->ext_command->id == CMD_PROCESS_SERVICE_CHECK_RESULT && pcr->ext_command->handler == service_command_handler)
+		num_fields = 4;
+	else if (pcr->ext_command->id == CMD_PROCESS_HOST_CHECK_RESULT && pcr->ext_command->handler == host_command_handler)
+		num_fields = 3;
+	else
+		return ERROR;
+	pcr->entry_time = (time_t)entry_time;
+	pcr->args = endptr + 1;
+
+	/* the plugin output is last and may contain semicolons */
+	for (i = 0, ptr = pcr->args; i < num_fields; i++) {
+		fields[i] = ptr;
+		if (i == num_fields - 1)
+			break;
+		if (!(ptr = strchr(ptr, ';')))
+			goto restore;
+		delims[num_delims++] = ptr;
+		*ptr++ = 0;
+	}
+	for (i = 0; i < num_fields; i++) {
+		if (!*fields[i])
+			goto restore;
+	}
+
+	errno = 0;
+	return_code = strtol(fields[num_fields - 2], &endptr, 10);
+	if (errno || *endptr || return_code < INT_MIN || return_code > INT_MAX)
+		goto restore;
+	pcr->return_code = (int)return_code;
+	pcr->output = fields[num_fields - 1];
+
+	if (num_fields == 4) {
+		if (!(pcr->svc = find_service(fields[0], fields[1])))
+			goto restore;
+		pcr->hst = pcr->svc->host_ptr;
+	} else if (!(pcr->hst = find_host(fields[0]))) {
+		goto restore;
+	}
+	ret = OK;
+
+restore:
+	for (i = 0; i < num_delims; i++)
+		*delims[i] = ';';
+	return ret;
+}
+
+/* the equivalent of running the check result command's handler */
+static int process_passive_check_result(struct passive_check_result *pcr)
+{
+	time_t current_time = time(NULL);
+
+	if (pcr->svc) {
+		pcr->svc->last_update = current_time;
+		return process_passive_service_check(pcr->entry_time, pcr->svc->host_name, pcr->svc->description, pcr->return_code, pcr->output);
+	}
+	pcr->hst->last_update = current_time;
+	return process_passive_host_check(pcr->entry_time, pcr->hst->name, pcr->return_code, pcr->output);
+}
+
 /* top-level external command processor */
 int process_external_command(char *cmd, int mode, GError **error)
 {
-	char *temp_buffer = NULL;
 	char *args = NULL;
 	char *name = NULL;
 	int id = CMD_NONE;
+	time_t entry_time;
 	GError *external_command_ret = NULL;
-	struct external_command *parsed_command;
+	struct external_command *parsed_command = NULL;
+	struct passive_check_result pcr;
 
 	int broker_result;
 
@@ -3369,62 +3480,63 @@ int process_external_command(char *cmd, int mode, GError **error)
 	strip(cmd);
 
 	log_debug_info(DEBUGL_EXTERNALCOMMANDS, 2, "Raw command entry: %s\n", cmd);
-	/* is the command in the command register? */
-	parsed_command = command_parse(cmd, mode, &external_command_ret);
-	if (g_error_matches(external_command_ret, NM_COMMAND_ERROR, CMD_ERROR_CUSTOM_COMMAND)) {
-		id = CMD_CUSTOM_COMMAND;
-		/*custom command, reset return value*/
-		g_clear_error(&external_command_ret);
-	} else if (external_command_ret) {
-		int code = external_command_ret->code;
-		nm_log(NSLOG_EXTERNAL_COMMAND | NSLOG_RUNTIME_WARNING, "Warning: External command parse error %s (%s)\n", cmd, external_command_ret->message);
-		g_propagate_error(error, external_command_ret);
-		return code;
+	if ((mode & COMMAND_SYNTAX_NOKV) && parse_passive_check_result(cmd, &pcr) == OK) {
+		id = pcr.ext_command->id;
+		entry_time = pcr.entry_time;
+		name = pcr.ext_command->name;
+		args = pcr.args;
 	} else {
-		id = command_id(parsed_command);
+		/* is the command in the command register? */
+		parsed_command = command_parse(cmd, mode, &external_command_ret);
+		if (g_error_matches(external_command_ret, NM_COMMAND_ERROR, CMD_ERROR_CUSTOM_COMMAND)) {
+			id = CMD_CUSTOM_COMMAND;
+			/*custom command, reset return value*/
+			g_clear_error(&external_command_ret);
+		} else if (external_command_ret) {
+			int code = external_command_ret->code;
+			nm_log(NSLOG_EXTERNAL_COMMAND | NSLOG_RUNTIME_WARNING, "Warning: External command parse error %s (%s)\n", cmd, external_command_ret->message);
+			g_propagate_error(error, external_command_ret);
+			return code;
+		} else {
+			id = command_id(parsed_command);
+		}
+		entry_time = command_entry_time(parsed_command);
+		/*XXX: broker_external_command() discards const, though it doesn't seem to modify its arguments */
+		name = (char *)command_name(parsed_command);
+		args = (char *)command_raw_arguments(parsed_command);
 	}
-	/*XXX: retain const correctness, broker_external_command below discards it though it seems to not
-	 * modify its arguments*/
-	name = nm_strdup(command_name(parsed_command));
-	args = nm_strdup(command_raw_arguments(parsed_command));
 
 	/* update statistics for external commands */
 	update_check_stats(EXTERNAL_COMMAND_STATS, time(NULL));
 
 	/* log the external command */
-	nm_asprintf(&temp_buffer, "EXTERNAL COMMAND: %s;%s\n", name, args);
 	if (id == CMD_PROCESS_SERVICE_CHECK_RESULT || id == CMD_PROCESS_HOST_CHECK_RESULT) {
 		/* passive checks are logged in checks.c as well, as some my bypass external commands by getting dropped in checkresults dir */
 		if (log_passive_checks == TRUE)
-			nm_log(NSLOG_PASSIVE_CHECK, "%s", temp_buffer);
+			nm_log(NSLOG_PASSIVE_CHECK, "EXTERNAL COMMAND: %s;%s\n", name, args);
 	} else if (log_external_commands == TRUE) {
-		nm_log(NSLOG_EXTERNAL_COMMAND, "%s", temp_buffer);
+		nm_log(NSLOG_EXTERNAL_COMMAND, "EXTERNAL COMMAND: %s;%s\n", name, args);
 	}
-	nm_free(temp_buffer);
 
-	broker_result = broker_external_command(NEBTYPE_EXTERNALCOMMAND_START, NEBFLAG_NONE, NEBATTR_NONE, id, command_entry_time(parsed_command), name, args);
+	broker_result = broker_external_command(NEBTYPE_EXTERNALCOMMAND_START, NEBFLAG_NONE, NEBATTR_NONE, id, entry_time, name, args);
 
 	if (broker_result == NEBERROR_CALLBACKOVERRIDE || broker_result == NEBERROR_CALLBACKCANCEL) {
 		nm_log(NSLOG_EXTERNAL_COMMAND | NSLOG_INFO_MESSAGE, "Info: External command blocked by broker module -> %s;%s\n", name, args);
-		free(name);
-		free(args);
 		command_destroy(parsed_command);
 		return OK;
 	}
 
 	/* custom commands aren't handled internally by Naemon, but may be by NEB modules */
 	if (id != CMD_CUSTOM_COMMAND) {
-		int ret = command_execute_handler(parsed_command);
+		int ret = parsed_command ? command_execute_handler(parsed_command) : process_passive_check_result(&pcr);
 		if (ret != OK) {
 			nm_log(NSLOG_EXTERNAL_COMMAND | NSLOG_RUNTIME_WARNING, "Error: External command failed -> %s;%s\n", name, args);
 		}
 	}
 
 
-	broker_external_command(NEBTYPE_EXTERNALCOMMAND_END, NEBFLAG_NONE, NEBATTR_NONE, id, command_entry_time(parsed_command), name, args);
+	broker_external_command(NEBTYPE_EXTERNALCOMMAND_END, NEBFLAG_NONE, NEBATTR_NONE, id, entry_time, name, args);
 
-	free(name);
-	free(args);
 	command_destroy(parsed_command);
 	return OK;
 }
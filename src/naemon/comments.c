@@ -12,7 +12,70 @@
 
 comment *comment_list = NULL;
 int defer_comment_sorting = 0;
-comment **comment_hashlist = NULL;
+static comment *comment_list_tail;
+static GHashTable *comment_by_id; /* comment id -> comment */
+static GHashTable *comments_by_object; /* host or service -> GSList of its comments */
+static GHashTable *comments_by_host; /* host name -> first comment in its nexthash chain */
+
+
+static void init_comment_indexes(void)
+{
+	if (comment_by_id != NULL)
+		return;
+
+	comment_by_id = g_hash_table_new(g_direct_hash, g_direct_equal);
+	comments_by_object = g_hash_table_new(g_direct_hash, g_direct_equal);
+	comments_by_host = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+
+static gpointer comment_object(comment *c)
+{
+	if (c->comment_type == HOST_COMMENT)
+		return find_host(c->host_name);
+	return find_service(c->host_name, c->service_description);
+}
+
+
+static void comment_index_add(comment *c)
+{
+	gpointer obj;
+	GSList *list;
+
+	init_comment_indexes();
+	g_hash_table_insert(comment_by_id, GSIZE_TO_POINTER(c->comment_id), c);
+
+	obj = comment_object(c);
+	if (obj == NULL)
+		return;
+	list = g_hash_table_lookup(comments_by_object, obj);
+	g_hash_table_insert(comments_by_object, obj, g_slist_prepend(list, c));
+}
+
+
+static void comment_index_remove(comment *c)
+{
+	gpointer obj;
+	GSList *list;
+
+	g_hash_table_remove(comment_by_id, GSIZE_TO_POINTER(c->comment_id));
+
+	obj = comment_object(c);
+	if (obj == NULL)
+		return;
+	list = g_slist_remove(g_hash_table_lookup(comments_by_object, obj), c);
+	if (list)
+		g_hash_table_insert(comments_by_object, obj, list);
+	else
+		g_hash_table_remove(comments_by_object, obj);
+}
+
+
+static gboolean free_comment_index_entry(gpointer key, gpointer value, gpointer user_data)
+{
+	g_slist_free(value);
+	return TRUE;
+}
 
 
 /******************************************************************/
@@ -142,52 +205,35 @@ int add_new_service_comment(int entry_type, char *host_name, char *svc_descripti
 int delete_comment(int type, unsigned long comment_id)
 {
 	comment *this_comment = NULL;
-	comment *last_comment = NULL;
-	comment *next_comment = NULL;
-	int hashslot = 0;
-	comment *this_hash = NULL;
-	comment *last_hash = NULL;
 
 	/* find the comment we should remove */
-	for (this_comment = comment_list, last_comment = comment_list; this_comment != NULL; this_comment = next_comment) {
-		next_comment = this_comment->next;
-
-		/* we found the comment we should delete */
-		if (this_comment->comment_id == comment_id && this_comment->comment_type == type)
-			break;
-
-		last_comment = this_comment;
-	}
-
-	if (this_comment == NULL)
+	if ((this_comment = find_comment(comment_id, type)) == NULL)
 		return ERROR;
 
 	broker_comment_data(NEBTYPE_COMMENT_DELETE, NEBFLAG_NONE, NEBATTR_NONE, type, this_comment->entry_type, this_comment->host_name, this_comment->service_description, this_comment->entry_time, this_comment->author, this_comment->comment_data, this_comment->persistent, this_comment->source, this_comment->expires, this_comment->expire_time, comment_id);
 
 	/* remove the comment from the list in memory */
+	comment_index_remove(this_comment);
+
 	/* first remove from chained hash list */
-	hashslot = hashfunc(this_comment->host_name, NULL, COMMENT_HASHSLOTS);
-	last_hash = NULL;
-	for (this_hash = comment_hashlist[hashslot]; this_hash; this_hash = this_hash->nexthash) {
-		if (this_hash == this_comment) {
-			if (last_hash)
-				last_hash->nexthash = this_hash->nexthash;
-			else {
-				if (this_hash->nexthash)
-					comment_hashlist[hashslot] = this_hash->nexthash;
-				else
-					comment_hashlist[hashslot] = NULL;
-			}
-			break;
-		}
-		last_hash = this_hash;
-	}
+	if (this_comment->prevhash)
+		this_comment->prevhash->nexthash = this_comment->nexthash;
+	else if (this_comment->nexthash)
+		g_hash_table_insert(comments_by_host, nm_strdup(this_comment->host_name), this_comment->nexthash);
+	else
+		g_hash_table_remove(comments_by_host, this_comment->host_name);
+	if (this_comment->nexthash)
+		this_comment->nexthash->prevhash = this_comment->prevhash;
 
 	/* then removed from linked list */
-	if (comment_list == this_comment)
+	if (this_comment->prev)
+		this_comment->prev->next = this_comment->next;
+	else
 		comment_list = this_comment->next;
+	if (this_comment->next)
+		this_comment->next->prev = this_comment->prev;
 	else
-		last_comment->next = next_comment;
+		comment_list_tail = this_comment->prev;
 
 	nm_free(this_comment->host_name);
 	nm_free(this_comment->service_description);
@@ -242,17 +288,18 @@ int delete_all_host_comments(char *host_name)
 {
 	int result = OK;
 	comment *temp_comment = NULL;
-	comment *next_comment = NULL;
+	GSList *comments, *l;
 
 	if (host_name == NULL)
 		return ERROR;
 
 	/* delete host comments from memory */
-	for (temp_comment = get_first_comment_by_host(host_name); temp_comment != NULL; temp_comment = next_comment) {
-		next_comment = get_next_comment_by_host(host_name, temp_comment);
-		if (temp_comment->comment_type == HOST_COMMENT)
-			delete_comment(HOST_COMMENT, temp_comment->comment_id);
+	comments = g_slist_copy(get_host_comments(find_host(host_name)));
+	for (l = comments; l != NULL; l = l->next) {
+		temp_comment = l->data;
+		delete_comment(HOST_COMMENT, temp_comment->comment_id);
 	}
+	g_slist_free(comments);
 
 	return result;
 }
@@ -263,20 +310,19 @@ int delete_host_acknowledgement_comments(host *hst)
 {
 	int result = OK;
 	comment *temp_comment = NULL;
-	comment *next_comment = NULL;
+	GSList *comments, *l;
 
 	if (hst == NULL)
 		return ERROR;
 
 	/* delete comments from memory */
-	temp_comment = get_first_comment_by_host(hst->name);
-	while (temp_comment) {
-		next_comment = get_next_comment_by_host(hst->name, temp_comment);
-		if (temp_comment->comment_type == HOST_COMMENT && temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE) {
+	comments = g_slist_copy(get_host_comments(hst));
+	for (l = comments; l != NULL; l = l->next) {
+		temp_comment = l->data;
+		if (temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE)
 			delete_comment(HOST_COMMENT, temp_comment->comment_id);
-		}
-		temp_comment = next_comment;
 	}
+	g_slist_free(comments);
 
 	return result;
 }
@@ -287,17 +333,18 @@ int delete_all_service_comments(char *host_name, char *svc_description)
 {
 	int result = OK;
 	comment *temp_comment = NULL;
-	comment *next_comment = NULL;
+	GSList *comments, *l;
 
 	if (host_name == NULL || svc_description == NULL)
 		return ERROR;
 
 	/* delete service comments from memory */
-	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = next_comment) {
-		next_comment = temp_comment->next;
-		if (temp_comment->comment_type == SERVICE_COMMENT && !g_strcmp0(temp_comment->host_name, host_name) && !g_strcmp0(temp_comment->service_description, svc_description))
-			delete_comment(SERVICE_COMMENT, temp_comment->comment_id);
+	comments = g_slist_copy(get_service_comments(find_service(host_name, svc_description)));
+	for (l = comments; l != NULL; l = l->next) {
+		temp_comment = l->data;
+		delete_comment(SERVICE_COMMENT, temp_comment->comment_id);
 	}
+	g_slist_free(comments);
 
 	return result;
 }
@@ -308,17 +355,19 @@ int delete_service_acknowledgement_comments(service *svc)
 {
 	int result = OK;
 	comment *temp_comment = NULL;
-	comment *next_comment = NULL;
+	GSList *comments, *l;
 
 	if (svc == NULL)
 		return ERROR;
 
 	/* delete comments from memory */
-	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = next_comment) {
-		next_comment = temp_comment->next;
-		if (temp_comment->comment_type == SERVICE_COMMENT && !g_strcmp0(temp_comment->host_name, svc->host_name) && !g_strcmp0(temp_comment->service_description, svc->description)  && temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE)
+	comments = g_slist_copy(get_service_comments(svc));
+	for (l = comments; l != NULL; l = l->next) {
+		temp_comment = l->data;
+		if (temp_comment->entry_type == ACKNOWLEDGEMENT_COMMENT && temp_comment->persistent == FALSE)
 			delete_comment(SERVICE_COMMENT, temp_comment->comment_id);
 	}
+	g_slist_free(comments);
 
 	return result;
 }
@@ -328,40 +377,33 @@ int delete_service_acknowledgement_comments(service *svc)
 /****************** CHAINED HASH FUNCTIONS ************************/
 /******************************************************************/
 
-/* adds comment to hash list in memory */
+/*
+ * adds comment to hash list in memory. Every host has a chain of its
+ * own, linked through nexthash and prevhash.
+ */
 int add_comment_to_hashlist(comment *new_comment)
 {
-	comment *temp_comment = NULL;
-	comment *lastpointer = NULL;
-	int hashslot = 0;
-
-	/* initialize hash list */
-	if (comment_hashlist == NULL) {
-		int i;
-
-		comment_hashlist = nm_malloc(sizeof(comment *) * COMMENT_HASHSLOTS);
+	comment *first_comment = NULL;
 
-		for (i = 0; i < COMMENT_HASHSLOTS; i++)
-			comment_hashlist[i] = NULL;
-	}
+	init_comment_indexes();
 
 	if (!new_comment)
 		return 0;
 
-	hashslot = hashfunc(new_comment->host_name, NULL, COMMENT_HASHSLOTS);
-	lastpointer = NULL;
-	for (temp_comment = comment_hashlist[hashslot]; temp_comment && g_strcmp0(temp_comment->host_name, new_comment->host_name) < 0; temp_comment = temp_comment->nexthash) {
-		if (g_strcmp0(temp_comment->host_name, new_comment->host_name) >= 0)
-			break;
-		lastpointer = temp_comment;
+	/* multiples are allowed. The head stays, so the key does too */
+	first_comment = g_hash_table_lookup(comments_by_host, new_comment->host_name);
+	if (first_comment == NULL) {
+		new_comment->prevhash = NULL;
+		new_comment->nexthash = NULL;
+		g_hash_table_insert(comments_by_host, nm_strdup(new_comment->host_name), new_comment);
+		return 1;
 	}
 
-	/* multiples are allowed */
-	if (lastpointer)
-		lastpointer->nexthash = new_comment;
-	else
-		comment_hashlist[hashslot] = new_comment;
-	new_comment->nexthash = temp_comment;
+	new_comment->prevhash = first_comment;
+	new_comment->nexthash = first_comment->nexthash;
+	if (first_comment->nexthash)
+		first_comment->nexthash->prevhash = new_comment;
+	first_comment->nexthash = new_comment;
 
 	return 1;
 }
@@ -397,7 +439,6 @@ int add_service_comment(int entry_type, char *host_name, char *svc_description,
 int add_comment(int comment_type, int entry_type, char *host_name, char *svc_description, time_t entry_time, char *author, char *comment_data, unsigned long comment_id, int persistent, int expires, time_t expire_time, int source)
 {
 	comment *new_comment = NULL;
-	comment *last_comment = NULL;
 	comment *temp_comment = NULL;
 	int result = OK;
 
@@ -405,6 +446,12 @@ int add_comment(int comment_type, int entry_type, char *host_name, char *svc_des
 	if (host_name == NULL || author == NULL || comment_data == NULL || (comment_type == SERVICE_COMMENT && svc_description == NULL))
 		return ERROR;
 
+	/* comment ids are unique */
+	if (find_comment(comment_id, HOST_COMMENT | SERVICE_COMMENT) != NULL) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Ignoring comment with id %lu, which is already in use.\n", comment_id);
+		return ERROR;
+	}
+
 	/* allocate memory for the comment */
 	new_comment = nm_calloc(1, sizeof(comment));
 
@@ -441,32 +488,30 @@ int add_comment(int comment_type, int entry_type, char *host_name, char *svc_des
 		return ERROR;
 	}
 
-	if (defer_comment_sorting) {
-		new_comment->next = comment_list;
-		comment_list = new_comment;
-	} else {
-		/* add new comment to comment list, sorted by comment id */
-		last_comment = comment_list;
-		for (temp_comment = comment_list; temp_comment != NULL; temp_comment = temp_comment->next) {
-			if (new_comment->comment_id < temp_comment->comment_id) {
-				new_comment->next = temp_comment;
-				if (temp_comment == comment_list)
-					comment_list = new_comment;
-				else
-					last_comment->next = new_comment;
-				break;
-			} else
-				last_comment = temp_comment;
-		}
-		if (comment_list == NULL) {
-			new_comment->next = NULL;
-			comment_list = new_comment;
-		} else if (temp_comment == NULL) {
-			new_comment->next = NULL;
-			last_comment->next = new_comment;
-		}
+	comment_index_add(new_comment);
+
+	/*
+	 * add new comment to comment list, sorted by comment id. New
+	 * comments nearly always get the highest id, so look from the end.
+	 */
+	temp_comment = comment_list_tail;
+	if (!defer_comment_sorting) {
+		while (temp_comment != NULL && temp_comment->comment_id > new_comment->comment_id)
+			temp_comment = temp_comment->prev;
 	}
 
+	/* insert after temp_comment, or first if there is none */
+	new_comment->prev = temp_comment;
+	new_comment->next = temp_comment ? temp_comment->next : comment_list;
+	if (temp_comment)
+		temp_comment->next = new_comment;
+	else
+		comment_list = new_comment;
+	if (new_comment->next)
+		new_comment->next->prev = new_comment;
+	else
+		comment_list_tail = new_comment;
+
 	broker_comment_data(NEBTYPE_COMMENT_LOAD, NEBFLAG_NONE, NEBATTR_NONE, comment_type, entry_type, host_name, svc_description, entry_time, author, comment_data, persistent, source, expires, expire_time, comment_id);
 
 	return OK;
@@ -477,7 +522,9 @@ static int comment_compar(const void *p1, const void *p2)
 {
 	comment *c1 = *(comment **)p1;
 	comment *c2 = *(comment **)p2;
-	return c1->comment_id - c2->comment_id;
+	if (c1->comment_id == c2->comment_id)
+		return 0;
+	return c1->comment_id < c2->comment_id ? -1 : 1;
 }
 
 
@@ -507,11 +554,14 @@ int sort_comments(void)
 
 	qsort((void *)array, i, sizeof(*array), comment_compar);
 	comment_list = temp_comment = array[0];
+	temp_comment->prev = NULL;
 	for (i = 1; i < unsorted_comments; i++) {
 		temp_comment->next = array[i];
+		array[i]->prev = temp_comment;
 		temp_comment = temp_comment->next;
 	}
 	temp_comment->next = NULL;
+	comment_list_tail = temp_comment;
 	nm_free(array);
 	return OK;
 }
@@ -537,10 +587,19 @@ void free_comment_data(void)
 		nm_free(this_comment);
 	}
 
-	/* free hash list and reset list pointer */
-	nm_free(comment_hashlist);
-	comment_hashlist = NULL;
+	/* free hash lists and reset list pointer */
 	comment_list = NULL;
+	comment_list_tail = NULL;
+
+	if (comment_by_id != NULL) {
+		g_hash_table_foreach_remove(comments_by_object, free_comment_index_entry, NULL);
+		g_hash_table_destroy(comments_by_object);
+		g_hash_table_destroy(comments_by_host);
+		g_hash_table_destroy(comment_by_id);
+		comments_by_object = NULL;
+		comments_by_host = NULL;
+		comment_by_id = NULL;
+	}
 
 	return;
 }
@@ -553,36 +612,20 @@ void free_comment_data(void)
 /* get the number of comments associated with a particular host */
 int number_of_host_comments(char *host_name)
 {
-	comment *temp_comment = NULL;
-	int total_comments = 0;
-
 	if (host_name == NULL)
 		return 0;
 
-	for (temp_comment = get_first_comment_by_host(host_name); temp_comment != NULL; temp_comment = get_next_comment_by_host(host_name, temp_comment)) {
-		if (temp_comment->comment_type == HOST_COMMENT)
-			total_comments++;
-	}
-
-	return total_comments;
+	return g_slist_length(get_host_comments(find_host(host_name)));
 }
 
 
 /* get the number of comments associated with a particular service */
 int number_of_service_comments(char *host_name, char *svc_description)
 {
-	comment *temp_comment = NULL;
-	int total_comments = 0;
-
 	if (host_name == NULL || svc_description == NULL)
 		return 0;
 
-	for (temp_comment = get_first_comment_by_host(host_name); temp_comment != NULL; temp_comment = get_next_comment_by_host(host_name, temp_comment)) {
-		if (temp_comment->comment_type == SERVICE_COMMENT && !g_strcmp0(temp_comment->service_description, svc_description))
-			total_comments++;
-	}
-
-	return total_comments;
+	return g_slist_length(get_service_comments(find_service(host_name, svc_description)));
 }
 
 
@@ -590,6 +633,22 @@ int number_of_service_comments(char *host_name, char *svc_description)
 /********************* TRAVERSAL FUNCTIONS ************************/
 /******************************************************************/
 
+GSList *get_host_comments(host *hst)
+{
+	if (hst == NULL || comments_by_object == NULL)
+		return NULL;
+	return g_hash_table_lookup(comments_by_object, hst);
+}
+
+
+GSList *get_service_comments(service *svc)
+{
+	if (svc == NULL || comments_by_object == NULL)
+		return NULL;
+	return g_hash_table_lookup(comments_by_object, svc);
+}
+
+
 comment *get_first_comment_by_host(char *host_name)
 {
 
@@ -599,22 +658,13 @@ comment *get_first_comment_by_host(char *host_name)
 
 comment *get_next_comment_by_host(char *host_name, comment *start)
 {
-	comment *temp_comment = NULL;
-
-	if (host_name == NULL || comment_hashlist == NULL)
+	if (host_name == NULL || comments_by_host == NULL)
 		return NULL;
 
 	if (start == NULL)
-		temp_comment = comment_hashlist[hashfunc(host_name, NULL, COMMENT_HASHSLOTS)];
-	else
-		temp_comment = start->nexthash;
-
-	for (; temp_comment && g_strcmp0(temp_comment->host_name, host_name) < 0; temp_comment = temp_comment->nexthash);
-
-	if (temp_comment && g_strcmp0(temp_comment->host_name, host_name) == 0)
-		return temp_comment;
+		return g_hash_table_lookup(comments_by_host, host_name);
 
-	return NULL;
+	return start->nexthash;
 }
 
 
@@ -641,10 +691,12 @@ comment *find_comment(unsigned long comment_id, int comment_type)
 {
 	comment *temp_comment = NULL;
 
-	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = temp_comment->next) {
-		if (temp_comment->comment_id == comment_id && (temp_comment->comment_type & comment_type))
-			return temp_comment;
-	}
+	if (comment_by_id == NULL)
+		return NULL;
+
+	temp_comment = g_hash_table_lookup(comment_by_id, GSIZE_TO_POINTER(comment_id));
+	if (temp_comment && (temp_comment->comment_type & comment_type))
+		return temp_comment;
 
 	return NULL;
 }
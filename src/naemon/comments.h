@@ -5,6 +5,7 @@
 #error "Only <naemon/naemon.h> can be included directly."
 #endif
 
+#include <glib.h>
 #include "common.h"
 #include "objects_host.h"
 #include "objects_service.h"
@@ -51,6 +52,8 @@ typedef struct comment {
 	char 	*comment_data;
 	struct 	comment *next;
 	struct 	comment *nexthash;
+	struct 	comment *prev;
+	struct 	comment *prevhash;
 } comment;
 
 extern struct comment *comment_list;
@@ -75,6 +78,10 @@ struct comment *find_host_comment(unsigned long);                            /*
 struct comment *get_first_comment_by_host(char *);
 struct comment *get_next_comment_by_host(char *, struct comment *);
 
+/* the comments attached to a host or service, in no particular order */
+GSList *get_host_comments(struct host *);
+GSList *get_service_comments(struct service *);
+
 int number_of_host_comments(char *);			              /* returns the number of comments associated with a particular host */
 int number_of_service_comments(char *, char *);		              /* returns the number of comments associated with a particular service */
 
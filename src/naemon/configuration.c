@@ -14,8 +14,11 @@
 #include "configuration.h"
 #include "events.h"
 #include "logging.h"
+#include "statusdata.h"
+#include "xsdincremental.h"
 #include "globals.h"
 #include "perfdata.h"
+#include "workers.h"
 #include "nm_alloc.h"
 #include <sys/types.h>
 #include <dirent.h>
@@ -119,6 +122,31 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 
 		else if (!strcmp(variable, "check_workers"))
 			num_check_workers = atoi(value);
+		else if (!strcmp(variable, "worker_dispatch_batching"))
+			worker_dispatch_batching = (atoi(value) > 0) ? TRUE : FALSE;
+		else if (!strcmp(variable, "worker_dispatch_policy")) {
+			if ((worker_dispatch_policy = wproc_dispatch_policy_by_name(value)) < 0) {
+				nm_asprintf(&error_message, "Illegal value for worker_dispatch_policy");
+				error = TRUE;
+				break;
+			}
+		}
+		else if (!strcmp(variable, "worker_autoscale"))
+			worker_autoscale = (atoi(value) > 0) ? TRUE : FALSE;
+		else if (!strcmp(variable, "worker_autoscale_min")) {
+			if ((worker_autoscale_min = atoi(value)) < 0) {
+				nm_asprintf(&error_message, "Illegal value for worker_autoscale_min");
+				error = TRUE;
+				break;
+			}
+		}
+		else if (!strcmp(variable, "worker_autoscale_max")) {
+			if ((worker_autoscale_max = atoi(value)) < 0) {
+				nm_asprintf(&error_message, "Illegal value for worker_autoscale_max");
+				error = TRUE;
+				break;
+			}
+		}
 		else if (!strcmp(variable, "query_socket")) {
 			nm_free(qh_socket_path);
 			qh_socket_path = nspath_absolute(value, config_file_dir);
@@ -155,6 +183,17 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 		else if (!strcmp(variable, "max_debug_file_size"))
 			max_debug_file_size = strtoul(value, NULL, 0);
 
+		else if (!strcmp(variable, "binary_debug_log")) {
+
+			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
+				nm_asprintf(&error_message, "Illegal value for binary_debug_log");
+				error = TRUE;
+				break;
+			}
+
+			binary_debug_log = (atoi(value) > 0) ? TRUE : FALSE;
+		}
+
 		else if (!strcmp(variable, "command_file")) {
 
 			if (strlen(value) > MAX_FILENAME_LENGTH - 1) {
@@ -354,6 +393,37 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 			log_initial_states = (atoi(value) > 0) ? TRUE : FALSE;
 		}
 
+		else if (!strcmp(variable, "use_async_logging")) {
+
+			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
+				nm_asprintf(&error_message, "Illegal value for use_async_logging");
+				error = TRUE;
+				break;
+			}
+
+			use_async_logging = (atoi(value) > 0) ? TRUE : FALSE;
+		}
+
+		else if (!strcmp(variable, "log_flush_interval")) {
+
+			log_flush_interval = strtoul(value, NULL, 0);
+			if (log_flush_interval == 0) {
+				nm_asprintf(&error_message, "Illegal value for log_flush_interval");
+				error = TRUE;
+				break;
+			}
+		}
+
+		else if (!strcmp(variable, "log_buffer_size")) {
+
+			log_buffer_size = strtoul(value, NULL, 0);
+			if (log_buffer_size == 0) {
+				nm_asprintf(&error_message, "Illegal value for log_buffer_size");
+				error = TRUE;
+				break;
+			}
+		}
+
 		else if (!strcmp(variable, "log_current_states")) {
 
 			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
@@ -386,6 +456,39 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 			}
 		}
 
+		else if (!strcmp(variable, "binary_retention")) {
+
+			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
+				nm_asprintf(&error_message, "Illegal value for binary_retention");
+				error = TRUE;
+				break;
+			}
+
+			binary_retention = (atoi(value) > 0) ? TRUE : FALSE;
+		}
+
+		else if (!strcmp(variable, "background_retention_saves")) {
+
+			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
+				nm_asprintf(&error_message, "Illegal value for background_retention_saves");
+				error = TRUE;
+				break;
+			}
+
+			background_retention_saves = (atoi(value) > 0) ? TRUE : FALSE;
+		}
+
+		else if (!strcmp(variable, "retention_fsync")) {
+
+			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
+				nm_asprintf(&error_message, "Illegal value for retention_fsync");
+				error = TRUE;
+				break;
+			}
+
+			retention_fsync = (atoi(value) > 0) ? TRUE : FALSE;
+		}
+
 		else if (!strcmp(variable, "use_retained_program_state")) {
 
 			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
@@ -548,6 +651,28 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 			}
 		}
 
+		else if (!strcmp(variable, "notification_coalesce_window")) {
+
+			notification_coalesce_window = atoi(value);
+
+			if (notification_coalesce_window < 0) {
+				nm_asprintf(&error_message, "Illegal value for notification_coalesce_window");
+				error = TRUE;
+				break;
+			}
+		}
+
+		else if (!strcmp(variable, "notification_rate_limit")) {
+
+			notification_rate_limit = atoi(value);
+
+			if (notification_rate_limit < 0) {
+				nm_asprintf(&error_message, "Illegal value for notification_rate_limit");
+				error = TRUE;
+				break;
+			}
+		}
+
 		else if (!strcmp(variable, "ocsp_timeout")) {
 
 			ocsp_timeout = atoi(value);
@@ -796,6 +921,17 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 			status_update_interval = atoi(value);
 		}
 
+		else if (!strcmp(variable, "background_status_updates")) {
+
+			if (strlen(value) != 1 || value[0] < '0' || value[0] > '1') {
+				nm_asprintf(&error_message, "Illegal value for background_status_updates");
+				error = TRUE;
+				break;
+			}
+
+			background_status_updates = (atoi(value) > 0) ? TRUE : FALSE;
+		}
+
 		else if (!strcmp(variable, "time_change_threshold")) {
 
 			time_change_threshold = atoi(value);
@@ -942,6 +1078,10 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 		/* BEGIN status data variables */
 		else if (!strcmp(variable, "status_file"))
 			status_file = nspath_absolute(value, config_file_dir);
+		else if (!strcmp(variable, "incremental_status_file")) {
+			nm_free(incremental_status_file);
+			incremental_status_file = nspath_absolute(value, config_file_dir);
+		}
 		else if (strstr(input, "state_retention_file=") == input)
 			retention_file = nspath_absolute(value, config_file_dir);
 		/* END status data variables */
@@ -1088,6 +1228,8 @@ read_config_file(const char *main_config_file, nagios_macros *mac)
 				error = TRUE;
 				break;
 			}
+		} else if (!strcmp(variable, "use_timing_wheel")) {
+			use_timing_wheel = (atoi(value) > 0) ? TRUE : FALSE;
 		}
 		/* skip external data directives */
 		else if (strstr(input, "x") == input)
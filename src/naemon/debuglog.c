@@ -0,0 +1,373 @@
+#include "debuglog.h"
+#include "nm_alloc.h"
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+const char *debuglog_next_conversion(const char *fmt, struct debuglog_conversion *conv)
+{
+	const char *p;
+
+	if (!fmt || !(p = strchr(fmt, '%')))
+		return NULL;
+
+	memset(conv, 0, sizeof(*conv));
+	conv->spec = p++;
+
+	/* flags */
+	while (*p && strchr("-+ #0'I", *p))
+		p++;
+
+	/* field width */
+	if (*p == '*') {
+		conv->star_width = 1;
+		p++;
+	} else {
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	/* precision */
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			conv->star_precision = 1;
+			p++;
+		} else {
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+	}
+
+	/* length modifier */
+	switch (*p) {
+	case 'h':
+		p++;
+		conv->length = DEBUGLOG_LEN_SHORT;
+		if (*p == 'h') {
+			p++;
+			conv->length = DEBUGLOG_LEN_CHAR;
+		}
+		break;
+	case 'l':
+		p++;
+		conv->length = DEBUGLOG_LEN_LONG;
+		if (*p == 'l') {
+			p++;
+			conv->length = DEBUGLOG_LEN_LONG_LONG;
+		}
+		break;
+	case 'q':
+		p++;
+		conv->length = DEBUGLOG_LEN_LONG_LONG;
+		break;
+	case 'L':
+		p++;
+		conv->length = DEBUGLOG_LEN_LONG_DOUBLE;
+		break;
+	case 'j':
+		p++;
+		conv->length = DEBUGLOG_LEN_INTMAX;
+		break;
+	case 'z': case 'Z':
+		p++;
+		conv->length = DEBUGLOG_LEN_SIZE;
+		break;
+	case 't':
+		p++;
+		conv->length = DEBUGLOG_LEN_PTRDIFF;
+		break;
+	}
+
+	/* conversion specifier */
+	switch (*p) {
+	case 'd': case 'i': case 'c': case 'C':
+		conv->type = DEBUGLOG_ARG_INT;
+		break;
+	case 'o': case 'u': case 'x': case 'X':
+		conv->type = DEBUGLOG_ARG_UINT;
+		break;
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		conv->type = DEBUGLOG_ARG_DOUBLE;
+		break;
+	case 's': case 'S':
+		conv->type = DEBUGLOG_ARG_STRING;
+		break;
+	case 'p':
+		conv->type = DEBUGLOG_ARG_POINTER;
+		break;
+	case 'm':
+		conv->type = DEBUGLOG_ARG_ERRNO;
+		break;
+	case 'n':
+		conv->type = DEBUGLOG_ARG_COUNT;
+		break;
+	default:
+		/* '%', something we don't understand, or the end of the string */
+		conv->type = DEBUGLOG_ARG_NONE;
+		break;
+	}
+	if (*p)
+		p++;
+
+	conv->spec_len = p - conv->spec;
+	return p;
+}
+
+/* the arguments of a message record, as they're read back */
+struct debuglog_args {
+	const char *p, *end;
+};
+
+static int read_arg(struct debuglog_args *args, void *dst, size_t len)
+{
+	if ((size_t)(args->end - args->p) < len)
+		return -1;
+	memcpy(dst, args->p, len);
+	args->p += len;
+	return 0;
+}
+
+#define append_arg(out, spec, stars, nstars, val) \
+	do { \
+		if (nstars == 2) \
+			g_string_append_printf(out, spec, stars[0], stars[1], val); \
+		else if (nstars == 1) \
+			g_string_append_printf(out, spec, stars[0], val); \
+		else \
+			g_string_append_printf(out, spec, val); \
+	} while (0)
+
+static int append_conversion(GString *out, const struct debuglog_conversion *conv, struct debuglog_args *args)
+{
+	char spec[64];
+	int stars[2], nstars = 0;
+	int64_t star, i;
+	uint64_t u;
+	double d;
+	uint32_t len;
+	int32_t saved_errno;
+	char *str;
+
+	if (conv->spec_len >= sizeof(spec))
+		return -1;
+	memcpy(spec, conv->spec, conv->spec_len);
+	spec[conv->spec_len] = 0;
+
+	if (conv->star_width) {
+		if (read_arg(args, &star, sizeof(star)) < 0)
+			return -1;
+		stars[nstars++] = (int)star;
+	}
+	if (conv->star_precision) {
+		if (read_arg(args, &star, sizeof(star)) < 0)
+			return -1;
+		stars[nstars++] = (int)star;
+	}
+
+	switch (conv->type) {
+	case DEBUGLOG_ARG_NONE:
+		if (!strcmp(spec, "%%"))
+			g_string_append_c(out, '%');
+		else
+			g_string_append(out, spec);
+		break;
+
+	case DEBUGLOG_ARG_COUNT:
+		break;
+
+	case DEBUGLOG_ARG_ERRNO:
+		if (read_arg(args, &saved_errno, sizeof(saved_errno)) < 0)
+			return -1;
+		g_string_append(out, strerror(saved_errno));
+		break;
+
+	case DEBUGLOG_ARG_INT:
+		if (read_arg(args, &i, sizeof(i)) < 0)
+			return -1;
+		switch (conv->length) {
+		case DEBUGLOG_LEN_LONG:
+			append_arg(out, spec, stars, nstars, (long)i);
+			break;
+		case DEBUGLOG_LEN_LONG_LONG:
+		case DEBUGLOG_LEN_LONG_DOUBLE:
+			append_arg(out, spec, stars, nstars, (long long)i);
+			break;
+		case DEBUGLOG_LEN_INTMAX:
+			append_arg(out, spec, stars, nstars, (intmax_t)i);
+			break;
+		case DEBUGLOG_LEN_SIZE:
+			append_arg(out, spec, stars, nstars, (ssize_t)i);
+			break;
+		case DEBUGLOG_LEN_PTRDIFF:
+			append_arg(out, spec, stars, nstars, (ptrdiff_t)i);
+			break;
+		default:
+			append_arg(out, spec, stars, nstars, (int)i);
+			break;
+		}
+		break;
+
+	case DEBUGLOG_ARG_UINT:
+		if (read_arg(args, &u, sizeof(u)) < 0)
+			return -1;
+		switch (conv->length) {
+		case DEBUGLOG_LEN_LONG:
+			append_arg(out, spec, stars, nstars, (unsigned long)u);
+			break;
+		case DEBUGLOG_LEN_LONG_LONG:
+		case DEBUGLOG_LEN_LONG_DOUBLE:
+			append_arg(out, spec, stars, nstars, (unsigned long long)u);
+			break;
+		case DEBUGLOG_LEN_INTMAX:
+			append_arg(out, spec, stars, nstars, (uintmax_t)u);
+			break;
+		case DEBUGLOG_LEN_SIZE:
+			append_arg(out, spec, stars, nstars, (size_t)u);
+			break;
+		case DEBUGLOG_LEN_PTRDIFF:
+			append_arg(out, spec, stars, nstars, (ptrdiff_t)u);
+			break;
+		default:
+			append_arg(out, spec, stars, nstars, (unsigned int)u);
+			break;
+		}
+		break;
+
+	case DEBUGLOG_ARG_DOUBLE:
+		if (read_arg(args, &d, sizeof(d)) < 0)
+			return -1;
+		if (conv->length == DEBUGLOG_LEN_LONG_DOUBLE)
+			append_arg(out, spec, stars, nstars, (long double)d);
+		else
+			append_arg(out, spec, stars, nstars, d);
+		break;
+
+	case DEBUGLOG_ARG_POINTER:
+		if (read_arg(args, &u, sizeof(u)) < 0)
+			return -1;
+		append_arg(out, spec, stars, nstars, (void *)(uintptr_t)u);
+		break;
+
+	case DEBUGLOG_ARG_STRING:
+		if (read_arg(args, &len, sizeof(len)) < 0)
+			return -1;
+		if (len == DEBUGLOG_NULL_STRING) {
+			append_arg(out, spec, stars, nstars, "(null)");
+			break;
+		}
+		if ((size_t)(args->end - args->p) < len)
+			return -1;
+		str = nm_strndup(args->p, len);
+		args->p += len;
+		append_arg(out, spec, stars, nstars, str);
+		nm_free(str);
+		break;
+	}
+
+	return 0;
+}
+
+static void append_message(GString *out, const struct debuglog_record *rec, const char *fmt)
+{
+	struct debuglog_conversion conv;
+	struct debuglog_args args;
+	const char *next;
+
+	args.p = (const char *)(rec + 1);
+	args.end = (const char *)rec + rec->len;
+
+	while ((next = debuglog_next_conversion(fmt, &conv))) {
+		g_string_append_len(out, fmt, conv.spec - fmt);
+		if (append_conversion(out, &conv, &args) < 0) {
+			g_string_append(out, "[truncated]\n");
+			return;
+		}
+		fmt = next;
+	}
+	g_string_append(out, fmt);
+}
+
+/* returns the record at *pos and moves *pos past it */
+static const struct debuglog_record *next_record(const char *ring, uint64_t ring_size, uint64_t *pos, uint64_t head)
+{
+	const struct debuglog_record *rec;
+	uint64_t offset;
+
+	if (*pos >= head)
+		return NULL;
+
+	offset = *pos % ring_size;
+	if (offset + DEBUGLOG_ALIGN > ring_size)
+		return NULL;
+	rec = (const struct debuglog_record *)(ring + offset);
+	if (rec->len < DEBUGLOG_ALIGN || rec->len % DEBUGLOG_ALIGN || offset + rec->len > ring_size)
+		return NULL;
+	if (rec->type != DEBUGLOG_WRAP && rec->len < sizeof(*rec))
+		return NULL;
+
+	*pos += rec->len;
+	return rec;
+}
+
+/* the string in a format record, if it's terminated */
+static const char *format_string(const struct debuglog_record *rec)
+{
+	const char *str = (const char *)(rec + 1);
+
+	return memchr(str, 0, rec->len - sizeof(*rec)) ? str : NULL;
+}
+
+long debuglog_decode(const char *buf, size_t size, GString *out)
+{
+	const struct debuglog_header *hdr = (const struct debuglog_header *)buf;
+	const struct debuglog_record *rec;
+	GHashTable *formats;
+	const char *ring, *fmt;
+	uint64_t ring_size, pos;
+	long messages = 0;
+
+	if (size < sizeof(*hdr) || memcmp(hdr->magic, DEBUGLOG_MAGIC, sizeof(DEBUGLOG_MAGIC)))
+		return -1;
+	if (hdr->version != DEBUGLOG_VERSION || hdr->size != size)
+		return -1;
+	if (hdr->header_size < sizeof(*hdr) || hdr->header_size >= size || hdr->header_size % DEBUGLOG_ALIGN)
+		return -1;
+	if (hdr->head < hdr->tail)
+		return -1;
+
+	ring = buf + hdr->header_size;
+	ring_size = size - hdr->header_size;
+
+	/*
+	 * a message may come after its format string was evicted, so the
+	 * first copy of each that's left is what we start out with
+	 */
+	formats = g_hash_table_new(g_int64_hash, g_int64_equal);
+	for (pos = hdr->tail; (rec = next_record(ring, ring_size, &pos, hdr->head));) {
+		if (rec->type != DEBUGLOG_FORMAT || !format_string(rec))
+			continue;
+		if (!g_hash_table_lookup(formats, &rec->fmt))
+			g_hash_table_insert(formats, (gpointer)&rec->fmt, (gpointer)format_string(rec));
+	}
+
+	/* the same address may hold another format once a module is unloaded */
+	for (pos = hdr->tail; (rec = next_record(ring, ring_size, &pos, hdr->head));) {
+		if (rec->type == DEBUGLOG_FORMAT && format_string(rec))
+			g_hash_table_insert(formats, (gpointer)&rec->fmt, (gpointer)format_string(rec));
+		if (rec->type != DEBUGLOG_MESSAGE)
+			continue;
+		messages++;
+		g_string_append_printf(out, "[%ld.%06ld] [%03d.%d] [pid=%lu] ",
+		                       (long)rec->tv_sec, (long)rec->tv_usec, rec->level, rec->verbosity, (unsigned long)hdr->pid);
+		fmt = g_hash_table_lookup(formats, &rec->fmt);
+		if (fmt)
+			append_message(out, rec, fmt);
+		else
+			g_string_append_printf(out, "[format %#llx is no longer in the log]\n", (unsigned long long)rec->fmt);
+	}
+	g_hash_table_destroy(formats);
+
+	return messages;
+}
@@ -0,0 +1,135 @@
+#ifndef INCLUDE_debuglog_h__
+#define INCLUDE_debuglog_h__
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <glib.h>
+#include "lib/lnae-utils.h"
+
+/*
+ * The binary debug log.
+ *
+ * With binary_debug_log enabled, log_debug_info() doesn't format
+ * anything. It copies the address of the format string, a timestamp
+ * and the raw arguments into a ring of records in a memory mapped
+ * file, and naemondebug turns that back into text later.
+ *
+ * The file starts with a header, followed by the ring. Records are
+ * addressed by the number of bytes written to the ring before them,
+ * so "head" and "tail" only ever grow. A record's offset in the file
+ * is header_size + (position % (size - header_size)). Records never
+ * straddle the end of the ring; a DEBUGLOG_WRAP record pads out the
+ * space that is left when the next record doesn't fit.
+ *
+ * A format string is stored once in a DEBUGLOG_FORMAT record, keyed by
+ * its address. When that record is overwritten, the next message using
+ * the format stores it again.
+ */
+
+NAGIOS_BEGIN_DECL
+
+#define DEBUGLOG_MAGIC "NMDEBUG"
+#define DEBUGLOG_VERSION 1
+#define DEBUGLOG_HEADER_SIZE 4096
+#define DEBUGLOG_MIN_SIZE (64 * 1024)
+#define DEBUGLOG_ALIGN 8
+#define DEBUGLOG_MAX_STRING 1024 /* longer %s arguments are truncated */
+
+struct debuglog_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t size; /* of the whole file */
+	uint64_t head; /* position of the next record */
+	uint64_t tail; /* position of the oldest record */
+	int64_t pid;
+};
+
+enum debuglog_record_type {
+	DEBUGLOG_WRAP,
+	DEBUGLOG_FORMAT, /* followed by the nul-terminated format string */
+	DEBUGLOG_MESSAGE, /* followed by the arguments */
+};
+
+/* len is a multiple of DEBUGLOG_ALIGN and includes the header */
+struct debuglog_record {
+	uint32_t len;
+	uint16_t type;
+	uint16_t verbosity;
+	int32_t level;
+	uint32_t reserved;
+	uint64_t fmt; /* address of the format string */
+	int64_t tv_sec;
+	int64_t tv_usec;
+};
+
+/*
+ * Arguments follow a message record in the order the format string
+ * consumes them, unaligned:
+ *   integers, '*' widths and precisions: 8 bytes, sign or zero extended
+ *   floating point: a double
+ *   %s: a 4 byte length, then that many bytes (~0 for a NULL pointer)
+ *   %p: 8 bytes
+ *   %m: the 4 byte errno at the time of the call
+ */
+#define DEBUGLOG_NULL_STRING UINT32_MAX
+
+enum debuglog_arg_type {
+	DEBUGLOG_ARG_NONE, /* %%, or a conversion we don't know */
+	DEBUGLOG_ARG_INT,
+	DEBUGLOG_ARG_UINT,
+	DEBUGLOG_ARG_DOUBLE,
+	DEBUGLOG_ARG_STRING,
+	DEBUGLOG_ARG_POINTER,
+	DEBUGLOG_ARG_ERRNO,
+	DEBUGLOG_ARG_COUNT, /* %n, which we never write to */
+};
+
+enum debuglog_arg_length {
+	DEBUGLOG_LEN_DEFAULT,
+	DEBUGLOG_LEN_CHAR,
+	DEBUGLOG_LEN_SHORT,
+	DEBUGLOG_LEN_LONG,
+	DEBUGLOG_LEN_LONG_LONG,
+	DEBUGLOG_LEN_LONG_DOUBLE,
+	DEBUGLOG_LEN_INTMAX,
+	DEBUGLOG_LEN_SIZE,
+	DEBUGLOG_LEN_PTRDIFF,
+};
+
+/* a single conversion specification in a printf() format string */
+struct debuglog_conversion {
+	const char *spec; /* points to the '%' */
+	size_t spec_len;
+	enum debuglog_arg_type type;
+	enum debuglog_arg_length length;
+	int star_width; /* width is passed as an argument */
+	int star_precision; /* precision is passed as an argument */
+};
+
+/**
+ * Finds the next conversion in a printf() format string
+ * @param fmt Where to start looking
+ * @param conv Filled in with the conversion found
+ * @return Pointer to the character after the conversion, or NULL if
+ *         there are no more conversions in fmt
+ */
+const char *debuglog_next_conversion(const char *fmt, struct debuglog_conversion *conv);
+
+/**
+ * Turns a copy of a binary debug log back into text, oldest message
+ * first, formatted the way the text debug log would have had it
+ * @param buf The contents of the log file
+ * @param size The size of buf
+ * @param out Where to append the text
+ * @return The number of messages decoded, or -1 if buf isn't a binary
+ *         debug log
+ */
+long debuglog_decode(const char *buf, size_t size, GString *out);
+
+NAGIOS_END_DECL
+#endif
@@ -25,7 +25,11 @@
 #define DEFAULT_RETENTION_UPDATE_INTERVAL			60	/* minutes between auto-save of retention data */
 #define DEFAULT_RETAINED_SCHEDULING_RANDOMIZE_WINDOW	60	/* number of seconds used for randomizing the re-scheduling of checks missed over a restart */
 #define DEFAULT_RETENTION_SCHEDULING_HORIZON    		900     /* max seconds between program restarts that we will preserve scheduling information */
+#define DEFAULT_BINARY_RETENTION				0	/* write retention data in the text format */
+#define DEFAULT_BACKGROUND_RETENTION_SAVES			0	/* auto-save retention data from the main process */
+#define DEFAULT_RETENTION_FSYNC					1	/* sync the retention file to disk before it replaces the old one */
 #define DEFAULT_STATUS_UPDATE_INTERVAL				60	/* seconds between aggregated status data updates */
+#define DEFAULT_BACKGROUND_STATUS_UPDATES			0	/* write status data from the main process */
 #define DEFAULT_FRESHNESS_CHECK_INTERVAL        		60      /* seconds between service result freshness checks */
 #define DEFAULT_ORPHAN_CHECK_INTERVAL           		60      /* seconds between checks for orphaned hosts and services */
 
@@ -47,10 +51,14 @@
 #define DEFAULT_LOG_CURRENT_STATES				1	/* log current service and host states after rotating log */
 #define DEFAULT_LOG_EXTERNAL_COMMANDS				1	/* log external commands */
 #define DEFAULT_LOG_PASSIVE_CHECKS				1	/* log passive service checks */
+#define DEFAULT_USE_ASYNC_LOGGING				0	/* write to the log file from the main thread */
+#define DEFAULT_LOG_FLUSH_INTERVAL				100	/* milliseconds between asynchronous log writes */
+#define DEFAULT_LOG_BUFFER_SIZE					1048576	/* bytes of log lines to queue for the log writer */
 
 #define DEFAULT_DEBUG_LEVEL                                     0       /* don't log any debugging information */
 #define DEFAULT_DEBUG_VERBOSITY                                 1
 #define DEFAULT_MAX_DEBUG_FILE_SIZE                             1000000 /* max size of debug log */
+#define DEFAULT_BINARY_DEBUG_LOG                                0       /* write the debug log as text */
 
 #define DEFAULT_AGGRESSIVE_HOST_CHECKING			0	/* don't use "aggressive" host checking */
 #define DEFAULT_CHECK_EXTERNAL_COMMANDS				1 	/* check for external commands */
@@ -89,6 +97,14 @@
 #define DEFAULT_ALLOW_CIRCULAR_DEPENDENCIES             0        /* Allow circular depdendencies */
 #define DEFAULT_HOST_DOWN_DISABLE_SERVICE_CHECKS        0        /* run service checks if the host is down */
 #define DEFAULT_SKIP_CHECK_STATUS                      -1        /* do not change status by default */
+#define DEFAULT_USE_TIMING_WHEEL                        1        /* schedule events using the timing wheel */
+#define DEFAULT_WORKER_DISPATCH_BATCHING                1        /* send jobs to workers in batches */
+#define DEFAULT_WORKER_DISPATCH_POLICY                  WPROC_DISPATCH_ROUND_ROBIN /* take turns handing jobs to workers */
+#define DEFAULT_WORKER_AUTOSCALE                        0        /* keep the number of core workers fixed */
+#define DEFAULT_WORKER_AUTOSCALE_MIN                    0        /* as many as check_workers starts */
+#define DEFAULT_WORKER_AUTOSCALE_MAX                    0        /* twice as many as check_workers starts */
+#define DEFAULT_NOTIFICATION_COALESCE_WINDOW            0        /* send each notification on its own */
+#define DEFAULT_NOTIFICATION_RATE_LIMIT                 0        /* no limit on notifications sent per second */
 
 #define DEFAULT_HOST_PERFDATA_FILE_TEMPLATE "[HOSTPERFDATA]\t$TIMET$\t$HOSTNAME$\t$HOSTEXECUTIONTIME$\t$HOSTOUTPUT$\t$HOSTPERFDATA$"
 #define DEFAULT_SERVICE_PERFDATA_FILE_TEMPLATE "[SERVICEPERFDATA]\t$TIMET$\t$HOSTNAME$\t$SERVICEDESC$\t$SERVICEEXECUTIONTIME$\t$SERVICELATENCY$\t$SERVICEOUTPUT$\t$SERVICEPERFDATA$"
@@ -16,6 +16,9 @@
 scheduled_downtime *scheduled_downtime_list = NULL;
 int		   defer_downtime_sorting = 0;
 static GHashTable *dt_hashtable;
+static GTree *dt_tree; /* all downtimes, in scheduled_downtime_list order */
+static GHashTable *dt_by_object; /* host or service -> GSList of its downtimes */
+static GHashTable *dt_by_trigger; /* downtime id -> GSList of downtimes it triggers */
 
 
 #define DT_ENULL (-1)
@@ -26,7 +29,7 @@ static GHashTable *dt_hashtable;
 #define DT_ETIME (-6)
 
 
-static void check_for_expired_downtime(struct nm_event_execution_properties *evprop);
+static void handle_downtime_expire_event(struct nm_event_execution_properties *evprop);
 static int handle_scheduled_downtime_start(scheduled_downtime *dt);
 static int handle_scheduled_downtime_stop(scheduled_downtime *dt);
 
@@ -47,10 +50,11 @@ static const char *dt_strerror(int err)
 }
 
 
-static int downtime_compar(const void *p1, const void *p2)
+/* orders downtimes by start time, and tells them all apart */
+static gint downtime_compar(gconstpointer p1, gconstpointer p2)
 {
-	scheduled_downtime *d1 = *(scheduled_downtime **)p1;
-	scheduled_downtime *d2 = *(scheduled_downtime **)p2;
+	const scheduled_downtime *d1 = p1;
+	const scheduled_downtime *d2 = p2;
 
 	/*
 		If the start times of two downtimes are equal and one is triggered
@@ -78,21 +82,83 @@ static int downtime_compar(const void *p1, const void *p2)
 		implications of this were not well understood.
 	*/
 
-	if (d1->start_time == d2->start_time) {
-		if ((d1->triggered_by == 0 && d2->triggered_by != 0) ||
-		    (d1->triggered_by != 0 && d2->triggered_by == 0)) {
-			return d1->triggered_by == 0 ? -1 : 1;
-		}
-	}
-	return (d1->start_time < d2->start_time) ? -1 : (d1->start_time - d2->start_time);
+	if (d1->start_time != d2->start_time)
+		return d1->start_time < d2->start_time ? -1 : 1;
+	if (!d1->triggered_by != !d2->triggered_by)
+		return d1->triggered_by == 0 ? -1 : 1;
+	if (d1->downtime_id != d2->downtime_id)
+		return d1->downtime_id < d2->downtime_id ? -1 : 1;
+	if (d1 != d2)
+		return d1 < d2 ? -1 : 1;
+	return 0;
+}
+
+
+/* the downtimes on either side of one that isn't in dt_tree yet */
+struct downtime_neighbours {
+	scheduled_downtime *dt;
+	scheduled_downtime *prev, *next;
+};
+
+/*
+ * g_tree_search() callback. The search walks down the tree towards
+ * where nb->dt would go, so the last downtime it passes on either side
+ * is its neighbour in the list.
+ */
+static gint find_downtime_neighbours(gconstpointer key, gconstpointer data)
+{
+	struct downtime_neighbours *nb = (struct downtime_neighbours *)data;
+	scheduled_downtime *cur = (scheduled_downtime *)key;
+	gint cmp = downtime_compar(nb->dt, cur);
+
+	if (cmp < 0)
+		nb->next = cur;
+	else
+		nb->prev = cur;
+	return cmp;
+}
+
+
+static void downtime_index_add(GHashTable *index, gpointer key, scheduled_downtime *dt)
+{
+	GSList *list = g_hash_table_lookup(index, key);
+	g_hash_table_insert(index, key, g_slist_prepend(list, dt));
+}
+
+
+static void downtime_index_remove(GHashTable *index, gpointer key, scheduled_downtime *dt)
+{
+	GSList *list = g_hash_table_lookup(index, key);
+
+	list = g_slist_remove(list, dt);
+	if (list)
+		g_hash_table_insert(index, key, list);
+	else
+		g_hash_table_remove(index, key);
+}
+
+
+static gboolean free_downtime_index_entry(gpointer key, gpointer value, gpointer user_data)
+{
+	g_slist_free(value);
+	return TRUE;
+}
+
+
+static gpointer downtime_object(scheduled_downtime *dt)
+{
+	if (dt->type == HOST_DOWNTIME)
+		return find_host(dt->host_name);
+	return find_service(dt->host_name, dt->service_description);
 }
 
 
 static int downtime_add(scheduled_downtime *dt)
 {
 	scheduled_downtime *trigger = NULL;
-	struct host *h;
-	struct service *s;
+	struct host *h = NULL;
+	struct service *s = NULL;
+	struct downtime_neighbours nb;
 
 	if (!dt)
 		return DT_ENULL;
@@ -141,35 +207,24 @@ static int downtime_add(scheduled_downtime *dt)
 
 	g_hash_table_insert(dt_hashtable, GINT_TO_POINTER(dt->downtime_id), dt);
 
-	if (defer_downtime_sorting || !scheduled_downtime_list ||
-	    downtime_compar(&dt, &scheduled_downtime_list) < 0) {
-		if (scheduled_downtime_list) {
-			scheduled_downtime_list->prev = dt;
-		}
-		dt->next = scheduled_downtime_list;
-		dt->prev = NULL;
+	/* link it into the list next to its neighbours in the tree */
+	nb.dt = dt;
+	nb.prev = nb.next = NULL;
+	g_tree_search(dt_tree, find_downtime_neighbours, &nb);
+	g_tree_insert(dt_tree, dt, dt);
+	dt->prev = nb.prev;
+	dt->next = nb.next;
+	if (nb.prev)
+		nb.prev->next = dt;
+	else
 		scheduled_downtime_list = dt;
-	} else {
-		scheduled_downtime *cur;
-
-		/* add new downtime to downtime list, sorted by start time */
-		for (cur = scheduled_downtime_list; cur; cur = cur->next) {
-			if (downtime_compar(&dt, &cur) < 0) {
-				dt->prev = cur->prev;
-				if (cur->prev)
-					cur->prev->next = dt;
-				dt->next = cur;
-				cur->prev = dt;
-				break;
-			}
-			if (!cur->next) {
-				dt->next = NULL;
-				cur->next = dt;
-				dt->prev = cur;
-				break;
-			}
-		}
-	}
+	if (nb.next)
+		nb.next->prev = dt;
+
+	downtime_index_add(dt_by_object, h ? (gpointer)h : (gpointer)s, dt);
+	if (dt->triggered_by)
+		downtime_index_add(dt_by_trigger, GINT_TO_POINTER(dt->triggered_by), dt);
+
 	return OK;
 }
 
@@ -177,6 +232,11 @@ static int downtime_add(scheduled_downtime *dt)
 static void downtime_remove(scheduled_downtime *dt)
 {
 	g_hash_table_remove(dt_hashtable, GINT_TO_POINTER(dt->downtime_id));
+	g_tree_remove(dt_tree, dt);
+	downtime_index_remove(dt_by_object, downtime_object(dt), dt);
+	if (dt->triggered_by)
+		downtime_index_remove(dt_by_trigger, GINT_TO_POINTER(dt->triggered_by), dt);
+
 	if (scheduled_downtime_list == dt) {
 		scheduled_downtime_list = dt->next;
 		if (scheduled_downtime_list)
@@ -197,6 +257,9 @@ static void downtime_remove(scheduled_downtime *dt)
 int initialize_downtime_data(void)
 {
 	dt_hashtable = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dt_tree = g_tree_new(downtime_compar);
+	dt_by_object = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dt_by_trigger = g_hash_table_new(g_direct_hash, g_direct_equal);
 	next_downtime_id = 1;
 	return OK;
 }
@@ -303,7 +366,7 @@ int schedule_downtime(int type, char *host_name, char *service_description, time
 int unschedule_downtime(int type, unsigned long downtime_id)
 {
 	scheduled_downtime *temp_downtime = NULL;
-	scheduled_downtime *next_downtime = NULL;
+	GSList *triggered;
 	host *hst = NULL;
 	service *svc = NULL;
 	int attr = 0;
@@ -383,24 +446,10 @@ int unschedule_downtime(int type, unsigned long downtime_id)
 	else
 		delete_service_downtime(downtime_id);
 
-	/*
-	 * unschedule all downtime entries that were triggered by this one
-	 * @TODO: Fix this algorithm so it uses something sane instead
-	 * of this horrible mess of recursive O(n * t), where t is
-	 * "downtime triggered by this downtime"
-	 */
-	while (1) {
-
-		for (temp_downtime = scheduled_downtime_list; temp_downtime != NULL; temp_downtime = next_downtime) {
-			next_downtime = temp_downtime->next;
-			if (temp_downtime->triggered_by == downtime_id) {
-				unschedule_downtime(ANY_DOWNTIME, temp_downtime->downtime_id);
-				break;
-			}
-		}
-
-		if (temp_downtime == NULL)
-			break;
+	/* unschedule all downtime entries that were triggered by this one */
+	while ((triggered = g_hash_table_lookup(dt_by_trigger, GINT_TO_POINTER(downtime_id)))) {
+		temp_downtime = triggered->data;
+		unschedule_downtime(ANY_DOWNTIME, temp_downtime->downtime_id);
 	}
 
 	return OK;
@@ -517,7 +566,9 @@ int register_downtime(int type, unsigned long downtime_id)
 			 *	when its "handle_downtime_stop_event" event is invoked (scheduled above)
 			 */
 			log_debug_info(DEBUGL_DOWNTIME, 1, "Scheduling downtime expire event in case flexible downtime is never triggered\n");
-			temp_downtime->stop_event = schedule_event((temp_downtime->end_time + 1) - time(NULL), check_for_expired_downtime, NULL);
+			new_downtime_id = nm_malloc(sizeof(unsigned long));
+			*new_downtime_id = downtime_id;
+			temp_downtime->stop_event = schedule_event((temp_downtime->end_time + 1) - time(NULL), handle_downtime_expire_event, (void *)new_downtime_id);
 			if (temp_downtime->flex_downtime_start > 0) {
 				new_downtime_id = nm_malloc(sizeof(unsigned long));
 				*new_downtime_id = downtime_id;
@@ -534,6 +585,13 @@ int register_downtime(int type, unsigned long downtime_id)
 
 		}
 
+		/* ...but they must go away if their trigger never fires */
+		else {
+			new_downtime_id = nm_malloc(sizeof(unsigned long));
+			*new_downtime_id = downtime_id;
+			temp_downtime->stop_event = schedule_event((temp_downtime->end_time + 1) - time(NULL), handle_downtime_expire_event, (void *)new_downtime_id);
+		}
+
 	}
 
 	return OK;
@@ -565,7 +623,7 @@ int handle_scheduled_downtime_by_id(unsigned long downtime_id)
 
 static int handle_scheduled_downtime_stop(scheduled_downtime *temp_downtime)
 {
-	scheduled_downtime *this_downtime = NULL;
+	GSList *triggered;
 	host *hst = NULL;
 	service *svc = NULL;
 	int attr = 0;
@@ -631,20 +689,10 @@ static int handle_scheduled_downtime_stop(scheduled_downtime *temp_downtime)
 	else
 		update_service_status(svc, FALSE);
 
-	/* handle (stop) downtime that is triggered by this one */
-	while (1) {
-
-		/* list contents might change by recursive calls, so we use this inefficient method to prevent segfaults */
-		for (this_downtime = scheduled_downtime_list; this_downtime != NULL; this_downtime = this_downtime->next) {
-			if (this_downtime->triggered_by == temp_downtime->downtime_id) {
-				handle_scheduled_downtime(this_downtime);
-				break;
-			}
-		}
-
-		if (this_downtime == NULL)
-			break;
-	}
+	/* handle (stop) downtime that is triggered by this one. They're
+	 * removed from the index once they've stopped */
+	while ((triggered = g_hash_table_lookup(dt_by_trigger, GINT_TO_POINTER(temp_downtime->downtime_id))))
+		handle_scheduled_downtime(triggered->data);
 
 	temp_downtime->is_in_effect = FALSE;
 
@@ -661,6 +709,7 @@ static int handle_scheduled_downtime_start(scheduled_downtime *temp_downtime)
 {
 
 	scheduled_downtime *this_downtime = NULL;
+	GSList *triggered, *list;
 	host *hst = NULL;
 	service *svc = NULL;
 	time_t event_time = 0L;
@@ -739,16 +788,20 @@ static int handle_scheduled_downtime_start(scheduled_downtime *temp_downtime)
 	new_downtime_id = nm_malloc(sizeof(unsigned long));
 	*new_downtime_id = temp_downtime->downtime_id;
 
+	/* the downtime has started, so it won't expire */
+	if (temp_downtime->stop_event)
+		destroy_event(temp_downtime->stop_event);
 	temp_downtime->stop_event = schedule_event(event_time - time(NULL), handle_downtime_stop_event, (void *)new_downtime_id);
 
 	/* handle (start) downtime that is triggered by this one */
-	for (this_downtime = scheduled_downtime_list; this_downtime != NULL; this_downtime = this_downtime->next) {
-		if (this_downtime->triggered_by == temp_downtime->downtime_id) {
-			/* Initialize the flex_downtime_start as it has not been initialized as a flexible downtime */
-			this_downtime->flex_downtime_start = temp_downtime->flex_downtime_start;
-			handle_scheduled_downtime(this_downtime);
-		}
+	triggered = g_slist_copy(g_hash_table_lookup(dt_by_trigger, GINT_TO_POINTER(temp_downtime->downtime_id)));
+	for (list = triggered; list; list = list->next) {
+		this_downtime = list->data;
+		/* Initialize the flex_downtime_start as it has not been initialized as a flexible downtime */
+		this_downtime->flex_downtime_start = temp_downtime->flex_downtime_start;
+		handle_scheduled_downtime(this_downtime);
 	}
+	g_slist_free(triggered);
 
 	return OK;
 }
@@ -771,6 +824,7 @@ int handle_scheduled_downtime(scheduled_downtime *temp_downtime)
 int check_pending_flex_host_downtime(host *hst)
 {
 	scheduled_downtime *temp_downtime = NULL;
+	GSList *list;
 	time_t current_time = 0L;
 	unsigned long *new_downtime_id = NULL;
 	int num_downtimes_start = 0;
@@ -784,11 +838,9 @@ int check_pending_flex_host_downtime(host *hst)
 	if (hst->current_state == STATE_UP)
 		return OK;
 
-	/* check all downtime entries */
-	for (temp_downtime = scheduled_downtime_list; temp_downtime != NULL; temp_downtime = temp_downtime->next) {
-
-		if (temp_downtime->type != HOST_DOWNTIME)
-			continue;
+	/* check all downtime entries for this host */
+	for (list = get_host_downtimes(hst); list; list = list->next) {
+		temp_downtime = list->data;
 
 		if (temp_downtime->fixed == TRUE)
 			continue;
@@ -800,21 +852,17 @@ int check_pending_flex_host_downtime(host *hst)
 		if (temp_downtime->triggered_by != 0)
 			continue;
 
-		/* this entry matches our host! */
-		if (find_host(temp_downtime->host_name) == hst) {
-
-			/* if the time boundaries are okay, start this scheduled downtime */
-			if (temp_downtime->start_time <= current_time && current_time <= temp_downtime->end_time) {
+		/* if the time boundaries are okay, start this scheduled downtime */
+		if (temp_downtime->start_time <= current_time && current_time <= temp_downtime->end_time) {
 
-				log_debug_info(DEBUGL_DOWNTIME, 0, "Flexible downtime (id=%lu) for host '%s' starting now...\n", temp_downtime->downtime_id, hst->name);
-				temp_downtime->flex_downtime_start = current_time;
+			log_debug_info(DEBUGL_DOWNTIME, 0, "Flexible downtime (id=%lu) for host '%s' starting now...\n", temp_downtime->downtime_id, hst->name);
+			temp_downtime->flex_downtime_start = current_time;
 
-				new_downtime_id = nm_malloc(sizeof(unsigned long));
-				*new_downtime_id = temp_downtime->downtime_id;
+			new_downtime_id = nm_malloc(sizeof(unsigned long));
+			*new_downtime_id = temp_downtime->downtime_id;
 
-				temp_downtime->start_event = schedule_event(temp_downtime->flex_downtime_start - time(NULL), handle_downtime_start_event, (void *)new_downtime_id);
-				num_downtimes_start++;
-			}
+			temp_downtime->start_event = schedule_event(temp_downtime->flex_downtime_start - time(NULL), handle_downtime_start_event, (void *)new_downtime_id);
+			num_downtimes_start++;
 		}
 	}
 
@@ -828,6 +876,7 @@ int check_pending_flex_host_downtime(host *hst)
 int check_pending_flex_service_downtime(service *svc)
 {
 	scheduled_downtime *temp_downtime = NULL;
+	GSList *list;
 	time_t current_time = 0L;
 	unsigned long *new_downtime_id = NULL;
 	int num_downtimes_start = 0;
@@ -841,11 +890,9 @@ int check_pending_flex_service_downtime(service *svc)
 	if (svc->current_state == STATE_OK)
 		return OK;
 
-	/* check all downtime entries */
-	for (temp_downtime = scheduled_downtime_list; temp_downtime != NULL; temp_downtime = temp_downtime->next) {
-
-		if (temp_downtime->type != SERVICE_DOWNTIME)
-			continue;
+	/* check all downtime entries for this service */
+	for (list = get_service_downtimes(svc); list; list = list->next) {
+		temp_downtime = list->data;
 
 		if (temp_downtime->fixed == TRUE)
 			continue;
@@ -857,22 +904,18 @@ int check_pending_flex_service_downtime(service *svc)
 		if (temp_downtime->triggered_by != 0)
 			continue;
 
-		/* this entry matches our service! */
-		if (find_service(temp_downtime->host_name, temp_downtime->service_description) == svc) {
-
-			/* if the time boundaries are okay, start this scheduled downtime */
-			if (temp_downtime->start_time <= current_time && current_time <= temp_downtime->end_time) {
+		/* if the time boundaries are okay, start this scheduled downtime */
+		if (temp_downtime->start_time <= current_time && current_time <= temp_downtime->end_time) {
 
-				log_debug_info(DEBUGL_DOWNTIME, 0, "Flexible downtime (id=%lu) for service '%s' on host '%s' starting now...\n", temp_downtime->downtime_id, svc->description, svc->host_name);
+			log_debug_info(DEBUGL_DOWNTIME, 0, "Flexible downtime (id=%lu) for service '%s' on host '%s' starting now...\n", temp_downtime->downtime_id, svc->description, svc->host_name);
 
-				temp_downtime->flex_downtime_start = current_time;
+			temp_downtime->flex_downtime_start = current_time;
 
-				new_downtime_id = nm_malloc(sizeof(unsigned long));
-				*new_downtime_id = temp_downtime->downtime_id;
+			new_downtime_id = nm_malloc(sizeof(unsigned long));
+			*new_downtime_id = temp_downtime->downtime_id;
 
-				temp_downtime->start_event = schedule_event(temp_downtime->flex_downtime_start - time(NULL), handle_downtime_start_event, (void *)new_downtime_id);
-				num_downtimes_start++;
-			}
+			temp_downtime->start_event = schedule_event(temp_downtime->flex_downtime_start - time(NULL), handle_downtime_start_event, (void *)new_downtime_id);
+			num_downtimes_start++;
 		}
 	}
 
@@ -880,64 +923,72 @@ int check_pending_flex_service_downtime(service *svc)
 }
 
 
-/* event handler: checks for (and removes) expired downtime entries */
-static void check_for_expired_downtime(struct nm_event_execution_properties *evprop)
+/* removes a flexible or triggered downtime that never started */
+static void expire_downtime(scheduled_downtime *temp_downtime)
 {
-	scheduled_downtime *temp_downtime = NULL;
-	scheduled_downtime *next_downtime = NULL;
-	time_t current_time = 0L;
 	service *svc = NULL;
 	host *hst = NULL;
 
-	if (evprop->execution_type == EVENT_EXEC_NORMAL) {
-		time(&current_time);
-
-		/* check all downtime entries... */
-		for (temp_downtime = scheduled_downtime_list; temp_downtime != NULL; temp_downtime = next_downtime) {
-
-			next_downtime = temp_downtime->next;
-
-			/* this entry should be removed */
-			if (temp_downtime->is_in_effect == FALSE && temp_downtime->end_time <= current_time) {
-
-				log_debug_info(DEBUGL_DOWNTIME, 0, "Expiring %s downtime (id=%lu)...\n", (temp_downtime->type == HOST_DOWNTIME) ? "host" : "service", temp_downtime->downtime_id);
-
-				/* find the host or service associated with this downtime */
-				if (temp_downtime->type == HOST_DOWNTIME) {
-					if ((hst = find_host(temp_downtime->host_name)) == NULL) {
-						log_debug_info(DEBUGL_DOWNTIME, 1,
-						               "Unable to find host (%s) for downtime\n",
-						               temp_downtime->host_name);
-						return; /* ERROR */
-					}
-
-					/* send a notification */
-					host_notification(hst, NOTIFICATION_DOWNTIMEEND,
-					                  temp_downtime->author, temp_downtime->comment,
-					                  NOTIFICATION_OPTION_NONE);
-				} else {
-					if ((svc = find_service(temp_downtime->host_name,
-					                        temp_downtime->service_description)) == NULL) {
-						log_debug_info(DEBUGL_DOWNTIME, 1,
-						               "Unable to find service (%s) host (%s) for downtime\n",
-						               temp_downtime->service_description,
-						               temp_downtime->host_name);
-						return; /* ERROR */
-					}
-
-					/* send a notification */
-					service_notification(svc, NOTIFICATION_DOWNTIMEEND,
-					                     temp_downtime->author, temp_downtime->comment,
-					                     NOTIFICATION_OPTION_NONE);
-				}
-
-				/* delete the downtime entry */
-				if (temp_downtime->type == HOST_DOWNTIME)
-					delete_host_downtime(temp_downtime->downtime_id);
-				else
-					delete_service_downtime(temp_downtime->downtime_id);
+	log_debug_info(DEBUGL_DOWNTIME, 0, "Expiring %s downtime (id=%lu)...\n", (temp_downtime->type == HOST_DOWNTIME) ? "host" : "service", temp_downtime->downtime_id);
+
+	/* find the host or service associated with this downtime */
+	if (temp_downtime->type == HOST_DOWNTIME) {
+		if ((hst = find_host(temp_downtime->host_name)) == NULL) {
+			log_debug_info(DEBUGL_DOWNTIME, 1,
+			               "Unable to find host (%s) for downtime\n",
+			               temp_downtime->host_name);
+			return; /* ERROR */
+		}
+
+		/* send a notification */
+		host_notification(hst, NOTIFICATION_DOWNTIMEEND,
+		                  temp_downtime->author, temp_downtime->comment,
+		                  NOTIFICATION_OPTION_NONE);
+	} else {
+		if ((svc = find_service(temp_downtime->host_name,
+		                        temp_downtime->service_description)) == NULL) {
+			log_debug_info(DEBUGL_DOWNTIME, 1,
+			               "Unable to find service (%s) host (%s) for downtime\n",
+			               temp_downtime->service_description,
+			               temp_downtime->host_name);
+			return; /* ERROR */
+		}
+
+		/* send a notification */
+		service_notification(svc, NOTIFICATION_DOWNTIMEEND,
+		                     temp_downtime->author, temp_downtime->comment,
+		                     NOTIFICATION_OPTION_NONE);
+	}
+
+	/* delete the downtime entry */
+	if (temp_downtime->type == HOST_DOWNTIME)
+		delete_host_downtime(temp_downtime->downtime_id);
+	else
+		delete_service_downtime(temp_downtime->downtime_id);
+}
+
+
+/*
+ * event handler: expires a downtime at its end time, unless it has
+ * started. Downtimes that start get a stop event instead.
+ */
+static void handle_downtime_expire_event(struct nm_event_execution_properties *evprop)
+{
+	scheduled_downtime *temp_downtime = NULL;
+
+	if (evprop->user_data) {
+		if (evprop->execution_type == EVENT_EXEC_NORMAL) {
+			unsigned long downtime_id = *(unsigned long *)evprop->user_data;
+
+			if ((temp_downtime = find_downtime(ANY_DOWNTIME, downtime_id)) != NULL) {
+				if (temp_downtime->stop_event == evprop->attributes.timed.event)
+					temp_downtime->stop_event = NULL;
+
+				if (temp_downtime->is_in_effect == FALSE && temp_downtime->end_time <= time(NULL))
+					expire_downtime(temp_downtime);
 			}
 		}
+		nm_free(evprop->user_data);
 	}
 }
 
@@ -1231,40 +1282,10 @@ int add_downtime(int downtime_type, char *host_name, char *svc_description, time
 }
 
 
+/* the downtime list is always kept sorted, so there's nothing left to do */
 int sort_downtime(void)
 {
-	scheduled_downtime **array, *temp_downtime;
-	unsigned long i = 0, unsorted_downtimes = 0;
-
-	if (!defer_downtime_sorting)
-		return OK;
 	defer_downtime_sorting = 0;
-
-	temp_downtime = scheduled_downtime_list;
-	while (temp_downtime != NULL) {
-		temp_downtime = temp_downtime->next;
-		unsorted_downtimes++;
-	}
-
-	if (!unsorted_downtimes)
-		return OK;
-
-	array = nm_malloc(sizeof(*array) * unsorted_downtimes);
-	while (scheduled_downtime_list) {
-		array[i++] = scheduled_downtime_list;
-		scheduled_downtime_list = scheduled_downtime_list->next;
-	}
-
-	qsort((void *)array, i, sizeof(*array), downtime_compar);
-	scheduled_downtime_list = temp_downtime = array[0];
-	temp_downtime->prev = NULL;
-	for (i = 1; i < unsorted_downtimes; i++) {
-		temp_downtime->next = array[i];
-		temp_downtime = temp_downtime->next;
-		temp_downtime->prev = array[i - 1];
-	}
-	temp_downtime->next = NULL;
-	nm_free(array);
 	return OK;
 }
 
@@ -1285,6 +1306,18 @@ scheduled_downtime *find_downtime(int type, unsigned long downtime_id)
 }
 
 
+GSList *get_host_downtimes(host *hst)
+{
+	return g_hash_table_lookup(dt_by_object, hst);
+}
+
+
+GSList *get_service_downtimes(service *svc)
+{
+	return g_hash_table_lookup(dt_by_object, svc);
+}
+
+
 /* finds a specific host downtime entry */
 scheduled_downtime *find_host_downtime(unsigned long downtime_id)
 {
@@ -1311,6 +1344,14 @@ void free_downtime_data(void)
 
 	g_hash_table_destroy(dt_hashtable);
 	dt_hashtable = NULL;
+	g_tree_destroy(dt_tree);
+	dt_tree = NULL;
+	g_hash_table_foreach_remove(dt_by_object, free_downtime_index_entry, NULL);
+	g_hash_table_destroy(dt_by_object);
+	dt_by_object = NULL;
+	g_hash_table_foreach_remove(dt_by_trigger, free_downtime_index_entry, NULL);
+	g_hash_table_destroy(dt_by_trigger);
+	dt_by_trigger = NULL;
 
 	/* free memory for the scheduled_downtime list */
 	for (this_downtime = scheduled_downtime_list; this_downtime != NULL; this_downtime = next_downtime) {
@@ -5,6 +5,7 @@
 #error "Only <naemon/naemon.h> can be included directly."
 #endif
 
+#include <glib.h>
 #include "common.h"
 #include "objects_host.h"
 #include "objects_service.h"
@@ -63,9 +64,9 @@ int check_pending_flex_service_downtime(struct service *);
 int add_host_downtime(char *, time_t, char *, char *, time_t, time_t, time_t, int, unsigned long, unsigned long, unsigned long, int, int, unsigned long *);
 int add_service_downtime(char *, char *, time_t, char *, char *, time_t, time_t, time_t, int, unsigned long, unsigned long, unsigned long, int, int, unsigned long *);
 
-/* If you are going to be adding a lot of downtime in sequence, set
-   defer_downtime_sorting to 1 before you start and then call
-   sort_downtime afterwards. Things will go MUCH faster. */
+/* scheduled_downtime_list is kept sorted as downtime is added, so
+   defer_downtime_sorting and sort_downtime are no longer needed. They
+   are kept for the benefit of existing callers. */
 
 extern int defer_downtime_sorting;
 int add_downtime(int, char *, char *, time_t, char *, char *, time_t, time_t, time_t, int, unsigned long, unsigned long, unsigned long, int, int, unsigned long *);
@@ -75,6 +76,10 @@ struct scheduled_downtime *find_downtime(int, unsigned long);
 struct scheduled_downtime *find_host_downtime(unsigned long);
 struct scheduled_downtime *find_service_downtime(unsigned long);
 
+/* the downtimes scheduled for a host or service, in no particular order */
+GSList *get_host_downtimes(struct host *);
+GSList *get_service_downtimes(struct service *);
+
 void free_downtime_data(void);                                       /* frees memory allocated to scheduled downtime list */
 
 int delete_downtime_by_hostname_service_description_start_time_comment(char *, char *, time_t, char *);
@@ -2,29 +2,90 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "events.h"
 #include "logging.h"
 #include "nm_alloc.h"
 #include "nm_arith.h"
+#include "defaults.h"
 
 /* Which clock should be used for events? */
 #define EVENT_CLOCK_ID CLOCK_MONOTONIC
 #define EVENT_MAX_POLL_TIME_MS 1500
+/* delays are clamped to this many seconds, so event times can't overflow */
+#define EVENT_MAX_DELAY (1LL << 40)
+/* timed events are allocated from slabs of this size */
+#define EVENT_SLAB_SIZE 4096
+#define EVENT_SLAB_EVENTS ((EVENT_SLAB_SIZE - sizeof(void *)) / sizeof(struct timed_event))
+/*
+ * Timing wheel geometry. Each level has TW_SIZE slots, and a tick is one
+ * millisecond, so the four levels cover 256ms, 65s, 4.6h and 49.7 days
+ * respectively. Anything further away than that goes on the overflow list.
+ */
+#define TW_BITS 8
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+#define TW_WHEEL_SLOTS (TW_LEVELS * TW_SIZE)
+#define TW_SLOT_DUE TW_WHEEL_SLOTS
+#define TW_SLOT_OVERFLOW (TW_WHEEL_SLOTS + 1)
+#define TW_NUM_LISTS (TW_WHEEL_SLOTS + 2)
+
+/* links an event into a wheel slot; each slot's list is a ring through its head */
+struct tw_link {
+	struct tw_link *next, *prev;
+};
+
+/*
+ * An event is only ever in one of the queues, so the heap position and the
+ * wheel's list link can share space. The first pointer is also used for
+ * the free list of the event pool.
+ */
 struct timed_event {
-	size_t pos;
-	struct timespec event_time;
+	int64_t event_time; /* milliseconds, on EVENT_CLOCK_ID */
 	event_callback callback;
 	void *user_data;
+	union {
+		size_t pos; /* position in the heap */
+		struct tw_link link; /* neighbours in the wheel slot */
+		struct timed_event *next; /* next on the free list */
+	};
 };
 
+#define tw_event(l) ((struct timed_event *)((char *)(l) - offsetof(struct timed_event, link)))
+
 struct timed_event_queue {
 	struct timed_event **queue;
 	size_t count;
 	size_t size;
 };
 
-struct timed_event_queue *event_queue = NULL; /* our scheduling queue */
+struct timing_wheel {
+	int64_t epoch; /* the time of tick 0 */
+	int64_t tick; /* the next tick to expire */
+	int64_t overflow_min; /* no event on the overflow list expires before this */
+	size_t count; /* events on the wheel */
+	uint64_t occupied[TW_WHEEL_SLOTS / 64];
+	struct tw_link lists[TW_NUM_LISTS];
+};
+
+struct timed_event_slab {
+	struct timed_event_slab *next;
+	struct timed_event events[EVENT_SLAB_EVENTS];
+};
+
+struct timed_event_pool {
+	struct timed_event *free_list;
+	struct timed_event_slab *slabs;
+	struct timed_event_pool_stats stats;
+};
+
+struct timed_event_queue *event_queue = NULL; /* our scheduling queue, if using the heap */
+static struct timing_wheel *event_wheel = NULL; /* our scheduling queue, if using the timing wheel */
+static struct timed_event_pool event_pool; /* where all timed events come from */
 iobroker_set *nagios_iobs = NULL;
+int use_timing_wheel = DEFAULT_USE_TIMING_WHEEL;
 
 /******************************************************************/
 /************************** TIME HELPERS *************************/
@@ -60,19 +121,89 @@ overflow:
 	return (a->tv_sec < b->tv_sec) ? LONG_MIN : LONG_MAX;
 }
 
+/* the current time in milliseconds, as used for event times */
+static inline int64_t event_clock_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(EVENT_CLOCK_ID, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/******************************************************************/
+/************************** EVENT POOL ****************************/
+/******************************************************************/
+
+/*
+ * Events are created and destroyed at a very high rate, one or more for
+ * every check, so rather than going through malloc() for every one of them
+ * they're handed out from slabs, and recycled through a free list.
+ */
+static struct timed_event *timed_event_alloc(void)
+{
+	struct timed_event_pool *p = &event_pool;
+	struct timed_event_slab *slab;
+	struct timed_event *ev;
+	size_t i;
+
+	if (!p->free_list) {
+		slab = nm_malloc(sizeof(struct timed_event_slab));
+		slab->next = p->slabs;
+		p->slabs = slab;
+		for (i = EVENT_SLAB_EVENTS; i > 0; i--) {
+			slab->events[i - 1].next = p->free_list;
+			p->free_list = &slab->events[i - 1];
+		}
+		p->stats.slabs++;
+		p->stats.capacity += EVENT_SLAB_EVENTS;
+	}
+
+	ev = p->free_list;
+	p->free_list = ev->next;
+	memset(ev, 0, sizeof(*ev));
+	if (++p->stats.in_use > p->stats.high_water)
+		p->stats.high_water = p->stats.in_use;
+	p->stats.allocations++;
+	return ev;
+}
+
+static void timed_event_free(struct timed_event *ev)
+{
+	ev->next = event_pool.free_list;
+	event_pool.free_list = ev;
+	event_pool.stats.in_use--;
+}
+
+/* give the pool's memory back, if nothing is using it */
+static void timed_event_pool_release(void)
+{
+	struct timed_event_slab *slab, *next;
+
+	if (event_pool.stats.in_use)
+		return;
+	for (slab = event_pool.slabs; slab; slab = next) {
+		next = slab->next;
+		nm_free(slab);
+	}
+	event_pool.slabs = NULL;
+	event_pool.free_list = NULL;
+	event_pool.stats.slabs = 0;
+	event_pool.stats.capacity = 0;
+}
+
+void get_timed_event_pool_stats(struct timed_event_pool_stats *stats)
+{
+	*stats = event_pool.stats;
+}
+
 /******************************************************************/
 /************************** HEAP METHODS **************************/
 /******************************************************************/
 
 static inline int evheap_compare(struct timed_event *eva, struct timed_event *evb)
 {
-	if (eva->event_time.tv_sec < evb->event_time.tv_sec)
-		return -1;
-	if (eva->event_time.tv_sec > evb->event_time.tv_sec)
-		return 1;
-	if (eva->event_time.tv_nsec < evb->event_time.tv_nsec)
+	if (eva->event_time < evb->event_time)
 		return -1;
-	if (eva->event_time.tv_nsec > evb->event_time.tv_nsec)
+	if (eva->event_time > evb->event_time)
 		return 1;
 	return 0;
 }
@@ -210,45 +341,425 @@ static void evheap_destroy(struct timed_event_queue *q)
 }
 
 
+/******************************************************************/
+/********************** TIMING WHEEL METHODS **********************/
+/******************************************************************/
+
+/*
+ * A hierarchical timing wheel (Varghese & Lauck). Time is counted in
+ * millisecond ticks since the wheel was created. Level 0 has one slot per
+ * tick for the next TW_SIZE ticks, and every level above it has one slot
+ * per full rotation of the level below. Whenever the level 0 cursor wraps,
+ * the current slot of the level above is cascaded down, so that events
+ * only ever move towards level 0 as their time approaches.
+ *
+ * Adding and removing events is O(1). Expiry moves a whole slot at a time
+ * to the due list, from which events are executed in the order they
+ * expired.
+ *
+ * The slot lists are doubly linked rings through the slot's own link, so
+ * an event can be unlinked from wherever it is without knowing its slot.
+ * When that empties the slot, the slot is the one both its neighbours
+ * point to.
+ */
+
+/* the tick at which something happening at the given time is due */
+static inline int64_t tw_ticks(struct timing_wheel *w, int64_t ms)
+{
+	return ms - w->epoch;
+}
+
+static inline void tw_mark(struct timing_wheel *w, int slot)
+{
+	w->occupied[slot >> 6] |= 1ULL << (slot & 63);
+}
+
+static inline void tw_unmark(struct timing_wheel *w, int slot)
+{
+	w->occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+}
+
+/* first occupied slot in [from, to) of the flat slot bitmap, or -1 */
+static int tw_find_slot(struct timing_wheel *w, int from, int to)
+{
+	uint64_t word;
+	int i;
+
+	if (from >= to)
+		return -1;
+	i = from >> 6;
+	word = w->occupied[i] & (~0ULL << (from & 63));
+	for (;;) {
+		if (word) {
+			int slot = (i << 6) + __builtin_ctzll(word);
+			return slot < to ? slot : -1;
+		}
+		if (++i > (to - 1) >> 6)
+			return -1;
+		word = w->occupied[i];
+	}
+}
+
+/*
+ * Offset of the first occupied slot on the given level, counting from
+ * slot idx + min_offset and wrapping around, or -1 if the level is empty
+ */
+static int tw_find_offset(struct timing_wheel *w, int level, int idx, int min_offset)
+{
+	int base = level * TW_SIZE, start = (idx + min_offset) & TW_MASK, slot;
+
+	slot = tw_find_slot(w, base + start, base + TW_SIZE);
+	if (slot >= 0)
+		return (slot - base - idx) & TW_MASK;
+	slot = tw_find_slot(w, base, base + start);
+	if (slot >= 0)
+		return (slot - base - idx) & TW_MASK;
+	return -1;
+}
+
+static inline int tw_list_empty(struct tw_link *list)
+{
+	return list->next == list;
+}
+
+static inline void tw_list_init(struct tw_link *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline void tw_list_unlink(struct tw_link *l)
+{
+	l->prev->next = l->next;
+	l->next->prev = l->prev;
+}
+
+/* move everything on the from list to the end of the to list */
+static void tw_list_splice(struct tw_link *to, struct tw_link *from)
+{
+	if (tw_list_empty(from))
+		return;
+	from->next->prev = to->prev;
+	to->prev->next = from->next;
+	from->prev->next = to;
+	to->prev = from->prev;
+	tw_list_init(from);
+}
+
+static void tw_list_append(struct timing_wheel *w, int slot, struct timed_event *ev)
+{
+	struct tw_link *list = &w->lists[slot];
+
+	ev->link.next = list;
+	ev->link.prev = list->prev;
+	list->prev->next = &ev->link;
+	list->prev = &ev->link;
+	if (slot < TW_WHEEL_SLOTS)
+		tw_mark(w, slot);
+}
+
+/* put an event in the right slot relative to the wheel's current tick */
+static void tw_place(struct timing_wheel *w, struct timed_event *ev)
+{
+	int64_t expires = tw_ticks(w, ev->event_time);
+	int level, shift;
+
+	if (expires < w->tick) {
+		tw_list_append(w, TW_SLOT_DUE, ev);
+		return;
+	}
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		shift = level * TW_BITS;
+		if ((expires >> shift) - (w->tick >> shift) < TW_SIZE) {
+			tw_list_append(w, level * TW_SIZE + ((expires >> shift) & TW_MASK), ev);
+			return;
+		}
+	}
+	tw_list_append(w, TW_SLOT_OVERFLOW, ev);
+	if (expires < w->overflow_min)
+		w->overflow_min = expires;
+}
+
+/* re-place every event in the given slot */
+static void tw_replace_slot(struct timing_wheel *w, int slot)
+{
+	struct tw_link list, *l;
+
+	/* they may well go right back into it */
+	tw_list_init(&list);
+	tw_list_splice(&list, &w->lists[slot]);
+	if (slot < TW_WHEEL_SLOTS)
+		tw_unmark(w, slot);
+	while ((l = list.next) != &list) {
+		tw_list_unlink(l);
+		tw_place(w, tw_event(l));
+	}
+}
+
+/* called when level 0 is about to wrap, to move events down a level */
+static void tw_cascade(struct timing_wheel *w)
+{
+	int level, shift;
+
+	for (level = TW_LEVELS - 1; level > 0; level--) {
+		shift = level * TW_BITS;
+		if (w->tick & ((1LL << shift) - 1))
+			continue;
+		if (level == TW_LEVELS - 1) {
+			w->overflow_min = INT64_MAX;
+			tw_replace_slot(w, TW_SLOT_OVERFLOW);
+		}
+		tw_replace_slot(w, level * TW_SIZE + ((w->tick >> shift) & TW_MASK));
+	}
+}
+
+/* move everything in the given slot to the end of the due list */
+static void tw_expire_slot(struct timing_wheel *w, int slot)
+{
+	tw_list_splice(&w->lists[TW_SLOT_DUE], &w->lists[slot]);
+	if (slot < TW_WHEEL_SLOTS)
+		tw_unmark(w, slot);
+}
+
+static int64_t tw_next_expiry(struct timing_wheel *w);
+
+/* expire everything up to and including the given tick */
+static void tw_advance(struct timing_wheel *w, int64_t tick)
+{
+	int64_t next;
+	int idx, slot;
+
+	while (w->tick <= tick) {
+		idx = w->tick & TW_MASK;
+		if (!idx)
+			tw_cascade(w);
+
+		tw_expire_slot(w, idx);
+
+		/* skip straight to the next occupied slot or the next cascade */
+		if ((slot = tw_find_slot(w, idx + 1, TW_SIZE)) >= 0) {
+			next = w->tick + slot - idx;
+		} else if (tw_find_slot(w, 0, idx + 1) >= 0) {
+			next = (w->tick | TW_MASK) + 1;
+		} else {
+			/*
+			 * level 0 is empty, so skip every cascade up until the
+			 * one that will actually move something down
+			 */
+			next = tw_next_expiry(w) & ~(int64_t)TW_MASK;
+			if (next <= w->tick)
+				next = (w->tick | TW_MASK) + 1;
+		}
+		w->tick = next > tick ? tick + 1 : next;
+	}
+}
+
+/* the first event on the due list, if any */
+static struct timed_event *tw_due_head(struct timing_wheel *w)
+{
+	struct tw_link *due = &w->lists[TW_SLOT_DUE];
+
+	return tw_list_empty(due) ? NULL : tw_event(due->next);
+}
+
+/*
+ * Returns a lower bound for the tick at which the next event is due, or
+ * INT64_MAX if the wheel is empty. The bound is exact if the event is in
+ * level 0, and otherwise the start of the slot it's in.
+ */
+static int64_t tw_next_expiry(struct timing_wheel *w)
+{
+	int64_t next = INT64_MAX, bound;
+	int level, shift, offset, min_offset;
+
+	if (!tw_list_empty(&w->lists[TW_SLOT_DUE]))
+		return w->tick - 1;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		shift = level * TW_BITS;
+		/*
+		 * the current slot of an upper level is empty, unless we're on
+		 * the boundary where it's about to be cascaded
+		 */
+		min_offset = (w->tick & ((1LL << shift) - 1)) ? 1 : 0;
+		offset = tw_find_offset(w, level, (w->tick >> shift) & TW_MASK, min_offset);
+		if (offset < 0)
+			continue;
+		bound = ((w->tick >> shift) + offset) << shift;
+		if (bound < next)
+			next = bound;
+	}
+
+	if (!tw_list_empty(&w->lists[TW_SLOT_OVERFLOW])) {
+		/* the top level cascade that will move the first one into the wheel */
+		shift = (TW_LEVELS - 1) * TW_BITS;
+		bound = ((w->overflow_min >> shift) - (TW_SIZE - 1)) << shift;
+		if (bound <= w->tick)
+			bound = ((w->tick >> shift) + 1) << shift;
+		if (bound < next)
+			next = bound;
+	}
+	return next;
+}
+
+static void tw_add(struct timing_wheel *w, struct timed_event *ev)
+{
+	tw_place(w, ev);
+	w->count++;
+}
+
+static void tw_remove(struct timing_wheel *w, struct timed_event *ev)
+{
+	struct tw_link *prev = ev->link.prev;
+	int slot;
+
+	tw_list_unlink(&ev->link);
+	if (prev == ev->link.next) {
+		/* that was the last one, so prev is the slot itself */
+		slot = prev - w->lists;
+		if (slot < TW_WHEEL_SLOTS)
+			tw_unmark(w, slot);
+	}
+	w->count--;
+}
+
+static struct timing_wheel *tw_create(void)
+{
+	struct timing_wheel *w;
+	int i;
+
+	w = nm_calloc(1, sizeof(struct timing_wheel));
+	for (i = 0; i < TW_NUM_LISTS; i++)
+		tw_list_init(&w->lists[i]);
+	w->epoch = event_clock_ms();
+	w->tick = 0;
+	w->overflow_min = INT64_MAX;
+	return w;
+}
+
+/* destroys the wheel, and frees whatever events are still on it */
+static void tw_destroy(struct timing_wheel *w)
+{
+	struct tw_link *l, *next;
+	int i;
+
+	for (i = 0; i < TW_NUM_LISTS; i++) {
+		for (l = w->lists[i].next; l != &w->lists[i]; l = next) {
+			next = l->next;
+			timed_event_free(tw_event(l));
+		}
+	}
+	nm_free(w);
+}
+
+
 
 /******************************************************************/
 /************ EVENT SCHEDULING/HANDLING FUNCTIONS *****************/
 /******************************************************************/
 
+static void event_queue_add(struct timed_event *ev)
+{
+	if (event_wheel)
+		tw_add(event_wheel, ev);
+	else
+		evheap_add(event_queue, ev);
+}
+
+/* take an event out of the queue */
+static void event_queue_remove(struct timed_event *ev)
+{
+	if (event_wheel)
+		tw_remove(event_wheel, ev);
+	else
+		evheap_remove(event_queue, ev);
+}
+
+/*
+ * Find out how long it is until the next event might be due.
+ * @return FALSE if there are no events at all
+ */
+static int event_queue_next(int64_t current_time, int64_t *time_diff)
+{
+	timed_event *evt;
+	int64_t now, next;
+
+	if (event_wheel) {
+		now = tw_ticks(event_wheel, current_time);
+		tw_advance(event_wheel, now);
+		if ((evt = tw_due_head(event_wheel)) != NULL) {
+			*time_diff = evt->event_time - current_time;
+			return TRUE;
+		}
+		if (!event_wheel->count || (next = tw_next_expiry(event_wheel)) == INT64_MAX)
+			return FALSE;
+		*time_diff = next - now;
+		return TRUE;
+	}
+
+	if ((evt = evheap_head(event_queue)) == NULL)
+		return FALSE;
+	*time_diff = evt->event_time - current_time;
+	return TRUE;
+}
+
+/* get the next event whose time has come, if any */
+static timed_event *event_queue_due(int64_t current_time)
+{
+	timed_event *evt;
+
+	if (event_wheel) {
+		tw_advance(event_wheel, tw_ticks(event_wheel, current_time));
+		return tw_due_head(event_wheel);
+	}
+
+	evt = evheap_head(event_queue);
+	if (evt && evt->event_time > current_time)
+		return NULL;
+	return evt;
+}
+
 timed_event *schedule_event(time_t delay, event_callback callback, void *user_data)
 {
 
 	timed_event *event;
 
-	g_return_val_if_fail(event_queue != NULL, NULL);
+	g_return_val_if_fail(event_queue != NULL || event_wheel != NULL, NULL);
 	g_return_val_if_fail(callback != NULL, NULL);
 
-	event = nm_calloc(1, sizeof(struct timed_event));
-
-	clock_gettime(EVENT_CLOCK_ID, &event->event_time);
-	event->event_time.tv_sec += delay;
+	if (delay > EVENT_MAX_DELAY)
+		delay = EVENT_MAX_DELAY;
+	else if (delay < -EVENT_MAX_DELAY)
+		delay = -EVENT_MAX_DELAY;
 
+	event = timed_event_alloc();
+	event->event_time = event_clock_ms() + (int64_t)delay * 1000;
 	event->callback = callback;
 	event->user_data = user_data;
 
-	evheap_add(event_queue, event);
+	event_queue_add(event);
 
 	return event;
 }
 
 long get_timed_event_time_left_ms(timed_event *ev)
 {
-	struct timespec current_time;
-	clock_gettime(EVENT_CLOCK_ID, &current_time);
-	return timespec_msdiff(&ev->event_time, &current_time);
+	int64_t diff = ev->event_time - event_clock_ms();
+	if (diff > LONG_MAX)
+		return LONG_MAX;
+	if (diff < LONG_MIN)
+		return LONG_MIN;
+	return diff;
 }
 
 /* Unschedule, execute and destroy event, given parameters of evprop */
 static void execute_and_destroy_event(struct nm_event_execution_properties *evprop)
 {
-	evheap_remove(event_queue, evprop->attributes.timed.event);
-	(*evprop->attributes.timed.event->callback)(evprop);
-	nm_free(evprop->attributes.timed.event);
+	struct timed_event *ev = evprop->attributes.timed.event;
+
+	event_queue_remove(ev);
+	(*ev->callback)(evprop);
+	timed_event_free(ev);
 }
 
 /* remove an event from the queue */
@@ -265,24 +776,42 @@ void destroy_event(timed_event *event)
 
 void init_event_queue(void)
 {
-	event_queue = evheap_create();
+	if (use_timing_wheel)
+		event_wheel = tw_create();
+	else
+		event_queue = evheap_create();
 }
 
 void destroy_event_queue(void)
 {
 	struct timed_event *ev;
+	int i;
 	/*
 	 * Since naemon doesn't know if things is started, we can't trust that
 	 * destroy event queue actually means we have an event queue to destroy
 	 */
-	if (event_queue == NULL)
-		return;
+	if (event_wheel != NULL) {
+		/* aborted callbacks may schedule new events, so go until it's empty */
+		while (event_wheel->count) {
+			for (i = 0; i < TW_NUM_LISTS; i++) {
+				if (i != TW_SLOT_DUE)
+					tw_expire_slot(event_wheel, i);
+			}
+			while ((ev = tw_due_head(event_wheel)) != NULL)
+				destroy_event(ev);
+		}
+		tw_destroy(event_wheel);
+		event_wheel = NULL;
+	}
 
-	while ((ev = evheap_head(event_queue)) != NULL) {
-		destroy_event(ev);
+	if (event_queue != NULL) {
+		while ((ev = evheap_head(event_queue)) != NULL) {
+			destroy_event(ev);
+		}
+		evheap_destroy(event_queue);
+		event_queue = NULL;
 	}
-	evheap_destroy(event_queue);
-	event_queue = NULL;
+	timed_event_pool_release();
 }
 
 /**
@@ -292,69 +821,78 @@ void destroy_event_queue(void)
 static int event_poll_full(iobroker_set *iobs, long int timeout_ms)
 {
 	timed_event *evt;
-	struct timespec current_time;
-	int64_t time_diff;
+	int64_t start_time, current_time, time_diff, time_left;
 	struct nm_event_execution_properties evprop;
-	int inputs;
-	clock_gettime(EVENT_CLOCK_ID, &current_time);
-
-	/* get next scheduled event */
-	evt = evheap_head(event_queue);
+	int inputs, have_events;
+	start_time = current_time = event_clock_ms();
 
-	if (evt) {
-		time_diff = timespec_msdiff(&evt->event_time, &current_time);
-		if (time_diff < 0)
-			time_diff = 0;
-		else if (time_diff >= timeout_ms)
-			time_diff = timeout_ms;
-	} else {
-		/* no scheduled events at all? then we can afford quite a bit of sleeping */
-		time_diff = timeout_ms;
-	}
+	/*
+	 * The timing wheel only knows a lower bound for when its next event
+	 * is due, so we may have to go around a few times before it is.
+	 */
+	for (;;) {
+		time_left = timeout_ms - (current_time - start_time);
+		if (time_left < 0)
+			time_left = 0;
+
+		/* find out when the next scheduled event is due */
+		have_events = event_queue_next(current_time, &time_diff);
+
+		if (have_events) {
+			if (time_diff < 0)
+				time_diff = 0;
+			else if (time_diff >= time_left)
+				time_diff = time_left;
+		} else {
+			/* no scheduled events at all? then we can afford quite a bit of sleeping */
+			time_diff = time_left;
+		}
 
-	if (!iobroker_push(iobs)) {
-		/* There is a backlog for data sending? Catch up at "idle
-		* priority", i.e. prevent sleeping while awaiting
-		* results, but continue to run events as usual.
-		*/
-		time_diff = 0;
-	}
-	inputs = iobroker_poll(iobs, time_diff);
-	if (inputs < 0) {
-		if (errno == EINTR) {
+		/*
+		 * Send off whatever is pending. Sockets with a backlog are
+		 * polled for writability, so there's no need to spin until
+		 * they've caught up.
+		 */
+		iobroker_push(iobs);
+		inputs = iobroker_poll(iobs, time_diff);
+		if (inputs < 0) {
+			if (errno == EINTR) {
+				/*
+				* errno is EINTR, which means it isn't a timed event, thus don't
+				* continue below
+				*/
+				return 0;
+			} else {
+				nm_log(NSLOG_RUNTIME_ERROR, "Error: Polling for input on %p failed: %s", iobs, iobroker_strerror(inputs));
+				return -1;
+			}
+		} else if (inputs > 0) {
+			log_debug_info(DEBUGL_IPC, 2, "## %d descriptors had input\n", inputs);
 			/*
-			* errno is EINTR, which means it isn't a timed event, thus don't
-			* continue below
+			* Since we got input on one of the file descriptors, this wakeup wasn't
+			* about a timed event, so start the main loop over.
 			*/
+			log_debug_info(DEBUGL_EVENTS, 0, "Event was cancelled by iobroker input\n");
 			return 0;
-		} else {
-			nm_log(NSLOG_RUNTIME_ERROR, "Error: Polling for input on %p failed: %s", iobs, iobroker_strerror(inputs));
-			return -1;
 		}
-	} else if (inputs > 0) {
-		log_debug_info(DEBUGL_IPC, 2, "## %d descriptors had input\n", inputs);
+
 		/*
-		* Since we got input on one of the file descriptors, this wakeup wasn't
-		* about a timed event, so start the main loop over.
-		*/
-		log_debug_info(DEBUGL_EVENTS, 0, "Event was cancelled by iobroker input\n");
-		return 0;
-	}
+		 * There were no timed events, so don't try to run them.
+		 */
+		if (!have_events) {
+			return 0;
+		}
 
-	/*
-	 * There were no timed events, so don't try to run them.
-	 */
-	if (!evt) {
-		return 0;
+		/*
+		 * Might have been a timeout just because the max time of polling
+		 */
+		current_time = event_clock_ms();
+		if ((evt = event_queue_due(current_time)) != NULL)
+			break;
+		if (!time_diff || time_diff >= time_left)
+			return 0;
 	}
-
-	/*
-	 * Might have been a timeout just because the max time of polling
-	 */
-	clock_gettime(EVENT_CLOCK_ID, &current_time);
-	time_diff = timespec_msdiff(&evt->event_time, &current_time);
-	if (time_diff > 0)
-		return 0;
+	time_diff = evt->event_time - current_time;
 
 	/*
 	 * It isn't any special cases, so it's time to run the event
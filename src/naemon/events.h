@@ -13,6 +13,7 @@
 NAGIOS_BEGIN_DECL
 
 extern iobroker_set *nagios_iobs;
+extern int use_timing_wheel; /* use the timing wheel rather than the binary heap */
 
 /* Set if execution of the callback is done normally because of timed event */
 enum nm_exec_type {
@@ -55,6 +56,21 @@ void destroy_event(timed_event *event);
  */
 long get_timed_event_time_left_ms(timed_event *ev);
 
+/* usage of the pool that timed events are allocated from */
+struct timed_event_pool_stats {
+	size_t in_use; /* events currently allocated */
+	size_t high_water; /* the most events ever allocated at once */
+	size_t capacity; /* events there is room for without growing */
+	size_t slabs; /* number of slabs the pool is made up of */
+	unsigned long long allocations; /* events allocated in total */
+};
+
+/**
+ * Gets the usage statistics of the timed event pool
+ * @param stats Where to store the statistics
+ */
+void get_timed_event_pool_stats(struct timed_event_pool_stats *stats);
+
 /* Main function */
 void init_event_queue(void); /* creates the queue nagios_squeue */
 int event_poll(void); /* main monitoring/event handler loop */
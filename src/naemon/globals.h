@@ -30,6 +30,11 @@ extern objectlist *objcfg_dirs;
 extern unsigned int nofile_limit, nproc_limit, max_apps;
 
 extern int num_check_workers;
+extern int worker_dispatch_batching;
+extern int worker_dispatch_policy;
+extern int worker_autoscale;
+extern int worker_autoscale_min;
+extern int worker_autoscale_max;
 extern char *qh_socket_path;
 
 extern char *macro_user[MAX_USER_MACROS];
@@ -67,6 +72,8 @@ extern int service_check_timeout_state;
 extern int host_check_timeout;
 extern int event_handler_timeout;
 extern int notification_timeout;
+extern int notification_coalesce_window;
+extern int notification_rate_limit;
 
 extern volatile sig_atomic_t sig_id;
 
@@ -113,6 +120,9 @@ extern int use_retained_scheduling_info;
 extern int retained_scheduling_randomize_window;
 extern int retention_scheduling_horizon;
 extern char *retention_file;
+extern int binary_retention;
+extern int background_retention_saves;
+extern int retention_fsync;
 extern unsigned long retained_host_attribute_mask;
 extern unsigned long retained_service_attribute_mask;
 extern unsigned long retained_contact_host_attribute_mask;
@@ -3,19 +3,61 @@
 #include "utils.h"
 #include "globals.h"
 #include "nm_alloc.h"
+#include "debuglog.h"
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <syslog.h>
 #include <stdarg.h>
+#include <pthread.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 
 static FILE *debug_file_fp;
 static FILE *log_fp;
 
 int log_initial_states = DEFAULT_LOG_INITIAL_STATES;
 int log_current_states = DEFAULT_LOG_CURRENT_STATES;
+int use_async_logging = DEFAULT_USE_ASYNC_LOGGING;
+unsigned long log_flush_interval = DEFAULT_LOG_FLUSH_INTERVAL;
+unsigned long log_buffer_size = DEFAULT_LOG_BUFFER_SIZE;
+int binary_debug_log = DEFAULT_BINARY_DEBUG_LOG;
 guint nm_g_log_handler_id = 0;
 
+/*
+ * With asynchronous logging, the main thread formats log lines into a
+ * ring buffer and a writer thread writes them to the log file in
+ * batches. The main thread is the only producer and whoever holds the
+ * lock the only consumer, so the buffer itself needs no locking. The
+ * lock guards the log file and the flush requests the main thread
+ * makes when it needs the log file to be up to date.
+ */
+static struct {
+	char *buf;
+	unsigned long size; /* always a power of two */
+	unsigned long head; /* bytes queued, only moved by the main thread */
+	unsigned long tail; /* bytes written, only moved by the writer */
+	unsigned long queued, dropped, flushed; /* lines */
+	unsigned long unreported_drops;
+	unsigned long flush_requests, flushes_done;
+	int running;
+	GThread *thread;
+	GMutex lock;
+	GCond cond;
+} log_writer;
+
+/*
+ * The binary debug log (see debuglog.h). The ring is only ever written
+ * by this process, so naemondebug may find a torn record at the tail
+ * if it reads the file while we're running, but never anywhere else.
+ */
+static struct {
+	struct debuglog_header *hdr;
+	char *ring;
+	uint64_t ring_size;
+	GHashTable *formats; /* format address -> position of its format record */
+} debug_ring;
+
 /******************************************************************/
 /************************ LOGGING FUNCTIONS ***********************/
 /******************************************************************/
@@ -71,6 +113,251 @@ static int write_to_syslog(char *buffer, unsigned long data_type)
 	return OK;
 }
 
+/* copies len bytes to the head of the log buffer, wrapping around as needed */
+static void log_buffer_put(unsigned long *head, const char *data, unsigned long len)
+{
+	unsigned long offset, chunk;
+
+	while (len) {
+		offset = *head & (log_writer.size - 1);
+		chunk = log_writer.size - offset;
+		if (chunk > len)
+			chunk = len;
+		memcpy(log_writer.buf + offset, data, chunk);
+		data += chunk;
+		len -= chunk;
+		*head += chunk;
+	}
+}
+
+/* hands a log line over to the writer thread, dropping it if there's no room */
+static void queue_log_line(const char *buffer, time_t log_time)
+{
+	char prefix[32], warning[128];
+	unsigned long head, space, prefix_len, warning_len, len;
+
+	prefix_len = snprintf(prefix, sizeof(prefix), "[%lu] ", (unsigned long)log_time);
+	len = prefix_len + strlen(buffer) + 1;
+
+	head = log_writer.head;
+	space = log_writer.size - (head - __atomic_load_n(&log_writer.tail, __ATOMIC_ACQUIRE));
+
+	/*
+	 * let the log know that something is missing, once there's room for
+	 * it. The warning is only formatted once it's sure to fit
+	 */
+	if (log_writer.unreported_drops && len + sizeof(warning) <= space) {
+		warning_len = snprintf(warning, sizeof(warning), "[%lu] Warning: %lu log messages were dropped because the log buffer was full\n",
+		                       (unsigned long)log_time, log_writer.unreported_drops);
+		if (warning_len >= sizeof(warning))
+			warning_len = sizeof(warning) - 1;
+		log_buffer_put(&head, warning, warning_len);
+		space -= warning_len;
+		log_writer.unreported_drops = 0;
+	}
+
+	if (len > space) {
+		log_writer.unreported_drops++;
+		__atomic_add_fetch(&log_writer.dropped, 1, __ATOMIC_RELAXED);
+	} else {
+		log_buffer_put(&head, prefix, prefix_len);
+		log_buffer_put(&head, buffer, len - prefix_len - 1);
+		log_buffer_put(&head, "\n", 1);
+	}
+
+	/* publish the line before it's counted, see drain_log_buffer() */
+	__atomic_store_n(&log_writer.head, head, __ATOMIC_RELEASE);
+	if (len <= space)
+		__atomic_add_fetch(&log_writer.queued, 1, __ATOMIC_RELEASE);
+
+	/* don't wait for the timer if the buffer is filling up */
+	if (log_writer.size - space + len > log_writer.size / 2) {
+		g_mutex_lock(&log_writer.lock);
+		g_cond_signal(&log_writer.cond);
+		g_mutex_unlock(&log_writer.lock);
+	}
+}
+
+/* writes everything in the log buffer to the log file. Called with the lock held */
+static void drain_log_buffer(void)
+{
+	unsigned long head, tail, queued, offset, chunk;
+	FILE *fp;
+
+	/* lines are counted after they're queued, so all of these are in the buffer */
+	queued = __atomic_load_n(&log_writer.queued, __ATOMIC_ACQUIRE);
+	head = __atomic_load_n(&log_writer.head, __ATOMIC_ACQUIRE);
+	tail = log_writer.tail;
+	if (head == tail)
+		return;
+
+	fp = open_log_file();
+	while (tail != head) {
+		offset = tail & (log_writer.size - 1);
+		chunk = log_writer.size - offset;
+		if (chunk > head - tail)
+			chunk = head - tail;
+		if (fp)
+			fwrite(log_writer.buf + offset, 1, chunk, fp);
+		tail += chunk;
+	}
+	if (fp) {
+		fflush(fp);
+		__atomic_store_n(&log_writer.flushed, queued, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&log_writer.dropped, queued - log_writer.flushed, __ATOMIC_RELAXED);
+		__atomic_store_n(&log_writer.flushed, queued, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&log_writer.tail, tail, __ATOMIC_RELEASE);
+}
+
+static gpointer log_writer_thread(gpointer discard)
+{
+	unsigned long request;
+	gint64 deadline;
+
+	g_mutex_lock(&log_writer.lock);
+	while (log_writer.running) {
+		deadline = g_get_monotonic_time() + (gint64)log_flush_interval * G_TIME_SPAN_MILLISECOND;
+		while (log_writer.running && log_writer.flushes_done == log_writer.flush_requests) {
+			if (!g_cond_wait_until(&log_writer.cond, &log_writer.lock, deadline))
+				break;
+			/* woken up because the buffer is filling up */
+			if (__atomic_load_n(&log_writer.head, __ATOMIC_ACQUIRE) - log_writer.tail > log_writer.size / 2)
+				break;
+		}
+		request = log_writer.flush_requests;
+		drain_log_buffer();
+		if (log_writer.flushes_done != request) {
+			log_writer.flushes_done = request;
+			g_cond_broadcast(&log_writer.cond);
+		}
+	}
+	drain_log_buffer();
+	g_mutex_unlock(&log_writer.lock);
+
+	return NULL;
+}
+
+/*
+ * A child forked while the writer is in the middle of writing would
+ * inherit a locked log file and whatever is buffered in it, so the
+ * buffer is written out first and the writer is kept out of the log
+ * file until fork() is done.
+ */
+static int log_writer_forking;
+
+static void log_writer_atfork_prepare(void)
+{
+	if (!log_writer.running)
+		return;
+
+	g_mutex_lock(&log_writer.lock);
+	drain_log_buffer();
+	if (log_fp)
+		fflush(log_fp);
+	log_writer_forking = TRUE;
+}
+
+static void log_writer_atfork_parent(void)
+{
+	if (!log_writer_forking)
+		return;
+
+	log_writer_forking = FALSE;
+	g_mutex_unlock(&log_writer.lock);
+}
+
+/* forked children have no writer thread, so they go back to writing directly */
+static void log_writer_atfork_child(void)
+{
+	log_writer_atfork_parent();
+	log_writer.running = FALSE;
+	log_writer.thread = NULL;
+}
+
+int start_log_writer(void)
+{
+	static int handlers_registered = FALSE;
+	GError *error = NULL;
+
+	if (!use_async_logging || log_writer.running || verify_config)
+		return OK;
+
+	if (!handlers_registered) {
+		pthread_atfork(log_writer_atfork_prepare, log_writer_atfork_parent, log_writer_atfork_child);
+		atexit(stop_log_writer);
+		handlers_registered = TRUE;
+	}
+
+	for (log_writer.size = 4096; log_writer.size < log_buffer_size && log_writer.size < (1UL << 30);)
+		log_writer.size <<= 1;
+	log_writer.buf = nm_malloc(log_writer.size);
+	log_writer.head = log_writer.tail = 0;
+	log_writer.queued = log_writer.dropped = log_writer.flushed = 0;
+	log_writer.unreported_drops = 0;
+	log_writer.flush_requests = log_writer.flushes_done = 0;
+	g_mutex_init(&log_writer.lock);
+	g_cond_init(&log_writer.cond);
+
+	log_writer.running = TRUE;
+	log_writer.thread = g_thread_try_new("log writer", log_writer_thread, NULL, &error);
+	if (!log_writer.thread) {
+		log_writer.running = FALSE;
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: Failed to start log writer thread, logging synchronously: %s\n", error->message);
+		g_clear_error(&error);
+		g_cond_clear(&log_writer.cond);
+		g_mutex_clear(&log_writer.lock);
+		nm_free(log_writer.buf);
+		return ERROR;
+	}
+
+	return OK;
+}
+
+/* waits until everything logged so far has been written to the log file */
+void flush_log_writer(void)
+{
+	unsigned long request;
+
+	if (!log_writer.running)
+		return;
+
+	g_mutex_lock(&log_writer.lock);
+	request = ++log_writer.flush_requests;
+	g_cond_broadcast(&log_writer.cond);
+	while (log_writer.flushes_done < request)
+		g_cond_wait(&log_writer.cond, &log_writer.lock);
+	g_mutex_unlock(&log_writer.lock);
+}
+
+void stop_log_writer(void)
+{
+	if (!log_writer.running)
+		return;
+
+	g_mutex_lock(&log_writer.lock);
+	log_writer.running = FALSE;
+	g_cond_broadcast(&log_writer.cond);
+	g_mutex_unlock(&log_writer.lock);
+	g_thread_join(log_writer.thread);
+	log_writer.thread = NULL;
+
+	g_cond_clear(&log_writer.cond);
+	g_mutex_clear(&log_writer.lock);
+	nm_free(log_writer.buf);
+}
+
+void get_log_writer_stats(struct log_writer_stats *stats)
+{
+	stats->active = log_writer.running;
+	stats->queued = __atomic_load_n(&log_writer.queued, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&log_writer.dropped, __ATOMIC_RELAXED);
+	stats->flushed = __atomic_load_n(&log_writer.flushed, __ATOMIC_RELAXED);
+	stats->buffer_size = log_writer.running ? log_writer.size : 0;
+	stats->buffered = log_writer.running ? log_writer.head - __atomic_load_n(&log_writer.tail, __ATOMIC_ACQUIRE) : 0;
+}
+
 /* write something to the naemon log file */
 static int write_to_log(char *buffer, unsigned long data_type, time_t *timestamp)
 {
@@ -91,9 +378,6 @@ static int write_to_log(char *buffer, unsigned long data_type, time_t *timestamp
 	if (log_file == NULL)
 		return ERROR;
 
-	fp = open_log_file();
-	if (fp == NULL)
-		return ERROR;
 	/* what timestamp should we use? */
 	if (timestamp == NULL)
 		time(&log_time);
@@ -103,9 +387,18 @@ static int write_to_log(char *buffer, unsigned long data_type, time_t *timestamp
 	/* strip any newlines from the end of the buffer */
 	strip(buffer);
 
-	/* write the buffer to the log file */
-	fprintf(fp, "[%lu] %s\n", log_time, buffer);
-	fflush(fp);
+	if (log_writer.running) {
+		/* the writer thread owns the log file */
+		queue_log_line(buffer, log_time);
+	} else {
+		fp = open_log_file();
+		if (fp == NULL)
+			return ERROR;
+
+		/* write the buffer to the log file */
+		fprintf(fp, "[%lu] %s\n", log_time, buffer);
+		fflush(fp);
+	}
 
 	broker_log_data(NEBTYPE_LOG_DATA, NEBFLAG_NONE, NEBATTR_NONE, buffer, data_type, log_time);
 
@@ -179,14 +472,37 @@ static void write_to_all_logs_with_timestamp(char *buffer, unsigned long data_ty
 	write_to_log(buffer, data_type, timestamp);
 }
 
-int close_log_file(void)
+/* the writer thread uses the log file with its lock held */
+static void lock_log_file(void)
+{
+	if (log_writer.running)
+		g_mutex_lock(&log_writer.lock);
+}
+
+static void unlock_log_file(void)
+{
+	if (log_writer.running)
+		g_mutex_unlock(&log_writer.lock);
+}
+
+/* called with the log file locked */
+static void do_close_log_file(void)
 {
 	if (!log_fp)
-		return 0;
+		return;
 
 	fflush(log_fp);
 	fclose(log_fp);
 	log_fp = NULL;
+}
+
+int close_log_file(void)
+{
+	/* let the writer thread finish with the file first */
+	flush_log_writer();
+	lock_log_file();
+	do_close_log_file();
+	unlock_log_file();
 	return 0;
 }
 
@@ -194,13 +510,18 @@ int close_log_file(void)
 int rotate_log_file(time_t rotation_time)
 {
 	char *temp_buffer = NULL;
+	FILE *fp;
 
 	/* update the last log rotation time and status log */
 	last_log_rotation = time(NULL);
 
-	close_log_file();
-	log_fp = open_log_file();
-	if (log_fp == NULL)
+	/* the writer thread mustn't see the file between closing and reopening it */
+	flush_log_writer();
+	lock_log_file();
+	do_close_log_file();
+	fp = open_log_file();
+	unlock_log_file();
+	if (fp == NULL)
 		return ERROR;
 
 	/* record the log rotation after it has been done... */
@@ -234,6 +555,307 @@ int write_log_file_info(time_t *timestamp)
 }
 
 
+/* makes room for len bytes at the head of the debug ring */
+static void debug_ring_evict(uint64_t len)
+{
+	struct debuglog_header *hdr = debug_ring.hdr;
+
+	while (hdr->head + len - hdr->tail > debug_ring.ring_size) {
+		struct debuglog_record *rec = (struct debuglog_record *)(debug_ring.ring + hdr->tail % debug_ring.ring_size);
+		hdr->tail += rec->len;
+	}
+}
+
+/*
+ * returns where a record of len bytes goes. The record is committed by
+ * advancing the head past it once it has been filled in.
+ */
+static struct debuglog_record *debug_ring_reserve(uint32_t len)
+{
+	struct debuglog_header *hdr = debug_ring.hdr;
+	uint64_t offset = hdr->head % debug_ring.ring_size;
+
+	if (offset + len > debug_ring.ring_size) {
+		struct debuglog_record *wrap = (struct debuglog_record *)(debug_ring.ring + offset);
+		uint32_t pad = debug_ring.ring_size - offset;
+		debug_ring_evict(pad);
+		wrap->len = pad;
+		wrap->type = DEBUGLOG_WRAP;
+		hdr->head += pad;
+		offset = 0;
+	}
+	debug_ring_evict(len);
+
+	return (struct debuglog_record *)(debug_ring.ring + offset);
+}
+
+/* stores fmt in the ring, unless the copy stored earlier is still there */
+static int debug_ring_define(const char *fmt)
+{
+	struct debuglog_record *rec;
+	uint64_t *pos;
+	size_t fmt_len;
+	uint32_t len;
+
+	pos = g_hash_table_lookup(debug_ring.formats, fmt);
+	if (pos && *pos >= debug_ring.hdr->tail)
+		return OK;
+
+	fmt_len = strlen(fmt) + 1;
+	if (fmt_len > debug_ring.ring_size / 4)
+		return ERROR;
+	len = (sizeof(*rec) + fmt_len + DEBUGLOG_ALIGN - 1) & ~(DEBUGLOG_ALIGN - 1);
+
+	rec = debug_ring_reserve(len);
+	memset(rec, 0, sizeof(*rec));
+	rec->len = len;
+	rec->type = DEBUGLOG_FORMAT;
+	rec->fmt = (uintptr_t)fmt;
+	memcpy(rec + 1, fmt, fmt_len);
+
+	if (!pos) {
+		pos = nm_malloc(sizeof(*pos));
+		g_hash_table_insert(debug_ring.formats, (gpointer)fmt, pos);
+	}
+	*pos = debug_ring.hdr->head;
+	debug_ring.hdr->head += len;
+
+	return OK;
+}
+
+/* copies the arguments fmt consumes into buf, the way debuglog.h says */
+static size_t debug_ring_pack(char *buf, size_t size, const char *fmt, va_list ap, int saved_errno)
+{
+	struct debuglog_conversion conv;
+	size_t used = 0;
+	int64_t i;
+	uint64_t u;
+	double d;
+	uint32_t len;
+	const char *str;
+
+#define pack(val) \
+	do { \
+		if (used + sizeof(val) > size) \
+			return used; \
+		memcpy(buf + used, &(val), sizeof(val)); \
+		used += sizeof(val); \
+	} while (0)
+
+	while ((fmt = debuglog_next_conversion(fmt, &conv))) {
+		if (conv.star_width) {
+			i = va_arg(ap, int);
+			pack(i);
+		}
+		if (conv.star_precision) {
+			i = va_arg(ap, int);
+			pack(i);
+		}
+
+		switch (conv.type) {
+		case DEBUGLOG_ARG_NONE:
+			break;
+
+		case DEBUGLOG_ARG_COUNT:
+			(void)va_arg(ap, void *);
+			break;
+
+		case DEBUGLOG_ARG_ERRNO:
+			pack(saved_errno);
+			break;
+
+		case DEBUGLOG_ARG_INT:
+			switch (conv.length) {
+			case DEBUGLOG_LEN_LONG: i = va_arg(ap, long); break;
+			case DEBUGLOG_LEN_LONG_LONG:
+			case DEBUGLOG_LEN_LONG_DOUBLE: i = va_arg(ap, long long); break;
+			case DEBUGLOG_LEN_INTMAX: i = va_arg(ap, intmax_t); break;
+			case DEBUGLOG_LEN_SIZE: i = va_arg(ap, ssize_t); break;
+			case DEBUGLOG_LEN_PTRDIFF: i = va_arg(ap, ptrdiff_t); break;
+			default: i = va_arg(ap, int); break;
+			}
+			pack(i);
+			break;
+
+		case DEBUGLOG_ARG_UINT:
+			switch (conv.length) {
+			case DEBUGLOG_LEN_LONG: u = va_arg(ap, unsigned long); break;
+			case DEBUGLOG_LEN_LONG_LONG:
+			case DEBUGLOG_LEN_LONG_DOUBLE: u = va_arg(ap, unsigned long long); break;
+			case DEBUGLOG_LEN_INTMAX: u = va_arg(ap, uintmax_t); break;
+			case DEBUGLOG_LEN_SIZE: u = va_arg(ap, size_t); break;
+			case DEBUGLOG_LEN_PTRDIFF: u = va_arg(ap, ptrdiff_t); break;
+			default: u = va_arg(ap, unsigned int); break;
+			}
+			pack(u);
+			break;
+
+		case DEBUGLOG_ARG_DOUBLE:
+			if (conv.length == DEBUGLOG_LEN_LONG_DOUBLE)
+				d = va_arg(ap, long double);
+			else
+				d = va_arg(ap, double);
+			pack(d);
+			break;
+
+		case DEBUGLOG_ARG_POINTER:
+			u = (uintptr_t)va_arg(ap, void *);
+			pack(u);
+			break;
+
+		case DEBUGLOG_ARG_STRING:
+			str = va_arg(ap, const char *);
+			if (!str) {
+				len = DEBUGLOG_NULL_STRING;
+				pack(len);
+				break;
+			}
+			if (used + sizeof(len) > size)
+				return used;
+			len = strnlen(str, MIN(DEBUGLOG_MAX_STRING, size - used - sizeof(len)));
+			pack(len);
+			memcpy(buf + used, str, len);
+			used += len;
+			break;
+		}
+	}
+#undef pack
+
+	return used;
+}
+
+static int debug_ring_write(int level, int verbosity, const char *fmt, va_list ap)
+{
+	char args[4096];
+	struct debuglog_record *rec;
+	struct timeval current_time;
+	int saved_errno = errno;
+	size_t args_len;
+	uint32_t len;
+
+	gettimeofday(&current_time, NULL);
+	args_len = debug_ring_pack(args, sizeof(args), fmt, ap, saved_errno);
+
+	if (debug_ring_define(fmt) != OK)
+		return ERROR;
+
+	len = (sizeof(*rec) + args_len + DEBUGLOG_ALIGN - 1) & ~(DEBUGLOG_ALIGN - 1);
+	rec = debug_ring_reserve(len);
+	rec->len = len;
+	rec->type = DEBUGLOG_MESSAGE;
+	rec->verbosity = verbosity;
+	rec->level = level;
+	rec->reserved = 0;
+	rec->fmt = (uintptr_t)fmt;
+	rec->tv_sec = current_time.tv_sec;
+	rec->tv_usec = current_time.tv_usec;
+	memcpy(rec + 1, args, args_len);
+	debug_ring.hdr->head += len;
+
+	return OK;
+}
+
+/* forked children would scribble over our ring, so they log nothing */
+static void debug_ring_atfork_child(void)
+{
+	debug_ring.hdr = NULL;
+}
+
+/* whether hdr is a ring of size bytes that we've been writing to */
+static int is_our_debug_ring(const struct debuglog_header *hdr, uint64_t size)
+{
+	return !memcmp(hdr->magic, DEBUGLOG_MAGIC, sizeof(DEBUGLOG_MAGIC)) &&
+	       hdr->version == DEBUGLOG_VERSION &&
+	       hdr->header_size == DEBUGLOG_HEADER_SIZE &&
+	       hdr->size == size && hdr->head >= hdr->tail &&
+	       hdr->pid == (int64_t)getpid();
+}
+
+/*
+ * The first time we open the ring, the previous run's ring is moved
+ * out of the way. When it's reopened on a restart we keep adding to
+ * the one we have, unless it's been resized or replaced.
+ */
+static int open_debug_ring(void)
+{
+	static int handlers_registered = FALSE;
+	static int rotated = FALSE;
+	struct debuglog_header *hdr;
+	char *tmppath = NULL;
+	uint64_t size;
+	int fd;
+
+	size = MAX(max_debug_file_size, DEBUGLOG_MIN_SIZE) & ~(DEBUGLOG_ALIGN - 1);
+
+	/* keep the trace from the last run around, in case it crashed */
+	if (!rotated) {
+		nm_asprintf(&tmppath, "%s.old", debug_file);
+		if (tmppath) {
+			unlink(tmppath);
+			my_rename(debug_file, tmppath);
+			nm_free(tmppath);
+		}
+	}
+
+	fd = open(debug_file, O_RDWR | O_CREAT | (rotated ? 0 : O_TRUNC), 0644);
+	if (fd < 0)
+		return ERROR;
+	rotated = TRUE;
+	if (ftruncate(fd, size) < 0) {
+		close(fd);
+		return ERROR;
+	}
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return ERROR;
+
+	if (!is_our_debug_ring(hdr, size)) {
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->version = DEBUGLOG_VERSION;
+		hdr->header_size = DEBUGLOG_HEADER_SIZE;
+		hdr->size = size;
+		hdr->head = hdr->tail = 0;
+		hdr->pid = getpid();
+		memcpy(hdr->magic, DEBUGLOG_MAGIC, sizeof(DEBUGLOG_MAGIC));
+	}
+
+	if (!handlers_registered) {
+		pthread_atfork(NULL, NULL, debug_ring_atfork_child);
+		handlers_registered = TRUE;
+	}
+
+	debug_ring.formats = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+	debug_ring.ring = (char *)hdr + DEBUGLOG_HEADER_SIZE;
+	debug_ring.ring_size = size - DEBUGLOG_HEADER_SIZE;
+	debug_ring.hdr = hdr;
+
+	return OK;
+}
+
+static void close_debug_ring(void)
+{
+	if (debug_ring.hdr) {
+		munmap(debug_ring.hdr, debug_ring.hdr->size);
+		debug_ring.hdr = NULL;
+	}
+	if (debug_ring.formats) {
+		g_hash_table_destroy(debug_ring.formats);
+		debug_ring.formats = NULL;
+	}
+}
+
+/*
+ * Format strings are only copied into the debug ring the first time
+ * they're seen at an address, so this must be called before memory
+ * holding one may be reused, as when the module it's in is unloaded.
+ */
+void forget_debug_log_formats(void)
+{
+	if (debug_ring.formats)
+		g_hash_table_remove_all(debug_ring.formats);
+}
+
 /* opens the debug log for writing */
 int open_debug_log(void)
 {
@@ -246,6 +868,9 @@ int open_debug_log(void)
 	if (debug_level == DEBUGL_NONE)
 		return OK;
 
+	if (binary_debug_log)
+		return open_debug_ring();
+
 	if ((debug_file_fp = fopen(debug_file, "a+")) == NULL)
 		return ERROR;
 
@@ -258,6 +883,7 @@ int open_debug_log(void)
 /* closes the debug log */
 int close_debug_log(void)
 {
+	close_debug_ring();
 
 	if (debug_file_fp != NULL)
 		fclose(debug_file_fp);
@@ -281,6 +907,14 @@ int log_debug_info(int level, int verbosity, const char *fmt, ...)
 	if (verbosity > debug_verbosity)
 		return OK;
 
+	if (debug_ring.hdr) {
+		int result;
+		va_start(ap, fmt);
+		result = debug_ring_write(level, verbosity, fmt, ap);
+		va_end(ap);
+		return result;
+	}
+
 	if (debug_file_fp == NULL)
 		return ERROR;
 
@@ -339,5 +973,5 @@ void nm_g_log_handler(const gchar *domain, GLogLevelFlags log_level,
 		nm_log(nm_log_type, message, NULL);
 
 	if (log_level & G_LOG_LEVEL_DEBUG)
-		log_debug_info(DEBUGL_ALL, 1, message, NULL);
+		log_debug_info(DEBUGL_ALL, 1, "%s", message);
 }
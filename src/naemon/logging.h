@@ -78,10 +78,30 @@ NAGIOS_BEGIN_DECL
 
 extern int log_initial_states;
 extern int log_current_states;
+extern int use_async_logging;
+extern unsigned long log_flush_interval; /* milliseconds */
+extern unsigned long log_buffer_size; /* bytes */
+extern int binary_debug_log;
+
+/* what the asynchronous log writer has been up to */
+struct log_writer_stats {
+	int active; /* whether a writer thread is running */
+	unsigned long queued; /* lines handed to the writer */
+	unsigned long dropped; /* lines lost because the buffer was full */
+	unsigned long flushed; /* lines written to the log file */
+	unsigned long buffered; /* bytes waiting to be written */
+	unsigned long buffer_size;
+};
 
 /**** Logging Functions ****/
 void nm_log(int, const char *, ...)
 __attribute__((__format__(__printf__, 2, 3)));
+/*
+ * With binary_debug_log set, the format string is recorded by its
+ * address and only formatted when the log is decoded, so it must be
+ * a string constant. Modules that are unloaded have theirs forgotten
+ * by forget_debug_log_formats().
+ */
 int log_debug_info(int, int, const char *, ...)
 __attribute__((__format__(__printf__, 3, 4)));
 
@@ -89,8 +109,19 @@ int rotate_log_file(time_t);			     	/* rotates the main log file */
 int write_log_file_info(time_t *); 			/* records log file/version info */
 int open_debug_log(void);
 int close_debug_log(void);
+void forget_debug_log_formats(void);
 int close_log_file(void);
 
+/*
+ * Asynchronous logging. The writer thread is only started if
+ * use_async_logging is set, and lines logged while it isn't running
+ * are written to the log file right away.
+ */
+int start_log_writer(void);
+void stop_log_writer(void); /* writes everything still queued */
+void flush_log_writer(void); /* waits until everything queued is written */
+void get_log_writer_stats(struct log_writer_stats *stats);
+
 /* GLib log handler (GLogFunc*) that maps GLib log messages to their
  * corresponding Naemon levels. Only intended for use as a regular handler,
  * don't invoke directly through application code*/
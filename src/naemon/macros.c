@@ -117,8 +117,8 @@ static int grab_custom_object_macro_r(nagios_macros *mac, char *macro_name, cust
 	return result;
 }
 
-/* given a "raw" command, return the "expanded" or "whole" command line */
-int get_raw_command_line_r(nagios_macros *mac, command *cmd_ptr, char *cmd, char **full_command, int macro_options)
+/* set the $ARGn$ macros from the arguments of a "command!arg1!arg2" string */
+int grab_argv_macros_r(nagios_macros *mac, char *cmd, int macro_options)
 {
 	char temp_arg[MAX_COMMAND_BUFFER] = "";
 	char *arg_buffer = NULL;
@@ -129,15 +129,6 @@ int get_raw_command_line_r(nagios_macros *mac, command *cmd_ptr, char *cmd, char
 	/* clear the argv macros */
 	clear_argv_macros_r(mac);
 
-	/* make sure we've got all the requirements */
-	if (cmd_ptr == NULL || full_command == NULL)
-		return ERROR;
-
-	log_debug_info(DEBUGL_COMMANDS | DEBUGL_CHECKS | DEBUGL_MACROS, 2, "Raw Command Input: %s\n", cmd_ptr->command_line);
-
-	/* get the full command line */
-	*full_command = nm_strdup((cmd_ptr->command_line == NULL) ? "" : cmd_ptr->command_line);
-
 	/* XXX: Crazy indent */
 	/* get the command arguments */
 	if (cmd != NULL) {
@@ -181,6 +172,27 @@ int get_raw_command_line_r(nagios_macros *mac, command *cmd_ptr, char *cmd, char
 		}
 	}
 
+	return OK;
+}
+
+/* given a "raw" command, return the "expanded" or "whole" command line */
+int get_raw_command_line_r(nagios_macros *mac, command *cmd_ptr, char *cmd, char **full_command, int macro_options)
+{
+	/* clear the argv macros */
+	clear_argv_macros_r(mac);
+
+	/* make sure we've got all the requirements */
+	if (cmd_ptr == NULL || full_command == NULL)
+		return ERROR;
+
+	log_debug_info(DEBUGL_COMMANDS | DEBUGL_CHECKS | DEBUGL_MACROS, 2, "Raw Command Input: %s\n", cmd_ptr->command_line);
+
+	/* get the full command line */
+	*full_command = nm_strdup((cmd_ptr->command_line == NULL) ? "" : cmd_ptr->command_line);
+
+	/* get the command arguments */
+	grab_argv_macros_r(mac, cmd, macro_options);
+
 	log_debug_info(DEBUGL_COMMANDS | DEBUGL_CHECKS | DEBUGL_MACROS, 2, "Expanded Command Output: %s\n", *full_command);
 
 	return OK;
@@ -1875,6 +1887,8 @@ static int grab_macrox_value_r(nagios_macros *mac, int macro_type, char *arg1, c
 	case MACRO_NOTIFICATIONAUTHORNAME:
 	case MACRO_NOTIFICATIONAUTHORALIAS:
 	case MACRO_NOTIFICATIONCOMMENT:
+	case MACRO_NOTIFICATIONCOUNT:
+	case MACRO_NOTIFICATIONLIST:
 
 		/* notification macros have already been pre-computed */
 		*output = mac->x[macro_type];
@@ -2279,150 +2293,334 @@ static int grab_macro_value_r(nagios_macros *mac, char *macro_buffer, char **out
 
 
 /*
- * replace macros in notification commands with their values,
- * the thread-safe version
+ * A command line compiled for macro expansion. It's split into literal
+ * text and macros once, with the macros resolved as far as possible,
+ * so expanding it doesn't involve any parsing or lookups by name.
  */
-int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffer, int options)
-{
-	char *temp_buffer = NULL;
-	char *save_buffer = NULL;
-	char *buf_ptr = NULL;
-	char *delim_ptr = NULL;
-	int in_macro = FALSE;
-	char *selected_macro = NULL;
-	char *original_macro = NULL;
-	int result = OK;
-	int free_macro = FALSE;
-	int macro_options = 0;
-
-	if (output_buffer == NULL || input_buffer == NULL)
-		return ERROR;
+enum macro_token_type {
+	MACRO_TOKEN_TEXT, /* literal text */
+	MACRO_TOKEN_INVALID, /* a macro that can never be expanded */
+	MACRO_TOKEN_ARGV, /* $ARGn$ */
+	MACRO_TOKEN_USER, /* $USERn$ */
+	MACRO_TOKEN_X, /* a standard macro without arguments */
+	MACRO_TOKEN_OTHER, /* anything else, looked up by name when expanded */
+};
 
-	*output_buffer = nm_strdup("");
-	in_macro = FALSE;
+struct macro_token {
+	enum macro_token_type type;
+	int index; /* argv or user macro index, or the standard macro code */
+	int options; /* how a standard macro may be escaped */
+	int closed; /* FALSE if the macro ran into the end of the string */
+	const char *str; /* the text, or the nul-terminated macro name */
+	size_t len;
+};
 
-	log_debug_info(DEBUGL_MACROS, 1, "**** BEGIN MACRO PROCESSING ***********\n");
-	log_debug_info(DEBUGL_MACROS, 1, "Processing: '%s'\n", input_buffer);
+struct macro_program {
+	unsigned int num_tokens;
+	struct macro_token *tokens;
+	char *strings;
+};
 
-	/* use a duplicate of original buffer, so we don't modify the original */
-	save_buffer = buf_ptr = nm_strdup(input_buffer);
-	while (buf_ptr) {
+/* one piece of expanded output */
+struct macro_segment {
+	const char *str;
+	size_t len;
+	char *to_free;
+};
 
-		/* save pointer to this working part of buffer */
-		temp_buffer = buf_ptr;
+/* works out what a macro is, the same way grab_macro_value_r() does */
+static void resolve_macro_token(struct macro_token *tok)
+{
+	const struct macro_key_code *mkey;
+	int x;
 
-		/* find the next delimiter - terminate preceding string and advance buffer pointer for next run */
-		if ((delim_ptr = strchr(buf_ptr, '$'))) {
-			delim_ptr[0] = '\x0';
-			buf_ptr = (char *)delim_ptr + 1;
-		}
-		/* no delimiter found - we already have the last of the buffer */
-		else
-			buf_ptr = NULL;
+	if (strstr(tok->str, "ARG") == tok->str) {
+		x = atoi(tok->str + 3);
+		tok->type = (x <= 0 || x > MAX_COMMAND_ARGUMENTS) ? MACRO_TOKEN_INVALID : MACRO_TOKEN_ARGV;
+		tok->index = x - 1;
+	} else if (strstr(tok->str, "USER") == tok->str) {
+		x = atoi(tok->str + 4);
+		tok->type = (x <= 0 || x > MAX_USER_MACROS) ? MACRO_TOKEN_INVALID : MACRO_TOKEN_USER;
+		tok->index = x - 1;
+	} else if (!strchr(tok->str, ':') && (mkey = find_macro_key(tok->str))) {
+		tok->type = MACRO_TOKEN_X;
+		tok->index = mkey->code;
+		tok->options = mkey->options;
+	} else {
+		tok->type = MACRO_TOKEN_OTHER;
+	}
+}
 
-		log_debug_info(DEBUGL_MACROS, 2, "  Processing part: '%s'\n", temp_buffer);
+struct macro_program *compile_macro_string(const char *input)
+{
+	struct macro_program *prog;
+	struct macro_token *tok;
+	char *ptr, *delim;
+	const char *p;
+	size_t max_tokens = 1;
+	int in_macro = FALSE;
 
-		/* we're in plain text... */
-		if (in_macro == FALSE) {
+	if (input == NULL)
+		return NULL;
 
-			/* add the plain text to the end of the already processed buffer */
-			*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(temp_buffer) + 1);
-			strcat(*output_buffer, temp_buffer);
+	/* there can be at most one token per '$', plus one */
+	for (p = input; (p = strchr(p, '$')); p++)
+		max_tokens++;
+	prog = nm_calloc(1, sizeof(*prog));
+	prog->tokens = nm_calloc(max_tokens, sizeof(*prog->tokens));
+	prog->strings = nm_strdup(input);
+
+	for (ptr = prog->strings; ptr; in_macro = !in_macro) {
+		tok = &prog->tokens[prog->num_tokens];
+		tok->str = ptr;
+		tok->closed = FALSE;
+		if ((delim = strchr(ptr, '$'))) {
+			*delim = 0;
+			tok->closed = TRUE;
+		}
+		tok->len = delim ? (size_t)(delim - ptr) : strlen(ptr);
+		ptr = delim ? delim + 1 : NULL;
 
-			log_debug_info(DEBUGL_MACROS, 2, "  Not currently in macro.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
-			in_macro = TRUE;
+		if (!in_macro) {
+			tok->type = MACRO_TOKEN_TEXT;
+			if (tok->len)
+				prog->num_tokens++;
 			continue;
 		}
 
 		/* an escaped $ is done by specifying two $$ next to each other */
-		if (!strcmp(temp_buffer, "")) {
-			log_debug_info(DEBUGL_MACROS, 2, "  Escaped $.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
-			*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + 2);
-			strcat(*output_buffer, "$");
-			in_macro = FALSE;
+		if (!tok->len) {
+			tok->type = MACRO_TOKEN_TEXT;
+			tok->str = "$";
+			tok->len = 1;
+			prog->num_tokens++;
 			continue;
 		}
 
-		/* looks like we're in a macro, so process it... */
-		/* grab the macro value */
-		free_macro = FALSE;
-		selected_macro = NULL;
-		result = grab_macro_value_r(mac, temp_buffer, &selected_macro, &macro_options, &free_macro);
-		log_debug_info(DEBUGL_MACROS, 2, "  Processed '%s', Free: %d\n", temp_buffer, free_macro);
-
-		/**
-		 * we couldn't parse the macro cause the macro
-		 * doesn't exist, so continue on
-		 */
-		if (result != OK) {
+		prog->num_tokens++;
+		resolve_macro_token(tok);
+	}
+
+	return prog;
+}
+
+void free_compiled_macros(struct macro_program *prog)
+{
+	if (!prog)
+		return;
+	nm_free(prog->tokens);
+	nm_free(prog->strings);
+	nm_free(prog);
+}
+
+/* get the value of a compiled macro, like grab_macro_value_r() does */
+static int grab_compiled_macro_value_r(nagios_macros *mac, struct macro_token *tok, char **output, int *clean_options, int *free_macro)
+{
+	*output = NULL;
+	*clean_options = 0;
+	*free_macro = FALSE;
+
+	switch (tok->type) {
+	case MACRO_TOKEN_ARGV:
+		*output = mac->argv[tok->index];
+		return OK;
+	case MACRO_TOKEN_USER:
+		*output = macro_user[tok->index];
+		return OK;
+	case MACRO_TOKEN_X:
+		/* most frequently used "x" macro gets a shortcut */
+		if (tok->index == MACRO_HOSTADDRESS && mac->host_ptr) {
+			*output = mac->host_ptr->address;
+			return OK;
+		}
+		*clean_options = tok->options;
+		return grab_macrox_value_r(mac, tok->index, NULL, NULL, output, free_macro);
+	case MACRO_TOKEN_OTHER:
+		return grab_macro_value_r(mac, (char *)tok->str, output, clean_options, free_macro);
+	default:
+		return ERROR;
+	}
+}
+
+/*
+ * expands a macro into at most three segments of output, which spell
+ * out the macro itself if it doesn't exist. Returns how many were used
+ */
+static unsigned int expand_macro_token(nagios_macros *mac, struct macro_token *tok, int options, struct macro_segment *segs)
+{
+	char *selected_macro, *original_macro, *cleaned_macro;
+	int result, macro_options, free_macro;
+	unsigned int num_segs = 0;
+
+	result = grab_compiled_macro_value_r(mac, tok, &selected_macro, &macro_options, &free_macro);
+	log_debug_info(DEBUGL_MACROS, 2, "  Processed '%s', Free: %d\n", tok->str, free_macro);
+
+	/* the macro doesn't exist, so it's left as it is */
+	if (result != OK) {
+		if (free_macro == TRUE)
+			nm_free(selected_macro);
+		segs[num_segs].str = "$";
+		segs[num_segs].len = 1;
+		segs[num_segs++].to_free = NULL;
+		segs[num_segs].str = tok->str;
+		segs[num_segs].len = tok->len;
+		segs[num_segs++].to_free = NULL;
+		if (tok->closed) {
+			segs[num_segs].str = "$";
+			segs[num_segs].len = 1;
+			segs[num_segs++].to_free = NULL;
+		}
+		return num_segs;
+	}
+
+	if (selected_macro == NULL)
+		return 0;
+
+	/* URL encode the macro if requested - this allocates new memory */
+	if (options & URL_ENCODE_MACRO_CHARS) {
+		original_macro = selected_macro;
+		selected_macro = get_url_encoded_string(selected_macro);
+		if (free_macro == TRUE)
+			nm_free(original_macro);
+		free_macro = TRUE;
+	}
+
+	/* some macros should sometimes be cleaned */
+	if (macro_options & options & (STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS)) {
+		cleaned_macro = clean_macro_chars(selected_macro, options);
+		if (*selected_macro) {
 			if (free_macro == TRUE)
 				nm_free(selected_macro);
+			selected_macro = cleaned_macro;
+			free_macro = TRUE;
+		}
+	}
+
+	segs[num_segs].str = selected_macro;
+	segs[num_segs].len = strlen(selected_macro);
+	segs[num_segs++].to_free = free_macro == TRUE ? selected_macro : NULL;
+	return num_segs;
+}
 
-			/* add the plain text to the end of the already processed buffer */
-			*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(temp_buffer) + 3);
-			strcat(*output_buffer, "$");
-			strcat(*output_buffer, temp_buffer);
+int process_compiled_macros_r(nagios_macros *mac, struct macro_program *prog, char **output_buffer, int options)
+{
+	struct macro_segment stack_segs[64], *segs = stack_segs;
+	struct macro_token *tok;
+	unsigned int i, num_segs = 0, max_segs;
+	char *out;
+	size_t len = 0;
 
-			/* if we still do not reach the end of string */
-			if (buf_ptr)
-				strcat(*output_buffer, "$");
+	if (output_buffer == NULL || prog == NULL)
+		return ERROR;
 
-			in_macro = FALSE;
+	/* an unknown macro may take up three segments */
+	max_segs = prog->num_tokens * 3;
+	if (max_segs > ARRAY_SIZE(stack_segs))
+		segs = nm_malloc(max_segs * sizeof(*segs));
+
+	for (i = 0; i < prog->num_tokens; i++) {
+		tok = &prog->tokens[i];
+		if (tok->type == MACRO_TOKEN_TEXT) {
+			segs[num_segs].str = tok->str;
+			segs[num_segs].len = tok->len;
+			segs[num_segs++].to_free = NULL;
 			continue;
 		}
+		num_segs += expand_macro_token(mac, tok, options, &segs[num_segs]);
+	}
 
-		/* insert macro */
-		if (selected_macro != NULL) {
-			log_debug_info(DEBUGL_MACROS, 2, "  Processed '%s', Free: %d,  Cleaning options: %d\n", temp_buffer, free_macro, options);
+	/* now we know how long it is, so put it all together in one go */
+	for (i = 0; i < num_segs; i++)
+		len += segs[i].len;
+	*output_buffer = out = nm_malloc(len + 1);
+	for (i = 0; i < num_segs; i++) {
+		memcpy(out, segs[i].str, segs[i].len);
+		out += segs[i].len;
+		nm_free(segs[i].to_free);
+	}
+	*out = 0;
 
-			/* URL encode the macro if requested - this allocates new memory */
-			if (options & URL_ENCODE_MACRO_CHARS) {
-				original_macro = selected_macro;
-				selected_macro = get_url_encoded_string(selected_macro);
-				if (free_macro == TRUE) {
-					nm_free(original_macro);
-				}
-				free_macro = TRUE;
-			}
+	if (segs != stack_segs)
+		nm_free(segs);
 
-			/* some macros should sometimes be cleaned */
-			if (macro_options & options & (STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS)) {
-				char *cleaned_macro = NULL;
+	return OK;
+}
 
-				/* add the (cleaned) processed macro to the end of the already processed buffer */
-				if (selected_macro != NULL && (cleaned_macro = clean_macro_chars(selected_macro, options)) != NULL) {
-					*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(cleaned_macro) + 1);
-					strcat(*output_buffer, cleaned_macro);
-					if (*cleaned_macro)
-						free(cleaned_macro);
+/* appends to a buffer that grows by doubling */
+static void append_output(char **buf, size_t *len, size_t *size, const char *str, size_t n)
+{
+	if (*len + n >= *size) {
+		while (*len + n >= *size)
+			*size *= 2;
+		*buf = nm_realloc(*buf, *size);
+	}
+	memcpy(*buf + *len, str, n);
+	*len += n;
+}
 
-					log_debug_info(DEBUGL_MACROS, 2, "  Cleaned macro.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
-				}
-			}
+/*
+ * replace macros in notification commands with their values,
+ * the thread-safe version. The string is only used once, so it's
+ * expanded as it's parsed rather than compiled first
+ */
+int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffer, int options)
+{
+	struct macro_segment segs[3];
+	struct macro_token tok;
+	char *buf, *ptr, *delim, *out;
+	size_t len = 0, size;
+	unsigned int i, num_segs;
+	int in_macro = FALSE;
 
-			/* others are not cleaned */
-			else {
-				/* add the processed macro to the end of the already processed buffer */
-				if (selected_macro != NULL) {
-					*output_buffer = nm_realloc(*output_buffer, strlen(*output_buffer) + strlen(selected_macro) + 1);
-					strcat(*output_buffer, selected_macro);
+	if (output_buffer == NULL || input_buffer == NULL)
+		return ERROR;
 
-					log_debug_info(DEBUGL_MACROS, 2, "  Uncleaned macro.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
-				}
-			}
+	log_debug_info(DEBUGL_MACROS, 1, "**** BEGIN MACRO PROCESSING ***********\n");
+	log_debug_info(DEBUGL_MACROS, 1, "Processing: '%s'\n", input_buffer);
 
-			/* free memory if necessary (if we URL encoded the macro or we were told to do so by grab_macro_value()) */
-			if (free_macro == TRUE)
-				nm_free(selected_macro);
+	/* plain arguments are common enough to skip parsing them */
+	if (!strchr(input_buffer, '$')) {
+		*output_buffer = nm_strdup(input_buffer);
+		log_debug_info(DEBUGL_MACROS, 1, "**** END MACRO PROCESSING *************\n");
+		return OK;
+	}
 
-			log_debug_info(DEBUGL_MACROS, 2, "  Just finished macro.  Running output (%lu): '%s'\n", (unsigned long)strlen(*output_buffer), *output_buffer);
+	/* macro names are cut out of a copy, as they must be nul-terminated */
+	buf = nm_strdup(input_buffer);
+	size = strlen(input_buffer) + 1;
+	out = nm_malloc(size);
+
+	for (ptr = buf; ptr; in_macro = !in_macro) {
+		tok.str = ptr;
+		tok.closed = FALSE;
+		if ((delim = strchr(ptr, '$'))) {
+			*delim = 0;
+			tok.closed = TRUE;
 		}
+		tok.len = delim ? (size_t)(delim - ptr) : strlen(ptr);
+		ptr = delim ? delim + 1 : NULL;
 
-		in_macro = FALSE;
-	}
+		if (!in_macro) {
+			append_output(&out, &len, &size, tok.str, tok.len);
+			continue;
+		}
+
+		/* an escaped $ is done by specifying two $$ next to each other */
+		if (!tok.len) {
+			append_output(&out, &len, &size, "$", 1);
+			continue;
+		}
 
-	/* free copy of input buffer */
-	nm_free(save_buffer);
+		resolve_macro_token(&tok);
+		num_segs = expand_macro_token(mac, &tok, options, segs);
+		for (i = 0; i < num_segs; i++) {
+			append_output(&out, &len, &size, segs[i].str, segs[i].len);
+			nm_free(segs[i].to_free);
+		}
+	}
+	out[len] = 0;
+	*output_buffer = out;
+	nm_free(buf);
 
 	log_debug_info(DEBUGL_MACROS, 1, "  Done.  Final output: '%s'\n", *output_buffer);
 	log_debug_info(DEBUGL_MACROS, 1, "**** END MACRO PROCESSING *************\n");
@@ -2430,6 +2628,18 @@ int process_macros_r(nagios_macros *mac, char *input_buffer, char **output_buffe
 	return OK;
 }
 
+int process_command_macros_r(nagios_macros *mac, command *cmd_ptr, char **output_buffer, int options)
+{
+	if (cmd_ptr == NULL || output_buffer == NULL)
+		return ERROR;
+
+	if (cmd_ptr->compiled_command_line == NULL)
+		cmd_ptr->compiled_command_line = compile_macro_string(cmd_ptr->command_line ? cmd_ptr->command_line : "");
+
+	log_debug_info(DEBUGL_MACROS, 1, "Processing command '%s': '%s'\n", cmd_ptr->name, cmd_ptr->command_line);
+	return process_compiled_macros_r(mac, cmd_ptr->compiled_command_line, output_buffer, options);
+}
+
 int process_macros(char *input_buffer, char **output_buffer, int options)
 {
 	return process_macros_r(&global_macros, input_buffer, output_buffer, options);
@@ -2501,6 +2711,7 @@ int init_macros(void)
 		case MACRO_SERVICENOTES:
 		case MACRO_HOSTGROUPNOTES:
 		case MACRO_SERVICEGROUPNOTES:
+		case MACRO_NOTIFICATIONLIST:
 			macro_keys[x].options |= STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
 			break;
 		}
@@ -2680,6 +2891,8 @@ int init_macrox_names(void)
 	add_macrox_name(HOSTVALUE);
 	add_macrox_name(SERVICEVALUE);
 	add_macrox_name(PROBLEMVALUE);
+	add_macrox_name(NOTIFICATIONCOUNT);
+	add_macrox_name(NOTIFICATIONLIST);
 
 	return OK;
 }
@@ -2716,6 +2929,36 @@ int clear_argv_macros_r(nagios_macros *mac)
 }
 
 
+/* tells if a macro is "constant" (i.e. it doesn't change throughout the course of monitoring) */
+static int is_constant_macro(int macro_type)
+{
+	switch (macro_type) {
+	case MACRO_ADMINEMAIL:
+	case MACRO_ADMINPAGER:
+	case MACRO_MAINCONFIGFILE:
+	case MACRO_STATUSDATAFILE:
+	case MACRO_RETENTIONDATAFILE:
+	case MACRO_OBJECTCACHEFILE:
+	case MACRO_TEMPFILE:
+	case MACRO_LOGFILE:
+	case MACRO_RESOURCEFILE:
+	case MACRO_COMMANDFILE:
+	case MACRO_HOSTPERFDATAFILE:
+	case MACRO_SERVICEPERFDATAFILE:
+	case MACRO_PROCESSSTARTTIME:
+	case MACRO_TEMPPATH:
+	case MACRO_EVENTSTARTTIME:
+	case MACRO_TOTALHOSTSERVICES:
+	case MACRO_TOTALHOSTSERVICESOK:
+	case MACRO_TOTALHOSTSERVICESWARNING:
+	case MACRO_TOTALHOSTSERVICESUNKNOWN:
+	case MACRO_TOTALHOSTSERVICESCRITICAL:
+		return TRUE;
+	}
+	return FALSE;
+}
+
+
 /* clear all macros that are not "constant" (i.e. they change throughout the course of monitoring) */
 int clear_volatile_macros_r(nagios_macros *mac)
 {
@@ -2724,34 +2967,9 @@ int clear_volatile_macros_r(nagios_macros *mac)
 	register int x = 0;
 
 	for (x = 0; x < MACRO_X_COUNT; x++) {
-		switch (x) {
-
-		case MACRO_ADMINEMAIL:
-		case MACRO_ADMINPAGER:
-		case MACRO_MAINCONFIGFILE:
-		case MACRO_STATUSDATAFILE:
-		case MACRO_RETENTIONDATAFILE:
-		case MACRO_OBJECTCACHEFILE:
-		case MACRO_TEMPFILE:
-		case MACRO_LOGFILE:
-		case MACRO_RESOURCEFILE:
-		case MACRO_COMMANDFILE:
-		case MACRO_HOSTPERFDATAFILE:
-		case MACRO_SERVICEPERFDATAFILE:
-		case MACRO_PROCESSSTARTTIME:
-		case MACRO_TEMPPATH:
-		case MACRO_EVENTSTARTTIME:
-		case MACRO_TOTALHOSTSERVICES:
-		case MACRO_TOTALHOSTSERVICESOK:
-		case MACRO_TOTALHOSTSERVICESWARNING:
-		case MACRO_TOTALHOSTSERVICESUNKNOWN:
-		case MACRO_TOTALHOSTSERVICESCRITICAL:
-			/* these don't change during the course of monitoring, so no need to free them */
-			break;
-		default:
+		/* constant macros don't change during the course of monitoring, so no need to free them */
+		if (!is_constant_macro(x))
 			nm_free(mac->x[x]);
-			break;
-		}
 	}
 
 	/* contact address macros */
@@ -2803,6 +3021,60 @@ int clear_volatile_macros_r(nagios_macros *mac)
 }
 
 
+static customvariablesmember *copy_custom_variables(customvariablesmember *src)
+{
+	customvariablesmember *head = NULL, **tail = &head;
+
+	for (; src; src = src->next) {
+		*tail = nm_calloc(1, sizeof(**tail));
+		(*tail)->variable_name = nm_strdup(src->variable_name);
+		(*tail)->variable_value = src->variable_value ? nm_strdup(src->variable_value) : NULL;
+		(*tail)->has_been_modified = src->has_been_modified;
+		tail = &(*tail)->next;
+	}
+	return head;
+}
+
+
+/*
+ * copy the volatile macros so they can be used after the original
+ * ones have been cleared. ARGx and on-demand macros are left out, as
+ * they're set for each command that gets processed. The copy is
+ * freed with clear_volatile_macros_r()
+ */
+int copy_volatile_macros_r(nagios_macros *dest, nagios_macros *src)
+{
+	register int x = 0;
+
+	memset(dest, 0, sizeof(*dest));
+
+	for (x = 0; x < MACRO_X_COUNT; x++) {
+		if (is_constant_macro(x))
+			dest->x[x] = src->x[x];
+		else if (src->x[x])
+			dest->x[x] = nm_strdup(src->x[x]);
+	}
+
+	for (x = 0; x < MAX_CONTACT_ADDRESSES; x++) {
+		if (src->contactaddress[x])
+			dest->contactaddress[x] = nm_strdup(src->contactaddress[x]);
+	}
+
+	dest->host_ptr = src->host_ptr;
+	dest->hostgroup_ptr = src->hostgroup_ptr;
+	dest->service_ptr = src->service_ptr;
+	dest->servicegroup_ptr = src->servicegroup_ptr;
+	dest->contact_ptr = src->contact_ptr;
+	dest->contactgroup_ptr = src->contactgroup_ptr;
+
+	dest->custom_host_vars = copy_custom_variables(src->custom_host_vars);
+	dest->custom_service_vars = copy_custom_variables(src->custom_service_vars);
+	dest->custom_contact_vars = copy_custom_variables(src->custom_contact_vars);
+
+	return OK;
+}
+
+
 /* clear service macros */
 int clear_service_macros_r(nagios_macros *mac)
 {
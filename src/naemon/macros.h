@@ -22,7 +22,7 @@
 /****************** MACRO DEFINITIONS *****************/
 #define MACRO_ENV_VAR_PREFIX			"NAGIOS_"
 #define MAX_USER_MACROS				256	/* max $USERx$ macros */
-#define MACRO_X_COUNT				156	/* size of macro_x[] array */
+#define MACRO_X_COUNT				158	/* size of macro_x[] array */
 
 NAGIOS_BEGIN_DECL
 
@@ -201,6 +201,8 @@ typedef struct nagios_macros nagios_macros;
 #define MACRO_HOSTVALUE                         153
 #define MACRO_SERVICEVALUE                      154
 #define MACRO_PROBLEMVALUE                      155
+#define MACRO_NOTIFICATIONCOUNT                 156
+#define MACRO_NOTIFICATIONLIST                  157
 
 
 /************* MACRO CLEANING OPTIONS *****************/
@@ -223,9 +225,26 @@ int process_macros(char *, char **, int);
 /* thread-safe version of the above */
 int process_macros_r(nagios_macros *mac, char *, char **, int);
 
+/*
+ * Macro strings can be compiled once and expanded many times, which
+ * saves parsing them and looking the macros up by name every time.
+ */
+struct macro_program *compile_macro_string(const char *input);
+int process_compiled_macros_r(nagios_macros *mac, struct macro_program *prog, char **output_buffer, int options);
+void free_compiled_macros(struct macro_program *prog);
+
+/*
+ * expand the macros in a command's command line, compiling it
+ * the first time the command is used
+ */
+int process_command_macros_r(nagios_macros *mac, command *cmd_ptr, char **output_buffer, int options);
+
 /* given a raw command line, determine the actual command to run */
 int get_raw_command_line_r(nagios_macros *mac, command *, char *, char **, int);
 
+/* set the $ARGn$ macros from the arguments in a "command!arg1!arg2" string */
+int grab_argv_macros_r(nagios_macros *mac, char *, int);
+
 /*
  * These functions updates *mac with the values from
  * their respective object type.
@@ -244,6 +263,7 @@ int free_macrox_names(void);
 /* clear out memory from *mac */
 int clear_argv_macros_r(nagios_macros *mac);
 int clear_volatile_macros_r(nagios_macros *mac);
+int copy_volatile_macros_r(nagios_macros *dest, nagios_macros *src);
 int clear_host_macros_r(nagios_macros *mac);
 int clear_service_macros_r(nagios_macros *mac);
 int clear_hostgroup_macros_r(nagios_macros *mac);
@@ -12,6 +12,7 @@
 #include "nebmodules.h"
 #include "workers.h"
 #include "nerd.h"
+#include "notifications.h"
 #include "query-handler.h"
 #include "configuration.h"
 #include "commands.h"
@@ -495,6 +496,9 @@ int main(int argc, char **argv)
 			nagios_pid = (int)getpid();
 		}
 
+		/* the log writer thread mustn't be started until we've daemonized */
+		start_log_writer();
+
 		/* this must be logged after we read config data, as user may have changed location of main log file */
 		nm_log(NSLOG_PROCESS_INFO, "Naemon "VERSION" starting... (PID=%d)\n", (int)getpid());
 
@@ -535,6 +539,8 @@ int main(int argc, char **argv)
 		nerd_init();
 		timing_point("Initialized NERD\n");
 
+		notification_dispatch_init();
+
 		/* initialize check workers */
 		timing_point("Spawning %u workers\n", wproc_num_workers_spawned);
 		if (init_workers(num_check_workers) < 0) {
@@ -648,6 +654,7 @@ int main(int argc, char **argv)
 		/* initialize the check execution subsystem */
 		timing_point("Initializing check execution scheduling\n");
 		checks_init();
+		init_worker_autoscaler();
 		timing_point("Initialized check execution scheduling\n");
 
 		/* initialize check statistics */
@@ -714,6 +721,9 @@ int main(int argc, char **argv)
 
 		disconnect_command_file_worker();
 
+		/* while the workers can still run them */
+		notification_dispatch_deinit();
+
 		/* save service and host state information */
 		save_state_information(FALSE);
 		cleanup_retention_data();
@@ -741,6 +751,9 @@ int main(int argc, char **argv)
 		/* clean up after ourselves */
 		cleanup();
 
+		/* write out whatever is still queued for the main log */
+		stop_log_writer();
+
 		/* close debug log */
 		close_debug_log();
 
@@ -8,6 +8,7 @@
 #define _NAEMON_H_INSIDE
 
 #include "lib/libnaemon.h"
+#include "bgwriter.h"
 #include "broker.h"
 #include "checks.h"
 #include "checks_service.h"
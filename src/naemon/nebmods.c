@@ -303,6 +303,9 @@ int neb_unload_module(nebmodule *mod, int flags, int reason)
 			nm_log(NSLOG_RUNTIME_ERROR, "Error: Could not unload module '%s' -> %s\n", mod->filename, dlerror());
 			return ERROR;
 		}
+
+		/* its format strings are gone, and something else may end up where they were */
+		forget_debug_log_formats();
 	}
 
 	/* mark the module as being unloaded */
@@ -493,6 +496,7 @@ int neb_register_callback_full(enum NEBCallbackType callback_type, void *mod_han
 	new_callback->module_handle = mod_handle;
 	new_callback->callback_func = callback_func;
 	new_callback->api_version = api_version;
+	new_callback->module_name = temp_module->core_module ? "Unnamed core module" : temp_module->filename;
 
 	/* add new function to callback list, sorted by priority (first come, first served for same priority) */
 	new_callback->next = NULL;
@@ -505,9 +509,10 @@ int neb_register_callback_full(enum NEBCallbackType callback_type, void *mod_han
 				break;
 			last_callback = temp_callback;
 		}
-		if (last_callback == NULL)
+		if (last_callback == NULL) {
+			new_callback->next = temp_callback;
 			neb_callback_list[callback_type] = new_callback;
-		else {
+		} else {
 			if (temp_callback == NULL)
 				last_callback->next = new_callback;
 			else {
@@ -581,9 +586,9 @@ int neb_deregister_callback(enum NEBCallbackType callback_type, void *callback_f
 		return NEBERROR_CALLBACKNOTFOUND;
 
 	else {
-		/* only one item in the list */
+		/* first item in the list */
 		if (temp_callback != last_callback->next)
-			neb_callback_list[callback_type] = NULL;
+			neb_callback_list[callback_type] = next_callback;
 		else
 			last_callback->next = next_callback;
 		nm_free(temp_callback);
@@ -616,11 +621,9 @@ static neb_cb_result *neb_invoke_callback(void *cb, enum NEBCallbackAPIVersion a
 neb_cb_resultset *neb_make_callbacks_full(enum NEBCallbackType callback_type, void *data)
 {
 	nebcallback *temp_callback, *next_callback;
-	nebmodule *temp_module;
 	neb_cb_resultset *resultset = neb_cb_resultset_create();
 	neb_cb_result *cbresult = NULL;
 	int total_callbacks = 0;
-	char *temp_module_name = "";
 
 	/* make sure callback list is initialized */
 	if (neb_callback_list == NULL) {
@@ -634,21 +637,9 @@ neb_cb_resultset *neb_make_callbacks_full(enum NEBCallbackType callback_type, vo
 	/* make the callbacks... */
 	for (temp_callback = neb_callback_list[callback_type]; temp_callback; temp_callback = next_callback) {
 		next_callback = temp_callback->next;
-		/* get name of module reponsible for the callback */
-		for (temp_module = neb_module_list; temp_module != NULL; temp_module = temp_module->next) {
-			if (temp_module->module_handle == temp_callback->module_handle) {
-				if (temp_module->core_module) {
-					temp_module_name = "Unnamed core module";
-				} else {
-					temp_module_name = temp_module->filename;
-				}
-				break;
-			}
-		}
 		cbresult = neb_invoke_callback(temp_callback->callback_func, temp_callback->api_version, callback_type, data);
-		cbresult->module_name = nm_strdup(temp_module_name);
+		cbresult->module_name = nm_strdup(temp_callback->module_name);
 		g_ptr_array_add(resultset->cb_results, cbresult);
-		temp_callback = next_callback;
 
 		total_callbacks++;
 		log_debug_info(DEBUGL_EVENTBROKER, 2, "Callback #%d (type %d) return code = %d\n", total_callbacks, callback_type, cbresult->rc);
@@ -666,22 +657,47 @@ neb_cb_resultset *neb_make_callbacks_full(enum NEBCallbackType callback_type, vo
 	return resultset;
 }
 
+/* make callbacks to modules, keeping only the last return code */
 int neb_make_callbacks(enum NEBCallbackType callback_type, void *data)
 {
-	neb_cb_resultset_iter iter;
-	int rc = 0;
-	neb_cb_result *cb_result = NULL;
-	neb_cb_resultset *resultset = neb_make_callbacks_full(callback_type, data);
+	nebcallback *temp_callback, *next_callback;
+	int rc = 0, total_callbacks = 0;
 
-	neb_cb_resultset_iter_init(&iter, resultset);
-	while (neb_cb_resultset_iter_next(&iter, &cb_result)) {
-		rc = cb_result->rc;
+	if (neb_callback_list == NULL)
+		return ERROR;
+
+	/* nobody's listening */
+	if (neb_callback_list[callback_type] == NULL)
+		return 0;
+
+	log_debug_info(DEBUGL_EVENTBROKER, 1, "Making callbacks (type %d)...\n", callback_type);
+
+	for (temp_callback = neb_callback_list[callback_type]; temp_callback; temp_callback = next_callback) {
+		next_callback = temp_callback->next;
+		if (temp_callback->api_version == NEB_API_VERSION_1) {
+			int (*callbackfunc)(int, void *) = temp_callback->callback_func;
+			rc = callbackfunc(callback_type, data);
+		} else {
+			neb_cb_result *cbresult = neb_invoke_callback(temp_callback->callback_func, temp_callback->api_version, callback_type, data);
+			rc = cbresult->rc;
+			neb_cb_result_destroy(cbresult);
+		}
+
+		total_callbacks++;
+		log_debug_info(DEBUGL_EVENTBROKER, 2, "Callback #%d (type %d) return code = %d\n", total_callbacks, callback_type, rc);
+
+		if (rc == NEBERROR_CALLBACKCANCEL || rc == NEBERROR_CALLBACKOVERRIDE)
+			break;
 	}
 
-	neb_cb_resultset_destroy(resultset);
 	return rc;
 }
 
+int neb_has_callbacks(enum NEBCallbackType callback_type)
+{
+	return neb_callback_list != NULL && neb_callback_list[callback_type] != NULL;
+}
+
 
 /* initialize callback list */
 int neb_init_callback_list(void)
@@ -18,6 +18,7 @@ typedef struct nebcallback_struct {
 	void                        *module_handle;
 	int                         priority;
 	enum NEBCallbackAPIVersion  api_version;
+	const char                  *module_name;
 	struct nebcallback_struct   *next;
 } nebcallback;
 
@@ -61,14 +62,23 @@ neb_cb_resultset * neb_make_callbacks_full(enum NEBCallbackType callback_type, v
  * Make callbacks to Event Broker Modules (simplified)
  * This is identical to \p neb_make_callbacks_full, with the execption that it
  * automatically frees the result and only returns the return code of the last
- * callback invoked, in order to provide backwards compatibility. New code
- * should probably avoid using this function.
+ * callback invoked, in order to provide backwards compatibility. No result
+ * set is built, so version 1 callbacks are invoked without allocating
+ * anything. New code should probably avoid using this function.
  * @param callback_type The callback type to invoke
  * @param user_data Opaque pointer passed to callback
  * @return The return code of the callback result
  */
 int neb_make_callbacks(enum NEBCallbackType callback_type, void * user_data);
 
+/**
+ * Check if any callbacks are registered for a callback type, so callers
+ * can skip building the event data when nobody is listening
+ * @param callback_type The callback type to check
+ * @return Non-zero if there are callbacks to invoke, otherwise 0
+ */
+int neb_has_callbacks(enum NEBCallbackType callback_type);
+
 /***** CALLBACK RESULT *****/
 /**
  * Create a new \p neb_cb_result with the given \p rc and a description formatted with
@@ -10,10 +10,13 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 #include "config.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include "lib/libnaemon.h"
 #include "common.h"
 #include "broker.h"
@@ -28,6 +31,42 @@
 #include "nm_alloc.h"
 #include "events.h"
 
+#ifndef IOV_MAX
+# define IOV_MAX 16
+#endif
+
+/*
+ * Every subscriber has a bounded queue of messages waiting to be sent,
+ * so one that doesn't keep up can neither block the main loop nor
+ * starve the others. Messages are formatted once per event and shared
+ * between the queues of all subscribers that get it.
+ */
+#define NERD_QUEUE_SIZE 1024 /* messages */
+#define NERD_QUEUE_BYTES (1024 * 1024)
+
+#define NERD_OVERFLOW_DROP_OLDEST 0
+#define NERD_OVERFLOW_DISCONNECT  1
+
+struct nerd_message {
+	unsigned int refs;
+	unsigned int len;
+	char buf[];
+};
+
+struct nerd_subscriber {
+	int sd;
+	unsigned int num_subscriptions;
+	int policy; /* what to do when the queue is full */
+	struct nerd_message *queue[NERD_QUEUE_SIZE];
+	unsigned int head, count;
+	unsigned int sent; /* bytes of the head message already sent */
+	size_t queued_bytes;
+	unsigned long delivered, dropped;
+	int writing; /* waiting for the socket to become writable */
+	int doomed; /* to be cancelled once we're done broadcasting */
+	struct nerd_subscriber *next_doomed;
+};
+
 struct nerd_channel {
 	const char *name; /* name of this channel */
 	const char *description; /* user-presentable string to document the purpose of this channel */
@@ -43,6 +82,242 @@ static nebmodule nerd_mod; /* fake module to get our callbacks accepted */
 static struct nerd_channel **channels;
 static unsigned int num_channels, alloc_channels;
 static unsigned int chan_host_checks_id, chan_service_checks_id;
+static GHashTable *subscribers; /* struct nerd_subscriber, keyed by sd */
+static struct nerd_subscriber *doomed_subscribers;
+
+
+static struct nerd_message *nerd_message_create(const void *buf, unsigned int len)
+{
+	struct nerd_message *msg;
+
+	msg = nm_malloc(sizeof(*msg) + len + 1);
+	msg->refs = 1;
+	msg->len = len;
+	memcpy(msg->buf, buf, len);
+	msg->buf[len] = 0;
+	return msg;
+}
+
+static struct nerd_message *nerd_message_printf(const char *fmt, ...)
+{
+	struct nerd_message *msg;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return NULL;
+
+	msg = nm_malloc(sizeof(*msg) + len + 1);
+	msg->refs = 1;
+	msg->len = len;
+	va_start(ap, fmt);
+	vsnprintf(msg->buf, len + 1, fmt, ap);
+	va_end(ap);
+	return msg;
+}
+
+static void nerd_message_unref(struct nerd_message *msg)
+{
+	if (msg && !--msg->refs)
+		free(msg);
+}
+
+static struct nerd_subscriber *get_subscriber(int sd)
+{
+	return subscribers ? g_hash_table_lookup(subscribers, GINT_TO_POINTER(sd)) : NULL;
+}
+
+static struct nerd_subscriber *add_subscriber(int sd)
+{
+	struct nerd_subscriber *s;
+
+	if (!subscribers)
+		subscribers = g_hash_table_new(g_direct_hash, g_direct_equal);
+	if ((s = get_subscriber(sd)))
+		return s;
+
+	s = nm_calloc(1, sizeof(*s));
+	s->sd = sd;
+	s->policy = NERD_OVERFLOW_DROP_OLDEST;
+	g_hash_table_insert(subscribers, GINT_TO_POINTER(sd), s);
+	return s;
+}
+
+/* unlinks the head of the queue, which must not be empty */
+static struct nerd_message *dequeue(struct nerd_subscriber *s)
+{
+	struct nerd_message *msg = s->queue[s->head];
+
+	s->queue[s->head] = NULL;
+	s->head = (s->head + 1) % NERD_QUEUE_SIZE;
+	s->count--;
+	s->queued_bytes -= msg->len;
+	s->sent = 0;
+	return msg;
+}
+
+static void destroy_subscriber(struct nerd_subscriber *s)
+{
+	if (s->writing)
+		iobroker_set_output_handler(nagios_iobs, s->sd, NULL, NULL);
+	while (s->count)
+		nerd_message_unref(dequeue(s));
+	free(s);
+}
+
+static void release_subscriber(struct nerd_subscriber *s)
+{
+	if (--s->num_subscriptions)
+		return;
+	g_hash_table_remove(subscribers, GINT_TO_POINTER(s->sd));
+	destroy_subscriber(s);
+}
+
+/*
+ * Cancelling a subscriber changes the subscription lists, so it can't
+ * be done while we're walking one of them.
+ */
+static void doom_subscriber(struct nerd_subscriber *s)
+{
+	if (s->doomed)
+		return;
+	s->doomed = 1;
+	s->next_doomed = doomed_subscribers;
+	doomed_subscribers = s;
+}
+
+static void reap_doomed_subscribers(void)
+{
+	struct nerd_subscriber *s;
+
+	while ((s = doomed_subscribers)) {
+		doomed_subscribers = s->next_doomed;
+		nerd_cancel_subscriber(s->sd);
+	}
+}
+
+static int nerd_output_ready(int sd, int events, void *arg);
+
+/*
+ * Send as much of the queue as the socket takes. Whatever is left is
+ * sent from nerd_output_ready() once the socket becomes writable.
+ */
+static int flush_subscriber(struct nerd_subscriber *s)
+{
+	while (s->count) {
+		struct iovec iov[IOV_MAX];
+		unsigned int i, cnt;
+		ssize_t wlen;
+		size_t left;
+
+		cnt = s->count > IOV_MAX ? IOV_MAX : s->count;
+		for (i = 0; i < cnt; i++) {
+			struct nerd_message *msg = s->queue[(s->head + i) % NERD_QUEUE_SIZE];
+			iov[i].iov_base = msg->buf;
+			iov[i].iov_len = msg->len;
+		}
+		iov[0].iov_base = (char *)iov[0].iov_base + s->sent;
+		iov[0].iov_len -= s->sent;
+
+		wlen = writev(s->sd, iov, cnt);
+		if (wlen < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+
+		left = wlen;
+		while (s->count && left >= s->queue[s->head]->len - s->sent) {
+			left -= s->queue[s->head]->len - s->sent;
+			nerd_message_unref(dequeue(s));
+			s->delivered++;
+		}
+		s->sent += left;
+		if (s->sent)
+			break; /* the socket is full */
+	}
+
+	if (s->count && !s->writing) {
+		if (iobroker_set_output_handler(nagios_iobs, s->sd, s, nerd_output_ready) < 0)
+			return -1;
+		s->writing = 1;
+	} else if (!s->count && s->writing) {
+		iobroker_set_output_handler(nagios_iobs, s->sd, NULL, NULL);
+		s->writing = 0;
+	}
+	return 0;
+}
+
+static int nerd_output_ready(int sd, int events, void *arg)
+{
+	struct nerd_subscriber *s = (struct nerd_subscriber *)arg;
+
+	if (flush_subscriber(s) < 0)
+		nerd_cancel_subscriber(sd);
+	return 0;
+}
+
+/* drops the oldest message we haven't started sending */
+static int drop_oldest(struct nerd_subscriber *s)
+{
+	struct nerd_message *msg;
+
+	if (!s->sent) {
+		if (!s->count)
+			return -1;
+		nerd_message_unref(dequeue(s));
+	} else {
+		/* keep the partly sent one, as the stream would break otherwise */
+		unsigned int second = (s->head + 1) % NERD_QUEUE_SIZE;
+
+		if (s->count < 2)
+			return -1;
+		msg = s->queue[second];
+		s->queue[second] = s->queue[s->head];
+		s->queue[s->head] = NULL;
+		s->head = second;
+		s->count--;
+		s->queued_bytes -= msg->len;
+		nerd_message_unref(msg);
+	}
+	s->dropped++;
+	return 0;
+}
+
+static void enqueue(struct nerd_subscriber *s, struct nerd_message *msg)
+{
+	if (s->doomed)
+		return;
+
+	while (s->count == NERD_QUEUE_SIZE || (s->count && s->queued_bytes + msg->len > NERD_QUEUE_BYTES)) {
+		if (s->policy == NERD_OVERFLOW_DROP_OLDEST) {
+			if (!drop_oldest(s))
+				continue;
+			/* all we have is partly sent, so this one has to go */
+			s->dropped++;
+			return;
+		}
+		nm_log(NSLOG_INFO_MESSAGE, "nerd: Disconnecting subscriber %d, which is %u messages behind\n",
+		       s->sd, s->count);
+		s->dropped++;
+		doom_subscriber(s);
+		return;
+	}
+
+	msg->refs++;
+	s->queue[(s->head + s->count) % NERD_QUEUE_SIZE] = msg;
+	s->count++;
+	s->queued_bytes += msg->len;
+
+	/* if we're already waiting for the socket, the loop will get to it */
+	if (!s->writing && flush_subscriber(s) < 0)
+		doom_subscriber(s);
+}
 
 
 static struct nerd_channel *find_channel(const char *name)
@@ -114,6 +389,8 @@ static int subscribe(int sd, struct nerd_channel *chan, char *fmt)
 	subscr->sd = sd;
 	subscr->chan = chan;
 	subscr->format = fmt ? nm_strdup(fmt) : NULL;
+	subscr->subscriber = add_subscriber(sd);
+	subscr->subscriber->num_subscriptions++;
 
 	if (!chan->subscriptions) {
 		nerd_register_channel_callbacks(chan);
@@ -137,7 +414,9 @@ static int cancel_channel_subscription(struct nerd_channel *chan, int sd)
 
 		if (subscr->sd == sd) {
 			cancelled++;
+			release_subscriber(subscr->subscriber);
 			free(list);
+			free(subscr->format);
 			free(subscr);
 			if (prev) {
 				prev->next = next;
@@ -169,6 +448,8 @@ static int unsubscribe(int sd, struct nerd_channel *chan)
 		next = list->next;
 		if (subscr->sd == sd) {
 			/* found it, so remove it */
+			release_subscriber(subscr->subscriber);
+			free(subscr->format);
 			free(subscr);
 			free(list);
 			if (!prev) {
@@ -201,31 +482,29 @@ int nerd_cancel_subscriber(int sd)
 	return 0;
 }
 
+static int broadcast_message(struct nerd_channel *chan, struct nerd_message *msg)
+{
+	objectlist *list;
+
+	for (list = chan->subscriptions; list; list = list->next) {
+		struct nerd_subscription *subscr = (struct nerd_subscription *)list->object_ptr;
+		enqueue(subscr->subscriber, msg);
+	}
+	nerd_message_unref(msg);
+	reap_doomed_subscribers();
+	return 0;
+}
+
 int nerd_broadcast(unsigned int chan_id, void *buf, unsigned int len)
 {
 	struct nerd_channel *chan;
-	objectlist *list, *next;
 
 	if (!(chan = nerd_get_channel(chan_id)))
 		return -1;
+	if (!chan->subscriptions)
+		return 0;
 
-	for (list = chan->subscriptions; list; list = next) {
-		struct nerd_subscription *subscr = (struct nerd_subscription *)list->object_ptr;
-		int result;
-
-		next = list->next;
-
-		result = send(subscr->sd, buf, len, 0);
-		if (result < 0) {
-			if (errno == EAGAIN)
-				return 0;
-
-			nerd_cancel_subscriber(subscr->sd);
-			return 500;
-		}
-	}
-
-	return 0;
+	return broadcast_message(chan, nerd_message_create(buf, len));
 }
 
 
@@ -233,8 +512,8 @@ static int chan_host_checks(int cb, void *data)
 {
 	nebstruct_host_check_data *ds = (nebstruct_host_check_data *)data;
 	check_result *cr = (check_result *)ds->check_result_ptr;
+	struct nerd_message *msg;
 	host *h;
-	char *buf;
 
 	if (ds->type != NEBTYPE_HOSTCHECK_PROCESSED)
 		return 0;
@@ -243,9 +522,9 @@ static int chan_host_checks(int cb, void *data)
 		return 0;
 
 	h = (host *)ds->object_ptr;
-	nm_asprintf(&buf, "%s from %d -> %d: %s\n", h->name, h->last_state, h->current_state, cr->output);
-	nerd_broadcast(chan_host_checks_id, buf, strlen(buf));
-	free(buf);
+	msg = nerd_message_printf("%s from %d -> %d: %s\n", h->name, h->last_state, h->current_state, cr->output);
+	if (msg)
+		broadcast_message(channels[chan_host_checks_id], msg);
 	return 0;
 }
 
@@ -253,15 +532,19 @@ static int chan_service_checks(int cb, void *data)
 {
 	nebstruct_service_check_data *ds = (nebstruct_service_check_data *)data;
 	check_result *cr = (check_result *)ds->check_result_ptr;
+	struct nerd_message *msg;
 	service *s;
-	char *buf;
 
 	if (ds->type != NEBTYPE_SERVICECHECK_PROCESSED)
 		return 0;
+
+	if (channels[chan_service_checks_id]->subscriptions == NULL)
+		return 0;
+
 	s = (service *)ds->object_ptr;
-	nm_asprintf(&buf, "%s;%s from %d -> %d: %s\n", s->host_name, s->description, s->last_state, s->current_state, cr->output);
-	nerd_broadcast(chan_service_checks_id, buf, strlen(buf));
-	free(buf);
+	msg = nerd_message_printf("%s;%s from %d -> %d: %s\n", s->host_name, s->description, s->last_state, s->current_state, cr->output);
+	if (msg)
+		broadcast_message(channels[chan_service_checks_id], msg);
 	return 0;
 }
 
@@ -275,15 +558,22 @@ static int nerd_deinit(void)
 
 		for (list = chan->subscriptions; list; list = next) {
 			struct nerd_subscription *subscr = (struct nerd_subscription *)list->object_ptr;
+			release_subscriber(subscr->subscriber);
 			iobroker_close(nagios_iobs, subscr->sd);
 			next = list->next;
 			free(list);
+			free(subscr->format);
 			free(subscr);
 		}
 		chan->subscriptions = NULL;
 		nm_free(chan);
 	}
 	nm_free(channels);
+	if (subscribers) {
+		g_hash_table_destroy(subscribers);
+		subscribers = NULL;
+	}
+	doomed_subscribers = NULL;
 	num_channels = 0;
 	alloc_channels = 0;
 
@@ -331,7 +621,28 @@ static int nerd_qh_handler(int sd, char *request, unsigned int len)
 		                 "Valid commands:\n"
 		                 "  list                      list available channels\n"
 		                 "  subscribe <channel>       subscribe to a channel\n"
-		                 "  unsubscribe <channel>     unsubscribe to a channel\n");
+		                 "  unsubscribe <channel>     unsubscribe to a channel\n"
+		                 "  overflow <policy>         what to do with messages when we fall\n"
+		                 "                            behind; drop-oldest (default) or disconnect\n"
+		                 "  stats                     list subscribers and their queues\n");
+		return 0;
+	}
+
+	if (!strcmp(request, "stats")) {
+		GHashTableIter iter;
+		gpointer value;
+
+		if (subscribers) {
+			g_hash_table_iter_init(&iter, subscribers);
+			while (g_hash_table_iter_next(&iter, NULL, &value)) {
+				struct nerd_subscriber *s = (struct nerd_subscriber *)value;
+				nsock_printf(sd, "sd=%d;subscriptions=%u;policy=%s;queued=%u;queued_bytes=%lu;delivered=%lu;dropped=%lu\n",
+				             s->sd, s->num_subscriptions,
+				             s->policy == NERD_OVERFLOW_DISCONNECT ? "disconnect" : "drop-oldest",
+				             s->count, (unsigned long)s->queued_bytes, s->delivered, s->dropped);
+			}
+		}
+		nsock_printf(sd, "%c", 0);
 		return 0;
 	}
 
@@ -351,6 +662,22 @@ static int nerd_qh_handler(int sd, char *request, unsigned int len)
 
 	*chan_name = 0;
 	chan_name++;
+
+	if (!strcmp(request, "overflow")) {
+		struct nerd_subscriber *s = get_subscriber(sd);
+
+		/* the policy belongs to the queue, which comes with a subscription */
+		if (!s)
+			return 400;
+		if (!strcmp(chan_name, "drop-oldest"))
+			s->policy = NERD_OVERFLOW_DROP_OLDEST;
+		else if (!strcmp(chan_name, "disconnect"))
+			s->policy = NERD_OVERFLOW_DISCONNECT;
+		else
+			return 400;
+		return 0;
+	}
+
 	if (!strcmp(request, "subscribe"))
 		action = NERD_SUBSCRIBE;
 	else if (!strcmp(request, "unsubscribe"))
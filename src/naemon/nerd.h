@@ -14,6 +14,7 @@ struct nerd_subscription {
 	int sd;
 	struct nerd_channel *chan;
 	char *format; /* requested format (macro string) for this subscription */
+	struct nerd_subscriber *subscriber; /* output queue shared by all subscriptions on sd */
 };
 
 /*** Nagios Event Radio Dispatcher functions ***/
@@ -7,6 +7,8 @@
 #include "neberrors.h"
 #include "nebmods.h"
 #include "workers.h"
+#include "events.h"
+#include "query-handler.h"
 #include "utils.h"
 #include "checks.h"
 #include "checks_service.h"
@@ -25,7 +27,21 @@ struct notification_job {
 
 static notification *create_notification_list_from_host(nagios_macros *mac, host *hst, int options, int *escalated, int type);
 static notification *create_notification_list_from_service(nagios_macros *mac, service *svc, int options, int *escalated, int type);
-static int add_notification(notification **notification_list, nagios_macros *mac, contact *);						/* adds a notification instance */
+
+/*
+ * Escalations and contactgroups tend to overlap a lot, so while we
+ * build the list of contacts to notify we remember which ones we've
+ * already looked at, and only check each contact's viability once.
+ */
+struct notification_round {
+	notification *list;
+	bitmap *seen; /* contacts we've already considered, by id */
+	GString *recipients; /* for $NOTIFICATIONRECIPIENTS$ */
+};
+
+static void notification_round_init(struct notification_round *round);
+static void notification_round_finish(struct notification_round *round, nagios_macros *mac);
+static int add_notification(struct notification_round *round, contact *);						/* adds a notification instance */
 
 static void free_notification_list(notification *notification_list)
 {
@@ -283,9 +299,15 @@ void log_notification_suppression_reason(enum NotificationSuppressionReason reas
 #define LOG_SERVICE_NSR_NEB_BLOCKED(NSR, NEB_CB_DESCRIPTION) log_notification_suppression_reason(NSR, NS_TYPE_SERVICE, svc, NULL, NEB_CB_DESCRIPTION);
 #define LOG_HOST_NSR_NEB_BLOCKED(NSR, NEB_CB_DESCRIPTION) log_notification_suppression_reason(NSR, NS_TYPE_HOST, hst, NULL, NEB_CB_DESCRIPTION);
 
+/* notification commands given to a worker that haven't finished yet */
+static unsigned int notifications_running;
+
 static void notification_handle_job_result(struct wproc_result *wpres, void *data, int flags)
 {
 	struct notification_job *nj = (struct notification_job *)data;
+
+	if (notifications_running)
+		notifications_running--;
 	if (wpres) {
 		if (wpres->early_timeout) {
 			if (nj->svc) {
@@ -331,6 +353,451 @@ static void notification_handle_job_result(struct wproc_result *wpres, void *dat
 	free(nj);
 }
 
+/******************************************************************/
+/******************* NOTIFICATION DISPATCHING *********************/
+/******************************************************************/
+
+/*
+ * Notification commands don't go to the workers straight away, but
+ * through a queue that sends no more than notification_rate_limit of
+ * them per second, and only while the workers aren't busy with checks.
+ * With notification_coalesce_window set, the first notification for one
+ * of a contact's notification commands opens a batch that is sent that
+ * many seconds later, with a single run of the command for it and all
+ * the notifications that arrived in the meantime.
+ */
+
+/* at most this many notifications are coalesced into one command */
+#define NOTIFICATION_BATCH_MAX 500
+
+/*
+ * notifications held back because the workers are busy are sent
+ * anyway once they've waited this many seconds
+ */
+#define NOTIFICATION_MAX_HOLD_TIME 60
+
+/* at most this many seconds are spent on sending notifications when shutting down */
+#define NOTIFICATION_SHUTDOWN_WAIT 10
+
+/* a notification command waiting for its turn to be sent to a worker */
+struct queued_notification {
+	char *command;
+	struct notification_job *nj;
+	time_t queued;
+	struct queued_notification *next;
+};
+
+/*
+ * A piece of a batch's command line: either text that was expanded
+ * when the batch was opened, or $NOTIFICATIONCOUNT$ or
+ * $NOTIFICATIONLIST$, which are expanded when it's sent.
+ */
+struct batch_part {
+	char *text;
+	int is_macro;
+};
+
+/*
+ * Notifications coalesced into one run of a notification command.
+ * The command line gets the macros of the first notification in the
+ * batch, expanded as it's queued so the objects changing before the
+ * batch is sent don't show up in it. $NOTIFICATIONCOUNT$ and
+ * $NOTIFICATIONLIST$ cover all of the batch's notifications.
+ */
+struct notification_batch {
+	contact *ctc;
+	commandsmember *cmd;
+	host *hst;
+	service *svc;
+	GArray *parts; /* the command line, or NULL if it couldn't be built */
+	GString *list;
+	unsigned int count;
+	timed_event *ev;
+};
+
+static GHashTable *notification_batches; /* open batches, by commandsmember */
+static int dispatching_stopped; /* set when shutting down, to send everything right away */
+
+static struct {
+	struct queued_notification *head, *tail;
+	unsigned int len;
+	unsigned int tokens; /* sends left this second under the rate limit */
+	time_t refilled;
+	timed_event *ev;
+} dispatch_queue;
+
+static struct {
+	unsigned long dispatched; /* commands handed to the workers */
+	unsigned long failed; /* commands the workers couldn't take */
+	unsigned long queued; /* commands that had to wait in the queue */
+	unsigned long batches; /* commands run for coalesced notifications */
+	unsigned long coalesced; /* notifications that were added to a batch */
+} notification_stats;
+
+static int take_dispatch_token(time_t now)
+{
+	if (!notification_rate_limit)
+		return TRUE;
+
+	if (now != dispatch_queue.refilled) {
+		unsigned long tokens = dispatch_queue.tokens + (unsigned long)(now - dispatch_queue.refilled) * notification_rate_limit;
+		dispatch_queue.tokens = tokens > (unsigned long)notification_rate_limit ? (unsigned int)notification_rate_limit : tokens;
+		dispatch_queue.refilled = now;
+	}
+	if (!dispatch_queue.tokens)
+		return FALSE;
+	dispatch_queue.tokens--;
+	return TRUE;
+}
+
+static void run_notification(char *cmd, struct notification_job *nj)
+{
+	if (ERROR == wproc_run_callback(cmd, notification_timeout, notification_handle_job_result, nj, NULL)) {
+		if (nj->svc)
+			nm_log(NSLOG_RUNTIME_ERROR, "wproc: Unable to send notification for service '%s' on host '%s' to worker\n", nj->svc->description, nj->hst->name);
+		else
+			nm_log(NSLOG_RUNTIME_ERROR, "wproc: Unable to send notification for host '%s' to worker\n", nj->hst->name);
+		free(nj);
+		notification_stats.failed++;
+	} else {
+		notification_stats.dispatched++;
+		notifications_running++;
+	}
+	nm_free(cmd);
+}
+
+/* sends everything in the queue, regardless of limits */
+static void drain_dispatch_queue(void)
+{
+	struct queued_notification *qn;
+
+	while ((qn = dispatch_queue.head)) {
+		dispatch_queue.head = qn->next;
+		run_notification(qn->command, qn->nj);
+		nm_free(qn);
+	}
+	dispatch_queue.tail = NULL;
+	dispatch_queue.len = 0;
+}
+
+static void dispatch_queued_notifications(struct nm_event_execution_properties *evprop)
+{
+	struct queued_notification *qn;
+	time_t now = time(NULL);
+
+	if (evprop->execution_type == EVENT_EXEC_ABORTED)
+		return;
+	dispatch_queue.ev = NULL;
+
+	while ((qn = dispatch_queue.head)) {
+		if (now - qn->queued < NOTIFICATION_MAX_HOLD_TIME && !wproc_can_run_low_priority())
+			break;
+		if (!take_dispatch_token(now))
+			break;
+		dispatch_queue.head = qn->next;
+		if (!dispatch_queue.head)
+			dispatch_queue.tail = NULL;
+		dispatch_queue.len--;
+		run_notification(qn->command, qn->nj);
+		nm_free(qn);
+	}
+
+	if (dispatch_queue.head)
+		dispatch_queue.ev = schedule_event(1, dispatch_queued_notifications, NULL);
+}
+
+/* sends a notification command off, or queues it. Takes over cmd */
+static void dispatch_notification(char *cmd, struct notification_job *nj)
+{
+	struct queued_notification *qn;
+
+	if (dispatching_stopped || (!dispatch_queue.head && wproc_can_run_low_priority() && take_dispatch_token(time(NULL)))) {
+		run_notification(cmd, nj);
+		return;
+	}
+
+	qn = nm_malloc(sizeof(*qn));
+	qn->command = cmd;
+	qn->nj = nj;
+	qn->queued = time(NULL);
+	qn->next = NULL;
+	if (dispatch_queue.tail)
+		dispatch_queue.tail->next = qn;
+	else
+		dispatch_queue.head = qn;
+	dispatch_queue.tail = qn;
+	dispatch_queue.len++;
+	notification_stats.queued++;
+
+	if (!dispatch_queue.ev) {
+		dispatch_queue.ev = schedule_event(1, dispatch_queued_notifications, NULL);
+		/* no event loop to send it for us */
+		if (!dispatch_queue.ev)
+			drain_dispatch_queue();
+	}
+}
+
+/* adds text to a batch's command line, and empties it */
+static void add_batch_part(GArray *parts, GString *text, int is_macro)
+{
+	struct batch_part part;
+
+	part.text = nm_strdup(text->str);
+	part.is_macro = is_macro;
+	g_array_append_val(parts, part);
+	g_string_truncate(text, 0);
+}
+
+/* adds text to a batch's command line with its macros expanded */
+static void add_expanded_batch_part(GArray *parts, GString *text, nagios_macros *mac, int macro_options)
+{
+	char *expanded = NULL;
+
+	process_macros_r(mac, text->str, &expanded, macro_options);
+	g_string_assign(text, expanded ? expanded : "");
+	nm_free(expanded);
+	add_batch_part(parts, text, FALSE);
+}
+
+/*
+ * Cuts a batch's command line up around $NOTIFICATIONCOUNT$ and
+ * $NOTIFICATIONLIST$ and expands the macros in everything else.
+ * The pieces are cut at macro boundaries, so each of them is
+ * processed the same way the whole command line would have been.
+ */
+static void expand_batch_command(struct notification_batch *b, nagios_macros *mac, char *raw_command, int macro_options)
+{
+	GString *text = g_string_new(NULL);
+	char *ptr, *delim;
+	int in_macro = FALSE;
+
+	b->parts = g_array_new(FALSE, FALSE, sizeof(struct batch_part));
+
+	for (ptr = raw_command; ptr; in_macro = !in_macro) {
+		if ((delim = strchr(ptr, '$')))
+			*delim = 0;
+
+		if (in_macro && delim && (!strcmp(ptr, "NOTIFICATIONCOUNT") || !strcmp(ptr, "NOTIFICATIONLIST"))) {
+			if (text->len)
+				add_expanded_batch_part(b->parts, text, mac, macro_options);
+			g_string_printf(text, "$%s$", ptr);
+			add_batch_part(b->parts, text, TRUE);
+		} else {
+			if (in_macro)
+				g_string_append_c(text, '$');
+			g_string_append(text, ptr);
+			if (in_macro && delim)
+				g_string_append_c(text, '$');
+		}
+
+		ptr = delim ? delim + 1 : NULL;
+	}
+
+	if (text->len)
+		add_expanded_batch_part(b->parts, text, mac, macro_options);
+	g_string_free(text, TRUE);
+}
+
+static void send_notification_batch(struct notification_batch *b)
+{
+	nagios_macros mac;
+	GString *cmdline;
+	char *value = NULL;
+	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
+	struct notification_job *nj;
+	struct batch_part *part;
+	guint i;
+
+	g_hash_table_remove(notification_batches, b->cmd);
+	if (b->ev)
+		destroy_event(b->ev);
+
+	log_debug_info(DEBUGL_NOTIFICATIONS, 1, "Sending %u coalesced notifications to contact '%s'\n", b->count, b->ctc->name);
+
+	if (b->parts != NULL) {
+		memset(&mac, 0, sizeof(mac));
+		nm_asprintf(&mac.x[MACRO_NOTIFICATIONCOUNT], "%u", b->count);
+		mac.x[MACRO_NOTIFICATIONLIST] = b->list->str;
+
+		cmdline = g_string_new(NULL);
+		for (i = 0; i < b->parts->len; i++) {
+			part = &g_array_index(b->parts, struct batch_part, i);
+			if (part->is_macro) {
+				process_macros_r(&mac, part->text, &value, macro_options);
+				if (value)
+					g_string_append(cmdline, value);
+				nm_free(value);
+			} else {
+				g_string_append(cmdline, part->text);
+			}
+			nm_free(part->text);
+		}
+		g_array_free(b->parts, TRUE);
+		nm_free(mac.x[MACRO_NOTIFICATIONCOUNT]);
+
+		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Processed notification command: %s\n", cmdline->str);
+		nj = nm_calloc(1, sizeof(struct notification_job));
+		nj->ctc = b->ctc;
+		nj->hst = b->hst;
+		nj->svc = b->svc;
+		dispatch_notification(nm_strdup(cmdline->str), nj);
+		g_string_free(cmdline, TRUE);
+		notification_stats.batches++;
+	}
+
+	g_string_free(b->list, TRUE);
+	nm_free(b);
+}
+
+static void notification_batch_timeout(struct nm_event_execution_properties *evprop)
+{
+	struct notification_batch *b = evprop->user_data;
+
+	if (evprop->execution_type == EVENT_EXEC_ABORTED)
+		return;
+	b->ev = NULL;
+	send_notification_batch(b);
+}
+
+/* adds a notification to the batch for a contact's notification command */
+static void coalesce_notification(nagios_macros *mac, contact *cntct, commandsmember *cmd, host *hst, service *svc)
+{
+	struct notification_batch *b;
+	const char *item = mac->x[MACRO_NOTIFICATIONLIST] ? mac->x[MACRO_NOTIFICATIONLIST] : "";
+	char *raw_command = NULL;
+	int macro_options = STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS;
+
+	notification_stats.coalesced++;
+
+	if (!notification_batches)
+		notification_batches = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	if ((b = g_hash_table_lookup(notification_batches, cmd))) {
+		g_string_append(b->list, "\\n");
+		g_string_append(b->list, item);
+		if (++b->count >= NOTIFICATION_BATCH_MAX)
+			send_notification_batch(b);
+		return;
+	}
+
+	b = nm_calloc(1, sizeof(*b));
+	b->ctc = cntct;
+	b->cmd = cmd;
+	b->hst = hst;
+	b->svc = svc;
+	get_raw_command_line_r(mac, cmd->command_ptr, cmd->command, &raw_command, macro_options);
+	if (raw_command != NULL) {
+		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Raw notification command: %s\n", raw_command);
+		expand_batch_command(b, mac, raw_command, macro_options);
+		nm_free(raw_command);
+	}
+	b->list = g_string_new(item);
+	b->count = 1;
+	g_hash_table_insert(notification_batches, cmd, b);
+
+	if (!dispatching_stopped)
+		b->ev = schedule_event(notification_coalesce_window, notification_batch_timeout, b);
+	/* no event loop to send it for us */
+	if (!b->ev)
+		send_notification_batch(b);
+}
+
+static int notification_qh_handler(int sd, char *buf, unsigned int len)
+{
+	GHashTableIter iter;
+	struct notification_batch *b;
+	time_t now = time(NULL);
+
+	if (!*buf || !strcmp(buf, "help")) {
+		nsock_printf_nul(sd, "Query handler for notification dispatching.\n"
+		                 "Valid commands:\n"
+		                 "  stats     Print coalescing, rate limit and queue statistics\n"
+		                 "  batches   List the notifications being coalesced for each contact\n");
+		return 0;
+	}
+
+	if (!strcmp(buf, "stats")) {
+		nsock_printf(sd, "coalesce_window=%d;rate_limit=%d;open_batches=%u;queue_length=%u;oldest=%lu;workers_busy=%d;running=%u;"
+		             "dispatched=%lu;failed=%lu;queued=%lu;batches=%lu;coalesced=%lu\n",
+		             notification_coalesce_window, notification_rate_limit,
+		             notification_batches ? g_hash_table_size(notification_batches) : 0,
+		             dispatch_queue.len,
+		             dispatch_queue.head ? (unsigned long)(now - dispatch_queue.head->queued) : 0UL,
+		             !wproc_can_run_low_priority(), notifications_running,
+		             notification_stats.dispatched, notification_stats.failed,
+		             notification_stats.queued, notification_stats.batches,
+		             notification_stats.coalesced);
+		return 0;
+	}
+
+	if (!strcmp(buf, "batches")) {
+		if (notification_batches) {
+			g_hash_table_iter_init(&iter, notification_batches);
+			while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&b)) {
+				nsock_printf(sd, "contact=%s;command=%s;notifications=%u;time_left=%ld\n",
+				             b->ctc->name, b->cmd->command, b->count,
+				             b->ev ? get_timed_event_time_left_ms(b->ev) / 1000 : 0L);
+			}
+		}
+		return 0;
+	}
+
+	return 400;
+}
+
+int notification_dispatch_init(void)
+{
+	dispatching_stopped = FALSE;
+	return qh_register_handler("notifications", "Notification dispatch statistics", 0, notification_qh_handler);
+}
+
+/*
+ * Sends whatever is coalescing or queued right away, as we're about to
+ * lose the workers and the objects the notifications are about. This
+ * must run while the workers are still up, as they're killed once we
+ * return, and waits a little for the commands they're running to finish.
+ * Whatever couldn't be sent or didn't finish in time is logged.
+ */
+void notification_dispatch_deinit(void)
+{
+	GList *batches, *l;
+	unsigned long failed = notification_stats.failed;
+	time_t deadline;
+
+	dispatching_stopped = TRUE;
+
+	if (notification_batches) {
+		batches = g_hash_table_get_values(notification_batches);
+		for (l = batches; l; l = l->next)
+			send_notification_batch(l->data);
+		g_list_free(batches);
+		g_hash_table_destroy(notification_batches);
+		notification_batches = NULL;
+	}
+
+	if (dispatch_queue.ev) {
+		destroy_event(dispatch_queue.ev);
+		dispatch_queue.ev = NULL;
+	}
+	drain_dispatch_queue();
+
+	/* the event loop is gone, so nothing else will send the workers' batches */
+	wproc_flush_batches();
+
+	deadline = time(NULL) + (notification_timeout < NOTIFICATION_SHUTDOWN_WAIT ? notification_timeout : NOTIFICATION_SHUTDOWN_WAIT);
+	while (notifications_running && nagios_iobs && time(NULL) < deadline) {
+		iobroker_poll(nagios_iobs, 100);
+		wproc_flush_batches();
+	}
+
+	if (notification_stats.failed > failed)
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: %lu notifications could not be sent to a worker before shutting down\n",
+		       notification_stats.failed - failed);
+	if (notifications_running)
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: %u notification commands were still running when shutting down, and may not have completed\n",
+		       notifications_running);
+}
+
 
 /******************************************************************/
 /***************** SERVICE NOTIFICATION FUNCTIONS *****************/
@@ -479,6 +946,13 @@ int service_notification(service *svc, int type, char *not_author, char *not_dat
 		/* set the notification id macro */
 		nm_asprintf(&mac.x[MACRO_SERVICENOTIFICATIONID], "%lu", svc->current_notification_id);
 
+		/* this notification on its own, unless it gets coalesced with others */
+		mac.x[MACRO_NOTIFICATIONCOUNT] = nm_strdup("1");
+		nm_asprintf(&mac.x[MACRO_NOTIFICATIONLIST], "%s;%s;%s;%s;%s",
+		            mac.x[MACRO_NOTIFICATIONTYPE], svc->host_name, svc->description,
+		            service_state_name(svc->current_state),
+		            svc->plugin_output ? svc->plugin_output : "");
+
 		/* notify each contact (duplicates have been removed) */
 		for (temp_notification = notification_list; temp_notification != NULL; temp_notification = temp_notification->next) {
 
@@ -508,8 +982,10 @@ int service_notification(service *svc, int type, char *not_author, char *not_dat
 		nm_free(mac.x[MACRO_SERVICEACKAUTHORALIAS]);
 		nm_free(mac.x[MACRO_SERVICEACKAUTHOR]);
 		nm_free(mac.x[MACRO_SERVICEACKCOMMENT]);
+		nm_free(mac.x[MACRO_NOTIFICATIONCOUNT]);
+		nm_free(mac.x[MACRO_NOTIFICATIONLIST]);
 
-		/* this gets set in add_notification() */
+		/* this gets set while building the notification list */
 		nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
 
 		/*
@@ -975,26 +1451,27 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 		else if (NEBERROR_CALLBACKOVERRIDE == neb_result)
 			continue ;
 
-		get_raw_command_line_r(mac, temp_commandsmember->command_ptr, temp_commandsmember->command, &raw_command, macro_options);
-		if (raw_command == NULL)
-			continue;
+		/* coalesced notifications get their command line from their batch */
+		if (!notification_coalesce_window) {
+			get_raw_command_line_r(mac, temp_commandsmember->command_ptr, temp_commandsmember->command, &raw_command, macro_options);
+			if (raw_command == NULL)
+				continue;
 
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Raw notification command: %s\n", raw_command);
+			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Raw notification command: %s\n", raw_command);
 
-		/* process any macros contained in the argument */
-		process_macros_r(mac, raw_command, &processed_command, macro_options);
-		nm_free(raw_command);
-		if (processed_command == NULL)
-			continue;
+			/* process any macros contained in the argument */
+			process_macros_r(mac, raw_command, &processed_command, macro_options);
+			nm_free(raw_command);
+			if (processed_command == NULL)
+				continue;
+
+			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Processed notification command: %s\n", processed_command);
+		}
 
 		/* get the command name */
 		command_name = nm_strdup(temp_commandsmember->command);
 		command_name_ptr = strtok(command_name, "!");
 
-		/* run the notification command... */
-
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Processed notification command: %s\n", processed_command);
-
 		/* log the notification to program log file */
 		if (log_notifications == TRUE) {
 			if (type != NOTIFICATION_NORMAL) {
@@ -1009,18 +1486,19 @@ int notify_contact_of_service(nagios_macros *mac, contact *cntct, service *svc,
 			nm_free(processed_buffer);
 		}
 
-		/* run the notification command */
-		nj = nm_calloc(1, sizeof(struct notification_job));
-		nj->ctc = cntct;
-		nj->hst = svc->host_ptr;
-		nj->svc = svc;
-		if (ERROR == wproc_run_callback(processed_command, notification_timeout, notification_handle_job_result, nj, mac)) {
-			nm_log(NSLOG_RUNTIME_ERROR, "wproc: Unable to send notification for service '%s on host '%s' to worker\n", svc->description, svc->host_ptr->name);
-			free(nj);
+		/* run the notification command, or add it to the contact's batch */
+		if (notification_coalesce_window) {
+			coalesce_notification(mac, cntct, temp_commandsmember, svc->host_ptr, svc);
+		} else {
+			nj = nm_calloc(1, sizeof(struct notification_job));
+			nj->ctc = cntct;
+			nj->hst = svc->host_ptr;
+			nj->svc = svc;
+			dispatch_notification(processed_command, nj);
+			processed_command = NULL;
 		}
 
 		nm_free(command_name);
-		nm_free(processed_command);
 
 		/* get end time */
 		gettimeofday(&method_end_time, NULL);
@@ -1108,13 +1586,31 @@ int should_service_notification_be_escalated(service *svc)
 }
 
 
+/* adds a contact to the notification list, unless it's been considered already or can't be notified */
+static void consider_service_contact(struct notification_round *round, contact *cntct, service *svc, int type, int options)
+{
+	if (cntct == NULL)
+		return;
+
+	if (cntct->id < num_objects.contacts) {
+		if (bitmap_isset(round->seen, cntct->id))
+			return;
+		bitmap_set(round->seen, cntct->id);
+	}
+
+	/* check now if the contact can be notified */
+	if (check_contact_service_notification_viability(cntct, svc, type, options) == OK)
+		add_notification(round, cntct);
+	else
+		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", cntct->name);
+}
+
 /* given a service, create a list of contacts to be notified, removing duplicates, checking contact notification viability */
 static notification *create_notification_list_from_service(nagios_macros *mac, service *svc, int options, int *escalated, int type)
 {
-	notification *notification_list = NULL;
+	struct notification_round round;
 	serviceescalation *temp_se = NULL;
 	contactsmember *temp_contactsmember = NULL;
-	contact *temp_contact = NULL;
 	contactgroupsmember *temp_contactgroupsmember = NULL;
 	contactgroup *temp_contactgroup = NULL;
 	int escalate_notification = FALSE;
@@ -1128,6 +1624,8 @@ static notification *create_notification_list_from_service(nagios_macros *mac, s
 	/* set the escalation macro */
 	mac->x[MACRO_NOTIFICATIONISESCALATED] = nm_strdup(escalate_notification ? "1" : "0");
 
+	notification_round_init(&round);
+
 	if (options & NOTIFICATION_OPTION_BROADCAST)
 		log_debug_info(DEBUGL_NOTIFICATIONS, 1, "This notification will be BROADCAST to all (escalated and normal) contacts...\n");
 
@@ -1149,13 +1647,7 @@ static notification *create_notification_list_from_service(nagios_macros *mac, s
 
 			/* add all individual contacts for this escalation entry */
 			for (temp_contactsmember = temp_se->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
-				/* check now if the contact can be notified */
-				if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
-					add_notification(&notification_list, mac, temp_contact);
-				else
-					log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+				consider_service_contact(&round, temp_contactsmember->contact_ptr, svc, type, options);
 			}
 
 			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact groups from service escalation(s) to notification list.\n");
@@ -1166,13 +1658,7 @@ static notification *create_notification_list_from_service(nagios_macros *mac, s
 				if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
 					continue;
 				for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-					if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-						continue;
-					/* check now if the contact can be notified */
-					if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
-						add_notification(&notification_list, mac, temp_contact);
-					else
-						log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+					consider_service_contact(&round, temp_contactsmember->contact_ptr, svc, type, options);
 				}
 			}
 		}
@@ -1185,13 +1671,7 @@ static notification *create_notification_list_from_service(nagios_macros *mac, s
 
 		/* add all individual contacts for this service */
 		for (temp_contactsmember = svc->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-			if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-				continue;
-			/* check now if the contact can be notified */
-			if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
-				add_notification(&notification_list, mac, temp_contact);
-			else
-				log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+			consider_service_contact(&round, temp_contactsmember->contact_ptr, svc, type, options);
 		}
 
 		/* add all contacts that belong to contactgroups for this service */
@@ -1200,18 +1680,13 @@ static notification *create_notification_list_from_service(nagios_macros *mac, s
 			if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
 				continue;
 			for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
-				/* check now if the contact can be notified */
-				if (check_contact_service_notification_viability(temp_contact, svc, type, options) == OK)
-					add_notification(&notification_list, mac, temp_contact);
-				else
-					log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+				consider_service_contact(&round, temp_contactsmember->contact_ptr, svc, type, options);
 			}
 		}
 	}
 
-	return notification_list;
+	notification_round_finish(&round, mac);
+	return round.list;
 }
 
 
@@ -1361,6 +1836,13 @@ int host_notification(host *hst, int type, char *not_author, char *not_data, int
 		/* set the notification id macro */
 		nm_asprintf(&mac.x[MACRO_HOSTNOTIFICATIONID], "%lu", hst->current_notification_id);
 
+		/* this notification on its own, unless it gets coalesced with others */
+		mac.x[MACRO_NOTIFICATIONCOUNT] = nm_strdup("1");
+		nm_asprintf(&mac.x[MACRO_NOTIFICATIONLIST], "%s;%s;%s;%s",
+		            mac.x[MACRO_NOTIFICATIONTYPE], hst->name,
+		            host_state_name(hst->current_state),
+		            hst->plugin_output ? hst->plugin_output : "");
+
 		/* notify each contact (duplicates have been removed) */
 		for (temp_notification = notification_list; temp_notification != NULL; temp_notification = temp_notification->next) {
 
@@ -1393,7 +1875,9 @@ int host_notification(host *hst, int type, char *not_author, char *not_data, int
 		nm_free(mac.x[MACRO_HOSTACKAUTHORALIAS]);
 		nm_free(mac.x[MACRO_HOSTACKAUTHOR]);
 		nm_free(mac.x[MACRO_HOSTACKCOMMENT]);
-		/* this gets set in add_notification() */
+		nm_free(mac.x[MACRO_NOTIFICATIONCOUNT]);
+		nm_free(mac.x[MACRO_NOTIFICATIONLIST]);
+		/* this gets set while building the notification list */
 		nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
 
 		/*
@@ -1820,26 +2304,27 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 		else if (NEBERROR_CALLBACKOVERRIDE == neb_result)
 			continue ;
 
-		get_raw_command_line_r(mac, temp_commandsmember->command_ptr, temp_commandsmember->command, &raw_command, macro_options);
-		if (raw_command == NULL)
-			continue;
+		/* coalesced notifications get their command line from their batch */
+		if (!notification_coalesce_window) {
+			get_raw_command_line_r(mac, temp_commandsmember->command_ptr, temp_commandsmember->command, &raw_command, macro_options);
+			if (raw_command == NULL)
+				continue;
 
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Raw notification command: %s\n", raw_command);
+			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Raw notification command: %s\n", raw_command);
 
-		/* process any macros contained in the argument */
-		process_macros_r(mac, raw_command, &processed_command, macro_options);
-		nm_free(raw_command);
-		if (processed_command == NULL)
-			continue;
+			/* process any macros contained in the argument */
+			process_macros_r(mac, raw_command, &processed_command, macro_options);
+			nm_free(raw_command);
+			if (processed_command == NULL)
+				continue;
+
+			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Processed notification command: %s\n", processed_command);
+		}
 
 		/* get the command name */
 		command_name = nm_strdup(temp_commandsmember->command);
 		command_name_ptr = strtok(command_name, "!");
 
-		/* run the notification command... */
-
-		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Processed notification command: %s\n", processed_command);
-
 		/* log the notification to program log file */
 		if (log_notifications == TRUE) {
 			if (type != NOTIFICATION_NORMAL) {
@@ -1854,20 +2339,21 @@ int notify_contact_of_host(nagios_macros *mac, contact *cntct, host *hst, int ty
 			nm_free(processed_buffer);
 		}
 
-		/* run the notification command */
-		nj = nm_calloc(1, sizeof(struct notification_job));
-		nj->ctc = cntct;
-		nj->hst = hst;
-		nj->svc = NULL;
-		if (ERROR == wproc_run_callback(processed_command, notification_timeout, notification_handle_job_result, nj, mac)) {
-			nm_log(NSLOG_RUNTIME_ERROR, "wproc: Unable to send notification for host '%s' to worker\n", hst->name);
-			free(nj);
+		/* run the notification command, or add it to the contact's batch */
+		if (notification_coalesce_window) {
+			coalesce_notification(mac, cntct, temp_commandsmember, hst, NULL);
+		} else {
+			nj = nm_calloc(1, sizeof(struct notification_job));
+			nj->ctc = cntct;
+			nj->hst = hst;
+			nj->svc = NULL;
+			dispatch_notification(processed_command, nj);
+			processed_command = NULL;
 		}
 
 		/* @todo Handle nebmod stuff when getting results from workers */
 
 		nm_free(command_name);
-		nm_free(processed_command);
 
 		/* get end time */
 		gettimeofday(&method_end_time, NULL);
@@ -1955,13 +2441,31 @@ int should_host_notification_be_escalated(host *hst)
 }
 
 
+/* adds a contact to the notification list, unless it's been considered already or can't be notified */
+static void consider_host_contact(struct notification_round *round, contact *cntct, host *hst, int type, int options)
+{
+	if (cntct == NULL)
+		return;
+
+	if (cntct->id < num_objects.contacts) {
+		if (bitmap_isset(round->seen, cntct->id))
+			return;
+		bitmap_set(round->seen, cntct->id);
+	}
+
+	/* check now if the contact can be notified */
+	if (check_contact_host_notification_viability(cntct, hst, type, options) == OK)
+		add_notification(round, cntct);
+	else
+		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", cntct->name);
+}
+
 /* given a host, create a list of contacts to be notified, removing duplicates, checking contact notification viability */
 static notification *create_notification_list_from_host(nagios_macros *mac, host *hst, int options, int *escalated, int type)
 {
-	notification *notification_list = NULL;
+	struct notification_round round;
 	hostescalation *temp_he = NULL;
 	contactsmember *temp_contactsmember = NULL;
-	contact *temp_contact = NULL;
 	contactgroupsmember *temp_contactgroupsmember = NULL;
 	contactgroup *temp_contactgroup = NULL;
 	int escalate_notification = FALSE;
@@ -1975,6 +2479,8 @@ static notification *create_notification_list_from_host(nagios_macros *mac, host
 	/* set the escalation macro */
 	mac->x[MACRO_NOTIFICATIONISESCALATED] = nm_strdup(escalate_notification ? "1" : "0");
 
+	notification_round_init(&round);
+
 	if (options & NOTIFICATION_OPTION_BROADCAST)
 		log_debug_info(DEBUGL_NOTIFICATIONS, 1, "This notification will be BROADCAST to all (escalated and normal) contacts...\n");
 
@@ -1996,13 +2502,7 @@ static notification *create_notification_list_from_host(nagios_macros *mac, host
 
 			/* add all individual contacts for this escalation */
 			for (temp_contactsmember = temp_he->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
-				/* check now if the contact can be notified */
-				if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
-					add_notification(&notification_list, mac, temp_contact);
-				else
-					log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+				consider_host_contact(&round, temp_contactsmember->contact_ptr, hst, type, options);
 			}
 
 			log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact groups from host escalation(s) to notification list.\n");
@@ -2013,13 +2513,7 @@ static notification *create_notification_list_from_host(nagios_macros *mac, host
 				if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
 					continue;
 				for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-					if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-						continue;
-					/* check now if the contact can be notified */
-					if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
-						add_notification(&notification_list, mac, temp_contact);
-					else
-						log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+					consider_host_contact(&round, temp_contactsmember->contact_ptr, hst, type, options);
 				}
 			}
 		}
@@ -2034,13 +2528,7 @@ static notification *create_notification_list_from_host(nagios_macros *mac, host
 
 		/* add all individual contacts for this host */
 		for (temp_contactsmember = hst->contacts; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-			if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-				continue;
-			/* check now if the contact can be notified */
-			if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
-				add_notification(&notification_list, mac, temp_contact);
-			else
-				log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+			consider_host_contact(&round, temp_contactsmember->contact_ptr, hst, type, options);
 		}
 
 		log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding members of contact groups for host to notification list.\n");
@@ -2052,18 +2540,13 @@ static notification *create_notification_list_from_host(nagios_macros *mac, host
 			if ((temp_contactgroup = temp_contactgroupsmember->group_ptr) == NULL)
 				continue;
 			for (temp_contactsmember = temp_contactgroup->members; temp_contactsmember != NULL; temp_contactsmember = temp_contactsmember->next) {
-				if ((temp_contact = temp_contactsmember->contact_ptr) == NULL)
-					continue;
-				/* check now if the contact can be notified */
-				if (check_contact_host_notification_viability(temp_contact, hst, type, options) == OK)
-					add_notification(&notification_list, mac, temp_contact);
-				else
-					log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Not adding contact '%s'\n", temp_contact->name);
+				consider_host_contact(&round, temp_contactsmember->contact_ptr, hst, type, options);
 			}
 		}
 	}
 
-	return notification_list;
+	notification_round_finish(&round, mac);
+	return round.list;
 }
 
 
@@ -2207,19 +2690,39 @@ static notification *find_notification(notification *notification_list, contact
 }
 
 
+static void notification_round_init(struct notification_round *round)
+{
+	round->list = NULL;
+	round->seen = bitmap_create(num_objects.contacts);
+	round->recipients = g_string_new(NULL);
+}
+
+/* hands over $NOTIFICATIONRECIPIENTS$ and releases everything else */
+static void notification_round_finish(struct notification_round *round, nagios_macros *mac)
+{
+	if (round->recipients->len)
+		mac->x[MACRO_NOTIFICATIONRECIPIENTS] = nm_strdup(round->recipients->str);
+	g_string_free(round->recipients, TRUE);
+	round->recipients = NULL;
+	bitmap_destroy(round->seen);
+	round->seen = NULL;
+}
+
 /* add a new notification to the list in memory */
-int add_notification(notification **notification_list, nagios_macros *mac, contact *cntct)
+static int add_notification(struct notification_round *round, contact *cntct)
 {
 	notification *new_notification = NULL;
-	notification *temp_notification = NULL;
 
 	if (cntct == NULL)
 		return ERROR;
 
 	log_debug_info(DEBUGL_NOTIFICATIONS, 2, "Adding contact '%s' to notification list.\n", cntct->name);
 
-	/* don't add anything if this contact is already on the notification list */
-	if ((temp_notification = find_notification(*notification_list, cntct)) != NULL)
+	/*
+	 * don't add anything if this contact is already on the notification
+	 * list. The bitmap takes care of that for all registered contacts.
+	 */
+	if (cntct->id >= num_objects.contacts && find_notification(round->list, cntct) != NULL)
 		return OK;
 
 	/* allocate memory for a new contact in the notification list */
@@ -2229,17 +2732,13 @@ int add_notification(notification **notification_list, nagios_macros *mac, conta
 	new_notification->contact = cntct;
 
 	/* add new notification to head of list */
-	new_notification->next = *notification_list;
-	*notification_list = new_notification;
+	new_notification->next = round->list;
+	round->list = new_notification;
 
 	/* add contact to notification recipients macro */
-	if (mac->x[MACRO_NOTIFICATIONRECIPIENTS] == NULL)
-		mac->x[MACRO_NOTIFICATIONRECIPIENTS] = nm_strdup(cntct->name);
-	else {
-		mac->x[MACRO_NOTIFICATIONRECIPIENTS] = nm_realloc(mac->x[MACRO_NOTIFICATIONRECIPIENTS], strlen(mac->x[MACRO_NOTIFICATIONRECIPIENTS]) + strlen(cntct->name) + 2);
-		strcat(mac->x[MACRO_NOTIFICATIONRECIPIENTS], ",");
-		strcat(mac->x[MACRO_NOTIFICATIONRECIPIENTS], cntct->name);
-	}
+	if (round->recipients->len)
+		g_string_append_c(round->recipients, ',');
+	g_string_append(round->recipients, cntct->name);
 
 	return OK;
 }
@@ -98,6 +98,8 @@ int check_contact_host_notification_viability(contact *, host *, int, int);	/* c
 int notify_contact_of_host(nagios_macros *mac, contact *, host *, int, char *, char *, int, int);        	/* notify a single contact about a host */
 time_t get_next_host_notification_time(host *, time_t);				/* calculates next acceptable re-notification time for a host */
 time_t get_next_service_notification_time(service *, time_t);			/* calculates next acceptable re-notification time for a service */
+int notification_dispatch_init(void);						/* registers the notifications query handler */
+void notification_dispatch_deinit(void);					/* sends coalesced and queued notifications right away */
 
 NAGIOS_END_DECL
 
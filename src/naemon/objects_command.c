@@ -1,6 +1,7 @@
 #include "objects_command.h"
 #include "nm_alloc.h"
 #include "logging.h"
+#include "macros.h"
 #include <string.h>
 #include <glib.h>
 
@@ -85,6 +86,7 @@ void destroy_command(command *this_command)
 		return;
 	nm_free(this_command->name);
 	nm_free(this_command->command_line);
+	free_compiled_macros(this_command->compiled_command_line);
 	nm_free(this_command);
 }
 
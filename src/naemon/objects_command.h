@@ -16,6 +16,7 @@ struct command;
 typedef struct command command;
 struct commandsmember;
 typedef struct commandsmember commandsmember;
+struct macro_program;
 
 extern struct command *command_list;
 extern struct command **command_ary;
@@ -25,6 +26,7 @@ struct command {
 	char    *name;
 	char    *command_line;
 	struct command *next;
+	struct macro_program *compiled_command_line; /* compiled on first use */
 };
 
 struct commandsmember {
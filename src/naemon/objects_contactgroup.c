@@ -30,7 +30,7 @@ void destroy_objects_contactgroup()
 
 	contactgroup_hash_table = NULL;
 	nm_free(contactgroup_ary);
-	num_objects.contacts = 0;
+	num_objects.contactgroups = 0;
 }
 
 contactgroup *create_contactgroup(const char *name, const char *alias)
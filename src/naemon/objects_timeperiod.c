@@ -11,6 +11,7 @@ static time_t calculate_time_from_weekday_of_month(int, int, int, int);	/* calcu
 static time_t calculate_time_from_day_of_month(int, int, int);	/* calculates midnight time of specific (1st, last, etc.) day of a particular month */
 
 static GHashTable *timeperiod_hash_table = NULL;
+static unsigned int timeperiod_cache_generation = 1;
 timeperiod **timeperiod_ary = NULL;
 timeperiod *timeperiod_list = NULL;
 
@@ -148,6 +149,7 @@ timeperiodexclusion *add_exclusion_to_timeperiod(timeperiod *period, char *name)
 
 	new_timeperiodexclusion->next = period->exclusions;
 	period->exclusions = new_timeperiodexclusion;
+	invalidate_timeperiod_cache();
 
 	return new_timeperiodexclusion;
 }
@@ -179,6 +181,7 @@ timerange *add_timerange_to_timeperiod(timeperiod *period, int day, unsigned lon
 	new_timerange = nm_malloc(sizeof(timerange));
 	new_timerange->range_start = start_time;
 	new_timerange->range_end = end_time;
+	invalidate_timeperiod_cache();
 
 	/* insertion-sort the new time range into the list for this day */
 	if (!period->days[day] || period->days[day]->range_start > new_timerange->range_start) {
@@ -235,6 +238,7 @@ daterange *add_exception_to_timeperiod(timeperiod *period, int type, int syear,
 	/* add the new date range to the head of the range list for this exception type */
 	new_daterange->next = period->exceptions[type];
 	period->exceptions[type] = new_daterange;
+	invalidate_timeperiod_cache();
 
 	return new_daterange;
 }
@@ -266,6 +270,7 @@ timerange *add_timerange_to_daterange(daterange *drange, unsigned long start_tim
 	/* add the new time range to the head of the range list for this date range */
 	new_timerange->next = drange->times;
 	drange->times = new_timerange;
+	invalidate_timeperiod_cache();
 
 	return new_timerange;
 }
@@ -627,18 +632,6 @@ static timerange *_get_matching_timerange(time_t test_time, const timeperiod *tp
 	return tperiod->days[test_time_wday];
 }
 
-static int is_time_excluded(time_t when, const struct timeperiod *tp)
-{
-	struct timeperiodexclusion *exc;
-
-	for (exc = tp->exclusions; exc; exc = exc->next) {
-		if (check_time_against_period(when, exc->timeperiod_ptr) == OK) {
-			return 1;
-		}
-	}
-	return 0;
-}
-
 static inline time_t get_midnight(time_t when)
 {
 	struct tm *t, tm_s;
@@ -655,26 +648,115 @@ static inline int timerange_includes_time(struct timerange *range, time_t when)
 	return (when >= (time_t)range->range_start && when < (time_t)range->range_end);
 }
 
-/* see if the specified time falls into a valid time range in the given time period */
-int check_time_against_period(time_t test_time, const timeperiod *tperiod)
+/* the midnight that starts the day after the one given */
+static time_t get_next_midnight(time_t midnight)
 {
-	timerange *temp_timerange = NULL;
-	time_t midnight = (time_t)0L;
+	struct tm *t, tm_s;
+
+	t = localtime_r(&midnight, &tm_s);
+	t->tm_sec = 0;
+	t->tm_min = 0;
+	t->tm_hour = 0;
+	t->tm_mday++;
+	t->tm_isdst = -1;
+	return mktime(t);
+}
+
+static int is_dst_time_r(time_t when)
+{
+	struct tm tm_s;
+
+	return localtime_r(&when, &tm_s)->tm_isdst;
+}
+
+/*
+ * Works out whether test_time is in the period, and for how long that
+ * answer stays the same. Within a day, that only changes at the edges
+ * of the day's time ranges and whenever an excluded period changes,
+ * but get_midnight() follows the DST flag of the time it's given, so
+ * a DST change starts a new window as well.
+ */
+static void refresh_validity_cache(time_t test_time, timeperiod *tperiod)
+{
+	timeperiodexclusion *exc;
+	timerange *tr;
+	time_t midnight, end;
+	int state = ERROR, excluded = 0;
 
 	midnight = get_midnight(test_time);
+	end = get_next_midnight(midnight);
+	if (end <= test_time) /* can't happen, but let's not loop */
+		end = test_time + 1;
+
+	for (exc = tperiod->exclusions; exc; exc = exc->next) {
+		if (!exc->timeperiod_ptr) {
+			excluded = 1;
+			continue;
+		}
+		if (check_time_against_period(test_time, exc->timeperiod_ptr) == OK)
+			excluded = 1;
+		if (exc->timeperiod_ptr->cache_end < end)
+			end = exc->timeperiod_ptr->cache_end;
+	}
+
+	for (tr = _get_matching_timerange(test_time, tperiod); tr; tr = tr->next) {
+		time_t range_start = midnight + tr->range_start, range_end = midnight + tr->range_end;
+
+		if (timerange_includes_time(tr, test_time - midnight))
+			state = OK;
+		if (range_start > test_time && range_start < end)
+			end = range_start;
+		if (range_end > test_time && range_end < end)
+			end = range_end;
+	}
+	if (excluded)
+		state = ERROR;
+
+	if (is_dst_time_r(end - 1) != is_dst_time_r(test_time)) {
+		/* find the first second on the other side of the change */
+		time_t lo = test_time, hi = end - 1;
+		int dst = is_dst_time_r(test_time);
+
+		while (hi - lo > 1) {
+			time_t mid = lo + (hi - lo) / 2;
+			if (is_dst_time_r(mid) == dst)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		end = hi;
+	}
+
+	tperiod->cache_start = test_time;
+	tperiod->cache_end = end;
+	tperiod->cache_state = state;
+	tperiod->cache_generation = timeperiod_cache_generation;
+}
+
+void invalidate_timeperiod_cache(void)
+{
+	timeperiod_cache_generation++;
+}
+
+/*
+ * see if the specified time falls into a valid time range in the given
+ * time period. The answer is cached until the period's next transition,
+ * so this is usually just a comparison.
+ */
+int check_time_against_period(time_t test_time, const timeperiod *tperiod)
+{
+	/* the cache isn't part of what the caller considers constant */
+	timeperiod *tp = (timeperiod *)tperiod;
 
 	/* if no period was specified, assume the time is good */
 	if (tperiod == NULL)
 		return OK;
 
-	if (is_time_excluded(test_time, tperiod))
-		return ERROR;
+	if (tp->cache_generation != timeperiod_cache_generation
+	    || test_time < tp->cache_start || test_time >= tp->cache_end)
+		refresh_validity_cache(test_time, tp);
 
-	for (temp_timerange = _get_matching_timerange(test_time, tperiod); temp_timerange != NULL; temp_timerange = temp_timerange->next) {
-		if (timerange_includes_time(temp_timerange, test_time - midnight))
-			return OK;
-	}
-	return ERROR;
+	return tp->cache_state;
 }
 
 
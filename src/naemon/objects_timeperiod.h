@@ -39,6 +39,10 @@ struct timeperiod {
 	struct daterange *exceptions[DATERANGE_TYPES];
 	struct timeperiodexclusion *exclusions;
 	struct timeperiod *next;
+	/* check_time_against_period() gives cache_state for [cache_start, cache_end) */
+	time_t cache_start, cache_end;
+	int cache_state;
+	unsigned int cache_generation;
 };
 
 struct timerange {
@@ -88,6 +92,7 @@ struct timeperiod *find_timeperiod(const char *);
 void fcache_timeperiod(FILE *fp, const struct timeperiod *temp_timeperiod);
 
 int check_time_against_period(time_t, const timeperiod *);	/* check to see if a specific time is covered by a time period */
+void invalidate_timeperiod_cache(void);	/* forget cached validity, fe. after the timezone changes */
 void get_next_valid_time(time_t, time_t *, timeperiod *);	/* get the next valid time in a time period */
 
 NAGIOS_END_DECL
@@ -5,6 +5,8 @@
 #include "events.h"
 #include "utils.h"
 #include "logging.h"
+#include "statusdata.h"
+#include "sretention.h"
 #include "globals.h"
 #include "commands.h"
 #include "nm_alloc.h"
@@ -324,6 +326,64 @@ static int qh_help(int sd, char *buf, unsigned int len)
 	return 0;
 }
 
+static int qh_core(int sd, char *buf, unsigned int len)
+{
+	if (!*buf || !strcmp(buf, "help")) {
+		nsock_printf_nul(sd, "Query handler for naemon core internals.\n"
+		                 "Available commands:\n"
+		                 "  events      Show timed event pool statistics\n"
+		                 "  logging     Show asynchronous log writer statistics\n"
+		                 "  status      Show status data dump statistics\n"
+		                 "  retention   Show retention data save statistics\n"
+		                );
+		return 0;
+	}
+
+	if (!strcmp(buf, "events")) {
+		struct timed_event_pool_stats st;
+
+		get_timed_event_pool_stats(&st);
+		nsock_printf_nul(sd, "in_use=%lu;high_water=%lu;capacity=%lu;slabs=%lu;allocations=%llu\n",
+		                 (unsigned long)st.in_use, (unsigned long)st.high_water,
+		                 (unsigned long)st.capacity, (unsigned long)st.slabs,
+		                 st.allocations);
+		return 0;
+	}
+
+	if (!strcmp(buf, "logging")) {
+		struct log_writer_stats st;
+
+		get_log_writer_stats(&st);
+		nsock_printf_nul(sd, "active=%d;queued=%lu;dropped=%lu;flushed=%lu;buffered=%lu;buffer_size=%lu\n",
+		                 st.active, st.queued, st.dropped, st.flushed, st.buffered, st.buffer_size);
+		return 0;
+	}
+
+	if (!strcmp(buf, "status")) {
+		struct bg_writer_stats st;
+
+		get_status_dump_stats(&st);
+		nsock_printf_nul(sd, "background=%d;in_progress=%d;dumps=%lu;skipped=%lu;failed=%lu;"
+		                 "last_stall_usec=%lu;max_stall_usec=%lu;last_duration_usec=%lu;max_duration_usec=%lu\n",
+		                 background_status_updates, st.in_progress, st.writes, st.skipped, st.failed,
+		                 st.last_stall, st.max_stall, st.last_duration, st.max_duration);
+		return 0;
+	}
+
+	if (!strcmp(buf, "retention")) {
+		struct bg_writer_stats st;
+
+		get_retention_save_stats(&st);
+		nsock_printf_nul(sd, "background=%d;fsync=%d;in_progress=%d;saves=%lu;skipped=%lu;failed=%lu;"
+		                 "last_stall_usec=%lu;max_stall_usec=%lu;last_duration_usec=%lu;max_duration_usec=%lu\n",
+		                 background_retention_saves, retention_fsync, st.in_progress, st.writes, st.skipped, st.failed,
+		                 st.last_stall, st.max_stall, st.last_duration, st.max_duration);
+		return 0;
+	}
+
+	return 404;
+}
+
 static int qh_command(int sd, char *buf, unsigned int len)
 {
 	char *space;
@@ -403,6 +463,7 @@ int qh_init(const char *path)
 
 	/* now register our the in-core handlers */
 	qh_register_handler("command", "Naemon external commands interface", 0, qh_command);
+	qh_register_handler("core", "Naemon core internals and statistics", 0, qh_core);
 	qh_register_handler("echo", "The Echo Service - What You Put Is What You Get", 0, qh_echo);
 	qh_register_handler("help", "Help for the query handler", 0, qh_help);
 
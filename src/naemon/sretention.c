@@ -8,6 +8,7 @@
 #include "logging.h"
 #include "nm_alloc.h"
 #include "events.h"
+#include "bgwriter.h"
 #include <string.h>
 
 /* hosts and services before attribute modifications */
@@ -15,6 +16,38 @@ static struct host **premod_hosts;
 static struct service **premod_services;
 static struct contact **premod_contacts;
 
+/*
+ * With background_retention_saves, auto-saves are done by a background
+ * writer (see bgwriter.h). The NEB start callback runs in the parent
+ * before the fork, so the snapshot includes whatever modules did on
+ * start, and the end callback once the file has been written. Other
+ * saves wait for a running writer first, so an older snapshot can
+ * never replace a newer file.
+ */
+static void retention_writer_prepare(void)
+{
+	broker_retention_data(NEBTYPE_RETENTIONDATA_STARTSAVE, NEBFLAG_NONE, NEBATTR_NONE);
+}
+
+static void retention_writer_done(int result)
+{
+	if (result == OK) {
+		broker_retention_data(NEBTYPE_RETENTIONDATA_ENDSAVE, NEBFLAG_NONE, NEBATTR_NONE);
+		nm_log(NSLOG_PROCESS_INFO,
+		       "Auto-save of retention data completed successfully.\n");
+	} else {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Background auto-save of retention data failed\n");
+	}
+}
+
+static struct bg_writer retention_writer = BG_WRITER_INIT("retention data", DEBUGL_RETENTIONDATA,
+        retention_writer_prepare, xrddefault_save_state_information, retention_writer_done);
+
+void get_retention_save_stats(struct bg_writer_stats *stats)
+{
+	*stats = retention_writer.stats;
+}
+
 /******************************************************************/
 /************* TOP-LEVEL STATE INFORMATION FUNCTIONS **************/
 /******************************************************************/
@@ -26,6 +59,11 @@ void save_state_information_eventhandler(struct nm_event_execution_properties *e
 	if (evprop->execution_type == EVENT_EXEC_NORMAL) {
 		schedule_event(retention_update_interval * interval_length, save_state_information_eventhandler, evprop->user_data);
 
+		/* a save that has taken ten intervals is stuck */
+		if (background_retention_saves == TRUE && retain_state_information == TRUE &&
+		    bg_writer_start(&retention_writer, retention_update_interval * interval_length * 10) == OK)
+			return;
+
 		status = save_state_information(TRUE);
 
 		if (status == OK) {
@@ -55,6 +93,8 @@ int cleanup_retention_data(void)
 {
 	unsigned int i;
 
+	bg_writer_wait(&retention_writer);
+
 	for (i = 0; i < num_objects.hosts; i++) {
 		nm_free(premod_hosts[i]);
 	}
@@ -75,17 +115,27 @@ int cleanup_retention_data(void)
 /* save all host and service state information */
 int save_state_information(int autosave)
 {
+	struct timespec start;
+	unsigned long elapsed;
 	int result = OK;
 
 	if (retain_state_information == FALSE)
 		return OK;
 
+	/* don't let a running writer replace what we write with older data */
+	bg_writer_wait(&retention_writer);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	broker_retention_data(NEBTYPE_RETENTIONDATA_STARTSAVE, NEBFLAG_NONE, NEBATTR_NONE);
 
 	result = xrddefault_save_state_information();
 
 	broker_retention_data(NEBTYPE_RETENTIONDATA_ENDSAVE, NEBFLAG_NONE, NEBATTR_NONE);
 
+	elapsed = bg_writer_record(&retention_writer, &start, result);
+	log_debug_info(DEBUGL_RETENTIONDATA, 1, "Saved retention data in %lu usec\n", elapsed);
+
 	if (result == ERROR)
 		return ERROR;
 
@@ -6,11 +6,14 @@
 #endif
 
 #include "common.h"
+#include "events.h"
+#include "bgwriter.h"
 NAGIOS_BEGIN_DECL
 
 int initialize_retention_data(void);
 int cleanup_retention_data(void);
 int save_state_information(int);                 /* saves all host and state information */
+void save_state_information_eventhandler(struct nm_event_execution_properties *evprop); /* the periodic auto-save */
 int read_initial_state_information(void);        /* reads in initial host and state information */
 int pre_modify_contact_attribute(struct contact *s, int attr);
 int pre_modify_service_attribute(struct service *s, int attr);
@@ -19,6 +22,12 @@ struct contact *get_premod_contact(unsigned int id);
 struct host *get_premod_host(unsigned int id);
 struct service *get_premod_service(unsigned int id);
 void deinit_retention_data(void);
+
+/**
+ * Gets statistics about retention data saves
+ * @param stats Where to store the statistics
+ */
+void get_retention_save_stats(struct bg_writer_stats *stats);
 NAGIOS_END_DECL
 
 #endif
@@ -2,9 +2,46 @@
 #include "common.h"
 #include "statusdata.h"
 #include "xsddefault.h"
+#include "xsdincremental.h"
 #include "broker.h"
 #include "globals.h"
 #include "events.h"
+#include "defaults.h"
+#include "logging.h"
+#include "utils.h"
+#include "bgwriter.h"
+
+
+/*
+ * With background_status_updates, the periodic status dump is done by
+ * a background writer (see bgwriter.h).
+ */
+int background_status_updates = DEFAULT_BACKGROUND_STATUS_UPDATES;
+
+static void status_writer_prepare(void)
+{
+	broker_aggregated_status_data(NEBTYPE_AGGREGATEDSTATUS_STARTDUMP, NEBFLAG_NONE, NEBATTR_NONE);
+
+	/* the child must not write to our mapping */
+	xsdincremental_save_status_data();
+
+	/* the child would update its own copy of these */
+	generate_check_stats();
+}
+
+/* like update_all_status_data(), the end of the dump is announced either way */
+static void status_writer_done(int result)
+{
+	broker_aggregated_status_data(NEBTYPE_AGGREGATEDSTATUS_ENDDUMP, NEBFLAG_NONE, NEBATTR_NONE);
+}
+
+static struct bg_writer status_writer = BG_WRITER_INIT("status data", DEBUGL_STATUSDATA,
+        status_writer_prepare, xsddefault_save_status_data, status_writer_done);
+
+void get_status_dump_stats(struct bg_writer_stats *stats)
+{
+	*stats = status_writer.stats;
+}
 
 
 /******************************************************************/
@@ -26,7 +63,9 @@ static void update_all_status_data_eventhandler(struct nm_event_execution_proper
 
 		if (!status_update_interval)
 			return;
-		update_all_status_data();
+		/* a dump that has taken ten intervals is stuck */
+		if (!background_status_updates || bg_writer_start(&status_writer, interval * 10) != OK)
+			update_all_status_data();
 	}
 }
 
@@ -46,6 +85,9 @@ int initialize_status_data(const char *cfgfile)
 	schedule_event(status_update_interval, update_all_status_data_eventhandler, NULL);
 	schedule_event(5, update_status_data_eventhandler, NULL);
 
+	if (xsdincremental_initialize_status_data() != OK)
+		return ERROR;
+
 	return xsddefault_initialize_status_data(cfgfile);
 }
 
@@ -53,13 +95,19 @@ int initialize_status_data(const char *cfgfile)
 /* update all status data (aggregated dump) */
 int update_all_status_data(void)
 {
+	struct timespec start;
 	int result = OK;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	broker_aggregated_status_data(NEBTYPE_AGGREGATEDSTATUS_STARTDUMP, NEBFLAG_NONE, NEBATTR_NONE);
 
+	xsdincremental_save_status_data();
 	result = xsddefault_save_status_data();
 
 	broker_aggregated_status_data(NEBTYPE_AGGREGATEDSTATUS_ENDDUMP, NEBFLAG_NONE, NEBATTR_NONE);
+
+	bg_writer_record(&status_writer, &start, result);
 	return result;
 }
 
@@ -67,6 +115,10 @@ int update_all_status_data(void)
 /* cleans up status data before program termination */
 int cleanup_status_data(int delete_status_data)
 {
+	/* don't let a writer that's still running recreate the file */
+	bg_writer_wait(&status_writer);
+
+	xsdincremental_cleanup_status_data(delete_status_data);
 	return xsddefault_cleanup_status_data(delete_status_data);
 }
 
@@ -85,6 +137,7 @@ int update_program_status(int aggregated_dump)
 /* updates host status info */
 int update_host_status(host *hst, int aggregated_dump)
 {
+	xsdincremental_mark_dirty(XSDI_HOST, hst->id);
 
 	if (aggregated_dump == FALSE)
 		broker_host_status(NEBTYPE_HOSTSTATUS_UPDATE, NEBFLAG_NONE, NEBATTR_NONE, hst);
@@ -96,6 +149,7 @@ int update_host_status(host *hst, int aggregated_dump)
 /* updates service status info */
 int update_service_status(service *svc, int aggregated_dump)
 {
+	xsdincremental_mark_dirty(XSDI_SERVICE, svc->id);
 
 	if (aggregated_dump == FALSE)
 		broker_service_status(NEBTYPE_SERVICESTATUS_UPDATE, NEBFLAG_NONE, NEBATTR_NONE, svc);
@@ -107,6 +161,7 @@ int update_service_status(service *svc, int aggregated_dump)
 /* updates contact status info */
 int update_contact_status(contact *cntct, int aggregated_dump)
 {
+	xsdincremental_mark_dirty(XSDI_CONTACT, cntct->id);
 
 	if (aggregated_dump == FALSE)
 		broker_contact_status(NEBTYPE_CONTACTSTATUS_UPDATE, NEBFLAG_NONE, NEBATTR_NONE, cntct);
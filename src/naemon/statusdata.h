@@ -9,6 +9,7 @@
 #include "objects_host.h"
 #include "objects_service.h"
 #include "objects_contact.h"
+#include "bgwriter.h"
 
 NAGIOS_BEGIN_DECL
 /* Convert the (historically ordered) host states into a notion of "urgency".
@@ -21,6 +22,8 @@ NAGIOS_BEGIN_DECL
 	  CPU-efficient as possible: */
 #define HOST_URGENCY(hs)		((hs)|(((hs)&0x5)<<1))
 
+extern int background_status_updates;
+
 int initialize_status_data(const char *);               /* initializes status data at program start */
 int update_all_status_data(void);                       /* updates all status data */
 int cleanup_status_data(int);                           /* cleans up status data at program termination */
@@ -29,5 +32,11 @@ int update_host_status(host *, int);                    /* updates host status d
 int update_service_status(service *, int);              /* updates service status data */
 int update_contact_status(contact *, int);              /* updates contact status data */
 
+/**
+ * Gets statistics about the periodic status data dumps
+ * @param stats Where to store the statistics
+ */
+void get_status_dump_stats(struct bg_writer_stats *stats);
+
 NAGIOS_END_DECL
 #endif
@@ -47,6 +47,11 @@ objectlist *objcfg_dirs = NULL;
 int upipe_fd[2];
 
 int num_check_workers = 0; /* auto-decide */
+int worker_dispatch_batching = DEFAULT_WORKER_DISPATCH_BATCHING;
+int worker_dispatch_policy = DEFAULT_WORKER_DISPATCH_POLICY;
+int worker_autoscale = DEFAULT_WORKER_AUTOSCALE;
+int worker_autoscale_min = DEFAULT_WORKER_AUTOSCALE_MIN;
+int worker_autoscale_max = DEFAULT_WORKER_AUTOSCALE_MAX;
 char *qh_socket_path = NULL; /* disabled */
 
 char *ocsp_command = NULL;
@@ -77,6 +82,8 @@ int service_check_timeout_state = STATE_CRITICAL;
 int host_check_timeout = DEFAULT_HOST_CHECK_TIMEOUT;
 int event_handler_timeout = DEFAULT_EVENT_HANDLER_TIMEOUT;
 int notification_timeout = DEFAULT_NOTIFICATION_TIMEOUT;
+int notification_coalesce_window = DEFAULT_NOTIFICATION_COALESCE_WINDOW;
+int notification_rate_limit = DEFAULT_NOTIFICATION_RATE_LIMIT;
 
 
 char *object_precache_file;
@@ -115,6 +122,9 @@ int use_retained_scheduling_info = FALSE;
 int retained_scheduling_randomize_window = DEFAULT_RETAINED_SCHEDULING_RANDOMIZE_WINDOW;
 int retention_scheduling_horizon = DEFAULT_RETENTION_SCHEDULING_HORIZON;
 char *retention_file = NULL;
+int binary_retention = DEFAULT_BINARY_RETENTION;
+int background_retention_saves = DEFAULT_BACKGROUND_RETENTION_SAVES;
+int retention_fsync = DEFAULT_RETENTION_FSYNC;
 
 unsigned long modified_process_attributes = MODATTR_NONE;
 unsigned long modified_host_process_attributes = MODATTR_NONE;
@@ -1076,6 +1086,9 @@ int reset_variables(void)
 	log_service_retries = DEFAULT_LOG_SERVICE_RETRIES;
 	log_host_retries = DEFAULT_LOG_HOST_RETRIES;
 	log_initial_states = DEFAULT_LOG_INITIAL_STATES;
+	use_async_logging = DEFAULT_USE_ASYNC_LOGGING;
+	log_flush_interval = DEFAULT_LOG_FLUSH_INTERVAL;
+	log_buffer_size = DEFAULT_LOG_BUFFER_SIZE;
 
 	enable_notification_suppression_reason_logging = DEFAULT_NSR_LOGGING;
 	log_notifications = DEFAULT_NOTIFICATION_LOGGING;
@@ -1091,6 +1104,8 @@ int reset_variables(void)
 	host_check_timeout = DEFAULT_HOST_CHECK_TIMEOUT;
 	event_handler_timeout = DEFAULT_EVENT_HANDLER_TIMEOUT;
 	notification_timeout = DEFAULT_NOTIFICATION_TIMEOUT;
+	notification_coalesce_window = DEFAULT_NOTIFICATION_COALESCE_WINDOW;
+	notification_rate_limit = DEFAULT_NOTIFICATION_RATE_LIMIT;
 	ocsp_timeout = DEFAULT_OCSP_TIMEOUT;
 	ochp_timeout = DEFAULT_OCHP_TIMEOUT;
 
@@ -1109,6 +1124,9 @@ int reset_variables(void)
 	use_retained_program_state = TRUE;
 	use_retained_scheduling_info = FALSE;
 	retention_scheduling_horizon = DEFAULT_RETENTION_SCHEDULING_HORIZON;
+	binary_retention = DEFAULT_BINARY_RETENTION;
+	background_retention_saves = DEFAULT_BACKGROUND_RETENTION_SAVES;
+	retention_fsync = DEFAULT_RETENTION_FSYNC;
 	modified_host_process_attributes = MODATTR_NONE;
 	modified_service_process_attributes = MODATTR_NONE;
 	retained_host_attribute_mask = 0L;
@@ -1152,6 +1170,7 @@ int reset_variables(void)
 	next_notification_id = 1;
 
 	status_update_interval = DEFAULT_STATUS_UPDATE_INTERVAL;
+	background_status_updates = DEFAULT_BACKGROUND_STATUS_UPDATES;
 
 	event_broker_options = BROKER_NOTHING;
 
@@ -1173,9 +1192,17 @@ int reset_variables(void)
 	debug_level = DEFAULT_DEBUG_LEVEL;
 	debug_verbosity = DEFAULT_DEBUG_VERBOSITY;
 	max_debug_file_size = DEFAULT_MAX_DEBUG_FILE_SIZE;
+	binary_debug_log = DEFAULT_BINARY_DEBUG_LOG;
 
 	date_format = DATE_FORMAT_US;
 
+	use_timing_wheel = DEFAULT_USE_TIMING_WHEEL;
+	worker_dispatch_batching = DEFAULT_WORKER_DISPATCH_BATCHING;
+	worker_dispatch_policy = DEFAULT_WORKER_DISPATCH_POLICY;
+	worker_autoscale = DEFAULT_WORKER_AUTOSCALE;
+	worker_autoscale_min = DEFAULT_WORKER_AUTOSCALE_MIN;
+	worker_autoscale_max = DEFAULT_WORKER_AUTOSCALE_MAX;
+
 	/* initialize macros */
 	init_macros();
 
@@ -20,6 +20,9 @@
 #include "lib/worker.h"
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 /* perfect hash function for wproc response codes */
 #include "wpres-phash.h"
@@ -34,10 +37,33 @@ struct wproc_job {
 	void (*callback)(struct wproc_result *, void *, int);
 	void *data;
 	struct wproc_worker *wp;
+	struct timeval dispatched; /* when the job was handed to wp */
 };
 
 struct wproc_list;
 
+/* where in the batch's buffer a job's command goes */
+struct wproc_batch_job {
+	struct wproc_job *job;
+	size_t split;
+	size_t command_len;
+};
+
+/*
+ * Jobs queued up to be sent to a worker in one go. The job data is
+ * serialized straight into buf, except for the commands, which are
+ * spliced in from the jobs themselves when the batch is written.
+ */
+struct wproc_batch {
+	char *buf;
+	size_t len, size;
+	struct wproc_batch_job *jobs;
+	unsigned int num_jobs, max_jobs;
+	struct iovec *iov;
+	int pending; /* set if the worker is on the list of batches to flush */
+	struct wproc_worker *next_pending;
+};
+
 struct wproc_worker {
 	char *name; /**< check-source name of this worker */
 	int sd;     /**< communication socket */
@@ -48,6 +74,12 @@ struct wproc_worker {
 	nm_bufferqueue *bq;  /**< bufferqueue for reading from worker */
 	GHashTable *jobs; /**< array of jobs */
 	struct wproc_list *wp_list;
+	struct wproc_batch batch; /**< jobs waiting to be sent */
+	int binary; /**< sends results in the binary protocol */
+	unsigned int latency[WPROC_LATENCY_BUCKETS]; /**< dispatch-to-result latency histogram */
+	int core; /**< a core worker we spawned ourselves */
+	int retiring; /**< finishing its jobs before being shut down */
+	struct wproc_worker *next_retiring;
 };
 
 struct wproc_list {
@@ -60,10 +92,77 @@ static struct wproc_list workers = {0, 0, NULL};
 
 static GHashTable *specialized_workers;
 static struct wproc_list *to_remove = NULL;
+static struct wproc_worker *batch_pending; /* workers with jobs waiting to be sent */
+static timed_event *batch_flush_event;
+static struct wproc_worker *retiring_workers; /* drained, then shut down */
+static GHashTable *core_worker_pids; /* spawned core workers that haven't registered yet */
 
 unsigned int wproc_num_workers_online = 0, wproc_num_workers_desired = 0;
 unsigned int wproc_num_workers_spawned = 0;
 
+/* at most this many jobs are sent to a worker in one batch */
+#define WPROC_BATCH_MAX_JOBS 256
+
+/*
+ * affinity dispatch lets a worker take up to this many percent of its
+ * fair share of the outstanding jobs before moving on to the next one
+ */
+#define WPROC_AFFINITY_LOAD_FACTOR 125
+
+/* how often the autoscaler looks at the workers, in seconds */
+#define WPROC_AUTOSCALE_INTERVAL 10
+
+/*
+ * the autoscaler spawns a core worker when the outstanding jobs per
+ * worker or the mean dispatch latency (seconds from handing a job to
+ * a worker until it got started) go above the high marks, and retires
+ * one when both have stayed below the low marks for a while
+ */
+#define WPROC_AUTOSCALE_JOBS_HIGH 100
+#define WPROC_AUTOSCALE_JOBS_LOW 10
+#define WPROC_AUTOSCALE_LATENCY_HIGH 0.25
+#define WPROC_AUTOSCALE_LATENCY_LOW 0.05
+#define WPROC_AUTOSCALE_QUIET_ROUNDS 6
+
+/*
+ * low priority jobs, such as notifications, are held back while the
+ * workers have more than this many jobs each, so checks go first
+ */
+#define WPROC_LOW_PRIORITY_MAX_LOAD 50
+
+/* spawned workers that haven't registered after this many seconds are given up on */
+#define WPROC_AUTOSCALE_SPAWN_TIMEOUT 60
+
+/* number of scaling events kept for the wproc "scaling" command */
+#define WPROC_SCALING_EVENTS 16
+
+struct wproc_scaling_event {
+	time_t when;
+	const char *action;
+	pid_t pid;
+	unsigned int workers;
+	float jobs_per_worker;
+	float latency;
+};
+
+static struct {
+	unsigned int min, max;
+	unsigned int quiet_rounds;
+	time_t last_spawn;
+	double latency_sum;
+	unsigned int latency_count;
+	unsigned int spawned, retired;
+	unsigned int num_events;
+	struct wproc_scaling_event events[WPROC_SCALING_EVENTS];
+} autoscale;
+
+static const char *dispatch_policy_names[] = {
+	"round-robin",
+	"least-loaded",
+	"two-choices",
+	"affinity",
+};
+
 #define tv2float(tv) ((float)((tv)->tv_sec) + ((float)(tv)->tv_usec) / 1000000.0)
 
 static void wproc_logdump_buffer(int debuglevel, int verbosity, const char *prefix, char *buf)
@@ -127,35 +226,185 @@ static struct wproc_list *get_wproc_list(const char *cmd)
 	return wp_list ? wp_list : &workers;
 }
 
-static struct wproc_worker *get_worker(const char *cmd)
+int wproc_dispatch_policy_by_name(const char *name)
 {
-	struct wproc_list *wp_list;
-	struct wproc_worker *worker = NULL;
-	size_t i, boundary;
+	unsigned int i;
 
-	if (!cmd)
-		return NULL;
+	for (i = 0; i < ARRAY_SIZE(dispatch_policy_names); i++) {
+		if (!strcmp(name, dispatch_policy_names[i]))
+			return i;
+	}
+	return -1;
+}
 
-	wp_list = get_wproc_list(cmd);
-	if (!wp_list || !wp_list->wps || !wp_list->len)
-		return NULL;
+static inline unsigned int wproc_load(struct wproc_worker *wp)
+{
+	return g_hash_table_size(wp->jobs);
+}
+
+static inline int wproc_is_full(struct wproc_worker *wp)
+{
+	return wproc_load(wp) >= (unsigned int)wp->max_jobs;
+}
+
+static struct wproc_worker *get_worker_round_robin(struct wproc_list *wp_list)
+{
+	size_t i, boundary;
 
 	/* Try to find a worker that is not overloaded. We go one lap around the
 	 * list before giving up. */
 	i = boundary = wp_list->idx % wp_list->len;
 	do {
 		i = (i + 1) % wp_list->len;
-		if (g_hash_table_size(wp_list->wps[i]->jobs) < (unsigned int) wp_list->wps[i]->max_jobs) {
+		if (!wproc_is_full(wp_list->wps[i])) {
 			/* We found one! */
 			wp_list->idx = i;
-			worker = wp_list->wps[i];
-			break;
+			return wp_list->wps[i];
 		}
 	} while (i != boundary);
 
+	return NULL;
+}
+
+/*
+ * The worker with the fewest outstanding jobs. We start looking right
+ * after the last pick, so idle workers still take turns.
+ */
+static struct wproc_worker *get_worker_least_loaded(struct wproc_list *wp_list)
+{
+	struct wproc_worker *worker = NULL;
+	unsigned int i, n, best = 0, best_load = 0;
+
+	for (n = 1; n <= wp_list->len; n++) {
+		struct wproc_worker *wp;
+
+		i = (wp_list->idx + n) % wp_list->len;
+		wp = wp_list->wps[i];
+		if (wproc_is_full(wp))
+			continue;
+		if (!worker || wproc_load(wp) < best_load) {
+			worker = wp;
+			best = i;
+			best_load = wproc_load(wp);
+			if (!best_load)
+				break;
+		}
+	}
+	if (worker)
+		wp_list->idx = best;
+
 	return worker;
 }
 
+/*
+ * The less loaded of two workers picked at random. That spreads load
+ * almost as well as least-loaded does, without looking at them all.
+ */
+static struct wproc_worker *get_worker_two_choices(struct wproc_list *wp_list)
+{
+	struct wproc_worker *a, *b;
+	unsigned int i, j;
+
+	if (wp_list->len < 3)
+		return get_worker_least_loaded(wp_list);
+
+	i = rand() % wp_list->len;
+	j = rand() % (wp_list->len - 1);
+	if (j >= i)
+		j++;
+	a = wp_list->wps[i];
+	b = wp_list->wps[j];
+	if (wproc_is_full(a) || (!wproc_is_full(b) && wproc_load(b) < wproc_load(a)))
+		a = b;
+	if (wproc_is_full(a))
+		return get_worker_least_loaded(wp_list);
+
+	return a;
+}
+
+/*
+ * Jobs running the same plugin go to the same worker, so whatever the
+ * plugin keeps warm there gets reused. A worker only takes a job this
+ * way while it isn't carrying much more than its fair share of the
+ * outstanding jobs. Otherwise the job goes to the next worker in line,
+ * so one busy plugin can't swamp a single worker.
+ */
+static struct wproc_worker *get_worker_affinity(struct wproc_list *wp_list, const char *cmd)
+{
+	unsigned int i, n, hash = 5381, total = 0, bound;
+	const char *p;
+
+	for (p = cmd; *p && *p != ' '; p++)
+		hash = ((hash << 5) + hash) ^ (unsigned char)*p;
+
+	for (i = 0; i < wp_list->len; i++)
+		total += wproc_load(wp_list->wps[i]);
+	bound = ((total + 1) * WPROC_AFFINITY_LOAD_FACTOR) / (100 * wp_list->len) + 1;
+
+	for (n = 0; n < wp_list->len; n++) {
+		struct wproc_worker *wp;
+
+		i = (hash + n) % wp_list->len;
+		wp = wp_list->wps[i];
+		if (!wproc_is_full(wp) && wproc_load(wp) < bound)
+			return wp;
+	}
+
+	return get_worker_least_loaded(wp_list);
+}
+
+static struct wproc_worker *get_worker(const char *cmd)
+{
+	struct wproc_list *wp_list;
+
+	if (!cmd)
+		return NULL;
+
+	wp_list = get_wproc_list(cmd);
+	if (!wp_list || !wp_list->wps || !wp_list->len)
+		return NULL;
+
+	switch (worker_dispatch_policy) {
+	case WPROC_DISPATCH_LEAST_LOADED:
+		return get_worker_least_loaded(wp_list);
+	case WPROC_DISPATCH_TWO_CHOICES:
+		return get_worker_two_choices(wp_list);
+	case WPROC_DISPATCH_AFFINITY:
+		return get_worker_affinity(wp_list, cmd);
+	}
+
+	return get_worker_round_robin(wp_list);
+}
+
+/* bucket 0 counts jobs done in under 1ms, bucket N those under 2^N ms */
+static void record_latency(struct wproc_worker *wp, struct wproc_job *job)
+{
+	struct timeval now;
+	unsigned long msecs;
+	unsigned int bucket = 0;
+
+	gettimeofday(&now, NULL);
+	msecs = (unsigned long)(tv_delta_f(&job->dispatched, &now) * 1000);
+	while (msecs && bucket < WPROC_LATENCY_BUCKETS - 1) {
+		msecs >>= 1;
+		bucket++;
+	}
+	wp->latency[bucket]++;
+}
+
+/* feeds the autoscaler with how long the job waited before it got started */
+static void record_dispatch_latency(struct wproc_job *job, struct wproc_result *wpres)
+{
+	double delay;
+
+	if (!job->dispatched.tv_sec || !wpres->start.tv_sec)
+		return;
+
+	delay = tv_delta_f(&job->dispatched, &wpres->start);
+	autoscale.latency_sum += delay > 0 ? delay : 0;
+	autoscale.latency_count++;
+}
+
 static void run_job_callback(struct wproc_job *job, struct wproc_result *wpres, int val)
 {
 	if (!job || !job->callback)
@@ -187,6 +436,25 @@ static int wproc_is_alive(struct wproc_worker *wp)
 	return 0;
 }
 
+static void wproc_batch_discard(struct wproc_worker *wp);
+
+/*
+ * reaps a killed worker once it's gone, so that one that's slow to die
+ * doesn't stall the main loop. When shutting down we wait for it
+ */
+static void reap_killed_worker(struct nm_event_execution_properties *evprop)
+{
+	pid_t pid = GPOINTER_TO_INT(evprop->user_data);
+	int ret;
+
+	do {
+		ret = waitpid(pid, NULL, evprop->execution_type == EVENT_EXEC_ABORTED ? 0 : WNOHANG);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret == 0)
+		schedule_event(1, reap_killed_worker, evprop->user_data);
+}
+
 static int wproc_destroy(struct wproc_worker *wp, int flags)
 {
 	int i = 0, force = 0, self;
@@ -194,6 +462,9 @@ static int wproc_destroy(struct wproc_worker *wp, int flags)
 	if (!wp)
 		return 0;
 
+	/* its socket is going away, so there's nowhere to send them */
+	wproc_batch_discard(wp);
+
 	force = !!(flags & WPROC_FORCE);
 
 	self = getpid();
@@ -204,6 +475,9 @@ static int wproc_destroy(struct wproc_worker *wp, int flags)
 	/* free all memory when either forcing or a worker called us */
 	nm_bufferqueue_destroy(wp->bq);
 	wp->bq = NULL;
+	nm_free(wp->batch.buf);
+	nm_free(wp->batch.jobs);
+	nm_free(wp->batch.iov);
 	nm_free(wp->name);
 	g_hash_table_destroy(wp->jobs);
 	wp->jobs = NULL;
@@ -221,7 +495,11 @@ static int wproc_destroy(struct wproc_worker *wp, int flags)
 
 	/* reap this child if it still exists */
 	do {
-		int ret = waitpid(wp->pid, &i, 0);
+		int ret = waitpid(wp->pid, &i, (flags & WPROC_NOWAIT) ? WNOHANG : 0);
+		if (ret == 0) {
+			schedule_event(1, reap_killed_worker, GINT_TO_POINTER(wp->pid));
+			break;
+		}
 		if (ret == wp->pid || (ret < 0 && errno == ECHILD))
 			break;
 	} while (1);
@@ -256,6 +534,90 @@ static void remove_worker(struct wproc_worker *worker)
 	g_hash_table_foreach_remove(specialized_workers, remove_specialized, to_remove);
 }
 
+static unsigned int num_core_workers(void)
+{
+	unsigned int i, num = 0;
+
+	for (i = 0; i < workers.len; i++) {
+		if (workers.wps[i]->core)
+			num++;
+	}
+
+	return num;
+}
+
+static void log_scaling_event(const char *action, pid_t pid, float jobs_per_worker, float latency)
+{
+	struct wproc_scaling_event *ev;
+
+	ev = &autoscale.events[autoscale.num_events++ % WPROC_SCALING_EVENTS];
+	ev->when = time(NULL);
+	ev->action = action;
+	ev->pid = pid;
+	ev->workers = num_core_workers();
+	ev->jobs_per_worker = jobs_per_worker;
+	ev->latency = latency;
+}
+
+static void unlink_retiring(struct wproc_worker *wp)
+{
+	struct wproc_worker **ptr;
+
+	for (ptr = &retiring_workers; *ptr; ptr = &(*ptr)->next_retiring) {
+		if (*ptr == wp) {
+			*ptr = wp->next_retiring;
+			break;
+		}
+	}
+	wp->next_retiring = NULL;
+}
+
+/* shuts down a retiring worker once it has no jobs left */
+static void finish_retiring(struct wproc_worker *wp)
+{
+	unlink_retiring(wp);
+	nm_log(NSLOG_INFO_MESSAGE, "wproc: Worker %s retired", wp->name);
+	log_scaling_event("retired", wp->pid, 0, 0);
+	autoscale.retired++;
+
+	/* it has nothing left to do, so there's no point in being gentle */
+	wproc_destroy(wp, WPROC_FORCE | WPROC_NOWAIT);
+}
+
+/*
+ * Stops handing jobs to a worker and shuts it down once the jobs it
+ * already has are done. Unlike a worker whose socket breaks, none of
+ * its jobs are started over on another worker.
+ */
+static void retire_worker(struct wproc_worker *wp)
+{
+	nm_log(NSLOG_INFO_MESSAGE, "wproc: Retiring worker %s once its %u jobs are done",
+	       wp->name, g_hash_table_size(wp->jobs));
+	wp->retiring = 1;
+	remove_worker(wp);
+	wproc_num_workers_online--;
+	wp->next_retiring = retiring_workers;
+	retiring_workers = wp;
+
+	if (!g_hash_table_size(wp->jobs))
+		finish_retiring(wp);
+}
+
+/* the core worker with the fewest outstanding jobs */
+static struct wproc_worker *least_loaded_core_worker(void)
+{
+	struct wproc_worker *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < workers.len; i++) {
+		struct wproc_worker *wp = workers.wps[i];
+		if (wp->core && (!best || wproc_load(wp) < wproc_load(best)))
+			best = wp;
+	}
+
+	return best;
+}
+
 
 /*
  * This gets called from both parent and worker process, so
@@ -276,6 +638,15 @@ void free_worker_memory(int flags)
 
 		free(workers.wps);
 	}
+	while (retiring_workers) {
+		struct wproc_worker *wp = retiring_workers;
+		retiring_workers = wp->next_retiring;
+		wproc_destroy(wp, flags);
+	}
+	if (core_worker_pids) {
+		g_hash_table_destroy(core_worker_pids);
+		core_worker_pids = NULL;
+	}
 	g_hash_table_foreach_remove(specialized_workers, remove_specialized, NULL);
 	g_hash_table_destroy(specialized_workers);
 	workers.wps = NULL;
@@ -406,12 +777,145 @@ static int parse_worker_result(wproc_result *wpres, struct kvvec *kvv)
 	return 0;
 }
 
+/*
+ * parses a binary protocol result. Like above, the strings point
+ * into the frame's payload
+ */
+static int parse_worker_result_frame(wproc_result *wpres, char *payload, size_t len)
+{
+	struct wproc_result_frame res;
+	char *str[4];
+	uint32_t str_len[4];
+	size_t offset = sizeof(res);
+	int i;
+
+	if (len < sizeof(res))
+		return -1;
+	memcpy(&res, payload, sizeof(res));
+
+	str_len[0] = res.command_len;
+	str_len[1] = res.outstd_len;
+	str_len[2] = res.outerr_len;
+	str_len[3] = res.error_msg_len;
+	for (i = 0; i < 4; i++) {
+		if (str_len[i] >= len - offset || payload[offset + str_len[i]])
+			return -1;
+		str[i] = payload + offset;
+		offset += str_len[i] + 1;
+	}
+
+	wpres->job_id = res.job_id;
+	wpres->timeout = res.timeout;
+	wpres->wait_status = res.wait_status;
+	wpres->exited_ok = res.exited_ok;
+	wpres->error_code = res.error_code;
+	wpres->start.tv_sec = res.start_sec;
+	wpres->start.tv_usec = res.start_usec;
+	wpres->stop.tv_sec = res.stop_sec;
+	wpres->stop.tv_usec = res.stop_usec;
+	wpres->rusage.ru_utime.tv_sec = res.ru_utime_sec;
+	wpres->rusage.ru_utime.tv_usec = res.ru_utime_usec;
+	wpres->rusage.ru_stime.tv_sec = res.ru_stime_sec;
+	wpres->rusage.ru_stime.tv_usec = res.ru_stime_usec;
+	wpres->rusage.ru_minflt = res.ru_minflt;
+	wpres->rusage.ru_majflt = res.ru_majflt;
+	wpres->rusage.ru_inblock = res.ru_inblock;
+	wpres->rusage.ru_oublock = res.ru_oublock;
+	wpres->command = str[0];
+	wpres->outstd = str[1];
+	wpres->outerr = str[2];
+	if (res.error_msg_len) {
+		wpres->exited_ok = FALSE;
+		wpres->error_msg = str[3];
+	}
+	if (res.error_code)
+		wpres->exited_ok = FALSE;
+
+	return 0;
+}
+
 static struct wproc_job *create_job(void (*callback)(struct wproc_result *, void *, int), void *data, time_t timeout, const char *cmd);
 static int wproc_run_job(struct wproc_job *job, nagios_macros *mac);
 
+/* hands a parsed result to whoever started the job */
+static void complete_job(struct wproc_worker *wp, wproc_result *wpres)
+{
+	struct wproc_job *job;
+	char *error_reason = NULL;
+
+	job = get_job(wp, wpres->job_id);
+	if (!job) {
+		nm_log(NSLOG_RUNTIME_WARNING, "wproc: Job with id '%d' doesn't exist on %s.\n", wpres->job_id, wp->name);
+		return;
+	}
+
+	/*
+	 * ETIME ("Timer expired") doesn't really happen
+	 * on any modern systems, so we reuse it to mean
+	 * "program timed out"
+	 */
+	if (wpres->error_code == ETIME) {
+		wpres->early_timeout = TRUE;
+	}
+
+	if (wpres->early_timeout) {
+		nm_asprintf(&error_reason, "timed out after %.2fs", tv_delta_f(&wpres->start, &wpres->stop));
+	} else if (WIFSIGNALED(wpres->wait_status)) {
+		nm_asprintf(&error_reason, "died by signal %d%s after %.2f seconds",
+		            WTERMSIG(wpres->wait_status),
+		            WCOREDUMP(wpres->wait_status) ? " (core dumped)" : "",
+		            tv_delta_f(&wpres->start, &wpres->stop));
+	}
+	if (error_reason) {
+		log_debug_info(DEBUGL_IPC, DEBUGV_BASIC, "wproc: job %d from worker %s %s\n",
+		               job->id, wp->name, error_reason);
+		log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   command: %s\n", job->command);
+		log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   early_timeout=%d; exited_ok=%d; wait_status=%d; error_code=%d;\n",
+		               wpres->early_timeout, wpres->exited_ok, wpres->wait_status, wpres->error_code);
+		wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MORE, "wproc:   stderr", wpres->outerr);
+		wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MORE, "wproc:   stdout", wpres->outstd);
+	}
+	nm_free(error_reason);
+
+	record_latency(wp, job);
+	record_dispatch_latency(job, wpres);
+	run_job_callback(job, wpres, 0);
+	g_hash_table_remove(wp->jobs, GINT_TO_POINTER(job->id));
+}
+
+/* returns -1 if the worker sent something that can't be a frame */
+static int handle_worker_frames(struct wproc_worker *wp)
+{
+	struct wproc_frame frame;
+	char *payload;
+	wproc_result wpres;
+	int ret;
+
+	while ((ret = worker_ioc2frame(wp->bq, &frame, &payload)) > 0) {
+		if (frame.type == WPROC_FRAME_LOG) {
+			log_debug_info(DEBUGL_IPC, DEBUGV_BASIC, "wproc: %s: %s\n", wp->name, payload);
+		} else if (frame.type != WPROC_FRAME_RESULT) {
+			nm_log(NSLOG_RUNTIME_WARNING, "wproc: Unknown frame type %u from %s\n", frame.type, wp->name);
+		} else {
+			memset(&wpres, 0, sizeof(wpres));
+			wpres.job_id = -1;
+			wpres.source = wp->name;
+			if (parse_worker_result_frame(&wpres, payload, frame.len) < 0) {
+				nm_log(NSLOG_RUNTIME_ERROR, "wproc: Failed to parse result frame with len %u from %s\n",
+				       frame.len, wp->name);
+			} else {
+				complete_job(wp, &wpres);
+			}
+		}
+		nm_free(payload);
+	}
+
+	return ret;
+}
+
 static int handle_worker_result(int sd, int events, void *arg)
 {
-	char *buf, *error_reason = NULL;
+	char *buf;
 	size_t size;
 	int ret;
 	struct wproc_worker *wp = (struct wproc_worker *)arg;
@@ -422,11 +926,22 @@ static int handle_worker_result(int sd, int events, void *arg)
 		nm_log(NSLOG_RUNTIME_WARNING, "wproc: nm_bufferqueue_read() from %s returned %d: %s\n",
 		       wp->name, ret, strerror(errno));
 		return 0;
-	} else if (ret == 0) {
+	}
+	if (ret > 0 && wp->binary && handle_worker_frames(wp) < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "wproc: Garbled data from worker %s, disconnecting it", wp->name);
+		/* there's no finding the next frame, so the worker has to go */
+		shutdown(sd, SHUT_RDWR);
+		ret = 0;
+	}
+	if (ret == 0) {
 		GHashTableIter iter;
 		gpointer job_;
 		nm_log(NSLOG_INFO_MESSAGE, "wproc: Socket to worker %s broken, removing", wp->name);
-		wproc_num_workers_online--;
+		/* a retiring worker was already taken offline */
+		if (wp->retiring)
+			unlink_retiring(wp);
+		else
+			wproc_num_workers_online--;
 		iobroker_unregister(nagios_iobs, sd);
 		if (workers.len <= 0) {
 			/* there aren't global workers left, we can't run any more checks
@@ -452,9 +967,8 @@ static int handle_worker_result(int sd, int events, void *arg)
 		wproc_destroy(wp, 0);
 		return 0;
 	}
-	while ((buf = worker_ioc2msg(wp->bq, &size, 0))) {
+	while (!wp->binary && (buf = worker_ioc2msg(wp->bq, &size, 0))) {
 		static struct kvvec kvv = KVVEC_INITIALIZER;
-		struct wproc_job *job;
 		wproc_result wpres;
 
 		/* log messages are handled first */
@@ -479,46 +993,13 @@ static int handle_worker_result(int sd, int events, void *arg)
 		wpres.source = wp->name;
 		parse_worker_result(&wpres, &kvv);
 
-		job = get_job(wp, wpres.job_id);
-		if (!job) {
-			nm_log(NSLOG_RUNTIME_WARNING, "wproc: Job with id '%d' doesn't exist on %s.\n", wpres.job_id, wp->name);
-			nm_free(buf);
-			continue;
-		}
-
-		/*
-		 * ETIME ("Timer expired") doesn't really happen
-		 * on any modern systems, so we reuse it to mean
-		 * "program timed out"
-		 */
-		if (wpres.error_code == ETIME) {
-			wpres.early_timeout = TRUE;
-		}
-
-		if (wpres.early_timeout) {
-			nm_asprintf(&error_reason, "timed out after %.2fs", tv_delta_f(&wpres.start, &wpres.stop));
-		} else if (WIFSIGNALED(wpres.wait_status)) {
-			nm_asprintf(&error_reason, "died by signal %d%s after %.2f seconds",
-			            WTERMSIG(wpres.wait_status),
-			            WCOREDUMP(wpres.wait_status) ? " (core dumped)" : "",
-			            tv_delta_f(&wpres.start, &wpres.stop));
-		}
-		if (error_reason) {
-			log_debug_info(DEBUGL_IPC, DEBUGV_BASIC, "wproc: job %d from worker %s %s\n",
-			               job->id, wp->name, error_reason);
-			log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   command: %s\n", job->command);
-			log_debug_info(DEBUGL_IPC, DEBUGV_MORE, "wproc:   early_timeout=%d; exited_ok=%d; wait_status=%d; error_code=%d;\n",
-			               wpres.early_timeout, wpres.exited_ok, wpres.wait_status, wpres.error_code);
-			wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MORE, "wproc:   stderr", wpres.outerr);
-			wproc_logdump_buffer(DEBUGL_IPC, DEBUGV_MORE, "wproc:   stdout", wpres.outstd);
-		}
-		nm_free(error_reason);
-
-		run_job_callback(job, &wpres, 0);
-		g_hash_table_remove(wp->jobs, GINT_TO_POINTER(job->id));
+		complete_job(wp, &wpres);
 		nm_free(buf);
 	}
 
+	if (wp->retiring && !g_hash_table_size(wp->jobs))
+		finish_retiring(wp);
+
 	return 0;
 }
 
@@ -535,6 +1016,25 @@ int workers_alive(void)
 	return alive;
 }
 
+/*
+ * Tells if the workers are quiet enough to take low priority jobs.
+ * Checks are always sent right away, so a core busy with checks will
+ * hold other work back until the checks have drained.
+ */
+int wproc_can_run_low_priority(void)
+{
+	unsigned int i, outstanding = 0;
+
+	/* nothing to wait for */
+	if (!workers.len)
+		return TRUE;
+
+	for (i = 0; i < workers.len; i++)
+		outstanding += wproc_load(workers.wps[i]);
+
+	return outstanding < workers.len * WPROC_LOW_PRIORITY_MAX_LOAD;
+}
+
 /* a service for registering workers */
 static int register_worker(int sd, char *buf, unsigned int len)
 {
@@ -567,6 +1067,8 @@ static int register_worker(int sd, char *buf, unsigned int len)
 			worker->pid = atoi(kv->value);
 		} else if (!strcmp(kv->key, "max_jobs")) {
 			worker->max_jobs = atoi(kv->value);
+		} else if (!strcmp(kv->key, "protocol")) {
+			worker->binary = atoi(kv->value) >= WPROC_PROTOCOL_BINARY;
 		} else if (!strcmp(kv->key, "plugin")) {
 			struct wproc_list *command_handlers;
 			is_global = 0;
@@ -600,6 +1102,7 @@ static int register_worker(int sd, char *buf, unsigned int len)
 	                   NULL, destroy_job);
 
 	if (is_global) {
+		worker->core = core_worker_pids && g_hash_table_remove(core_worker_pids, GINT_TO_POINTER(worker->pid));
 		workers.len++;
 		workers.wps = nm_realloc(workers.wps, workers.len * sizeof(struct wproc_worker *));
 		workers.wps[workers.len - 1] = worker;
@@ -607,7 +1110,10 @@ static int register_worker(int sd, char *buf, unsigned int len)
 	}
 	wproc_num_workers_online++;
 	kvvec_destroy(info, 0);
-	nsock_printf_nul(sd, "OK");
+	if (worker->binary)
+		nsock_printf_nul(sd, "OK protocol=%d", WPROC_PROTOCOL_BINARY);
+	else
+		nsock_printf_nul(sd, "OK");
 
 	/* signal query handler to release its bufferqueue for this one */
 	return QH_TAKEOVER;
@@ -620,9 +1126,12 @@ static int wproc_query_handler(int sd, char *buf, unsigned int len)
 	if (!*buf || !strcmp(buf, "help")) {
 		nsock_printf_nul(sd, "Control worker processes.\n"
 		                 "Valid commands:\n"
-		                 "  wpstats              Print general job information\n"
+		                 "  wpstats              Print general job information. latency lists how many\n"
+		                 "                       jobs got their result back within 1, 2, 4 ... ms of\n"
+		                 "                       being dispatched, the last bucket taking the rest\n"
+		                 "  scaling              Print autoscaler settings and the latest scaling events\n"
 		                 "  register <options>   Register a new worker\n"
-		                 "                       <options> can be name, pid, max_jobs and/or plugin.\n"
+		                 "                       <options> can be name, pid, max_jobs, protocol and/or plugin.\n"
 		                 "                       There can be many plugin args.");
 		return 0;
 	}
@@ -640,9 +1149,34 @@ static int wproc_query_handler(int sd, char *buf, unsigned int len)
 
 		for (i = 0; i < workers.len; i++) {
 			struct wproc_worker *wp = workers.wps[i];
-			nsock_printf(sd, "name=%s;pid=%d;jobs_running=%u;jobs_started=%u\n",
+			unsigned int b;
+
+			nsock_printf(sd, "name=%s;pid=%d;jobs_running=%u;jobs_started=%u;policy=%s;latency=",
 			             wp->name, wp->pid,
-			             g_hash_table_size(wp->jobs), wp->jobs_started);
+			             g_hash_table_size(wp->jobs), wp->jobs_started,
+			             dispatch_policy_names[worker_dispatch_policy]);
+			for (b = 0; b < WPROC_LATENCY_BUCKETS; b++)
+				nsock_printf(sd, "%s%u", b ? "," : "", wp->latency[b]);
+			nsock_printf(sd, "\n");
+		}
+		return 0;
+	}
+	if (!strcmp(buf, "scaling")) {
+		unsigned int i, num_retiring = 0;
+		struct wproc_worker *wp;
+
+		for (wp = retiring_workers; wp; wp = wp->next_retiring)
+			num_retiring++;
+		nsock_printf(sd, "autoscale=%d;min=%u;max=%u;workers=%u;pending=%u;retiring=%u;spawned=%u;retired=%u\n",
+		             worker_autoscale, autoscale.min, autoscale.max, num_core_workers(),
+		             core_worker_pids ? g_hash_table_size(core_worker_pids) : 0,
+		             num_retiring, autoscale.spawned, autoscale.retired);
+		i = autoscale.num_events > WPROC_SCALING_EVENTS ? autoscale.num_events - WPROC_SCALING_EVENTS : 0;
+		for (; i < autoscale.num_events; i++) {
+			struct wproc_scaling_event *ev = &autoscale.events[i % WPROC_SCALING_EVENTS];
+			nsock_printf(sd, "time=%lu;action=%s;pid=%d;workers=%u;jobs_per_worker=%.2f;dispatch_latency=%.3f\n",
+			             (unsigned long)ev->when, ev->action, ev->pid, ev->workers,
+			             ev->jobs_per_worker, ev->latency);
 		}
 		return 0;
 	}
@@ -655,14 +1189,104 @@ static int spawn_core_worker(void)
 	char *argvec[] = {naemon_binary_path, "--worker", qh_socket_path, NULL};
 	int ret;
 
-	if ((ret = spawn_helper(argvec)) < 0)
+	if ((ret = spawn_helper(argvec)) < 0) {
 		nm_log(NSLOG_RUNTIME_ERROR, "wproc: Failed to launch core worker: %s\n", strerror(errno));
-	else
+	} else {
 		wproc_num_workers_spawned++;
+		g_hash_table_insert(core_worker_pids, GINT_TO_POINTER(ret), GINT_TO_POINTER(ret));
+		autoscale.last_spawn = time(NULL);
+	}
 
 	return ret;
 }
 
+/*
+ * Returns 1 if another core worker should be spawned, -1 if one
+ * should be retired and 0 if the number of workers is fine as it is.
+ */
+static int autoscale_decision(unsigned int num, float jobs_per_worker, float latency)
+{
+	if (num < autoscale.min)
+		return 1;
+	if (num > autoscale.max)
+		return -1;
+
+	if (jobs_per_worker > WPROC_AUTOSCALE_JOBS_HIGH || latency > WPROC_AUTOSCALE_LATENCY_HIGH) {
+		autoscale.quiet_rounds = 0;
+		return num < autoscale.max;
+	}
+	if (jobs_per_worker >= WPROC_AUTOSCALE_JOBS_LOW || latency >= WPROC_AUTOSCALE_LATENCY_LOW) {
+		autoscale.quiet_rounds = 0;
+		return 0;
+	}
+
+	/* don't let a short lull take workers away */
+	if (++autoscale.quiet_rounds < WPROC_AUTOSCALE_QUIET_ROUNDS || num <= autoscale.min)
+		return 0;
+	autoscale.quiet_rounds = 0;
+	return -1;
+}
+
+static void autoscale_workers(void)
+{
+	unsigned int i, outstanding = 0;
+	float jobs_per_worker = 0, latency = 0;
+	struct wproc_worker *wp;
+	int pid;
+
+	/* let freshly spawned workers register before looking again */
+	if (core_worker_pids && g_hash_table_size(core_worker_pids)) {
+		if (time(NULL) - autoscale.last_spawn < WPROC_AUTOSCALE_SPAWN_TIMEOUT)
+			return;
+		nm_log(NSLOG_RUNTIME_WARNING, "wproc: %u spawned core workers never registered, giving up on them\n",
+		       g_hash_table_size(core_worker_pids));
+		g_hash_table_remove_all(core_worker_pids);
+	}
+
+	for (i = 0; i < workers.len; i++)
+		outstanding += wproc_load(workers.wps[i]);
+	if (workers.len)
+		jobs_per_worker = (float)outstanding / workers.len;
+	if (autoscale.latency_count)
+		latency = autoscale.latency_sum / autoscale.latency_count;
+	autoscale.latency_sum = 0;
+	autoscale.latency_count = 0;
+
+	switch (autoscale_decision(num_core_workers(), jobs_per_worker, latency)) {
+	case 1:
+		if ((pid = spawn_core_worker()) < 0)
+			break;
+		nm_log(NSLOG_INFO_MESSAGE, "wproc: Spawned core worker %d (%.1f jobs per worker, %.3fs dispatch latency)",
+		       pid, jobs_per_worker, latency);
+		wproc_num_workers_desired++;
+		autoscale.spawned++;
+		log_scaling_event("spawn", pid, jobs_per_worker, latency);
+		break;
+	case -1:
+		if (!(wp = least_loaded_core_worker()))
+			break;
+		wproc_num_workers_desired--;
+		log_scaling_event("retire", wp->pid, jobs_per_worker, latency);
+		retire_worker(wp);
+		break;
+	}
+}
+
+static void wproc_autoscale(struct nm_event_execution_properties *evprop)
+{
+	if (evprop->execution_type == EVENT_EXEC_NORMAL) {
+		/* Reschedule, since recurring */
+		schedule_event(WPROC_AUTOSCALE_INTERVAL, wproc_autoscale, NULL);
+		autoscale_workers();
+	}
+}
+
+void init_worker_autoscaler(void)
+{
+	if (worker_autoscale)
+		schedule_event(WPROC_AUTOSCALE_INTERVAL, wproc_autoscale, NULL);
+}
+
 
 int init_workers(int desired_workers)
 {
@@ -675,6 +1299,8 @@ int init_workers(int desired_workers)
 	specialized_workers = g_hash_table_new_full(g_str_hash, g_str_equal,
 	                      free, NULL
 	                                           );
+	if (!core_worker_pids)
+		core_worker_pids = g_hash_table_new(g_direct_hash, g_direct_equal);
 	if (!qh_register_handler("wproc", "Worker process management and info", 0, wproc_query_handler)) {
 		log_debug_info(DEBUGL_IPC, DEBUGV_BASIC, "wproc: Successfully registered manager as @wproc with query handler\n");
 	} else {
@@ -699,14 +1325,29 @@ int init_workers(int desired_workers)
 			}
 		}
 	}
+	if (worker_autoscale) {
+		autoscale.min = worker_autoscale_min > 0 ? worker_autoscale_min : desired_workers;
+		autoscale.max = worker_autoscale_max > 0 ? worker_autoscale_max : desired_workers * 2;
+		if (autoscale.max < autoscale.min)
+			autoscale.max = autoscale.min;
+		if (desired_workers < (int)autoscale.min)
+			desired_workers = autoscale.min;
+		else if (desired_workers > (int)autoscale.max)
+			desired_workers = autoscale.max;
+	}
 	wproc_num_workers_desired = desired_workers;
 
 	if (workers_alive() == desired_workers)
 		return 0;
 
-	/* can't shrink the number of workers (yet) */
-	if (desired_workers < (int)workers.len)
-		return -1;
+	/* retire the surplus once they're done with what they're doing */
+	if (desired_workers < (int)workers.len) {
+		struct wproc_worker *wp;
+
+		while ((int)workers.len > desired_workers && (wp = least_loaded_core_worker()))
+			retire_worker(wp);
+		return 0;
+	}
 
 	for (i = 0; i < desired_workers; i++)
 		spawn_core_worker();
@@ -731,10 +1372,184 @@ static struct wproc_job *create_job(void (*callback)(struct wproc_result *, void
 	job->data = data;
 	job->timeout = timeout;
 	job->command = nm_strdup(cmd);
+	gettimeofday(&job->dispatched, NULL);
 	g_hash_table_insert(wp->jobs, GINT_TO_POINTER(job->id), job);
 	return job;
 }
 
+static void batch_append(struct wproc_batch *b, const char *data, size_t len)
+{
+	if (b->len + len > b->size) {
+		b->size = (b->len + len) * 2;
+		b->buf = nm_realloc(b->buf, b->size);
+	}
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+}
+
+static void batch_append_kv(struct wproc_batch *b, const char *key, const char *value)
+{
+	char sep = KV_SEP;
+	batch_append(b, key, strlen(key));
+	batch_append(b, &sep, 1);
+	if (value) {
+		sep = PAIR_SEP;
+		batch_append(b, value, strlen(value));
+		batch_append(b, &sep, 1);
+	}
+}
+
+/*
+ * Forgets a job that couldn't be sent. Its caller gets ERROR back,
+ * so the callback isn't run (see wproc_run_callback())
+ */
+static void cancel_job(struct wproc_job *job)
+{
+	job->callback = NULL;
+	g_hash_table_remove(job->wp->jobs, GINT_TO_POINTER(job->id));
+}
+
+static void wproc_batch_unlink(struct wproc_worker *wp)
+{
+	struct wproc_worker **cur;
+
+	if (!wp->batch.pending)
+		return;
+	for (cur = &batch_pending; *cur; cur = &(*cur)->batch.next_pending) {
+		if (*cur == wp) {
+			*cur = wp->batch.next_pending;
+			break;
+		}
+	}
+	wp->batch.pending = 0;
+	wp->batch.next_pending = NULL;
+}
+
+static void wproc_batch_discard(struct wproc_worker *wp)
+{
+	wproc_batch_unlink(wp);
+	wp->batch.num_jobs = 0;
+	wp->batch.len = 0;
+}
+
+/* send all jobs queued up for this worker with a single write */
+static int wproc_batch_flush(struct wproc_worker *wp)
+{
+	struct wproc_batch *b = &wp->batch;
+	unsigned int i;
+	size_t prev = 0;
+	int ret, iovcnt = 0, result = OK;
+
+	wproc_batch_unlink(wp);
+	if (!b->num_jobs)
+		return OK;
+
+	for (i = 0; i < b->num_jobs; i++) {
+		b->iov[iovcnt].iov_base = b->buf + prev;
+		b->iov[iovcnt++].iov_len = b->jobs[i].split - prev;
+		b->iov[iovcnt].iov_base = b->jobs[i].job->command;
+		b->iov[iovcnt++].iov_len = b->jobs[i].command_len;
+		prev = b->jobs[i].split;
+	}
+	b->iov[iovcnt].iov_base = b->buf + prev;
+	b->iov[iovcnt++].iov_len = b->len - prev;
+
+	if (!iobroker_is_registered(nagios_iobs, wp->sd))
+		ret = -EPIPE;
+	else
+		ret = iobroker_write_packetv(nagios_iobs, wp->sd, b->iov, iovcnt);
+	if (ret < 0) {
+		nm_log(NSLOG_RUNTIME_ERROR, "wproc: Failed to send a batch of %u jobs to '%s': %s\n",
+		       b->num_jobs, wp->name, iobroker_strerror(ret));
+		/* their callbacks get a NULL result, see wproc_run_callback() */
+		for (i = 0; i < b->num_jobs; i++)
+			g_hash_table_remove(wp->jobs, GINT_TO_POINTER(b->jobs[i].job->id));
+		result = ERROR;
+	} else {
+		log_debug_info(DEBUGL_IPC, 1, "wproc: Sent a batch of %u jobs to '%s'\n", b->num_jobs, wp->name);
+		wp->jobs_started += b->num_jobs;
+	}
+	b->num_jobs = 0;
+	b->len = 0;
+
+	return result;
+}
+
+static void wproc_batch_flush_all(struct nm_event_execution_properties *evprop)
+{
+	batch_flush_event = NULL;
+	while (batch_pending)
+		wproc_batch_flush(batch_pending);
+}
+
+/* sends the jobs waiting in batches now, for when the event loop won't */
+void wproc_flush_batches(void)
+{
+	if (batch_flush_event) {
+		destroy_event(batch_flush_event);
+		batch_flush_event = NULL;
+	}
+	while (batch_pending)
+		wproc_batch_flush(batch_pending);
+}
+
+/*
+ * Serialize a job into its worker's batch. The batch is sent off once
+ * the event loop is done with whatever else is due right now, or as
+ * soon as it's full.
+ */
+static int wproc_queue_job(struct wproc_job *job)
+{
+	struct wproc_worker *wp = job->wp;
+	struct wproc_batch *b = &wp->batch;
+	char num[16], sep = PAIR_SEP;
+
+	/* we'd only find out when the batch is sent, which is too late to say so */
+	if (!iobroker_is_registered(nagios_iobs, wp->sd)) {
+		nm_log(NSLOG_RUNTIME_ERROR, "wproc: Can't send job to '%s', its socket is gone\n", wp->name);
+		cancel_job(job);
+		return ERROR;
+	}
+
+	if (!b->max_jobs) {
+		b->max_jobs = WPROC_BATCH_MAX_JOBS;
+		b->jobs = nm_malloc(b->max_jobs * sizeof(*b->jobs));
+		b->iov = nm_malloc((b->max_jobs * 2 + 1) * sizeof(*b->iov));
+	}
+
+	snprintf(num, sizeof(num), "%d", job->id);
+	batch_append_kv(b, "job_id", num);
+	batch_append_kv(b, "type", "0");
+	batch_append_kv(b, "command", NULL);
+	b->jobs[b->num_jobs].job = job;
+	b->jobs[b->num_jobs].split = b->len;
+	b->jobs[b->num_jobs].command_len = strlen(job->command);
+	b->num_jobs++;
+	batch_append(b, &sep, 1);
+	snprintf(num, sizeof(num), "%u", job->timeout);
+	batch_append_kv(b, "timeout", num);
+	batch_append(b, MSG_DELIM, MSG_DELIM_LEN);
+
+	/* a failed flush is reported to each job's callback */
+	if (b->num_jobs >= b->max_jobs) {
+		wproc_batch_flush(wp);
+		return OK;
+	}
+
+	if (!b->pending) {
+		b->pending = 1;
+		b->next_pending = batch_pending;
+		batch_pending = wp;
+	}
+	if (!batch_flush_event) {
+		batch_flush_event = schedule_event(0, wproc_batch_flush_all, NULL);
+		/* no event loop to flush it for us */
+		if (!batch_flush_event)
+			wproc_batch_flush(wp);
+	}
+	return OK;
+}
+
 /*
  * Handles adding the command and macros to the kvvec,
  * as well as shipping the command off to a designated
@@ -752,6 +1567,9 @@ static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 
 	wp = job->wp;
 
+	if (worker_dispatch_batching)
+		return wproc_queue_job(job);
+
 	if (!kvvec_init(&kvv, 4))	/* job_id, command and timeout */
 		return ERROR;
 
@@ -762,9 +1580,9 @@ static int wproc_run_job(struct wproc_job *job, nagios_macros *mac)
 	kvvb = build_kvvec_buf(&kvv);
 	ret = iobroker_write_packet(nagios_iobs, wp->sd, kvvb->buf, kvvb->bufsize);
 	if (ret < 0) {
-		nm_log(NSLOG_RUNTIME_ERROR, "wproc: '%s' seems to be choked. ret = %d; bufsize = %lu: errno = %d (%s)\n",
-		       wp->name, ret, kvvb->bufsize, errno, strerror(errno));
-		g_hash_table_remove(wp->jobs, GINT_TO_POINTER(job->id));
+		nm_log(NSLOG_RUNTIME_ERROR, "wproc: Failed to send job to '%s': %s\n",
+		       wp->name, iobroker_strerror(ret));
+		cancel_job(job);
 		result = ERROR;
 	} else {
 		wp->jobs_started++;
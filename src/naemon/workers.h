@@ -11,6 +11,16 @@
 #include <sys/resource.h>
 
 #define WPROC_FORCE  (1 << 0)
+#define WPROC_NOWAIT (1 << 1) /* reap a killed worker from an event, not right away */
+
+/* how jobs are spread over the workers, see worker_dispatch_policy */
+#define WPROC_DISPATCH_ROUND_ROBIN  0
+#define WPROC_DISPATCH_LEAST_LOADED 1
+#define WPROC_DISPATCH_TWO_CHOICES  2
+#define WPROC_DISPATCH_AFFINITY     3
+
+/* number of buckets in the per-worker latency histograms */
+#define WPROC_LATENCY_BUCKETS 16
 
 NAGIOS_BEGIN_DECL;
 
@@ -29,7 +39,7 @@ typedef struct wproc_result {
 	int error_code;
 	int exited_ok;
 	int early_timeout;
-	struct kvvec *response;
+	struct kvvec *response; /* NULL for workers using the binary protocol */
 	struct rusage rusage;
 } wproc_result;
 
@@ -42,8 +52,20 @@ struct load_control; /* TODO: load_control is ugly */
 void free_worker_memory(int flags);
 int workers_alive(void);
 int init_workers(int desired_workers);
+void init_worker_autoscaler(void);
+int wproc_dispatch_policy_by_name(const char *name);
+int wproc_can_run_low_priority(void);
+void wproc_flush_batches(void);
 
-int wproc_run_callback(char *cmt, int timeout, void (*cb)(struct wproc_result *, void *, int), void *data, nagios_macros *mac);
+/*
+ * Runs cmd on a worker. If this returns ERROR, the callback is never
+ * called and data is still the caller's. Otherwise the callback is
+ * called exactly once, possibly before this returns. It gets a NULL
+ * result if the job was lost without running, such as when the batch
+ * it was in couldn't be sent or the workers were shut down, so it must
+ * free data then as well.
+ */
+int wproc_run_callback(char *cmt, int timeout,void (*cb)(struct wproc_result *, void *, int), void *data, nagios_macros *mac);
 
 NAGIOS_END_DECL;
 #endif
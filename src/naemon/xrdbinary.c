@@ -0,0 +1,478 @@
+#include "config.h"
+#include "common.h"
+#include "xrdbinary.h"
+#include "objects_host.h"
+#include "objects_service.h"
+#include "objects_contact.h"
+#include "logging.h"
+#include "nm_alloc.h"
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+/* below this many records, threads cost more than they save */
+#define XRDB_PARALLEL_MIN 4096
+#define XRDB_MAX_THREADS 8
+
+/******************************************************************/
+/***************************** WRITING ****************************/
+/******************************************************************/
+
+struct binary_writer {
+	struct xrd_writer w;
+	FILE *fp;
+	GHashTable *strings; /* string -> its offset + 1 */
+	GString *strtab;
+	GArray *fields;
+	struct xrdb_record rec;
+	uint64_t records;
+	int error;
+};
+
+static uint64_t add_string(struct binary_writer *bw, const char *s)
+{
+	gpointer offset;
+
+	if (!*s)
+		return 0;
+
+	if ((offset = g_hash_table_lookup(bw->strings, s)) != NULL)
+		return GPOINTER_TO_SIZE(offset) - 1;
+
+	offset = GSIZE_TO_POINTER(bw->strtab->len + 1);
+	g_hash_table_insert(bw->strings, g_strdup(s), offset);
+	g_string_append_len(bw->strtab, s, strlen(s) + 1);
+	return GPOINTER_TO_SIZE(offset) - 1;
+}
+
+static void binary_begin(struct xrd_writer *w, int data_type, unsigned int id)
+{
+	struct binary_writer *bw = (struct binary_writer *)w;
+
+	memset(&bw->rec, 0, sizeof(bw->rec));
+	bw->rec.type = data_type;
+	bw->rec.id = id;
+	g_array_set_size(bw->fields, 0);
+}
+
+static void binary_put(struct xrd_writer *w, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	struct binary_writer *bw = (struct binary_writer *)w;
+	struct xrdb_field f;
+
+	memset(&f, 0, sizeof(f));
+	f.key = key;
+	f.kind = xrd_keys[key].kind;
+	if (customvar)
+		f.customvar = add_string(bw, customvar);
+
+	switch (xrd_keys[key].kind) {
+	case XRD_INT:
+		f.value.i = val->i;
+		break;
+	case XRD_ULONG:
+		f.value.ul = val->ul;
+		break;
+	case XRD_DOUBLE:
+		f.value.d = val->d;
+		break;
+	case XRD_STRING:
+		f.value.str = add_string(bw, val->s);
+		break;
+	}
+	g_array_append_val(bw->fields, f);
+}
+
+static void binary_end(struct xrd_writer *w)
+{
+	struct binary_writer *bw = (struct binary_writer *)w;
+
+	bw->rec.fields = bw->fields->len;
+	bw->rec.len = sizeof(bw->rec) + bw->fields->len * sizeof(struct xrdb_field);
+	if (fwrite(&bw->rec, sizeof(bw->rec), 1, bw->fp) != 1)
+		bw->error = TRUE;
+	if (bw->fields->len && fwrite(bw->fields->data, sizeof(struct xrdb_field), bw->fields->len, bw->fp) != bw->fields->len)
+		bw->error = TRUE;
+	bw->records++;
+}
+
+struct xrd_writer *xrdb_writer_open(FILE *fp)
+{
+	struct binary_writer *bw = nm_calloc(1, sizeof(*bw));
+	struct xrdb_header hdr;
+
+	bw->w.begin = binary_begin;
+	bw->w.put = binary_put;
+	bw->w.end = binary_end;
+	bw->fp = fp;
+	bw->strings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	bw->strtab = g_string_sized_new(4096);
+	bw->fields = g_array_new(FALSE, FALSE, sizeof(struct xrdb_field));
+
+	/* offset 0 is the empty string */
+	g_string_append_c(bw->strtab, 0);
+
+	/* the real header is written when we know what goes in it */
+	memset(&hdr, 0, sizeof(hdr));
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		bw->error = TRUE;
+
+	return &bw->w;
+}
+
+int xrdb_writer_close(struct xrd_writer *w)
+{
+	struct binary_writer *bw = (struct binary_writer *)w;
+	struct xrdb_header hdr;
+	long offset;
+	int result = OK;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, XRDB_MAGIC, sizeof(hdr.magic));
+	hdr.version = XRDB_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.config_hash = xrdb_config_hash();
+	hdr.records = bw->records;
+
+	if ((offset = ftell(bw->fp)) < 0)
+		bw->error = TRUE;
+	hdr.strings_offset = offset;
+	hdr.strings_size = bw->strtab->len;
+	hdr.size = hdr.strings_offset + hdr.strings_size;
+
+	if (fwrite(bw->strtab->str, 1, bw->strtab->len, bw->fp) != bw->strtab->len)
+		bw->error = TRUE;
+	if (fseek(bw->fp, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, bw->fp) != 1)
+		bw->error = TRUE;
+
+	if (bw->error) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Failed to write binary retention data: %s\n", strerror(errno));
+		result = ERROR;
+	}
+
+	g_hash_table_destroy(bw->strings);
+	g_string_free(bw->strtab, TRUE);
+	g_array_free(bw->fields, TRUE);
+	nm_free(bw);
+
+	return result;
+}
+
+/* FNV-1a, including the terminating nul so "ab"+"c" != "a"+"bc" */
+static uint64_t hash_string(uint64_t h, const char *s)
+{
+	do {
+		h ^= (unsigned char)*s;
+		h *= 1099511628211ULL;
+	} while (*s++);
+	return h;
+}
+
+uint64_t xrdb_config_hash(void)
+{
+	uint64_t h = 14695981039346656037ULL;
+	unsigned int i;
+
+	for (i = 0; i < num_objects.hosts; i++)
+		h = hash_string(h, host_ary[i]->name);
+	h = hash_string(h, "");
+	for (i = 0; i < num_objects.services; i++) {
+		h = hash_string(h, service_ary[i]->host_name);
+		h = hash_string(h, service_ary[i]->description);
+	}
+	h = hash_string(h, "");
+	for (i = 0; i < num_objects.contacts; i++)
+		h = hash_string(h, contact_ary[i]->name);
+
+	return h;
+}
+
+/******************************************************************/
+/***************************** READING ****************************/
+/******************************************************************/
+
+struct xrdb_file {
+	const char *map;
+	const struct xrdb_header *hdr;
+	const char *strings;
+	uint64_t *offsets; /* of each record */
+	void **objects; /* what each record is for */
+	char *valid;
+	int use_ids;
+};
+
+struct xrdb_shard {
+	struct xrdb_file *f;
+	uint64_t first, last;
+};
+
+int xrdb_is_binary(const char *path)
+{
+	char magic[sizeof(XRDB_MAGIC) - 1];
+	int fd;
+	ssize_t len;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return FALSE;
+	len = read(fd, magic, sizeof(magic));
+	close(fd);
+
+	return len == sizeof(magic) && !memcmp(magic, XRDB_MAGIC, sizeof(magic));
+}
+
+static inline const struct xrdb_record *record_at(struct xrdb_file *f, uint64_t i)
+{
+	return (const struct xrdb_record *)(f->map + f->offsets[i]);
+}
+
+static inline const struct xrdb_field *record_fields(const struct xrdb_record *rec)
+{
+	return (const struct xrdb_field *)(rec + 1);
+}
+
+static inline int valid_string(struct xrdb_file *f, uint64_t offset)
+{
+	return offset < f->hdr->strings_size;
+}
+
+static const char *field_string(struct xrdb_file *f, const struct xrdb_record *rec, enum xrd_key key)
+{
+	const struct xrdb_field *field = record_fields(rec);
+	uint32_t i;
+
+	for (i = 0; i < rec->fields; i++) {
+		if (field[i].key == key)
+			return f->strings + field[i].value.str;
+	}
+	return NULL;
+}
+
+/* checks a record and finds the object it is for */
+static int check_record(struct xrdb_file *f, uint64_t i)
+{
+	const struct xrdb_record *rec = record_at(f, i);
+	const struct xrdb_field *field = record_fields(rec);
+	const char *host_name, *description;
+	uint32_t x;
+
+	if (rec->type <= XRDDEFAULT_NO_DATA || rec->type >= XRDDEFAULT_NUM_DATA_TYPES)
+		return FALSE;
+
+	for (x = 0; x < rec->fields; x++) {
+		if (field[x].key <= XRD_KEY_UNKNOWN || field[x].key >= XRD_NUM_KEYS)
+			return FALSE;
+		if (field[x].kind != xrd_keys[field[x].key].kind)
+			return FALSE;
+		if (field[x].kind == XRD_STRING && !valid_string(f, field[x].value.str))
+			return FALSE;
+		if (field[x].key == XRD_KEY_CUSTOM_VARIABLE && !valid_string(f, field[x].customvar))
+			return FALSE;
+	}
+
+	/*
+	 * If the objects are the ones the file was written with, the ids
+	 * are all we need. Otherwise objects are found by name, like in
+	 * the text format.
+	 */
+	switch (rec->type) {
+	case XRDDEFAULT_HOSTSTATUS_DATA:
+		if (f->use_ids && rec->id < num_objects.hosts)
+			f->objects[i] = host_ary[rec->id];
+		else if ((host_name = field_string(f, rec, XRD_KEY_HOST_NAME)))
+			f->objects[i] = find_host(host_name);
+		break;
+	case XRDDEFAULT_SERVICESTATUS_DATA:
+		if (f->use_ids && rec->id < num_objects.services)
+			f->objects[i] = service_ary[rec->id];
+		else if ((host_name = field_string(f, rec, XRD_KEY_HOST_NAME)) && (description = field_string(f, rec, XRD_KEY_SERVICE_DESCRIPTION)))
+			f->objects[i] = find_service(host_name, description);
+		break;
+	case XRDDEFAULT_CONTACTSTATUS_DATA:
+		if (f->use_ids && rec->id < num_objects.contacts)
+			f->objects[i] = contact_ary[rec->id];
+		else if ((host_name = field_string(f, rec, XRD_KEY_CONTACT_NAME)))
+			f->objects[i] = find_contact(host_name);
+		break;
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+static gpointer check_shard(gpointer data)
+{
+	struct xrdb_shard *shard = data;
+	uint64_t i;
+
+	/* lookups only read the object tables, so shards don't interfere */
+	for (i = shard->first; i < shard->last; i++)
+		shard->f->valid[i] = check_record(shard->f, i);
+
+	return NULL;
+}
+
+static void check_records(struct xrdb_file *f, uint64_t records)
+{
+	struct xrdb_shard shards[XRDB_MAX_THREADS];
+	GThread *threads[XRDB_MAX_THREADS];
+	GError *error = NULL;
+	unsigned int nthreads = 1, i;
+
+	if (records >= XRDB_PARALLEL_MIN)
+		nthreads = MIN(MAX(g_get_num_processors(), 1), XRDB_MAX_THREADS);
+
+	/* records are in object id order, so each shard gets a contiguous range */
+	for (i = 0; i < nthreads; i++) {
+		shards[i].f = f;
+		shards[i].first = records * i / nthreads;
+		shards[i].last = records * (i + 1) / nthreads;
+	}
+
+	if (nthreads == 1) {
+		check_shard(&shards[0]);
+		return;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		threads[i] = g_thread_try_new("retention loader", check_shard, &shards[i], &error);
+		if (!threads[i]) {
+			log_debug_info(DEBUGL_RETENTIONDATA, 1, "Failed to start retention loader thread: %s\n", error->message);
+			g_clear_error(&error);
+			check_shard(&shards[i]);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		if (threads[i])
+			g_thread_join(threads[i]);
+	}
+}
+
+/* hands a checked record to the loader */
+static void apply_record(struct xrdb_file *f, uint64_t i, struct xrd_loader *ld)
+{
+	const struct xrdb_record *rec = record_at(f, i);
+	const struct xrdb_field *field = record_fields(rec);
+	struct xrd_value val;
+	uint32_t x;
+
+	xrddefault_begin_block(ld, rec->type, f->objects[i]);
+	for (x = 0; x < rec->fields; x++) {
+		memset(&val, 0, sizeof(val));
+		switch (field[x].kind) {
+		case XRD_INT:
+			val.i = field[x].value.i;
+			break;
+		case XRD_ULONG:
+			val.ul = field[x].value.ul;
+			break;
+		case XRD_DOUBLE:
+			val.d = field[x].value.d;
+			break;
+		case XRD_STRING:
+			val.s = f->strings + field[x].value.str;
+			break;
+		}
+		xrddefault_apply(ld, field[x].key, &val, f->strings + field[x].customvar);
+	}
+	xrddefault_end_block(ld);
+}
+
+static int check_header(const struct xrdb_header *hdr, size_t size)
+{
+	if (size < sizeof(*hdr) || memcmp(hdr->magic, XRDB_MAGIC, sizeof(hdr->magic)))
+		return ERROR;
+	if (hdr->version != XRDB_VERSION || hdr->header_size != sizeof(*hdr) || hdr->size != size)
+		return ERROR;
+	if (hdr->strings_offset < sizeof(*hdr) || hdr->strings_offset > size || hdr->strings_size != size - hdr->strings_offset)
+		return ERROR;
+	/* there can't be more records than fit before the strings */
+	if (hdr->records > (hdr->strings_offset - hdr->header_size) / sizeof(struct xrdb_record))
+		return ERROR;
+	/* every string ends inside the table */
+	if (!hdr->strings_size || ((const char *)hdr)[size - 1] != 0)
+		return ERROR;
+	return OK;
+}
+
+int xrdb_read(const char *path, struct xrd_loader *ld)
+{
+	struct xrdb_file f;
+	struct stat st;
+	const struct xrdb_record *rec;
+	uint64_t pos, i, records = 0, skipped = 0;
+	void *map;
+	int fd, result = OK;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return ERROR;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct xrdb_header)) {
+		close(fd);
+		return ERROR;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return ERROR;
+
+	memset(&f, 0, sizeof(f));
+	f.map = map;
+	f.hdr = map;
+	if (check_header(f.hdr, st.st_size) != OK) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Retention file '%s' is corrupt\n", path);
+		munmap(map, st.st_size);
+		return ERROR;
+	}
+	f.strings = f.map + f.hdr->strings_offset;
+	f.use_ids = f.hdr->config_hash == xrdb_config_hash();
+
+	/* finding where each record starts has to be done in order */
+	f.offsets = nm_malloc(sizeof(*f.offsets) * (f.hdr->records + 1));
+	for (pos = f.hdr->header_size; pos < f.hdr->strings_offset; pos += rec->len) {
+		rec = (const struct xrdb_record *)(f.map + pos);
+		if (records == f.hdr->records || f.hdr->strings_offset - pos < sizeof(*rec)
+		    || rec->len < sizeof(*rec) || rec->len > f.hdr->strings_offset - pos
+		    || rec->len - sizeof(*rec) != (uint64_t)rec->fields * sizeof(struct xrdb_field)) {
+			result = ERROR;
+			break;
+		}
+		f.offsets[records++] = pos;
+	}
+	if (result != OK || records != f.hdr->records) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Retention file '%s' is corrupt\n", path);
+		nm_free(f.offsets);
+		munmap(map, st.st_size);
+		return ERROR;
+	}
+
+	log_debug_info(DEBUGL_RETENTIONDATA, 2, "Reading %lu retention records, objects found by %s\n", (unsigned long)records, f.use_ids ? "id" : "name");
+
+	f.objects = nm_calloc(records ? records : 1, sizeof(*f.objects));
+	f.valid = nm_calloc(records ? records : 1, sizeof(*f.valid));
+	check_records(&f, records);
+
+	/* applying is done here, in file order, like for the text format */
+	for (i = 0; i < records; i++) {
+		rec = record_at(&f, i);
+		if (!f.valid[i]) {
+			skipped++;
+			continue;
+		}
+		/* the object is gone */
+		if (!f.objects[i] && (rec->type == XRDDEFAULT_HOSTSTATUS_DATA || rec->type == XRDDEFAULT_SERVICESTATUS_DATA || rec->type == XRDDEFAULT_CONTACTSTATUS_DATA))
+			continue;
+		apply_record(&f, i, ld);
+	}
+
+	if (skipped)
+		nm_log(NSLOG_RUNTIME_WARNING, "Warning: Skipped %lu invalid records in retention file '%s'\n", (unsigned long)skipped, path);
+
+	nm_free(f.valid);
+	nm_free(f.objects);
+	nm_free(f.offsets);
+	munmap(map, st.st_size);
+
+	return OK;
+}
@@ -0,0 +1,105 @@
+#ifndef INCLUDE_xrdbinary_h__
+#define INCLUDE_xrdbinary_h__
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include "lib/lnae-utils.h"
+#include "xrddefault.h"
+
+/*
+ * The binary retention file.
+ *
+ * It holds the same blocks and variables as the text format, but
+ * variables are stored by number (enum xrd_key) with their values
+ * already converted, and every string is stored once in a string table
+ * at the end of the file.
+ *
+ * After the header comes one record per block, each a struct
+ * xrdb_record followed by its fields. Records of hosts, services and
+ * contacts carry the object's id. The header has a hash of the names
+ * of all objects in id order; if it matches the running config, ids
+ * are used as they are, otherwise objects are looked up by name like
+ * in the text format.
+ */
+
+NAGIOS_BEGIN_DECL
+
+#define XRDB_MAGIC "NMRETAIN"
+#define XRDB_VERSION 1
+
+struct xrdb_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t size; /* of the whole file */
+	uint64_t config_hash;
+	uint64_t records;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+};
+
+/* len includes the record and all its fields */
+struct xrdb_record {
+	uint32_t len;
+	uint16_t type; /* XRDDEFAULT_*_DATA */
+	uint16_t reserved;
+	uint32_t id;
+	uint32_t fields;
+};
+
+struct xrdb_field {
+	uint16_t key;
+	uint16_t kind;
+	uint32_t customvar; /* offset of the custom variable's name */
+	union {
+		int64_t i;
+		uint64_t ul;
+		double d;
+		uint64_t str; /* offset in the string table */
+	} value;
+};
+
+/**
+ * Starts writing a binary retention file
+ * @param fp The file to write to, at its start
+ * @return A writer for xrddefault_save_state_information()
+ */
+struct xrd_writer *xrdb_writer_open(FILE *fp);
+
+/**
+ * Finishes a binary retention file and frees the writer
+ * @param w A writer from xrdb_writer_open()
+ * @return OK if the file was written completely, ERROR otherwise
+ */
+int xrdb_writer_close(struct xrd_writer *w);
+
+/**
+ * Checks if a file is a binary retention file
+ * @param path The file to check
+ * @return TRUE if it is, FALSE if it isn't or can't be read
+ */
+int xrdb_is_binary(const char *path);
+
+/**
+ * Reads a binary retention file into the loader. Records are checked
+ * and their objects looked up by several threads at once; the data is
+ * then applied in file order by the calling thread.
+ * @param path The file to read
+ * @param ld What to apply the records to
+ * @return OK on success, ERROR if the file is not a valid binary
+ *         retention file
+ */
+int xrdb_read(const char *path, struct xrd_loader *ld);
+
+/**
+ * Hashes the names of all hosts, services and contacts in id order
+ * @return The hash
+ */
+uint64_t xrdb_config_hash(void);
+
+NAGIOS_END_DECL
+#endif
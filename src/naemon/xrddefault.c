@@ -6,6 +6,7 @@
 #include "comments.h"
 #include "downtime.h"
 #include "xrddefault.h"
+#include "xrdbinary.h"
 #include "utils.h"
 #include "flapping.h"
 #include "notifications.h"
@@ -15,6 +16,7 @@
 #include "nm_alloc.h"
 #include "broker.h"
 #include <string.h>
+#include <fcntl.h>
 
 /******************************************************************/
 /********************* INIT/CLEANUP FUNCTIONS *********************/
@@ -50,24 +52,208 @@ int xrddefault_cleanup_retention_data(void)
 }
 
 
+/******************************************************************/
+/************************ RETENTION VARIABLES *********************/
+/******************************************************************/
+
+const struct xrd_key_info xrd_keys[XRD_NUM_KEYS] = {
+	[XRD_KEY_UNKNOWN] = { NULL, XRD_INT, 0 },
+	[XRD_KEY_CREATED] = { "created", XRD_ULONG, 0 },
+	[XRD_KEY_VERSION] = { "version", XRD_STRING, 0 },
+	[XRD_KEY_MODIFIED_ATTRIBUTES] = { "modified_attributes", XRD_ULONG, 0 },
+	[XRD_KEY_MODIFIED_HOST_ATTRIBUTES] = { "modified_host_attributes", XRD_ULONG, 0 },
+	[XRD_KEY_MODIFIED_SERVICE_ATTRIBUTES] = { "modified_service_attributes", XRD_ULONG, 0 },
+	[XRD_KEY_ENABLE_NOTIFICATIONS] = { "enable_notifications", XRD_INT, 0 },
+	[XRD_KEY_ACTIVE_SERVICE_CHECKS_ENABLED] = { "active_service_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_PASSIVE_SERVICE_CHECKS_ENABLED] = { "passive_service_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_ACTIVE_HOST_CHECKS_ENABLED] = { "active_host_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_PASSIVE_HOST_CHECKS_ENABLED] = { "passive_host_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_ENABLE_EVENT_HANDLERS] = { "enable_event_handlers", XRD_INT, 0 },
+	[XRD_KEY_OBSESS_OVER_SERVICES] = { "obsess_over_services", XRD_INT, 0 },
+	[XRD_KEY_OBSESS_OVER_HOSTS] = { "obsess_over_hosts", XRD_INT, 0 },
+	[XRD_KEY_CHECK_SERVICE_FRESHNESS] = { "check_service_freshness", XRD_INT, 0 },
+	[XRD_KEY_CHECK_HOST_FRESHNESS] = { "check_host_freshness", XRD_INT, 0 },
+	[XRD_KEY_ENABLE_FLAP_DETECTION] = { "enable_flap_detection", XRD_INT, 0 },
+	[XRD_KEY_PROCESS_PERFORMANCE_DATA] = { "process_performance_data", XRD_INT, 0 },
+	[XRD_KEY_GLOBAL_HOST_EVENT_HANDLER] = { "global_host_event_handler", XRD_STRING, 0 },
+	[XRD_KEY_GLOBAL_SERVICE_EVENT_HANDLER] = { "global_service_event_handler", XRD_STRING, 0 },
+	[XRD_KEY_NEXT_COMMENT_ID] = { "next_comment_id", XRD_ULONG, 0 },
+	[XRD_KEY_NEXT_DOWNTIME_ID] = { "next_downtime_id", XRD_ULONG, 0 },
+	[XRD_KEY_NEXT_EVENT_ID] = { "next_event_id", XRD_ULONG, 0 },
+	[XRD_KEY_NEXT_PROBLEM_ID] = { "next_problem_id", XRD_ULONG, 0 },
+	[XRD_KEY_NEXT_NOTIFICATION_ID] = { "next_notification_id", XRD_ULONG, 0 },
+	[XRD_KEY_HOST_NAME] = { "host_name", XRD_STRING, 0 },
+	[XRD_KEY_SERVICE_DESCRIPTION] = { "service_description", XRD_STRING, 0 },
+	[XRD_KEY_CONTACT_NAME] = { "contact_name", XRD_STRING, 0 },
+	[XRD_KEY_CHECK_COMMAND] = { "check_command", XRD_STRING, 0 },
+	[XRD_KEY_CHECK_PERIOD] = { "check_period", XRD_STRING, 0 },
+	[XRD_KEY_NOTIFICATION_PERIOD] = { "notification_period", XRD_STRING, 0 },
+	[XRD_KEY_EVENT_HANDLER] = { "event_handler", XRD_STRING, 0 },
+	[XRD_KEY_HAS_BEEN_CHECKED] = { "has_been_checked", XRD_INT, 0 },
+	[XRD_KEY_CHECK_EXECUTION_TIME] = { "check_execution_time", XRD_DOUBLE, 3 },
+	[XRD_KEY_CHECK_LATENCY] = { "check_latency", XRD_DOUBLE, 3 },
+	[XRD_KEY_CHECK_TYPE] = { "check_type", XRD_INT, 0 },
+	[XRD_KEY_CURRENT_STATE] = { "current_state", XRD_INT, 0 },
+	[XRD_KEY_LAST_STATE] = { "last_state", XRD_INT, 0 },
+	[XRD_KEY_LAST_HARD_STATE] = { "last_hard_state", XRD_INT, 0 },
+	[XRD_KEY_LAST_EVENT_ID] = { "last_event_id", XRD_ULONG, 0 },
+	[XRD_KEY_CURRENT_EVENT_ID] = { "current_event_id", XRD_ULONG, 0 },
+	[XRD_KEY_CURRENT_PROBLEM_ID] = { "current_problem_id", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_PROBLEM_ID] = { "last_problem_id", XRD_ULONG, 0 },
+	[XRD_KEY_PLUGIN_OUTPUT] = { "plugin_output", XRD_STRING, 0 },
+	[XRD_KEY_LONG_PLUGIN_OUTPUT] = { "long_plugin_output", XRD_STRING, 0 },
+	[XRD_KEY_PERFORMANCE_DATA] = { "performance_data", XRD_STRING, 0 },
+	[XRD_KEY_LAST_CHECK] = { "last_check", XRD_ULONG, 0 },
+	[XRD_KEY_NEXT_CHECK] = { "next_check", XRD_ULONG, 0 },
+	[XRD_KEY_CHECK_OPTIONS] = { "check_options", XRD_INT, 0 },
+	[XRD_KEY_CURRENT_ATTEMPT] = { "current_attempt", XRD_INT, 0 },
+	[XRD_KEY_MAX_ATTEMPTS] = { "max_attempts", XRD_INT, 0 },
+	[XRD_KEY_NORMAL_CHECK_INTERVAL] = { "normal_check_interval", XRD_DOUBLE, 6 },
+	[XRD_KEY_RETRY_CHECK_INTERVAL] = { "retry_check_interval", XRD_DOUBLE, 6 },
+	[XRD_KEY_STATE_TYPE] = { "state_type", XRD_INT, 0 },
+	[XRD_KEY_LAST_STATE_CHANGE] = { "last_state_change", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_HARD_STATE_CHANGE] = { "last_hard_state_change", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_TIME_UP] = { "last_time_up", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_TIME_DOWN] = { "last_time_down", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_TIME_UNREACHABLE] = { "last_time_unreachable", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_TIME_OK] = { "last_time_ok", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_TIME_WARNING] = { "last_time_warning", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_TIME_UNKNOWN] = { "last_time_unknown", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_TIME_CRITICAL] = { "last_time_critical", XRD_ULONG, 0 },
+	[XRD_KEY_NOTIFIED_ON_DOWN] = { "notified_on_down", XRD_INT, 0 },
+	[XRD_KEY_NOTIFIED_ON_UNREACHABLE] = { "notified_on_unreachable", XRD_INT, 0 },
+	[XRD_KEY_NOTIFIED_ON_UNKNOWN] = { "notified_on_unknown", XRD_INT, 0 },
+	[XRD_KEY_NOTIFIED_ON_WARNING] = { "notified_on_warning", XRD_INT, 0 },
+	[XRD_KEY_NOTIFIED_ON_CRITICAL] = { "notified_on_critical", XRD_INT, 0 },
+	[XRD_KEY_LAST_NOTIFICATION] = { "last_notification", XRD_ULONG, 0 },
+	[XRD_KEY_CURRENT_NOTIFICATION_NUMBER] = { "current_notification_number", XRD_INT, 0 },
+	[XRD_KEY_CURRENT_NOTIFICATION_ID] = { "current_notification_id", XRD_ULONG, 0 },
+	[XRD_KEY_CONFIG_NOTIFICATIONS_ENABLED] = { "config:notifications_enabled", XRD_INT, 0 },
+	[XRD_KEY_NOTIFICATIONS_ENABLED] = { "notifications_enabled", XRD_INT, 0 },
+	[XRD_KEY_PROBLEM_HAS_BEEN_ACKNOWLEDGED] = { "problem_has_been_acknowledged", XRD_INT, 0 },
+	[XRD_KEY_ACKNOWLEDGEMENT_TYPE] = { "acknowledgement_type", XRD_INT, 0 },
+	[XRD_KEY_CONFIG_ACTIVE_CHECKS_ENABLED] = { "config:active_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_ACTIVE_CHECKS_ENABLED] = { "active_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_CONFIG_PASSIVE_CHECKS_ENABLED] = { "config:passive_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_PASSIVE_CHECKS_ENABLED] = { "passive_checks_enabled", XRD_INT, 0 },
+	[XRD_KEY_CONFIG_EVENT_HANDLER_ENABLED] = { "config:event_handler_enabled", XRD_INT, 0 },
+	[XRD_KEY_EVENT_HANDLER_ENABLED] = { "event_handler_enabled", XRD_INT, 0 },
+	[XRD_KEY_CONFIG_FLAP_DETECTION_ENABLED] = { "config:flap_detection_enabled", XRD_INT, 0 },
+	[XRD_KEY_FLAP_DETECTION_ENABLED] = { "flap_detection_enabled", XRD_INT, 0 },
+	[XRD_KEY_CONFIG_PROCESS_PERFORMANCE_DATA] = { "config:process_performance_data", XRD_INT, 0 },
+	[XRD_KEY_CONFIG_OBSESS] = { "config:obsess", XRD_INT, 0 },
+	[XRD_KEY_OBSESS] = { "obsess", XRD_INT, 0 },
+	[XRD_KEY_IS_FLAPPING] = { "is_flapping", XRD_INT, 0 },
+	[XRD_KEY_PERCENT_STATE_CHANGE] = { "percent_state_change", XRD_DOUBLE, 2 },
+	[XRD_KEY_CHECK_FLAPPING_RECOVERY_NOTIFICATION] = { "check_flapping_recovery_notification", XRD_INT, 0 },
+	[XRD_KEY_LAST_UPDATE] = { "last_update", XRD_ULONG, 0 },
+	[XRD_KEY_STATE_HISTORY] = { "state_history", XRD_STRING, 0 },
+	[XRD_KEY_CUSTOM_VARIABLE] = { NULL, XRD_STRING, 0 },
+	[XRD_KEY_HOST_NOTIFICATION_PERIOD] = { "host_notification_period", XRD_STRING, 0 },
+	[XRD_KEY_SERVICE_NOTIFICATION_PERIOD] = { "service_notification_period", XRD_STRING, 0 },
+	[XRD_KEY_LAST_HOST_NOTIFICATION] = { "last_host_notification", XRD_ULONG, 0 },
+	[XRD_KEY_LAST_SERVICE_NOTIFICATION] = { "last_service_notification", XRD_ULONG, 0 },
+	[XRD_KEY_CONFIG_HOST_NOTIFICATIONS_ENABLED] = { "config:host_notifications_enabled", XRD_INT, 0 },
+	[XRD_KEY_HOST_NOTIFICATIONS_ENABLED] = { "host_notifications_enabled", XRD_INT, 0 },
+	[XRD_KEY_CONFIG_SERVICE_NOTIFICATIONS_ENABLED] = { "config:service_notifications_enabled", XRD_INT, 0 },
+	[XRD_KEY_SERVICE_NOTIFICATIONS_ENABLED] = { "service_notifications_enabled", XRD_INT, 0 },
+	[XRD_KEY_ENTRY_TYPE] = { "entry_type", XRD_INT, 0 },
+	[XRD_KEY_COMMENT_ID] = { "comment_id", XRD_ULONG, 0 },
+	[XRD_KEY_SOURCE] = { "source", XRD_INT, 0 },
+	[XRD_KEY_PERSISTENT] = { "persistent", XRD_INT, 0 },
+	[XRD_KEY_ENTRY_TIME] = { "entry_time", XRD_ULONG, 0 },
+	[XRD_KEY_EXPIRES] = { "expires", XRD_INT, 0 },
+	[XRD_KEY_EXPIRE_TIME] = { "expire_time", XRD_ULONG, 0 },
+	[XRD_KEY_AUTHOR] = { "author", XRD_STRING, 0 },
+	[XRD_KEY_COMMENT_DATA] = { "comment_data", XRD_STRING, 0 },
+	[XRD_KEY_DOWNTIME_ID] = { "downtime_id", XRD_ULONG, 0 },
+	[XRD_KEY_START_TIME] = { "start_time", XRD_ULONG, 0 },
+	[XRD_KEY_FLEX_DOWNTIME_START] = { "flex_downtime_start", XRD_ULONG, 0 },
+	[XRD_KEY_END_TIME] = { "end_time", XRD_ULONG, 0 },
+	[XRD_KEY_TRIGGERED_BY] = { "triggered_by", XRD_ULONG, 0 },
+	[XRD_KEY_FIXED] = { "fixed", XRD_INT, 0 },
+	[XRD_KEY_DURATION] = { "duration", XRD_ULONG, 0 },
+	[XRD_KEY_IS_IN_EFFECT] = { "is_in_effect", XRD_INT, 0 },
+	[XRD_KEY_START_NOTIFICATION_SENT] = { "start_notification_sent", XRD_INT, 0 },
+	[XRD_KEY_COMMENT] = { "comment", XRD_STRING, 0 },
+};
+
+
 /******************************************************************/
 /**************** DEFAULT STATE OUTPUT FUNCTION *******************/
 /******************************************************************/
 
-int xrddefault_save_state_information(void)
+static void put_int(struct xrd_writer *w, enum xrd_key key, int i)
+{
+	struct xrd_value v = { 0 };
+	v.i = i;
+	w->put(w, key, &v, NULL);
+}
+
+static void put_ulong(struct xrd_writer *w, enum xrd_key key, unsigned long ul)
+{
+	struct xrd_value v = { 0 };
+	v.ul = ul;
+	w->put(w, key, &v, NULL);
+}
+
+static void put_double(struct xrd_writer *w, enum xrd_key key, double d)
+{
+	struct xrd_value v = { 0 };
+	v.d = d;
+	w->put(w, key, &v, NULL);
+}
+
+static void put_str(struct xrd_writer *w, enum xrd_key key, const char *s)
+{
+	struct xrd_value v = { 0 };
+	v.s = s == NULL ? "" : s;
+	w->put(w, key, &v, NULL);
+}
+
+static void put_state_history(struct xrd_writer *w, const int *history, int index)
+{
+	char buf[MAX_STATE_HISTORY_ENTRIES * 12];
+	int x, len = 0;
+
+	buf[0] = 0;
+	for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++)
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%d", (x > 0) ? "," : "", history[(x + index) % MAX_STATE_HISTORY_ENTRIES]);
+	put_str(w, XRD_KEY_STATE_HISTORY, buf);
+}
+
+static void put_custom_variables(struct xrd_writer *w, customvariablesmember *cvar)
+{
+	struct xrd_value v = { 0 };
+	char *buf;
+
+	for (; cvar != NULL; cvar = cvar->next) {
+		if (!cvar->variable_name)
+			continue;
+		nm_asprintf(&buf, "%d;%s", cvar->has_been_modified, (cvar->variable_value == NULL) ? "" : cvar->variable_value);
+		v.s = buf;
+		w->put(w, XRD_KEY_CUSTOM_VARIABLE, &v, cvar->variable_name);
+		nm_free(buf);
+	}
+}
+
+/* the config value goes first, so the reader knows it when it gets the current one */
+#define PUT_IF_CHANGED(conf, obj, v, conf_key, key) \
+	do { \
+		if (conf && conf->v != obj->v) { \
+			put_int(w, conf_key, conf->v); \
+			put_int(w, key, obj->v); \
+		} \
+	} while(0)
+
+/* hands all retention data to a writer, one block at a time */
+static void save_state(struct xrd_writer *w)
 {
-	char *tmp_file = NULL;
-	customvariablesmember *temp_customvariablesmember = NULL;
-	time_t current_time = 0L;
-	int result = OK;
-	FILE *fp = NULL;
 	host *temp_host = NULL;
 	service *temp_service = NULL;
 	contact *temp_contact = NULL;
 	comment *temp_comment = NULL;
 	scheduled_downtime *temp_downtime = NULL;
-	int x = 0;
-	int fd = 0;
 	unsigned long host_attribute_mask = 0L;
 	unsigned long service_attribute_mask = 0L;
 	unsigned long contact_attribute_mask = 0L;
@@ -76,34 +262,6 @@ int xrddefault_save_state_information(void)
 	unsigned long process_host_attribute_mask = 0L;
 	unsigned long process_service_attribute_mask = 0L;
 
-	/* make sure we have everything */
-	if (retention_file == NULL) {
-		nm_log(NSLOG_RUNTIME_ERROR, "Error: We don't have the required file names to store retention data!\n");
-		return ERROR;
-	}
-
-	/* open a safe temp file for output */
-	nm_asprintf(&tmp_file, "%sXXXXXX", retention_file);
-	if (tmp_file == NULL)
-		return ERROR;
-	if ((fd = mkstemp(tmp_file)) == -1)
-		return ERROR;
-
-	log_debug_info(DEBUGL_RETENTIONDATA, 2, "Writing retention data to temp file '%s'\n", tmp_file);
-
-	fp = (FILE *)fdopen(fd, "w");
-	if (fp == NULL) {
-
-		close(fd);
-		unlink(tmp_file);
-
-		nm_log(NSLOG_RUNTIME_ERROR, "Error: Could not open temp state retention file '%s' for writing!\n", tmp_file);
-
-		nm_free(tmp_file);
-
-		return ERROR;
-	}
-
 	/* what attributes should be masked out? */
 	/* NOTE: host/service/contact-specific values may be added in the future, but for now we only have global masks */
 	process_host_attribute_mask = retained_process_host_attribute_mask;
@@ -113,317 +271,355 @@ int xrddefault_save_state_information(void)
 	contact_host_attribute_mask = retained_contact_host_attribute_mask;
 	contact_service_attribute_mask = retained_contact_service_attribute_mask;
 
-	/* write version info to status file */
-	fprintf(fp, "########################################\n");
-	fprintf(fp, "#      NAEMON STATE RETENTION FILE\n");
-	fprintf(fp, "#\n");
-	fprintf(fp, "# THIS FILE IS AUTOMATICALLY GENERATED\n");
-	fprintf(fp, "# BY NAEMON.  DO NOT MODIFY THIS FILE!\n");
-	fprintf(fp, "########################################\n");
-
-	time(&current_time);
-
 	/* write file info */
-	fprintf(fp, "info {\n");
-	fprintf(fp, "created=%lu\n", current_time);
-	fprintf(fp, "version=" VERSION "\n");
-	fprintf(fp, "}\n");
+	w->begin(w, XRDDEFAULT_INFO_DATA, 0);
+	put_ulong(w, XRD_KEY_CREATED, time(NULL));
+	put_str(w, XRD_KEY_VERSION, VERSION);
+	w->end(w);
 
 	/* save program state information */
-	fprintf(fp, "program {\n");
-	fprintf(fp, "modified_host_attributes=%lu\n", (modified_host_process_attributes & ~process_host_attribute_mask));
-	fprintf(fp, "modified_service_attributes=%lu\n", (modified_service_process_attributes & ~process_service_attribute_mask));
-	fprintf(fp, "enable_notifications=%d\n", enable_notifications);
-	fprintf(fp, "active_service_checks_enabled=%d\n", execute_service_checks);
-	fprintf(fp, "passive_service_checks_enabled=%d\n", accept_passive_service_checks);
-	fprintf(fp, "active_host_checks_enabled=%d\n", execute_host_checks);
-	fprintf(fp, "passive_host_checks_enabled=%d\n", accept_passive_host_checks);
-	fprintf(fp, "enable_event_handlers=%d\n", enable_event_handlers);
-	fprintf(fp, "obsess_over_services=%d\n", obsess_over_services);
-	fprintf(fp, "obsess_over_hosts=%d\n", obsess_over_hosts);
-	fprintf(fp, "check_service_freshness=%d\n", check_service_freshness);
-	fprintf(fp, "check_host_freshness=%d\n", check_host_freshness);
-	fprintf(fp, "enable_flap_detection=%d\n", enable_flap_detection);
-	fprintf(fp, "process_performance_data=%d\n", process_performance_data);
-	fprintf(fp, "global_host_event_handler=%s\n", (global_host_event_handler == NULL) ? "" : global_host_event_handler);
-	fprintf(fp, "global_service_event_handler=%s\n", (global_service_event_handler == NULL) ? "" : global_service_event_handler);
-	fprintf(fp, "next_comment_id=%lu\n", next_comment_id);
-	fprintf(fp, "next_downtime_id=%lu\n", next_downtime_id);
-	fprintf(fp, "next_event_id=%lu\n", next_event_id);
-	fprintf(fp, "next_problem_id=%lu\n", next_problem_id);
-	fprintf(fp, "next_notification_id=%lu\n", next_notification_id);
-	fprintf(fp, "}\n");
+	w->begin(w, XRDDEFAULT_PROGRAMSTATUS_DATA, 0);
+	put_ulong(w, XRD_KEY_MODIFIED_HOST_ATTRIBUTES, (modified_host_process_attributes & ~process_host_attribute_mask));
+	put_ulong(w, XRD_KEY_MODIFIED_SERVICE_ATTRIBUTES, (modified_service_process_attributes & ~process_service_attribute_mask));
+	put_int(w, XRD_KEY_ENABLE_NOTIFICATIONS, enable_notifications);
+	put_int(w, XRD_KEY_ACTIVE_SERVICE_CHECKS_ENABLED, execute_service_checks);
+	put_int(w, XRD_KEY_PASSIVE_SERVICE_CHECKS_ENABLED, accept_passive_service_checks);
+	put_int(w, XRD_KEY_ACTIVE_HOST_CHECKS_ENABLED, execute_host_checks);
+	put_int(w, XRD_KEY_PASSIVE_HOST_CHECKS_ENABLED, accept_passive_host_checks);
+	put_int(w, XRD_KEY_ENABLE_EVENT_HANDLERS, enable_event_handlers);
+	put_int(w, XRD_KEY_OBSESS_OVER_SERVICES, obsess_over_services);
+	put_int(w, XRD_KEY_OBSESS_OVER_HOSTS, obsess_over_hosts);
+	put_int(w, XRD_KEY_CHECK_SERVICE_FRESHNESS, check_service_freshness);
+	put_int(w, XRD_KEY_CHECK_HOST_FRESHNESS, check_host_freshness);
+	put_int(w, XRD_KEY_ENABLE_FLAP_DETECTION, enable_flap_detection);
+	put_int(w, XRD_KEY_PROCESS_PERFORMANCE_DATA, process_performance_data);
+	put_str(w, XRD_KEY_GLOBAL_HOST_EVENT_HANDLER, global_host_event_handler);
+	put_str(w, XRD_KEY_GLOBAL_SERVICE_EVENT_HANDLER, global_service_event_handler);
+	put_ulong(w, XRD_KEY_NEXT_COMMENT_ID, next_comment_id);
+	put_ulong(w, XRD_KEY_NEXT_DOWNTIME_ID, next_downtime_id);
+	put_ulong(w, XRD_KEY_NEXT_EVENT_ID, next_event_id);
+	put_ulong(w, XRD_KEY_NEXT_PROBLEM_ID, next_problem_id);
+	put_ulong(w, XRD_KEY_NEXT_NOTIFICATION_ID, next_notification_id);
+	w->end(w);
 
 	/* save host state information */
 	for (temp_host = host_list; temp_host != NULL; temp_host = temp_host->next) {
 		struct host *conf_host;
 		conf_host = get_premod_host(temp_host->id);
-		fprintf(fp, "host {\n");
-		fprintf(fp, "host_name=%s\n", temp_host->name);
-		fprintf(fp, "modified_attributes=%lu\n", (temp_host->modified_attributes & ~host_attribute_mask));
-		fprintf(fp, "check_command=%s\n", (temp_host->check_command == NULL) ? "" : temp_host->check_command);
-		fprintf(fp, "check_period=%s\n", (temp_host->check_period == NULL) ? "" : temp_host->check_period);
-		fprintf(fp, "notification_period=%s\n", (temp_host->notification_period == NULL) ? "" : temp_host->notification_period);
-		fprintf(fp, "event_handler=%s\n", (temp_host->event_handler == NULL) ? "" : temp_host->event_handler);
-		fprintf(fp, "has_been_checked=%d\n", temp_host->has_been_checked);
-		fprintf(fp, "check_execution_time=%.3f\n", temp_host->execution_time);
-		fprintf(fp, "check_latency=%.3f\n", temp_host->latency);
-		fprintf(fp, "check_type=%d\n", temp_host->check_type);
-		fprintf(fp, "current_state=%d\n", temp_host->current_state);
-		fprintf(fp, "last_state=%d\n", temp_host->last_state);
-		fprintf(fp, "last_hard_state=%d\n", temp_host->last_hard_state);
-		fprintf(fp, "last_event_id=%lu\n", temp_host->last_event_id);
-		fprintf(fp, "current_event_id=%lu\n", temp_host->current_event_id);
-		fprintf(fp, "current_problem_id=%lu\n", temp_host->current_problem_id);
-		fprintf(fp, "last_problem_id=%lu\n", temp_host->last_problem_id);
-		fprintf(fp, "plugin_output=%s\n", (temp_host->plugin_output == NULL) ? "" : temp_host->plugin_output);
-		fprintf(fp, "long_plugin_output=%s\n", (temp_host->long_plugin_output == NULL) ? "" : temp_host->long_plugin_output);
-		fprintf(fp, "performance_data=%s\n", (temp_host->perf_data == NULL) ? "" : temp_host->perf_data);
-		fprintf(fp, "last_check=%lu\n", temp_host->last_check);
-		fprintf(fp, "next_check=%lu\n", temp_host->next_check);
-		fprintf(fp, "check_options=%d\n", temp_host->check_options);
-		fprintf(fp, "current_attempt=%d\n", temp_host->current_attempt);
-		fprintf(fp, "max_attempts=%d\n", temp_host->max_attempts);
-		fprintf(fp, "normal_check_interval=%f\n", temp_host->check_interval);
-		fprintf(fp, "retry_check_interval=%f\n", temp_host->check_interval);
-		fprintf(fp, "state_type=%d\n", temp_host->state_type);
-		fprintf(fp, "last_state_change=%lu\n", temp_host->last_state_change);
-		fprintf(fp, "last_hard_state_change=%lu\n", temp_host->last_hard_state_change);
-		fprintf(fp, "last_time_up=%lu\n", temp_host->last_time_up);
-		fprintf(fp, "last_time_down=%lu\n", temp_host->last_time_down);
-		fprintf(fp, "last_time_unreachable=%lu\n", temp_host->last_time_unreachable);
-		fprintf(fp, "notified_on_down=%d\n", flag_isset(temp_host->notified_on, OPT_DOWN));
-		fprintf(fp, "notified_on_unreachable=%d\n", flag_isset(temp_host->notified_on, OPT_UNREACHABLE));
-		fprintf(fp, "last_notification=%lu\n", temp_host->last_notification);
-		fprintf(fp, "current_notification_number=%d\n", temp_host->current_notification_number);
-		fprintf(fp, "current_notification_id=%lu\n", temp_host->current_notification_id);
-		if (conf_host && conf_host->notifications_enabled != temp_host->notifications_enabled) {
-			fprintf(fp, "config:notifications_enabled=%d\n", conf_host->notifications_enabled);
-			fprintf(fp, "notifications_enabled=%d\n", temp_host->notifications_enabled);
-		}
-		fprintf(fp, "problem_has_been_acknowledged=%d\n", temp_host->problem_has_been_acknowledged);
-		fprintf(fp, "acknowledgement_type=%d\n", temp_host->acknowledgement_type);
-		if (conf_host && conf_host->checks_enabled != temp_host->checks_enabled) {
-			fprintf(fp, "config:active_checks_enabled=%d\n", conf_host->checks_enabled);
-			fprintf(fp, "active_checks_enabled=%d\n", temp_host->checks_enabled);
-		}
-		if (conf_host && conf_host->accept_passive_checks != temp_host->accept_passive_checks) {
-			fprintf(fp, "config:passive_checks_enabled=%d\n", conf_host->accept_passive_checks);
-			fprintf(fp, "passive_checks_enabled=%d\n", temp_host->accept_passive_checks);
-		}
-		if (conf_host && conf_host->event_handler_enabled != temp_host->event_handler_enabled) {
-			fprintf(fp, "config:event_handler_enabled=%d\n", conf_host->event_handler_enabled);
-			fprintf(fp, "event_handler_enabled=%d\n", temp_host->event_handler_enabled);
-		}
-		if (conf_host && conf_host->flap_detection_enabled != temp_host->flap_detection_enabled) {
-			fprintf(fp, "config:flap_detection_enabled=%d\n", conf_host->flap_detection_enabled);
-			fprintf(fp, "flap_detection_enabled=%d\n", temp_host->flap_detection_enabled);
-		}
-		if (conf_host && conf_host->process_performance_data != temp_host->process_performance_data) {
-			fprintf(fp, "config:process_performance_data=%d\n", conf_host->process_performance_data);
-			fprintf(fp, "process_performance_data=%d\n", temp_host->process_performance_data);
-		}
-		if (conf_host && conf_host->obsess != temp_host->obsess) {
-			fprintf(fp, "config:obsess=%d\n", conf_host->obsess);
-			fprintf(fp, "obsess=%d\n", temp_host->obsess);
-		}
-		fprintf(fp, "is_flapping=%d\n", temp_host->is_flapping);
-		fprintf(fp, "percent_state_change=%.2f\n", temp_host->percent_state_change);
-		fprintf(fp, "check_flapping_recovery_notification=%d\n", temp_host->check_flapping_recovery_notification);
-		fprintf(fp, "last_update=%lu\n", temp_host->last_update);
-
-		fprintf(fp, "state_history=");
-		for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++)
-			fprintf(fp, "%s%d", (x > 0) ? "," : "", temp_host->state_history[(x + temp_host->state_history_index) % MAX_STATE_HISTORY_ENTRIES]);
-		fprintf(fp, "\n");
-
-		/* custom variables */
-		for (temp_customvariablesmember = temp_host->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-			if (temp_customvariablesmember->variable_name)
-				fprintf(fp, "_%s=%d;%s\n", temp_customvariablesmember->variable_name, temp_customvariablesmember->has_been_modified, (temp_customvariablesmember->variable_value == NULL) ? "" : temp_customvariablesmember->variable_value);
-		}
-
-		fprintf(fp, "}\n");
-
+		w->begin(w, XRDDEFAULT_HOSTSTATUS_DATA, temp_host->id);
+		put_str(w, XRD_KEY_HOST_NAME, temp_host->name);
+		put_ulong(w, XRD_KEY_MODIFIED_ATTRIBUTES, (temp_host->modified_attributes & ~host_attribute_mask));
+		put_str(w, XRD_KEY_CHECK_COMMAND, temp_host->check_command);
+		put_str(w, XRD_KEY_CHECK_PERIOD, temp_host->check_period);
+		put_str(w, XRD_KEY_NOTIFICATION_PERIOD, temp_host->notification_period);
+		put_str(w, XRD_KEY_EVENT_HANDLER, temp_host->event_handler);
+		put_int(w, XRD_KEY_HAS_BEEN_CHECKED, temp_host->has_been_checked);
+		put_double(w, XRD_KEY_CHECK_EXECUTION_TIME, temp_host->execution_time);
+		put_double(w, XRD_KEY_CHECK_LATENCY, temp_host->latency);
+		put_int(w, XRD_KEY_CHECK_TYPE, temp_host->check_type);
+		put_int(w, XRD_KEY_CURRENT_STATE, temp_host->current_state);
+		put_int(w, XRD_KEY_LAST_STATE, temp_host->last_state);
+		put_int(w, XRD_KEY_LAST_HARD_STATE, temp_host->last_hard_state);
+		put_ulong(w, XRD_KEY_LAST_EVENT_ID, temp_host->last_event_id);
+		put_ulong(w, XRD_KEY_CURRENT_EVENT_ID, temp_host->current_event_id);
+		put_ulong(w, XRD_KEY_CURRENT_PROBLEM_ID, temp_host->current_problem_id);
+		put_ulong(w, XRD_KEY_LAST_PROBLEM_ID, temp_host->last_problem_id);
+		put_str(w, XRD_KEY_PLUGIN_OUTPUT, temp_host->plugin_output);
+		put_str(w, XRD_KEY_LONG_PLUGIN_OUTPUT, temp_host->long_plugin_output);
+		put_str(w, XRD_KEY_PERFORMANCE_DATA, temp_host->perf_data);
+		put_ulong(w, XRD_KEY_LAST_CHECK, temp_host->last_check);
+		put_ulong(w, XRD_KEY_NEXT_CHECK, temp_host->next_check);
+		put_int(w, XRD_KEY_CHECK_OPTIONS, temp_host->check_options);
+		put_int(w, XRD_KEY_CURRENT_ATTEMPT, temp_host->current_attempt);
+		put_int(w, XRD_KEY_MAX_ATTEMPTS, temp_host->max_attempts);
+		put_double(w, XRD_KEY_NORMAL_CHECK_INTERVAL, temp_host->check_interval);
+		put_double(w, XRD_KEY_RETRY_CHECK_INTERVAL, temp_host->check_interval);
+		put_int(w, XRD_KEY_STATE_TYPE, temp_host->state_type);
+		put_ulong(w, XRD_KEY_LAST_STATE_CHANGE, temp_host->last_state_change);
+		put_ulong(w, XRD_KEY_LAST_HARD_STATE_CHANGE, temp_host->last_hard_state_change);
+		put_ulong(w, XRD_KEY_LAST_TIME_UP, temp_host->last_time_up);
+		put_ulong(w, XRD_KEY_LAST_TIME_DOWN, temp_host->last_time_down);
+		put_ulong(w, XRD_KEY_LAST_TIME_UNREACHABLE, temp_host->last_time_unreachable);
+		put_int(w, XRD_KEY_NOTIFIED_ON_DOWN, flag_isset(temp_host->notified_on, OPT_DOWN));
+		put_int(w, XRD_KEY_NOTIFIED_ON_UNREACHABLE, flag_isset(temp_host->notified_on, OPT_UNREACHABLE));
+		put_ulong(w, XRD_KEY_LAST_NOTIFICATION, temp_host->last_notification);
+		put_int(w, XRD_KEY_CURRENT_NOTIFICATION_NUMBER, temp_host->current_notification_number);
+		put_ulong(w, XRD_KEY_CURRENT_NOTIFICATION_ID, temp_host->current_notification_id);
+		PUT_IF_CHANGED(conf_host, temp_host, notifications_enabled, XRD_KEY_CONFIG_NOTIFICATIONS_ENABLED, XRD_KEY_NOTIFICATIONS_ENABLED);
+		put_int(w, XRD_KEY_PROBLEM_HAS_BEEN_ACKNOWLEDGED, temp_host->problem_has_been_acknowledged);
+		put_int(w, XRD_KEY_ACKNOWLEDGEMENT_TYPE, temp_host->acknowledgement_type);
+		PUT_IF_CHANGED(conf_host, temp_host, checks_enabled, XRD_KEY_CONFIG_ACTIVE_CHECKS_ENABLED, XRD_KEY_ACTIVE_CHECKS_ENABLED);
+		PUT_IF_CHANGED(conf_host, temp_host, accept_passive_checks, XRD_KEY_CONFIG_PASSIVE_CHECKS_ENABLED, XRD_KEY_PASSIVE_CHECKS_ENABLED);
+		PUT_IF_CHANGED(conf_host, temp_host, event_handler_enabled, XRD_KEY_CONFIG_EVENT_HANDLER_ENABLED, XRD_KEY_EVENT_HANDLER_ENABLED);
+		PUT_IF_CHANGED(conf_host, temp_host, flap_detection_enabled, XRD_KEY_CONFIG_FLAP_DETECTION_ENABLED, XRD_KEY_FLAP_DETECTION_ENABLED);
+		PUT_IF_CHANGED(conf_host, temp_host, process_performance_data, XRD_KEY_CONFIG_PROCESS_PERFORMANCE_DATA, XRD_KEY_PROCESS_PERFORMANCE_DATA);
+		PUT_IF_CHANGED(conf_host, temp_host, obsess, XRD_KEY_CONFIG_OBSESS, XRD_KEY_OBSESS);
+		put_int(w, XRD_KEY_IS_FLAPPING, temp_host->is_flapping);
+		put_double(w, XRD_KEY_PERCENT_STATE_CHANGE, temp_host->percent_state_change);
+		put_int(w, XRD_KEY_CHECK_FLAPPING_RECOVERY_NOTIFICATION, temp_host->check_flapping_recovery_notification);
+		put_ulong(w, XRD_KEY_LAST_UPDATE, temp_host->last_update);
+		put_state_history(w, temp_host->state_history, temp_host->state_history_index);
+		put_custom_variables(w, temp_host->custom_variables);
+		w->end(w);
 	}
 
 	/* save service state information */
 	for (temp_service = service_list; temp_service != NULL; temp_service = temp_service->next) {
 		struct service *conf_svc;
 		conf_svc = get_premod_service(temp_service->id);
-		fprintf(fp, "service {\n");
-		fprintf(fp, "host_name=%s\n", temp_service->host_name);
-		fprintf(fp, "service_description=%s\n", temp_service->description);
-		fprintf(fp, "modified_attributes=%lu\n", (temp_service->modified_attributes & ~service_attribute_mask));
-		fprintf(fp, "check_command=%s\n", (temp_service->check_command == NULL) ? "" : temp_service->check_command);
-		fprintf(fp, "check_period=%s\n", (temp_service->check_period == NULL) ? "" : temp_service->check_period);
-		fprintf(fp, "notification_period=%s\n", (temp_service->notification_period == NULL) ? "" : temp_service->notification_period);
-		fprintf(fp, "event_handler=%s\n", (temp_service->event_handler == NULL) ? "" : temp_service->event_handler);
-		fprintf(fp, "has_been_checked=%d\n", temp_service->has_been_checked);
-		fprintf(fp, "check_execution_time=%.3f\n", temp_service->execution_time);
-		fprintf(fp, "check_latency=%.3f\n", temp_service->latency);
-		fprintf(fp, "check_type=%d\n", temp_service->check_type);
-		fprintf(fp, "current_state=%d\n", temp_service->current_state);
-		fprintf(fp, "last_state=%d\n", temp_service->last_state);
-		fprintf(fp, "last_hard_state=%d\n", temp_service->last_hard_state);
-		fprintf(fp, "last_event_id=%lu\n", temp_service->last_event_id);
-		fprintf(fp, "current_event_id=%lu\n", temp_service->current_event_id);
-		fprintf(fp, "current_problem_id=%lu\n", temp_service->current_problem_id);
-		fprintf(fp, "last_problem_id=%lu\n", temp_service->last_problem_id);
-		fprintf(fp, "current_attempt=%d\n", temp_service->current_attempt);
-		fprintf(fp, "max_attempts=%d\n", temp_service->max_attempts);
-		fprintf(fp, "normal_check_interval=%f\n", temp_service->check_interval);
-		fprintf(fp, "retry_check_interval=%f\n", temp_service->retry_interval);
-		fprintf(fp, "state_type=%d\n", temp_service->state_type);
-		fprintf(fp, "last_state_change=%lu\n", temp_service->last_state_change);
-		fprintf(fp, "last_hard_state_change=%lu\n", temp_service->last_hard_state_change);
-		fprintf(fp, "last_time_ok=%lu\n", temp_service->last_time_ok);
-		fprintf(fp, "last_time_warning=%lu\n", temp_service->last_time_warning);
-		fprintf(fp, "last_time_unknown=%lu\n", temp_service->last_time_unknown);
-		fprintf(fp, "last_time_critical=%lu\n", temp_service->last_time_critical);
-		fprintf(fp, "plugin_output=%s\n", (temp_service->plugin_output == NULL) ? "" : temp_service->plugin_output);
-		fprintf(fp, "long_plugin_output=%s\n", (temp_service->long_plugin_output == NULL) ? "" : temp_service->long_plugin_output);
-		fprintf(fp, "performance_data=%s\n", (temp_service->perf_data == NULL) ? "" : temp_service->perf_data);
-		fprintf(fp, "last_check=%lu\n", temp_service->last_check);
-		fprintf(fp, "next_check=%lu\n", temp_service->next_check);
-		fprintf(fp, "check_options=%d\n", temp_service->check_options);
-		fprintf(fp, "notified_on_unknown=%d\n", flag_isset(temp_service->notified_on, OPT_UNKNOWN));
-		fprintf(fp, "notified_on_warning=%d\n", flag_isset(temp_service->notified_on, OPT_WARNING));
-		fprintf(fp, "notified_on_critical=%d\n", flag_isset(temp_service->notified_on, OPT_CRITICAL));
-		fprintf(fp, "current_notification_number=%d\n", temp_service->current_notification_number);
-		fprintf(fp, "current_notification_id=%lu\n", temp_service->current_notification_id);
-		fprintf(fp, "last_notification=%lu\n", temp_service->last_notification);
-		if (conf_svc && conf_svc->notifications_enabled != temp_service->notifications_enabled) {
-			fprintf(fp, "config:notifications_enabled=%d\n", conf_svc->notifications_enabled);
-			fprintf(fp, "notifications_enabled=%d\n", temp_service->notifications_enabled);
-		}
-		if (conf_svc && conf_svc->checks_enabled != temp_service->checks_enabled) {
-			fprintf(fp, "config:active_checks_enabled=%d\n", conf_svc->checks_enabled);
-			fprintf(fp, "active_checks_enabled=%d\n", temp_service->checks_enabled);
-		}
-		if (conf_svc && conf_svc->accept_passive_checks != temp_service->accept_passive_checks) {
-			fprintf(fp, "config:passive_checks_enabled=%d\n", conf_svc->accept_passive_checks);
-			fprintf(fp, "passive_checks_enabled=%d\n", temp_service->accept_passive_checks);
-		}
-		if (conf_svc && conf_svc->event_handler_enabled != temp_service->event_handler_enabled) {
-			fprintf(fp, "config:event_handler_enabled=%d\n", conf_svc->event_handler_enabled);
-			fprintf(fp, "event_handler_enabled=%d\n", temp_service->event_handler_enabled);
-		}
-		fprintf(fp, "problem_has_been_acknowledged=%d\n", temp_service->problem_has_been_acknowledged);
-		fprintf(fp, "acknowledgement_type=%d\n", temp_service->acknowledgement_type);
-		if (conf_svc && conf_svc->flap_detection_enabled != temp_service->flap_detection_enabled) {
-			fprintf(fp, "config:flap_detection_enabled=%d\n", conf_svc->flap_detection_enabled);
-			fprintf(fp, "flap_detection_enabled=%d\n", temp_service->flap_detection_enabled);
-		}
-		if (conf_svc && conf_svc->process_performance_data != temp_service->process_performance_data) {
-			fprintf(fp, "config:process_performance_data=%d\n", conf_svc->process_performance_data);
-			fprintf(fp, "process_performance_data=%d\n", temp_service->process_performance_data);
-		}
-		if (conf_svc && conf_svc->obsess != temp_service->obsess) {
-			fprintf(fp, "config:obsess=%d\n", conf_svc->obsess);
-			fprintf(fp, "obsess=%d\n", temp_service->obsess);
-		}
-		fprintf(fp, "last_update=%lu\n", temp_service->last_update);
-		fprintf(fp, "is_flapping=%d\n", temp_service->is_flapping);
-		fprintf(fp, "percent_state_change=%.2f\n", temp_service->percent_state_change);
-		fprintf(fp, "check_flapping_recovery_notification=%d\n", temp_service->check_flapping_recovery_notification);
-		fprintf(fp, "state_history=");
-		for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++)
-			fprintf(fp, "%s%d", (x > 0) ? "," : "", temp_service->state_history[(x + temp_service->state_history_index) % MAX_STATE_HISTORY_ENTRIES]);
-		fprintf(fp, "\n");
-
-		/* custom variables */
-		for (temp_customvariablesmember = temp_service->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-			if (temp_customvariablesmember->variable_name)
-				fprintf(fp, "_%s=%d;%s\n", temp_customvariablesmember->variable_name, temp_customvariablesmember->has_been_modified, (temp_customvariablesmember->variable_value == NULL) ? "" : temp_customvariablesmember->variable_value);
-		}
-
-		fprintf(fp, "}\n");
+		w->begin(w, XRDDEFAULT_SERVICESTATUS_DATA, temp_service->id);
+		put_str(w, XRD_KEY_HOST_NAME, temp_service->host_name);
+		put_str(w, XRD_KEY_SERVICE_DESCRIPTION, temp_service->description);
+		put_ulong(w, XRD_KEY_MODIFIED_ATTRIBUTES, (temp_service->modified_attributes & ~service_attribute_mask));
+		put_str(w, XRD_KEY_CHECK_COMMAND, temp_service->check_command);
+		put_str(w, XRD_KEY_CHECK_PERIOD, temp_service->check_period);
+		put_str(w, XRD_KEY_NOTIFICATION_PERIOD, temp_service->notification_period);
+		put_str(w, XRD_KEY_EVENT_HANDLER, temp_service->event_handler);
+		put_int(w, XRD_KEY_HAS_BEEN_CHECKED, temp_service->has_been_checked);
+		put_double(w, XRD_KEY_CHECK_EXECUTION_TIME, temp_service->execution_time);
+		put_double(w, XRD_KEY_CHECK_LATENCY, temp_service->latency);
+		put_int(w, XRD_KEY_CHECK_TYPE, temp_service->check_type);
+		put_int(w, XRD_KEY_CURRENT_STATE, temp_service->current_state);
+		put_int(w, XRD_KEY_LAST_STATE, temp_service->last_state);
+		put_int(w, XRD_KEY_LAST_HARD_STATE, temp_service->last_hard_state);
+		put_ulong(w, XRD_KEY_LAST_EVENT_ID, temp_service->last_event_id);
+		put_ulong(w, XRD_KEY_CURRENT_EVENT_ID, temp_service->current_event_id);
+		put_ulong(w, XRD_KEY_CURRENT_PROBLEM_ID, temp_service->current_problem_id);
+		put_ulong(w, XRD_KEY_LAST_PROBLEM_ID, temp_service->last_problem_id);
+		put_int(w, XRD_KEY_CURRENT_ATTEMPT, temp_service->current_attempt);
+		put_int(w, XRD_KEY_MAX_ATTEMPTS, temp_service->max_attempts);
+		put_double(w, XRD_KEY_NORMAL_CHECK_INTERVAL, temp_service->check_interval);
+		put_double(w, XRD_KEY_RETRY_CHECK_INTERVAL, temp_service->retry_interval);
+		put_int(w, XRD_KEY_STATE_TYPE, temp_service->state_type);
+		put_ulong(w, XRD_KEY_LAST_STATE_CHANGE, temp_service->last_state_change);
+		put_ulong(w, XRD_KEY_LAST_HARD_STATE_CHANGE, temp_service->last_hard_state_change);
+		put_ulong(w, XRD_KEY_LAST_TIME_OK, temp_service->last_time_ok);
+		put_ulong(w, XRD_KEY_LAST_TIME_WARNING, temp_service->last_time_warning);
+		put_ulong(w, XRD_KEY_LAST_TIME_UNKNOWN, temp_service->last_time_unknown);
+		put_ulong(w, XRD_KEY_LAST_TIME_CRITICAL, temp_service->last_time_critical);
+		put_str(w, XRD_KEY_PLUGIN_OUTPUT, temp_service->plugin_output);
+		put_str(w, XRD_KEY_LONG_PLUGIN_OUTPUT, temp_service->long_plugin_output);
+		put_str(w, XRD_KEY_PERFORMANCE_DATA, temp_service->perf_data);
+		put_ulong(w, XRD_KEY_LAST_CHECK, temp_service->last_check);
+		put_ulong(w, XRD_KEY_NEXT_CHECK, temp_service->next_check);
+		put_int(w, XRD_KEY_CHECK_OPTIONS, temp_service->check_options);
+		put_int(w, XRD_KEY_NOTIFIED_ON_UNKNOWN, flag_isset(temp_service->notified_on, OPT_UNKNOWN));
+		put_int(w, XRD_KEY_NOTIFIED_ON_WARNING, flag_isset(temp_service->notified_on, OPT_WARNING));
+		put_int(w, XRD_KEY_NOTIFIED_ON_CRITICAL, flag_isset(temp_service->notified_on, OPT_CRITICAL));
+		put_int(w, XRD_KEY_CURRENT_NOTIFICATION_NUMBER, temp_service->current_notification_number);
+		put_ulong(w, XRD_KEY_CURRENT_NOTIFICATION_ID, temp_service->current_notification_id);
+		put_ulong(w, XRD_KEY_LAST_NOTIFICATION, temp_service->last_notification);
+		PUT_IF_CHANGED(conf_svc, temp_service, notifications_enabled, XRD_KEY_CONFIG_NOTIFICATIONS_ENABLED, XRD_KEY_NOTIFICATIONS_ENABLED);
+		PUT_IF_CHANGED(conf_svc, temp_service, checks_enabled, XRD_KEY_CONFIG_ACTIVE_CHECKS_ENABLED, XRD_KEY_ACTIVE_CHECKS_ENABLED);
+		PUT_IF_CHANGED(conf_svc, temp_service, accept_passive_checks, XRD_KEY_CONFIG_PASSIVE_CHECKS_ENABLED, XRD_KEY_PASSIVE_CHECKS_ENABLED);
+		PUT_IF_CHANGED(conf_svc, temp_service, event_handler_enabled, XRD_KEY_CONFIG_EVENT_HANDLER_ENABLED, XRD_KEY_EVENT_HANDLER_ENABLED);
+		put_int(w, XRD_KEY_PROBLEM_HAS_BEEN_ACKNOWLEDGED, temp_service->problem_has_been_acknowledged);
+		put_int(w, XRD_KEY_ACKNOWLEDGEMENT_TYPE, temp_service->acknowledgement_type);
+		PUT_IF_CHANGED(conf_svc, temp_service, flap_detection_enabled, XRD_KEY_CONFIG_FLAP_DETECTION_ENABLED, XRD_KEY_FLAP_DETECTION_ENABLED);
+		PUT_IF_CHANGED(conf_svc, temp_service, process_performance_data, XRD_KEY_CONFIG_PROCESS_PERFORMANCE_DATA, XRD_KEY_PROCESS_PERFORMANCE_DATA);
+		PUT_IF_CHANGED(conf_svc, temp_service, obsess, XRD_KEY_CONFIG_OBSESS, XRD_KEY_OBSESS);
+		put_ulong(w, XRD_KEY_LAST_UPDATE, temp_service->last_update);
+		put_int(w, XRD_KEY_IS_FLAPPING, temp_service->is_flapping);
+		put_double(w, XRD_KEY_PERCENT_STATE_CHANGE, temp_service->percent_state_change);
+		put_int(w, XRD_KEY_CHECK_FLAPPING_RECOVERY_NOTIFICATION, temp_service->check_flapping_recovery_notification);
+		put_state_history(w, temp_service->state_history, temp_service->state_history_index);
+		put_custom_variables(w, temp_service->custom_variables);
+		w->end(w);
 	}
 
 	/* save contact state information */
 	for (temp_contact = contact_list; temp_contact != NULL; temp_contact = temp_contact->next) {
 		struct contact *conf_cont;
 		conf_cont = get_premod_contact(temp_contact->id);
-
-		fprintf(fp, "contact {\n");
-		fprintf(fp, "contact_name=%s\n", temp_contact->name);
-		fprintf(fp, "modified_attributes=%lu\n", (temp_contact->modified_attributes & ~contact_attribute_mask));
-		fprintf(fp, "modified_host_attributes=%lu\n", (temp_contact->modified_host_attributes & ~contact_host_attribute_mask));
-		fprintf(fp, "modified_service_attributes=%lu\n", (temp_contact->modified_service_attributes & ~contact_service_attribute_mask));
-		fprintf(fp, "host_notification_period=%s\n", (temp_contact->host_notification_period == NULL) ? "" : temp_contact->host_notification_period);
-		fprintf(fp, "service_notification_period=%s\n", (temp_contact->service_notification_period == NULL) ? "" : temp_contact->service_notification_period);
-		fprintf(fp, "last_host_notification=%lu\n", temp_contact->last_host_notification);
-		fprintf(fp, "last_service_notification=%lu\n", temp_contact->last_service_notification);
-		if (conf_cont && conf_cont->host_notifications_enabled != temp_contact->host_notifications_enabled) {
-			fprintf(fp, "config:host_notifications_enabled=%d\n", conf_cont->host_notifications_enabled);
-			fprintf(fp, "host_notifications_enabled=%d\n", temp_contact->host_notifications_enabled);
-		}
-		if (conf_cont && conf_cont->service_notifications_enabled != temp_contact->service_notifications_enabled) {
-			fprintf(fp, "config:service_notifications_enabled=%d\n", conf_cont->service_notifications_enabled);
-			fprintf(fp, "service_notifications_enabled=%d\n", temp_contact->service_notifications_enabled);
-		}
-
-		/* custom variables */
-		for (temp_customvariablesmember = temp_contact->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-			if (temp_customvariablesmember->variable_name)
-				fprintf(fp, "_%s=%d;%s\n", temp_customvariablesmember->variable_name, temp_customvariablesmember->has_been_modified, (temp_customvariablesmember->variable_value == NULL) ? "" : temp_customvariablesmember->variable_value);
-		}
-
-		fprintf(fp, "}\n");
+		w->begin(w, XRDDEFAULT_CONTACTSTATUS_DATA, temp_contact->id);
+		put_str(w, XRD_KEY_CONTACT_NAME, temp_contact->name);
+		put_ulong(w, XRD_KEY_MODIFIED_ATTRIBUTES, (temp_contact->modified_attributes & ~contact_attribute_mask));
+		put_ulong(w, XRD_KEY_MODIFIED_HOST_ATTRIBUTES, (temp_contact->modified_host_attributes & ~contact_host_attribute_mask));
+		put_ulong(w, XRD_KEY_MODIFIED_SERVICE_ATTRIBUTES, (temp_contact->modified_service_attributes & ~contact_service_attribute_mask));
+		put_str(w, XRD_KEY_HOST_NOTIFICATION_PERIOD, temp_contact->host_notification_period);
+		put_str(w, XRD_KEY_SERVICE_NOTIFICATION_PERIOD, temp_contact->service_notification_period);
+		put_ulong(w, XRD_KEY_LAST_HOST_NOTIFICATION, temp_contact->last_host_notification);
+		put_ulong(w, XRD_KEY_LAST_SERVICE_NOTIFICATION, temp_contact->last_service_notification);
+		PUT_IF_CHANGED(conf_cont, temp_contact, host_notifications_enabled, XRD_KEY_CONFIG_HOST_NOTIFICATIONS_ENABLED, XRD_KEY_HOST_NOTIFICATIONS_ENABLED);
+		PUT_IF_CHANGED(conf_cont, temp_contact, service_notifications_enabled, XRD_KEY_CONFIG_SERVICE_NOTIFICATIONS_ENABLED, XRD_KEY_SERVICE_NOTIFICATIONS_ENABLED);
+		put_custom_variables(w, temp_contact->custom_variables);
+		w->end(w);
 	}
 
 	/* save all comments */
 	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = temp_comment->next) {
-
-		if (temp_comment->comment_type == HOST_COMMENT)
-			fprintf(fp, "hostcomment {\n");
-		else
-			fprintf(fp, "servicecomment {\n");
-		fprintf(fp, "host_name=%s\n", temp_comment->host_name);
+		w->begin(w, temp_comment->comment_type == HOST_COMMENT ? XRDDEFAULT_HOSTCOMMENT_DATA : XRDDEFAULT_SERVICECOMMENT_DATA, 0);
+		put_str(w, XRD_KEY_HOST_NAME, temp_comment->host_name);
 		if (temp_comment->comment_type == SERVICE_COMMENT)
-			fprintf(fp, "service_description=%s\n", temp_comment->service_description);
-		fprintf(fp, "entry_type=%d\n", temp_comment->entry_type);
-		fprintf(fp, "comment_id=%lu\n", temp_comment->comment_id);
-		fprintf(fp, "source=%d\n", temp_comment->source);
-		fprintf(fp, "persistent=%d\n", temp_comment->persistent);
-		fprintf(fp, "entry_time=%lu\n", temp_comment->entry_time);
-		fprintf(fp, "expires=%d\n", temp_comment->expires);
-		fprintf(fp, "expire_time=%lu\n", temp_comment->expire_time);
-		fprintf(fp, "author=%s\n", temp_comment->author);
-		fprintf(fp, "comment_data=%s\n", temp_comment->comment_data);
-		fprintf(fp, "}\n");
+			put_str(w, XRD_KEY_SERVICE_DESCRIPTION, temp_comment->service_description);
+		put_int(w, XRD_KEY_ENTRY_TYPE, temp_comment->entry_type);
+		put_ulong(w, XRD_KEY_COMMENT_ID, temp_comment->comment_id);
+		put_int(w, XRD_KEY_SOURCE, temp_comment->source);
+		put_int(w, XRD_KEY_PERSISTENT, temp_comment->persistent);
+		put_ulong(w, XRD_KEY_ENTRY_TIME, temp_comment->entry_time);
+		put_int(w, XRD_KEY_EXPIRES, temp_comment->expires);
+		put_ulong(w, XRD_KEY_EXPIRE_TIME, temp_comment->expire_time);
+		put_str(w, XRD_KEY_AUTHOR, temp_comment->author);
+		put_str(w, XRD_KEY_COMMENT_DATA, temp_comment->comment_data);
+		w->end(w);
 	}
 
 	/* save all downtime */
 	for (temp_downtime = scheduled_downtime_list; temp_downtime != NULL; temp_downtime = temp_downtime->next) {
-
-		if (temp_downtime->type == HOST_DOWNTIME)
-			fprintf(fp, "hostdowntime {\n");
-		else
-			fprintf(fp, "servicedowntime {\n");
-		fprintf(fp, "host_name=%s\n", temp_downtime->host_name);
+		w->begin(w, temp_downtime->type == HOST_DOWNTIME ? XRDDEFAULT_HOSTDOWNTIME_DATA : XRDDEFAULT_SERVICEDOWNTIME_DATA, 0);
+		put_str(w, XRD_KEY_HOST_NAME, temp_downtime->host_name);
 		if (temp_downtime->type == SERVICE_DOWNTIME)
-			fprintf(fp, "service_description=%s\n", temp_downtime->service_description);
-		fprintf(fp, "comment_id=%lu\n", temp_downtime->comment_id);
-		fprintf(fp, "downtime_id=%lu\n", temp_downtime->downtime_id);
-		fprintf(fp, "entry_time=%lu\n", temp_downtime->entry_time);
-		fprintf(fp, "start_time=%lu\n", temp_downtime->start_time);
-		fprintf(fp, "flex_downtime_start=%lu\n", temp_downtime->flex_downtime_start);
-		fprintf(fp, "end_time=%lu\n", temp_downtime->end_time);
-		fprintf(fp, "triggered_by=%lu\n", temp_downtime->triggered_by);
-		fprintf(fp, "fixed=%d\n", temp_downtime->fixed);
-		fprintf(fp, "duration=%lu\n", temp_downtime->duration);
-		fprintf(fp, "is_in_effect=%d\n", temp_downtime->is_in_effect);
-		fprintf(fp, "start_notification_sent=%d\n", temp_downtime->start_notification_sent);
-		fprintf(fp, "author=%s\n", temp_downtime->author);
-		fprintf(fp, "comment=%s\n", temp_downtime->comment);
-		fprintf(fp, "}\n");
+			put_str(w, XRD_KEY_SERVICE_DESCRIPTION, temp_downtime->service_description);
+		put_ulong(w, XRD_KEY_COMMENT_ID, temp_downtime->comment_id);
+		put_ulong(w, XRD_KEY_DOWNTIME_ID, temp_downtime->downtime_id);
+		put_ulong(w, XRD_KEY_ENTRY_TIME, temp_downtime->entry_time);
+		put_ulong(w, XRD_KEY_START_TIME, temp_downtime->start_time);
+		put_ulong(w, XRD_KEY_FLEX_DOWNTIME_START, temp_downtime->flex_downtime_start);
+		put_ulong(w, XRD_KEY_END_TIME, temp_downtime->end_time);
+		put_ulong(w, XRD_KEY_TRIGGERED_BY, temp_downtime->triggered_by);
+		put_int(w, XRD_KEY_FIXED, temp_downtime->fixed);
+		put_ulong(w, XRD_KEY_DURATION, temp_downtime->duration);
+		put_int(w, XRD_KEY_IS_IN_EFFECT, temp_downtime->is_in_effect);
+		put_int(w, XRD_KEY_START_NOTIFICATION_SENT, temp_downtime->start_notification_sent);
+		put_str(w, XRD_KEY_AUTHOR, temp_downtime->author);
+		put_str(w, XRD_KEY_COMMENT, temp_downtime->comment);
+		w->end(w);
+	}
+}
+
+/* the text format */
+struct text_writer {
+	struct xrd_writer w;
+	FILE *fp;
+};
+
+static const char *block_names[XRDDEFAULT_NUM_DATA_TYPES] = {
+	NULL, "info", "program", "host", "service", "contact",
+	"hostcomment", "servicecomment", "hostdowntime", "servicedowntime",
+};
+
+static void text_begin(struct xrd_writer *w, int data_type, unsigned int id)
+{
+	struct text_writer *tw = (struct text_writer *)w;
+	(void)id;
+	fprintf(tw->fp, "%s {\n", block_names[data_type]);
+}
+
+static void text_put(struct xrd_writer *w, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	struct text_writer *tw = (struct text_writer *)w;
+
+	if (key == XRD_KEY_CUSTOM_VARIABLE) {
+		fprintf(tw->fp, "_%s=%s\n", customvar, val->s);
+		return;
+	}
+
+	switch (xrd_keys[key].kind) {
+	case XRD_INT:
+		fprintf(tw->fp, "%s=%d\n", xrd_keys[key].name, val->i);
+		break;
+	case XRD_ULONG:
+		fprintf(tw->fp, "%s=%lu\n", xrd_keys[key].name, val->ul);
+		break;
+	case XRD_DOUBLE:
+		fprintf(tw->fp, "%s=%.*f\n", xrd_keys[key].name, xrd_keys[key].precision, val->d);
+		break;
+	case XRD_STRING:
+		fprintf(tw->fp, "%s=%s\n", xrd_keys[key].name, val->s);
+		break;
+	}
+}
+
+static void text_end(struct xrd_writer *w)
+{
+	struct text_writer *tw = (struct text_writer *)w;
+	fprintf(tw->fp, "}\n");
+}
+
+/* makes the rename of the new retention file stick */
+static void sync_retention_dir(void)
+{
+	char *dir, *slash;
+	int fd;
+
+	dir = nm_strdup(retention_file);
+	if ((slash = strrchr(dir, '/')) == NULL) {
+		strcpy(dir, ".");
+	} else if (slash == dir) {
+		slash[1] = 0;
+	} else {
+		*slash = 0;
+	}
+
+	if ((fd = open(dir, O_RDONLY)) >= 0) {
+		if (fsync(fd) < 0)
+			log_debug_info(DEBUGL_RETENTIONDATA, 1, "Failed to sync directory '%s': %s\n", dir, strerror(errno));
+		close(fd);
+	}
+	nm_free(dir);
+}
+
+int xrddefault_save_state_information(void)
+{
+	char *tmp_file = NULL;
+	int result = OK;
+	FILE *fp = NULL;
+	int fd = 0;
+	struct text_writer tw;
+	struct xrd_writer *bw;
+
+	/* make sure we have everything */
+	if (retention_file == NULL) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: We don't have the required file names to store retention data!\n");
+		return ERROR;
+	}
+
+	/* open a safe temp file for output */
+	nm_asprintf(&tmp_file, "%sXXXXXX", retention_file);
+	if (tmp_file == NULL)
+		return ERROR;
+	if ((fd = mkstemp(tmp_file)) == -1)
+		return ERROR;
+
+	log_debug_info(DEBUGL_RETENTIONDATA, 2, "Writing retention data to temp file '%s'\n", tmp_file);
+
+	fp = (FILE *)fdopen(fd, "w");
+	if (fp == NULL) {
+
+		close(fd);
+		unlink(tmp_file);
+
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Could not open temp state retention file '%s' for writing!\n", tmp_file);
+
+		nm_free(tmp_file);
+
+		return ERROR;
+	}
+
+	if (binary_retention == TRUE) {
+		bw = xrdb_writer_open(fp);
+		save_state(bw);
+		result = xrdb_writer_close(bw) == OK ? 0 : -1;
+	} else {
+		/* write version info to status file */
+		fprintf(fp, "########################################\n");
+		fprintf(fp, "#      NAEMON STATE RETENTION FILE\n");
+		fprintf(fp, "#\n");
+		fprintf(fp, "# THIS FILE IS AUTOMATICALLY GENERATED\n");
+		fprintf(fp, "# BY NAEMON.  DO NOT MODIFY THIS FILE!\n");
+		fprintf(fp, "########################################\n");
+
+		tw.w.begin = text_begin;
+		tw.w.put = text_put;
+		tw.w.end = text_end;
+		tw.fp = fp;
+		save_state(&tw.w);
 	}
 
 	fflush(fp);
-	fsync(fd);
-	result = ferror(fp) | fclose(fp);
+	if (retention_fsync == TRUE)
+		result |= fsync(fd);
+	result |= ferror(fp) | fclose(fp);
 
 	/* save/close was successful */
 	if (result == 0) {
@@ -435,6 +631,8 @@ int xrddefault_save_state_information(void)
 			unlink(tmp_file);
 			nm_log(NSLOG_RUNTIME_ERROR, "Error: Unable to update retention file '%s': %s", retention_file, strerror(errno));
 			result = ERROR;
+		} else if (retention_fsync == TRUE) {
+			sync_retention_dir();
 		}
 	}
 
@@ -457,1183 +655,1450 @@ int xrddefault_save_state_information(void)
 /******************************************************************/
 /***************** DEFAULT STATE INPUT FUNCTION *******************/
 /******************************************************************/
+
+/* what we know about the block being read */
+struct xrd_loader {
+	int data_type;
+	host *hst;
+	service *svc;
+	contact *cntct;
+	char *host_name;
+	char *service_description;
+	char *author;
+	char *comment_data;
+	unsigned long comment_id;
+	int persistent;
+	int expires;
+	time_t expire_time;
+	int entry_type;
+	int source;
+	time_t entry_time;
+	unsigned long downtime_id;
+	time_t start_time;
+	time_t flex_downtime_start;
+	time_t end_time;
+	int fixed;
+	unsigned long triggered_by;
+	unsigned long duration;
+	int is_in_effect;
+	int start_notification_sent;
+	int scheduling_info_is_ok;
+	unsigned long host_attribute_mask;
+	unsigned long service_attribute_mask;
+	unsigned long contact_attribute_mask;
+	unsigned long contact_host_attribute_mask;
+	unsigned long contact_service_attribute_mask;
+	unsigned long process_host_attribute_mask;
+	unsigned long process_service_attribute_mask;
+	struct host conf, have;
+	struct contact cont_conf, cont_have;
+};
+
 #define RETAIN_BOOL(type, obj, v, attr) \
 	do { \
-		if ((obj->modified_attributes & attr && !have.v) || (have.v && conf.v == obj->v)) { \
-			printf("Retaining boolean " #v " for " #type " (%s) (conf.v = %d; have.v = %d)\n", val, conf.v, have.v); \
+		if ((obj->modified_attributes & attr && !ld->have.v) || (ld->have.v && ld->conf.v == obj->v)) { \
+			log_debug_info(DEBUGL_RETENTIONDATA, 2, "Retaining boolean " #v " for " #type " (%d) (conf.v = %d; have.v = %d)\n", val->i, ld->conf.v, ld->have.v); \
 			pre_modify_##type##_attribute(obj, attr); \
-			obj->v = atoi(val) > 0 ? TRUE : FALSE; \
+			obj->v = val->i > 0 ? TRUE : FALSE; \
 		} \
 	} while(0)
 
-int xrddefault_read_state_information(void)
+static void load_state_history(int *history, int *index, const char *val)
 {
-	char *input = NULL;
-	char *inputbuf = NULL;
-	char *temp_ptr = NULL;
-	mmapfile *thefile;
-	char *host_name = NULL;
-	char *service_description = NULL;
-	char *contact_name = NULL;
-	char *author = NULL;
-	char *comment_data = NULL;
-	int data_type = XRDDEFAULT_NO_DATA;
-	int x = 0;
-	host *temp_host = NULL;
-	service *temp_service = NULL;
-	contact *temp_contact = NULL;
-	command *temp_command = NULL;
-	timeperiod *temp_timeperiod = NULL;
-	customvariablesmember *temp_customvariablesmember = NULL;
-	char *customvarname = NULL;
-	char *var = NULL;
-	char *val = NULL;
-	char *tempval = NULL;
-	char *ch = NULL;
-	unsigned long comment_id = 0;
-	int persistent = FALSE;
-	int expires = FALSE;
-	time_t expire_time = 0L;
-	int entry_type = USER_COMMENT;
-	int source = COMMENTSOURCE_INTERNAL;
-	time_t entry_time = 0L;
-	time_t creation_time;
-	time_t current_time;
-	int scheduling_info_is_ok = FALSE;
-	unsigned long downtime_id = 0;
-	time_t start_time = 0L;
-	time_t flex_downtime_start = (time_t)0;
-	time_t end_time = 0L;
-	int fixed = FALSE;
-	unsigned long triggered_by = 0;
-	unsigned long duration = 0L;
-	unsigned long host_attribute_mask = 0L;
-	unsigned long service_attribute_mask = 0L;
-	unsigned long contact_attribute_mask = 0L;
-	unsigned long contact_host_attribute_mask = 0L;
-	unsigned long contact_service_attribute_mask = 0L;
-	unsigned long process_host_attribute_mask = 0L;
-	unsigned long process_service_attribute_mask = 0L;
-	int force_remove = FALSE;
-	int ack = FALSE;
-	int found_directive = FALSE;
-	int is_in_effect = FALSE;
-	int start_notification_sent = FALSE;
-	struct host conf, have;
-	struct contact cont_conf, cont_have;
+	const char *p = val;
+	int x;
+
+	/* the value may be read only, so my_strsep() won't do */
+	for (x = 0; x < MAX_STATE_HISTORY_ENTRIES && p != NULL; x++) {
+		history[x] = atoi(p);
+		if ((p = strchr(p, ',')) != NULL)
+			p++;
+	}
+	*index = 0;
+}
 
-	/* make sure we have what we need */
-	if (retention_file == NULL) {
+static void load_custom_variable(customvariablesmember *cvar, const char *name, const char *val)
+{
+	int x;
+
+	for (; cvar != NULL; cvar = cvar->next) {
+		if (!strcmp(name, cvar->variable_name)) {
+			if ((x = atoi(val)) > 0 && strlen(val) >= 2) {
+				nm_free(cvar->variable_value);
+				cvar->variable_value = nm_strdup(val + 2);
+				cvar->has_been_modified = (x > 0) ? TRUE : FALSE;
+			}
+			break;
+		}
+	}
+}
 
-		nm_log(NSLOG_RUNTIME_ERROR, "Error: We don't have a filename for retention data!\n");
+/* makes sure a retained command still exists; returns a copy of it if it does */
+static char *load_command(const char *val)
+{
+	char *tempval = nm_strdup(val);
 
-		return ERROR;
+	if (find_bang_command(tempval) == NULL)
+		nm_free(tempval);
+	return tempval;
+}
+
+static int load_config_value(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val)
+{
+	int v = val->i > 0 ? TRUE : FALSE;
+
+	switch (key) {
+	case XRD_KEY_CONFIG_NOTIFICATIONS_ENABLED:
+		ld->conf.notifications_enabled = v;
+		ld->have.notifications_enabled = 1;
+		break;
+	case XRD_KEY_CONFIG_ACTIVE_CHECKS_ENABLED:
+		ld->conf.checks_enabled = v;
+		ld->have.checks_enabled = 1;
+		break;
+	case XRD_KEY_CONFIG_PASSIVE_CHECKS_ENABLED:
+		ld->conf.accept_passive_checks = v;
+		ld->have.accept_passive_checks = 1;
+		break;
+	case XRD_KEY_CONFIG_EVENT_HANDLER_ENABLED:
+		ld->conf.event_handler_enabled = v;
+		ld->have.event_handler_enabled = 1;
+		break;
+	case XRD_KEY_CONFIG_FLAP_DETECTION_ENABLED:
+		ld->conf.flap_detection_enabled = v;
+		ld->have.flap_detection_enabled = 1;
+		break;
+	case XRD_KEY_CONFIG_PROCESS_PERFORMANCE_DATA:
+		ld->conf.process_performance_data = v;
+		ld->have.process_performance_data = 1;
+		break;
+	case XRD_KEY_CONFIG_OBSESS:
+		ld->conf.obsess = v;
+		ld->have.obsess = 1;
+		break;
+	default:
+		return FALSE;
 	}
+	return TRUE;
+}
 
-	/* open the retention file for reading */
-	if ((thefile = mmap_fopen(retention_file)) == NULL)
-		return ERROR;
+static void load_info(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val)
+{
+	time_t creation_time, current_time;
 
-	/* what attributes should be masked out? */
-	/* NOTE: host/service/contact-specific values may be added in the future, but for now we only have global masks */
-	process_host_attribute_mask = retained_process_host_attribute_mask;
-	process_service_attribute_mask = retained_process_host_attribute_mask;
-	host_attribute_mask = retained_host_attribute_mask;
-	service_attribute_mask = retained_host_attribute_mask;
-	contact_host_attribute_mask = retained_contact_host_attribute_mask;
-	contact_service_attribute_mask = retained_contact_service_attribute_mask;
+	if (key != XRD_KEY_CREATED)
+		return;
 
-	/* Big speedup when reading retention.dat in bulk */
-	defer_downtime_sorting = 1;
-	defer_comment_sorting = 1;
+	creation_time = val->ul;
+	time(&current_time);
+	if (creation_time + retention_scheduling_horizon > current_time && creation_time <= current_time)
+		ld->scheduling_info_is_ok = TRUE;
+	else
+		ld->scheduling_info_is_ok = FALSE;
+	last_program_stop = creation_time;
+}
 
-	/* read all lines in the retention file */
-	while (1) {
-		nm_free(inputbuf);
+static void load_program(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val)
+{
+	char *tempval;
 
-		/* read the next line */
-		if ((inputbuf = mmap_fgets(thefile)) == NULL)
-			break;
+	if (key == XRD_KEY_MODIFIED_HOST_ATTRIBUTES) {
 
-		input = inputbuf;
+		modified_host_process_attributes = val->ul;
 
-		/* far better than strip()ing */
-		if (input[0] == '\t')
-			input++;
+		/* mask out attributes we don't want to retain */
+		modified_host_process_attributes &= ~ld->process_host_attribute_mask;
+	} else if (key == XRD_KEY_MODIFIED_SERVICE_ATTRIBUTES) {
 
-		strip(input);
+		modified_service_process_attributes = val->ul;
 
-		if (!strcmp(input, "service {")) {
-			memset(&conf, 0, sizeof(conf));
-			memset(&have, 0, sizeof(have));
-			memset(&cont_conf, 0, sizeof(cont_conf));
-			memset(&cont_have, 0, sizeof(cont_have));
-			data_type = XRDDEFAULT_SERVICESTATUS_DATA;
-		} else if (!strcmp(input, "host {")) {
-			memset(&conf, 0, sizeof(conf));
-			memset(&have, 0, sizeof(have));
-			data_type = XRDDEFAULT_HOSTSTATUS_DATA;
-		} else if (!strcmp(input, "contact {"))
-			data_type = XRDDEFAULT_CONTACTSTATUS_DATA;
-		else if (!strcmp(input, "hostcomment {"))
-			data_type = XRDDEFAULT_HOSTCOMMENT_DATA;
-		else if (!strcmp(input, "servicecomment {"))
-			data_type = XRDDEFAULT_SERVICECOMMENT_DATA;
-		else if (!strcmp(input, "hostdowntime {"))
-			data_type = XRDDEFAULT_HOSTDOWNTIME_DATA;
-		else if (!strcmp(input, "servicedowntime {"))
-			data_type = XRDDEFAULT_SERVICEDOWNTIME_DATA;
-		else if (!strcmp(input, "info {"))
-			data_type = XRDDEFAULT_INFO_DATA;
-		else if (!strcmp(input, "program {"))
-			data_type = XRDDEFAULT_PROGRAMSTATUS_DATA;
-
-		else if (!strcmp(input, "}")) {
-
-			switch (data_type) {
-
-			case XRDDEFAULT_INFO_DATA:
-				break;
-
-			case XRDDEFAULT_PROGRAMSTATUS_DATA:
-
-				/* adjust modified attributes if necessary */
-				if (use_retained_program_state == FALSE) {
-					modified_host_process_attributes = MODATTR_NONE;
-					modified_service_process_attributes = MODATTR_NONE;
-				}
-				break;
+		/* mask out attributes we don't want to retain */
+		modified_service_process_attributes &= ~ld->process_service_attribute_mask;
+	}
+	if (use_retained_program_state == FALSE)
+		return;
+
+	switch (key) {
+	case XRD_KEY_ENABLE_NOTIFICATIONS:
+		if (modified_host_process_attributes & MODATTR_NOTIFICATIONS_ENABLED)
+			enable_notifications = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_ACTIVE_SERVICE_CHECKS_ENABLED:
+		if (modified_service_process_attributes & MODATTR_ACTIVE_CHECKS_ENABLED)
+			execute_service_checks = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_PASSIVE_SERVICE_CHECKS_ENABLED:
+		if (modified_service_process_attributes & MODATTR_PASSIVE_CHECKS_ENABLED)
+			accept_passive_service_checks = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_ACTIVE_HOST_CHECKS_ENABLED:
+		if (modified_host_process_attributes & MODATTR_ACTIVE_CHECKS_ENABLED)
+			execute_host_checks = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_PASSIVE_HOST_CHECKS_ENABLED:
+		if (modified_host_process_attributes & MODATTR_PASSIVE_CHECKS_ENABLED)
+			accept_passive_host_checks = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_ENABLE_EVENT_HANDLERS:
+		if (modified_host_process_attributes & MODATTR_EVENT_HANDLER_ENABLED)
+			enable_event_handlers = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_OBSESS_OVER_SERVICES:
+		if (modified_service_process_attributes & MODATTR_OBSESSIVE_HANDLER_ENABLED)
+			obsess_over_services = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_OBSESS_OVER_HOSTS:
+		if (modified_host_process_attributes & MODATTR_OBSESSIVE_HANDLER_ENABLED)
+			obsess_over_hosts = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_CHECK_SERVICE_FRESHNESS:
+		if (modified_service_process_attributes & MODATTR_FRESHNESS_CHECKS_ENABLED)
+			check_service_freshness = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_CHECK_HOST_FRESHNESS:
+		if (modified_host_process_attributes & MODATTR_FRESHNESS_CHECKS_ENABLED)
+			check_host_freshness = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_ENABLE_FLAP_DETECTION:
+		if (modified_host_process_attributes & MODATTR_FLAP_DETECTION_ENABLED)
+			enable_flap_detection = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_PROCESS_PERFORMANCE_DATA:
+		if (modified_host_process_attributes & MODATTR_PERFORMANCE_DATA_ENABLED)
+			process_performance_data = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_GLOBAL_HOST_EVENT_HANDLER:
+		/* make sure the check command still exists... */
+		if (modified_host_process_attributes & MODATTR_EVENT_HANDLER_COMMAND && (tempval = load_command(val->s))) {
+			nm_free(global_host_event_handler);
+			global_host_event_handler = tempval;
+		}
+		break;
+	case XRD_KEY_GLOBAL_SERVICE_EVENT_HANDLER:
+		/* make sure the check command still exists... */
+		if (modified_service_process_attributes & MODATTR_EVENT_HANDLER_COMMAND && (tempval = load_command(val->s))) {
+			nm_free(global_service_event_handler);
+			global_service_event_handler = tempval;
+		}
+		break;
+	case XRD_KEY_NEXT_COMMENT_ID:
+		next_comment_id = val->ul;
+		break;
+	case XRD_KEY_NEXT_DOWNTIME_ID:
+		next_downtime_id = val->ul;
+		break;
+	case XRD_KEY_NEXT_EVENT_ID:
+		next_event_id = val->ul;
+		break;
+	case XRD_KEY_NEXT_PROBLEM_ID:
+		next_problem_id = val->ul;
+		break;
+	case XRD_KEY_NEXT_NOTIFICATION_ID:
+		next_notification_id = val->ul;
+		break;
+	default:
+		break;
+	}
+}
 
-			case XRDDEFAULT_HOSTSTATUS_DATA:
+/* returns FALSE if key isn't status information */
+static int load_host_status(struct xrd_loader *ld, host *temp_host, enum xrd_key key, const struct xrd_value *val)
+{
+	switch (key) {
+	case XRD_KEY_HAS_BEEN_CHECKED:
+		temp_host->has_been_checked = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_CHECK_EXECUTION_TIME:
+		temp_host->execution_time = val->d;
+		break;
+	case XRD_KEY_CHECK_LATENCY:
+		temp_host->latency = val->d;
+		break;
+	case XRD_KEY_CHECK_TYPE:
+		temp_host->check_type = val->i;
+		break;
+	case XRD_KEY_CURRENT_STATE:
+		temp_host->current_state = val->i;
+		break;
+	case XRD_KEY_LAST_STATE:
+		temp_host->last_state = val->i;
+		break;
+	case XRD_KEY_LAST_HARD_STATE:
+		temp_host->last_hard_state = val->i;
+		break;
+	case XRD_KEY_PLUGIN_OUTPUT:
+		nm_free(temp_host->plugin_output);
+		temp_host->plugin_output = nm_strdup(val->s);
+		break;
+	case XRD_KEY_LONG_PLUGIN_OUTPUT:
+		nm_free(temp_host->long_plugin_output);
+		temp_host->long_plugin_output = nm_strdup(val->s);
+		break;
+	case XRD_KEY_PERFORMANCE_DATA:
+		nm_free(temp_host->perf_data);
+		temp_host->perf_data = nm_strdup(val->s);
+		break;
+	case XRD_KEY_LAST_CHECK:
+		temp_host->last_check = val->ul;
+		break;
+	case XRD_KEY_NEXT_CHECK:
+		if (use_retained_scheduling_info == TRUE && ld->scheduling_info_is_ok == TRUE)
+			temp_host->next_check = val->ul;
+		break;
+	case XRD_KEY_CHECK_OPTIONS:
+		if (use_retained_scheduling_info == TRUE && ld->scheduling_info_is_ok == TRUE)
+			temp_host->check_options = val->i;
+		break;
+	case XRD_KEY_CURRENT_ATTEMPT:
+		temp_host->current_attempt = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_CURRENT_EVENT_ID:
+		temp_host->current_event_id = val->ul;
+		break;
+	case XRD_KEY_LAST_EVENT_ID:
+		temp_host->last_event_id = val->ul;
+		break;
+	case XRD_KEY_CURRENT_PROBLEM_ID:
+		temp_host->current_problem_id = val->ul;
+		break;
+	case XRD_KEY_LAST_PROBLEM_ID:
+		temp_host->last_problem_id = val->ul;
+		break;
+	case XRD_KEY_STATE_TYPE:
+		temp_host->state_type = val->i;
+		break;
+	case XRD_KEY_LAST_STATE_CHANGE:
+		temp_host->last_state_change = val->ul;
+		break;
+	case XRD_KEY_LAST_HARD_STATE_CHANGE:
+		temp_host->last_hard_state_change = val->ul;
+		break;
+	case XRD_KEY_LAST_TIME_UP:
+		temp_host->last_time_up = val->ul;
+		break;
+	case XRD_KEY_LAST_TIME_DOWN:
+		temp_host->last_time_down = val->ul;
+		break;
+	case XRD_KEY_LAST_TIME_UNREACHABLE:
+		temp_host->last_time_unreachable = val->ul;
+		break;
+	case XRD_KEY_LAST_UPDATE:
+		temp_host->last_update = val->ul;
+		break;
+	case XRD_KEY_NOTIFIED_ON_DOWN:
+		temp_host->notified_on |= (val->i > 0 ? OPT_DOWN : 0);
+		break;
+	case XRD_KEY_NOTIFIED_ON_UNREACHABLE:
+		temp_host->notified_on |= (val->i > 0 ? OPT_UNREACHABLE : 0);
+		break;
+	case XRD_KEY_LAST_NOTIFICATION:
+		temp_host->last_notification = val->ul;
+		break;
+	case XRD_KEY_CURRENT_NOTIFICATION_NUMBER:
+		temp_host->current_notification_number = val->i;
+		break;
+	case XRD_KEY_CURRENT_NOTIFICATION_ID:
+		temp_host->current_notification_id = val->ul;
+		break;
+	case XRD_KEY_IS_FLAPPING:
+		temp_host->is_flapping = val->i;
+		break;
+	case XRD_KEY_PERCENT_STATE_CHANGE:
+		temp_host->percent_state_change = val->d;
+		break;
+	case XRD_KEY_CHECK_FLAPPING_RECOVERY_NOTIFICATION:
+		temp_host->check_flapping_recovery_notification = val->i;
+		break;
+	case XRD_KEY_STATE_HISTORY:
+		load_state_history(temp_host->state_history, &temp_host->state_history_index, val->s);
+		break;
+	default:
+		return FALSE;
+	}
+	return TRUE;
+}
 
-				if (temp_host != NULL) {
+static void load_host_nonstatus(struct xrd_loader *ld, host *temp_host, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	timeperiod *temp_timeperiod = NULL;
+	char *tempval = NULL;
 
-					/* adjust modified attributes if necessary */
-					if (temp_host->retain_nonstatus_information == FALSE)
-						temp_host->modified_attributes = MODATTR_NONE;
+	if (load_config_value(ld, key, val))
+		return;
+
+	switch (key) {
+	case XRD_KEY_PROBLEM_HAS_BEEN_ACKNOWLEDGED:
+		temp_host->problem_has_been_acknowledged = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_ACKNOWLEDGEMENT_TYPE:
+		temp_host->acknowledgement_type = val->i;
+		break;
+	case XRD_KEY_NOTIFICATIONS_ENABLED:
+		RETAIN_BOOL(host, temp_host, notifications_enabled, MODATTR_NOTIFICATIONS_ENABLED);
+		break;
+	case XRD_KEY_ACTIVE_CHECKS_ENABLED:
+		RETAIN_BOOL(host, temp_host, checks_enabled, MODATTR_ACTIVE_CHECKS_ENABLED);
+		break;
+	case XRD_KEY_PASSIVE_CHECKS_ENABLED:
+		RETAIN_BOOL(host, temp_host, accept_passive_checks, MODATTR_PASSIVE_CHECKS_ENABLED);
+		break;
+	case XRD_KEY_EVENT_HANDLER_ENABLED:
+		RETAIN_BOOL(host, temp_host, event_handler_enabled, MODATTR_EVENT_HANDLER_ENABLED);
+		break;
+	case XRD_KEY_FLAP_DETECTION_ENABLED:
+		RETAIN_BOOL(host, temp_host, flap_detection_enabled, MODATTR_FLAP_DETECTION_ENABLED);
+		break;
+	case XRD_KEY_PROCESS_PERFORMANCE_DATA:
+		RETAIN_BOOL(host, temp_host, process_performance_data, MODATTR_PERFORMANCE_DATA_ENABLED);
+		break;
+	case XRD_KEY_OBSESS:
+		RETAIN_BOOL(host, temp_host, obsess, MODATTR_OBSESSIVE_HANDLER_ENABLED);
+		break;
+	case XRD_KEY_CHECK_COMMAND:
+		if (temp_host->modified_attributes & MODATTR_CHECK_COMMAND) {
+
+			/* make sure the check command still exists... */
+			if ((tempval = load_command(val->s))) {
+				nm_free(temp_host->check_command);
+				temp_host->check_command = tempval;
+			} else
+				temp_host->modified_attributes &= ~MODATTR_CHECK_COMMAND;
+		}
+		break;
+	case XRD_KEY_CHECK_PERIOD:
+		if (temp_host->modified_attributes & MODATTR_CHECK_TIMEPERIOD) {
+
+			/* make sure the timeperiod still exists... */
+			temp_timeperiod = find_timeperiod(val->s);
+			if (temp_timeperiod) {
+				temp_host->check_period = temp_timeperiod->name;
+				temp_host->check_period_ptr = temp_timeperiod;
+			} else {
+				temp_host->modified_attributes &= ~MODATTR_CHECK_TIMEPERIOD;
+			}
+		}
+		break;
+	case XRD_KEY_NOTIFICATION_PERIOD:
+		if (temp_host->modified_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
+
+			/* make sure the timeperiod still exists... */
+			temp_timeperiod = find_timeperiod(val->s);
+			if (temp_timeperiod) {
+				temp_host->notification_period = temp_timeperiod->name;
+				temp_host->notification_period_ptr = temp_timeperiod;
+			} else {
+				temp_host->modified_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
+			}
+		}
+		break;
+	case XRD_KEY_EVENT_HANDLER:
+		if (temp_host->modified_attributes & MODATTR_EVENT_HANDLER_COMMAND) {
+
+			/* make sure the check command still exists... */
+			if ((tempval = load_command(val->s))) {
+				nm_free(temp_host->event_handler);
+				temp_host->event_handler = tempval;
+			} else
+				temp_host->modified_attributes &= ~MODATTR_EVENT_HANDLER_COMMAND;
+		}
+		break;
+	case XRD_KEY_NORMAL_CHECK_INTERVAL:
+		if (temp_host->modified_attributes & MODATTR_NORMAL_CHECK_INTERVAL && val->d >= 0)
+			temp_host->check_interval = val->d;
+		break;
+	case XRD_KEY_RETRY_CHECK_INTERVAL:
+		if (temp_host->modified_attributes & MODATTR_RETRY_CHECK_INTERVAL && val->d >= 0)
+			temp_host->retry_interval = val->d;
+		break;
+	case XRD_KEY_MAX_ATTEMPTS:
+		if (temp_host->modified_attributes & MODATTR_MAX_CHECK_ATTEMPTS && val->i >= 1) {
+
+			temp_host->max_attempts = val->i;
+
+			/* adjust current attempt number if in a hard state */
+			if (temp_host->state_type == HARD_STATE && temp_host->current_state != STATE_UP && temp_host->current_attempt > 1)
+				temp_host->current_attempt = temp_host->max_attempts;
+		}
+		break;
+	case XRD_KEY_CUSTOM_VARIABLE:
+		if (temp_host->modified_attributes & MODATTR_CUSTOM_VARIABLE)
+			load_custom_variable(temp_host->custom_variables, customvar, val->s);
+		break;
+	default:
+		break;
+	}
+}
 
-					/* adjust modified attributes if no custom variables have been changed */
-					if (temp_host->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
-						for (temp_customvariablesmember = temp_host->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-							if (temp_customvariablesmember->has_been_modified == TRUE)
-								break;
-						}
-						if (temp_customvariablesmember == NULL)
-							temp_host->modified_attributes &= ~MODATTR_CUSTOM_VARIABLE;
-					}
+static void load_host(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	host *temp_host = ld->hst;
 
-					/* calculate next possible notification time */
-					if (temp_host->current_state != STATE_UP && temp_host->last_notification != (time_t)0)
-						temp_host->next_notification = get_next_host_notification_time(temp_host, temp_host->last_notification);
+	if (temp_host == NULL) {
+		if (key == XRD_KEY_HOST_NAME)
+			ld->hst = find_host(val->s);
+		return;
+	}
 
-					/* ADDED 01/23/2009 adjust current check attempts if host in hard problem state (max attempts may have changed in config since restart) */
-					if (temp_host->current_state != STATE_UP && temp_host->state_type == HARD_STATE)
-						temp_host->current_attempt = temp_host->max_attempts;
+	if (key == XRD_KEY_MODIFIED_ATTRIBUTES) {
 
-					/* handle new vars added in 2.x */
-					if (temp_host->last_hard_state_change == (time_t)0)
-						temp_host->last_hard_state_change = temp_host->last_state_change;
+		temp_host->modified_attributes = val->ul;
 
-					/* update host status */
-					update_host_status(temp_host, FALSE);
-				}
+		/* mask out attributes we don't want to retain */
+		temp_host->modified_attributes &= ~ld->host_attribute_mask;
+		return;
+	}
 
-				temp_host = NULL;
-				break;
+	/* non-status information is only retained along with the status */
+	if (temp_host->retain_status_information == TRUE && !load_host_status(ld, temp_host, key, val)
+	    && temp_host->retain_nonstatus_information == TRUE)
+		load_host_nonstatus(ld, temp_host, key, val, customvar);
+}
 
-			case XRDDEFAULT_SERVICESTATUS_DATA:
+static int load_service_status(struct xrd_loader *ld, service *temp_service, enum xrd_key key, const struct xrd_value *val)
+{
+	if (load_config_value(ld, key, val))
+		return TRUE;
+
+	switch (key) {
+	case XRD_KEY_HAS_BEEN_CHECKED:
+		temp_service->has_been_checked = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_CHECK_EXECUTION_TIME:
+		temp_service->execution_time = val->d;
+		break;
+	case XRD_KEY_CHECK_LATENCY:
+		temp_service->latency = val->d;
+		break;
+	case XRD_KEY_CHECK_TYPE:
+		temp_service->check_type = val->i;
+		break;
+	case XRD_KEY_CURRENT_STATE:
+		temp_service->current_state = val->i;
+		break;
+	case XRD_KEY_LAST_STATE:
+		temp_service->last_state = val->i;
+		break;
+	case XRD_KEY_LAST_HARD_STATE:
+		temp_service->last_hard_state = val->i;
+		break;
+	case XRD_KEY_CURRENT_ATTEMPT:
+		temp_service->current_attempt = val->i;
+		break;
+	case XRD_KEY_CURRENT_EVENT_ID:
+		temp_service->current_event_id = val->ul;
+		break;
+	case XRD_KEY_LAST_EVENT_ID:
+		temp_service->last_event_id = val->ul;
+		break;
+	case XRD_KEY_CURRENT_PROBLEM_ID:
+		temp_service->current_problem_id = val->ul;
+		break;
+	case XRD_KEY_LAST_PROBLEM_ID:
+		temp_service->last_problem_id = val->ul;
+		break;
+	case XRD_KEY_STATE_TYPE:
+		temp_service->state_type = val->i;
+		break;
+	case XRD_KEY_LAST_STATE_CHANGE:
+		temp_service->last_state_change = val->ul;
+		break;
+	case XRD_KEY_LAST_HARD_STATE_CHANGE:
+		temp_service->last_hard_state_change = val->ul;
+		break;
+	case XRD_KEY_LAST_TIME_OK:
+		temp_service->last_time_ok = val->ul;
+		break;
+	case XRD_KEY_LAST_TIME_WARNING:
+		temp_service->last_time_warning = val->ul;
+		break;
+	case XRD_KEY_LAST_TIME_UNKNOWN:
+		temp_service->last_time_unknown = val->ul;
+		break;
+	case XRD_KEY_LAST_TIME_CRITICAL:
+		temp_service->last_time_critical = val->ul;
+		break;
+	case XRD_KEY_LAST_UPDATE:
+		temp_service->last_update = val->ul;
+		break;
+	case XRD_KEY_PLUGIN_OUTPUT:
+		nm_free(temp_service->plugin_output);
+		temp_service->plugin_output = nm_strdup(val->s);
+		break;
+	case XRD_KEY_LONG_PLUGIN_OUTPUT:
+		nm_free(temp_service->long_plugin_output);
+		temp_service->long_plugin_output = nm_strdup(val->s);
+		break;
+	case XRD_KEY_PERFORMANCE_DATA:
+		nm_free(temp_service->perf_data);
+		temp_service->perf_data = nm_strdup(val->s);
+		break;
+	case XRD_KEY_LAST_CHECK:
+		temp_service->last_check = val->ul;
+		break;
+	case XRD_KEY_NEXT_CHECK:
+		if (use_retained_scheduling_info == TRUE && ld->scheduling_info_is_ok == TRUE)
+			temp_service->next_check = val->ul;
+		break;
+	case XRD_KEY_CHECK_OPTIONS:
+		if (use_retained_scheduling_info == TRUE && ld->scheduling_info_is_ok == TRUE)
+			temp_service->check_options = val->i;
+		break;
+	case XRD_KEY_NOTIFIED_ON_UNKNOWN:
+		temp_service->notified_on |= ((val->i > 0) ? OPT_UNKNOWN : 0);
+		break;
+	case XRD_KEY_NOTIFIED_ON_WARNING:
+		temp_service->notified_on |= ((val->i > 0) ? OPT_WARNING : 0);
+		break;
+	case XRD_KEY_NOTIFIED_ON_CRITICAL:
+		temp_service->notified_on |= ((val->i > 0) ? OPT_CRITICAL : 0);
+		break;
+	case XRD_KEY_CURRENT_NOTIFICATION_NUMBER:
+		temp_service->current_notification_number = val->i;
+		break;
+	case XRD_KEY_CURRENT_NOTIFICATION_ID:
+		temp_service->current_notification_id = val->ul;
+		break;
+	case XRD_KEY_LAST_NOTIFICATION:
+		temp_service->last_notification = val->ul;
+		break;
+	case XRD_KEY_IS_FLAPPING:
+		temp_service->is_flapping = val->i;
+		break;
+	case XRD_KEY_PERCENT_STATE_CHANGE:
+		temp_service->percent_state_change = val->d;
+		break;
+	case XRD_KEY_CHECK_FLAPPING_RECOVERY_NOTIFICATION:
+		temp_service->check_flapping_recovery_notification = val->i;
+		break;
+	case XRD_KEY_STATE_HISTORY:
+		load_state_history(temp_service->state_history, &temp_service->state_history_index, val->s);
+		break;
+	default:
+		return FALSE;
+	}
+	return TRUE;
+}
 
-				if (temp_service != NULL) {
+static void load_service_nonstatus(struct xrd_loader *ld, service *temp_service, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	timeperiod *temp_timeperiod = NULL;
+	char *tempval = NULL;
 
-					/* adjust modified attributes if necessary */
-					if (temp_service->retain_nonstatus_information == FALSE)
-						temp_service->modified_attributes = MODATTR_NONE;
+	switch (key) {
+	case XRD_KEY_PROBLEM_HAS_BEEN_ACKNOWLEDGED:
+		temp_service->problem_has_been_acknowledged = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_ACKNOWLEDGEMENT_TYPE:
+		temp_service->acknowledgement_type = val->i;
+		break;
+	case XRD_KEY_NOTIFICATIONS_ENABLED:
+		RETAIN_BOOL(service, temp_service, notifications_enabled, MODATTR_NOTIFICATIONS_ENABLED);
+		break;
+	case XRD_KEY_ACTIVE_CHECKS_ENABLED:
+		RETAIN_BOOL(service, temp_service, checks_enabled, MODATTR_ACTIVE_CHECKS_ENABLED);
+		break;
+	case XRD_KEY_PASSIVE_CHECKS_ENABLED:
+		RETAIN_BOOL(service, temp_service, accept_passive_checks, MODATTR_PASSIVE_CHECKS_ENABLED);
+		break;
+	case XRD_KEY_EVENT_HANDLER_ENABLED:
+		RETAIN_BOOL(service, temp_service, event_handler_enabled, MODATTR_EVENT_HANDLER_ENABLED);
+		break;
+	case XRD_KEY_FLAP_DETECTION_ENABLED:
+		RETAIN_BOOL(service, temp_service, flap_detection_enabled, MODATTR_FLAP_DETECTION_ENABLED);
+		break;
+	case XRD_KEY_PROCESS_PERFORMANCE_DATA:
+		RETAIN_BOOL(service, temp_service, process_performance_data, MODATTR_PERFORMANCE_DATA_ENABLED);
+		break;
+	case XRD_KEY_OBSESS:
+		RETAIN_BOOL(service, temp_service, obsess, MODATTR_OBSESSIVE_HANDLER_ENABLED);
+		break;
+	case XRD_KEY_CHECK_COMMAND:
+		if (temp_service->modified_attributes & MODATTR_CHECK_COMMAND) {
+
+			/* make sure the check command still exists... */
+			if ((tempval = load_command(val->s))) {
+				nm_free(temp_service->check_command);
+				temp_service->check_command = tempval;
+			} else {
+				temp_service->modified_attributes &= ~MODATTR_CHECK_COMMAND;
+			}
+		}
+		break;
+	case XRD_KEY_CHECK_PERIOD:
+		if (temp_service->modified_attributes & MODATTR_CHECK_TIMEPERIOD) {
+
+			/* make sure the timeperiod still exists... */
+			temp_timeperiod = find_timeperiod(val->s);
+			if (temp_timeperiod) {
+				temp_service->check_period = temp_timeperiod->name;
+				temp_service->check_period_ptr = temp_timeperiod;
+			} else {
+				temp_service->modified_attributes &= ~MODATTR_CHECK_TIMEPERIOD;
+			}
+		}
+		break;
+	case XRD_KEY_NOTIFICATION_PERIOD:
+		if (temp_service->modified_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
+
+			/* make sure the timeperiod still exists... */
+			temp_timeperiod = find_timeperiod(val->s);
+			if (temp_timeperiod) {
+				temp_service->notification_period = temp_timeperiod->name;
+				temp_service->notification_period_ptr = temp_timeperiod;
+			} else {
+				temp_service->modified_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
+			}
+		}
+		break;
+	case XRD_KEY_EVENT_HANDLER:
+		if (temp_service->modified_attributes & MODATTR_EVENT_HANDLER_COMMAND) {
+
+			/* make sure the check command still exists... */
+			if ((tempval = load_command(val->s))) {
+				nm_free(temp_service->event_handler);
+				temp_service->event_handler = tempval;
+			} else {
+				temp_service->modified_attributes &= ~MODATTR_EVENT_HANDLER_COMMAND;
+			}
+		}
+		break;
+	case XRD_KEY_NORMAL_CHECK_INTERVAL:
+		if (temp_service->modified_attributes & MODATTR_NORMAL_CHECK_INTERVAL && val->d >= 0)
+			temp_service->check_interval = val->d;
+		break;
+	case XRD_KEY_RETRY_CHECK_INTERVAL:
+		if (temp_service->modified_attributes & MODATTR_RETRY_CHECK_INTERVAL && val->d >= 0)
+			temp_service->retry_interval = val->d;
+		break;
+	case XRD_KEY_MAX_ATTEMPTS:
+		if (temp_service->modified_attributes & MODATTR_MAX_CHECK_ATTEMPTS && val->i >= 1) {
+
+			temp_service->max_attempts = val->i;
+
+			/* adjust current attempt number if in a hard state */
+			if (temp_service->state_type == HARD_STATE && temp_service->current_state != STATE_OK && temp_service->current_attempt > 1)
+				temp_service->current_attempt = temp_service->max_attempts;
+		}
+		break;
+	case XRD_KEY_CUSTOM_VARIABLE:
+		if (temp_service->modified_attributes & MODATTR_CUSTOM_VARIABLE)
+			load_custom_variable(temp_service->custom_variables, customvar, val->s);
+		break;
+	default:
+		break;
+	}
+}
 
-					/* adjust modified attributes if no custom variables have been changed */
-					if (temp_service->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
-						for (temp_customvariablesmember = temp_service->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-							if (temp_customvariablesmember->has_been_modified == TRUE)
-								break;
+static void load_service(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	service *temp_service = ld->svc;
+
+	if (temp_service == NULL) {
+		if (key == XRD_KEY_HOST_NAME) {
+			nm_free(ld->host_name);
+			ld->host_name = nm_strdup(val->s);
+		} else if (key == XRD_KEY_SERVICE_DESCRIPTION)
+			ld->svc = find_service(ld->host_name, val->s);
+		return;
+	}
 
-						}
-						if (temp_customvariablesmember == NULL)
-							temp_service->modified_attributes &= ~MODATTR_CUSTOM_VARIABLE;
-					}
+	if (key == XRD_KEY_MODIFIED_ATTRIBUTES) {
 
-					/* calculate next possible notification time */
-					if (temp_service->current_state != STATE_OK && temp_service->last_notification != (time_t)0)
-						temp_service->next_notification = get_next_service_notification_time(temp_service, temp_service->last_notification);
+		temp_service->modified_attributes = val->ul;
 
-					/* fix old vars */
-					if (temp_service->has_been_checked == FALSE && temp_service->state_type == SOFT_STATE)
-						temp_service->state_type = HARD_STATE;
+		/* mask out attributes we don't want to retain */
+		temp_service->modified_attributes &= ~ld->service_attribute_mask;
+		return;
+	}
 
-					/* ADDED 01/23/2009 adjust current check attempt if service is in hard problem state (max attempts may have changed in config since restart) */
-					if (temp_service->current_state != STATE_OK && temp_service->state_type == HARD_STATE)
-						temp_service->current_attempt = temp_service->max_attempts;
+	/* non-status information is only retained along with the status */
+	if (temp_service->retain_status_information == TRUE && !load_service_status(ld, temp_service, key, val)
+	    && temp_service->retain_nonstatus_information == TRUE)
+		load_service_nonstatus(ld, temp_service, key, val, customvar);
+}
 
-					/* handle new vars added in 2.x */
-					if (temp_service->last_hard_state_change == (time_t)0)
-						temp_service->last_hard_state_change = temp_service->last_state_change;
+static void load_contact_nonstatus(struct xrd_loader *ld, contact *temp_contact, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	timeperiod *temp_timeperiod = NULL;
 
-					/* update service status */
-					update_service_status(temp_service, FALSE);
-				}
+	switch (key) {
+	case XRD_KEY_HOST_NOTIFICATION_PERIOD:
+		if (temp_contact->modified_host_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
+
+			/* make sure the timeperiod still exists... */
+			temp_timeperiod = find_timeperiod(val->s);
+			if (temp_timeperiod) {
+				temp_contact->host_notification_period = temp_timeperiod->name;
+				temp_contact->host_notification_period_ptr = temp_timeperiod;
+			} else {
+				temp_contact->modified_host_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
+			}
+		}
+		break;
+	case XRD_KEY_SERVICE_NOTIFICATION_PERIOD:
+		if (temp_contact->modified_service_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
+
+			/* make sure the timeperiod still exists... */
+			temp_timeperiod = find_timeperiod(val->s);
+			if (temp_timeperiod) {
+				temp_contact->service_notification_period = temp_timeperiod->name;
+				temp_contact->service_notification_period_ptr = temp_timeperiod;
+			} else {
+				temp_contact->modified_service_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
+			}
+		}
+		break;
+	case XRD_KEY_CONFIG_HOST_NOTIFICATIONS_ENABLED:
+		ld->cont_have.host_notifications_enabled = TRUE;
+		ld->cont_conf.host_notifications_enabled = val->i > 0 ? TRUE : FALSE;
+		break;
+	case XRD_KEY_HOST_NOTIFICATIONS_ENABLED:
+		if (temp_contact->modified_host_attributes & MODATTR_NOTIFICATIONS_ENABLED
+		    || (ld->cont_have.host_notifications_enabled && ld->cont_conf.host_notifications_enabled == temp_contact->host_notifications_enabled)) {
+			pre_modify_contact_attribute(temp_contact, MODATTR_NOTIFICATIONS_ENABLED);
+			temp_contact->host_notifications_enabled = (val->i > 0) ? TRUE : FALSE;
+		}
+		break;
+	case XRD_KEY_CONFIG_SERVICE_NOTIFICATIONS_ENABLED:
+		ld->cont_have.service_notifications_enabled = TRUE;
+		ld->cont_conf.service_notifications_enabled = val->i > 0 ? TRUE : FALSE;
+		break;
+	case XRD_KEY_SERVICE_NOTIFICATIONS_ENABLED:
+		if (temp_contact->modified_service_attributes & MODATTR_NOTIFICATIONS_ENABLED
+		    || (ld->cont_have.service_notifications_enabled && ld->cont_conf.service_notifications_enabled == temp_contact->service_notifications_enabled)) {
+			pre_modify_contact_attribute(temp_contact, MODATTR_NOTIFICATIONS_ENABLED);
+			temp_contact->service_notifications_enabled = (val->i > 0) ? TRUE : FALSE;
+		}
+		break;
+	case XRD_KEY_CUSTOM_VARIABLE:
+		if (temp_contact->modified_attributes & MODATTR_CUSTOM_VARIABLE)
+			load_custom_variable(temp_contact->custom_variables, customvar, val->s);
+		break;
+	default:
+		break;
+	}
+}
 
-				nm_free(host_name);
-				temp_service = NULL;
-				break;
+static void load_contact(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	contact *temp_contact = ld->cntct;
 
-			case XRDDEFAULT_CONTACTSTATUS_DATA:
+	if (temp_contact == NULL) {
+		if (key == XRD_KEY_CONTACT_NAME)
+			ld->cntct = find_contact(val->s);
+		return;
+	}
 
-				if (temp_contact != NULL) {
+	switch (key) {
+	case XRD_KEY_MODIFIED_ATTRIBUTES:
+		temp_contact->modified_attributes = val->ul;
+
+		/* mask out attributes we don't want to retain */
+		temp_contact->modified_attributes &= ~ld->contact_attribute_mask;
+		return;
+	case XRD_KEY_MODIFIED_HOST_ATTRIBUTES:
+		temp_contact->modified_host_attributes = val->ul;
+
+		/* mask out attributes we don't want to retain */
+		temp_contact->modified_host_attributes &= ~ld->contact_host_attribute_mask;
+		return;
+	case XRD_KEY_MODIFIED_SERVICE_ATTRIBUTES:
+		temp_contact->modified_service_attributes = val->ul;
+
+		/* mask out attributes we don't want to retain */
+		temp_contact->modified_service_attributes &= ~ld->contact_service_attribute_mask;
+		return;
+	default:
+		break;
+	}
 
-					/* adjust modified attributes if necessary */
-					if (temp_contact->retain_nonstatus_information == FALSE)
-						temp_contact->modified_attributes = MODATTR_NONE;
+	/* non-status information is only retained along with the status */
+	if (temp_contact->retain_status_information == FALSE)
+		return;
+	if (key == XRD_KEY_LAST_HOST_NOTIFICATION)
+		temp_contact->last_host_notification = val->ul;
+	else if (key == XRD_KEY_LAST_SERVICE_NOTIFICATION)
+		temp_contact->last_service_notification = val->ul;
+	else if (temp_contact->retain_nonstatus_information == TRUE)
+		load_contact_nonstatus(ld, temp_contact, key, val, customvar);
+}
 
-					/* adjust modified attributes if no custom variables have been changed */
-					if (temp_contact->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
-						for (temp_customvariablesmember = temp_contact->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-							if (temp_customvariablesmember->has_been_modified == TRUE)
-								break;
+static void load_comment(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val)
+{
+	switch (key) {
+	case XRD_KEY_HOST_NAME:
+		nm_free(ld->host_name);
+		ld->host_name = nm_strdup(val->s);
+		break;
+	case XRD_KEY_SERVICE_DESCRIPTION:
+		nm_free(ld->service_description);
+		ld->service_description = nm_strdup(val->s);
+		break;
+	case XRD_KEY_ENTRY_TYPE:
+		ld->entry_type = val->i;
+		break;
+	case XRD_KEY_COMMENT_ID:
+		ld->comment_id = val->ul;
+		break;
+	case XRD_KEY_SOURCE:
+		ld->source = val->i;
+		break;
+	case XRD_KEY_PERSISTENT:
+		ld->persistent = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_ENTRY_TIME:
+		ld->entry_time = val->ul;
+		break;
+	case XRD_KEY_EXPIRES:
+		ld->expires = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_EXPIRE_TIME:
+		ld->expire_time = val->ul;
+		break;
+	case XRD_KEY_AUTHOR:
+		nm_free(ld->author);
+		ld->author = nm_strdup(val->s);
+		break;
+	case XRD_KEY_COMMENT_DATA:
+		nm_free(ld->comment_data);
+		ld->comment_data = nm_strdup(val->s);
+		break;
+	default:
+		break;
+	}
+}
 
-						}
-						if (temp_customvariablesmember == NULL)
-							temp_contact->modified_attributes &= ~MODATTR_CUSTOM_VARIABLE;
-					}
+static void load_downtime(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val)
+{
+	switch (key) {
+	case XRD_KEY_HOST_NAME:
+		nm_free(ld->host_name);
+		ld->host_name = nm_strdup(val->s);
+		break;
+	case XRD_KEY_SERVICE_DESCRIPTION:
+		nm_free(ld->service_description);
+		ld->service_description = nm_strdup(val->s);
+		break;
+	case XRD_KEY_DOWNTIME_ID:
+		ld->downtime_id = val->ul;
+		break;
+	case XRD_KEY_COMMENT_ID:
+		ld->comment_id = val->ul;
+		break;
+	case XRD_KEY_ENTRY_TIME:
+		ld->entry_time = val->ul;
+		break;
+	case XRD_KEY_START_TIME:
+		ld->start_time = val->ul;
+		break;
+	case XRD_KEY_FLEX_DOWNTIME_START:
+		ld->flex_downtime_start = val->ul;
+		break;
+	case XRD_KEY_END_TIME:
+		ld->end_time = val->ul;
+		break;
+	case XRD_KEY_FIXED:
+		ld->fixed = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_TRIGGERED_BY:
+		ld->triggered_by = val->ul;
+		break;
+	case XRD_KEY_IS_IN_EFFECT:
+		ld->is_in_effect = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_START_NOTIFICATION_SENT:
+		ld->start_notification_sent = (val->i > 0) ? TRUE : FALSE;
+		break;
+	case XRD_KEY_DURATION:
+		ld->duration = val->ul;
+		break;
+	case XRD_KEY_AUTHOR:
+		nm_free(ld->author);
+		ld->author = nm_strdup(val->s);
+		break;
+	case XRD_KEY_COMMENT:
+		nm_free(ld->comment_data);
+		ld->comment_data = nm_strdup(val->s);
+		break;
+	default:
+		break;
+	}
+}
 
-					/* update contact status */
-					update_contact_status(temp_contact, FALSE);
-				}
+void xrddefault_begin_block(struct xrd_loader *ld, int data_type, void *object)
+{
+	ld->data_type = data_type;
+
+	switch (data_type) {
+	case XRDDEFAULT_HOSTSTATUS_DATA:
+		memset(&ld->conf, 0, sizeof(ld->conf));
+		memset(&ld->have, 0, sizeof(ld->have));
+		ld->hst = object;
+		break;
+	case XRDDEFAULT_SERVICESTATUS_DATA:
+		memset(&ld->conf, 0, sizeof(ld->conf));
+		memset(&ld->have, 0, sizeof(ld->have));
+		ld->svc = object;
+		break;
+	case XRDDEFAULT_CONTACTSTATUS_DATA:
+		memset(&ld->cont_conf, 0, sizeof(ld->cont_conf));
+		memset(&ld->cont_have, 0, sizeof(ld->cont_have));
+		ld->cntct = object;
+		break;
+	default:
+		break;
+	}
+}
 
-				nm_free(contact_name);
-				temp_contact = NULL;
-				break;
-
-			case XRDDEFAULT_HOSTCOMMENT_DATA:
-			case XRDDEFAULT_SERVICECOMMENT_DATA:
-
-				/*
-				 * delete the comment if its object has disappeared
-				 * This only matters for eventbroker modules that
-				 * track comments outside of Naemon's core.
-				 */
-				force_remove = FALSE;
-				/* host no longer exists */
-				if ((temp_host = find_host(host_name)) == NULL)
-					force_remove = TRUE;
-				/* service no longer exists */
-				else if (data_type == XRDDEFAULT_SERVICECOMMENT_DATA && (temp_service = find_service(host_name, service_description)) == NULL)
-					force_remove = TRUE;
-				/* acknowledgement comments get deleted if they're not persistent and the original problem is no longer acknowledged */
-				else if (entry_type == ACKNOWLEDGEMENT_COMMENT) {
-					if (data_type == XRDDEFAULT_HOSTCOMMENT_DATA)
-						ack = temp_host->problem_has_been_acknowledged;
-					else
-						ack = temp_service->problem_has_been_acknowledged;
-					if (ack == FALSE && persistent == FALSE)
-						force_remove = TRUE;
-				}
-				/* comments from downtimes don't get removed, they would be immediatly added again anyway, but with incremented id for each reload */
-				else if (entry_type == DOWNTIME_COMMENT) {
-				}
-				/* non-persistent comments don't last past restarts UNLESS they're acks (see above) */
-				else if (persistent == FALSE)
-					force_remove = TRUE;
-
-				if (force_remove == TRUE) {
-					broker_comment_data
-					(NEBTYPE_COMMENT_DELETE, NEBFLAG_NONE, NEBATTR_NONE,
-					 (data_type == XRDDEFAULT_HOSTCOMMENT_DATA) ? HOST_COMMENT : SERVICE_COMMENT,
-					 entry_type, host_name, service_description,
-					 entry_time, author, comment_data, persistent, source,
-					 expires, expire_time, comment_id
-					);
-				} else {
-					/* add the comment */
-					add_comment((data_type == XRDDEFAULT_HOSTCOMMENT_DATA) ? HOST_COMMENT : SERVICE_COMMENT, entry_type, host_name, service_description, entry_time, author, comment_data, comment_id, persistent, expires, expire_time, source);
-				}
+void xrddefault_apply(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val, const char *customvar)
+{
+	switch (ld->data_type) {
+	case XRDDEFAULT_INFO_DATA:
+		load_info(ld, key, val);
+		break;
+	case XRDDEFAULT_PROGRAMSTATUS_DATA:
+		load_program(ld, key, val);
+		break;
+	case XRDDEFAULT_HOSTSTATUS_DATA:
+		load_host(ld, key, val, customvar);
+		break;
+	case XRDDEFAULT_SERVICESTATUS_DATA:
+		load_service(ld, key, val, customvar);
+		break;
+	case XRDDEFAULT_CONTACTSTATUS_DATA:
+		load_contact(ld, key, val, customvar);
+		break;
+	case XRDDEFAULT_HOSTCOMMENT_DATA:
+	case XRDDEFAULT_SERVICECOMMENT_DATA:
+		load_comment(ld, key, val);
+		break;
+	case XRDDEFAULT_HOSTDOWNTIME_DATA:
+	case XRDDEFAULT_SERVICEDOWNTIME_DATA:
+		load_downtime(ld, key, val);
+		break;
+	default:
+		break;
+	}
+}
 
-				/* free temp memory */
-				nm_free(host_name);
-				nm_free(service_description);
-				nm_free(author);
-				nm_free(comment_data);
-
-				/* reset defaults */
-				entry_type = USER_COMMENT;
-				comment_id = 0;
-				source = COMMENTSOURCE_INTERNAL;
-				persistent = FALSE;
-				entry_time = 0L;
-				expires = FALSE;
-				expire_time = 0L;
-
-				break;
-
-			case XRDDEFAULT_HOSTDOWNTIME_DATA:
-			case XRDDEFAULT_SERVICEDOWNTIME_DATA:
-
-				/*
-				 * Delete the downtime if its objects no longer exist
-				 * This only matters for eventbroker modules that track
-				 * downtime outside of Naemon's core, and even then only
-				 * for hosts and services that reappear in the config
-				 * when the old version of their names were in scheduled
-				 * downtime at the time they got deleted.
-				 */
-				force_remove = FALSE;
-				if (data_type == XRDDEFAULT_HOSTDOWNTIME_DATA) {
-					if (!host_name || !find_host(host_name))
-						force_remove = TRUE;
-				} else {
-					if (!host_name || !service_description || !find_service(host_name, service_description))
-						force_remove = TRUE;
-				}
+static void end_comment(struct xrd_loader *ld)
+{
+	host *temp_host = NULL;
+	service *temp_service = NULL;
+	int force_remove = FALSE;
+	int ack = FALSE;
+	int data_type = ld->data_type;
+
+	/*
+	 * delete the comment if its object has disappeared
+	 * This only matters for eventbroker modules that
+	 * track comments outside of Naemon's core.
+	 */
+	/* host no longer exists */
+	if ((temp_host = find_host(ld->host_name)) == NULL)
+		force_remove = TRUE;
+	/* service no longer exists */
+	else if (data_type == XRDDEFAULT_SERVICECOMMENT_DATA && (temp_service = find_service(ld->host_name, ld->service_description)) == NULL)
+		force_remove = TRUE;
+	/* acknowledgement comments get deleted if they're not persistent and the original problem is no longer acknowledged */
+	else if (ld->entry_type == ACKNOWLEDGEMENT_COMMENT) {
+		if (data_type == XRDDEFAULT_HOSTCOMMENT_DATA)
+			ack = temp_host->problem_has_been_acknowledged;
+		else
+			ack = temp_service->problem_has_been_acknowledged;
+		if (ack == FALSE && ld->persistent == FALSE)
+			force_remove = TRUE;
+	}
+	/* comments from downtimes don't get removed, they would be immediatly added again anyway, but with incremented id for each reload */
+	else if (ld->entry_type == DOWNTIME_COMMENT) {
+	}
+	/* non-persistent comments don't last past restarts UNLESS they're acks (see above) */
+	else if (ld->persistent == FALSE)
+		force_remove = TRUE;
+
+	if (force_remove == TRUE) {
+		broker_comment_data
+		(NEBTYPE_COMMENT_DELETE, NEBFLAG_NONE, NEBATTR_NONE,
+		 (data_type == XRDDEFAULT_HOSTCOMMENT_DATA) ? HOST_COMMENT : SERVICE_COMMENT,
+		 ld->entry_type, ld->host_name, ld->service_description,
+		 ld->entry_time, ld->author, ld->comment_data, ld->persistent, ld->source,
+		 ld->expires, ld->expire_time, ld->comment_id
+		);
+	} else {
+		/* add the comment */
+		add_comment((data_type == XRDDEFAULT_HOSTCOMMENT_DATA) ? HOST_COMMENT : SERVICE_COMMENT, ld->entry_type, ld->host_name, ld->service_description, ld->entry_time, ld->author, ld->comment_data, ld->comment_id, ld->persistent, ld->expires, ld->expire_time, ld->source);
+	}
 
-				if (force_remove == TRUE) {
-					broker_downtime_data
-					(NEBTYPE_DOWNTIME_STOP, NEBFLAG_NONE,
-					 NEBATTR_DOWNTIME_STOP_CANCELLED,
-					 data_type == XRDDEFAULT_HOSTDOWNTIME_DATA ? HOST_DOWNTIME : SERVICE_DOWNTIME,
-					 host_name, service_description,
-					 entry_time, author, comment_data,
-					 start_time, end_time, fixed, triggered_by,
-					 duration, downtime_id
-					);
-				} else {
-					/* add the downtime */
-					if (data_type == XRDDEFAULT_HOSTDOWNTIME_DATA) {
-						host *hst = NULL;
-						add_host_downtime(host_name, entry_time, author, comment_data, start_time, flex_downtime_start, end_time, fixed, triggered_by, duration, downtime_id, is_in_effect, start_notification_sent, &comment_id);
-
-						if (is_in_effect && (hst = find_host(host_name)) != NULL) {
-							hst->scheduled_downtime_depth++;
-						}
-					} else {
-						service *svc = NULL;
-						add_service_downtime(host_name, service_description, entry_time, author, comment_data, start_time, flex_downtime_start, end_time, fixed, triggered_by, duration, downtime_id, is_in_effect, start_notification_sent, &comment_id);
-						if (is_in_effect && (svc = find_service(host_name, service_description)) != NULL) {
-							svc->scheduled_downtime_depth++;
-						}
-					}
-					/* must register the downtime with Nagios so it can schedule it, add comments, etc. */
-					register_downtime((data_type == XRDDEFAULT_HOSTDOWNTIME_DATA) ? HOST_DOWNTIME : SERVICE_DOWNTIME, downtime_id);
-				}
+	/* reset defaults */
+	ld->entry_type = USER_COMMENT;
+	ld->comment_id = 0;
+	ld->source = COMMENTSOURCE_INTERNAL;
+	ld->persistent = FALSE;
+	ld->entry_time = 0L;
+	ld->expires = FALSE;
+	ld->expire_time = 0L;
+}
 
-				/* free temp memory */
-				nm_free(host_name);
-				nm_free(service_description);
-				nm_free(author);
-				nm_free(comment_data);
-
-				/* reset defaults */
-				downtime_id = 0;
-				entry_time = 0L;
-				start_time = 0L;
-				flex_downtime_start = (time_t)0;
-				end_time = 0L;
-				fixed = FALSE;
-				triggered_by = 0;
-				duration = 0L;
-
-				break;
-
-			default:
-				break;
-			}
+static void end_downtime(struct xrd_loader *ld)
+{
+	int force_remove = FALSE;
+	int data_type = ld->data_type;
+
+	/*
+	 * Delete the downtime if its objects no longer exist
+	 * This only matters for eventbroker modules that track
+	 * downtime outside of Naemon's core, and even then only
+	 * for hosts and services that reappear in the config
+	 * when the old version of their names were in scheduled
+	 * downtime at the time they got deleted.
+	 */
+	if (data_type == XRDDEFAULT_HOSTDOWNTIME_DATA) {
+		if (!ld->host_name || !find_host(ld->host_name))
+			force_remove = TRUE;
+	} else {
+		if (!ld->host_name || !ld->service_description || !find_service(ld->host_name, ld->service_description))
+			force_remove = TRUE;
+	}
 
-			data_type = XRDDEFAULT_NO_DATA;
+	if (force_remove == TRUE) {
+		broker_downtime_data
+		(NEBTYPE_DOWNTIME_STOP, NEBFLAG_NONE,
+		 NEBATTR_DOWNTIME_STOP_CANCELLED,
+		 data_type == XRDDEFAULT_HOSTDOWNTIME_DATA ? HOST_DOWNTIME : SERVICE_DOWNTIME,
+		 ld->host_name, ld->service_description,
+		 ld->entry_time, ld->author, ld->comment_data,
+		 ld->start_time, ld->end_time, ld->fixed, ld->triggered_by,
+		 ld->duration, ld->downtime_id
+		);
+	} else {
+		/* add the downtime */
+		if (data_type == XRDDEFAULT_HOSTDOWNTIME_DATA) {
+			host *hst = NULL;
+			add_host_downtime(ld->host_name, ld->entry_time, ld->author, ld->comment_data, ld->start_time, ld->flex_downtime_start, ld->end_time, ld->fixed, ld->triggered_by, ld->duration, ld->downtime_id, ld->is_in_effect, ld->start_notification_sent, &ld->comment_id);
+
+			if (ld->is_in_effect && (hst = find_host(ld->host_name)) != NULL) {
+				hst->scheduled_downtime_depth++;
+			}
+		} else {
+			service *svc = NULL;
+			add_service_downtime(ld->host_name, ld->service_description, ld->entry_time, ld->author, ld->comment_data, ld->start_time, ld->flex_downtime_start, ld->end_time, ld->fixed, ld->triggered_by, ld->duration, ld->downtime_id, ld->is_in_effect, ld->start_notification_sent, &ld->comment_id);
+			if (ld->is_in_effect && (svc = find_service(ld->host_name, ld->service_description)) != NULL) {
+				svc->scheduled_downtime_depth++;
+			}
 		}
+		/* must register the downtime with Nagios so it can schedule it, add comments, etc. */
+		register_downtime((data_type == XRDDEFAULT_HOSTDOWNTIME_DATA) ? HOST_DOWNTIME : SERVICE_DOWNTIME, ld->downtime_id);
+	}
 
-		else if (data_type != XRDDEFAULT_NO_DATA) {
+	/* reset defaults */
+	ld->downtime_id = 0;
+	ld->entry_time = 0L;
+	ld->start_time = 0L;
+	ld->flex_downtime_start = (time_t)0;
+	ld->end_time = 0L;
+	ld->fixed = FALSE;
+	ld->triggered_by = 0;
+	ld->duration = 0L;
+}
 
-			/* slightly faster than strtok () */
-			var = input;
-			if ((val = strchr(input, '=')) == NULL)
-				continue;
-			val[0] = '\x0';
-			val++;
+void xrddefault_end_block(struct xrd_loader *ld)
+{
+	customvariablesmember *temp_customvariablesmember = NULL;
+	host *temp_host = ld->hst;
+	service *temp_service = ld->svc;
+	contact *temp_contact = ld->cntct;
 
-			found_directive = TRUE;
+	switch (ld->data_type) {
 
-			switch (data_type) {
+	case XRDDEFAULT_INFO_DATA:
+		break;
 
-			case XRDDEFAULT_INFO_DATA:
-				if (!strcmp(var, "created")) {
-					creation_time = strtoul(val, NULL, 10);
-					time(&current_time);
-					if (creation_time + retention_scheduling_horizon > current_time && creation_time <= current_time)
-						scheduling_info_is_ok = TRUE;
-					else
-						scheduling_info_is_ok = FALSE;
-					last_program_stop = creation_time;
-				} else if (!strcmp(var, "version")) {}
-				else if (!strcmp(var, "last_update_check")) {}
-				else if (!strcmp(var, "update_available")) {}
-				else if (!strcmp(var, "last_version")) {}
-				else if (!strcmp(var, "new_version")) {}
-				break;
+	case XRDDEFAULT_PROGRAMSTATUS_DATA:
 
-			case XRDDEFAULT_PROGRAMSTATUS_DATA:
-				if (!strcmp(var, "modified_host_attributes")) {
+		/* adjust modified attributes if necessary */
+		if (use_retained_program_state == FALSE) {
+			modified_host_process_attributes = MODATTR_NONE;
+			modified_service_process_attributes = MODATTR_NONE;
+		}
+		break;
 
-					modified_host_process_attributes = strtoul(val, NULL, 10);
+	case XRDDEFAULT_HOSTSTATUS_DATA:
 
-					/* mask out attributes we don't want to retain */
-					modified_host_process_attributes &= ~process_host_attribute_mask;
-				} else if (!strcmp(var, "modified_service_attributes")) {
+		if (temp_host != NULL) {
 
-					modified_service_process_attributes = strtoul(val, NULL, 10);
+			/* adjust modified attributes if necessary */
+			if (temp_host->retain_nonstatus_information == FALSE)
+				temp_host->modified_attributes = MODATTR_NONE;
 
-					/* mask out attributes we don't want to retain */
-					modified_service_process_attributes &= ~process_service_attribute_mask;
-				}
-				if (use_retained_program_state == TRUE) {
-					if (!strcmp(var, "enable_notifications")) {
-						if (modified_host_process_attributes & MODATTR_NOTIFICATIONS_ENABLED)
-							enable_notifications = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "active_service_checks_enabled")) {
-						if (modified_service_process_attributes & MODATTR_ACTIVE_CHECKS_ENABLED)
-							execute_service_checks = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "passive_service_checks_enabled")) {
-						if (modified_service_process_attributes & MODATTR_PASSIVE_CHECKS_ENABLED)
-							accept_passive_service_checks = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "active_host_checks_enabled")) {
-						if (modified_host_process_attributes & MODATTR_ACTIVE_CHECKS_ENABLED)
-							execute_host_checks = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "passive_host_checks_enabled")) {
-						if (modified_host_process_attributes & MODATTR_PASSIVE_CHECKS_ENABLED)
-							accept_passive_host_checks = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "enable_event_handlers")) {
-						if (modified_host_process_attributes & MODATTR_EVENT_HANDLER_ENABLED)
-							enable_event_handlers = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "obsess_over_services")) {
-						if (modified_service_process_attributes & MODATTR_OBSESSIVE_HANDLER_ENABLED)
-							obsess_over_services = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "obsess_over_hosts")) {
-						if (modified_host_process_attributes & MODATTR_OBSESSIVE_HANDLER_ENABLED)
-							obsess_over_hosts = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "check_service_freshness")) {
-						if (modified_service_process_attributes & MODATTR_FRESHNESS_CHECKS_ENABLED)
-							check_service_freshness = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "check_host_freshness")) {
-						if (modified_host_process_attributes & MODATTR_FRESHNESS_CHECKS_ENABLED)
-							check_host_freshness = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "enable_flap_detection")) {
-						if (modified_host_process_attributes & MODATTR_FLAP_DETECTION_ENABLED)
-							enable_flap_detection = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "process_performance_data")) {
-						if (modified_host_process_attributes & MODATTR_PERFORMANCE_DATA_ENABLED)
-							process_performance_data = (atoi(val) > 0) ? TRUE : FALSE;
-					} else if (!strcmp(var, "global_host_event_handler")) {
-						if (modified_host_process_attributes & MODATTR_EVENT_HANDLER_COMMAND) {
-
-							/* make sure the check command still exists... */
-							tempval = nm_strdup(val);
-							temp_command = find_bang_command(tempval);
-							if (temp_command && tempval) {
-								nm_free(global_host_event_handler);
-								global_host_event_handler = tempval;
-							}
-						}
-					} else if (!strcmp(var, "global_service_event_handler")) {
-						if (modified_service_process_attributes & MODATTR_EVENT_HANDLER_COMMAND) {
-
-							/* make sure the check command still exists... */
-							tempval = nm_strdup(val);
-							temp_command = find_bang_command(tempval);
-
-							if (temp_command && tempval) {
-								nm_free(global_service_event_handler);
-								global_service_event_handler = tempval;
-							}
-						}
-					} else if (!strcmp(var, "next_comment_id"))
-						next_comment_id = strtoul(val, NULL, 10);
-					else if (!strcmp(var, "next_downtime_id"))
-						next_downtime_id = strtoul(val, NULL, 10);
-					else if (!strcmp(var, "next_event_id"))
-						next_event_id = strtoul(val, NULL, 10);
-					else if (!strcmp(var, "next_problem_id"))
-						next_problem_id = strtoul(val, NULL, 10);
-					else if (!strcmp(var, "next_notification_id"))
-						next_notification_id = strtoul(val, NULL, 10);
+			/* adjust modified attributes if no custom variables have been changed */
+			if (temp_host->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
+				for (temp_customvariablesmember = temp_host->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
+					if (temp_customvariablesmember->has_been_modified == TRUE)
+						break;
 				}
-				break;
+				if (temp_customvariablesmember == NULL)
+					temp_host->modified_attributes &= ~MODATTR_CUSTOM_VARIABLE;
+			}
+
+			/* calculate next possible notification time */
+			if (temp_host->current_state != STATE_UP && temp_host->last_notification != (time_t)0)
+				temp_host->next_notification = get_next_host_notification_time(temp_host, temp_host->last_notification);
 
-			case XRDDEFAULT_HOSTSTATUS_DATA:
+			/* ADDED 01/23/2009 adjust current check attempts if host in hard problem state (max attempts may have changed in config since restart) */
+			if (temp_host->current_state != STATE_UP && temp_host->state_type == HARD_STATE)
+				temp_host->current_attempt = temp_host->max_attempts;
 
-				if (temp_host == NULL) {
-					if (!strcmp(var, "host_name")) {
-						temp_host = find_host(val);
-					}
-				} else {
-					if (!strcmp(var, "modified_attributes")) {
+			/* handle new vars added in 2.x */
+			if (temp_host->last_hard_state_change == (time_t)0)
+				temp_host->last_hard_state_change = temp_host->last_state_change;
 
-						temp_host->modified_attributes = strtoul(val, NULL, 10);
+			/* update host status */
+			update_host_status(temp_host, FALSE);
+		}
 
-						/* mask out attributes we don't want to retain */
-						temp_host->modified_attributes &= ~host_attribute_mask;
+		ld->hst = NULL;
+		break;
 
-						/* break out */
+	case XRDDEFAULT_SERVICESTATUS_DATA:
+
+		if (temp_service != NULL) {
+
+			/* adjust modified attributes if necessary */
+			if (temp_service->retain_nonstatus_information == FALSE)
+				temp_service->modified_attributes = MODATTR_NONE;
+
+			/* adjust modified attributes if no custom variables have been changed */
+			if (temp_service->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
+				for (temp_customvariablesmember = temp_service->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
+					if (temp_customvariablesmember->has_been_modified == TRUE)
 						break;
-					}
-					if (temp_host->retain_status_information == TRUE) {
-						if (!strcmp(var, "has_been_checked"))
-							temp_host->has_been_checked = (atoi(val) > 0) ? TRUE : FALSE;
-						else if (!strcmp(var, "check_execution_time"))
-							temp_host->execution_time = strtod(val, NULL);
-						else if (!strcmp(var, "check_latency"))
-							temp_host->latency = strtod(val, NULL);
-						else if (!strcmp(var, "check_type"))
-							temp_host->check_type = atoi(val);
-						else if (!strcmp(var, "current_state"))
-							temp_host->current_state = atoi(val);
-						else if (!strcmp(var, "last_state"))
-							temp_host->last_state = atoi(val);
-						else if (!strcmp(var, "last_hard_state"))
-							temp_host->last_hard_state = atoi(val);
-						else if (!strcmp(var, "plugin_output")) {
-							nm_free(temp_host->plugin_output);
-							temp_host->plugin_output = nm_strdup(val);
-						} else if (!strcmp(var, "long_plugin_output")) {
-							nm_free(temp_host->long_plugin_output);
-							temp_host->long_plugin_output = nm_strdup(val);
-						} else if (!strcmp(var, "performance_data")) {
-							nm_free(temp_host->perf_data);
-							temp_host->perf_data = nm_strdup(val);
-						} else if (!strcmp(var, "last_check"))
-							temp_host->last_check = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "next_check")) {
-							if (use_retained_scheduling_info == TRUE && scheduling_info_is_ok == TRUE)
-								temp_host->next_check = strtoul(val, NULL, 10);
-						} else if (!strcmp(var, "check_options")) {
-							if (use_retained_scheduling_info == TRUE && scheduling_info_is_ok == TRUE)
-								temp_host->check_options = atoi(val);
-						} else if (!strcmp(var, "current_attempt"))
-							temp_host->current_attempt = (atoi(val) > 0) ? TRUE : FALSE;
-						else if (!strcmp(var, "current_event_id"))
-							temp_host->current_event_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_event_id"))
-							temp_host->last_event_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "current_problem_id"))
-							temp_host->current_problem_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_problem_id"))
-							temp_host->last_problem_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "state_type"))
-							temp_host->state_type = atoi(val);
-						else if (!strcmp(var, "last_state_change"))
-							temp_host->last_state_change = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_hard_state_change"))
-							temp_host->last_hard_state_change = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_time_up"))
-							temp_host->last_time_up = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_time_down"))
-							temp_host->last_time_down = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_time_unreachable"))
-							temp_host->last_time_unreachable = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_update"))
-							temp_host->last_update = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "notified_on_down"))
-							temp_host->notified_on |= (atoi(val) > 0 ? OPT_DOWN : 0);
-						else if (!strcmp(var, "notified_on_unreachable"))
-							temp_host->notified_on |= (atoi(val) > 0 ? OPT_UNREACHABLE : 0);
-						else if (!strcmp(var, "last_notification"))
-							temp_host->last_notification = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "current_notification_number"))
-							temp_host->current_notification_number = atoi(val);
-						else if (!strcmp(var, "current_notification_id"))
-							temp_host->current_notification_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "is_flapping"))
-							temp_host->is_flapping = atoi(val);
-						else if (!strcmp(var, "percent_state_change"))
-							temp_host->percent_state_change = strtod(val, NULL);
-						else if (!strcmp(var, "check_flapping_recovery_notification"))
-							temp_host->check_flapping_recovery_notification = atoi(val);
-						else if (!strcmp(var, "state_history")) {
-							temp_ptr = val;
-							for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++) {
-								if ((ch = my_strsep(&temp_ptr, ",")) != NULL)
-									temp_host->state_history[x] = atoi(ch);
-								else
-									break;
-							}
-							temp_host->state_history_index = 0;
-						} else
-							found_directive = FALSE;
-					}
-					if (temp_host->retain_nonstatus_information == TRUE) {
-						if (found_directive == TRUE) {
-							/* null-op speeds up logic */
-						} else if (!strcmp(var, "config:notifications_enabled")) {
-							conf.notifications_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.notifications_enabled = 1;
-						} else if (!strcmp(var, "config:active_checks_enabled")) {
-							conf.checks_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.checks_enabled = 1;
-						} else if (!strcmp(var, "config:passive_checks_enabled")) {
-							conf.accept_passive_checks = atoi(val) > 0 ? TRUE : FALSE;
-							have.accept_passive_checks = 1;
-						} else if (!strcmp(var, "config:event_handler_enabled")) {
-							conf.event_handler_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.event_handler_enabled = 1;
-						} else if (!strcmp(var, "config:flap_detection_enabled")) {
-							conf.flap_detection_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.flap_detection_enabled = 1;
-						} else if (!strcmp(var, "config:process_performance_data")) {
-							conf.process_performance_data = atoi(val) > 0 ? TRUE : FALSE;
-							have.process_performance_data = 1;
-						} else if (!strcmp(var, "config:obsess")) {
-							conf.obsess = atoi(val) > 0 ? TRUE : FALSE;
-							have.obsess = 1;
-						} else if (!strcmp(var, "problem_has_been_acknowledged")) {
-							temp_host->problem_has_been_acknowledged = (atoi(val) > 0) ? TRUE : FALSE;
-						} else if (!strcmp(var, "acknowledgement_type")) {
-							temp_host->acknowledgement_type = atoi(val);
-						} else if (!strcmp(var, "notifications_enabled")) {
-							RETAIN_BOOL(host, temp_host, notifications_enabled, MODATTR_NOTIFICATIONS_ENABLED);
-						} else if (!strcmp(var, "active_checks_enabled")) {
-							RETAIN_BOOL(host, temp_host, checks_enabled, MODATTR_ACTIVE_CHECKS_ENABLED);
-						} else if (!strcmp(var, "passive_checks_enabled")) {
-							RETAIN_BOOL(host, temp_host, accept_passive_checks, MODATTR_PASSIVE_CHECKS_ENABLED);
-						} else if (!strcmp(var, "event_handler_enabled")) {
-							RETAIN_BOOL(host, temp_host, event_handler_enabled, MODATTR_EVENT_HANDLER_ENABLED);
-						} else if (!strcmp(var, "flap_detection_enabled")) {
-							RETAIN_BOOL(host, temp_host, flap_detection_enabled, MODATTR_FLAP_DETECTION_ENABLED);
-						} else if (!strcmp(var, "process_performance_data")) {
-							RETAIN_BOOL(host, temp_host, process_performance_data, MODATTR_PERFORMANCE_DATA_ENABLED);
-						} else if (!strcmp(var, "obsess_over_host") || !strcmp(var, "obsess")) {
-							RETAIN_BOOL(host, temp_host, obsess, MODATTR_OBSESSIVE_HANDLER_ENABLED);
-						} else if (!strcmp(var, "check_command")) {
-							if (temp_host->modified_attributes & MODATTR_CHECK_COMMAND) {
-
-								/* make sure the check command still exists... */
-								tempval = nm_strdup(val);
-								temp_command = find_bang_command(tempval);
-								if (temp_command && tempval) {
-									nm_free(temp_host->check_command);
-									temp_host->check_command = tempval;
-								} else
-									temp_host->modified_attributes &= ~MODATTR_CHECK_COMMAND;
-							}
-						} else if (!strcmp(var, "check_period")) {
-							if (temp_host->modified_attributes & MODATTR_CHECK_TIMEPERIOD) {
-
-								/* make sure the timeperiod still exists... */
-								temp_timeperiod = find_timeperiod(val);
-								if (temp_timeperiod) {
-									temp_host->check_period = temp_timeperiod->name;
-									temp_host->check_period_ptr = temp_timeperiod;
-								} else {
-									temp_host->modified_attributes &= ~MODATTR_CHECK_TIMEPERIOD;
-								}
-							}
-						} else if (!strcmp(var, "notification_period")) {
-							if (temp_host->modified_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
-
-								/* make sure the timeperiod still exists... */
-								temp_timeperiod = find_timeperiod(val);
-								if (temp_timeperiod) {
-									temp_host->notification_period = temp_timeperiod->name;
-									temp_host->notification_period_ptr = temp_timeperiod;
-								} else {
-									temp_host->modified_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
-								}
-							}
-						} else if (!strcmp(var, "event_handler")) {
-							if (temp_host->modified_attributes & MODATTR_EVENT_HANDLER_COMMAND) {
-
-								/* make sure the check command still exists... */
-								tempval = nm_strdup(val);
-								temp_command = find_bang_command(tempval);
-								if (temp_command && tempval) {
-									nm_free(temp_host->event_handler);
-									temp_host->event_handler = tempval;
-								} else
-									temp_host->modified_attributes &= ~MODATTR_EVENT_HANDLER_COMMAND;
-							}
-						} else if (!strcmp(var, "normal_check_interval")) {
-							if (temp_host->modified_attributes & MODATTR_NORMAL_CHECK_INTERVAL && strtod(val, NULL) >= 0)
-								temp_host->check_interval = strtod(val, NULL);
-						} else if (!strcmp(var, "retry_check_interval")) {
-							if (temp_host->modified_attributes & MODATTR_RETRY_CHECK_INTERVAL && strtod(val, NULL) >= 0)
-								temp_host->retry_interval = strtod(val, NULL);
-						} else if (!strcmp(var, "max_attempts")) {
-							if (temp_host->modified_attributes & MODATTR_MAX_CHECK_ATTEMPTS && atoi(val) >= 1) {
-
-								temp_host->max_attempts = atoi(val);
-
-								/* adjust current attempt number if in a hard state */
-								if (temp_host->state_type == HARD_STATE && temp_host->current_state != STATE_UP && temp_host->current_attempt > 1)
-									temp_host->current_attempt = temp_host->max_attempts;
-							}
-						}
-
-						/* custom variables */
-						else if (var[0] == '_') {
-
-							if (temp_host->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
-
-								/* get the variable name */
-								customvarname = nm_strdup(var + 1);
-
-								for (temp_customvariablesmember = temp_host->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-									if (!strcmp(customvarname, temp_customvariablesmember->variable_name)) {
-										if ((x = atoi(val)) > 0 && strlen(val) >= 2) {
-											nm_free(temp_customvariablesmember->variable_value);
-											temp_customvariablesmember->variable_value = nm_strdup(val + 2);
-											temp_customvariablesmember->has_been_modified = (x > 0) ? TRUE : FALSE;
-										}
-										break;
-									}
-								}
-
-								nm_free(customvarname);
-							}
-
-						}
-					}
 
 				}
+				if (temp_customvariablesmember == NULL)
+					temp_service->modified_attributes &= ~MODATTR_CUSTOM_VARIABLE;
+			}
 
-				break;
+			/* calculate next possible notification time */
+			if (temp_service->current_state != STATE_OK && temp_service->last_notification != (time_t)0)
+				temp_service->next_notification = get_next_service_notification_time(temp_service, temp_service->last_notification);
 
-			case XRDDEFAULT_SERVICESTATUS_DATA:
+			/* fix old vars */
+			if (temp_service->has_been_checked == FALSE && temp_service->state_type == SOFT_STATE)
+				temp_service->state_type = HARD_STATE;
 
-				if (temp_service == NULL) {
-					if (!strcmp(var, "host_name")) {
-						host_name = nm_strdup(val);
-						break;
-					} else if (!strcmp(var, "service_description")) {
-						temp_service = find_service(host_name, val);
+			/* ADDED 01/23/2009 adjust current check attempt if service is in hard problem state (max attempts may have changed in config since restart) */
+			if (temp_service->current_state != STATE_OK && temp_service->state_type == HARD_STATE)
+				temp_service->current_attempt = temp_service->max_attempts;
+
+			/* handle new vars added in 2.x */
+			if (temp_service->last_hard_state_change == (time_t)0)
+				temp_service->last_hard_state_change = temp_service->last_state_change;
+
+			/* update service status */
+			update_service_status(temp_service, FALSE);
+		}
+
+		ld->svc = NULL;
+		break;
+
+	case XRDDEFAULT_CONTACTSTATUS_DATA:
+
+		if (temp_contact != NULL) {
+
+			/* adjust modified attributes if necessary */
+			if (temp_contact->retain_nonstatus_information == FALSE)
+				temp_contact->modified_attributes = MODATTR_NONE;
+
+			/* adjust modified attributes if no custom variables have been changed */
+			if (temp_contact->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
+				for (temp_customvariablesmember = temp_contact->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
+					if (temp_customvariablesmember->has_been_modified == TRUE)
 						break;
-					}
-				} else {
-					if (!strcmp(var, "modified_attributes")) {
-
-						temp_service->modified_attributes = strtoul(val, NULL, 10);
-
-						/* mask out attributes we don't want to retain */
-						temp_service->modified_attributes &= ~service_attribute_mask;
-					}
-					if (temp_service->retain_status_information == TRUE) {
-						if (!strcmp(var, "has_been_checked")) {
-							temp_service->has_been_checked = (atoi(val) > 0) ? TRUE : FALSE;
-						} else if (!strcmp(var, "config:notifications_enabled")) {
-							conf.notifications_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.notifications_enabled = 1;
-						} else if (!strcmp(var, "config:active_checks_enabled")) {
-							conf.checks_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.checks_enabled = 1;
-						} else if (!strcmp(var, "config:passive_checks_enabled")) {
-							conf.accept_passive_checks = atoi(val) > 0 ? TRUE : FALSE;
-							have.accept_passive_checks = 1;
-						} else if (!strcmp(var, "config:event_handler_enabled")) {
-							conf.event_handler_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.event_handler_enabled = 1;
-						} else if (!strcmp(var, "config:flap_detection_enabled")) {
-							conf.flap_detection_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.flap_detection_enabled = 1;
-						} else if (!strcmp(var, "config:process_performance_data")) {
-							conf.process_performance_data = atoi(val) > 0 ? TRUE : FALSE;
-							have.process_performance_data = 1;
-						} else if (!strcmp(var, "config:obsess")) {
-							conf.obsess = atoi(val) > 0 ? TRUE : FALSE;
-							have.obsess = 1;
-						} else if (!strcmp(var, "check_execution_time"))
-							temp_service->execution_time = strtod(val, NULL);
-						else if (!strcmp(var, "check_latency"))
-							temp_service->latency = strtod(val, NULL);
-						else if (!strcmp(var, "check_type"))
-							temp_service->check_type = atoi(val);
-						else if (!strcmp(var, "current_state"))
-							temp_service->current_state = atoi(val);
-						else if (!strcmp(var, "last_state"))
-							temp_service->last_state = atoi(val);
-						else if (!strcmp(var, "last_hard_state"))
-							temp_service->last_hard_state = atoi(val);
-						else if (!strcmp(var, "current_attempt"))
-							temp_service->current_attempt = atoi(val);
-						else if (!strcmp(var, "current_event_id"))
-							temp_service->current_event_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_event_id"))
-							temp_service->last_event_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "current_problem_id"))
-							temp_service->current_problem_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_problem_id"))
-							temp_service->last_problem_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "state_type"))
-							temp_service->state_type = atoi(val);
-						else if (!strcmp(var, "last_state_change"))
-							temp_service->last_state_change = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_hard_state_change"))
-							temp_service->last_hard_state_change = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_time_ok"))
-							temp_service->last_time_ok = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_time_warning"))
-							temp_service->last_time_warning = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_time_unknown"))
-							temp_service->last_time_unknown = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_time_critical"))
-							temp_service->last_time_critical = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_update"))
-							temp_service->last_update = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "plugin_output")) {
-							nm_free(temp_service->plugin_output);
-							temp_service->plugin_output = nm_strdup(val);
-						} else if (!strcmp(var, "long_plugin_output")) {
-							nm_free(temp_service->long_plugin_output);
-							temp_service->long_plugin_output = nm_strdup(val);
-						} else if (!strcmp(var, "performance_data")) {
-							nm_free(temp_service->perf_data);
-							temp_service->perf_data = nm_strdup(val);
-						} else if (!strcmp(var, "last_check"))
-							temp_service->last_check = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "next_check")) {
-							if (use_retained_scheduling_info == TRUE && scheduling_info_is_ok == TRUE)
-								temp_service->next_check = strtoul(val, NULL, 10);
-						} else if (!strcmp(var, "check_options")) {
-							if (use_retained_scheduling_info == TRUE && scheduling_info_is_ok == TRUE)
-								temp_service->check_options = atoi(val);
-						} else if (!strcmp(var, "notified_on_unknown"))
-							temp_service->notified_on |= ((atoi(val) > 0) ? OPT_UNKNOWN : 0);
-						else if (!strcmp(var, "notified_on_warning"))
-							temp_service->notified_on |= ((atoi(val) > 0) ? OPT_WARNING : 0);
-						else if (!strcmp(var, "notified_on_critical"))
-							temp_service->notified_on |= ((atoi(val) > 0) ? OPT_CRITICAL : 0);
-						else if (!strcmp(var, "current_notification_number"))
-							temp_service->current_notification_number = atoi(val);
-						else if (!strcmp(var, "current_notification_id"))
-							temp_service->current_notification_id = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_notification"))
-							temp_service->last_notification = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "is_flapping"))
-							temp_service->is_flapping = atoi(val);
-						else if (!strcmp(var, "percent_state_change"))
-							temp_service->percent_state_change = strtod(val, NULL);
-						else if (!strcmp(var, "check_flapping_recovery_notification"))
-							temp_service->check_flapping_recovery_notification = atoi(val);
-						else if (!strcmp(var, "state_history")) {
-							temp_ptr = val;
-							for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++) {
-								if ((ch = my_strsep(&temp_ptr, ",")) != NULL)
-									temp_service->state_history[x] = atoi(ch);
-								else
-									break;
-							}
-							temp_service->state_history_index = 0;
-						} else
-							found_directive = FALSE;
-					}
-					if (temp_service->retain_nonstatus_information == TRUE) {
-						if (found_directive == TRUE) {
-							/* null-op speeds up logic */
-						} else if (!strcmp(var, "config:notifications_enabled")) {
-							conf.notifications_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.notifications_enabled = 1;
-						} else if (!strcmp(var, "config:active_checks_enabled")) {
-							conf.checks_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.checks_enabled = 1;
-						} else if (!strcmp(var, "config:passive_checks_enabled")) {
-							conf.accept_passive_checks = atoi(val) > 0 ? TRUE : FALSE;
-							have.accept_passive_checks = 1;
-						} else if (!strcmp(var, "config:event_handler_enabled")) {
-							conf.event_handler_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.event_handler_enabled = 1;
-						} else if (!strcmp(var, "config:flap_detection_enabled")) {
-							conf.flap_detection_enabled = atoi(val) > 0 ? TRUE : FALSE;
-							have.flap_detection_enabled = 1;
-						} else if (!strcmp(var, "config:process_performance_data")) {
-							conf.process_performance_data = atoi(val) > 0 ? TRUE : FALSE;
-							have.process_performance_data = 1;
-						} else if (!strcmp(var, "config:obsess")) {
-							conf.obsess = atoi(val) > 0 ? TRUE : FALSE;
-							have.obsess = 1;
-						} else if (!strcmp(var, "problem_has_been_acknowledged")) {
-							temp_service->problem_has_been_acknowledged = (atoi(val) > 0) ? TRUE : FALSE;
-						} else if (!strcmp(var, "acknowledgement_type")) {
-							temp_service->acknowledgement_type = atoi(val);
-						} else if (!strcmp(var, "notifications_enabled")) {
-							RETAIN_BOOL(service, temp_service, notifications_enabled, MODATTR_NOTIFICATIONS_ENABLED);
-						} else if (!strcmp(var, "active_checks_enabled")) {
-							RETAIN_BOOL(service, temp_service, checks_enabled, MODATTR_ACTIVE_CHECKS_ENABLED);
-						} else if (!strcmp(var, "passive_checks_enabled")) {
-							RETAIN_BOOL(service, temp_service, accept_passive_checks, MODATTR_PASSIVE_CHECKS_ENABLED);
-						} else if (!strcmp(var, "event_handler_enabled")) {
-							RETAIN_BOOL(service, temp_service, event_handler_enabled, MODATTR_EVENT_HANDLER_ENABLED);
-						} else if (!strcmp(var, "flap_detection_enabled")) {
-							RETAIN_BOOL(service, temp_service, flap_detection_enabled, MODATTR_FLAP_DETECTION_ENABLED);
-						} else if (!strcmp(var, "process_performance_data")) {
-							RETAIN_BOOL(service, temp_service, process_performance_data, MODATTR_PERFORMANCE_DATA_ENABLED);
-						} else if (!strcmp(var, "obsess_over_service") || !strcmp(var, "obsess")) {
-							RETAIN_BOOL(service, temp_service, obsess, MODATTR_OBSESSIVE_HANDLER_ENABLED);
-						} else if (!strcmp(var, "check_command")) {
-							if (temp_service->modified_attributes & MODATTR_CHECK_COMMAND) {
-
-								/* make sure the check command still exists... */
-								tempval = nm_strdup(val);
-								temp_command = find_bang_command(tempval);
-								if (temp_command && tempval) {
-									nm_free(temp_service->check_command);
-									temp_service->check_command = tempval;
-								} else {
-									temp_service->modified_attributes &= ~MODATTR_CHECK_COMMAND;
-								}
-							}
-						} else if (!strcmp(var, "check_period")) {
-							if (temp_service->modified_attributes & MODATTR_CHECK_TIMEPERIOD) {
-
-								/* make sure the timeperiod still exists... */
-								temp_timeperiod = find_timeperiod(val);
-								if (temp_timeperiod) {
-									temp_service->check_period = temp_timeperiod->name;
-									temp_service->check_period_ptr = temp_timeperiod;
-								} else {
-									temp_service->modified_attributes &= ~MODATTR_CHECK_TIMEPERIOD;
-								}
-							}
-						} else if (!strcmp(var, "notification_period")) {
-							if (temp_service->modified_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
-
-								/* make sure the timeperiod still exists... */
-								temp_timeperiod = find_timeperiod(val);
-								if (temp_timeperiod) {
-									temp_service->notification_period = temp_timeperiod->name;
-									temp_service->notification_period_ptr = temp_timeperiod;
-								} else {
-									temp_service->modified_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
-								}
-							}
-						} else if (!strcmp(var, "event_handler")) {
-							if (temp_service->modified_attributes & MODATTR_EVENT_HANDLER_COMMAND) {
-
-								/* make sure the check command still exists... */
-								tempval = nm_strdup(val);
-								temp_command = find_bang_command(temp_ptr);
-								if (temp_command && tempval) {
-									nm_free(temp_service->event_handler);
-									temp_service->event_handler = tempval;
-								} else {
-									temp_service->modified_attributes &= ~MODATTR_EVENT_HANDLER_COMMAND;
-								}
-							}
-						} else if (!strcmp(var, "normal_check_interval")) {
-							if (temp_service->modified_attributes & MODATTR_NORMAL_CHECK_INTERVAL && strtod(val, NULL) >= 0)
-								temp_service->check_interval = strtod(val, NULL);
-						} else if (!strcmp(var, "retry_check_interval")) {
-							if (temp_service->modified_attributes & MODATTR_RETRY_CHECK_INTERVAL && strtod(val, NULL) >= 0)
-								temp_service->retry_interval = strtod(val, NULL);
-						} else if (!strcmp(var, "max_attempts")) {
-							if (temp_service->modified_attributes & MODATTR_MAX_CHECK_ATTEMPTS && atoi(val) >= 1) {
-
-								temp_service->max_attempts = atoi(val);
-
-								/* adjust current attempt number if in a hard state */
-								if (temp_service->state_type == HARD_STATE && temp_service->current_state != STATE_OK && temp_service->current_attempt > 1)
-									temp_service->current_attempt = temp_service->max_attempts;
-							}
-						}
-
-						/* custom variables */
-						else if (var[0] == '_') {
-
-							if (temp_service->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
-
-								/* get the variable name */
-								customvarname = nm_strdup(var + 1);
-								for (temp_customvariablesmember = temp_service->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-									if (!strcmp(customvarname, temp_customvariablesmember->variable_name)) {
-										if ((x = atoi(val)) > 0 && strlen(val) >= 2) {
-											nm_free(temp_customvariablesmember->variable_value);
-											temp_customvariablesmember->variable_value = nm_strdup(val + 2);
-											temp_customvariablesmember->has_been_modified = (x > 0) ? TRUE : FALSE;
-										}
-										break;
-									}
-								}
-
-								nm_free(customvarname);
-							}
-						}
-					}
+
 				}
+				if (temp_customvariablesmember == NULL)
+					temp_contact->modified_attributes &= ~MODATTR_CUSTOM_VARIABLE;
+			}
+
+			/* update contact status */
+			update_contact_status(temp_contact, FALSE);
+		}
+
+		ld->cntct = NULL;
+		break;
+
+	case XRDDEFAULT_HOSTCOMMENT_DATA:
+	case XRDDEFAULT_SERVICECOMMENT_DATA:
+		end_comment(ld);
+		break;
+
+	case XRDDEFAULT_HOSTDOWNTIME_DATA:
+	case XRDDEFAULT_SERVICEDOWNTIME_DATA:
+		end_downtime(ld);
+		break;
+
+	default:
+		break;
+	}
+
+	/* free temp memory */
+	nm_free(ld->host_name);
+	nm_free(ld->service_description);
+	nm_free(ld->author);
+	nm_free(ld->comment_data);
+
+	ld->data_type = XRDDEFAULT_NO_DATA;
+}
+
+/* reads the text format */
+static int read_text_state_information(struct xrd_loader *ld)
+{
+	char *input = NULL;
+	char *inputbuf = NULL;
+	mmapfile *thefile;
+	GHashTable *keys;
+	enum xrd_key key;
+	struct xrd_value value;
+	char *var = NULL;
+	char *val = NULL;
+	char *brace;
+	int x;
 
-				break;
-
-			case XRDDEFAULT_CONTACTSTATUS_DATA:
-				if (temp_contact == NULL) {
-					if (!strcmp(var, "contact_name")) {
-						contact_name = nm_strdup(val);
-						temp_contact = find_contact(contact_name);
-					}
-				} else {
-					if (!strcmp(var, "modified_attributes")) {
-
-						temp_contact->modified_attributes = strtoul(val, NULL, 10);
-
-						/* mask out attributes we don't want to retain */
-						temp_contact->modified_attributes &= ~contact_attribute_mask;
-					} else if (!strcmp(var, "modified_host_attributes")) {
-
-						temp_contact->modified_host_attributes = strtoul(val, NULL, 10);
-
-						/* mask out attributes we don't want to retain */
-						temp_contact->modified_host_attributes &= ~contact_host_attribute_mask;
-					} else if (!strcmp(var, "modified_service_attributes")) {
-						temp_contact->modified_service_attributes = strtoul(val, NULL, 10);
-
-						/* mask out attributes we don't want to retain */
-						temp_contact->modified_service_attributes &= ~contact_service_attribute_mask;
-					} else if (temp_contact->retain_status_information == TRUE) {
-						if (!strcmp(var, "last_host_notification"))
-							temp_contact->last_host_notification = strtoul(val, NULL, 10);
-						else if (!strcmp(var, "last_service_notification"))
-							temp_contact->last_service_notification = strtoul(val, NULL, 10);
-						else
-							found_directive = FALSE;
-					}
-					if (temp_contact->retain_nonstatus_information == TRUE) {
-						/* null-op speeds up logic */
-						if (found_directive == TRUE);
-
-						else if (!strcmp(var, "host_notification_period")) {
-							if (temp_contact->modified_host_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
-
-								/* make sure the timeperiod still exists... */
-								temp_timeperiod = find_timeperiod(val);
-								if (temp_timeperiod) {
-									temp_contact->host_notification_period = temp_timeperiod->name;
-									temp_contact->host_notification_period_ptr = temp_timeperiod;
-								} else {
-									temp_contact->modified_host_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
-								}
-							}
-						} else if (!strcmp(var, "service_notification_period")) {
-							if (temp_contact->modified_service_attributes & MODATTR_NOTIFICATION_TIMEPERIOD) {
-
-								/* make sure the timeperiod still exists... */
-								temp_timeperiod = find_timeperiod(val);
-								if (temp_timeperiod) {
-									temp_contact->service_notification_period = temp_timeperiod->name;
-									temp_contact->service_notification_period_ptr = temp_timeperiod;
-								} else {
-									temp_contact->modified_service_attributes &= ~MODATTR_NOTIFICATION_TIMEPERIOD;
-								}
-							}
-						} else if (!strcmp(var, "config:host_notifications_enabled")) {
-							cont_have.host_notifications_enabled = TRUE;
-							cont_conf.host_notifications_enabled = atoi(val) > 0 ? TRUE : FALSE;
-						} else if (!strcmp(var, "host_notifications_enabled")) {
-							if (temp_contact->modified_host_attributes & MODATTR_NOTIFICATIONS_ENABLED
-							    || (cont_have.host_notifications_enabled && cont_conf.host_notifications_enabled == temp_contact->host_notifications_enabled)) {
-								pre_modify_contact_attribute(temp_contact, MODATTR_NOTIFICATIONS_ENABLED);
-								temp_contact->host_notifications_enabled = (atoi(val) > 0) ? TRUE : FALSE;
-							}
-						} else if (!strcmp(var, "config:service_notifications_enabled")) {
-							cont_have.service_notifications_enabled = TRUE;
-							cont_conf.service_notifications_enabled = atoi(val) > 0 ? TRUE : FALSE;
-						} else if (!strcmp(var, "service_notifications_enabled")) {
-							if (temp_contact->modified_service_attributes & MODATTR_NOTIFICATIONS_ENABLED
-							    || (cont_have.service_notifications_enabled && cont_conf.service_notifications_enabled == temp_contact->service_notifications_enabled)) {
-								pre_modify_contact_attribute(temp_contact, MODATTR_NOTIFICATIONS_ENABLED);
-								temp_contact->service_notifications_enabled = (atoi(val) > 0) ? TRUE : FALSE;
-							}
-						}
-						/* custom variables */
-						else if (var[0] == '_') {
-
-							if (temp_contact->modified_attributes & MODATTR_CUSTOM_VARIABLE) {
-
-								/* get the variable name */
-								customvarname = nm_strdup(var + 1);
-								for (temp_customvariablesmember = temp_contact->custom_variables; temp_customvariablesmember != NULL; temp_customvariablesmember = temp_customvariablesmember->next) {
-									if (!strcmp(customvarname, temp_customvariablesmember->variable_name)) {
-										if ((x = atoi(val)) > 0 && strlen(val) >= 2) {
-											nm_free(temp_customvariablesmember->variable_value);
-											temp_customvariablesmember->variable_value = nm_strdup(val + 2);
-											temp_customvariablesmember->has_been_modified = (x > 0) ? TRUE : FALSE;
-										}
-										break;
-									}
-								}
-
-								nm_free(customvarname);
-							}
-						}
-					}
+	/* open the retention file for reading */
+	if ((thefile = mmap_fopen(retention_file)) == NULL)
+		return ERROR;
+
+	keys = g_hash_table_new(g_str_hash, g_str_equal);
+	for (x = XRD_KEY_UNKNOWN + 1; x < XRD_NUM_KEYS; x++) {
+		if (xrd_keys[x].name)
+			g_hash_table_insert(keys, (gpointer)xrd_keys[x].name, GINT_TO_POINTER(x));
+	}
+	g_hash_table_insert(keys, "obsess_over_host", GINT_TO_POINTER(XRD_KEY_OBSESS));
+	g_hash_table_insert(keys, "obsess_over_service", GINT_TO_POINTER(XRD_KEY_OBSESS));
+
+	/* read all lines in the retention file */
+	while (1) {
+		nm_free(inputbuf);
+
+		/* read the next line */
+		if ((inputbuf = mmap_fgets(thefile)) == NULL)
+			break;
+
+		input = inputbuf;
+
+		/* far better than strip()ing */
+		if (input[0] == '\t')
+			input++;
+
+		strip(input);
+
+		if (!strcmp(input, "}")) {
+			xrddefault_end_block(ld);
+			continue;
+		}
+
+		if ((brace = strstr(input, " {")) != NULL && brace[2] == 0) {
+			*brace = 0;
+			for (x = XRDDEFAULT_INFO_DATA; x < XRDDEFAULT_NUM_DATA_TYPES; x++) {
+				if (!strcmp(input, block_names[x])) {
+					xrddefault_begin_block(ld, x, NULL);
+					break;
 				}
-				break;
-
-			case XRDDEFAULT_HOSTCOMMENT_DATA:
-			case XRDDEFAULT_SERVICECOMMENT_DATA:
-				if (!strcmp(var, "host_name"))
-					host_name = nm_strdup(val);
-				else if (!strcmp(var, "service_description"))
-					service_description = nm_strdup(val);
-				else if (!strcmp(var, "entry_type"))
-					entry_type = atoi(val);
-				else if (!strcmp(var, "comment_id"))
-					comment_id = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "source"))
-					source = atoi(val);
-				else if (!strcmp(var, "persistent"))
-					persistent = (atoi(val) > 0) ? TRUE : FALSE;
-				else if (!strcmp(var, "entry_time"))
-					entry_time = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "expires"))
-					expires = (atoi(val) > 0) ? TRUE : FALSE;
-				else if (!strcmp(var, "expire_time"))
-					expire_time = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "author"))
-					author = nm_strdup(val);
-				else if (!strcmp(var, "comment_data"))
-					comment_data = nm_strdup(val);
-				break;
-
-			case XRDDEFAULT_HOSTDOWNTIME_DATA:
-			case XRDDEFAULT_SERVICEDOWNTIME_DATA:
-				if (!strcmp(var, "host_name"))
-					host_name = nm_strdup(val);
-				else if (!strcmp(var, "service_description"))
-					service_description = nm_strdup(val);
-				else if (!strcmp(var, "downtime_id"))
-					downtime_id = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "comment_id"))
-					comment_id = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "entry_time"))
-					entry_time = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "start_time"))
-					start_time = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "flex_downtime_start"))
-					flex_downtime_start = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "end_time"))
-					end_time = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "fixed"))
-					fixed = (atoi(val) > 0) ? TRUE : FALSE;
-				else if (!strcmp(var, "triggered_by"))
-					triggered_by = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "is_in_effect"))
-					is_in_effect = (atoi(val) > 0) ? TRUE : FALSE;
-				else if (!strcmp(var, "start_notification_sent"))
-					start_notification_sent = (atoi(val) > 0) ? TRUE : FALSE;
-				else if (!strcmp(var, "duration"))
-					duration = strtoul(val, NULL, 10);
-				else if (!strcmp(var, "author"))
-					author = nm_strdup(val);
-				else if (!strcmp(var, "comment"))
-					comment_data = nm_strdup(val);
-				break;
-
-			default:
-				break;
 			}
+			continue;
 		}
+
+		if (ld->data_type == XRDDEFAULT_NO_DATA)
+			continue;
+
+		/* slightly faster than strtok () */
+		var = input;
+		if ((val = strchr(input, '=')) == NULL)
+			continue;
+		val[0] = '\x0';
+		val++;
+
+		if (var[0] == '_') {
+			key = XRD_KEY_CUSTOM_VARIABLE;
+			var++;
+		} else if ((key = GPOINTER_TO_INT(g_hash_table_lookup(keys, var))) == XRD_KEY_UNKNOWN) {
+			continue;
+		}
+
+		switch (xrd_keys[key].kind) {
+		case XRD_INT:
+			value.i = atoi(val);
+			break;
+		case XRD_ULONG:
+			value.ul = strtoul(val, NULL, 10);
+			break;
+		case XRD_DOUBLE:
+			value.d = strtod(val, NULL);
+			break;
+		case XRD_STRING:
+			value.s = val;
+			break;
+		}
+		xrddefault_apply(ld, key, &value, var);
 	}
 
 	nm_free(inputbuf);
 	mmap_fclose(thefile);
+	g_hash_table_destroy(keys);
+
+	return OK;
+}
+
+int xrddefault_read_state_information(void)
+{
+	struct xrd_loader ld;
+	int result;
+
+	/* make sure we have what we need */
+	if (retention_file == NULL) {
+
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: We don't have a filename for retention data!\n");
+
+		return ERROR;
+	}
+
+	memset(&ld, 0, sizeof(ld));
+	ld.data_type = XRDDEFAULT_NO_DATA;
+	ld.entry_type = USER_COMMENT;
+	ld.source = COMMENTSOURCE_INTERNAL;
+
+	/* what attributes should be masked out? */
+	/* NOTE: host/service/contact-specific values may be added in the future, but for now we only have global masks */
+	ld.process_host_attribute_mask = retained_process_host_attribute_mask;
+	ld.process_service_attribute_mask = retained_process_host_attribute_mask;
+	ld.host_attribute_mask = retained_host_attribute_mask;
+	ld.service_attribute_mask = retained_host_attribute_mask;
+	ld.contact_host_attribute_mask = retained_contact_host_attribute_mask;
+	ld.contact_service_attribute_mask = retained_contact_service_attribute_mask;
+
+	/* Big speedup when reading retention.dat in bulk */
+	defer_downtime_sorting = 1;
+	defer_comment_sorting = 1;
+
+	/*
+	 * Whatever format the file is in, it's read; the next save
+	 * writes it in the format binary_retention asks for.
+	 */
+	if (xrdb_is_binary(retention_file)) {
+		log_debug_info(DEBUGL_RETENTIONDATA, 2, "Reading binary retention data from '%s'\n", retention_file);
+		result = xrdb_read(retention_file, &ld);
+	} else {
+		result = read_text_state_information(&ld);
+	}
+
+	/* in case the file ended inside a block */
+	nm_free(ld.host_name);
+	nm_free(ld.service_description);
+	nm_free(ld.author);
+	nm_free(ld.comment_data);
+
+	if (result != OK)
+		return ERROR;
 
 	if (sort_downtime() != OK)
 		return ERROR;
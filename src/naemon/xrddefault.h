@@ -15,9 +15,186 @@
 #define XRDDEFAULT_SERVICECOMMENT_DATA   7
 #define XRDDEFAULT_HOSTDOWNTIME_DATA     8
 #define XRDDEFAULT_SERVICEDOWNTIME_DATA  9
+#define XRDDEFAULT_NUM_DATA_TYPES        10
 
 NAGIOS_BEGIN_DECL
 
+/*
+ * The variables of the retention file. Binary retention files store
+ * these numbers instead of the names, so new ones go at the end.
+ */
+enum xrd_key {
+	XRD_KEY_UNKNOWN,
+	XRD_KEY_CREATED,
+	XRD_KEY_VERSION,
+	XRD_KEY_MODIFIED_ATTRIBUTES,
+	XRD_KEY_MODIFIED_HOST_ATTRIBUTES,
+	XRD_KEY_MODIFIED_SERVICE_ATTRIBUTES,
+	XRD_KEY_ENABLE_NOTIFICATIONS,
+	XRD_KEY_ACTIVE_SERVICE_CHECKS_ENABLED,
+	XRD_KEY_PASSIVE_SERVICE_CHECKS_ENABLED,
+	XRD_KEY_ACTIVE_HOST_CHECKS_ENABLED,
+	XRD_KEY_PASSIVE_HOST_CHECKS_ENABLED,
+	XRD_KEY_ENABLE_EVENT_HANDLERS,
+	XRD_KEY_OBSESS_OVER_SERVICES,
+	XRD_KEY_OBSESS_OVER_HOSTS,
+	XRD_KEY_CHECK_SERVICE_FRESHNESS,
+	XRD_KEY_CHECK_HOST_FRESHNESS,
+	XRD_KEY_ENABLE_FLAP_DETECTION,
+	XRD_KEY_PROCESS_PERFORMANCE_DATA,
+	XRD_KEY_GLOBAL_HOST_EVENT_HANDLER,
+	XRD_KEY_GLOBAL_SERVICE_EVENT_HANDLER,
+	XRD_KEY_NEXT_COMMENT_ID,
+	XRD_KEY_NEXT_DOWNTIME_ID,
+	XRD_KEY_NEXT_EVENT_ID,
+	XRD_KEY_NEXT_PROBLEM_ID,
+	XRD_KEY_NEXT_NOTIFICATION_ID,
+	XRD_KEY_HOST_NAME,
+	XRD_KEY_SERVICE_DESCRIPTION,
+	XRD_KEY_CONTACT_NAME,
+	XRD_KEY_CHECK_COMMAND,
+	XRD_KEY_CHECK_PERIOD,
+	XRD_KEY_NOTIFICATION_PERIOD,
+	XRD_KEY_EVENT_HANDLER,
+	XRD_KEY_HAS_BEEN_CHECKED,
+	XRD_KEY_CHECK_EXECUTION_TIME,
+	XRD_KEY_CHECK_LATENCY,
+	XRD_KEY_CHECK_TYPE,
+	XRD_KEY_CURRENT_STATE,
+	XRD_KEY_LAST_STATE,
+	XRD_KEY_LAST_HARD_STATE,
+	XRD_KEY_LAST_EVENT_ID,
+	XRD_KEY_CURRENT_EVENT_ID,
+	XRD_KEY_CURRENT_PROBLEM_ID,
+	XRD_KEY_LAST_PROBLEM_ID,
+	XRD_KEY_PLUGIN_OUTPUT,
+	XRD_KEY_LONG_PLUGIN_OUTPUT,
+	XRD_KEY_PERFORMANCE_DATA,
+	XRD_KEY_LAST_CHECK,
+	XRD_KEY_NEXT_CHECK,
+	XRD_KEY_CHECK_OPTIONS,
+	XRD_KEY_CURRENT_ATTEMPT,
+	XRD_KEY_MAX_ATTEMPTS,
+	XRD_KEY_NORMAL_CHECK_INTERVAL,
+	XRD_KEY_RETRY_CHECK_INTERVAL,
+	XRD_KEY_STATE_TYPE,
+	XRD_KEY_LAST_STATE_CHANGE,
+	XRD_KEY_LAST_HARD_STATE_CHANGE,
+	XRD_KEY_LAST_TIME_UP,
+	XRD_KEY_LAST_TIME_DOWN,
+	XRD_KEY_LAST_TIME_UNREACHABLE,
+	XRD_KEY_LAST_TIME_OK,
+	XRD_KEY_LAST_TIME_WARNING,
+	XRD_KEY_LAST_TIME_UNKNOWN,
+	XRD_KEY_LAST_TIME_CRITICAL,
+	XRD_KEY_NOTIFIED_ON_DOWN,
+	XRD_KEY_NOTIFIED_ON_UNREACHABLE,
+	XRD_KEY_NOTIFIED_ON_UNKNOWN,
+	XRD_KEY_NOTIFIED_ON_WARNING,
+	XRD_KEY_NOTIFIED_ON_CRITICAL,
+	XRD_KEY_LAST_NOTIFICATION,
+	XRD_KEY_CURRENT_NOTIFICATION_NUMBER,
+	XRD_KEY_CURRENT_NOTIFICATION_ID,
+	XRD_KEY_CONFIG_NOTIFICATIONS_ENABLED,
+	XRD_KEY_NOTIFICATIONS_ENABLED,
+	XRD_KEY_PROBLEM_HAS_BEEN_ACKNOWLEDGED,
+	XRD_KEY_ACKNOWLEDGEMENT_TYPE,
+	XRD_KEY_CONFIG_ACTIVE_CHECKS_ENABLED,
+	XRD_KEY_ACTIVE_CHECKS_ENABLED,
+	XRD_KEY_CONFIG_PASSIVE_CHECKS_ENABLED,
+	XRD_KEY_PASSIVE_CHECKS_ENABLED,
+	XRD_KEY_CONFIG_EVENT_HANDLER_ENABLED,
+	XRD_KEY_EVENT_HANDLER_ENABLED,
+	XRD_KEY_CONFIG_FLAP_DETECTION_ENABLED,
+	XRD_KEY_FLAP_DETECTION_ENABLED,
+	XRD_KEY_CONFIG_PROCESS_PERFORMANCE_DATA,
+	XRD_KEY_CONFIG_OBSESS,
+	XRD_KEY_OBSESS,
+	XRD_KEY_IS_FLAPPING,
+	XRD_KEY_PERCENT_STATE_CHANGE,
+	XRD_KEY_CHECK_FLAPPING_RECOVERY_NOTIFICATION,
+	XRD_KEY_LAST_UPDATE,
+	XRD_KEY_STATE_HISTORY,
+	XRD_KEY_CUSTOM_VARIABLE,
+	XRD_KEY_HOST_NOTIFICATION_PERIOD,
+	XRD_KEY_SERVICE_NOTIFICATION_PERIOD,
+	XRD_KEY_LAST_HOST_NOTIFICATION,
+	XRD_KEY_LAST_SERVICE_NOTIFICATION,
+	XRD_KEY_CONFIG_HOST_NOTIFICATIONS_ENABLED,
+	XRD_KEY_HOST_NOTIFICATIONS_ENABLED,
+	XRD_KEY_CONFIG_SERVICE_NOTIFICATIONS_ENABLED,
+	XRD_KEY_SERVICE_NOTIFICATIONS_ENABLED,
+	XRD_KEY_ENTRY_TYPE,
+	XRD_KEY_COMMENT_ID,
+	XRD_KEY_SOURCE,
+	XRD_KEY_PERSISTENT,
+	XRD_KEY_ENTRY_TIME,
+	XRD_KEY_EXPIRES,
+	XRD_KEY_EXPIRE_TIME,
+	XRD_KEY_AUTHOR,
+	XRD_KEY_COMMENT_DATA,
+	XRD_KEY_DOWNTIME_ID,
+	XRD_KEY_START_TIME,
+	XRD_KEY_FLEX_DOWNTIME_START,
+	XRD_KEY_END_TIME,
+	XRD_KEY_TRIGGERED_BY,
+	XRD_KEY_FIXED,
+	XRD_KEY_DURATION,
+	XRD_KEY_IS_IN_EFFECT,
+	XRD_KEY_START_NOTIFICATION_SENT,
+	XRD_KEY_COMMENT,
+	XRD_NUM_KEYS
+};
+
+enum xrd_value_kind {
+	XRD_INT,
+	XRD_ULONG,
+	XRD_DOUBLE,
+	XRD_STRING,
+};
+
+struct xrd_key_info {
+	const char *name;
+	enum xrd_value_kind kind;
+	int precision; /* of doubles in the text format */
+};
+
+extern const struct xrd_key_info xrd_keys[XRD_NUM_KEYS];
+
+/* only the member matching the key's kind is used */
+struct xrd_value {
+	int i;
+	unsigned long ul;
+	double d;
+	const char *s;
+};
+
+/*
+ * Where retention data is saved to. A block holds one object, comment,
+ * downtime or the program state, in the order the text format has
+ * always had them. Custom variables are stored as XRD_KEY_CUSTOM_VARIABLE
+ * with the variable's name in customvar.
+ */
+struct xrd_writer {
+	void (*begin)(struct xrd_writer *w, int data_type, unsigned int id);
+	void (*put)(struct xrd_writer *w, enum xrd_key key, const struct xrd_value *val, const char *customvar);
+	void (*end)(struct xrd_writer *w);
+};
+
+/* the state of a retention file that's being read */
+struct xrd_loader;
+
+/**
+ * Starts applying a block of retention data
+ * @param ld The retention file being read
+ * @param data_type One of the XRDDEFAULT_*_DATA types
+ * @param object The host, service or contact the block is for, or NULL
+ *               to look it up from the block's names
+ */
+void xrddefault_begin_block(struct xrd_loader *ld, int data_type, void *object);
+void xrddefault_apply(struct xrd_loader *ld, enum xrd_key key, const struct xrd_value *val, const char *customvar);
+void xrddefault_end_block(struct xrd_loader *ld);
+
 int xrddefault_initialize_retention_data(void);
 int xrddefault_cleanup_retention_data(void);
 int xrddefault_save_state_information(void);        /* saves all host and service state information */
@@ -0,0 +1,505 @@
+#include "config.h"
+#include "common.h"
+#include "xsdincremental.h"
+#include "objects_host.h"
+#include "objects_service.h"
+#include "objects_contact.h"
+#include "utils.h"
+#include "logging.h"
+#include "globals.h"
+#include "nm_alloc.h"
+#include "lib/bitmap.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+char *incremental_status_file = NULL;
+
+/*
+ * Record slots are numbered hosts first, then services, then contacts.
+ * pending holds the slots set in dirty, in the order they were marked,
+ * so an update costs as much as the number of changed objects.
+ */
+static struct {
+	struct xsdi_header *hdr;
+	bitmap *dirty;
+	unsigned int *pending;
+	unsigned int num_pending;
+	unsigned int first_slot[XSDI_NUM_TYPES];
+} xsdi;
+
+#define XSDI_READ_RETRIES 1000
+
+static inline struct xsdi_record *record_at(const struct xsdi_header *hdr, unsigned int type, unsigned int id)
+{
+	return (struct xsdi_record *)((char *)hdr + hdr->offset[type] + (uint64_t)id * hdr->record_size);
+}
+
+static inline struct xsdi_journal_entry *journal_at(const struct xsdi_header *hdr, uint64_t generation)
+{
+	return (struct xsdi_journal_entry *)((char *)hdr + hdr->journal_offset) + generation % hdr->journal_size;
+}
+
+
+/******************************************************************/
+/*************************** READERS ******************************/
+/******************************************************************/
+
+int xsdi_check_header(const void *buf, size_t size)
+{
+	const struct xsdi_header *hdr = buf;
+	uint64_t end;
+	int type;
+
+	if (size < sizeof(*hdr) || memcmp(hdr->magic, XSDI_MAGIC, sizeof(hdr->magic)))
+		return -1;
+	if (hdr->version != XSDI_VERSION || hdr->record_size != sizeof(struct xsdi_record) || hdr->size != size)
+		return -1;
+	if (!hdr->journal_size)
+		return -1;
+
+	for (type = 0; type < XSDI_NUM_TYPES; type++) {
+		end = hdr->offset[type] + (uint64_t)hdr->count[type] * hdr->record_size;
+		if (hdr->offset[type] < sizeof(*hdr) || end < hdr->offset[type] || end > size)
+			return -1;
+	}
+	end = hdr->journal_offset + (uint64_t)hdr->journal_size * sizeof(struct xsdi_journal_entry);
+	if (hdr->journal_offset < sizeof(*hdr) || end > size)
+		return -1;
+	if (hdr->strings_offset < sizeof(*hdr) || hdr->strings_offset + hdr->strings_size > size)
+		return -1;
+
+	return 0;
+}
+
+/* copies len bytes guarded by the sequence number at seq */
+static int read_consistent(const uint32_t *seq, void *dst, const void *src, size_t len)
+{
+	uint32_t before, after;
+	int i;
+
+	for (i = 0; i < XSDI_READ_RETRIES; i++) {
+		before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (before & 1)
+			continue;
+		memcpy(dst, src, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(seq, __ATOMIC_RELAXED);
+		if (before == after)
+			return 0;
+	}
+
+	return EAGAIN;
+}
+
+int xsdi_read_record(const struct xsdi_header *hdr, enum xsdi_record_type type, unsigned int id, struct xsdi_record *out)
+{
+	const struct xsdi_record *rec;
+
+	if ((unsigned int)type >= XSDI_NUM_TYPES || id >= hdr->count[type])
+		return EINVAL;
+
+	rec = record_at(hdr, type, id);
+	return read_consistent(&rec->seq, out, rec, sizeof(*out));
+}
+
+int xsdi_read_program(const struct xsdi_header *hdr, struct xsdi_program *out)
+{
+	return read_consistent(&hdr->program.seq, out, &hdr->program, sizeof(*out));
+}
+
+int xsdi_read_journal(const struct xsdi_header *hdr, uint64_t generation, struct xsdi_journal_entry *out)
+{
+	const struct xsdi_journal_entry *entry;
+
+	if (generation >= __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE))
+		return EAGAIN;
+
+	entry = journal_at(hdr, generation);
+	if (__atomic_load_n(&entry->generation, __ATOMIC_ACQUIRE) != generation)
+		return ESTALE;
+	out->type = entry->type;
+	out->id = entry->id;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	out->generation = __atomic_load_n(&entry->generation, __ATOMIC_RELAXED);
+
+	return out->generation == generation ? 0 : ESTALE;
+}
+
+const char *xsdi_string(const struct xsdi_header *hdr, uint32_t offset)
+{
+	const char *str;
+
+	if (offset == XSDI_NO_STRING || offset >= hdr->strings_size)
+		return NULL;
+
+	str = (const char *)hdr + hdr->strings_offset + offset;
+	if (!memchr(str, 0, hdr->strings_size - offset))
+		return NULL;
+
+	return str;
+}
+
+
+/******************************************************************/
+/*************************** WRITER *******************************/
+/******************************************************************/
+
+/* a record a crashed writer left odd still ends up even */
+static inline void begin_write(uint32_t *seq)
+{
+	__atomic_store_n(seq, (*seq + 1) | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void end_write(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static void copy_output(char *dst, const char *src)
+{
+	if (!src) {
+		*dst = 0;
+		return;
+	}
+	strncpy(dst, src, XSDI_OUTPUT_SIZE - 1);
+	dst[XSDI_OUTPUT_SIZE - 1] = 0;
+}
+
+static void write_host(struct xsdi_record *rec, const host *hst)
+{
+	struct xsdi_check_status *st = &rec->status.check;
+
+	rec->last_update = hst->last_update;
+	st->current_state = hst->current_state;
+	st->last_hard_state = hst->last_hard_state;
+	st->state_type = hst->state_type;
+	st->current_attempt = hst->current_attempt;
+	st->max_attempts = hst->max_attempts;
+	st->has_been_checked = hst->has_been_checked;
+	st->check_type = hst->check_type;
+	st->active_checks_enabled = hst->checks_enabled;
+	st->passive_checks_enabled = hst->accept_passive_checks;
+	st->event_handler_enabled = hst->event_handler_enabled;
+	st->flap_detection_enabled = hst->flap_detection_enabled;
+	st->notifications_enabled = hst->notifications_enabled;
+	st->process_performance_data = hst->process_performance_data;
+	st->obsess = hst->obsess;
+	st->problem_has_been_acknowledged = hst->problem_has_been_acknowledged;
+	st->acknowledgement_type = hst->acknowledgement_type;
+	st->scheduled_downtime_depth = hst->scheduled_downtime_depth;
+	st->is_flapping = hst->is_flapping;
+	st->current_notification_number = hst->current_notification_number;
+	st->modified_attributes = hst->modified_attributes;
+	st->last_check = hst->last_check;
+	st->next_check = hst->next_check;
+	st->last_state_change = hst->last_state_change;
+	st->last_hard_state_change = hst->last_hard_state_change;
+	st->last_notification = hst->last_notification;
+	st->next_notification = hst->next_notification;
+	st->check_interval = hst->check_interval;
+	st->retry_interval = hst->retry_interval;
+	st->latency = hst->latency;
+	st->execution_time = hst->execution_time;
+	st->percent_state_change = hst->percent_state_change;
+	copy_output(st->plugin_output, hst->plugin_output);
+}
+
+static void write_service(struct xsdi_record *rec, const service *svc)
+{
+	struct xsdi_check_status *st = &rec->status.check;
+
+	rec->last_update = svc->last_update;
+	st->current_state = svc->current_state;
+	st->last_hard_state = svc->last_hard_state;
+	st->state_type = svc->state_type;
+	st->current_attempt = svc->current_attempt;
+	st->max_attempts = svc->max_attempts;
+	st->has_been_checked = svc->has_been_checked;
+	st->check_type = svc->check_type;
+	st->active_checks_enabled = svc->checks_enabled;
+	st->passive_checks_enabled = svc->accept_passive_checks;
+	st->event_handler_enabled = svc->event_handler_enabled;
+	st->flap_detection_enabled = svc->flap_detection_enabled;
+	st->notifications_enabled = svc->notifications_enabled;
+	st->process_performance_data = svc->process_performance_data;
+	st->obsess = svc->obsess;
+	st->problem_has_been_acknowledged = svc->problem_has_been_acknowledged;
+	st->acknowledgement_type = svc->acknowledgement_type;
+	st->scheduled_downtime_depth = svc->scheduled_downtime_depth;
+	st->is_flapping = svc->is_flapping;
+	st->current_notification_number = svc->current_notification_number;
+	st->modified_attributes = svc->modified_attributes;
+	st->last_check = svc->last_check;
+	st->next_check = svc->next_check;
+	st->last_state_change = svc->last_state_change;
+	st->last_hard_state_change = svc->last_hard_state_change;
+	st->last_notification = svc->last_notification;
+	st->next_notification = svc->next_notification;
+	st->check_interval = svc->check_interval;
+	st->retry_interval = svc->retry_interval;
+	st->latency = svc->latency;
+	st->execution_time = svc->execution_time;
+	st->percent_state_change = svc->percent_state_change;
+	copy_output(st->plugin_output, svc->plugin_output);
+}
+
+static void write_contact(struct xsdi_record *rec, const contact *cntct)
+{
+	struct xsdi_contact_status *st = &rec->status.contact;
+
+	rec->last_update = MAX(cntct->last_host_notification, cntct->last_service_notification);
+	st->host_notifications_enabled = cntct->host_notifications_enabled;
+	st->service_notifications_enabled = cntct->service_notifications_enabled;
+	st->modified_attributes = cntct->modified_attributes;
+	st->modified_host_attributes = cntct->modified_host_attributes;
+	st->modified_service_attributes = cntct->modified_service_attributes;
+	st->last_host_notification = cntct->last_host_notification;
+	st->last_service_notification = cntct->last_service_notification;
+}
+
+static void write_program(struct xsdi_program *prog)
+{
+	begin_write(&prog->seq);
+	prog->pid = nagios_pid;
+	prog->program_start = program_start;
+	prog->last_log_rotation = last_log_rotation;
+	prog->modified_host_attributes = modified_host_process_attributes;
+	prog->modified_service_attributes = modified_service_process_attributes;
+	prog->enable_notifications = enable_notifications;
+	prog->active_service_checks_enabled = execute_service_checks;
+	prog->passive_service_checks_enabled = accept_passive_service_checks;
+	prog->active_host_checks_enabled = execute_host_checks;
+	prog->passive_host_checks_enabled = accept_passive_host_checks;
+	prog->enable_event_handlers = enable_event_handlers;
+	prog->obsess_over_services = obsess_over_services;
+	prog->obsess_over_hosts = obsess_over_hosts;
+	prog->check_service_freshness = check_service_freshness;
+	prog->check_host_freshness = check_host_freshness;
+	prog->enable_flap_detection = enable_flap_detection;
+	prog->process_performance_data = process_performance_data;
+	end_write(&prog->seq);
+}
+
+static void write_record(struct xsdi_header *hdr, unsigned int slot)
+{
+	struct xsdi_journal_entry *entry;
+	struct xsdi_record *rec;
+	unsigned int type, id;
+
+	for (type = XSDI_NUM_TYPES - 1; slot < xsdi.first_slot[type]; type--)
+		;
+	id = slot - xsdi.first_slot[type];
+	rec = record_at(hdr, type, id);
+
+	begin_write(&rec->seq);
+	switch (type) {
+	case XSDI_HOST:
+		write_host(rec, host_ary[id]);
+		break;
+	case XSDI_SERVICE:
+		write_service(rec, service_ary[id]);
+		break;
+	case XSDI_CONTACT:
+		write_contact(rec, contact_ary[id]);
+		break;
+	}
+	end_write(&rec->seq);
+
+	/* the entry's generation goes last, so readers can tell it's torn */
+	entry = journal_at(hdr, hdr->generation);
+	__atomic_store_n(&entry->generation, UINT64_MAX, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	entry->type = type;
+	entry->id = id;
+	__atomic_store_n(&entry->generation, hdr->generation, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->generation, hdr->generation + 1, __ATOMIC_RELEASE);
+}
+
+void xsdincremental_mark_dirty(enum xsdi_record_type type, unsigned int id)
+{
+	unsigned int slot;
+
+	/* everything is dirty when the file is created */
+	if (!xsdi.hdr || id >= xsdi.hdr->count[type])
+		return;
+
+	slot = xsdi.first_slot[type] + id;
+	if (bitmap_isset(xsdi.dirty, slot))
+		return;
+	bitmap_set(xsdi.dirty, slot);
+	xsdi.pending[xsdi.num_pending++] = slot;
+}
+
+int xsdincremental_save_status_data(void)
+{
+	struct xsdi_header *hdr = xsdi.hdr;
+	unsigned int i;
+
+	if (!hdr)
+		return OK;
+
+	log_debug_info(DEBUGL_STATUSDATA, 2, "Writing %u changed records to incremental status file\n", xsdi.num_pending);
+
+	for (i = 0; i < xsdi.num_pending; i++) {
+		write_record(hdr, xsdi.pending[i]);
+		bitmap_unset(xsdi.dirty, xsdi.pending[i]);
+	}
+	xsdi.num_pending = 0;
+
+	write_program(&hdr->program);
+	__atomic_store_n(&hdr->last_update, (int64_t)time(NULL), __ATOMIC_RELEASE);
+
+	return OK;
+}
+
+/* the records' names never change, so they're written once */
+static uint64_t add_string(struct xsdi_header *hdr, uint64_t pos, const char *str, uint32_t *offset)
+{
+	size_t len = strlen(str) + 1;
+
+	*offset = (uint32_t)pos;
+	memcpy((char *)hdr + hdr->strings_offset + pos, str, len);
+	return pos + len;
+}
+
+static void init_records(struct xsdi_header *hdr)
+{
+	struct xsdi_record *rec;
+	uint64_t pos = 0;
+	unsigned int i;
+
+	for (i = 0; i < hdr->count[XSDI_HOST]; i++) {
+		rec = record_at(hdr, XSDI_HOST, i);
+		rec->type = XSDI_HOST;
+		rec->id = i;
+		pos = add_string(hdr, pos, host_ary[i]->name, &rec->name);
+		rec->description = XSDI_NO_STRING;
+	}
+	for (i = 0; i < hdr->count[XSDI_SERVICE]; i++) {
+		rec = record_at(hdr, XSDI_SERVICE, i);
+		rec->type = XSDI_SERVICE;
+		rec->id = i;
+		pos = add_string(hdr, pos, service_ary[i]->host_name, &rec->name);
+		pos = add_string(hdr, pos, service_ary[i]->description, &rec->description);
+	}
+	for (i = 0; i < hdr->count[XSDI_CONTACT]; i++) {
+		rec = record_at(hdr, XSDI_CONTACT, i);
+		rec->type = XSDI_CONTACT;
+		rec->id = i;
+		pos = add_string(hdr, pos, contact_ary[i]->name, &rec->name);
+		rec->description = XSDI_NO_STRING;
+	}
+}
+
+int xsdincremental_initialize_status_data(void)
+{
+	struct xsdi_header *hdr;
+	uint64_t strings_size = 0, size;
+	unsigned int i, total;
+	char *tmp_file = NULL;
+	int fd;
+
+	if (!incremental_status_file)
+		return OK;
+
+	for (i = 0; i < num_objects.hosts; i++)
+		strings_size += strlen(host_ary[i]->name) + 1;
+	for (i = 0; i < num_objects.services; i++)
+		strings_size += strlen(service_ary[i]->host_name) + strlen(service_ary[i]->description) + 2;
+	for (i = 0; i < num_objects.contacts; i++)
+		strings_size += strlen(contact_ary[i]->name) + 1;
+	if (strings_size >= XSDI_NO_STRING) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Too many objects for the incremental status file\n");
+		return ERROR;
+	}
+
+	total = num_objects.hosts + num_objects.services + num_objects.contacts;
+	size = sizeof(*hdr) + (uint64_t)total * sizeof(struct xsdi_record);
+	size += (uint64_t)MAX(total, XSDI_MIN_JOURNAL) * sizeof(struct xsdi_journal_entry);
+	size += strings_size;
+
+	nm_asprintf(&tmp_file, "%sXXXXXX", incremental_status_file);
+	if ((fd = mkstemp(tmp_file)) == -1) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Unable to create temp file '%s' for writing status data: %s\n", tmp_file, strerror(errno));
+		nm_free(tmp_file);
+		return ERROR;
+	}
+	if (ftruncate(fd, size) < 0 || (hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Unable to map temp file '%s' for writing status data: %s\n", tmp_file, strerror(errno));
+		close(fd);
+		unlink(tmp_file);
+		nm_free(tmp_file);
+		return ERROR;
+	}
+	close(fd);
+
+	hdr->version = XSDI_VERSION;
+	hdr->record_size = sizeof(struct xsdi_record);
+	hdr->size = size;
+	hdr->pid = getpid();
+	hdr->created = time(NULL);
+	hdr->count[XSDI_HOST] = num_objects.hosts;
+	hdr->count[XSDI_SERVICE] = num_objects.services;
+	hdr->count[XSDI_CONTACT] = num_objects.contacts;
+	hdr->offset[XSDI_HOST] = sizeof(*hdr);
+	hdr->offset[XSDI_SERVICE] = hdr->offset[XSDI_HOST] + (uint64_t)num_objects.hosts * hdr->record_size;
+	hdr->offset[XSDI_CONTACT] = hdr->offset[XSDI_SERVICE] + (uint64_t)num_objects.services * hdr->record_size;
+	hdr->journal_offset = hdr->offset[XSDI_CONTACT] + (uint64_t)num_objects.contacts * hdr->record_size;
+	hdr->journal_size = MAX(total, XSDI_MIN_JOURNAL);
+	hdr->strings_offset = hdr->journal_offset + (uint64_t)hdr->journal_size * sizeof(struct xsdi_journal_entry);
+	hdr->strings_size = strings_size;
+	for (i = 0; i < hdr->journal_size; i++)
+		journal_at(hdr, i)->generation = UINT64_MAX;
+	init_records(hdr);
+	memcpy(hdr->magic, XSDI_MAGIC, sizeof(hdr->magic));
+
+	if (my_rename(tmp_file, incremental_status_file)) {
+		nm_log(NSLOG_RUNTIME_ERROR, "Error: Unable to create incremental status file '%s': %s\n", incremental_status_file, strerror(errno));
+		munmap(hdr, size);
+		unlink(tmp_file);
+		nm_free(tmp_file);
+		return ERROR;
+	}
+	nm_free(tmp_file);
+
+	xsdi.first_slot[XSDI_HOST] = 0;
+	xsdi.first_slot[XSDI_SERVICE] = num_objects.hosts;
+	xsdi.first_slot[XSDI_CONTACT] = num_objects.hosts + num_objects.services;
+	xsdi.dirty = bitmap_create(MAX(total, 1));
+	xsdi.pending = nm_malloc(MAX(total, 1) * sizeof(*xsdi.pending));
+	xsdi.hdr = hdr;
+
+	/* the first update writes everything */
+	xsdi.num_pending = 0;
+	for (i = 0; i < total; i++) {
+		bitmap_set(xsdi.dirty, i);
+		xsdi.pending[xsdi.num_pending++] = i;
+	}
+
+	return OK;
+}
+
+int xsdincremental_cleanup_status_data(int delete_status_data)
+{
+	int result = OK;
+
+	if (xsdi.hdr) {
+		munmap(xsdi.hdr, xsdi.hdr->size);
+		xsdi.hdr = NULL;
+	}
+	bitmap_destroy(xsdi.dirty);
+	xsdi.dirty = NULL;
+	nm_free(xsdi.pending);
+	xsdi.num_pending = 0;
+
+	if (delete_status_data == TRUE && incremental_status_file) {
+		if (unlink(incremental_status_file))
+			result = ERROR;
+	}
+	nm_free(incremental_status_file);
+
+	return result;
+}
@@ -0,0 +1,220 @@
+#ifndef INCLUDE_xsdincremental_h__
+#define INCLUDE_xsdincremental_h__
+
+#if !defined (_NAEMON_H_INSIDE) && !defined (NAEMON_COMPILATION)
+#error "Only <naemon/naemon.h> can be included directly."
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lib/lnae-utils.h"
+
+/*
+ * The incremental status file.
+ *
+ * status.dat is rewritten from scratch on every update, no matter how
+ * few objects changed. With incremental_status_file set, Naemon also
+ * keeps a memory mapped file with one fixed size record per host,
+ * service and contact, and an update only rewrites the records of the
+ * objects that changed since the last one.
+ *
+ * The file starts with a header, followed by the host, service and
+ * contact records (indexed by object id), a journal and the names of
+ * the objects. The file is created when Naemon starts and its layout
+ * never changes while it runs.
+ *
+ * Records are written in place, so a reader can find one half written.
+ * Each record has a sequence number that is odd while it's being
+ * written and changes every time it is; xsdi_read_record() retries
+ * until it gets a consistent copy.
+ *
+ * Every record written is also logged in the journal, a ring of
+ * (generation, type, id) entries. The header's generation counts the
+ * entries written so far, so a reader that remembers the generation it
+ * last saw only needs to re-read the records logged after it. If the
+ * writer has lapped the reader, the entries are gone and the reader
+ * has to re-read everything.
+ */
+
+NAGIOS_BEGIN_DECL
+
+#define XSDI_MAGIC "NMSTATUS"
+#define XSDI_VERSION 1
+#define XSDI_MIN_JOURNAL 1024
+#define XSDI_OUTPUT_SIZE 256 /* longer plugin output is truncated */
+#define XSDI_NO_STRING UINT32_MAX
+
+enum xsdi_record_type {
+	XSDI_HOST,
+	XSDI_SERVICE,
+	XSDI_CONTACT,
+	XSDI_NUM_TYPES
+};
+
+struct xsdi_program {
+	uint32_t seq;
+	int32_t pid;
+	int64_t program_start;
+	int64_t last_log_rotation;
+	uint64_t modified_host_attributes;
+	uint64_t modified_service_attributes;
+	int32_t enable_notifications;
+	int32_t active_service_checks_enabled;
+	int32_t passive_service_checks_enabled;
+	int32_t active_host_checks_enabled;
+	int32_t passive_host_checks_enabled;
+	int32_t enable_event_handlers;
+	int32_t obsess_over_services;
+	int32_t obsess_over_hosts;
+	int32_t check_service_freshness;
+	int32_t check_host_freshness;
+	int32_t enable_flap_detection;
+	int32_t process_performance_data;
+};
+
+struct xsdi_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t size; /* of the whole file */
+	int64_t pid;
+	int64_t created;
+	uint32_t count[XSDI_NUM_TYPES]; /* records of each type */
+	uint32_t journal_size; /* entries */
+	uint64_t offset[XSDI_NUM_TYPES]; /* of the first record of each type */
+	uint64_t journal_offset;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+	uint64_t generation; /* journal entries written so far */
+	int64_t last_update; /* time of the last update */
+	struct xsdi_program program;
+};
+
+/* hosts and services */
+struct xsdi_check_status {
+	int32_t current_state;
+	int32_t last_hard_state;
+	int32_t state_type;
+	int32_t current_attempt;
+	int32_t max_attempts;
+	int32_t has_been_checked;
+	int32_t check_type;
+	int32_t active_checks_enabled;
+	int32_t passive_checks_enabled;
+	int32_t event_handler_enabled;
+	int32_t flap_detection_enabled;
+	int32_t notifications_enabled;
+	int32_t process_performance_data;
+	int32_t obsess;
+	int32_t problem_has_been_acknowledged;
+	int32_t acknowledgement_type;
+	int32_t scheduled_downtime_depth;
+	int32_t is_flapping;
+	int32_t current_notification_number;
+	int32_t reserved;
+	uint64_t modified_attributes;
+	int64_t last_check;
+	int64_t next_check;
+	int64_t last_state_change;
+	int64_t last_hard_state_change;
+	int64_t last_notification;
+	int64_t next_notification;
+	double check_interval;
+	double retry_interval;
+	double latency;
+	double execution_time;
+	double percent_state_change;
+	char plugin_output[XSDI_OUTPUT_SIZE];
+};
+
+struct xsdi_contact_status {
+	int32_t host_notifications_enabled;
+	int32_t service_notifications_enabled;
+	uint64_t modified_attributes;
+	uint64_t modified_host_attributes;
+	uint64_t modified_service_attributes;
+	int64_t last_host_notification;
+	int64_t last_service_notification;
+};
+
+struct xsdi_record {
+	uint32_t seq; /* odd while the record is being written */
+	uint16_t type;
+	uint16_t reserved;
+	uint32_t id;
+	uint32_t name; /* host or contact name, in the string table */
+	uint32_t description; /* service description, or XSDI_NO_STRING */
+	uint32_t reserved2;
+	int64_t last_update; /* when the object last changed */
+	union {
+		struct xsdi_check_status check;
+		struct xsdi_contact_status contact;
+	} status;
+};
+
+struct xsdi_journal_entry {
+	uint64_t generation;
+	uint32_t type;
+	uint32_t id;
+};
+
+extern char *incremental_status_file;
+
+int xsdincremental_initialize_status_data(void);
+int xsdincremental_save_status_data(void);
+int xsdincremental_cleanup_status_data(int delete_status_data);
+
+/**
+ * Marks an object's record as changed, so the next update rewrites it
+ * @param type The type of the object
+ * @param id The id of the object
+ */
+void xsdincremental_mark_dirty(enum xsdi_record_type type, unsigned int id);
+
+/**
+ * Checks that a mapped incremental status file is one we can read
+ * @param buf The contents of the file
+ * @param size The size of buf
+ * @return 0 if it is, -1 if it isn't
+ */
+int xsdi_check_header(const void *buf, size_t size);
+
+/**
+ * Copies a record from the incremental status file
+ * @param hdr The start of the (checked) file
+ * @param type The type of the object
+ * @param id The id of the object
+ * @param out Where to copy the record
+ * @return 0 on success, EINVAL if there is no such record, EAGAIN if
+ *         the record is being written and we gave up waiting for it
+ */
+int xsdi_read_record(const struct xsdi_header *hdr, enum xsdi_record_type type, unsigned int id, struct xsdi_record *out);
+
+/**
+ * Copies the program status from the incremental status file
+ * @param hdr The start of the (checked) file
+ * @param out Where to copy the program status
+ * @return 0 on success, EAGAIN if it's being written
+ */
+int xsdi_read_program(const struct xsdi_header *hdr, struct xsdi_program *out);
+
+/**
+ * Copies a journal entry from the incremental status file
+ * @param hdr The start of the (checked) file
+ * @param generation The generation of the entry
+ * @param out Where to copy the entry
+ * @return 0 on success, EAGAIN if the entry hasn't been written yet,
+ *         ESTALE if it has been overwritten
+ */
+int xsdi_read_journal(const struct xsdi_header *hdr, uint64_t generation, struct xsdi_journal_entry *out);
+
+/**
+ * Looks up a name in the string table of the incremental status file
+ * @param hdr The start of the (checked) file
+ * @param offset The name or description of a record
+ * @return The string, or NULL if offset isn't a valid string
+ */
+const char *xsdi_string(const struct xsdi_header *hdr, uint32_t offset);
+
+NAGIOS_END_DECL
+#endif
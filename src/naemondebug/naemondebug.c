@@ -0,0 +1,151 @@
+/*
+ * naemondebug: Turns a binary debug log into text
+ */
+
+#include <getopt.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "lib/nspath.h"
+#include "config.h"
+#include <naemon/common.h>
+#include <naemon/defaults.h>
+#include <naemon/debuglog.h>
+#include <naemon/nm_alloc.h>
+
+static char *main_config_file = NULL;
+static char *debug_file = NULL;
+
+static int read_config_file(void)
+{
+	char temp_buffer[MAX_INPUT_BUFFER] = {0};
+	FILE *fp = NULL;
+	char *var = NULL;
+	char *val = NULL;
+	char *main_cfg_dir = NULL;
+	char *slash = NULL;
+
+	main_cfg_dir = nspath_absolute(main_config_file, NULL);
+	if ((slash = strrchr(main_cfg_dir, '/')))
+		*slash = 0;
+
+	fp = fopen(main_config_file, "r");
+	if (fp == NULL) {
+		nm_free(main_cfg_dir);
+		return ERROR;
+	}
+
+	while (fgets(temp_buffer, sizeof(temp_buffer) - 1, fp)) {
+
+		strip(temp_buffer);
+
+		/* skip blank lines and comments */
+		if (temp_buffer[0] == '#' || temp_buffer[0] == '\x0')
+			continue;
+
+		var = strtok(temp_buffer, "=");
+		val = strtok(NULL, "\n");
+		if (val == NULL)
+			continue;
+
+		if (!strcmp(var, "debug_file")) {
+			nm_free(debug_file);
+			debug_file = nspath_absolute(val, main_cfg_dir);
+		}
+	}
+
+	fclose(fp);
+	nm_free(main_cfg_dir);
+
+	return OK;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options] [<debug file>]\n", name);
+	printf("\n");
+	printf("Prints the messages in a debug log written with binary_debug_log=1\n");
+	printf("as text, oldest first. Without a debug file, the one the main config\n");
+	printf("file points to is used.\n");
+	printf("\n");
+	printf("Options:\n");
+	printf(" -V, --version      display program version information and exit.\n");
+	printf(" -h, --help         display usage information and exit.\n");
+	printf(" -c, --config=FILE  specifies location of main Naemon config file.\n");
+	printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+	GError *error = NULL;
+	GString *out;
+	gchar *contents = NULL;
+	gsize size = 0;
+	long messages;
+	int c;
+
+#ifdef HAVE_GETOPT_H
+	int option_index = 0;
+	static struct option long_options[] = {
+		{"help", no_argument, NULL, 'h'},
+		{"version", no_argument, NULL, 'V'},
+		{"config", required_argument, NULL, 'c'},
+		{NULL, 0, NULL, 0}
+	};
+#define getopt(argc, argv, OPTSTR) getopt_long(argc, argv, OPTSTR, long_options, &option_index)
+#endif
+
+	main_config_file = nm_strdup(get_default_config_file());
+
+	while ((c = getopt(argc, argv, "+hVc:")) != -1) {
+		switch (c) {
+		case 'V':
+			printf("Naemon Debug Log Decoder " VERSION "\n");
+			printf("Copyright (c) 2013-present Naemon Development Team (www.naemon.org)\n");
+			printf("License: GPL\n");
+			exit(OK);
+		case 'c':
+			nm_free(main_config_file);
+			main_config_file = nm_strdup(optarg);
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(OK);
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind < argc) {
+		debug_file = nm_strdup(argv[optind]);
+	} else if (read_config_file() == ERROR) {
+		fprintf(stderr, "Error processing config file '%s'\n", main_config_file);
+		exit(1);
+	}
+	nm_free(main_config_file);
+
+	if (!debug_file)
+		debug_file = nm_strdup(get_default_debug_file());
+
+	if (!g_file_get_contents(debug_file, &contents, &size, &error)) {
+		fprintf(stderr, "Error reading debug file: %s\n", error->message);
+		g_clear_error(&error);
+		exit(1);
+	}
+
+	out = g_string_new(NULL);
+	messages = debuglog_decode(contents, size, out);
+	g_free(contents);
+	if (messages < 0) {
+		fprintf(stderr, "'%s' is not a binary debug log\n", debug_file);
+		g_string_free(out, TRUE);
+		exit(1);
+	}
+
+	fwrite(out->str, 1, out->len, stdout);
+	g_string_free(out, TRUE);
+	nm_free(debug_file);
+
+	return OK;
+}
@@ -6,17 +6,23 @@
 #include "lib/worker.h"
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
 #include <string.h>
 #include <stdarg.h>
 #include <glib.h>
 
 static unsigned int started, running_jobs, timeouts, reapable;
 static int master_sd;
+static int binary_protocol; /* the master accepted WPROC_PROTOCOL_BINARY */
+static int use_pidfds; /* children are reaped through pidfds, not SIGCHLD */
 static GHashTable *ptab;
 
 struct execution_information {
 	timed_event *timed_event;
 	pid_t pid;
+	int pidfd; /* -1 unless we're watching the child through a pidfd */
+	int reaped; /* we've waited for pid, so it may belong to someone else now */
 	int state;
 	struct timeval start;
 	struct timeval stop;
@@ -53,6 +59,23 @@ static void exit_worker(int code, const char *msg)
 	exit(code);
 }
 
+/* sends a binary protocol frame made up of all the buffers in iov */
+static int worker_send_frame(int sd, int type, struct iovec *iov, int iovcnt)
+{
+	struct wproc_frame frame;
+	int i;
+
+	frame.magic = WPROC_FRAME_MAGIC;
+	frame.type = type;
+	frame.len = 0;
+	for (i = 1; i < iovcnt; i++)
+		frame.len += iov[i].iov_len;
+	iov[0].iov_base = &frame;
+	iov[0].iov_len = sizeof(frame);
+
+	return iobroker_write_packetv(nagios_iobs, sd, iov, iovcnt);
+}
+
 /*
  * write a log message to master.
  * Note that this will break if we change delimiters someday,
@@ -64,7 +87,7 @@ static void wlog(const char *fmt, ...)
 {
 	va_list ap;
 	static char lmsg[8192] = "log=";
-	int len = 4;
+	int len = 4, ret;
 	size_t to_send;
 
 	va_start(ap, fmt);
@@ -73,13 +96,22 @@ static void wlog(const char *fmt, ...)
 	if (len < 0 || len + 7 >= (int)sizeof(lmsg))
 		return;
 
-	len += 4; /* log= */
+	if (binary_protocol) {
+		struct iovec iov[2];
+
+		iov[1].iov_base = &lmsg[4];
+		iov[1].iov_len = len;
+		ret = worker_send_frame(master_sd, WPROC_FRAME_LOG, iov, 2);
+	} else {
+		len += 4; /* log= */
 
-	/* add delimiter and send it. 1 extra as kv pair separator */
-	to_send = len + MSG_DELIM_LEN + 1;
-	lmsg[len] = 0;
-	memcpy(&lmsg[len + 1], MSG_DELIM, MSG_DELIM_LEN);
-	if (iobroker_write_packet(nagios_iobs, master_sd, lmsg, to_send) < 0) {
+		/* add delimiter and send it. 1 extra as kv pair separator */
+		to_send = len + MSG_DELIM_LEN + 1;
+		lmsg[len] = 0;
+		memcpy(&lmsg[len + 1], MSG_DELIM, MSG_DELIM_LEN);
+		ret = iobroker_write_packet(nagios_iobs, master_sd, lmsg, to_send);
+	}
+	if (ret < 0) {
 		if (errno == EPIPE) {
 			/* master has died or abandoned us, so exit */
 			exit_worker(1, "Failed to write() to master");
@@ -104,6 +136,29 @@ static int worker_send_kvvec(int sd, struct kvvec *kvv)
 	return ret;
 }
 
+/*
+ * sends a result in the binary protocol. The strings must have a nul
+ * byte after their given length.
+ */
+static int worker_send_result(int sd, struct wproc_result_frame *res,
+                              const char *command, const char *outstd, const char *outerr, const char *error_msg)
+{
+	struct iovec iov[6];
+
+	iov[1].iov_base = res;
+	iov[1].iov_len = sizeof(*res);
+	iov[2].iov_base = (char *)command;
+	iov[2].iov_len = res->command_len + 1;
+	iov[3].iov_base = (char *)outstd;
+	iov[3].iov_len = res->outstd_len + 1;
+	iov[4].iov_base = (char *)outerr;
+	iov[4].iov_len = res->outerr_len + 1;
+	iov[5].iov_base = (char *)error_msg;
+	iov[5].iov_len = res->error_msg_len + 1;
+
+	return worker_send_frame(sd, WPROC_FRAME_RESULT, iov, 6);
+}
+
 static void job_error(child_process *cp, struct kvvec *kvv, const char *fmt, ...)
 {
 	char msg[4096];
@@ -114,6 +169,25 @@ static void job_error(child_process *cp, struct kvvec *kvv, const char *fmt, ...
 	va_start(ap, fmt);
 	len = vsnprintf(msg, sizeof(msg) - 1, fmt, ap);
 	va_end(ap);
+	if (len < 0)
+		len = 0;
+	else if (len >= (int)sizeof(msg) - 1)
+		len = sizeof(msg) - 2;
+	if (binary_protocol) {
+		struct wproc_result_frame res;
+
+		memset(&res, 0, sizeof(res));
+		res.job_id = cp ? (int32_t)cp->id : -1;
+		if (cp)
+			res.timeout = cp->timeout;
+		res.command_len = cp && cp->cmd ? strlen(cp->cmd) : 0;
+		res.error_msg_len = len;
+		ret = worker_send_result(master_sd, &res, cp && cp->cmd ? cp->cmd : "", "", "", msg);
+		if (ret < 0 && errno == EPIPE)
+			exit_worker(1, "Failed to send job error to master");
+		kvvec_destroy(kvv, 0);
+		return;
+	}
 	if (cp) {
 		kvvec_addkv_str(kvv, "job_id", mkstr("%d", cp->id));
 	}
@@ -127,20 +201,40 @@ static void job_error(child_process *cp, struct kvvec *kvv, const char *fmt, ...
 /* forward declaration */
 static void gather_output(child_process *cp, iobuf *io, int final);
 
+static int pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * Stop tracking the child of a job, once it's been reaped or the job
+ * is going away. The pid is only removed from ptab if it's still ours,
+ * since a reaped pid may already have been handed to a newer job.
+ */
+static void forget_child(child_process *cp)
+{
+	if (cp->ei->pidfd >= 0) {
+		iobroker_close(nagios_iobs, cp->ei->pidfd);
+		cp->ei->pidfd = -1;
+	}
+	if (g_hash_table_lookup(ptab, GINT_TO_POINTER(cp->ei->pid)) == cp)
+		g_hash_table_remove(ptab, GINT_TO_POINTER(cp->ei->pid));
+}
+
 static void destroy_job(child_process *cp)
 {
 	running_jobs--;
-	/*XXX: Maybe let this function be the value destructor for ptab? */
-	g_hash_table_remove(ptab, GINT_TO_POINTER(cp->ei->pid));
+	forget_child(cp);
 
-	if (cp->outstd.buf) {
-		free(cp->outstd.buf);
-		cp->outstd.buf = NULL;
-	}
-	if (cp->outerr.buf) {
-		free(cp->outerr.buf);
-		cp->outerr.buf = NULL;
-	}
+	nm_bufferqueue_destroy(cp->outstd.buf);
+	cp->outstd.buf = NULL;
+	nm_bufferqueue_destroy(cp->outerr.buf);
+	cp->outerr.buf = NULL;
 
 	kvvec_destroy(cp->request, KVVEC_FREE_ALL);
 	free(cp->cmd);
@@ -151,6 +245,65 @@ static void destroy_job(child_process *cp)
 	free(cp);
 }
 
+/* takes all output from the buffer, up to the first nul byte */
+static char *take_output(nm_bufferqueue *output, uint32_t *len)
+{
+	size_t buflen;
+	char *buf, *nul;
+
+	buflen = nm_bufferqueue_get_available(output);
+	buf = malloc(buflen + 1);
+	if (!buf)
+		exit_worker(1, "Failed to allocate output buffer");
+	nm_bufferqueue_unshift(output, buflen, buf);
+	buf[buflen] = 0;
+	if ((nul = memchr(buf, 0, buflen)))
+		buflen = (unsigned long)nul - (unsigned long)buf;
+	*len = buflen;
+	return buf;
+}
+
+static int finish_job_binary(child_process *cp, int reason)
+{
+	struct rusage *ru = &cp->ei->rusage;
+	struct wproc_result_frame res;
+	char *bufout, *buferr;
+	int ret;
+
+	memset(&res, 0, sizeof(res));
+	res.job_id = cp->id;
+	res.timeout = cp->timeout;
+	res.wait_status = cp->ret;
+	res.start_sec = cp->ei->start.tv_sec;
+	res.start_usec = cp->ei->start.tv_usec;
+	res.stop_sec = cp->ei->stop.tv_sec;
+	res.stop_usec = cp->ei->stop.tv_usec;
+	if (!reason) {
+		res.exited_ok = 1;
+		res.ru_utime_sec = ru->ru_utime.tv_sec;
+		res.ru_utime_usec = ru->ru_utime.tv_usec;
+		res.ru_stime_sec = ru->ru_stime.tv_sec;
+		res.ru_stime_usec = ru->ru_stime.tv_usec;
+		res.ru_minflt = ru->ru_minflt;
+		res.ru_majflt = ru->ru_majflt;
+		res.ru_inblock = ru->ru_inblock;
+		res.ru_oublock = ru->ru_oublock;
+	} else {
+		res.error_code = reason;
+	}
+	res.command_len = strlen(cp->cmd);
+	buferr = take_output(cp->outerr.buf, &res.outerr_len);
+	bufout = take_output(cp->outstd.buf, &res.outstd_len);
+
+	ret = worker_send_result(master_sd, &res, cp->cmd, bufout, buferr, "");
+	free(buferr);
+	free(bufout);
+	if (ret < 0 && errno == EPIPE)
+		exit_worker(1, "Failed to send result to master");
+
+	return 0;
+}
+
 static int finish_job(child_process *cp, int reason)
 {
 	static struct kvvec resp = KVVEC_INITIALIZER;
@@ -178,16 +331,19 @@ static int finish_job(child_process *cp, int reason)
 		cp->outerr.fd = -1;
 	}
 
+	gettimeofday(&cp->ei->stop, NULL);
+
+	cp->ei->runtime = tv_delta_f(&cp->ei->start, &cp->ei->stop);
+
+	if (binary_protocol)
+		return finish_job_binary(cp, reason);
+
 	/* how many key/value pairs do we need? */
 	if (kvvec_init(&resp, 12 + cp->request->kv_pairs) == NULL) {
 		/* what the hell do we do now? */
 		exit_worker(1, "Failed to init response key/value vector");
 	}
 
-	gettimeofday(&cp->ei->stop, NULL);
-
-	cp->ei->runtime = tv_delta_f(&cp->ei->start, &cp->ei->stop);
-
 	/*
 	 * Now build the return message.
 	 * First comes the request, minus environment variables
@@ -239,46 +395,6 @@ static int finish_job(child_process *cp, int reason)
 	return 0;
 }
 
-/*
- * Get the parent PID from a PID
- */
-static int get_process_parent_id(const pid_t pid, pid_t *ppid)
-{
-	char buffer[BUFSIZ], *s_ppid;
-	int errreading, size;
-	FILE *fp;
-
-	sprintf(buffer, "/proc/%d/stat", pid);
-	fp = fopen(buffer, "r");
-	if (!fp) {
-		return errno;
-	}
-
-	size = fread(buffer, sizeof(char), sizeof(buffer) - 1, fp);
-	if (size > 0) {
-		buffer[size] = '\0';
-	}
-	errreading = ferror(fp);
-	if (fclose(fp) != 0) {
-		return errno;
-	}
-
-	if (errreading != 0) {
-		return errreading;
-	}
-
-	strtok(buffer, " "); // (1) pid  %d
-	strtok(NULL, " "); // (2) comm  %s
-	strtok(NULL, " "); // (3) state  %c
-
-	if ((s_ppid = strtok(NULL, " ")) == NULL) { // (4) ppid  %d
-		return EBADF;
-	}
-
-	*ppid = atoi(s_ppid);
-	return 0;
-}
-
 /*
  * "What can the harvest hope for, if not for the care
  * of the Reaper Man?"
@@ -287,6 +403,9 @@ static int get_process_parent_id(const pid_t pid, pid_t *ppid)
  * We end up here no matter if the job is stale (ie, the child is
  * stuck in uninterruptable sleep) or if it's the first time we try
  * to kill it.
+ * As long as we haven't reaped our direct child its pid, and with it
+ * the process group we put it in, can't be reused, so we can kill
+ * the group without checking who owns it first.
  * A job is considered reaped once we reap our direct child, in
  * which case init will become parent of our grandchildren.
  * It's also considered fully reaped if kill() results in ESRCH or
@@ -296,7 +415,6 @@ static void kill_job(struct nm_event_execution_properties *event)
 {
 	child_process *cp = event->user_data;
 	int pid, id, ret, status, reaped = 0;
-	pid_t ppid, wpid;
 
 	g_return_if_fail(cp != NULL);
 	g_return_if_fail(cp->ei != NULL);
@@ -307,11 +425,8 @@ static void kill_job(struct nm_event_execution_properties *event)
 		(void)kill(-cp->ei->pid, SIGKILL);
 		return;
 	}
-	/* check if the child we'r killing belongs to this worker process */
-	wpid = getpid();
-	status = get_process_parent_id(pid, &ppid);
-	if (status != 0 || ppid != wpid) {
-		/* the pid might be reallocated but still exists in child proc list */
+	if (cp->ei->reaped) {
+		/* the pid might be reallocated, so leave it alone */
 		destroy_job(cp);
 		return;
 	}
@@ -344,6 +459,10 @@ static void kill_job(struct nm_event_execution_properties *event)
 			reaped = 1;
 		}
 	} while (ret && !reaped);
+	if (reaped) {
+		cp->ei->reaped = 1;
+		forget_child(cp);
+	}
 
 	if (!ret) {
 		int delay = 0;
@@ -434,6 +553,59 @@ static void sigchld_handler(int sig)
 	reapable++;
 }
 
+static void job_reaped(child_process *cp, int status, struct rusage *ru)
+{
+	cp->ei->reaped = 1;
+	forget_child(cp);
+	cp->ret = status;
+	memcpy(&cp->ei->rusage, ru, sizeof(*ru));
+	if (cp->ei->state != ESTALE) {
+		/* We leave any grandchild processes alive, until
+		 * the timeout for this job has expired (at which point they
+		 * will be reaped by the scheduled kill_job() event) in order
+		 * to preserve compatibility with older configurations.
+		 * See https://github.com/naemon/naemon-core/issues/137 for more
+		 * information.
+		 */
+		finish_job(cp, cp->ei->state);
+	}
+}
+
+/* a pidfd becomes readable when the child it refers to exits */
+static int pidfd_handler(int fd, int events, void *cp_)
+{
+	child_process *cp = (child_process *)cp_;
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	pid = wait4(cp->ei->pid, &status, WNOHANG, &ru);
+	if (!pid) {
+		/* not quite dead yet */
+		return 0;
+	}
+	if (pid < 0) {
+		/* someone else got to it first */
+		cp->ei->reaped = 1;
+		forget_child(cp);
+		return 0;
+	}
+	job_reaped(cp, status, &ru);
+	return 0;
+}
+
+/*
+ * Switch over to reaping through SIGCHLD, in case we can't get a
+ * pidfd for a child. Children that have already exited without us
+ * catching their signal are found by the first reap_jobs() run.
+ */
+static void use_sigchld(void)
+{
+	use_pidfds = 0;
+	signal(SIGCHLD, sigchld_handler);
+	reapable++;
+}
+
 static void reap_jobs(void)
 {
 	int reaped = 0;
@@ -449,19 +621,8 @@ static void reap_jobs(void)
 				continue;
 			}
 			reapable--;
-			cp->ret = status;
-			memcpy(&cp->ei->rusage, &ru, sizeof(ru));
 			reaped++;
-			if (cp->ei->state != ESTALE) {
-				/* We leave any grandchild processes alive, until
-				 * the timeout for this job has expired (at which point they
-				 * will be reaped by the scheduled kill_job() event) in order
-				 * to preserve compatibility with older configurations.
-				 * See https://github.com/naemon/naemon-core/issues/137 for more
-				 * information.
-				 */
-				finish_job(cp, cp->ei->state);
-			}
+			job_reaped(cp, status, &ru);
 		} else if (!pid || (pid < 0 && errno == ECHILD)) {
 			reapable = 0;
 		}
@@ -493,6 +654,18 @@ static int start_cmd(child_process *cp)
 		wlog("Failed to register iobroker for stderr");
 	g_hash_table_insert(ptab, GINT_TO_POINTER(cp->ei->pid), cp);
 
+	if (use_pidfds) {
+		cp->ei->pidfd = pidfd_open(cp->ei->pid);
+		if (cp->ei->pidfd < 0 || iobroker_register(nagios_iobs, cp->ei->pidfd, cp, pidfd_handler)) {
+			wlog("Failed to watch child %d through a pidfd, reaping on SIGCHLD from now on: %s",
+			     cp->ei->pid, strerror(errno));
+			if (cp->ei->pidfd >= 0)
+				close(cp->ei->pidfd);
+			cp->ei->pidfd = -1;
+			use_sigchld();
+		}
+	}
+
 	return 0;
 }
 
@@ -512,6 +685,7 @@ static child_process *parse_command_kvvec(struct kvvec *kvv)
 		wlog("Failed to calloc() a execution_information struct");
 		return NULL;
 	}
+	cp->ei->pidfd = -1;
 
 	for (i = 0; i < kvv->kv_pairs; i++) {
 		struct key_value *kv = &kvv->kv[i];
@@ -614,6 +788,8 @@ static int receive_command(int sd, int events, void *arg)
 
 static void enter_worker(int sd)
 {
+	int fd;
+
 	/* created with socketpair(), usually */
 	master_sd = sd;
 
@@ -623,8 +799,17 @@ static void enter_worker(int sd)
 		/* XXX: handle error somehow, or maybe just ignore it */
 	}
 
-	/* we need to catch child signals to mark jobs as reapable */
-	signal(SIGCHLD, sigchld_handler);
+	/*
+	 * Children are reaped when their pidfd turns readable if the
+	 * kernel supports that, and otherwise we need to catch child
+	 * signals to mark jobs as reapable
+	 */
+	if ((fd = pidfd_open(getpid())) >= 0) {
+		close(fd);
+		use_pidfds = 1;
+	} else {
+		signal(SIGCHLD, sigchld_handler);
+	}
 
 	fcntl(fileno(stdout), F_SETFD, FD_CLOEXEC);
 	fcntl(fileno(stderr), F_SETFD, FD_CLOEXEC);
@@ -641,13 +826,15 @@ static void enter_worker(int sd)
 	iobroker_register(nagios_iobs, master_sd, NULL, receive_command);
 	for (;;) {
 		event_poll();
-		reap_jobs();
+		if (!use_pidfds || reapable)
+			reap_jobs();
 	}
 }
 
 int nm_core_worker(const char *path)
 {
 	int sd, ret;
+	size_t len;
 	char response[128];
 
 	sd = nsock_unix(path, NSOCK_TCP | NSOCK_CONNECT);
@@ -657,24 +844,33 @@ int nm_core_worker(const char *path)
 		return 1;
 	}
 
-	ret = nsock_printf_nul(sd, "@wproc register name=Core Worker %d;pid=%d", getpid(), getpid());
+	ret = nsock_printf_nul(sd, "@wproc register name=Core Worker %d;pid=%d;protocol=%d",
+	                       getpid(), getpid(), WPROC_PROTOCOL_BINARY);
 	if (ret < 0) {
 		printf("Failed to register as worker.\n");
 		return 1;
 	}
 
-	ret = read(sd, response, 3);
-	if (ret != 3) {
-		printf("Failed to read response from wproc manager\n");
-		return 1;
-	}
-	if (memcmp(response, "OK", 3)) {
-		if (read(sd, response + 3, sizeof(response) - 4) < 0) {
-			printf("Failed to register with wproc manager: %s\n", strerror(errno));
-		} else {
-			response[sizeof(response) - 2] = 0;
-			printf("Failed to register with wproc manager: %s\n", response);
+	/*
+	 * Jobs may follow right after the nul-terminated response, so
+	 * we mustn't read any further than that.
+	 */
+	for (len = 0; len < sizeof(response) - 1; len++) {
+		ret = read(sd, &response[len], 1);
+		if (ret != 1) {
+			printf("Failed to read response from wproc manager\n");
+			return 1;
 		}
+		if (!response[len])
+			break;
+	}
+	response[len] = 0;
+	if (!strcmp(response, "OK")) {
+		binary_protocol = 0;
+	} else if (!strcmp(response, mkstr("OK protocol=%d", WPROC_PROTOCOL_BINARY))) {
+		binary_protocol = 1;
+	} else {
+		printf("Failed to register with wproc manager: %s\n", response);
 		return 1;
 	}
 
@@ -28,13 +28,13 @@ int main(int argc, char **argv)
 	time_t now = 0L;
 	time_t temp_start_time = 1234567890L;
 	time_t temp_end_time = 2134567890L;
-	unsigned long downtime_id = 0L;
+	unsigned long downtime_id = 0L, triggered_id = 0L;
 	scheduled_downtime *temp_downtime;
-	int i = 0;
+	int i = 0, sorted;
 	host *hst;
 	service *svc;
 
-	plan_tests(38);
+	plan_tests(43);
 
 	time(&now);
 
@@ -181,6 +181,31 @@ int main(int argc, char **argv)
 	for (temp_downtime = scheduled_downtime_list, i = 0; temp_downtime != NULL; temp_downtime = temp_downtime->next, i++) {}
 	ok(i == 0, "No downtimes left, Left: %d", i);
 
+	/* the list is kept sorted by start time, with triggered downtime after the rest */
+	for (i = 0; i < 20; i++) {
+		schedule_downtime(HOST_DOWNTIME, i % 2 ? "host1" : "host2", NULL, temp_start_time, "user", "order comment", temp_start_time + (i * 7) % 20, temp_end_time, 1, 0, 0, &downtime_id);
+	}
+	schedule_downtime(HOST_DOWNTIME, "host3", NULL, temp_start_time, "user", "triggered comment", temp_start_time, temp_end_time, 1, downtime_id, 0, &triggered_id);
+	for (temp_downtime = scheduled_downtime_list, i = 0, sorted = TRUE; temp_downtime != NULL; temp_downtime = temp_downtime->next, i++) {
+		if (!temp_downtime->next)
+			continue;
+		if (temp_downtime->next->prev != temp_downtime || temp_downtime->next->start_time < temp_downtime->start_time)
+			sorted = FALSE;
+		if (temp_downtime->next->start_time == temp_downtime->start_time && temp_downtime->triggered_by && !temp_downtime->next->triggered_by)
+			sorted = FALSE;
+	}
+	ok(i == 21 && sorted, "Got 21 downtimes in start time order: %d", i);
+
+	ok(g_slist_length(get_host_downtimes(find_host("host1"))) == 10, "Found the downtimes for host1");
+	ok(get_host_downtimes(find_host("host4")) == NULL, "host4 has no downtime");
+
+	/* unscheduling a downtime takes the ones it triggered with it */
+	unschedule_downtime(HOST_DOWNTIME, downtime_id);
+	ok(find_downtime(ANY_DOWNTIME, triggered_id) == NULL, "Triggered downtime was unscheduled too");
+
+	i = delete_downtime_by_hostname_service_description_start_time_comment(NULL, NULL, 0, "order comment");
+	ok(i == 19 && scheduled_downtime_list == NULL, "Deleted the rest: %d", i);
+
 	destroy_objects_host();
 	destroy_objects_service();
 	destroy_event_queue();
@@ -29,9 +29,11 @@
  *****************************************************************************/
 
 #include <string.h>
+#include <time.h>
 #include "naemon/objects.h"
 #include "naemon/macros.h"
 #include "naemon/utils.h"
+#include "naemon/globals.h"
 #include "naemon/nm_alloc.h"
 #include "tap.h"
 
@@ -68,6 +70,13 @@ static struct hostgroup test_hostgroup = {
 	.action_url = "action_url'&%",
 };
 
+static struct command test_command = {
+	.name = "check_command",
+	.command_line = "/usr/lib/plugins/check_it -H $HOSTADDRESS$ -n '$HOSTNAME$' "
+	"-s '$SERVICEDESC$' -w $ARG1$ -c $ARG2$ -u $USER1$ $$escaped "
+	"$HOSTNOTES$ $SERVICESTATEID:" TEST_HOSTNAME ":service description$ $IDONOTEXIST$ $unterminated",
+};
+
 static struct servicegroup test_servicegroup = {
 	.group_name = "servicegroup name'&%",
 	.notes = "notes'&%\"($SERVICEGROUPACTIONURL$)",
@@ -190,6 +199,11 @@ void test_escaping(nagios_macros *mac)
 	               "notes_url%27%26%25%28notes%2527%2526%2525%2522%2528action_url%2527%2526%2525%2529%29 '&%",
 	               URL_ENCODE_MACRO_CHARS);
 
+	/* the output may well be longer than the input */
+	RUN_MACRO_TEST("$HOSTNAME$$HOSTNAME$$HOSTNAME$",
+	               "name%27%26%25name%27%26%25name%27%26%25",
+	               URL_ENCODE_MACRO_CHARS);
+
 	/* Test for escaped $ value($$) */
 	RUN_MACRO_TEST("$$ '&%",
 	               "$ '&%",
@@ -216,6 +230,58 @@ static void test_ondemand_macros(nagios_macros *mac)
 	RUN_MACRO_TEST("$HOSTNAME:" TEST_HOSTGROUPNAME ":,$", TEST_HOSTNAME, 0);
 }
 
+static void test_compiled_commands(nagios_macros *mac)
+{
+	char *raw_command = NULL, *expected, *output;
+	const int opts[] = { 0, STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS, URL_ENCODE_MACRO_CHARS };
+	struct timespec start, stop;
+	unsigned int i, x;
+	double elapsed[2];
+
+	test_host.address = "address'&%";
+	macro_user[0] = nm_strdup("/usr/lib/plugins");
+	get_raw_command_line_r(mac, &test_command, "check_command!80!90", &raw_command, 0);
+
+	/* the compiled command line must expand exactly like the raw one */
+	for (i = 0; i < ARRAY_SIZE(opts); i++) {
+		process_macros_r(mac, raw_command, &expected, opts[i]);
+		process_command_macros_r(mac, &test_command, &output, opts[i]);
+		ok(!strcmp(output, expected), "compiled '%s' == '%s'", output, expected);
+		nm_free(expected);
+		nm_free(output);
+	}
+	ok(test_command.compiled_command_line != NULL, "command line is compiled on first use");
+
+	/* checks only set the arguments before expanding the compiled command line */
+	process_macros_r(mac, raw_command, &expected, 0);
+	clear_argv_macros_r(mac);
+	grab_argv_macros_r(mac, "check_command!80!90", 0);
+	process_command_macros_r(mac, &test_command, &output, 0);
+	ok(!strcmp(output, expected), "arguments alone expand to '%s'", output);
+	nm_free(expected);
+	nm_free(output);
+
+	/* compare how long both take to expand the same command line */
+	for (x = 0; x < 2; x++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < 100000; i++) {
+			if (x)
+				process_command_macros_r(mac, &test_command, &output, STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS);
+			else
+				process_macros_r(mac, raw_command, &output, STRIP_ILLEGAL_MACRO_CHARS | ESCAPE_MACRO_CHARS);
+			nm_free(output);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		elapsed[x] = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+	}
+	diag("100000 expansions: %.3fs parsed, %.3fs compiled", elapsed[0], elapsed[1]);
+
+	free_compiled_macros(test_command.compiled_command_line);
+	test_command.compiled_command_line = NULL;
+	nm_free(raw_command);
+	nm_free(macro_user[0]);
+}
+
 /*****************************************************************************/
 /*                             Main function                                 */
 /*****************************************************************************/
@@ -224,7 +290,7 @@ int main(void)
 {
 	nagios_macros *mac;
 
-	plan_tests(26);
+	plan_tests(32);
 
 	reset_variables();
 	init_environment();
@@ -234,6 +300,7 @@ int main(void)
 
 	test_escaping(mac);
 	test_ondemand_macros(mac);
+	test_compiled_commands(mac);
 
 	free(mac);
 
@@ -26,6 +26,7 @@
  *
  *****************************************************************************/
 #include <string.h>
+#include <sys/time.h>
 
 #include "naemon/objects_timeperiod.c"
 #include "naemon/utils.h"
@@ -114,6 +115,57 @@ struct expected_range {
 	int start, end;
 };
 
+static double elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+ * Walks every timeperiod through a few weeks, including a DST change,
+ * with the validity cache warm, and then again computing each answer
+ * from scratch, and reports how long each took.
+ */
+#define CACHE_TEST_STEP 613
+#define CACHE_TEST_DAYS 21
+static int test_validity_cache(time_t start)
+{
+	timeperiod *tp;
+	time_t t, end = start + CACHE_TEST_DAYS * 86400;
+	unsigned int i, n = 0, mismatches = 0;
+	int *warm;
+	struct timeval tv;
+	double warm_time, cold_time;
+
+	warm = nm_malloc(sizeof(int) * num_objects.timeperiods * (CACHE_TEST_DAYS * 86400 / CACHE_TEST_STEP + 1));
+	invalidate_timeperiod_cache();
+	gettimeofday(&tv, NULL);
+	for (t = start; t < end; t += CACHE_TEST_STEP) {
+		for (i = 0; i < num_objects.timeperiods; i++)
+			warm[n++] = check_time_against_period(t, timeperiod_ary[i]);
+	}
+	warm_time = elapsed(&tv);
+
+	n = 0;
+	gettimeofday(&tv, NULL);
+	for (t = start; t < end; t += CACHE_TEST_STEP) {
+		for (i = 0; i < num_objects.timeperiods; i++) {
+			tp = timeperiod_ary[i];
+			invalidate_timeperiod_cache();
+			if (check_time_against_period(t, tp) != warm[n++])
+				mismatches++;
+		}
+	}
+	cold_time = elapsed(&tv);
+
+	diag("%u timeperiod checks (TZ=%s): %.3fs cached, %.3fs uncached",
+	     n, getenv("TZ"), warm_time, cold_time);
+	nm_free(warm);
+	return mismatches;
+}
+
 int main(int argc, char **argv)
 {
 	int result;
@@ -129,7 +181,7 @@ int main(int argc, char **argv)
 	int iterations = 1000;
 	int failures;
 
-	plan_tests(121);
+	plan_tests(124);
 
 
 	/* reset program variables */
@@ -152,6 +204,7 @@ int main(int argc, char **argv)
 	/* make sure system timezone doesn't interfere with our tests */
 	putenv("TZ=UTC");
 	tzset();
+	invalidate_timeperiod_cache();
 
 	test_time = 1280579600; /* Sat Jul 31 14:33:20 CEST 2010 */
 	test_check_time_against_period(OK, test_time, "myexclude");
@@ -281,6 +334,7 @@ int main(int argc, char **argv)
 
 	putenv("TZ=UTC");
 	tzset();
+	invalidate_timeperiod_cache();
 	test_time = saved_test_time;
 	failures = 0;
 	for (c = 0; c < iterations; c++) {
@@ -297,6 +351,7 @@ int main(int argc, char **argv)
 
 	putenv("TZ=Europe/London");
 	tzset();
+	invalidate_timeperiod_cache();
 	test_time = saved_test_time;
 	failures = 0;
 	for (c = 0; c < iterations; c++) {
@@ -317,6 +372,7 @@ int main(int argc, char **argv)
 
 	putenv("TZ=America/New_York");
 	tzset();
+	invalidate_timeperiod_cache();
 	test_time = saved_test_time;
 	failures = 0;
 	for (c = 0; c < iterations; c++) {
@@ -336,6 +392,7 @@ int main(int argc, char **argv)
 	/* A little trip to Paris*/
 	putenv("TZ=Europe/Paris");
 	tzset();
+	invalidate_timeperiod_cache();
 
 
 	/* Timeperiod exclude tests, from Jean Gabes */
@@ -385,6 +442,7 @@ int main(int argc, char **argv)
 	ok(temp_timeperiod != NULL, "Testing Sunday 00:00-01:15,03:15-22:00");
 	putenv("TZ=Europe/London");
 	tzset();
+	invalidate_timeperiod_cache();
 
 	test_time = 1256421000;
 	is_valid_time = check_time_against_period(test_time, temp_timeperiod);
@@ -453,6 +511,7 @@ int main(int argc, char **argv)
 	ok(temp_timeperiod != NULL, "Testing complex weekly timeperiod definition");
 	putenv("TZ=America/New_York");
 	tzset();
+	invalidate_timeperiod_cache();
 
 	test_time = 1268109420;
 	is_valid_time = check_time_against_period(test_time, temp_timeperiod);
@@ -464,6 +523,17 @@ int main(int argc, char **argv)
 
 
 
+	/* the cache has to give the same answers as working it out every time */
+	ok(test_validity_cache(1256000000) == 0, "Cached validity matches uncached (TZ=%s)", getenv("TZ"));
+	putenv("TZ=Europe/London");
+	tzset();
+	invalidate_timeperiod_cache();
+	ok(test_validity_cache(1256000000) == 0, "Cached validity matches uncached (TZ=%s)", getenv("TZ"));
+	putenv("TZ=UTC");
+	tzset();
+	invalidate_timeperiod_cache();
+	ok(test_validity_cache(1405814400) == 0, "Cached validity matches uncached (TZ=%s)", getenv("TZ"));
+
 	cleanup();
 
 	nm_free(config_file);
@@ -157,6 +157,26 @@ tests_test_worker_LDADD = $(TESTSLDADD)
 tests_test_worker_LDFLAGS = $(TESTSLDADD)
 tests_test_worker_CPPFLAGS = $(TESTSCPPFLAGS)
 
+tests_test_worker_protocol_SOURCES = tests/test-worker-protocol.c
+tests_test_worker_protocol_LDADD = $(TESTSLDADD)
+tests_test_worker_protocol_LDFLAGS = $(TESTSLDFLAGS)
+tests_test_worker_protocol_CPPFLAGS = $(TESTSCPPFLAGS)
+
+tests_test_worker_dispatch_SOURCES = tests/test-worker-dispatch.c
+tests_test_worker_dispatch_LDADD = $(TESTSLDADD)
+tests_test_worker_dispatch_LDFLAGS = $(TESTSLDFLAGS)
+tests_test_worker_dispatch_CPPFLAGS = $(TESTSCPPFLAGS)
+
+tests_test_comments_SOURCES = tests/test-comments.c
+tests_test_comments_LDADD = $(TESTSLDADD)
+tests_test_comments_LDFLAGS = $(TESTSLDFLAGS)
+tests_test_comments_CPPFLAGS = $(TESTSCPPFLAGS)
+
+tests_test_status_incremental_SOURCES = tests/test-status-incremental.c
+tests_test_status_incremental_LDADD = $(TESTSLDADD)
+tests_test_status_incremental_LDFLAGS = $(TESTSLDFLAGS)
+tests_test_status_incremental_CPPFLAGS = $(TESTSCPPFLAGS)
+
 tests_test_retention_SOURCES = tests/test-retention.c
 tests_test_retention_LDADD = $(TESTSLDADD)
 tests_test_retention_LDFLAGS = $(TESTSLDADD)
@@ -167,11 +187,25 @@ tests_test_neb_callbacks_LDADD = $(TESTSLDADD)
 tests_test_neb_callbacks_LDFLAGS = $(TESTSLDADD)
 tests_test_neb_callbacks_CPPFLAGS = $(TESTSCPPFLAGS)
 
+tests_test_nerd_SOURCES = tests/test-nerd.c
+tests_test_nerd_LDADD = $(TESTSLDADD)
+tests_test_nerd_LDFLAGS = $(TESTSLDFLAGS)
+tests_test_nerd_CPPFLAGS = $(TESTSCPPFLAGS)
+
+tests_test_notification_dispatch_SOURCES = tests/test-notification-dispatch.c
+tests_test_notification_dispatch_LDADD = $(TESTSLDADD)
+tests_test_notification_dispatch_LDFLAGS = $(TESTSLDFLAGS)
+tests_test_notification_dispatch_CPPFLAGS = $(TESTSCPPFLAGS)
+
 check_PROGRAMS += \
 	tests/test-neb-callbacks \
+	tests/test-nerd \
+	tests/test-notification-dispatch \
 	tests/test-checks \
 	tests/test-check-result-processing \
 	tests/test-scheduled-downtimes \
+	tests/test-comments \
+	tests/test-status-incremental \
 	tests/test-check-scheduling \
 	tests/test-check-dependencies \
 	tests/test-query-handler \
@@ -186,6 +220,8 @@ check_PROGRAMS += \
 	tests/test-objects \
 	tests/test-kvvec-ekvstr \
 	tests/test-worker \
+	tests/test-worker-protocol \
+	tests/test-worker-dispatch \
 	tests/test-retention \
 	tests/test-arith \
 	tests/test-arith-builtins
@@ -201,5 +237,16 @@ check_PROGRAMS += test-bitmap test-iobroker test-bufferqueue \
 
 
 endif
+
+# benchmarks are not run by "make check"; use "make bench"
+EXTRA_PROGRAMS = tests/bench-event-scheduler
+tests_bench_event_scheduler_SOURCES = tests/bench-event-scheduler.c
+tests_bench_event_scheduler_CPPFLAGS = $(AM_CPPFLAGS) -Isrc
+CLEANFILES += $(EXTRA_PROGRAMS)
+
+.PHONY: bench
+bench: $(EXTRA_PROGRAMS)
+	tests/bench-event-scheduler$(EXEEXT)
+
 TEST_LOG_DRIVER = env AM_TAP_AWK='$(AWK)' $(SHELL) \
 	build-aux/tap-driver.sh
@@ -0,0 +1,119 @@
+/*
+ * Compares the event heap with the timing wheel on a check-like workload.
+ * Not part of "make check"; build and run it with "make bench".
+ *
+ * usage: bench-event-scheduler [events...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+/* yes, include C file, we should access static functions */
+#include "naemon/events.c"
+
+static void func_a(struct nm_event_execution_properties *evprop)
+{
+}
+
+static struct timed_event *bench_event(struct timing_wheel *w, int64_t ms)
+{
+	struct timed_event *ev = timed_event_alloc();
+	ev->callback = func_a;
+	ev->event_time = w->epoch + ms;
+	return ev;
+}
+
+static double bench_elapsed(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/*
+ * Schedule n events spread out over five minutes, reschedule all of them
+ * (like every service check does once per check), and then run them all.
+ */
+static int bench_scheduler(size_t n)
+{
+	struct timed_event_queue *q;
+	struct timing_wheel *w;
+	struct timed_event **evs, *ev;
+	struct timespec start;
+	int64_t *delays;
+	size_t i, left;
+	double heap_time, wheel_time;
+
+	evs = nm_calloc(n, sizeof(struct timed_event *));
+	delays = nm_calloc(n * 2, sizeof(int64_t));
+	for (i = 0; i < n * 2; i++)
+		delays[i] = rand() % 300000;
+
+	q = evheap_create();
+	w = tw_create();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		evs[i] = bench_event(w, delays[i]);
+		evheap_add(q, evs[i]);
+	}
+	for (i = 0; i < n; i++) {
+		evheap_remove(q, evs[i]);
+		timed_event_free(evs[i]);
+		evs[i] = bench_event(w, delays[n + i]);
+		evheap_add(q, evs[i]);
+	}
+	while ((ev = evheap_head(q)) != NULL) {
+		evheap_remove(q, ev);
+		timed_event_free(ev);
+	}
+	heap_time = bench_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		evs[i] = bench_event(w, delays[i]);
+		tw_add(w, evs[i]);
+	}
+	for (i = 0; i < n; i++) {
+		tw_remove(w, evs[i]);
+		timed_event_free(evs[i]);
+		evs[i] = bench_event(w, delays[n + i]);
+		tw_add(w, evs[i]);
+	}
+	tw_advance(w, 300000);
+	while ((ev = tw_due_head(w)) != NULL) {
+		tw_remove(w, ev);
+		timed_event_free(ev);
+	}
+	wheel_time = bench_elapsed(&start);
+	left = w->count;
+
+	printf("%8lu events: heap %.3fs, timing wheel %.3fs\n", (unsigned long)n, heap_time, wheel_time);
+
+	nm_free(evs);
+	nm_free(delays);
+	evheap_destroy(q);
+	tw_destroy(w);
+	timed_event_pool_release();
+
+	if (left) {
+		fprintf(stderr, "%lu events left on the timing wheel\n", (unsigned long)left);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if (argc < 2) {
+		if (bench_scheduler(10000) || bench_scheduler(100000) || bench_scheduler(1000000))
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (bench_scheduler(strtoul(argv[i], NULL, 10)))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
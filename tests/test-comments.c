@@ -0,0 +1,230 @@
+#include <check.h>
+#include <glib.h>
+#include <stdio.h>
+#include <time.h>
+#include "naemon/objects_service.h"
+#include "naemon/objects_command.h"
+#include "naemon/objects_host.h"
+#include "naemon/comments.h"
+#include "naemon/common.h"
+#include "naemon/globals.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_HOSTS 100
+#define SERVICES_PER_HOST 10
+
+static command *cmd;
+static host *hosts[NUM_HOSTS];
+static service *services[NUM_HOSTS * SERVICES_PER_HOST];
+
+void setup(void)
+{
+	char name[64];
+	int i, j;
+
+	init_objects_command(1);
+	cmd = create_command("my_command", "/bin/true");
+	ck_assert(cmd != NULL);
+	register_command(cmd);
+
+	init_objects_host(NUM_HOSTS);
+	init_objects_service(NUM_HOSTS * SERVICES_PER_HOST);
+	for (i = 0; i < NUM_HOSTS; i++) {
+		sprintf(name, "host%d", i);
+		hosts[i] = create_host(name);
+		ck_assert(hosts[i] != NULL);
+		hosts[i]->check_command_ptr = cmd;
+		register_host(hosts[i]);
+
+		for (j = 0; j < SERVICES_PER_HOST; j++) {
+			sprintf(name, "service%d", j);
+			services[i * SERVICES_PER_HOST + j] = create_service(hosts[i], name);
+			ck_assert(services[i * SERVICES_PER_HOST + j] != NULL);
+			services[i * SERVICES_PER_HOST + j]->check_command_ptr = cmd;
+			register_service(services[i * SERVICES_PER_HOST + j]);
+		}
+	}
+
+	next_comment_id = 0;
+	initialize_comment_data();
+}
+
+void teardown(void)
+{
+	free_comment_data();
+	destroy_objects_service();
+	destroy_objects_host();
+	destroy_objects_command();
+}
+
+static void check_comment_list(unsigned long expected)
+{
+	comment *temp_comment, *last = NULL;
+	unsigned long count = 0;
+
+	for (temp_comment = comment_list; temp_comment != NULL; temp_comment = temp_comment->next) {
+		ck_assert(temp_comment->prev == last);
+		if (last != NULL)
+			ck_assert(last->comment_id < temp_comment->comment_id);
+		ck_assert(find_comment(temp_comment->comment_id, temp_comment->comment_type) == temp_comment);
+		last = temp_comment;
+		count++;
+	}
+	ck_assert_int_eq(count, expected);
+}
+
+START_TEST(comment_lookup)
+{
+	service *svc = services[SERVICES_PER_HOST + 3];
+	unsigned long host_id, svc_id, ack_id, persistent_ack_id;
+
+	ck_assert_int_eq(OK, add_new_comment(HOST_COMMENT, USER_COMMENT, hosts[0]->name, NULL, time(NULL), "author", "host comment", TRUE, COMMENTSOURCE_INTERNAL, FALSE, 0, &host_id));
+	ck_assert_int_eq(OK, add_new_comment(SERVICE_COMMENT, USER_COMMENT, svc->host_name, svc->description, time(NULL), "author", "service comment", TRUE, COMMENTSOURCE_INTERNAL, FALSE, 0, &svc_id));
+	ck_assert_int_eq(OK, add_new_comment(SERVICE_COMMENT, ACKNOWLEDGEMENT_COMMENT, svc->host_name, svc->description, time(NULL), "author", "ack", FALSE, COMMENTSOURCE_INTERNAL, FALSE, 0, &ack_id));
+	ck_assert_int_eq(OK, add_new_comment(SERVICE_COMMENT, ACKNOWLEDGEMENT_COMMENT, svc->host_name, svc->description, time(NULL), "author", "sticky ack", TRUE, COMMENTSOURCE_INTERNAL, FALSE, 0, &persistent_ack_id));
+	check_comment_list(4);
+
+	ck_assert(find_host_comment(host_id) != NULL);
+	ck_assert(find_service_comment(host_id) == NULL);
+	ck_assert(find_service_comment(svc_id) != NULL);
+	ck_assert(find_comment(next_comment_id, HOST_COMMENT | SERVICE_COMMENT) == NULL);
+
+	ck_assert_int_eq(1, number_of_host_comments(hosts[0]->name));
+	ck_assert_int_eq(0, number_of_host_comments(svc->host_name));
+	ck_assert_int_eq(3, number_of_service_comments(svc->host_name, svc->description));
+	ck_assert_int_eq(0, number_of_service_comments(hosts[0]->name, "service4"));
+
+	/* ids must not be reused */
+	ck_assert_int_eq(ERROR, add_host_comment(USER_COMMENT, hosts[1]->name, time(NULL), "author", "dupe", svc_id, TRUE, FALSE, 0, COMMENTSOURCE_INTERNAL));
+	ck_assert_int_eq(0, number_of_host_comments(hosts[1]->name));
+
+	delete_service_acknowledgement_comments(svc);
+	ck_assert(find_service_comment(ack_id) == NULL);
+	ck_assert(find_service_comment(persistent_ack_id) != NULL);
+	ck_assert_int_eq(2, number_of_service_comments(svc->host_name, svc->description));
+	check_comment_list(3);
+
+	ck_assert_int_eq(ERROR, delete_host_comment(svc_id));
+	ck_assert_int_eq(OK, delete_service_comment(svc_id));
+	ck_assert_int_eq(ERROR, delete_service_comment(svc_id));
+	check_comment_list(2);
+
+	delete_all_service_comments(svc->host_name, svc->description);
+	delete_all_host_comments(hosts[0]->name);
+	ck_assert(comment_list == NULL);
+	ck_assert(get_first_comment_by_host(hosts[0]->name) == NULL);
+}
+END_TEST
+
+START_TEST(comment_list_order)
+{
+	unsigned long ids[] = { 17, 3, 12, 4, 30, 1, 25 };
+	comment *temp_comment;
+	size_t i, n = sizeof(ids) / sizeof(ids[0]);
+
+	/* ids from retention data, or from NEB modules, aren't always in order */
+	for (i = 0; i < n; i++)
+		ck_assert_int_eq(OK, add_host_comment(USER_COMMENT, hosts[i % 2]->name, time(NULL), "author", "comment", ids[i], TRUE, FALSE, 0, COMMENTSOURCE_INTERNAL));
+	check_comment_list(n);
+	ck_assert_int_eq(4, number_of_host_comments(hosts[0]->name));
+	ck_assert_int_eq(3, number_of_host_comments(hosts[1]->name));
+
+	ck_assert_int_eq(OK, delete_host_comment(1));
+	ck_assert_int_eq(OK, delete_host_comment(30));
+	ck_assert_int_eq(OK, delete_host_comment(12));
+	check_comment_list(n - 3);
+
+	/* the host chain still finds every comment on a host */
+	i = 0;
+	for (temp_comment = get_first_comment_by_host(hosts[0]->name); temp_comment != NULL; temp_comment = get_next_comment_by_host(hosts[0]->name, temp_comment))
+		i++;
+	ck_assert_int_eq(i, 2);
+
+	/* as they are when reading retention data */
+	defer_comment_sorting = 1;
+	for (i = 0; i < n; i++)
+		add_host_comment(USER_COMMENT, hosts[2]->name, time(NULL), "author", "comment", ids[i] + 100, TRUE, FALSE, 0, COMMENTSOURCE_INTERNAL);
+	ck_assert_int_eq(OK, sort_comments());
+	check_comment_list(2 * n - 3);
+}
+END_TEST
+
+static double bench_elapsed(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/*
+ * Load n comments, spread out over all services, the way they are when
+ * reading retention data, then add acknowledgements and delete them
+ * again service by service, like when the services recover.
+ */
+START_TEST(comment_benchmark)
+{
+	const unsigned long n = 100000;
+	const int num_services = NUM_HOSTS * SERVICES_PER_HOST;
+	struct timespec start;
+	double load_time, ack_time, delete_time;
+	unsigned long i;
+	service *svc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	defer_comment_sorting = 1;
+	for (i = 1; i <= n; i++) {
+		svc = services[i % num_services];
+		add_service_comment(USER_COMMENT, svc->host_name, svc->description, time(NULL), "author", "comment", i, TRUE, FALSE, 0, COMMENTSOURCE_INTERNAL);
+	}
+	sort_comments();
+	load_time = bench_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		svc = services[i % num_services];
+		add_new_comment(SERVICE_COMMENT, ACKNOWLEDGEMENT_COMMENT, svc->host_name, svc->description, time(NULL), "author", "ack", FALSE, COMMENTSOURCE_INTERNAL, FALSE, 0, NULL);
+	}
+	ack_time = bench_elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < (unsigned long)num_services; i++)
+		delete_service_acknowledgement_comments(services[i]);
+	for (i = 0; i < (unsigned long)num_services; i++)
+		delete_all_service_comments(services[i]->host_name, services[i]->description);
+	delete_time = bench_elapsed(&start);
+	ck_assert(comment_list == NULL);
+
+	printf("%lu comments: load %.3fs, acknowledge %.3fs, delete %.3fs\n", n, load_time, ack_time, delete_time);
+}
+END_TEST
+
+Suite *comments_suite(void)
+{
+	Suite *s = suite_create("Comments");
+	TCase *tc_comments, *tc_benchmark;
+
+	tc_comments = tcase_create("Comments");
+	tcase_add_checked_fixture(tc_comments, setup, teardown);
+	tcase_add_test(tc_comments, comment_lookup);
+	tcase_add_test(tc_comments, comment_list_order);
+	suite_add_tcase(s, tc_comments);
+
+	tc_benchmark = tcase_create("Comment benchmark");
+	tcase_add_checked_fixture(tc_benchmark, setup, teardown);
+	tcase_set_timeout(tc_benchmark, 120);
+	tcase_add_test(tc_benchmark, comment_benchmark);
+	suite_add_tcase(s, tc_benchmark);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed = 0;
+	Suite *s = comments_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_ENV);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -14,7 +14,7 @@ static void print_heap(struct timed_event_queue *q, size_t i) {
 	printf("%3lu %3lu ", i, ev->pos);
 	for(depth = i; depth>0; depth = ((depth-1)>>1))
 		printf("  ");
-	printf("%lu %lu\n", ev->event_time.tv_sec, ev->event_time.tv_nsec);
+	printf("%lld\n", (long long)ev->event_time);
 	print_heap(q, (i<<1) + 1);
 	print_heap(q, (i<<1) + 2);
 }
@@ -59,8 +59,7 @@ START_TEST(event_heap_count_ordered)
 	for (i = 0; i < test_size; i++) {
 		ev = nm_malloc(sizeof(struct timed_event));
 		ev->callback = func_a;
-		ev->event_time.tv_sec = i;
-		ev->event_time.tv_nsec = i;
+		ev->event_time = i;
 		ev->user_data = NULL;
 		evheap_add(q, ev);
 
@@ -74,7 +73,7 @@ START_TEST(event_heap_count_ordered)
 	for (i = 0; i < test_size; i++) {
 		ev = evheap_head(q);
 		ck_assert(ev != NULL);
-		ck_assert_int_eq(i, (size_t)ev->event_time.tv_nsec);
+		ck_assert_int_eq(i, (size_t)ev->event_time);
 		evheap_remove(q, ev);
 		free(ev);
 
@@ -105,8 +104,7 @@ START_TEST(event_heap_count_random_order)
 	for (i = 0; i < test_size; i++) {
 		ev = nm_malloc(sizeof(struct timed_event));
 		ev->callback = func_a;
-		ev->event_time.tv_sec = rand();
-		ev->event_time.tv_nsec = i;
+		ev->event_time = rand();
 		ev->user_data = NULL;
 		evheap_add(q, ev);
 
@@ -124,8 +122,8 @@ START_TEST(event_heap_count_random_order)
 		ck_assert(ev != NULL);
 
 		/* Make sure the value increments */
-		ck_assert((time_t)ev->event_time.tv_sec >= last_value);
-		last_value = (time_t)ev->event_time.tv_sec;
+		ck_assert((time_t)ev->event_time >= last_value);
+		last_value = (time_t)ev->event_time;
 
 		evheap_remove(q, ev);
 		free(ev);
@@ -164,8 +162,7 @@ START_TEST(event_heap_count_random_removal)
 	for (i = 0; i < test_size; i++) {
 		ev = nm_malloc(sizeof(struct timed_event));
 		ev->callback = func_a;
-		ev->event_time.tv_sec = i;
-		ev->event_time.tv_nsec = i;
+		ev->event_time = i;
 		ev->user_data = NULL;
 		evheap_add(q, ev);
 
@@ -196,6 +193,133 @@ START_TEST(event_heap_count_random_removal)
 }
 END_TEST
 
+/* Verify that every event is in the slot its expiry says it should be in */
+static void verify_wheel(struct timing_wheel *w)
+{
+	struct tw_link *l;
+	struct timed_event *ev;
+	size_t count = 0;
+	int64_t expires;
+	int i;
+
+	for (i = 0; i < TW_NUM_LISTS; i++) {
+		if (i < TW_WHEEL_SLOTS)
+			ck_assert_int_eq(!tw_list_empty(&w->lists[i]), !!(w->occupied[i >> 6] & (1ULL << (i & 63))));
+		for (l = w->lists[i].next; l != &w->lists[i]; l = l->next) {
+			ck_assert(l->next->prev == l);
+			ev = tw_event(l);
+			expires = tw_ticks(w, ev->event_time);
+			if (i == TW_SLOT_DUE)
+				ck_assert(expires < w->tick);
+			else if (i < TW_SIZE)
+				ck_assert_int_eq(expires & TW_MASK, i);
+			count++;
+		}
+	}
+	ck_assert_int_eq(count, w->count);
+}
+
+static struct timed_event *wheel_event(struct timing_wheel *w, int64_t ms)
+{
+	struct timed_event *ev = timed_event_alloc();
+	ev->callback = func_a;
+	ev->event_time = w->epoch + ms;
+	return ev;
+}
+
+START_TEST(event_wheel_count_random_order)
+{
+	struct timing_wheel *w;
+	struct timed_event *ev;
+	size_t i, expired = 0;
+	size_t test_size = 10000;
+	int64_t tick, last_value = 0;
+
+	w = tw_create();
+	ck_assert_int_eq(w->count, 0);
+	ck_assert_int_eq(tw_next_expiry(w), INT64_MAX);
+
+	for (i = 0; i < test_size; i++) {
+		/* spread events out over all levels, and then some */
+		tw_add(w, wheel_event(w, (rand() % 1000) * (1LL << (3 * (i % 12)))));
+		if (i % 500 == 0)
+			verify_wheel(w);
+	}
+	verify_wheel(w);
+	ck_assert_int_eq(w->count, test_size);
+
+	for (tick = 0; w->count; tick += 1 + rand() % 100000) {
+		/* nothing may be due before the wheel says it will be */
+		ck_assert(tw_next_expiry(w) <= tick || tw_list_empty(&w->lists[TW_SLOT_DUE]));
+		tw_advance(w, tick);
+		while ((ev = tw_due_head(w)) != NULL) {
+			ck_assert(tw_ticks(w, ev->event_time) <= tick);
+			ck_assert(tw_ticks(w, ev->event_time) >= last_value);
+			last_value = tw_ticks(w, ev->event_time);
+			tw_remove(w, ev);
+			timed_event_free(ev);
+			expired++;
+		}
+		if (expired % 500 == 0)
+			verify_wheel(w);
+		/* jump ahead once the events are too far apart to step through */
+		if (w->count && tw_next_expiry(w) > tick + 100000)
+			tick = tw_next_expiry(w);
+	}
+	ck_assert_int_eq(expired, test_size);
+
+	tw_destroy(w);
+}
+END_TEST
+
+START_TEST(event_wheel_count_random_removal)
+{
+	struct timing_wheel *w;
+	struct timed_event **evs;
+	size_t i, j;
+	size_t test_size = 10000;
+	size_t in_use = event_pool.stats.in_use;
+
+	w = tw_create();
+	evs = nm_calloc(test_size, sizeof(struct timed_event *));
+	for (i = 0; i < test_size; i++) {
+		evs[i] = wheel_event(w, rand() % 100000000);
+		tw_add(w, evs[i]);
+	}
+	verify_wheel(w);
+
+	/* move some to the due list, so removal is tested from there too */
+	tw_advance(w, 10000000);
+	verify_wheel(w);
+
+	for (i = 0; i < test_size; i++) {
+		ck_assert_int_ne(w->count, 0);
+
+		/* Pick an event at random */
+		j = rand() % test_size;
+		while (evs[j] == NULL)
+			j = (j + 1) % test_size;
+		tw_remove(w, evs[j]);
+		timed_event_free(evs[j]);
+		evs[j] = NULL;
+
+		if (i % 500 == 0)
+			verify_wheel(w);
+	}
+	ck_assert_int_eq(w->count, 0);
+
+	/* nothing lingers on the wheel or in the pool */
+	ck_assert(tw_due_head(w) == NULL);
+	ck_assert_int_eq(tw_next_expiry(w), INT64_MAX);
+	for (i = 0; i < TW_WHEEL_SLOTS / 64; i++)
+		ck_assert(w->occupied[i] == 0);
+	ck_assert_int_eq(event_pool.stats.in_use, in_use);
+
+	nm_free(evs);
+	tw_destroy(w);
+}
+END_TEST
+
 static struct nm_event_execution_properties *cb_props_param;
 static iobroker_set *iobs;
 void test_event_callback(struct nm_event_execution_properties *props)
@@ -211,11 +335,18 @@ void event_polling_setup(void)
 	ck_assert(iobs != NULL);
 }
 
+void event_polling_heap_setup(void)
+{
+	use_timing_wheel = FALSE;
+	event_polling_setup();
+}
+
 void event_polling_teardown(void)
 {
 	iobroker_destroy(iobs, 0);
 	destroy_event_queue();
 	nm_free(cb_props_param);
+	use_timing_wheel = DEFAULT_USE_TIMING_WHEEL;
 }
 
 static time_t runnable_delays[] = {
@@ -257,6 +388,47 @@ START_TEST(event_polling_scheduling_future)
 }
 END_TEST
 
+START_TEST(event_pool_reuse)
+{
+	struct timed_event_pool_stats st;
+	struct timed_event *ev, *evs[EVENT_SLAB_EVENTS + 1];
+	size_t i;
+
+	if (sizeof(void *) == 8)
+		ck_assert_int_eq(sizeof(struct timed_event), 40);
+
+	timed_event_pool_release();
+	get_timed_event_pool_stats(&st);
+	ck_assert_int_eq(st.in_use, 0);
+	ck_assert_int_eq(st.slabs, 0);
+
+	/* one more than fits in a slab */
+	for (i = 0; i < ARRAY_SIZE(evs); i++)
+		evs[i] = timed_event_alloc();
+	get_timed_event_pool_stats(&st);
+	ck_assert_int_eq(st.in_use, ARRAY_SIZE(evs));
+	ck_assert_int_eq(st.slabs, 2);
+	ck_assert_int_eq(st.capacity, 2 * EVENT_SLAB_EVENTS);
+
+	/* freed events are handed out again before the pool grows */
+	ev = evs[3];
+	timed_event_free(ev);
+	ck_assert(timed_event_alloc() == ev);
+
+	for (i = 0; i < ARRAY_SIZE(evs); i++)
+		timed_event_free(evs[i]);
+	get_timed_event_pool_stats(&st);
+	ck_assert_int_eq(st.in_use, 0);
+	ck_assert(st.high_water >= ARRAY_SIZE(evs));
+	ck_assert_int_eq(st.slabs, 2);
+
+	timed_event_pool_release();
+	get_timed_event_pool_stats(&st);
+	ck_assert_int_eq(st.slabs, 0);
+	ck_assert_int_eq(st.capacity, 0);
+}
+END_TEST
+
 START_TEST(event_timespec_msdiff)
 {
 	int64_t diff_s = 0, expected = 0;
@@ -291,21 +463,33 @@ END_TEST
 Suite *event_heap_suite(void)
 {
 	Suite *s = suite_create("Events");
-	TCase *tc_event_heap, *tc_event_polling;
+	TCase *tc_event_heap, *tc_event_wheel, *tc_event_polling, *tc_event_polling_heap;
 
 	tc_event_heap = tcase_create("Event heap");
 	tcase_add_test(tc_event_heap, event_heap_count_ordered);
 	tcase_add_test(tc_event_heap, event_heap_count_random_order);
 	tcase_add_test(tc_event_heap, event_heap_count_random_removal);
 	tcase_add_test(tc_event_heap, event_timespec_msdiff);
+	tcase_add_test(tc_event_heap, event_pool_reuse);
 	suite_add_tcase(s, tc_event_heap);
 
+	tc_event_wheel = tcase_create("Event timing wheel");
+	tcase_add_test(tc_event_wheel, event_wheel_count_random_order);
+	tcase_add_test(tc_event_wheel, event_wheel_count_random_removal);
+	suite_add_tcase(s, tc_event_wheel);
+
 	tc_event_polling = tcase_create("Event polling");
 	tcase_add_loop_test(tc_event_polling, event_polling_scheduling_past, 0, ARRAY_SIZE(runnable_delays));
 	tcase_add_loop_test(tc_event_polling, event_polling_scheduling_future, 0, ARRAY_SIZE(unrunnable_delays));
 	tcase_add_checked_fixture(tc_event_polling, event_polling_setup, event_polling_teardown);
 	suite_add_tcase(s, tc_event_polling);
 
+	tc_event_polling_heap = tcase_create("Event polling (heap)");
+	tcase_add_loop_test(tc_event_polling_heap, event_polling_scheduling_past, 0, ARRAY_SIZE(runnable_delays));
+	tcase_add_loop_test(tc_event_polling_heap, event_polling_scheduling_future, 0, ARRAY_SIZE(unrunnable_delays));
+	tcase_add_checked_fixture(tc_event_polling_heap, event_polling_heap_setup, event_polling_teardown);
+	suite_add_tcase(s, tc_event_polling_heap);
+
 	return s;
 }
 
@@ -1,6 +1,13 @@
 #include <naemon/commands.c>
 
 #include <check.h>
+#include <time.h>
+
+#define TARGET_HOST_NAME "my_host"
+#define TARGET_SERVICE_NAME "my_service"
+
+static host *hst;
+static service *svc;
 
 static int test_test_command_handler(const struct external_command *ext_command, time_t entry_time)
 {
@@ -101,6 +108,55 @@ START_TEST(kv_command_variable_validator)
 }
 END_TEST
 
+START_TEST(command_lookup_by_name)
+{
+	struct external_command *ext_command, *duplicate;
+	int id;
+
+	ext_command = command_lookup("TEST_COMMAND");
+	ck_assert(ext_command != NULL);
+	ck_assert_str_eq(ext_command->name, "TEST_COMMAND");
+	ck_assert(command_lookup("NO_SUCH_COMMAND") == NULL);
+
+	ext_command = command_create("ANOTHER_TEST_COMMAND", test_test_command_handler, "Another command", NULL);
+	id = command_register(ext_command, -1);
+	ck_assert_int_ge(id, 0);
+	ck_assert(command_lookup("ANOTHER_TEST_COMMAND") == ext_command);
+	duplicate = command_create("ANOTHER_TEST_COMMAND", test_test_command_handler, "Duplicate", NULL);
+	ck_assert_int_lt(command_register(duplicate, -1), 0);
+	command_destroy(duplicate);
+
+	command_unregister(ext_command);
+	ck_assert(command_lookup("ANOTHER_TEST_COMMAND") == NULL);
+	ck_assert(command_lookup("TEST_COMMAND") != NULL);
+}
+END_TEST
+
+START_TEST(nokv_command_parsing)
+{
+	struct external_command *extcmd;
+	GError *error = NULL;
+
+	extcmd = command_parse("[1234] TEST_COMMAND;1;2;semi;colons", COMMAND_SYNTAX_NOKV, &error);
+	ck_assert(error == NULL);
+	ck_assert(extcmd != NULL);
+	ck_assert_int_eq(command_entry_time(extcmd), 1234);
+	ck_assert_str_eq(command_raw_arguments(extcmd), "1;2;semi;colons");
+	ck_assert_str_eq((char *)command_argument_get_value(extcmd, "comment"), "semi;colons");
+	command_destroy(extcmd);
+
+	extcmd = command_parse("[1234] NO_SUCH_COMMAND;1", COMMAND_SYNTAX_NOKV, &error);
+	ck_assert(g_error_matches(error, NM_COMMAND_ERROR, CMD_ERROR_UNKNOWN_COMMAND));
+	ck_assert(extcmd == NULL);
+	g_clear_error(&error);
+
+	extcmd = command_parse("1234 TEST_COMMAND;1;2;kaka", COMMAND_SYNTAX_NOKV, &error);
+	ck_assert(g_error_matches(error, NM_COMMAND_ERROR, CMD_ERROR_MALFORMED_COMMAND));
+	ck_assert(extcmd == NULL);
+	g_clear_error(&error);
+}
+END_TEST
+
 START_TEST(kv_command_raw_arguments_set)
 {
 	struct external_command *extcmd;
@@ -119,6 +175,114 @@ START_TEST(kv_command_raw_arguments_set)
 }
 END_TEST
 
+static void setup_passive_results(void)
+{
+	init_objects_host(1);
+	init_objects_service(1);
+
+	hst = create_host(TARGET_HOST_NAME);
+	ck_assert(hst != NULL);
+	register_host(hst);
+
+	svc = create_service(hst, TARGET_SERVICE_NAME);
+	ck_assert(svc != NULL);
+	register_service(svc);
+
+	registered_commands_init(200);
+	register_core_commands();
+}
+
+static void teardown_passive_results(void)
+{
+	registered_commands_deinit();
+	destroy_objects_service();
+	destroy_objects_host();
+}
+
+START_TEST(passive_result_parsing)
+{
+	struct passive_check_result pcr;
+	char cmd[] = "[1234] PROCESS_SERVICE_CHECK_RESULT;" TARGET_HOST_NAME ";" TARGET_SERVICE_NAME ";2;output;with;semicolons|perf=1";
+	char host_cmd[] = "[1234] PROCESS_HOST_CHECK_RESULT;" TARGET_HOST_NAME ";1;host output";
+	char *orig = nm_strdup(cmd);
+
+	ck_assert_int_eq(parse_passive_check_result(cmd, &pcr), OK);
+	ck_assert(pcr.svc == svc);
+	ck_assert(pcr.hst == hst);
+	ck_assert_int_eq(pcr.entry_time, 1234);
+	ck_assert_int_eq(pcr.return_code, 2);
+	ck_assert_str_eq(pcr.output, "output;with;semicolons|perf=1");
+	ck_assert_str_eq(pcr.args, TARGET_HOST_NAME ";" TARGET_SERVICE_NAME ";2;output;with;semicolons|perf=1");
+	ck_assert_str_eq(cmd, orig);
+	nm_free(orig);
+
+	ck_assert_int_eq(parse_passive_check_result(host_cmd, &pcr), OK);
+	ck_assert(pcr.svc == NULL);
+	ck_assert(pcr.hst == hst);
+	ck_assert_int_eq(pcr.return_code, 1);
+	ck_assert_str_eq(pcr.output, "host output");
+}
+END_TEST
+
+START_TEST(passive_result_fallback)
+{
+	struct passive_check_result pcr;
+	const char *cmds[] = {
+		"[1234] PROCESS_SERVICE_CHECK_RESULT;" TARGET_HOST_NAME ";no_such_service;2;output",
+		"[1234] PROCESS_SERVICE_CHECK_RESULT;no_such_host;" TARGET_SERVICE_NAME ";2;output",
+		"[1234] PROCESS_SERVICE_CHECK_RESULT;" TARGET_HOST_NAME ";" TARGET_SERVICE_NAME ";two;output",
+		"[1234] PROCESS_SERVICE_CHECK_RESULT;" TARGET_HOST_NAME ";" TARGET_SERVICE_NAME ";2;",
+		"[1234] PROCESS_SERVICE_CHECK_RESULT;" TARGET_HOST_NAME ";" TARGET_SERVICE_NAME ";2",
+		"[1234] PROCESS_HOST_CHECK_RESULT;" TARGET_HOST_NAME ";;output",
+		"[12x4] PROCESS_HOST_CHECK_RESULT;" TARGET_HOST_NAME ";0;output",
+		"[1234] ENABLE_NOTIFICATIONS",
+		"[1234] ENABLE_HOST_CHECK;" TARGET_HOST_NAME,
+		NULL
+	};
+	char *cmd;
+	int i;
+
+	/* none of these may be handled, or mangled, by the fast path */
+	for (i = 0; cmds[i]; i++) {
+		cmd = nm_strdup(cmds[i]);
+		ck_assert_int_eq(parse_passive_check_result(cmd, &pcr), ERROR);
+		ck_assert_str_eq(cmd, cmds[i]);
+		nm_free(cmd);
+	}
+}
+END_TEST
+
+START_TEST(passive_result_throughput)
+{
+	struct passive_check_result pcr;
+	struct external_command *extcmd;
+	GError *error = NULL;
+	char cmd[] = "[1234] PROCESS_SERVICE_CHECK_RESULT;" TARGET_HOST_NAME ";" TARGET_SERVICE_NAME ";0;OK - all is well|time=0.01s;1;2;0";
+	struct timespec start, stop;
+	double elapsed[2];
+	int i, iterations = 100000;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		extcmd = command_parse(cmd, COMMAND_SYNTAX_NOKV, &error);
+		ck_assert(extcmd != NULL);
+		command_destroy(extcmd);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	elapsed[0] = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		ck_assert(parse_passive_check_result(cmd, &pcr) == OK);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	elapsed[1] = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+	printf("Parsed %d passive service check results: %.0f/s with command_parse(), %.0f/s in place\n",
+	       iterations, iterations / elapsed[0], iterations / elapsed[1]);
+}
+END_TEST
+
 Suite *kv_command_suite(void)
 {
 	Suite *s = suite_create("Key/Value-command");
@@ -131,6 +295,16 @@ Suite *kv_command_suite(void)
 	tcase_add_test(tc, kv_command_undefined_variable);
 	tcase_add_test(tc, kv_command_variable_validator);
 	tcase_add_test(tc, kv_command_raw_arguments_set);
+	tcase_add_test(tc, command_lookup_by_name);
+	tcase_add_test(tc, nokv_command_parsing);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("Passive check results");
+	tcase_add_checked_fixture(tc, setup_passive_results, teardown_passive_results);
+	tcase_add_test(tc, passive_result_parsing);
+	tcase_add_test(tc, passive_result_fallback);
+	tcase_add_test(tc, passive_result_throughput);
+	tcase_set_timeout(tc, 60);
 	suite_add_tcase(s, tc);
 
 	return s;
@@ -2,6 +2,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
 #include <check.h>
 #include "naemon/logging.c"
@@ -54,13 +55,310 @@ START_TEST(common_case)
 }
 END_TEST
 
+START_TEST(async_logging)
+{
+	int fd, ret;
+	size_t len;
+	char contents[1024], *long_line, *workdir;
+	time_t log_ts1 = 1234, log_ts2 = 5678;
+	struct log_writer_stats st;
+	logging_options = -1;
+
+	close_log_file();
+	workdir = getcwd(NULL, 0);
+	ret = asprintf(&log_file, "%s/async.log", workdir);
+	free(workdir);
+	ck_assert_msg(access(log_file, F_OK) == -1,
+	              "Log file '%s' already exists - cowardly refusing to unlink it for you", log_file);
+
+	/* nothing is written until we ask for it */
+	use_async_logging = TRUE;
+	log_flush_interval = 60000;
+	log_buffer_size = 4096;
+	ck_assert_int_eq(OK, start_log_writer());
+	get_log_writer_stats(&st);
+	ck_assert_int_eq(st.active, TRUE);
+	ck_assert_int_eq(st.buffer_size, 4096);
+
+	ret = write_to_log("Log information", -1, &log_ts1);
+	ck_assert_int_eq(OK, ret);
+	ret = write_to_log("More log information", -1, &log_ts2);
+	ck_assert_int_eq(OK, ret);
+	get_log_writer_stats(&st);
+	ck_assert_int_eq(st.queued, 2);
+	ck_assert_int_eq(st.flushed, 0);
+	ck_assert_int_eq(st.buffered, strlen("[1234] Log information\n[5678] More log information\n"));
+
+	flush_log_writer();
+	get_log_writer_stats(&st);
+	ck_assert_int_eq(st.flushed, 2);
+	ck_assert_int_eq(st.buffered, 0);
+	fd = open(log_file, O_RDONLY);
+	len = read(fd, contents, sizeof(contents) - 1);
+	contents[len] = '\0';
+	close(fd);
+	ck_assert_str_eq("[1234] Log information\n[5678] More log information\n", contents);
+
+	/* lines that don't fit are dropped, and the drop is logged later */
+	long_line = malloc(8192);
+	memset(long_line, 'x', 8191);
+	long_line[8191] = '\0';
+	ret = write_to_log(long_line, -1, &log_ts1);
+	ck_assert_int_eq(OK, ret);
+	free(long_line);
+	get_log_writer_stats(&st);
+	ck_assert_int_eq(st.dropped, 1);
+	ck_assert_int_eq(st.queued, 2);
+
+	ret = write_to_log("After the drop", -1, &log_ts2);
+	ck_assert_int_eq(OK, ret);
+	stop_log_writer();
+	get_log_writer_stats(&st);
+	ck_assert_int_eq(st.active, FALSE);
+	ck_assert_int_eq(st.flushed, 3);
+
+	fd = open(log_file, O_RDONLY);
+	len = read(fd, contents, sizeof(contents) - 1);
+	contents[len] = '\0';
+	close(fd);
+	ck_assert_str_eq("[1234] Log information\n[5678] More log information\n"
+	                 "[5678] Warning: 1 log messages were dropped because the log buffer was full\n"
+	                 "[5678] After the drop\n", contents);
+
+	/* without the writer, lines go straight to the file again */
+	ret = write_to_log("Synchronous", -1, &log_ts1);
+	ck_assert_int_eq(OK, ret);
+	fd = open(log_file, O_RDONLY);
+	len = read(fd, contents, sizeof(contents) - 1);
+	contents[len] = '\0';
+	close(fd);
+	ck_assert(strstr(contents, "[1234] Synchronous\n") != NULL);
+
+	close_log_file();
+	unlink(log_file);
+	use_async_logging = FALSE;
+}
+END_TEST
+
+START_TEST(async_rotation)
+{
+	int fd, ret;
+	size_t len;
+	char active_contents[1024], rotated_contents[1024];
+	time_t rotate_time = 1234, log_ts1 = 5678, log_ts2 = 9012;
+	char *workdir, *rotated_file;
+	logging_options = -1;
+
+	close_log_file();
+	workdir = getcwd(NULL, 0);
+	ret = asprintf(&rotated_file, "%s/async-old.log", workdir);
+	ret = asprintf(&log_file, "%s/async-active.log", workdir);
+	free(workdir);
+	ck_assert_msg(access(log_file, F_OK) == -1,
+	              "Log file '%s' already exists - cowardly refusing to unlink it for you", log_file);
+	ck_assert_msg(access(rotated_file, F_OK) == -1,
+	              "Log file '%s' already exists - cowardly refusing to unlink it for you", rotated_file);
+
+	/* the writer thread has the file open when it's rotated */
+	use_async_logging = TRUE;
+	log_flush_interval = 1;
+	log_buffer_size = 4096;
+	ck_assert_int_eq(OK, start_log_writer());
+	ret = write_to_log("Log information", -1, &log_ts1);
+	ck_assert_int_eq(OK, ret);
+	flush_log_writer();
+	ret = rename(log_file, rotated_file);
+	ck_assert_int_eq(0, ret);
+	ret = rotate_log_file(rotate_time);
+	ck_assert_int_eq(OK, ret);
+	ret = write_to_log("New log information", -1, &log_ts2);
+	ck_assert_int_eq(OK, ret);
+	stop_log_writer();
+
+	fd = open(log_file, O_RDONLY);
+	len = read(fd, active_contents, sizeof(active_contents) - 1);
+	active_contents[len] = '\0';
+	close(fd);
+	fd = open(rotated_file, O_RDONLY);
+	len = read(fd, rotated_contents, sizeof(rotated_contents) - 1);
+	rotated_contents[len] = '\0';
+	close(fd);
+	ck_assert_str_eq("[1234] LOG ROTATION: EXTERNAL\n[1234] LOG VERSION: 2.0\n[9012] New log information\n", active_contents);
+	ck_assert_str_eq("[5678] Log information\n", rotated_contents);
+
+	close_log_file();
+	unlink(rotated_file);
+	unlink(log_file);
+	free(rotated_file);
+	use_async_logging = FALSE;
+}
+END_TEST
+
+START_TEST(async_fork)
+{
+	int fd, ret, status;
+	size_t len;
+	char contents[1024];
+	time_t log_ts1 = 1234, log_ts2 = 5678, log_ts3 = 9012;
+	char *workdir;
+	pid_t pid;
+	logging_options = -1;
+
+	close_log_file();
+	workdir = getcwd(NULL, 0);
+	ret = asprintf(&log_file, "%s/async-fork.log", workdir);
+	free(workdir);
+	ck_assert_msg(access(log_file, F_OK) == -1,
+	              "Log file '%s' already exists - cowardly refusing to unlink it for you", log_file);
+
+	/* a forked child writes directly, after what the parent had queued */
+	use_async_logging = TRUE;
+	log_flush_interval = 60000;
+	log_buffer_size = 4096;
+	ck_assert_int_eq(OK, start_log_writer());
+	ret = write_to_log("Before fork", -1, &log_ts1);
+	ck_assert_int_eq(OK, ret);
+	pid = fork();
+	ck_assert(pid >= 0);
+	if (pid == 0) {
+		write_to_log("From the child", -1, &log_ts2);
+		_exit(EXIT_SUCCESS);
+	}
+	ck_assert_int_eq(pid, waitpid(pid, &status, 0));
+	ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+	ret = write_to_log("After fork", -1, &log_ts3);
+	ck_assert_int_eq(OK, ret);
+	stop_log_writer();
+
+	fd = open(log_file, O_RDONLY);
+	len = read(fd, contents, sizeof(contents) - 1);
+	contents[len] = '\0';
+	close(fd);
+	ck_assert_str_eq("[1234] Before fork\n[5678] From the child\n[9012] After fork\n", contents);
+
+	close_log_file();
+	unlink(log_file);
+	use_async_logging = FALSE;
+}
+END_TEST
+
+START_TEST(binary_debug_logging)
+{
+	int ret, i;
+	char *workdir, *old_file, *expected;
+	char fmtbuf[64];
+	gchar *contents = NULL;
+	gsize size = 0;
+	GString *out;
+	long messages;
+
+	workdir = getcwd(NULL, 0);
+	ret = asprintf(&debug_file, "%s/binary.debug", workdir);
+	ret = asprintf(&old_file, "%s/binary.debug.old", workdir);
+	free(workdir);
+	ck_assert_msg(access(debug_file, F_OK) == -1,
+	              "Debug file '%s' already exists - cowardly refusing to unlink it for you", debug_file);
+
+	/* the last run's trace is moved aside when we start */
+	ck_assert_int_eq(TRUE, g_file_set_contents(debug_file, "previous run", -1, NULL));
+	binary_debug_log = TRUE;
+	debug_level = DEBUGL_ALL;
+	debug_verbosity = DEBUGV_MORE;
+	max_debug_file_size = 0;
+	ck_assert_int_eq(OK, open_debug_log());
+	ck_assert_int_eq(TRUE, g_file_get_contents(old_file, &contents, &size, NULL));
+	ck_assert_str_eq("previous run", contents);
+	g_free(contents);
+
+	/* arguments are copied as they are and formatted when decoding */
+	ret = log_debug_info(DEBUGL_CHECKS, DEBUGV_MORE, "%s has %d checks, %lu done, %.2f%% %c [%5.*s] %llx\n",
+	                     "host1", -3, 42UL, 99.5, 'x', 3, "truncated", 0xdeadbeefULL);
+	ck_assert_int_eq(OK, ret);
+	ret = log_debug_info(DEBUGL_CHECKS, DEBUGV_MOST, "too verbose\n");
+	ck_assert_int_eq(OK, ret);
+	ck_assert_int_eq(TRUE, g_file_get_contents(debug_file, &contents, &size, NULL));
+	ck_assert_int_eq(size, DEBUGLOG_MIN_SIZE);
+	out = g_string_new(NULL);
+	messages = debuglog_decode(contents, size, out);
+	g_free(contents);
+	ck_assert_int_eq(messages, 1);
+	expected = g_strdup_printf("] [016.1] [pid=%lu] host1 has -3 checks, 42 done, 99.50%% x [  tru] deadbeef\n", (unsigned long)getpid());
+	ck_assert_msg(g_str_has_suffix(out->str, expected), "Unexpected output: %s", out->str);
+	g_free(expected);
+	g_string_free(out, TRUE);
+
+	/* the ring keeps the newest messages, and their format strings */
+	for (i = 0; i < 10000; i++) {
+		ret = log_debug_info(DEBUGL_EVENTS, DEBUGV_BASIC, "message %d of %s\n", i, "the wraparound test");
+		ck_assert_int_eq(OK, ret);
+	}
+	ck_assert_int_eq(TRUE, g_file_get_contents(debug_file, &contents, &size, NULL));
+	out = g_string_new(NULL);
+	messages = debuglog_decode(contents, size, out);
+	g_free(contents);
+	ck_assert(messages > 100 && messages < 10000);
+	ck_assert(strstr(out->str, "is no longer in the log") == NULL);
+	ck_assert(strstr(out->str, "host1 has") == NULL);
+	expected = g_strdup_printf("] message %ld of the wraparound test\n", 10000 - messages);
+	ck_assert_msg(strstr(out->str, expected) != NULL, "Missing '%s'", expected);
+	g_free(expected);
+	ck_assert(g_str_has_suffix(out->str, "] message 9999 of the wraparound test\n"));
+	g_string_free(out, TRUE);
+
+	/* a format string's memory may hold another once its module is unloaded */
+	strcpy(fmtbuf, "first module says %d\n");
+	ck_assert_int_eq(OK, log_debug_info(DEBUGL_EVENTS, DEBUGV_BASIC, fmtbuf, 1));
+	forget_debug_log_formats();
+	strcpy(fmtbuf, "second module says %s\n");
+	ck_assert_int_eq(OK, log_debug_info(DEBUGL_EVENTS, DEBUGV_BASIC, fmtbuf, "hello"));
+	ck_assert_int_eq(TRUE, g_file_get_contents(debug_file, &contents, &size, NULL));
+	out = g_string_new(NULL);
+	messages = debuglog_decode(contents, size, out);
+	g_free(contents);
+	ck_assert_msg(strstr(out->str, "] first module says 1\n") != NULL, "Unexpected output: %s", out->str);
+	ck_assert(g_str_has_suffix(out->str, "] second module says hello\n"));
+	g_string_free(out, TRUE);
+
+	/* reopening it on a restart carries on where we were */
+	close_debug_log();
+	ck_assert_int_eq(OK, open_debug_log());
+	ck_assert_int_eq(OK, log_debug_info(DEBUGL_EVENTS, DEBUGV_BASIC, "after the restart\n"));
+	ck_assert_int_eq(TRUE, g_file_get_contents(old_file, &contents, &size, NULL));
+	ck_assert_str_eq("previous run", contents);
+	g_free(contents);
+	ck_assert_int_eq(TRUE, g_file_get_contents(debug_file, &contents, &size, NULL));
+	out = g_string_new(NULL);
+	ck_assert(debuglog_decode(contents, size, out) > 1);
+	ck_assert(strstr(out->str, "] second module says hello\n") != NULL);
+	ck_assert(g_str_has_suffix(out->str, "] after the restart\n"));
+	ck_assert_int_eq(-1, debuglog_decode("not a debug log", 16, out));
+	g_free(contents);
+	g_string_free(out, TRUE);
+
+	close_debug_log();
+	unlink(debug_file);
+	unlink(old_file);
+	free(old_file);
+	binary_debug_log = FALSE;
+	debug_level = DEBUGL_NONE;
+}
+END_TEST
+
 Suite *
 checks_suite(void)
 {
 	Suite *s = suite_create("Logs");
 	TCase *rot = tcase_create("Handling log rotation");
+	TCase *async = tcase_create("Asynchronous logging");
+	TCase *binary = tcase_create("Binary debug log");
 	tcase_add_test(rot, common_case);
 	suite_add_tcase(s, rot);
+	tcase_add_test(async, async_logging);
+	tcase_add_test(async, async_rotation);
+	tcase_add_test(async, async_fork);
+	suite_add_tcase(s, async);
+	tcase_add_test(binary, binary_debug_logging);
+	suite_add_tcase(s, binary);
 	return s;
 }
 
@@ -2,6 +2,7 @@
 #include "naemon/nm_alloc.h"
 #include "naemon/events.h"
 #include "naemon/nebmods.h"
+#include "naemon/neberrors.h"
 #include "naemon/broker.h"
 #include "naemon/nebstructs.h"
 #include "naemon/statusdata.h"
@@ -9,7 +10,10 @@
 #include "naemon/checks.h"
 #include "naemon/checks_service.h"
 #include "naemon/checks_host.h"
+#include <sys/time.h>
 #define NUM_NEBTYPES 2000
+#define NUM_BENCH_MODULES 5
+#define BENCH_EVENTS 1000000
 nebmodule *test_nebmodule;
 static void *received_callback_data[NEBCALLBACK_NUMITEMS][NUM_NEBTYPES];
 
@@ -305,12 +309,144 @@ START_TEST(test_cb_api_v2)
 }
 END_TEST
 
+static unsigned int counted[3];
+
+static int count_cb_0(int type, void *data)
+{
+	counted[0]++;
+	return 0;
+}
+
+static int count_cb_1(int type, void *data)
+{
+	counted[1]++;
+	return 0;
+}
+
+static int count_cb_2(int type, void *data)
+{
+	counted[2]++;
+	return 0;
+}
+
+static int cancel_cb(int type, void *data)
+{
+	return NEBERROR_CALLBACKCANCEL;
+}
+
+void setup_dispatch(void)
+{
+	common_setup();
+	hst = create_host("MyHost");
+	svc = create_service(hst, "MyService");
+	memset(counted, 0, sizeof(counted));
+	event_broker_options = BROKER_EVERYTHING;
+}
+
+void teardown_dispatch(void)
+{
+	common_teardown();
+	destroy_service(svc);
+	destroy_host(hst);
+}
+
+static int broker_check(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return broker_service_check(NEBTYPE_SERVICECHECK_PROCESSED, NEBFLAG_NONE, NEBATTR_NONE, svc, CHECK_TYPE_ACTIVE,
+	                            now, now, "check_dummy!0!OK", 0.1, 0.2, 60, FALSE, 0, "/usr/lib/plugins/check_dummy 0 OK", NULL);
+}
+
+START_TEST(test_cb_no_listeners)
+{
+	ck_assert(!neb_has_callbacks(NEBCALLBACK_SERVICE_CHECK_DATA));
+	ck_assert_int_eq(OK, neb_make_callbacks(NEBCALLBACK_SERVICE_CHECK_DATA, NULL));
+	ck_assert_int_eq(OK, broker_check());
+
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, count_cb_0);
+	ck_assert(neb_has_callbacks(NEBCALLBACK_SERVICE_CHECK_DATA));
+	ck_assert(!neb_has_callbacks(NEBCALLBACK_HOST_CHECK_DATA));
+	ck_assert_int_eq(OK, broker_check());
+	ck_assert_int_eq(1, counted[0]);
+}
+END_TEST
+
+START_TEST(test_cb_deregister_first)
+{
+	/* each one goes in at the head of the list */
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 2, count_cb_2);
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 1, count_cb_1);
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, count_cb_0);
+	ck_assert_int_eq(OK, neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, count_cb_0));
+
+	/* the ones behind it must survive */
+	broker_check();
+	ck_assert_int_eq(0, counted[0]);
+	ck_assert_int_eq(1, counted[1]);
+	ck_assert_int_eq(1, counted[2]);
+}
+END_TEST
+
+START_TEST(test_cb_cancel)
+{
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 0, count_cb_0);
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 1, cancel_cb);
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 2, count_cb_1);
+	neb_register_callback_full(NEBCALLBACK_SERVICE_CHECK_DATA, test_nebmodule->module_handle, 3, NEB_API_VERSION_2, _test_cb_v2);
+
+	ck_assert_int_eq(NEBERROR_CALLBACKCANCEL, broker_check());
+	ck_assert_int_eq(1, counted[0]);
+	ck_assert_int_eq(0, counted[1]);
+
+	/* version 2 callbacks get their result thrown away */
+	neb_deregister_callback(NEBCALLBACK_SERVICE_CHECK_DATA, cancel_cb);
+	ck_assert_int_eq(0, neb_make_callbacks(NEBCALLBACK_SERVICE_CHECK_DATA, "description"));
+	ck_assert_int_eq(2, counted[0]);
+	ck_assert_int_eq(1, counted[1]);
+}
+END_TEST
+
+static double broker_rate(void)
+{
+	struct timeval start, stop;
+	unsigned int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_EVENTS; i++)
+		broker_check();
+	gettimeofday(&stop, NULL);
+
+	return BENCH_EVENTS / ((stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0);
+}
+
+START_TEST(test_cb_dispatch_rate)
+{
+	static nebmodule modules[NUM_BENCH_MODULES];
+	int i;
+
+	for (i = 0; i < NUM_BENCH_MODULES; i++)
+		neb_add_core_module(&modules[i]);
+
+	printf("broker events/s with 0 modules: %.0f\n", broker_rate());
+	neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, modules[0].module_handle, 0, count_cb_0);
+	printf("broker events/s with 1 module: %.0f\n", broker_rate());
+	for (i = 1; i < NUM_BENCH_MODULES; i++)
+		neb_register_callback(NEBCALLBACK_SERVICE_CHECK_DATA, modules[i].module_handle, 0, count_cb_0);
+	printf("broker events/s with %d modules: %.0f\n", NUM_BENCH_MODULES, broker_rate());
+
+	ck_assert_int_eq(BENCH_EVENTS * (1 + NUM_BENCH_MODULES), counted[0]);
+}
+END_TEST
+
 Suite *
 neb_cb_suite(void)
 {
 	Suite *s = suite_create("NEB Callbacks");
 	TCase *tc_api_version_1 = tcase_create("API Version 1");
 	TCase *tc_api_version_2 = tcase_create("API Version 2");
+	TCase *tc_dispatch = tcase_create("Dispatch");
 	tcase_add_checked_fixture(tc_api_version_1, setup_v1, teardown_v1);
 	tcase_add_test(tc_api_version_1, test_cb_service_check_processed);
 	tcase_add_test(tc_api_version_1, test_cb_service_stalking);
@@ -324,6 +460,13 @@ neb_cb_suite(void)
 	tcase_add_test(tc_api_version_2, test_cb_api_v2);
 	tcase_add_test(tc_api_version_2, test_cb_resultset_destroy_null);
 	suite_add_tcase(s, tc_api_version_2);
+
+	tcase_add_checked_fixture(tc_dispatch, setup_dispatch, teardown_dispatch);
+	tcase_add_test(tc_dispatch, test_cb_no_listeners);
+	tcase_add_test(tc_dispatch, test_cb_deregister_first);
+	tcase_add_test(tc_dispatch, test_cb_cancel);
+	tcase_add_test(tc_dispatch, test_cb_dispatch_rate);
+	suite_add_tcase(s, tc_dispatch);
 	return s;
 }
 
@@ -0,0 +1,248 @@
+#include <check.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "naemon/nerd.c"
+
+/*
+ * These tests subscribe to a channel with a socketpair per subscriber
+ * and play the part of clients that read at whatever pace they like.
+ */
+
+#define NUM_MESSAGES 10000
+#define MESSAGE_SIZE 200
+
+struct reader {
+	int fd;
+	char partial[MESSAGE_SIZE];
+	size_t plen;
+	int lines;
+	int last_seq;
+	int out_of_order;
+};
+
+static int chan_id;
+static struct nerd_channel *chan;
+
+static int ignore_input(int sd, int events, void *arg)
+{
+	return 0;
+}
+
+static void nerd_setup(void)
+{
+	nagios_iobs = iobroker_create();
+	chan_id = nerd_mkchan("test", "Test channel", NULL, 0);
+	chan = nerd_get_channel(chan_id);
+}
+
+static void nerd_teardown(void)
+{
+	nerd_deinit();
+	iobroker_destroy(nagios_iobs, IOBROKER_CLOSE_SOCKETS);
+	nagios_iobs = NULL;
+}
+
+static int connect_subscriber(struct reader *r)
+{
+	int sv[2];
+
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+	memset(r, 0, sizeof(*r));
+	r->fd = sv[1];
+	r->last_seq = -1;
+	iobroker_register(nagios_iobs, sv[0], NULL, ignore_input);
+	subscribe(sv[0], chan, NULL);
+	return sv[0];
+}
+
+static void broadcast_seq(int seq)
+{
+	char buf[MESSAGE_SIZE];
+
+	memset(buf, '.', sizeof(buf));
+	snprintf(buf, sizeof(buf), "%08d ", seq);
+	buf[strlen(buf)] = '.';
+	buf[sizeof(buf) - 1] = '\n';
+	nerd_broadcast(chan_id, buf, sizeof(buf));
+}
+
+/* reads what's there and checks that whole messages arrive in order */
+static int drain(struct reader *r)
+{
+	char buf[65536];
+	ssize_t len, i;
+	int total = 0;
+
+	while ((len = read(r->fd, buf, sizeof(buf))) > 0) {
+		total += len;
+		for (i = 0; i < len; i++) {
+			ck_assert(r->plen < sizeof(r->partial));
+			r->partial[r->plen++] = buf[i];
+			if (buf[i] == '\n') {
+				int seq = atoi(r->partial);
+				ck_assert_int_eq(r->plen, MESSAGE_SIZE);
+				if (seq <= r->last_seq)
+					r->out_of_order++;
+				r->last_seq = seq;
+				r->lines++;
+				r->plen = 0;
+			}
+		}
+	}
+	return len == 0 ? -1 : total;
+}
+
+START_TEST(slow_subscriber)
+{
+	struct reader fast, slow;
+	struct nerd_subscriber *fs, *ss;
+	int fast_sd, slow_sd, i;
+
+	fast_sd = connect_subscriber(&fast);
+	slow_sd = connect_subscriber(&slow);
+
+	for (i = 0; i < NUM_MESSAGES; i++) {
+		broadcast_seq(i);
+		drain(&fast);
+		iobroker_poll(nagios_iobs, 0);
+	}
+	for (i = 0; i < 100 && fast.lines < NUM_MESSAGES; i++) {
+		iobroker_poll(nagios_iobs, 10);
+		drain(&fast);
+	}
+
+	fs = get_subscriber(fast_sd);
+	ss = get_subscriber(slow_sd);
+	ck_assert(fs != NULL && ss != NULL);
+	ck_assert_int_eq(fast.lines, NUM_MESSAGES);
+	ck_assert_int_eq(fast.out_of_order, 0);
+	ck_assert_int_eq(fs->dropped, 0);
+	ck_assert_int_eq(fs->delivered, NUM_MESSAGES);
+
+	ck_assert_msg(ss->dropped > 0, "a subscriber that doesn't read loses messages");
+	ck_assert(ss->count <= NERD_QUEUE_SIZE);
+	ck_assert(ss->queued_bytes <= NERD_QUEUE_BYTES);
+	ck_assert_int_eq(ss->writing, 1);
+
+	/* once it catches up, it gets everything that wasn't dropped */
+	for (i = 0; i < 1000 && (ss->count || drain(&slow) > 0); i++) {
+		iobroker_poll(nagios_iobs, 10);
+		drain(&slow);
+	}
+	ck_assert_int_eq(ss->count, 0);
+	ck_assert_int_eq(ss->writing, 0);
+	ck_assert_int_eq(slow.out_of_order, 0);
+	ck_assert_int_eq(slow.lines + ss->dropped, NUM_MESSAGES);
+	ck_assert_int_eq(slow.last_seq, NUM_MESSAGES - 1);
+}
+END_TEST
+
+START_TEST(disconnect_policy)
+{
+	struct reader fast, slow;
+	int fast_sd, slow_sd, i;
+
+	fast_sd = connect_subscriber(&fast);
+	slow_sd = connect_subscriber(&slow);
+	get_subscriber(slow_sd)->policy = NERD_OVERFLOW_DISCONNECT;
+
+	for (i = 0; i < NUM_MESSAGES && get_subscriber(slow_sd); i++) {
+		broadcast_seq(i);
+		drain(&fast);
+		iobroker_poll(nagios_iobs, 0);
+	}
+	ck_assert_msg(get_subscriber(slow_sd) == NULL, "a subscriber that overflows is disconnected");
+	ck_assert(!iobroker_is_registered(nagios_iobs, slow_sd));
+	ck_assert(get_subscriber(fast_sd) != NULL);
+	ck_assert_int_eq(fast.out_of_order, 0);
+
+	/* what was sent before it fell behind still arrives, and then EOF */
+	for (i = 0; i < 1000 && drain(&slow) >= 0; i++)
+		;
+	ck_assert(slow.lines > 0);
+	ck_assert_int_eq(slow.out_of_order, 0);
+	close(slow.fd);
+}
+END_TEST
+
+START_TEST(shared_messages)
+{
+	struct reader r1, r2;
+	struct nerd_subscriber *s1, *s2;
+	struct nerd_message *m1, *m2;
+	int i;
+
+	s1 = get_subscriber(connect_subscriber(&r1));
+	s2 = get_subscriber(connect_subscriber(&r2));
+	for (i = 0; !s1->count || !s2->count; i++)
+		broadcast_seq(i);
+	broadcast_seq(i);
+
+	m1 = s1->queue[(s1->head + s1->count - 1) % NERD_QUEUE_SIZE];
+	m2 = s2->queue[(s2->head + s2->count - 1) % NERD_QUEUE_SIZE];
+	ck_assert_msg(m1 == m2, "subscribers share the formatted message");
+	ck_assert_int_eq(m1->refs, 2);
+	ck_assert_int_eq(m1->len, MESSAGE_SIZE);
+	close(r1.fd);
+	close(r2.fd);
+}
+END_TEST
+
+START_TEST(qh_commands)
+{
+	struct reader r;
+	char buf[1024], cmd[64];
+	int sd, len;
+
+	sd = connect_subscriber(&r);
+	unsubscribe(sd, chan);
+	ck_assert(get_subscriber(sd) == NULL);
+
+	strcpy(cmd, "overflow disconnect");
+	ck_assert_int_eq(400, nerd_qh_handler(sd, cmd, strlen(cmd)));
+
+	subscribe(sd, chan, NULL);
+	strcpy(cmd, "overflow sideways");
+	ck_assert_int_eq(400, nerd_qh_handler(sd, cmd, strlen(cmd)));
+	strcpy(cmd, "overflow disconnect");
+	ck_assert_int_eq(0, nerd_qh_handler(sd, cmd, strlen(cmd)));
+	ck_assert_int_eq(NERD_OVERFLOW_DISCONNECT, get_subscriber(sd)->policy);
+
+	strcpy(cmd, "stats");
+	ck_assert_int_eq(0, nerd_qh_handler(sd, cmd, strlen(cmd)));
+	len = read(r.fd, buf, sizeof(buf) - 1);
+	ck_assert(len > 0);
+	buf[len] = 0;
+	ck_assert_str_eq(buf, mkstr("sd=%d;subscriptions=1;policy=disconnect;queued=0;queued_bytes=0;delivered=0;dropped=0\n", sd));
+	close(r.fd);
+}
+END_TEST
+
+Suite *nerd_suite(void)
+{
+	Suite *s = suite_create("NERD");
+	TCase *tc_queues = tcase_create("Subscriber queues");
+
+	tcase_add_checked_fixture(tc_queues, nerd_setup, nerd_teardown);
+	tcase_add_test(tc_queues, slow_subscriber);
+	tcase_add_test(tc_queues, disconnect_policy);
+	tcase_add_test(tc_queues, shared_messages);
+	tcase_add_test(tc_queues, qh_commands);
+	suite_add_tcase(s, tc_queues);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed = 0;
+	Suite *s = nerd_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_ENV);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,521 @@
+#include <check.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "naemon/notifications.c"
+#include "naemon/workers.c"
+#include "naemon/events.h"
+
+/*
+ * There are no workers here, so every command the dispatcher lets
+ * through fails to start and is counted as failed. Commands held
+ * back by the rate limit stay in the queue, where we can look at them.
+ * The shutdown tests play a worker that takes jobs but never finishes
+ * them, on one end of a socketpair.
+ */
+
+static host *hst;
+static contact *ctc;
+static command *cmd;
+static commandsmember *cm;
+static struct wproc_worker *wp;
+static int worker_sd;
+
+static void setup(void)
+{
+	char cmdname[] = "notify!arg";
+
+	init_event_queue();
+	init_macros();
+	init_objects_host(1);
+	init_objects_contact(1);
+	init_objects_command(1);
+
+	cmd = create_command("notify", "/bin/notify $CONTACTNAME$ $NOTIFICATIONCOUNT$ '$NOTIFICATIONLIST$' $NOTIFICATIONTYPE$ $ARG1$");
+	ck_assert(cmd != NULL);
+	register_command(cmd);
+	hst = create_host("my_host");
+	ck_assert(hst != NULL);
+	register_host(hst);
+	ctc = create_contact("my_contact");
+	ck_assert(ctc != NULL);
+	cm = add_host_notification_command_to_contact(ctc, cmdname);
+	ck_assert(cm != NULL);
+	register_contact(ctc);
+
+	memset(&notification_stats, 0, sizeof(notification_stats));
+	memset(&dispatch_queue, 0, sizeof(dispatch_queue));
+	dispatching_stopped = FALSE;
+	notification_rate_limit = 0;
+	notification_coalesce_window = 0;
+}
+
+static void teardown(void)
+{
+	notification_dispatch_deinit();
+	destroy_event_queue();
+	destroy_objects_command();
+	destroy_objects_contact();
+	destroy_objects_host();
+}
+
+static void worker_setup(void)
+{
+	int sv[2];
+
+	setup();
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	nagios_iobs = iobroker_create();
+	ck_assert(nagios_iobs != NULL);
+	specialized_workers = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+	wp = nm_calloc(1, sizeof(*wp));
+	wp->name = nm_strdup("test worker");
+	wp->sd = sv[0];
+	wp->pid = getpid();
+	wp->max_jobs = 100;
+	wp->bq = nm_bufferqueue_create();
+	wp->jobs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, destroy_job);
+	wp->wp_list = &workers;
+	nagios_pid = getpid();
+	workers.len = 1;
+	workers.wps = nm_calloc(1, sizeof(struct wproc_worker *));
+	workers.wps[0] = wp;
+	iobroker_register(nagios_iobs, wp->sd, wp, handle_worker_result);
+	wproc_num_workers_online = 1;
+	worker_sd = sv[1];
+	notifications_running = 0;
+}
+
+static void worker_teardown(void)
+{
+	/* the jobs that never finished are lost, as when the workers are killed */
+	g_hash_table_destroy(wp->jobs);
+	ck_assert_int_eq(0, notifications_running);
+	close(worker_sd);
+	nm_bufferqueue_destroy(wp->bq);
+	nm_free(wp->name);
+	nm_free(wp);
+	nm_free(workers.wps);
+	workers.len = 0;
+	g_hash_table_destroy(specialized_workers);
+	specialized_workers = NULL;
+	iobroker_destroy(nagios_iobs, IOBROKER_CLOSE_SOCKETS);
+	nagios_iobs = NULL;
+	worker_dispatch_batching = DEFAULT_WORKER_DISPATCH_BATCHING;
+	teardown();
+}
+
+/* counts the jobs for command_line the worker was sent */
+static int worker_jobs_for(const char *buf, int len, const char *command_line)
+{
+	const char *p = buf, *end = buf + len;
+	int found = 0;
+
+	while ((p = memmem(p, end - p, command_line, strlen(command_line)))) {
+		found++;
+		p += strlen(command_line);
+	}
+	return found;
+}
+
+static void dispatch(const char *command_line)
+{
+	struct notification_job *nj = nm_calloc(1, sizeof(*nj));
+
+	nj->ctc = ctc;
+	nj->hst = hst;
+	dispatch_notification(nm_strdup(command_line), nj);
+}
+
+/* runs the queue's event as if its time had come */
+static void run_dispatch_event(void)
+{
+	struct nm_event_execution_properties evprop;
+	timed_event *ev = dispatch_queue.ev;
+
+	memset(&evprop, 0, sizeof(evprop));
+	evprop.execution_type = EVENT_EXEC_NORMAL;
+	evprop.event_type = EVENT_TYPE_TIMED;
+	dispatch_queued_notifications(&evprop);
+	if (ev)
+		destroy_event(ev);
+}
+
+static void notify(const char *type, const char *item)
+{
+	nagios_macros mac;
+
+	memset(&mac, 0, sizeof(mac));
+	grab_host_macros_r(&mac, hst);
+	grab_contact_macros_r(&mac, ctc);
+	mac.x[MACRO_NOTIFICATIONTYPE] = nm_strdup(type);
+	mac.x[MACRO_NOTIFICATIONCOUNT] = nm_strdup("1");
+	mac.x[MACRO_NOTIFICATIONLIST] = nm_strdup(item);
+	coalesce_notification(&mac, ctc, cm, hst, NULL);
+	clear_volatile_macros_r(&mac);
+}
+
+START_TEST(unlimited)
+{
+	int i;
+
+	for (i = 0; i < 100; i++)
+		dispatch("/bin/true");
+	ck_assert_int_eq(notification_stats.failed, 100);
+	ck_assert_int_eq(notification_stats.queued, 0);
+	ck_assert(dispatch_queue.head == NULL);
+	ck_assert(dispatch_queue.ev == NULL);
+}
+END_TEST
+
+START_TEST(rate_limit)
+{
+	time_t now = time(NULL);
+	int i, sent = 0;
+
+	notification_rate_limit = 10;
+	for (i = 0; i < 100; i++)
+		sent += take_dispatch_token(now);
+	ck_assert_int_eq(sent, 10);
+	ck_assert(take_dispatch_token(now + 1));
+
+	/* unused sends don't pile up */
+	for (i = 0, sent = 0; i < 100; i++)
+		sent += take_dispatch_token(now + 5);
+	ck_assert_int_eq(sent, 10);
+}
+END_TEST
+
+START_TEST(queueing)
+{
+	int i;
+
+	notification_rate_limit = 10;
+	for (i = 0; i < 100; i++)
+		dispatch("/bin/true");
+	ck_assert(dispatch_queue.len >= 80);
+	ck_assert_int_eq(notification_stats.failed + dispatch_queue.len, 100);
+	ck_assert_int_eq(notification_stats.queued, dispatch_queue.len);
+	ck_assert(dispatch_queue.ev != NULL);
+
+	/* the queue's event sends the next lot */
+	dispatch_queue.refilled -= 5;
+	i = dispatch_queue.len;
+	run_dispatch_event();
+	ck_assert(dispatch_queue.len < (unsigned int)i);
+	ck_assert(dispatch_queue.ev != NULL);
+
+	/* and the rest goes out right away when we shut down */
+	notification_dispatch_deinit();
+	ck_assert_int_eq(notification_stats.failed, 100);
+	ck_assert_int_eq(dispatch_queue.len, 0);
+	ck_assert(dispatch_queue.head == NULL);
+	ck_assert(dispatch_queue.ev == NULL);
+}
+END_TEST
+
+START_TEST(coalescing)
+{
+	struct notification_batch *b;
+	char buf[1024];
+	int sv[2], len;
+
+	notification_coalesce_window = 30;
+	notify("PROBLEM", "PROBLEM;my_host;DOWN;first");
+	notify("PROBLEM", "PROBLEM;my_host;DOWN;second");
+	notify("RECOVERY", "RECOVERY;my_host;UP;third");
+	ck_assert_int_eq(g_hash_table_size(notification_batches), 1);
+	b = g_hash_table_lookup(notification_batches, cm);
+	ck_assert(b != NULL);
+	ck_assert_int_eq(b->count, 3);
+	ck_assert(b->ev != NULL);
+	ck_assert_int_eq(notification_stats.failed, 0);
+
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	strcpy(buf, "batches");
+	ck_assert_int_eq(0, notification_qh_handler(sv[0], buf, strlen(buf)));
+	len = read(sv[1], buf, sizeof(buf) - 1);
+	ck_assert(len > 0);
+	buf[len] = 0;
+	ck_assert(!strncmp(buf, "contact=my_contact;command=notify!arg;notifications=3;time_left=", 64));
+
+	/* hold the command in the queue so we can see what it looks like */
+	notification_rate_limit = 1;
+	while (!dispatch_queue.len)
+		dispatch("/bin/true");
+	send_notification_batch(b);
+	ck_assert_int_eq(g_hash_table_size(notification_batches), 0);
+	ck_assert_int_eq(notification_stats.batches, 1);
+	ck_assert_int_eq(dispatch_queue.len, 2);
+	ck_assert_str_eq(dispatch_queue.tail->command,
+	                 "/bin/notify my_contact 3 'PROBLEM;my_host;DOWN;first\\nPROBLEM;my_host;DOWN;second\\nRECOVERY;my_host;UP;third' PROBLEM arg");
+
+	strcpy(buf, "stats");
+	ck_assert_int_eq(0, notification_qh_handler(sv[0], buf, strlen(buf)));
+	len = read(sv[1], buf, sizeof(buf) - 1);
+	ck_assert(len > 0);
+	buf[len] = 0;
+	ck_assert(!strncmp(buf, "coalesce_window=30;rate_limit=1;open_batches=0;queue_length=2;", 62));
+	ck_assert(strstr(buf, ";queued=2;batches=1;coalesced=3\n") != NULL);
+	close(sv[0]);
+	close(sv[1]);
+}
+END_TEST
+
+START_TEST(batch_macros_are_from_queueing)
+{
+	struct notification_batch *b;
+	command *output_cmd;
+
+	output_cmd = create_command("notify_output", "/bin/notify '$HOSTOUTPUT$' $NOTIFICATIONCOUNT$ $ARG1$");
+	ck_assert(output_cmd != NULL);
+	cm->command_ptr = output_cmd;
+
+	/* the batch gets the host output from when it was opened */
+	notification_coalesce_window = 30;
+	hst->plugin_output = nm_strdup("went down");
+	notify("PROBLEM", "PROBLEM;my_host;DOWN;went down");
+	nm_free(hst->plugin_output);
+	hst->plugin_output = nm_strdup("came back");
+	notify("RECOVERY", "RECOVERY;my_host;UP;came back");
+	b = g_hash_table_lookup(notification_batches, cm);
+	ck_assert(b != NULL);
+
+	notification_rate_limit = 1;
+	while (!dispatch_queue.len)
+		dispatch("/bin/true");
+	send_notification_batch(b);
+	ck_assert_int_eq(dispatch_queue.len, 2);
+	ck_assert_str_eq(dispatch_queue.tail->command, "/bin/notify 'went down' 2 arg");
+
+	cm->command_ptr = cmd;
+	destroy_command(output_cmd);
+}
+END_TEST
+
+START_TEST(full_batch)
+{
+	int i;
+
+	notification_coalesce_window = 30;
+	for (i = 0; i < NOTIFICATION_BATCH_MAX; i++)
+		notify("PROBLEM", "PROBLEM;my_host;DOWN;again");
+	ck_assert_int_eq(g_hash_table_size(notification_batches), 0);
+	ck_assert_int_eq(notification_stats.batches, 1);
+	ck_assert_int_eq(notification_stats.failed, 1);
+
+	/* what's left coalescing is sent at shutdown */
+	notify("PROBLEM", "PROBLEM;my_host;DOWN;again");
+	ck_assert_int_eq(g_hash_table_size(notification_batches), 1);
+	notification_dispatch_deinit();
+	ck_assert(notification_batches == NULL);
+	ck_assert_int_eq(notification_stats.batches, 2);
+	ck_assert_int_eq(notification_stats.failed, 2);
+}
+END_TEST
+
+START_TEST(shutdown_sends_everything)
+{
+	char buf[65536];
+	int len;
+
+	worker_dispatch_batching = TRUE;
+	notification_timeout = 1;
+
+	/* held back by the rate limit, by coalescing and in the worker's batch */
+	notification_rate_limit = 1;
+	while (dispatch_queue.len < 3)
+		dispatch("/bin/true");
+	notification_coalesce_window = 30;
+	notify("PROBLEM", "PROBLEM;my_host;DOWN;first");
+	notify("PROBLEM", "PROBLEM;my_host;DOWN;second");
+	ck_assert_int_eq(g_hash_table_size(notification_batches), 1);
+	ck_assert_int_eq(1, notification_stats.dispatched);
+	ck_assert_int_eq(1, wp->batch.num_jobs);
+	ck_assert_int_eq(-1, read(worker_sd, buf, sizeof(buf)));
+
+	/* the worker has all of them once we've shut down */
+	notification_dispatch_deinit();
+	ck_assert(notification_batches == NULL);
+	ck_assert_int_eq(0, dispatch_queue.len);
+	ck_assert_int_eq(0, wp->batch.num_jobs);
+	ck_assert_int_eq(5, notification_stats.dispatched);
+	ck_assert_int_eq(0, notification_stats.failed);
+	ck_assert_int_eq(5, g_hash_table_size(wp->jobs));
+	len = read(worker_sd, buf, sizeof(buf));
+	ck_assert(len > 0);
+	ck_assert_int_eq(4, worker_jobs_for(buf, len, "/bin/true"));
+	ck_assert_int_eq(1, worker_jobs_for(buf, len, "/bin/notify my_contact 2 "));
+
+	/* none finished before we stopped waiting */
+	ck_assert_int_eq(5, notifications_running);
+}
+END_TEST
+
+START_TEST(shutdown_without_workers)
+{
+	/* the workers are gone, so it's all counted as failed and not waited for */
+	iobroker_unregister(nagios_iobs, wp->sd);
+	notification_timeout = 10;
+	notification_rate_limit = 1;
+	while (dispatch_queue.len < 3)
+		dispatch("/bin/true");
+	ck_assert_int_eq(1, notification_stats.failed);
+
+	notification_dispatch_deinit();
+	ck_assert_int_eq(4, notification_stats.failed);
+	ck_assert_int_eq(0, notification_stats.dispatched);
+	ck_assert_int_eq(0, notifications_running);
+}
+END_TEST
+
+/*
+ * For the notification list tests, eve doesn't want host notifications,
+ * and the escalation, the contactgroups and the host's own contacts
+ * overlap. Members are added to the head of their lists, so they're
+ * considered in the opposite order of how they're added here.
+ */
+static void list_setup(void)
+{
+	const char *names[] = { "alice", "bob", "carol", "dave", "eve", "frank" };
+	contactgroup *ops, *dev;
+	hostescalation *he;
+	unsigned int i;
+
+	init_objects_host(1);
+	init_objects_contact(ARRAY_SIZE(names));
+	init_objects_contactgroup(2);
+
+	hst = create_host("my_host");
+	ck_assert(hst != NULL);
+	register_host(hst);
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		ctc = create_contact(names[i]);
+		ck_assert(ctc != NULL);
+		ctc->host_notifications_enabled = TRUE;
+		ctc->host_notification_options = OPT_ALL;
+		register_contact(ctc);
+	}
+	find_contact("eve")->host_notifications_enabled = FALSE;
+
+	ops = create_contactgroup("ops", NULL);
+	ck_assert(add_contact_to_contactgroup(ops, "bob") != NULL);
+	ck_assert(add_contact_to_contactgroup(ops, "carol") != NULL);
+	ck_assert(add_contact_to_contactgroup(ops, "eve") != NULL);
+	register_contactgroup(ops);
+	dev = create_contactgroup("dev", NULL);
+	ck_assert(add_contact_to_contactgroup(dev, "carol") != NULL);
+	ck_assert(add_contact_to_contactgroup(dev, "dave") != NULL);
+	ck_assert(add_contact_to_contactgroup(dev, "alice") != NULL);
+	register_contactgroup(dev);
+
+	he = add_hostescalation("my_host", 1, 0, 0, NULL, OPT_ALL);
+	ck_assert(he != NULL);
+	ck_assert(add_contact_to_hostescalation(he, "dave") != NULL);
+	ck_assert(add_contact_to_hostescalation(he, "eve") != NULL);
+	ck_assert(add_contactgroup_to_hostescalation(he, "ops") != NULL);
+
+	ck_assert(add_contact_to_host(hst, "alice") != NULL);
+	ck_assert(add_contact_to_host(hst, "bob") != NULL);
+	ck_assert(add_contact_to_host(hst, "frank") != NULL);
+	ck_assert(add_contactgroup_to_host(hst, "dev") != NULL);
+	ck_assert(add_contactgroup_to_host(hst, "ops") != NULL);
+
+	hst->current_state = STATE_DOWN;
+	hst->current_notification_number = 1;
+}
+
+static void list_teardown(void)
+{
+	destroy_objects_host();
+	destroy_objects_contact();
+	destroy_objects_contactgroup();
+}
+
+/* builds the host's notification list and checks it and $NOTIFICATIONRECIPIENTS$ */
+static void check_notification_list(int options, int escalated, const char *list_names, const char *recipients)
+{
+	nagios_macros mac;
+	notification *list, *n;
+	GString *names = g_string_new(NULL);
+	int was_escalated = -1;
+
+	memset(&mac, 0, sizeof(mac));
+	list = create_notification_list_from_host(&mac, hst, options, &was_escalated, NOTIFICATION_NORMAL);
+	for (n = list; n; n = n->next) {
+		if (names->len)
+			g_string_append_c(names, ',');
+		g_string_append(names, n->contact->name);
+	}
+	free_notification_list(list);
+
+	ck_assert_int_eq(escalated, was_escalated);
+	ck_assert_str_eq(list_names, names->str);
+	ck_assert_str_eq(recipients, mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
+	g_string_free(names, TRUE);
+	nm_free(mac.x[MACRO_NOTIFICATIONRECIPIENTS]);
+	nm_free(mac.x[MACRO_NOTIFICATIONISESCALATED]);
+}
+
+START_TEST(escalated_list)
+{
+	check_notification_list(NOTIFICATION_OPTION_NONE, TRUE, "bob,carol,dave", "dave,carol,bob");
+}
+END_TEST
+
+START_TEST(normal_list)
+{
+	hst->current_notification_number = 0;
+	check_notification_list(NOTIFICATION_OPTION_NONE, FALSE, "dave,carol,alice,bob,frank", "frank,bob,alice,carol,dave");
+}
+END_TEST
+
+START_TEST(broadcast_list)
+{
+	check_notification_list(NOTIFICATION_OPTION_BROADCAST, TRUE, "alice,frank,bob,carol,dave", "dave,carol,bob,frank,alice");
+}
+END_TEST
+
+Suite *notification_dispatch_suite(void)
+{
+	Suite *s = suite_create("Notification dispatch");
+	TCase *tc = tcase_create("Dispatch queue");
+	TCase *tc_shutdown = tcase_create("Shutdown");
+	TCase *tc_list = tcase_create("Notification lists");
+
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, unlimited);
+	tcase_add_test(tc, rate_limit);
+	tcase_add_test(tc, queueing);
+	tcase_add_test(tc, coalescing);
+	tcase_add_test(tc, batch_macros_are_from_queueing);
+	tcase_add_test(tc, full_batch);
+	suite_add_tcase(s, tc);
+
+	tcase_add_checked_fixture(tc_shutdown, worker_setup, worker_teardown);
+	tcase_add_test(tc_shutdown, shutdown_sends_everything);
+	tcase_add_test(tc_shutdown, shutdown_without_workers);
+	suite_add_tcase(s, tc_shutdown);
+
+	tcase_add_checked_fixture(tc_list, list_setup, list_teardown);
+	tcase_add_test(tc_list, escalated_list);
+	tcase_add_test(tc_list, normal_list);
+	tcase_add_test(tc_list, broadcast_list);
+	suite_add_tcase(s, tc_list);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed = 0;
+	Suite *s = notification_dispatch_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_ENV);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
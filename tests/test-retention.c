@@ -1,19 +1,27 @@
 #include <check.h>
 #include <glib.h>
 #include <stdio.h>
+#include <stddef.h>
 #include "naemon/objects_service.h"
 #include "naemon/objects_command.h"
 #include "naemon/objects_host.h"
+#include "naemon/objects_contact.h"
+#include "naemon/objects_timeperiod.h"
+#include "naemon/comments.h"
 #include "naemon/downtime.h"
 #include "naemon/events.h"
+#include "naemon/xrdbinary.h"
 #include "naemon/xrddefault.c"
 
 #define TARGET_SERVICE_NAME "my_service"
 #define TARGET_HOST_NAME "my_host"
+#define TARGET_CONTACT_NAME "my_contact"
 
 static host *hst;
 static command *cmd;
 static service *svc;
+static contact *cntct;
+static timeperiod *tp;
 
 /* This is separate due to it being required from inside the tests. */
 void setup_objects(void)
@@ -24,11 +32,18 @@ void setup_objects(void)
 	ck_assert(cmd != NULL);
 	register_command(cmd);
 
+	init_objects_timeperiod(1);
+	tp = create_timeperiod("my_timeperiod", "My timeperiod");
+	ck_assert(tp != NULL);
+	register_timeperiod(tp);
+
 	init_objects_host(1);
 	hst = create_host(TARGET_HOST_NAME);
 	ck_assert(hst != NULL);
 	hst->check_command_ptr = cmd;
 	hst->retain_status_information = TRUE;
+	hst->retain_nonstatus_information = TRUE;
+	add_custom_variable_to_host(hst, "MY_VAR", "from config");
 	register_host(hst);
 
 	init_objects_service(1);
@@ -36,8 +51,57 @@ void setup_objects(void)
 	ck_assert(svc != NULL);
 	svc->check_command_ptr = cmd;
 	svc->retain_status_information = TRUE;
+	svc->retain_nonstatus_information = TRUE;
+	add_custom_variable_to_service(svc, "MY_VAR", "from config");
 	register_service(svc);
 
+	init_objects_contact(1);
+	cntct = create_contact(TARGET_CONTACT_NAME);
+	ck_assert(cntct != NULL);
+	cntct->retain_status_information = TRUE;
+	cntct->retain_nonstatus_information = TRUE;
+	add_custom_variable_to_contact(cntct, "MY_VAR", "from config");
+	register_contact(cntct);
+
+}
+
+/* like setup_objects(), but another host gets the first id */
+void setup_objects_with_new_host(void)
+{
+	host *new_hst;
+
+	init_objects_command(1);
+	cmd = create_command("my_command", "/bin/true");
+	ck_assert(cmd != NULL);
+	register_command(cmd);
+
+	init_objects_host(2);
+	new_hst = create_host("my_new_host");
+	ck_assert(new_hst != NULL);
+	new_hst->check_command_ptr = cmd;
+	register_host(new_hst);
+	hst = create_host(TARGET_HOST_NAME);
+	ck_assert(hst != NULL);
+	hst->check_command_ptr = cmd;
+	hst->retain_status_information = TRUE;
+	register_host(hst);
+
+	init_objects_service(1);
+	svc = create_service(hst, TARGET_SERVICE_NAME);
+	ck_assert(svc != NULL);
+	svc->check_command_ptr = cmd;
+	svc->retain_status_information = TRUE;
+	register_service(svc);
+
+	init_objects_timeperiod(1);
+	tp = create_timeperiod("my_timeperiod", "My timeperiod");
+	ck_assert(tp != NULL);
+	register_timeperiod(tp);
+
+	init_objects_contact(1);
+	cntct = create_contact(TARGET_CONTACT_NAME);
+	ck_assert(cntct != NULL);
+	register_contact(cntct);
 }
 
 void teardown_objects(void)
@@ -46,6 +110,8 @@ void teardown_objects(void)
 	destroy_objects_command();
 	destroy_objects_host();
 	destroy_objects_service();
+	destroy_objects_contact();
+	destroy_objects_timeperiod();
 
 }
 
@@ -56,6 +122,9 @@ void setup(void)
 	setup_objects();
 
 	retain_state_information = TRUE;
+	binary_retention = FALSE;
+	background_retention_saves = FALSE;
+	retention_fsync = TRUE;
 	retention_file = nm_strdup("/tmp/retention.dat");
 	temp_file = nm_strdup("/tmp/retention.tmp");
 
@@ -108,6 +177,641 @@ START_TEST(retention_data_for_services_long_output)
 }
 END_TEST
 
+/* saves the retention data, recreates the objects from "config" and reads it back */
+static void reload_state_information(void)
+{
+	ck_assert(OK == save_state_information(0));
+
+	teardown_objects();
+	setup_objects();
+
+	ck_assert(OK == read_initial_state_information());
+}
+
+START_TEST(retention_data_text_program)
+{
+	modified_host_process_attributes = MODATTR_NOTIFICATIONS_ENABLED | MODATTR_ACTIVE_CHECKS_ENABLED
+	                                   | MODATTR_PASSIVE_CHECKS_ENABLED | MODATTR_EVENT_HANDLER_ENABLED
+	                                   | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_FRESHNESS_CHECKS_ENABLED
+	                                   | MODATTR_FLAP_DETECTION_ENABLED | MODATTR_PERFORMANCE_DATA_ENABLED
+	                                   | MODATTR_EVENT_HANDLER_COMMAND;
+	modified_service_process_attributes = MODATTR_ACTIVE_CHECKS_ENABLED | MODATTR_PASSIVE_CHECKS_ENABLED
+	                                      | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_FRESHNESS_CHECKS_ENABLED
+	                                      | MODATTR_EVENT_HANDLER_COMMAND;
+	enable_notifications = FALSE;
+	execute_service_checks = FALSE;
+	accept_passive_service_checks = FALSE;
+	execute_host_checks = FALSE;
+	accept_passive_host_checks = FALSE;
+	enable_event_handlers = FALSE;
+	obsess_over_services = TRUE;
+	obsess_over_hosts = TRUE;
+	check_service_freshness = FALSE;
+	check_host_freshness = FALSE;
+	enable_flap_detection = FALSE;
+	process_performance_data = TRUE;
+	global_host_event_handler = nm_strdup("my_command");
+	global_service_event_handler = nm_strdup("my_command!1");
+	next_comment_id = 11;
+	next_downtime_id = 12;
+	next_event_id = 13;
+	next_problem_id = 14;
+	next_notification_id = 15;
+
+	ck_assert(OK == save_state_information(0));
+
+	/* what the config would have said */
+	modified_host_process_attributes = MODATTR_NONE;
+	modified_service_process_attributes = MODATTR_NONE;
+	enable_notifications = TRUE;
+	execute_service_checks = TRUE;
+	accept_passive_service_checks = TRUE;
+	execute_host_checks = TRUE;
+	accept_passive_host_checks = TRUE;
+	enable_event_handlers = TRUE;
+	obsess_over_services = FALSE;
+	obsess_over_hosts = FALSE;
+	check_service_freshness = TRUE;
+	check_host_freshness = TRUE;
+	enable_flap_detection = TRUE;
+	process_performance_data = FALSE;
+	nm_free(global_host_event_handler);
+	nm_free(global_service_event_handler);
+	next_comment_id = next_downtime_id = next_event_id = next_problem_id = next_notification_id = 0;
+
+	ck_assert(OK == read_initial_state_information());
+
+	ck_assert_int_eq(MODATTR_NOTIFICATIONS_ENABLED | MODATTR_ACTIVE_CHECKS_ENABLED
+	                 | MODATTR_PASSIVE_CHECKS_ENABLED | MODATTR_EVENT_HANDLER_ENABLED
+	                 | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_FRESHNESS_CHECKS_ENABLED
+	                 | MODATTR_FLAP_DETECTION_ENABLED | MODATTR_PERFORMANCE_DATA_ENABLED
+	                 | MODATTR_EVENT_HANDLER_COMMAND, modified_host_process_attributes);
+	ck_assert_int_eq(MODATTR_ACTIVE_CHECKS_ENABLED | MODATTR_PASSIVE_CHECKS_ENABLED
+	                 | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_FRESHNESS_CHECKS_ENABLED
+	                 | MODATTR_EVENT_HANDLER_COMMAND, modified_service_process_attributes);
+	ck_assert_int_eq(FALSE, enable_notifications);
+	ck_assert_int_eq(FALSE, execute_service_checks);
+	ck_assert_int_eq(FALSE, accept_passive_service_checks);
+	ck_assert_int_eq(FALSE, execute_host_checks);
+	ck_assert_int_eq(FALSE, accept_passive_host_checks);
+	ck_assert_int_eq(FALSE, enable_event_handlers);
+	ck_assert_int_eq(TRUE, obsess_over_services);
+	ck_assert_int_eq(TRUE, obsess_over_hosts);
+	ck_assert_int_eq(FALSE, check_service_freshness);
+	ck_assert_int_eq(FALSE, check_host_freshness);
+	ck_assert_int_eq(FALSE, enable_flap_detection);
+	ck_assert_int_eq(TRUE, process_performance_data);
+	ck_assert_str_eq("my_command", global_host_event_handler);
+	ck_assert_str_eq("my_command!1", global_service_event_handler);
+	ck_assert_int_eq(11, next_comment_id);
+	ck_assert_int_eq(12, next_downtime_id);
+	ck_assert_int_eq(13, next_event_id);
+	ck_assert_int_eq(14, next_problem_id);
+	ck_assert_int_eq(15, next_notification_id);
+
+	/* the config wins for everything that wasn't modified */
+	modified_host_process_attributes = MODATTR_NONE;
+	modified_service_process_attributes = MODATTR_NONE;
+	ck_assert(OK == save_state_information(0));
+	enable_notifications = TRUE;
+	ck_assert(OK == read_initial_state_information());
+	ck_assert_int_eq(TRUE, enable_notifications);
+
+	nm_free(global_host_event_handler);
+	nm_free(global_service_event_handler);
+}
+END_TEST
+
+START_TEST(retention_data_text_host)
+{
+	time_t now = time(NULL);
+	int x;
+
+	hst->has_been_checked = TRUE;
+	hst->execution_time = 1.5;
+	hst->latency = 0.25;
+	hst->check_type = CHECK_TYPE_PASSIVE;
+	hst->current_state = STATE_DOWN;
+	hst->last_state = STATE_UNREACHABLE;
+	hst->last_hard_state = STATE_UP;
+	hst->last_event_id = 21;
+	hst->current_event_id = 22;
+	hst->current_problem_id = 23;
+	hst->last_problem_id = 24;
+	hst->plugin_output = nm_strdup("DOWN - retained");
+	hst->long_plugin_output = nm_strdup("first line\\nsecond line");
+	hst->perf_data = nm_strdup("rta=1ms;2;3");
+	hst->last_check = now - 10;
+	hst->next_check = now + 300;
+	hst->check_options = CHECK_OPTION_FORCE_EXECUTION;
+	hst->current_attempt = 1;
+	hst->state_type = SOFT_STATE;
+	hst->last_state_change = now - 20;
+	hst->last_hard_state_change = now - 30;
+	hst->last_time_up = now - 40;
+	hst->last_time_down = now - 10;
+	hst->last_time_unreachable = now - 50;
+	hst->notified_on = OPT_DOWN | OPT_UNREACHABLE;
+	hst->last_notification = now - 60;
+	hst->current_notification_number = 3;
+	hst->current_notification_id = 25;
+	hst->is_flapping = TRUE;
+	hst->percent_state_change = 12.5;
+	hst->check_flapping_recovery_notification = TRUE;
+	hst->last_update = now - 5;
+	for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++)
+		hst->state_history[x] = x % 3;
+
+	/* non-status information, as changed by external commands */
+	hst->problem_has_been_acknowledged = TRUE;
+	hst->acknowledgement_type = ACKNOWLEDGEMENT_STICKY;
+	pre_modify_host_attribute(hst, MODATTR_NOTIFICATIONS_ENABLED);
+	hst->notifications_enabled = TRUE;
+	hst->checks_enabled = TRUE;
+	hst->accept_passive_checks = TRUE;
+	hst->event_handler_enabled = TRUE;
+	hst->flap_detection_enabled = TRUE;
+	hst->process_performance_data = TRUE;
+	hst->obsess = TRUE;
+	hst->modified_attributes = MODATTR_NOTIFICATIONS_ENABLED | MODATTR_ACTIVE_CHECKS_ENABLED
+	                           | MODATTR_PASSIVE_CHECKS_ENABLED | MODATTR_EVENT_HANDLER_ENABLED
+	                           | MODATTR_FLAP_DETECTION_ENABLED | MODATTR_PERFORMANCE_DATA_ENABLED
+	                           | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_CHECK_COMMAND
+	                           | MODATTR_CHECK_TIMEPERIOD | MODATTR_NOTIFICATION_TIMEPERIOD
+	                           | MODATTR_EVENT_HANDLER_COMMAND | MODATTR_NORMAL_CHECK_INTERVAL
+	                           | MODATTR_MAX_CHECK_ATTEMPTS | MODATTR_CUSTOM_VARIABLE;
+	hst->check_command = nm_strdup("my_command!2");
+	hst->check_period = tp->name;
+	hst->notification_period = tp->name;
+	hst->event_handler = nm_strdup("my_command!3");
+	hst->check_interval = 7.0;
+	hst->max_attempts = 5;
+	nm_free(hst->custom_variables->variable_value);
+	hst->custom_variables->variable_value = nm_strdup("from a command");
+	hst->custom_variables->has_been_modified = TRUE;
+
+	reload_state_information();
+
+	ck_assert_int_eq(TRUE, hst->has_been_checked);
+	ck_assert(hst->execution_time == 1.5);
+	ck_assert(hst->latency == 0.25);
+	ck_assert_int_eq(CHECK_TYPE_PASSIVE, hst->check_type);
+	ck_assert_int_eq(STATE_DOWN, hst->current_state);
+	ck_assert_int_eq(STATE_UNREACHABLE, hst->last_state);
+	ck_assert_int_eq(STATE_UP, hst->last_hard_state);
+	ck_assert_int_eq(21, hst->last_event_id);
+	ck_assert_int_eq(22, hst->current_event_id);
+	ck_assert_int_eq(23, hst->current_problem_id);
+	ck_assert_int_eq(24, hst->last_problem_id);
+	ck_assert_str_eq("DOWN - retained", hst->plugin_output);
+	ck_assert_str_eq("first line\\nsecond line", hst->long_plugin_output);
+	ck_assert_str_eq("rta=1ms;2;3", hst->perf_data);
+	ck_assert_int_eq(now - 10, hst->last_check);
+	ck_assert_int_eq(now + 300, hst->next_check);
+	ck_assert_int_eq(CHECK_OPTION_FORCE_EXECUTION, hst->check_options);
+	ck_assert_int_eq(1, hst->current_attempt);
+	ck_assert_int_eq(SOFT_STATE, hst->state_type);
+	ck_assert_int_eq(now - 20, hst->last_state_change);
+	ck_assert_int_eq(now - 30, hst->last_hard_state_change);
+	ck_assert_int_eq(now - 40, hst->last_time_up);
+	ck_assert_int_eq(now - 10, hst->last_time_down);
+	ck_assert_int_eq(now - 50, hst->last_time_unreachable);
+	ck_assert_int_eq(OPT_DOWN | OPT_UNREACHABLE, hst->notified_on);
+	ck_assert_int_eq(now - 60, hst->last_notification);
+	ck_assert_int_eq(3, hst->current_notification_number);
+	ck_assert_int_eq(25, hst->current_notification_id);
+	ck_assert_int_eq(TRUE, hst->is_flapping);
+	ck_assert(hst->percent_state_change == 12.5);
+	ck_assert_int_eq(TRUE, hst->check_flapping_recovery_notification);
+	ck_assert_int_eq(now - 5, hst->last_update);
+	for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++)
+		ck_assert_int_eq(x % 3, hst->state_history[x]);
+	ck_assert_int_eq(0, hst->state_history_index);
+
+	ck_assert_int_eq(TRUE, hst->problem_has_been_acknowledged);
+	ck_assert_int_eq(ACKNOWLEDGEMENT_STICKY, hst->acknowledgement_type);
+	ck_assert_int_eq(TRUE, hst->notifications_enabled);
+	ck_assert_int_eq(TRUE, hst->checks_enabled);
+	ck_assert_int_eq(TRUE, hst->accept_passive_checks);
+	ck_assert_int_eq(TRUE, hst->event_handler_enabled);
+	ck_assert_int_eq(TRUE, hst->flap_detection_enabled);
+	ck_assert_int_eq(TRUE, hst->process_performance_data);
+	ck_assert_int_eq(TRUE, hst->obsess);
+	ck_assert_int_eq(MODATTR_NOTIFICATIONS_ENABLED | MODATTR_ACTIVE_CHECKS_ENABLED
+	                 | MODATTR_PASSIVE_CHECKS_ENABLED | MODATTR_EVENT_HANDLER_ENABLED
+	                 | MODATTR_FLAP_DETECTION_ENABLED | MODATTR_PERFORMANCE_DATA_ENABLED
+	                 | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_CHECK_COMMAND
+	                 | MODATTR_CHECK_TIMEPERIOD | MODATTR_NOTIFICATION_TIMEPERIOD
+	                 | MODATTR_EVENT_HANDLER_COMMAND | MODATTR_NORMAL_CHECK_INTERVAL
+	                 | MODATTR_MAX_CHECK_ATTEMPTS | MODATTR_CUSTOM_VARIABLE, hst->modified_attributes);
+	ck_assert_str_eq("my_command!2", hst->check_command);
+	ck_assert(hst->check_period_ptr == tp);
+	ck_assert(hst->notification_period_ptr == tp);
+	ck_assert_str_eq("my_command!3", hst->event_handler);
+	ck_assert(hst->check_interval == 7.0);
+	ck_assert_int_eq(5, hst->max_attempts);
+	ck_assert_str_eq("from a command", hst->custom_variables->variable_value);
+	ck_assert_int_eq(TRUE, hst->custom_variables->has_been_modified);
+}
+END_TEST
+
+START_TEST(retention_data_text_service)
+{
+	time_t now = time(NULL);
+	int x;
+
+	svc->has_been_checked = TRUE;
+	svc->execution_time = 2.5;
+	svc->latency = 0.125;
+	svc->check_type = CHECK_TYPE_PASSIVE;
+	svc->current_state = STATE_WARNING;
+	svc->last_state = STATE_CRITICAL;
+	svc->last_hard_state = STATE_OK;
+	svc->last_event_id = 31;
+	svc->current_event_id = 32;
+	svc->current_problem_id = 33;
+	svc->last_problem_id = 34;
+	svc->current_attempt = 1;
+	svc->state_type = SOFT_STATE;
+	svc->last_state_change = now - 20;
+	svc->last_hard_state_change = now - 30;
+	svc->last_time_ok = now - 40;
+	svc->last_time_warning = now - 10;
+	svc->last_time_unknown = now - 50;
+	svc->last_time_critical = now - 15;
+	svc->plugin_output = nm_strdup("WARNING - retained");
+	svc->long_plugin_output = nm_strdup("first line\\nsecond line");
+	svc->perf_data = nm_strdup("load=1;2;3");
+	svc->last_check = now - 10;
+	svc->next_check = now + 300;
+	svc->check_options = CHECK_OPTION_FORCE_EXECUTION;
+	svc->notified_on = OPT_UNKNOWN | OPT_WARNING | OPT_CRITICAL;
+	svc->current_notification_number = 4;
+	svc->current_notification_id = 35;
+	svc->last_notification = now - 60;
+	svc->last_update = now - 5;
+	svc->is_flapping = TRUE;
+	svc->percent_state_change = 37.25;
+	svc->check_flapping_recovery_notification = TRUE;
+	for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++)
+		svc->state_history[x] = x % 4;
+
+	/* non-status information, as changed by external commands */
+	svc->problem_has_been_acknowledged = TRUE;
+	svc->acknowledgement_type = ACKNOWLEDGEMENT_STICKY;
+	pre_modify_service_attribute(svc, MODATTR_NOTIFICATIONS_ENABLED);
+	svc->notifications_enabled = TRUE;
+	svc->checks_enabled = TRUE;
+	svc->accept_passive_checks = TRUE;
+	svc->event_handler_enabled = TRUE;
+	svc->flap_detection_enabled = TRUE;
+	svc->process_performance_data = TRUE;
+	svc->obsess = TRUE;
+	svc->modified_attributes = MODATTR_NOTIFICATIONS_ENABLED | MODATTR_ACTIVE_CHECKS_ENABLED
+	                           | MODATTR_PASSIVE_CHECKS_ENABLED | MODATTR_EVENT_HANDLER_ENABLED
+	                           | MODATTR_FLAP_DETECTION_ENABLED | MODATTR_PERFORMANCE_DATA_ENABLED
+	                           | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_CHECK_COMMAND
+	                           | MODATTR_CHECK_TIMEPERIOD | MODATTR_NOTIFICATION_TIMEPERIOD
+	                           | MODATTR_EVENT_HANDLER_COMMAND | MODATTR_NORMAL_CHECK_INTERVAL
+	                           | MODATTR_RETRY_CHECK_INTERVAL | MODATTR_MAX_CHECK_ATTEMPTS
+	                           | MODATTR_CUSTOM_VARIABLE;
+	nm_free(svc->check_command);
+	svc->check_command = nm_strdup("my_command!4");
+	svc->check_period = tp->name;
+	svc->notification_period = tp->name;
+	svc->event_handler = nm_strdup("my_command!5");
+	svc->check_interval = 3.0;
+	svc->retry_interval = 0.5;
+	svc->max_attempts = 6;
+	nm_free(svc->custom_variables->variable_value);
+	svc->custom_variables->variable_value = nm_strdup("from a command");
+	svc->custom_variables->has_been_modified = TRUE;
+
+	reload_state_information();
+
+	ck_assert_int_eq(TRUE, svc->has_been_checked);
+	ck_assert(svc->execution_time == 2.5);
+	ck_assert(svc->latency == 0.125);
+	ck_assert_int_eq(CHECK_TYPE_PASSIVE, svc->check_type);
+	ck_assert_int_eq(STATE_WARNING, svc->current_state);
+	ck_assert_int_eq(STATE_CRITICAL, svc->last_state);
+	ck_assert_int_eq(STATE_OK, svc->last_hard_state);
+	ck_assert_int_eq(31, svc->last_event_id);
+	ck_assert_int_eq(32, svc->current_event_id);
+	ck_assert_int_eq(33, svc->current_problem_id);
+	ck_assert_int_eq(34, svc->last_problem_id);
+	ck_assert_int_eq(1, svc->current_attempt);
+	ck_assert_int_eq(SOFT_STATE, svc->state_type);
+	ck_assert_int_eq(now - 20, svc->last_state_change);
+	ck_assert_int_eq(now - 30, svc->last_hard_state_change);
+	ck_assert_int_eq(now - 40, svc->last_time_ok);
+	ck_assert_int_eq(now - 10, svc->last_time_warning);
+	ck_assert_int_eq(now - 50, svc->last_time_unknown);
+	ck_assert_int_eq(now - 15, svc->last_time_critical);
+	ck_assert_str_eq("WARNING - retained", svc->plugin_output);
+	ck_assert_str_eq("first line\\nsecond line", svc->long_plugin_output);
+	ck_assert_str_eq("load=1;2;3", svc->perf_data);
+	ck_assert_int_eq(now - 10, svc->last_check);
+	ck_assert_int_eq(now + 300, svc->next_check);
+	ck_assert_int_eq(CHECK_OPTION_FORCE_EXECUTION, svc->check_options);
+	ck_assert_int_eq(OPT_UNKNOWN | OPT_WARNING | OPT_CRITICAL, svc->notified_on);
+	ck_assert_int_eq(4, svc->current_notification_number);
+	ck_assert_int_eq(35, svc->current_notification_id);
+	ck_assert_int_eq(now - 60, svc->last_notification);
+	ck_assert_int_eq(now - 5, svc->last_update);
+	ck_assert_int_eq(TRUE, svc->is_flapping);
+	ck_assert(svc->percent_state_change == 37.25);
+	ck_assert_int_eq(TRUE, svc->check_flapping_recovery_notification);
+	for (x = 0; x < MAX_STATE_HISTORY_ENTRIES; x++)
+		ck_assert_int_eq(x % 4, svc->state_history[x]);
+	ck_assert_int_eq(0, svc->state_history_index);
+
+	ck_assert_int_eq(TRUE, svc->problem_has_been_acknowledged);
+	ck_assert_int_eq(ACKNOWLEDGEMENT_STICKY, svc->acknowledgement_type);
+	ck_assert_int_eq(TRUE, svc->notifications_enabled);
+	ck_assert_int_eq(TRUE, svc->checks_enabled);
+	ck_assert_int_eq(TRUE, svc->accept_passive_checks);
+	ck_assert_int_eq(TRUE, svc->event_handler_enabled);
+	ck_assert_int_eq(TRUE, svc->flap_detection_enabled);
+	ck_assert_int_eq(TRUE, svc->process_performance_data);
+	ck_assert_int_eq(TRUE, svc->obsess);
+	ck_assert_int_eq(MODATTR_NOTIFICATIONS_ENABLED | MODATTR_ACTIVE_CHECKS_ENABLED
+	                 | MODATTR_PASSIVE_CHECKS_ENABLED | MODATTR_EVENT_HANDLER_ENABLED
+	                 | MODATTR_FLAP_DETECTION_ENABLED | MODATTR_PERFORMANCE_DATA_ENABLED
+	                 | MODATTR_OBSESSIVE_HANDLER_ENABLED | MODATTR_CHECK_COMMAND
+	                 | MODATTR_CHECK_TIMEPERIOD | MODATTR_NOTIFICATION_TIMEPERIOD
+	                 | MODATTR_EVENT_HANDLER_COMMAND | MODATTR_NORMAL_CHECK_INTERVAL
+	                 | MODATTR_RETRY_CHECK_INTERVAL | MODATTR_MAX_CHECK_ATTEMPTS
+	                 | MODATTR_CUSTOM_VARIABLE, svc->modified_attributes);
+	ck_assert_str_eq("my_command!4", svc->check_command);
+	ck_assert(svc->check_period_ptr == tp);
+	ck_assert(svc->notification_period_ptr == tp);
+	ck_assert_str_eq("my_command!5", svc->event_handler);
+	ck_assert(svc->check_interval == 3.0);
+	ck_assert(svc->retry_interval == 0.5);
+	ck_assert_int_eq(6, svc->max_attempts);
+	ck_assert_str_eq("from a command", svc->custom_variables->variable_value);
+	ck_assert_int_eq(TRUE, svc->custom_variables->has_been_modified);
+}
+END_TEST
+
+START_TEST(retention_data_text_contact)
+{
+	time_t now = time(NULL);
+
+	cntct->last_host_notification = now - 10;
+	cntct->last_service_notification = now - 20;
+	pre_modify_contact_attribute(cntct, MODATTR_NOTIFICATIONS_ENABLED);
+	cntct->host_notifications_enabled = TRUE;
+	cntct->service_notifications_enabled = TRUE;
+	cntct->host_notification_period = tp->name;
+	cntct->service_notification_period = tp->name;
+	cntct->modified_attributes = MODATTR_CUSTOM_VARIABLE;
+	cntct->modified_host_attributes = MODATTR_NOTIFICATIONS_ENABLED | MODATTR_NOTIFICATION_TIMEPERIOD;
+	cntct->modified_service_attributes = MODATTR_NOTIFICATIONS_ENABLED | MODATTR_NOTIFICATION_TIMEPERIOD;
+	nm_free(cntct->custom_variables->variable_value);
+	cntct->custom_variables->variable_value = nm_strdup("from a command");
+	cntct->custom_variables->has_been_modified = TRUE;
+
+	reload_state_information();
+
+	ck_assert_int_eq(now - 10, cntct->last_host_notification);
+	ck_assert_int_eq(now - 20, cntct->last_service_notification);
+	ck_assert_int_eq(TRUE, cntct->host_notifications_enabled);
+	ck_assert_int_eq(TRUE, cntct->service_notifications_enabled);
+	ck_assert(cntct->host_notification_period_ptr == tp);
+	ck_assert(cntct->service_notification_period_ptr == tp);
+	ck_assert_int_eq(MODATTR_CUSTOM_VARIABLE, cntct->modified_attributes);
+	ck_assert_int_eq(MODATTR_NOTIFICATIONS_ENABLED | MODATTR_NOTIFICATION_TIMEPERIOD, cntct->modified_host_attributes);
+	ck_assert_int_eq(MODATTR_NOTIFICATIONS_ENABLED | MODATTR_NOTIFICATION_TIMEPERIOD, cntct->modified_service_attributes);
+	ck_assert_str_eq("from a command", cntct->custom_variables->variable_value);
+	ck_assert_int_eq(TRUE, cntct->custom_variables->has_been_modified);
+}
+END_TEST
+
+START_TEST(retention_data_text_comments_and_downtime)
+{
+	time_t now = time(NULL);
+	unsigned long host_comment_id, service_comment_id, host_downtime_id, service_downtime_id, downtime_comment_id;
+	comment *temp_comment;
+	scheduled_downtime *temp_downtime;
+
+	initialize_comment_data();
+	initialize_downtime_data();
+
+	ck_assert(OK == add_new_host_comment(USER_COMMENT, TARGET_HOST_NAME, now - 10, "host author", "host comment", TRUE, COMMENTSOURCE_EXTERNAL, TRUE, now + 3600, &host_comment_id));
+	ck_assert(OK == add_new_service_comment(USER_COMMENT, TARGET_HOST_NAME, TARGET_SERVICE_NAME, now - 20, "service author", "service comment", TRUE, COMMENTSOURCE_INTERNAL, FALSE, 0, &service_comment_id));
+	ck_assert(OK == add_new_host_downtime(TARGET_HOST_NAME, now - 30, "host author", "host downtime", now + 3600, now + 7200, TRUE, 0, 3600, &host_downtime_id, FALSE, FALSE));
+	ck_assert(OK == register_downtime(HOST_DOWNTIME, host_downtime_id));
+	downtime_comment_id = find_host_downtime(host_downtime_id)->comment_id;
+	ck_assert(OK == add_new_service_downtime(TARGET_HOST_NAME, TARGET_SERVICE_NAME, now - 40, "service author", "service downtime", now + 3600, now + 7200, FALSE, 0, 1800, &service_downtime_id, FALSE, FALSE));
+	ck_assert(OK == register_downtime(SERVICE_DOWNTIME, service_downtime_id));
+
+	ck_assert(OK == save_state_information(0));
+
+	free_comment_data();
+	free_downtime_data();
+	initialize_downtime_data();
+	teardown_objects();
+	setup_objects();
+
+	ck_assert(OK == read_initial_state_information());
+
+	temp_comment = find_host_comment(host_comment_id);
+	ck_assert(temp_comment != NULL);
+	ck_assert_int_eq(USER_COMMENT, temp_comment->entry_type);
+	ck_assert_str_eq(TARGET_HOST_NAME, temp_comment->host_name);
+	ck_assert_int_eq(now - 10, temp_comment->entry_time);
+	ck_assert_str_eq("host author", temp_comment->author);
+	ck_assert_str_eq("host comment", temp_comment->comment_data);
+	ck_assert_int_eq(TRUE, temp_comment->persistent);
+	ck_assert_int_eq(COMMENTSOURCE_EXTERNAL, temp_comment->source);
+	ck_assert_int_eq(TRUE, temp_comment->expires);
+	ck_assert_int_eq(now + 3600, temp_comment->expire_time);
+
+	temp_comment = find_service_comment(service_comment_id);
+	ck_assert(temp_comment != NULL);
+	ck_assert_str_eq(TARGET_HOST_NAME, temp_comment->host_name);
+	ck_assert_str_eq(TARGET_SERVICE_NAME, temp_comment->service_description);
+	ck_assert_int_eq(now - 20, temp_comment->entry_time);
+	ck_assert_str_eq("service author", temp_comment->author);
+	ck_assert_str_eq("service comment", temp_comment->comment_data);
+	ck_assert_int_eq(COMMENTSOURCE_INTERNAL, temp_comment->source);
+	ck_assert_int_eq(FALSE, temp_comment->expires);
+
+	/* the comment made for the downtime comes back with it */
+	ck_assert(find_host_comment(downtime_comment_id) != NULL);
+
+	temp_downtime = find_host_downtime(host_downtime_id);
+	ck_assert(temp_downtime != NULL);
+	ck_assert_str_eq(TARGET_HOST_NAME, temp_downtime->host_name);
+	ck_assert_int_eq(downtime_comment_id, temp_downtime->comment_id);
+	ck_assert_int_eq(now - 30, temp_downtime->entry_time);
+	ck_assert_int_eq(now + 3600, temp_downtime->start_time);
+	ck_assert_int_eq(now + 7200, temp_downtime->end_time);
+	ck_assert_int_eq(TRUE, temp_downtime->fixed);
+	ck_assert_int_eq(3600, temp_downtime->duration);
+	ck_assert_str_eq("host author", temp_downtime->author);
+	ck_assert_str_eq("host downtime", temp_downtime->comment);
+
+	temp_downtime = find_service_downtime(service_downtime_id);
+	ck_assert(temp_downtime != NULL);
+	ck_assert_str_eq(TARGET_HOST_NAME, temp_downtime->host_name);
+	ck_assert_str_eq(TARGET_SERVICE_NAME, temp_downtime->service_description);
+	ck_assert_int_eq(now - 40, temp_downtime->entry_time);
+	ck_assert_int_eq(now + 3600, temp_downtime->start_time);
+	ck_assert_int_eq(now + 7200, temp_downtime->end_time);
+	ck_assert_int_eq(FALSE, temp_downtime->fixed);
+	ck_assert_int_eq(1800, temp_downtime->duration);
+	ck_assert_str_eq("service author", temp_downtime->author);
+	ck_assert_str_eq("service downtime", temp_downtime->comment);
+
+	free_comment_data();
+	free_downtime_data();
+}
+END_TEST
+
+START_TEST(retention_data_binary)
+{
+	svc->current_state = STATE_CRITICAL;
+	svc->plugin_output = nm_strdup("CRITICAL - binary");
+	hst->current_state = STATE_DOWN;
+
+	binary_retention = TRUE;
+	ck_assert(OK == save_state_information(0));
+	ck_assert(xrdb_is_binary(retention_file));
+
+	teardown_objects();
+	setup_objects();
+
+	ck_assert(OK == read_initial_state_information());
+	ck_assert_int_eq(STATE_CRITICAL, svc->current_state);
+	ck_assert_str_eq("CRITICAL - binary", svc->plugin_output);
+	ck_assert_int_eq(STATE_DOWN, hst->current_state);
+}
+END_TEST
+
+START_TEST(retention_data_converted)
+{
+	svc->plugin_output = nm_strdup("OK - converted");
+
+	/* a text file is read even if we want binary ones... */
+	ck_assert(OK == save_state_information(0));
+	ck_assert(!xrdb_is_binary(retention_file));
+	binary_retention = TRUE;
+
+	teardown_objects();
+	setup_objects();
+	ck_assert(OK == read_initial_state_information());
+	ck_assert_str_eq("OK - converted", svc->plugin_output);
+
+	/* ...and written as one the next time */
+	ck_assert(OK == save_state_information(0));
+	ck_assert(xrdb_is_binary(retention_file));
+
+	/* and back */
+	binary_retention = FALSE;
+	teardown_objects();
+	setup_objects();
+	ck_assert(OK == read_initial_state_information());
+	ck_assert_str_eq("OK - converted", svc->plugin_output);
+	ck_assert(OK == save_state_information(0));
+	ck_assert(!xrdb_is_binary(retention_file));
+}
+END_TEST
+
+START_TEST(retention_data_binary_config_changed)
+{
+	hst->plugin_output = nm_strdup("DOWN - moved");
+	svc->plugin_output = nm_strdup("OK - still here");
+
+	binary_retention = TRUE;
+	ck_assert(OK == save_state_information(0));
+
+	/* the ids in the file are no longer right, so names are used */
+	teardown_objects();
+	setup_objects_with_new_host();
+	ck_assert_int_eq(1, hst->id);
+
+	ck_assert(OK == read_initial_state_information());
+	ck_assert_str_eq("DOWN - moved", hst->plugin_output);
+	ck_assert_str_eq("OK - still here", svc->plugin_output);
+	ck_assert(host_ary[0]->plugin_output == NULL);
+}
+END_TEST
+
+/* overwrites the record count in the header of a binary retention file */
+static void set_binary_records(uint64_t records)
+{
+	FILE *fp = fopen(retention_file, "r+");
+
+	ck_assert(fp != NULL);
+	ck_assert_int_eq(0, fseek(fp, offsetof(struct xrdb_header, records), SEEK_SET));
+	ck_assert_int_eq(1, fwrite(&records, sizeof(records), 1, fp));
+	ck_assert_int_eq(0, fclose(fp));
+}
+
+START_TEST(retention_data_binary_corrupt_header)
+{
+	struct xrdb_header hdr;
+	FILE *fp;
+
+	svc->plugin_output = nm_strdup("OK - saved");
+
+	binary_retention = TRUE;
+	ck_assert(OK == save_state_information(0));
+	fp = fopen(retention_file, "r");
+	ck_assert(fp != NULL);
+	ck_assert_int_eq(1, fread(&hdr, sizeof(hdr), 1, fp));
+	fclose(fp);
+	teardown_objects();
+	setup_objects();
+
+	/* wraps around when multiplied by the size of an offset */
+	set_binary_records(UINT64_MAX / sizeof(uint64_t) + 1);
+	ck_assert(ERROR == read_initial_state_information());
+
+	/* too many to allocate */
+	set_binary_records(UINT64_MAX / 2);
+	ck_assert(ERROR == read_initial_state_information());
+
+	/* more than fit before the strings */
+	set_binary_records((hdr.strings_offset - hdr.header_size) / sizeof(struct xrdb_record) + 1);
+	ck_assert(ERROR == read_initial_state_information());
+	ck_assert(svc->plugin_output == NULL);
+
+	/* and the file is fine with the right count */
+	set_binary_records(hdr.records);
+	ck_assert(OK == read_initial_state_information());
+	ck_assert_str_eq("OK - saved", svc->plugin_output);
+}
+END_TEST
+
+START_TEST(retention_data_background_autosave)
+{
+	struct nm_event_execution_properties evprop = { EVENT_EXEC_NORMAL, EVENT_TYPE_TIMED, NULL, { { NULL, 0 } } };
+	struct bg_writer_stats before, after;
+
+	svc->plugin_output = nm_strdup("OK - saved in the background");
+	background_retention_saves = TRUE;
+	retention_fsync = FALSE;
+
+	get_retention_save_stats(&before);
+	save_state_information_eventhandler(&evprop);
+
+	/* there's no io broker here, so the writer was waited for */
+	get_retention_save_stats(&after);
+	ck_assert_int_eq(0, after.in_progress);
+	ck_assert_int_eq(before.writes + 1, after.writes);
+	ck_assert_int_eq(before.failed, after.failed);
+
+	teardown_objects();
+	setup_objects();
+	ck_assert(OK == read_initial_state_information());
+	ck_assert_str_eq("OK - saved in the background", svc->plugin_output);
+}
+END_TEST
+
 Suite *
 retention_suite(void)
 {
@@ -115,15 +819,34 @@ retention_suite(void)
 
 	TCase *tc_retention_data_for_hosts_long_output = tcase_create("Retention data for hosts");
 	TCase *tc_retention_data_for_services_long_output = tcase_create("Retention data for services");
+	TCase *tc_retention_data_text = tcase_create("Text retention data");
+	TCase *tc_retention_data_binary = tcase_create("Binary retention data");
+	TCase *tc_retention_data_background = tcase_create("Background retention saves");
 
 	tcase_add_checked_fixture(tc_retention_data_for_hosts_long_output, setup, teardown);
 	tcase_add_checked_fixture(tc_retention_data_for_services_long_output, setup, teardown);
+	tcase_add_checked_fixture(tc_retention_data_text, setup, teardown);
+	tcase_add_checked_fixture(tc_retention_data_binary, setup, teardown);
+	tcase_add_checked_fixture(tc_retention_data_background, setup, teardown);
 
 	tcase_add_test(tc_retention_data_for_hosts_long_output, retention_data_for_hosts_long_output);
 	tcase_add_test(tc_retention_data_for_services_long_output, retention_data_for_services_long_output);
+	tcase_add_test(tc_retention_data_text, retention_data_text_program);
+	tcase_add_test(tc_retention_data_text, retention_data_text_host);
+	tcase_add_test(tc_retention_data_text, retention_data_text_service);
+	tcase_add_test(tc_retention_data_text, retention_data_text_contact);
+	tcase_add_test(tc_retention_data_text, retention_data_text_comments_and_downtime);
+	tcase_add_test(tc_retention_data_binary, retention_data_binary);
+	tcase_add_test(tc_retention_data_binary, retention_data_converted);
+	tcase_add_test(tc_retention_data_binary, retention_data_binary_config_changed);
+	tcase_add_test(tc_retention_data_binary, retention_data_binary_corrupt_header);
+	tcase_add_test(tc_retention_data_background, retention_data_background_autosave);
 
 	suite_add_tcase(s, tc_retention_data_for_hosts_long_output);
 	suite_add_tcase(s, tc_retention_data_for_services_long_output);
+	suite_add_tcase(s, tc_retention_data_text);
+	suite_add_tcase(s, tc_retention_data_binary);
+	suite_add_tcase(s, tc_retention_data_background);
 	return s;
 }
 
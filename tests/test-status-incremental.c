@@ -0,0 +1,220 @@
+#include <check.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "naemon/objects_service.h"
+#include "naemon/objects_command.h"
+#include "naemon/objects_contact.h"
+#include "naemon/objects_host.h"
+#include "naemon/statusdata.h"
+#include "naemon/xsdincremental.h"
+#include "naemon/common.h"
+#include "naemon/globals.h"
+#include "naemon/nm_alloc.h"
+
+#define NUM_HOSTS 10
+#define SERVICES_PER_HOST 5
+#define NUM_CONTACTS 2
+
+static command *cmd;
+static host *hosts[NUM_HOSTS];
+static service *services[NUM_HOSTS * SERVICES_PER_HOST];
+static contact *contacts[NUM_CONTACTS];
+static char status_path[] = "/tmp/test-status-incremental.XXXXXX";
+
+/* what a reader sees */
+static struct xsdi_header *map_status_file(void)
+{
+	struct xsdi_header *hdr;
+	struct stat st;
+	int fd;
+
+	fd = open(status_path, O_RDONLY);
+	ck_assert(fd >= 0);
+	ck_assert_int_eq(0, fstat(fd, &st));
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	ck_assert(hdr != MAP_FAILED);
+	ck_assert_int_eq(0, xsdi_check_header(hdr, st.st_size));
+
+	return hdr;
+}
+
+void setup(void)
+{
+	char name[64];
+	int i, j, fd;
+
+	init_objects_command(1);
+	cmd = create_command("my_command", "/bin/true");
+	ck_assert(cmd != NULL);
+	register_command(cmd);
+
+	init_objects_host(NUM_HOSTS);
+	init_objects_service(NUM_HOSTS * SERVICES_PER_HOST);
+	for (i = 0; i < NUM_HOSTS; i++) {
+		sprintf(name, "host%d", i);
+		hosts[i] = create_host(name);
+		ck_assert(hosts[i] != NULL);
+		hosts[i]->check_command_ptr = cmd;
+		register_host(hosts[i]);
+
+		for (j = 0; j < SERVICES_PER_HOST; j++) {
+			sprintf(name, "service%d", j);
+			services[i * SERVICES_PER_HOST + j] = create_service(hosts[i], name);
+			ck_assert(services[i * SERVICES_PER_HOST + j] != NULL);
+			services[i * SERVICES_PER_HOST + j]->check_command_ptr = cmd;
+			register_service(services[i * SERVICES_PER_HOST + j]);
+		}
+	}
+
+	init_objects_contact(NUM_CONTACTS);
+	for (i = 0; i < NUM_CONTACTS; i++) {
+		sprintf(name, "contact%d", i);
+		contacts[i] = create_contact(name);
+		ck_assert(contacts[i] != NULL);
+		register_contact(contacts[i]);
+	}
+
+	strcpy(status_path + strlen(status_path) - 6, "XXXXXX");
+	fd = mkstemp(status_path);
+	ck_assert(fd >= 0);
+	close(fd);
+	incremental_status_file = nm_strdup(status_path);
+	ck_assert_int_eq(OK, xsdincremental_initialize_status_data());
+}
+
+void teardown(void)
+{
+	ck_assert_int_eq(OK, xsdincremental_cleanup_status_data(TRUE));
+	destroy_objects_contact();
+	destroy_objects_service();
+	destroy_objects_host();
+	destroy_objects_command();
+}
+
+START_TEST(incremental_records)
+{
+	struct xsdi_header *hdr;
+	struct xsdi_record rec;
+	struct xsdi_journal_entry entry;
+	service *svc = services[7];
+	uint64_t generation;
+	int i;
+
+	hdr = map_status_file();
+	ck_assert_int_eq(NUM_HOSTS, hdr->count[XSDI_HOST]);
+	ck_assert_int_eq(NUM_HOSTS * SERVICES_PER_HOST, hdr->count[XSDI_SERVICE]);
+	ck_assert_int_eq(NUM_CONTACTS, hdr->count[XSDI_CONTACT]);
+
+	/* names are there from the start */
+	ck_assert_int_eq(0, xsdi_read_record(hdr, XSDI_SERVICE, svc->id, &rec));
+	ck_assert_str_eq(svc->host_name, xsdi_string(hdr, rec.name));
+	ck_assert_str_eq(svc->description, xsdi_string(hdr, rec.description));
+	ck_assert(xsdi_string(hdr, XSDI_NO_STRING) == NULL);
+	ck_assert_int_eq(EINVAL, xsdi_read_record(hdr, XSDI_CONTACT, NUM_CONTACTS, &rec));
+
+	/* the first update writes everything */
+	ck_assert_int_eq(OK, xsdincremental_save_status_data());
+	ck_assert_int_eq(NUM_HOSTS + NUM_HOSTS * SERVICES_PER_HOST + NUM_CONTACTS, hdr->generation);
+	ck_assert(hdr->last_update != 0);
+	generation = hdr->generation;
+
+	/* later ones only what changed */
+	svc->current_state = STATE_CRITICAL;
+	svc->plugin_output = nm_strdup("CRITICAL - it broke");
+	update_service_status(svc, TRUE);
+	update_service_status(svc, TRUE);
+	contacts[1]->host_notifications_enabled = FALSE;
+	update_contact_status(contacts[1], TRUE);
+	ck_assert_int_eq(OK, xsdincremental_save_status_data());
+	ck_assert_int_eq(generation + 2, hdr->generation);
+
+	ck_assert_int_eq(0, xsdi_read_journal(hdr, generation, &entry));
+	ck_assert_int_eq(XSDI_SERVICE, entry.type);
+	ck_assert_int_eq(svc->id, entry.id);
+	ck_assert_int_eq(0, xsdi_read_journal(hdr, generation + 1, &entry));
+	ck_assert_int_eq(XSDI_CONTACT, entry.type);
+	ck_assert_int_eq(1, entry.id);
+	ck_assert_int_eq(EAGAIN, xsdi_read_journal(hdr, generation + 2, &entry));
+
+	ck_assert_int_eq(0, xsdi_read_record(hdr, XSDI_SERVICE, svc->id, &rec));
+	ck_assert_int_eq(STATE_CRITICAL, rec.status.check.current_state);
+	ck_assert_str_eq("CRITICAL - it broke", rec.status.check.plugin_output);
+	ck_assert_int_eq(0, xsdi_read_record(hdr, XSDI_CONTACT, 1, &rec));
+	ck_assert_int_eq(FALSE, rec.status.contact.host_notifications_enabled);
+
+	/* a reader that falls a whole journal behind has to start over */
+	for (i = 0; i < NUM_HOSTS * SERVICES_PER_HOST; i++)
+		update_service_status(services[i], TRUE);
+	while (hdr->generation < generation + hdr->journal_size + 1) {
+		for (i = 0; i < NUM_HOSTS; i++)
+			update_host_status(hosts[i], TRUE);
+		ck_assert_int_eq(OK, xsdincremental_save_status_data());
+	}
+	ck_assert_int_eq(ESTALE, xsdi_read_journal(hdr, generation, &entry));
+	ck_assert_int_eq(0, xsdi_read_journal(hdr, hdr->generation - 1, &entry));
+	ck_assert_int_eq(XSDI_HOST, entry.type);
+
+	munmap(hdr, hdr->size);
+}
+END_TEST
+
+START_TEST(incremental_torn_record)
+{
+	struct xsdi_header *hdr;
+	struct xsdi_record rec, *mapped;
+	int fd;
+
+	ck_assert_int_eq(OK, xsdincremental_save_status_data());
+
+	/* pretend the writer died halfway through a record */
+	fd = open(status_path, O_RDWR);
+	ck_assert(fd >= 0);
+	hdr = map_status_file();
+	mapped = mmap(NULL, hdr->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	ck_assert(mapped != MAP_FAILED);
+	mapped = (struct xsdi_record *)((char *)mapped + hdr->offset[XSDI_HOST] + 3 * hdr->record_size);
+	mapped->seq++;
+
+	ck_assert_int_eq(EAGAIN, xsdi_read_record(hdr, XSDI_HOST, 3, &rec));
+	ck_assert_int_eq(0, xsdi_read_record(hdr, XSDI_HOST, 4, &rec));
+
+	/* the next write of the record makes it consistent again */
+	update_host_status(hosts[3], TRUE);
+	ck_assert_int_eq(OK, xsdincremental_save_status_data());
+	ck_assert_int_eq(0, xsdi_read_record(hdr, XSDI_HOST, 3, &rec));
+	ck_assert_str_eq(hosts[3]->name, xsdi_string(hdr, rec.name));
+
+	munmap((char *)mapped - hdr->offset[XSDI_HOST] - 3 * hdr->record_size, hdr->size);
+	munmap(hdr, hdr->size);
+}
+END_TEST
+
+Suite *status_incremental_suite(void)
+{
+	Suite *s = suite_create("Incremental status file");
+	TCase *tc = tcase_create("Incremental status file");
+
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, incremental_records);
+	tcase_add_test(tc, incremental_torn_record);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed = 0;
+	Suite *s = status_incremental_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_ENV);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
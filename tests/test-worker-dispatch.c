@@ -0,0 +1,477 @@
+#include <check.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "naemon/workers.c"
+
+/*
+ * These tests hand jobs to a set of fake workers that never run
+ * anything, so the dispatch policies can be checked against known
+ * worker loads.
+ */
+
+#define NUM_WORKERS 4
+#define SIM_TICKS 200
+
+static struct wproc_worker *wps[NUM_WORKERS];
+
+static void dispatch_setup(void)
+{
+	int i;
+
+	specialized_workers = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+	workers.len = NUM_WORKERS;
+	workers.idx = 0;
+	workers.wps = nm_calloc(NUM_WORKERS, sizeof(struct wproc_worker *));
+	for (i = 0; i < NUM_WORKERS; i++) {
+		struct wproc_worker *wp = nm_calloc(1, sizeof(*wp));
+		wp->name = nm_strdup(mkstr("worker %d", i));
+		wp->max_jobs = 1000;
+		wp->jobs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, destroy_job);
+		wp->wp_list = &workers;
+		workers.wps[i] = wps[i] = wp;
+	}
+	worker_dispatch_policy = WPROC_DISPATCH_ROUND_ROBIN;
+}
+
+static void dispatch_teardown(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_WORKERS; i++) {
+		/* retired workers have been freed already */
+		if (!wps[i])
+			continue;
+		g_hash_table_destroy(wps[i]->jobs);
+		nm_free(wps[i]->name);
+		nm_free(wps[i]);
+	}
+	nm_free(workers.wps);
+	workers.len = 0;
+	g_hash_table_destroy(specialized_workers);
+	specialized_workers = NULL;
+	worker_dispatch_policy = DEFAULT_WORKER_DISPATCH_POLICY;
+	if (core_worker_pids) {
+		g_hash_table_destroy(core_worker_pids);
+		core_worker_pids = NULL;
+	}
+	memset(&autoscale, 0, sizeof(autoscale));
+	retiring_workers = NULL;
+	wproc_num_workers_online = wproc_num_workers_desired = 0;
+}
+
+static int worker_index(struct wproc_worker *wp)
+{
+	int i;
+
+	for (i = 0; i < NUM_WORKERS; i++) {
+		if (wps[i] == wp)
+			return i;
+	}
+	return -1;
+}
+
+/* gives worker idx num more outstanding jobs */
+static void load_worker(int idx, unsigned int num)
+{
+	while (num--) {
+		struct wproc_job *job = nm_calloc(1, sizeof(*job));
+		job->wp = wps[idx];
+		job->id = get_job_id(wps[idx]);
+		job->command = nm_strdup("/bin/true");
+		g_hash_table_insert(wps[idx]->jobs, GINT_TO_POINTER(job->id), job);
+	}
+}
+
+START_TEST(policy_names)
+{
+	ck_assert_int_eq(WPROC_DISPATCH_ROUND_ROBIN, wproc_dispatch_policy_by_name("round-robin"));
+	ck_assert_int_eq(WPROC_DISPATCH_LEAST_LOADED, wproc_dispatch_policy_by_name("least-loaded"));
+	ck_assert_int_eq(WPROC_DISPATCH_TWO_CHOICES, wproc_dispatch_policy_by_name("two-choices"));
+	ck_assert_int_eq(WPROC_DISPATCH_AFFINITY, wproc_dispatch_policy_by_name("affinity"));
+	ck_assert_int_eq(-1, wproc_dispatch_policy_by_name("random"));
+}
+END_TEST
+
+START_TEST(round_robin)
+{
+	int i;
+
+	for (i = 1; i <= NUM_WORKERS * 2; i++)
+		ck_assert_int_eq(i % NUM_WORKERS, worker_index(get_worker("/bin/true")));
+
+	/* full workers are skipped */
+	wps[1]->max_jobs = 1;
+	load_worker(1, 1);
+	ck_assert_int_eq(2, worker_index(get_worker("/bin/true")));
+	ck_assert_int_eq(3, worker_index(get_worker("/bin/true")));
+	ck_assert_int_eq(0, worker_index(get_worker("/bin/true")));
+	ck_assert_int_eq(2, worker_index(get_worker("/bin/true")));
+}
+END_TEST
+
+START_TEST(least_loaded)
+{
+	worker_dispatch_policy = WPROC_DISPATCH_LEAST_LOADED;
+	load_worker(0, 5);
+	load_worker(1, 2);
+	load_worker(2, 7);
+	load_worker(3, 2);
+	ck_assert_int_eq(1, worker_index(get_worker("/bin/true")));
+	/* ties go to the next worker after the last pick */
+	ck_assert_int_eq(3, worker_index(get_worker("/bin/true")));
+	load_worker(3, 1);
+	ck_assert_int_eq(1, worker_index(get_worker("/bin/true")));
+
+	/* a full worker never gets a job, no matter how idle it looks */
+	wps[1]->max_jobs = 2;
+	ck_assert_int_eq(3, worker_index(get_worker("/bin/true")));
+}
+END_TEST
+
+START_TEST(two_choices)
+{
+	int i, picked[NUM_WORKERS] = { 0 };
+
+	worker_dispatch_policy = WPROC_DISPATCH_TWO_CHOICES;
+	srand(4711);
+	load_worker(0, 10);
+	load_worker(1, 10);
+	load_worker(2, 10);
+	for (i = 0; i < 1000; i++)
+		picked[worker_index(get_worker("/bin/true"))]++;
+	/* the idle worker wins every pair it's in, which is half of them */
+	ck_assert_int_gt(picked[3], 400);
+	ck_assert_int_lt(picked[3], 600);
+
+	/* and gets everything once the others are full */
+	for (i = 0; i < 3; i++)
+		wps[i]->max_jobs = 10;
+	for (i = 0; i < 10; i++)
+		ck_assert_int_eq(3, worker_index(get_worker("/bin/true")));
+}
+END_TEST
+
+START_TEST(affinity)
+{
+	struct wproc_worker *home;
+	int i;
+
+	worker_dispatch_policy = WPROC_DISPATCH_AFFINITY;
+	home = get_worker("/usr/lib/plugins/check_ping -H host1");
+	ck_assert(home != NULL);
+	for (i = 0; i < 10; i++) {
+		ck_assert(home == get_worker("/usr/lib/plugins/check_ping -H host1"));
+		/* only the plugin matters, not its arguments */
+		ck_assert(home == get_worker(mkstr("/usr/lib/plugins/check_ping -H host%d", i)));
+	}
+
+	/* a worker carrying well over its share gives the plugin up */
+	load_worker(worker_index(home), 20);
+	ck_assert(home != get_worker("/usr/lib/plugins/check_ping -H host1"));
+}
+END_TEST
+
+START_TEST(latency_histogram)
+{
+	struct wproc_job job;
+	struct timeval now;
+	unsigned int i, total = 0;
+
+	memset(&job, 0, sizeof(job));
+	gettimeofday(&now, NULL);
+
+	job.dispatched = now;
+	record_latency(wps[0], &job);
+	ck_assert_int_eq(1, wps[0]->latency[0]);
+
+	job.dispatched.tv_sec = now.tv_sec - 1;
+	record_latency(wps[0], &job);
+	/* 1000ms lands in the under-1024ms bucket */
+	ck_assert_int_eq(1, wps[0]->latency[10]);
+
+	job.dispatched.tv_sec = now.tv_sec - 86400;
+	record_latency(wps[0], &job);
+	ck_assert_int_eq(1, wps[0]->latency[WPROC_LATENCY_BUCKETS - 1]);
+
+	for (i = 0; i < WPROC_LATENCY_BUCKETS; i++)
+		total += wps[0]->latency[i];
+	ck_assert_int_eq(3, total);
+}
+END_TEST
+
+START_TEST(wpstats)
+{
+	int sv[2];
+	char buf[4096] = { 0 };
+	char query[] = "wpstats";
+	ssize_t len;
+
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	worker_dispatch_policy = WPROC_DISPATCH_LEAST_LOADED;
+	load_worker(2, 3);
+	wps[2]->latency[1] = 7;
+	ck_assert_int_eq(0, wproc_query_handler(sv[0], query, sizeof(query) - 1));
+	len = read(sv[1], buf, sizeof(buf) - 1);
+	ck_assert_int_gt(len, 0);
+	ck_assert_msg(strstr(buf, "name=worker 2;pid=0;jobs_running=3;jobs_started=0;policy=least-loaded;latency=0,7,0,0,0,0,0,0,0,0,0,0,0,0,0,0\n") != NULL,
+	              "Unexpected wpstats output: %s", buf);
+	close(sv[0]);
+	close(sv[1]);
+}
+END_TEST
+
+/*
+ * Every fourth job runs for a long time, the rest finish right away.
+ * Returns the most outstanding jobs any single worker ended up with.
+ */
+static unsigned int simulate(int policy)
+{
+	struct {
+		struct wproc_worker *wp;
+		int id;
+		int done;
+	} *running;
+	unsigned int tick, i, num = 0, most = 0;
+
+	worker_dispatch_policy = policy;
+	running = nm_calloc(SIM_TICKS * NUM_WORKERS, sizeof(*running));
+	for (tick = 0; tick < SIM_TICKS; tick++) {
+		for (i = 0; i < num; i++) {
+			if (running[i].wp && running[i].done == (int)tick) {
+				g_hash_table_remove(running[i].wp->jobs, GINT_TO_POINTER(running[i].id));
+				running[i].wp = NULL;
+			}
+		}
+		for (i = 0; i < NUM_WORKERS; i++) {
+			struct wproc_job *job = create_job(NULL, NULL, 60, i == 0 ? "/plugins/check_slow" : "/plugins/check_fast");
+			ck_assert(job != NULL);
+			running[num].wp = job->wp;
+			running[num].id = job->id;
+			running[num].done = tick + (i == 0 ? SIM_TICKS : 1);
+			num++;
+		}
+	}
+	for (i = 0; i < NUM_WORKERS; i++) {
+		if (wproc_load(wps[i]) > most)
+			most = wproc_load(wps[i]);
+	}
+	nm_free(running);
+	return most;
+}
+
+START_TEST(slow_plugins_spread)
+{
+	unsigned int rr, ll, tc, aff;
+
+	srand(4711);
+	rr = simulate(WPROC_DISPATCH_ROUND_ROBIN);
+	dispatch_teardown();
+	dispatch_setup();
+	ll = simulate(WPROC_DISPATCH_LEAST_LOADED);
+	dispatch_teardown();
+	dispatch_setup();
+	tc = simulate(WPROC_DISPATCH_TWO_CHOICES);
+	dispatch_teardown();
+	dispatch_setup();
+	aff = simulate(WPROC_DISPATCH_AFFINITY);
+
+	printf("most jobs on one worker after %d ticks: round-robin %u, least-loaded %u, two-choices %u, affinity %u\n",
+	       SIM_TICKS, rr, ll, tc, aff);
+	/* round-robin piles every slow job onto the same worker */
+	ck_assert_int_ge(rr, SIM_TICKS);
+	ck_assert_int_le(ll, SIM_TICKS / NUM_WORKERS + 2);
+	ck_assert_int_lt(tc, rr);
+	ck_assert_int_lt(aff, rr);
+}
+END_TEST
+
+START_TEST(autoscale_decisions)
+{
+	int i;
+
+	autoscale.min = 2;
+	autoscale.max = 4;
+	ck_assert_int_eq(1, autoscale_decision(1, 0, 0));
+	ck_assert_int_eq(-1, autoscale_decision(5, 0, 0));
+	ck_assert_int_eq(1, autoscale_decision(3, WPROC_AUTOSCALE_JOBS_HIGH + 1, 0));
+	ck_assert_int_eq(1, autoscale_decision(3, 0, WPROC_AUTOSCALE_LATENCY_HIGH * 2));
+	ck_assert_int_eq(0, autoscale_decision(4, WPROC_AUTOSCALE_JOBS_HIGH + 1, 0));
+	ck_assert_int_eq(0, autoscale_decision(3, WPROC_AUTOSCALE_JOBS_LOW, 0));
+
+	/* it takes a few quiet rounds in a row to retire a worker */
+	for (i = 1; i < WPROC_AUTOSCALE_QUIET_ROUNDS; i++)
+		ck_assert_int_eq(0, autoscale_decision(3, 1, 0));
+	ck_assert_int_eq(0, autoscale_decision(3, WPROC_AUTOSCALE_JOBS_LOW, 0));
+	for (i = 1; i < WPROC_AUTOSCALE_QUIET_ROUNDS; i++)
+		ck_assert_int_eq(0, autoscale_decision(3, 1, 0));
+	ck_assert_int_eq(-1, autoscale_decision(3, 1, 0));
+
+	/* but never below the minimum */
+	for (i = 0; i < WPROC_AUTOSCALE_QUIET_ROUNDS * 2; i++)
+		ck_assert_int_eq(0, autoscale_decision(2, 0, 0));
+}
+END_TEST
+
+START_TEST(autoscale_spawn)
+{
+	int i, status;
+
+	naemon_binary_path = "/bin/true";
+	core_worker_pids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	autoscale.min = 1;
+	autoscale.max = NUM_WORKERS + 1;
+	for (i = 0; i < NUM_WORKERS; i++) {
+		wps[i]->core = 1;
+		load_worker(i, 10);
+	}
+
+	/* not busy enough to need another worker */
+	autoscale_workers();
+	ck_assert_int_eq(0, autoscale.spawned);
+
+	/* but slow to get jobs started */
+	autoscale.latency_sum = WPROC_AUTOSCALE_LATENCY_HIGH * 8;
+	autoscale.latency_count = 4;
+	autoscale_workers();
+	ck_assert_int_eq(1, autoscale.spawned);
+	ck_assert_int_eq(1, g_hash_table_size(core_worker_pids));
+	ck_assert_int_eq(1, autoscale.num_events);
+	ck_assert_str_eq("spawn", autoscale.events[0].action);
+	ck_assert_int_eq(NUM_WORKERS, autoscale.events[0].workers);
+
+	/* nothing more happens until the new one has registered */
+	load_worker(0, WPROC_AUTOSCALE_JOBS_HIGH * NUM_WORKERS);
+	autoscale_workers();
+	ck_assert_int_eq(1, autoscale.spawned);
+
+	ck_assert_int_eq(autoscale.events[0].pid, waitpid(autoscale.events[0].pid, &status, 0));
+	naemon_binary_path = NULL;
+}
+END_TEST
+
+/* what a core worker sends when a job is done */
+static void send_result(int sd, int job_id)
+{
+	struct kvvec *kvv = kvvec_create(4);
+	struct kvvec_buf *kvvb;
+
+	kvvec_addkv_str(kvv, "job_id", (char *)mkstr("%d", job_id));
+	kvvec_addkv_str(kvv, "wait_status", "0");
+	kvvb = build_kvvec_buf(kvv);
+	ck_assert_int_eq(kvvb->bufsize, write(sd, kvvb->buf, kvvb->bufsize));
+	free(kvvb->buf);
+	free(kvvb);
+	kvvec_destroy(kvv, 0);
+}
+
+START_TEST(retire_drains_jobs)
+{
+	struct wproc_worker *wp = wps[3];
+	struct timed_event_pool_stats stats;
+	char buf[4096] = { 0 };
+	char query[] = "scaling";
+	int i, sv[2], status;
+	pid_t pid;
+
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	nagios_iobs = iobroker_create();
+	nagios_pid = getpid();
+	init_event_queue();
+	if (!(pid = fork())) {
+		pause();
+		_exit(0);
+	}
+	wp->pid = pid;
+	wp->sd = sv[0];
+	wp->bq = nm_bufferqueue_create();
+	for (i = 0; i < NUM_WORKERS; i++)
+		wps[i]->core = 1;
+	iobroker_register(nagios_iobs, wp->sd, wp, handle_worker_result);
+	wproc_num_workers_online = NUM_WORKERS;
+	load_worker(3, 2);
+
+	retire_worker(wp);
+	ck_assert_int_eq(NUM_WORKERS - 1, workers.len);
+	ck_assert_int_eq(NUM_WORKERS - 1, wproc_num_workers_online);
+	ck_assert(retiring_workers == wp);
+	for (i = 0; i < NUM_WORKERS * 2; i++)
+		ck_assert(get_worker("/bin/true") != wp);
+
+	/* it stays around until its last job is done */
+	send_result(sv[1], 0);
+	handle_worker_result(wp->sd, 0, wp);
+	ck_assert(retiring_workers == wp);
+	ck_assert_int_eq(1, g_hash_table_size(wp->jobs));
+	ck_assert_int_eq(0, waitpid(pid, &status, WNOHANG));
+
+	wps[3] = NULL;
+	send_result(sv[1], 1);
+	handle_worker_result(wp->sd, 0, wp);
+	ck_assert(retiring_workers == NULL);
+	ck_assert_int_eq(1, autoscale.retired);
+	ck_assert_int_eq(NUM_WORKERS - 1, wproc_num_workers_online);
+
+	/* it's reaped from an event, or right away if it was quick to die */
+	get_timed_event_pool_stats(&stats);
+	ck_assert(stats.in_use == 1 || waitpid(pid, &status, WNOHANG) < 0);
+	destroy_event_queue();
+	ck_assert_int_eq(-1, waitpid(pid, &status, WNOHANG));
+	ck_assert_int_eq(ECHILD, errno);
+
+	/* the worker's end went with it */
+	close(sv[1]);
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	ck_assert_int_eq(0, wproc_query_handler(sv[0], query, sizeof(query) - 1));
+	ck_assert_int_gt(read(sv[1], buf, sizeof(buf) - 1), 0);
+	ck_assert_msg(strstr(buf, "workers=3;pending=0;retiring=0;spawned=0;retired=1\n") != NULL,
+	              "Unexpected scaling output: %s", buf);
+	ck_assert_msg(strstr(buf, mkstr(";action=retired;pid=%d;workers=3;", pid)) != NULL,
+	              "Unexpected scaling output: %s", buf);
+	close(sv[0]);
+	close(sv[1]);
+	iobroker_destroy(nagios_iobs, 0);
+	nagios_iobs = NULL;
+}
+END_TEST
+
+Suite *worker_dispatch_suite(void)
+{
+	Suite *s = suite_create("Worker dispatch");
+	TCase *tc_policies = tcase_create("Dispatch policies");
+	TCase *tc_stats = tcase_create("Worker statistics");
+	TCase *tc_autoscale = tcase_create("Autoscaling");
+
+	tcase_add_checked_fixture(tc_policies, dispatch_setup, dispatch_teardown);
+	tcase_add_test(tc_policies, policy_names);
+	tcase_add_test(tc_policies, round_robin);
+	tcase_add_test(tc_policies, least_loaded);
+	tcase_add_test(tc_policies, two_choices);
+	tcase_add_test(tc_policies, affinity);
+	tcase_add_test(tc_policies, slow_plugins_spread);
+	suite_add_tcase(s, tc_policies);
+
+	tcase_add_checked_fixture(tc_stats, dispatch_setup, dispatch_teardown);
+	tcase_add_test(tc_stats, latency_histogram);
+	tcase_add_test(tc_stats, wpstats);
+	suite_add_tcase(s, tc_stats);
+
+	tcase_add_checked_fixture(tc_autoscale, dispatch_setup, dispatch_teardown);
+	tcase_add_test(tc_autoscale, autoscale_decisions);
+	tcase_add_test(tc_autoscale, autoscale_spawn);
+	tcase_add_test(tc_autoscale, retire_drains_jobs);
+	suite_add_tcase(s, tc_autoscale);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed = 0;
+	Suite *s = worker_dispatch_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_ENV);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,363 @@
+#include <check.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "naemon/workers.c"
+
+/*
+ * These tests play the part of a worker on one end of a socketpair
+ * and feed results to handle_worker_result() on the other, so both
+ * protocols can be checked and timed without running any plugins.
+ */
+
+#define BENCH_RESULTS 50000
+#define BENCH_BATCH 64
+
+static struct wproc_worker *wp;
+static int worker_sd;
+static unsigned int completed;
+static wproc_result last;
+static char last_outstd[256], last_command[256];
+
+static void result_cb(struct wproc_result *wpres, void *data, int flags)
+{
+	if (!wpres)
+		return;
+	completed++;
+	last = *wpres;
+	snprintf(last_outstd, sizeof(last_outstd), "%s", wpres->outstd ? wpres->outstd : "(null)");
+	snprintf(last_command, sizeof(last_command), "%s", wpres->command ? wpres->command : "(null)");
+}
+
+static void worker_setup(int binary)
+{
+	int sv[2];
+
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	nagios_iobs = iobroker_create();
+	ck_assert(nagios_iobs != NULL);
+	specialized_workers = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+	wp = nm_calloc(1, sizeof(*wp));
+	wp->name = nm_strdup("test worker");
+	wp->sd = sv[0];
+	wp->pid = getpid();
+	wp->max_jobs = BENCH_RESULTS * 2;
+	wp->bq = nm_bufferqueue_create();
+	wp->jobs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, destroy_job);
+	wp->binary = binary;
+	wp->wp_list = &workers;
+	nagios_pid = getpid();
+	workers.len = 1;
+	workers.wps = nm_calloc(1, sizeof(struct wproc_worker *));
+	workers.wps[0] = wp;
+	iobroker_register(nagios_iobs, wp->sd, wp, handle_worker_result);
+	wproc_num_workers_online = 1;
+	worker_sd = sv[1];
+	completed = 0;
+}
+
+static void binary_setup(void)
+{
+	worker_setup(TRUE);
+}
+
+static void text_setup(void)
+{
+	worker_setup(FALSE);
+}
+
+static void worker_teardown(void)
+{
+	close(worker_sd);
+	nm_bufferqueue_destroy(wp->bq);
+	g_hash_table_destroy(wp->jobs);
+	nm_free(wp->name);
+	nm_free(wp);
+	nm_free(workers.wps);
+	workers.len = 0;
+	g_hash_table_destroy(specialized_workers);
+	specialized_workers = NULL;
+	iobroker_destroy(nagios_iobs, IOBROKER_CLOSE_SOCKETS);
+	nagios_iobs = NULL;
+}
+
+/* what the core worker's finish_job() sends */
+static void add_text_result(GString *out, int job_id, const char *cmd, const char *outstd)
+{
+	struct kvvec *kvv = kvvec_create(20);
+	struct kvvec_buf *kvvb;
+	struct timeval start = { 1500000000, 123456 }, stop = { 1500000001, 654321 };
+	struct timeval utime = { 0, 1000 }, stime = { 0, 2000 };
+
+	kvvec_addkv_str(kvv, "job_id", (char *)mkstr("%d", job_id));
+	kvvec_addkv_str(kvv, "type", "0");
+	kvvec_addkv_str(kvv, "command", (char *)cmd);
+	kvvec_addkv_str(kvv, "timeout", "60");
+	kvvec_addkv_str(kvv, "wait_status", (char *)mkstr("%d", 2 << 8));
+	kvvec_addkv_tv(kvv, "start", &start);
+	kvvec_addkv_tv(kvv, "stop", &stop);
+	kvvec_addkv_str(kvv, "runtime", "1.530865");
+	kvvec_addkv_str(kvv, "exited_ok", "1");
+	kvvec_addkv_tv(kvv, "ru_utime", &utime);
+	kvvec_addkv_tv(kvv, "ru_stime", &stime);
+	kvvec_addkv_long(kvv, "ru_minflt", 300);
+	kvvec_addkv_long(kvv, "ru_majflt", 0);
+	kvvec_addkv_long(kvv, "ru_inblock", 0);
+	kvvec_addkv_long(kvv, "ru_oublock", 8);
+	kvvec_addkv_str(kvv, "outerr", "");
+	kvvec_addkv_str(kvv, "outstd", (char *)outstd);
+	kvvb = build_kvvec_buf(kvv);
+	g_string_append_len(out, kvvb->buf, kvvb->bufsize);
+	free(kvvb->buf);
+	free(kvvb);
+	kvvec_destroy(kvv, 0);
+}
+
+static void add_binary_result(GString *out, int job_id, const char *cmd, const char *outstd)
+{
+	struct wproc_frame frame;
+	struct wproc_result_frame res;
+
+	memset(&res, 0, sizeof(res));
+	res.job_id = job_id;
+	res.timeout = 60;
+	res.wait_status = 2 << 8;
+	res.exited_ok = 1;
+	res.start_sec = 1500000000;
+	res.start_usec = 123456;
+	res.stop_sec = 1500000001;
+	res.stop_usec = 654321;
+	res.ru_utime_usec = 1000;
+	res.ru_stime_usec = 2000;
+	res.ru_minflt = 300;
+	res.ru_oublock = 8;
+	res.command_len = strlen(cmd);
+	res.outstd_len = strlen(outstd);
+
+	frame.magic = WPROC_FRAME_MAGIC;
+	frame.type = WPROC_FRAME_RESULT;
+	frame.len = sizeof(res) + res.command_len + res.outstd_len + 4;
+	g_string_append_len(out, (char *)&frame, sizeof(frame));
+	g_string_append_len(out, (char *)&res, sizeof(res));
+	g_string_append_len(out, cmd, res.command_len + 1);
+	g_string_append_len(out, outstd, res.outstd_len + 1);
+	g_string_append_len(out, "\0\0", 2);
+}
+
+static void add_result(GString *out, int job_id, const char *cmd, const char *outstd)
+{
+	if (wp->binary)
+		add_binary_result(out, job_id, cmd, outstd);
+	else
+		add_text_result(out, job_id, cmd, outstd);
+}
+
+/* writes everything in buf and handles it as it comes in */
+static void deliver(const char *buf, size_t len, unsigned int expect)
+{
+	while (len > 0) {
+		ssize_t wrote = write(worker_sd, buf, len);
+		ck_assert(wrote > 0);
+		buf += wrote;
+		len -= wrote;
+		handle_worker_result(wp->sd, 0, wp);
+	}
+	while (completed < expect)
+		handle_worker_result(wp->sd, 0, wp);
+}
+
+static void check_one_result(void)
+{
+	struct wproc_job *job;
+	GString *out = g_string_new(NULL);
+
+	job = create_job(result_cb, NULL, 60, "/usr/lib/plugins/check_dummy 2 'it broke'");
+	ck_assert(job != NULL);
+	add_result(out, job->id, job->command, "CRITICAL - it broke\n|time=1s");
+	deliver(out->str, out->len, 1);
+	g_string_free(out, TRUE);
+
+	ck_assert_int_eq(1, completed);
+	ck_assert_int_eq(0, g_hash_table_size(wp->jobs));
+	ck_assert_int_eq(2, WEXITSTATUS(last.wait_status));
+	ck_assert_int_eq(1, last.exited_ok);
+	ck_assert_int_eq(0, last.error_code);
+	ck_assert_int_eq(60, last.timeout);
+	ck_assert_int_eq(1500000000, last.start.tv_sec);
+	ck_assert_int_eq(123456, last.start.tv_usec);
+	ck_assert_int_eq(1500000001, last.stop.tv_sec);
+	ck_assert_int_eq(654321, last.stop.tv_usec);
+	ck_assert_int_eq(1000, last.rusage.ru_utime.tv_usec);
+	ck_assert_int_eq(2000, last.rusage.ru_stime.tv_usec);
+	ck_assert_int_eq(300, last.rusage.ru_minflt);
+	ck_assert_int_eq(8, last.rusage.ru_oublock);
+	ck_assert_str_eq("CRITICAL - it broke\n|time=1s", last_outstd);
+	ck_assert_str_eq("/usr/lib/plugins/check_dummy 2 'it broke'", last_command);
+	ck_assert_str_eq("test worker", last.source);
+}
+
+START_TEST(text_result)
+{
+	check_one_result();
+}
+END_TEST
+
+START_TEST(binary_result)
+{
+	check_one_result();
+}
+END_TEST
+
+START_TEST(binary_partial_frames)
+{
+	struct wproc_job *job;
+	GString *out = g_string_new(NULL);
+	size_t i;
+
+	job = create_job(result_cb, NULL, 60, "/bin/true");
+	ck_assert(job != NULL);
+	add_binary_result(out, job->id, job->command, "OK");
+
+	/* one byte at a time, so every frame boundary case is hit */
+	for (i = 0; i < out->len; i++) {
+		ck_assert_int_eq(0, completed);
+		ck_assert_int_eq(1, write(worker_sd, out->str + i, 1));
+		handle_worker_result(wp->sd, 0, wp);
+	}
+	ck_assert_int_eq(1, completed);
+	ck_assert_str_eq("OK", last_outstd);
+	g_string_free(out, TRUE);
+}
+END_TEST
+
+START_TEST(binary_garbage)
+{
+	struct wproc_frame frame = { 0x1234, WPROC_FRAME_RESULT, 8 };
+	char buf;
+
+	ck_assert_int_eq(sizeof(frame), write(worker_sd, &frame, sizeof(frame)));
+	handle_worker_result(wp->sd, 0, wp);
+
+	/* we can't find the next frame after that, so the worker is cut off */
+	ck_assert_int_eq(0, wproc_num_workers_online);
+	ck_assert_int_eq(0, workers.len);
+	ck_assert_int_eq(0, read(worker_sd, &buf, 1));
+	workers.len = 1;
+}
+END_TEST
+
+static unsigned int callbacks;
+static void count_cb(struct wproc_result *wpres, void *data, int flags)
+{
+	callbacks++;
+}
+
+START_TEST(send_failures)
+{
+	callbacks = 0;
+	signal(SIGPIPE, SIG_IGN);
+
+	/* jobs that can't be sent fail right away, and the callback isn't run */
+	worker_dispatch_batching = TRUE;
+	iobroker_unregister(nagios_iobs, wp->sd);
+	ck_assert_int_eq(ERROR, wproc_run_callback("/bin/true", 60, count_cb, NULL, NULL));
+	ck_assert_int_eq(0, wp->batch.num_jobs);
+	iobroker_register(nagios_iobs, wp->sd, wp, handle_worker_result);
+
+	worker_dispatch_batching = FALSE;
+	close(worker_sd);
+	worker_sd = -1;
+	ck_assert_int_eq(ERROR, wproc_run_callback("/bin/true", 60, count_cb, NULL, NULL));
+
+	ck_assert_int_eq(0, callbacks);
+	ck_assert_int_eq(0, g_hash_table_size(wp->jobs));
+	worker_dispatch_batching = DEFAULT_WORKER_DISPATCH_BATCHING;
+}
+END_TEST
+
+static double bench_elapsed(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static void bench_results(void)
+{
+	GString **batches;
+	struct wproc_job *job;
+	struct timespec start;
+	unsigned int i, j, num_batches = BENCH_RESULTS / BENCH_BATCH;
+	double elapsed;
+
+	batches = nm_calloc(num_batches, sizeof(GString *));
+	for (i = 0; i < num_batches; i++) {
+		batches[i] = g_string_new(NULL);
+		for (j = 0; j < BENCH_BATCH; j++) {
+			job = create_job(result_cb, NULL, 60, "/usr/lib/plugins/check_ping -H 192.168.1.1 -w 100,20% -c 500,60%");
+			add_result(batches[i], job->id, job->command,
+			           "PING OK - Packet loss = 0%, RTA = 0.05 ms|rta=0.050000ms;100.000000;500.000000;0.000000 pl=0%;20;60;0");
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num_batches; i++)
+		deliver(batches[i]->str, batches[i]->len, (i + 1) * BENCH_BATCH);
+	elapsed = bench_elapsed(&start);
+
+	ck_assert_int_eq(num_batches * BENCH_BATCH, completed);
+	printf("%s protocol: %u results in %.3fs, %.0f results/s\n",
+	       wp->binary ? "binary" : "text", completed, elapsed, completed / elapsed);
+
+	for (i = 0; i < num_batches; i++)
+		g_string_free(batches[i], TRUE);
+	nm_free(batches);
+}
+
+START_TEST(text_benchmark)
+{
+	bench_results();
+}
+END_TEST
+
+START_TEST(binary_benchmark)
+{
+	bench_results();
+}
+END_TEST
+
+Suite *worker_protocol_suite(void)
+{
+	Suite *s = suite_create("Worker protocol");
+	TCase *tc_text = tcase_create("Text protocol");
+	TCase *tc_binary = tcase_create("Binary protocol");
+
+	tcase_add_checked_fixture(tc_text, text_setup, worker_teardown);
+	tcase_add_test(tc_text, text_result);
+	tcase_add_test(tc_text, send_failures);
+	tcase_add_test(tc_text, text_benchmark);
+	suite_add_tcase(s, tc_text);
+
+	tcase_add_checked_fixture(tc_binary, binary_setup, worker_teardown);
+	tcase_add_test(tc_binary, binary_result);
+	tcase_add_test(tc_binary, binary_partial_frames);
+	tcase_add_test(tc_binary, binary_garbage);
+	tcase_add_test(tc_binary, binary_benchmark);
+	suite_add_tcase(s, tc_binary);
+
+	return s;
+}
+
+int main(void)
+{
+	int number_failed = 0;
+	Suite *s = worker_protocol_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_ENV);
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
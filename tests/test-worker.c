@@ -1,6 +1,7 @@
 #include "naemon/events.h"
 #include "naemon/query-handler.h"
 #include "naemon/globals.h"
+#include "naemon/defaults.h"
 #include "naemon/workers.h"
 #include "naemon/commands.h"
 #include "naemon/logging.h"
@@ -69,7 +70,7 @@ static void run_main_loop(time_t runtime)
 	n = s = time(NULL);
 
 	while (((runtime - (n - s)) > 0) && completed_jobs == 0) {
-		iobroker_poll(nagios_iobs, 250);
+		event_poll();
 		n = time(NULL);
 	}
 }
@@ -230,6 +231,45 @@ START_TEST(worker_test_child_remains_to_cause_sideeffects)
 END_TEST
 
 
+START_TEST(worker_test_batched_dispatch)
+{
+	struct wrk_test j = {
+		"stdbuf -oL echo 'hello world'",
+		"hello world\n",
+		"",
+		0, 0, 3
+	};
+	time_t start;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		ck_assert_int_eq(0, wproc_run_callback(j.command, j.timeout, wrk_test_cb, &j, NULL));
+
+	start = time(NULL);
+	while (completed_jobs < 3 && time(NULL) < start + j.timeout + 10)
+		event_poll();
+	ck_assert_int_eq(3, completed_jobs);
+
+	/* all three were queued before the event loop got to send them */
+	test_debug_log_content(TRUE, "Sent a batch of 3 jobs");
+}
+END_TEST
+
+START_TEST(worker_test_unbatched_dispatch)
+{
+	struct wrk_test j = {
+		"stdbuf -oL echo 'hello world'",
+		"hello world\n",
+		"",
+		0, 0, 3
+	};
+	worker_dispatch_batching = FALSE;
+	run_worker_test(&j);
+	worker_dispatch_batching = DEFAULT_WORKER_DISPATCH_BATCHING;
+	test_debug_log_content(FALSE, "Sent a batch of");
+}
+END_TEST
+
 
 /*
  * Make sure that the lifecycle of the command worker is deterministic w.r.t
@@ -279,6 +319,7 @@ void worker_test_setup(void)
 	open_debug_log();
 
 	init_iobroker();
+	init_event_queue();
 	enable_timing_point = 1;
 	qh_socket_path = "/tmp/qh-socket";
 	qh_init(qh_socket_path);
@@ -294,6 +335,7 @@ void worker_test_setup(void)
 
 void worker_test_teardown(void)
 {
+	destroy_event_queue();
 	free_worker_memory(WPROC_FORCE);
 	deinit_iobroker();
 	qh_deinit(qh_socket_path);
@@ -332,6 +374,8 @@ Suite *worker_suite(void)
 	tcase_add_test(tc_worker_output, worker_test_no_timeout_log);
 	tcase_add_test(tc_worker_output, worker_test_output_stdout_and_timeout);
 	tcase_add_test(tc_worker_output, worker_test_child_remains_to_cause_sideeffects);
+	tcase_add_test(tc_worker_output, worker_test_batched_dispatch);
+	tcase_add_test(tc_worker_output, worker_test_unbatched_dispatch);
 	suite_add_tcase(s, tc_worker_output);
 
 	tc_command_worker = tcase_create("command worker tests");